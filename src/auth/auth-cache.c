@@ -4,6 +4,8 @@
 #include "array.h"
 #include "lib-signals.h"
 #include "hash.h"
+#include "md5.h"
+#include "randgen.h"
 #include "str.h"
 #include "strescape.h"
 #include "var-expand.h"
@@ -13,11 +15,29 @@
 
 #include <time.h>
 
+/* Negative entries only need to remember that the key was looked up and
+   not found, so instead of keeping full cache nodes for them only a
+   fingerprint of the key is kept in a fixed size table. Each key has two
+   possible slots in the table. The fingerprint is a 64bit salted hash, so
+   (unlike with e.g. a Bloom filter) false positives that would fail
+   lookups for existing users are practically impossible. */
+struct auth_cache_neg_entry {
+	/* 0 = unused */
+	uint64_t fingerprint;
+	time_t created;
+};
+
 struct auth_cache {
 	HASH_TABLE(char *, struct auth_cache_node *) hash;
 	struct auth_cache_node *head, *tail;
+	/* cache key template => var_expand program */
+	HASH_TABLE(char *, struct var_expand_program *) key_programs;
 	struct event *event;
 
+	struct auth_cache_neg_entry *neg_entries_table;
+	unsigned int neg_entries_mask, neg_entries_count;
+	unsigned char neg_salt[16];
+
 	size_t max_size, size_left;
 	unsigned int ttl_secs, neg_ttl_secs;
 
@@ -202,6 +222,121 @@ auth_cache_node_destroy(struct auth_cache *cache, struct auth_cache_node *node)
 	i_free(node);
 }
 
+static void
+auth_cache_evict(struct auth_cache *cache, size_t alloc_size)
+{
+	struct auth_cache_node *node;
+
+	/* CLOCK-style eviction: lookups only mark the nodes referenced
+	   instead of moving them in the list. When the oldest node has been
+	   referenced, it gets a second chance by moving it to head. */
+	while (cache->size_left < alloc_size && cache->tail != NULL) {
+		node = cache->tail;
+		if (node->referenced) {
+			node->referenced = FALSE;
+			auth_cache_node_unlink(cache, node);
+			auth_cache_node_link_head(cache, node);
+		} else {
+			auth_cache_node_destroy(cache, node);
+		}
+	}
+}
+
+static void
+auth_cache_neg_hash(struct auth_cache *cache, const char *key,
+		    uint64_t *fingerprint_r, unsigned int idx_r[STATIC_ARRAY 2])
+{
+	struct md5_context ctx;
+	unsigned char digest[MD5_RESULTLEN];
+	uint32_t idx1, idx2;
+
+	md5_init(&ctx);
+	md5_update(&ctx, cache->neg_salt, sizeof(cache->neg_salt));
+	md5_update(&ctx, key, strlen(key));
+	md5_final(&ctx, digest);
+
+	memcpy(fingerprint_r, digest, sizeof(*fingerprint_r));
+	if (*fingerprint_r == 0)
+		*fingerprint_r = 1;
+	memcpy(&idx1, digest + 8, sizeof(idx1));
+	memcpy(&idx2, digest + 12, sizeof(idx2));
+	idx_r[0] = idx1 & cache->neg_entries_mask;
+	idx_r[1] = idx2 & cache->neg_entries_mask;
+}
+
+static struct auth_cache_neg_entry *
+auth_cache_neg_find(struct auth_cache *cache, const char *key)
+{
+	struct auth_cache_neg_entry *entry;
+	unsigned int i, idx[2];
+	uint64_t fingerprint;
+
+	if (cache->neg_entries_count == 0)
+		return NULL;
+
+	auth_cache_neg_hash(cache, key, &fingerprint, idx);
+	for (i = 0; i < N_ELEMENTS(idx); i++) {
+		entry = &cache->neg_entries_table[idx[i]];
+		if (entry->fingerprint == fingerprint)
+			return entry;
+	}
+	return NULL;
+}
+
+static void
+auth_cache_neg_insert(struct auth_cache *cache, const char *key)
+{
+	struct auth_cache_neg_entry *entry, *entry2;
+	unsigned int idx[2];
+	uint64_t fingerprint;
+
+	auth_cache_neg_hash(cache, key, &fingerprint, idx);
+	entry = &cache->neg_entries_table[idx[0]];
+	entry2 = &cache->neg_entries_table[idx[1]];
+	if (entry->fingerprint == fingerprint) {
+		/* already exists */
+	} else if (entry2->fingerprint == fingerprint) {
+		/* already exists */
+		entry = entry2;
+	} else if (entry->fingerprint == 0) {
+		/* unused slot */
+	} else if (entry2->fingerprint == 0 ||
+		   entry2->created < entry->created) {
+		/* use the unused or the older slot */
+		entry = entry2;
+	}
+
+	if (entry->fingerprint == 0)
+		cache->neg_entries_count++;
+	entry->fingerprint = fingerprint;
+	entry->created = time(NULL);
+}
+
+static void
+auth_cache_neg_remove(struct auth_cache *cache, const char *key)
+{
+	struct auth_cache_neg_entry *entry;
+
+	entry = auth_cache_neg_find(cache, key);
+	if (entry != NULL) {
+		i_zero(entry);
+		cache->neg_entries_count--;
+	}
+}
+
+static unsigned int auth_cache_neg_clear(struct auth_cache *cache)
+{
+	unsigned int ret = cache->neg_entries_count;
+
+	if (ret > 0) {
+		memset(cache->neg_entries_table, 0,
+		       sizeof(*cache->neg_entries_table) *
+		       (cache->neg_entries_mask + 1));
+		cache->neg_entries_count = 0;
+	}
+	return ret;
+}
+
 static void sig_auth_cache_clear(const siginfo_t *si ATTR_UNUSED, void *context)
 {
 	struct auth_cache *cache = context;
@@ -229,9 +364,13 @@ static void sig_auth_cache_stats(const siginfo_t *si ATTR_UNUSED, void *context)
 
 	cache_used = cache->max_size - cache->size_left;
 	e_info(cache->event, "Authentication cache current size: "
-	       "%zu bytes used of %zu bytes (%u%%)",
+	       "%zu bytes used of %zu bytes (%u%%), "
+	       "negative entries: %u of %u",
 	       cache_used, cache->max_size,
-	       (unsigned int)(cache_used * 100ULL / cache->max_size));
+	       (unsigned int)(cache_used * 100ULL / cache->max_size),
+	       cache->neg_entries_count,
+	       cache->neg_entries_table == NULL ? 0 :
+	       cache->neg_entries_mask + 1);
 
 	/* reset counters */
 	cache->hit_count = cache->miss_count = 0;
@@ -244,13 +383,29 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 )
 {
 	struct auth_cache *cache;
+	size_t neg_size, neg_max_count;
+	unsigned int neg_count;
 
 	cache = i_new(struct auth_cache, 1);
 	hash_table_create(&cache->hash, default_pool, 0, str_hash, strcmp);
+	hash_table_create(&cache->key_programs, default_pool, 0,
+			  str_hash, strcmp);
 	cache->max_size = max_size;
 	cache->size_left = max_size;
 	cache->ttl_secs = ttl_secs;
 	cache->neg_ttl_secs = neg_ttl_secs;
+
+	if (neg_ttl_secs > 0) {
+		neg_max_count = max_size / AUTH_CACHE_NEG_SIZE_DIVISOR /
+			sizeof(struct auth_cache_neg_entry);
+		for (neg_count = 16; neg_count * 2 <= neg_max_count &&
+		     neg_count < INT_MAX / 2; neg_count *= 2) ;
+		neg_size = sizeof(struct auth_cache_neg_entry) * neg_count;
+		cache->neg_entries_table = i_malloc(neg_size);
+		cache->neg_entries_mask = neg_count - 1;
+		cache->size_left -= I_MIN(neg_size, cache->size_left);
+		random_fill(cache->neg_salt, sizeof(cache->neg_salt));
+	}
 	cache->event = event_create(auth_event);
 
 	lib_signals_set_handler(SIGHUP, LIBSIG_FLAGS_SAFE,
@@ -270,6 +425,19 @@ void auth_cache_free(struct auth_cache **_cache)
 
 	auth_cache_clear(cache);
 	hash_table_destroy(&cache->hash);
+
+	struct hash_iterate_context *iter =
+		hash_table_iterate_init(cache->key_programs);
+	struct var_expand_program *program;
+	char *template;
+	while (hash_table_iterate(iter, cache->key_programs,
+				  &template, &program)) {
+		var_expand_program_free(&program);
+		i_free(template);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&cache->key_programs);
+	i_free(cache->neg_entries_table);
 	event_unref(&cache->event);
 	i_free(cache);
 }
@@ -281,7 +449,7 @@ unsigned int auth_cache_clear(struct auth_cache *cache)
 	while (cache->tail != NULL)
 		auth_cache_node_destroy(cache, cache->tail);
 	hash_table_clear(cache->hash, FALSE);
-	return ret;
+	return ret + auth_cache_neg_clear(cache);
 }
 
 static bool auth_cache_node_is_user(struct auth_cache_node *node,
@@ -342,7 +510,7 @@ unsigned int auth_cache_clear_users(struct auth_cache *cache,
 			ret++;
 		}
 	}
-	return ret;
+	return ret + auth_cache_neg_clear(cache);
 }
 
 static const char *
@@ -354,8 +522,27 @@ auth_cache_escape(const char *string,
 	return str_tabescape(string);
 }
 
+static const struct var_expand_program *
+auth_cache_get_key_program(struct auth_cache *cache, const char *key)
+{
+	struct var_expand_program *program;
+	const char *error;
+
+	program = hash_table_lookup(cache->key_programs, key);
+	if (program == NULL) {
+		/* The key was already validated by
+		   auth_cache_parse_key_and_fields(). If it somehow fails,
+		   the error is logged when expanding it. */
+		if (var_expand_program_create(key, &program, &error) < 0)
+			return NULL;
+		hash_table_insert(cache->key_programs, i_strdup(key), program);
+	}
+	return program;
+}
+
 static const char *
-auth_request_expand_cache_key(const struct auth_request *request,
+auth_request_expand_cache_key(struct auth_cache *cache,
+			      const struct auth_request *request,
 			      const char *key, const char *username)
 {
 	static bool error_logged = FALSE;
@@ -381,9 +568,17 @@ auth_request_expand_cache_key(const struct auth_request *request,
 	const struct var_expand_table *table =
 		auth_request_get_var_expand_table_full(request,
 			username, &count);
-	if (auth_request_var_expand_with_table(value, key, request, table,
-					       auth_cache_escape, &error) < 0 &&
-	    !error_logged) {
+	const struct var_expand_program *program =
+		auth_cache_get_key_program(cache, key);
+	int ret;
+	if (program != NULL) {
+		ret = auth_request_var_expand_program_with_table(value,
+			program, request, table, auth_cache_escape, &error);
+	} else {
+		ret = auth_request_var_expand_with_table(value, key, request,
+			table, auth_cache_escape, &error);
+	}
+	if (ret < 0 && !error_logged) {
 		error_logged = TRUE;
 		e_error(authdb_event(request),
 			"Failed to expand auth cache key %s: %s", key, error);
@@ -391,6 +586,32 @@ auth_request_expand_cache_key(const struct auth_request *request,
 	return str_c(value);
 }
 
+static const char *
+auth_cache_neg_lookup(struct auth_cache *cache, const char *key,
+		      struct auth_cache_node **node_r,
+		      bool *expired_r, bool *neg_expired_r)
+{
+	struct auth_cache_neg_entry *entry;
+
+	entry = auth_cache_neg_find(cache, key);
+	if (entry == NULL) {
+		cache->miss_count++;
+		return NULL;
+	}
+
+	if (entry->created < time(NULL) - (time_t)cache->neg_ttl_secs) {
+		/* TTL expired */
+		cache->miss_count++;
+		*expired_r = TRUE;
+		*neg_expired_r = TRUE;
+	} else {
+		cache->hit_count++;
+	}
+	if (node_r != NULL)
+		*node_r = NULL;
+	return "";
+}
+
 const char *
 auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		  const char *key, struct auth_cache_node **node_r,
@@ -404,12 +625,12 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 	*expired_r = FALSE;
 	*neg_expired_r = FALSE;
 
-	key = auth_request_expand_cache_key(request, key, request->fields.translated_username);
+	key = auth_request_expand_cache_key(cache, request, key,
+					    request->fields.translated_username);
 	node = hash_table_lookup(cache->hash, key);
-	if (node == NULL) {
-		cache->miss_count++;
-		return NULL;
-	}
+	if (node == NULL)
+		return auth_cache_neg_lookup(cache, key, node_r,
+					     expired_r, neg_expired_r);
 
 	value = node->data + strlen(node->data) + 1;
 	ttl_secs = *value == '\0' ? cache->neg_ttl_secs : cache->ttl_secs;
@@ -420,11 +641,7 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		cache->miss_count++;
 		*expired_r = TRUE;
 	} else {
-		/* move to head */
-		if (node != cache->head) {
-			auth_cache_node_unlink(cache, node);
-			auth_cache_node_link_head(cache, node);
-		}
+		node->referenced = TRUE;
 		cache->hit_count++;
 	}
 	if (node->created < now - (time_t)cache->neg_ttl_secs)
@@ -448,15 +665,8 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 		return;
 	}
 
-	key = auth_request_expand_cache_key(request, key, request->fields.translated_username);
-	key_len = strlen(key);
-
-	data_size = key_len + 1 + value_len + 1;
-	alloc_size = sizeof(struct auth_cache_node) + data_size;
-
-	/* make sure we have enough space */
-	while (cache->size_left < alloc_size && cache->tail != NULL)
-		auth_cache_node_destroy(cache, cache->tail);
+	key = auth_request_expand_cache_key(cache, request, key,
+					    request->fields.translated_username);
 
 	node = hash_table_lookup(cache->hash, key);
 	if (node != NULL) {
@@ -464,6 +674,21 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 		auth_cache_node_destroy(cache, node);
 	}
 
+	if (*value == '\0') {
+		auth_cache_neg_insert(cache, key);
+		cache->neg_entries++;
+		cache->neg_size += sizeof(struct auth_cache_neg_entry);
+		return;
+	}
+	auth_cache_neg_remove(cache, key);
+
+	key_len = strlen(key);
+	data_size = key_len + 1 + value_len + 1;
+	alloc_size = sizeof(struct auth_cache_node) + data_size;
+
+	/* make sure we have enough space */
+	auth_cache_evict(cache, alloc_size);
+
 	/* @UNSAFE */
 	node = i_malloc(alloc_size);
 	node->created = time(NULL);
@@ -478,13 +703,8 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 	hash_key = node->data;
 	hash_table_insert(cache->hash, hash_key, node);
 
-	if (*value != '\0') {
-		cache->pos_entries++;
-		cache->pos_size += alloc_size;
-	} else {
-		cache->neg_entries++;
-		cache->neg_size += alloc_size;
-	}
+	cache->pos_entries++;
+	cache->pos_size += alloc_size;
 }
 
 void auth_cache_remove(struct auth_cache *cache,
@@ -492,10 +712,11 @@ void auth_cache_remove(struct auth_cache *cache,
 {
 	struct auth_cache_node *node;
 
-	key = auth_request_expand_cache_key(request, key, request->fields.user);
+	key = auth_request_expand_cache_key(cache, request, key,
+					    request->fields.user);
 	node = hash_table_lookup(cache->hash, key);
-	if (node == NULL)
-		return;
-
-	auth_cache_node_destroy(cache, node);
+	if (node != NULL)
+		auth_cache_node_destroy(cache, node);
+	else
+		auth_cache_neg_remove(cache, key);
 }
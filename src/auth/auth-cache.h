@@ -6,13 +6,20 @@ struct auth_cache_node {
 
 	time_t created;
 	/* Total number of bytes used by this node */
-	uint32_t alloc_size:31;
+	uint32_t alloc_size:30;
 	/* TRUE if the user gave the correct password the last time. */
 	bool last_success:1;
+	/* TRUE if the node has been looked up since the eviction last
+	   passed it. Such nodes get a second chance instead of being
+	   evicted. */
+	bool referenced:1;
 
 	char data[]; /* key \0 value \0 */
 };
 
+/* Portion of the cache size used for the negative entries */
+#define AUTH_CACHE_NEG_SIZE_DIVISOR 8
+
 struct auth_cache;
 struct auth_request;
 
@@ -28,7 +35,9 @@ int auth_cache_parse_key_and_fields(pool_t pool, const char *query,
 /* Create a new cache. max_size specifies the maximum amount of memory in
    bytes to use for cache (it's not fully exact). ttl_secs specifies time to
    live for cache record, requests older than that are not used.
-   neg_ttl_secs specifies the TTL for negative entries. */
+   neg_ttl_secs specifies the TTL for negative entries. Negative entries are
+   kept in a separate fixed size table of key fingerprints, which uses
+   1/AUTH_CACHE_NEG_SIZE_DIVISOR of max_size. */
 struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 				  unsigned int neg_ttl_secs);
 void auth_cache_free(struct auth_cache **cache);
@@ -36,12 +45,15 @@ void auth_cache_free(struct auth_cache **cache);
 /* Clear the cache. Returns how many entries were removed. */
 unsigned int ATTR_NOWARN_UNUSED_RESULT
 auth_cache_clear(struct auth_cache *cache);
+/* Remove the entries of the users matching the masks. The negative entries
+   don't have the username available, so they are all removed. */
 unsigned int auth_cache_clear_users(struct auth_cache *cache,
 				    const char *const *user_masks);
 
 /* Look key from cache. key should be the same string as returned by
    auth_cache_parse_key(). Returned node can't be used after any other
-   auth_cache_*() calls. */
+   auth_cache_*() calls. For negative entries "" is returned and node_r is
+   set to NULL. */
 const char *
 auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		  const char *key, struct auth_cache_node **node_r,
@@ -257,6 +257,29 @@ int auth_request_var_expand_with_table(string_t *dest, const char *str,
 	return var_expand(dest, str, &params, error_r);
 }
 
+int auth_request_var_expand_program_with_table(string_t *dest,
+	const struct var_expand_program *program,
+	const struct auth_request *auth_request,
+	const struct var_expand_table *table,
+	auth_request_escape_func_t *escape_func, const char **error_r)
+{
+	struct auth_request_var_expand_ctx ctx;
+
+	i_zero(&ctx);
+	ctx.auth_request = auth_request;
+	ctx.escape_func = escape_func == NULL ? escape_none : escape_func;
+	const struct var_expand_params params = {
+		.table = table,
+		.providers = auth_request_var_expand_providers,
+		.escape_func = (var_expand_escape_func_t *)ctx.escape_func,
+		.context = &ctx,
+		.escape_context = (void *)auth_request,
+		.event = auth_request->event,
+	};
+
+	return var_expand_program_execute(dest, program, &params, error_r);
+}
+
 int t_auth_request_var_expand(const char *str,
 			      const struct auth_request *auth_request,
 			      auth_request_escape_func_t *escape_func,
@@ -28,6 +28,13 @@ int auth_request_var_expand_with_table(string_t *dest, const char *str,
 				       const struct var_expand_table *table,
 				       auth_request_escape_func_t *escape_func,
 				       const char **error_r);
+/* Same as auth_request_var_expand_with_table(), but execute an already
+   created var_expand program. */
+int auth_request_var_expand_program_with_table(string_t *dest,
+	const struct var_expand_program *program,
+	const struct auth_request *auth_request,
+	const struct var_expand_table *table,
+	auth_request_escape_func_t *escape_func, const char **error_r);
 int t_auth_request_var_expand(const char *str,
 			      const struct auth_request *auth_request,
 			      auth_request_escape_func_t *escape_func,
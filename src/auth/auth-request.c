@@ -2686,8 +2686,16 @@ auth_request_password_verify_log(struct auth_request *request,
 	/* Use original_username since it may be important for some
 	   password schemes (eg. digest-md5). Otherwise the username is used
 	   only for logging purposes. */
+	struct event *verify_event = event_create(event);
+	event_add_str(verify_event, "scheme", scheme);
 	ret = password_verify(plain_password, &gen_params,
 			      scheme, raw_password, raw_password_size, &error);
+	/* allow accounting the CPU usage per scheme */
+	event_set_name(verify_event, "password_verify_finished");
+	event_add_str(verify_event, "result",
+		      ret < 0 ? "error" : (ret == 0 ? "mismatch" : "ok"));
+	e_debug(verify_event, "%s password verification finished", scheme);
+	event_unref(&verify_event);
 	if (ret < 0) {
 		const char *password_str = request->set->debug_passwords ?
 			t_strdup_printf(" '%s'", crypted_password) : "";
@@ -2732,6 +2740,52 @@ auth_request_db_password_verify_log(struct auth_request *request,
 		log_password_mismatch);
 }
 
+static bool
+auth_request_password_verify_use_worker(struct auth_request *request,
+					const char *scheme)
+{
+	if (worker ||
+	    array_is_empty(&request->set->password_verify_worker_schemes))
+		return FALSE;
+
+	/* these don't need the password to be verified */
+	if (request->fields.skip_password_check ||
+	    request->passdb->set->deny ||
+	    auth_fields_exists(request->fields.extra_fields, "nopassword"))
+		return FALSE;
+
+	return str_array_icase_find(settings_boollist_get(
+		&request->set->password_verify_worker_schemes), scheme);
+}
+
+void auth_request_db_password_verify_async(struct auth_request *request,
+					   const char *plain_password,
+					   const char *crypted_password,
+					   const char *scheme,
+					   verify_plain_callback_t *callback)
+{
+	enum passdb_result result;
+
+	if (!auth_request_password_verify_use_worker(request, scheme)) {
+		result = auth_request_db_password_verify(request,
+			plain_password, crypted_password, scheme);
+		callback(result, request);
+		return;
+	}
+
+	if (!passdb_blocking_password_verify(request, plain_password,
+					     crypted_password, scheme,
+					     callback)) {
+		/* Reject early instead of queueing more work behind the
+		   already saturated workers. */
+		e_error(authdb_event(request),
+			"Too many pending %s password verifications "
+			"(auth_password_verify_worker_max_pending=%u)",
+			scheme, request->set->password_verify_worker_max_pending);
+		callback(PASSDB_RESULT_INTERNAL_FAILURE, request);
+	}
+}
+
 enum passdb_result auth_request_password_missing(struct auth_request *request)
 {
 	if (request->fields.skip_password_check) {
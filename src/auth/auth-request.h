@@ -392,6 +392,14 @@ auth_request_db_password_verify_log(struct auth_request *request,
 				    const char *scheme,
 				    bool log_password_mismatch)
 				    ATTR_WARN_UNUSED_RESULT;
+/* Like auth_request_db_password_verify(), but if the scheme is listed in
+   auth_password_verify_worker_schemes, verify the password in an
+   auth-worker process so that the auth process isn't blocked by it. */
+void auth_request_db_password_verify_async(struct auth_request *request,
+					   const char *plain_password,
+					   const char *crypted_password,
+					   const char *scheme,
+					   verify_plain_callback_t *callback);
 enum passdb_result auth_request_password_missing(struct auth_request *request);
 
 void auth_request_log_password_mismatch(struct auth_request *request,
@@ -317,6 +317,9 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(STR, proxy_self),
 	DEF(TIME, failure_delay),
 	DEF(TIME_MSECS, internal_failure_delay),
+	DEF(UINT, worker_max_pipelined_requests),
+	DEF(BOOLLIST, password_verify_worker_schemes),
+	DEF(UINT, password_verify_worker_max_pending),
 
 	{ .type = SET_FILTER_NAME, .key = "auth_policy", },
 	DEF(STR, policy_server_url),
@@ -378,6 +381,9 @@ static const struct auth_settings auth_default_settings = {
 	.proxy_self = "",
 	.failure_delay = 2,
 	.internal_failure_delay = 2000,
+	.worker_max_pipelined_requests = 1,
+	.password_verify_worker_schemes = ARRAY_INIT,
+	.password_verify_worker_max_pending = 100,
 
 	.policy_server_url = "",
 	.policy_server_api_header = "",
@@ -604,6 +610,11 @@ static bool auth_settings_ext_check(struct event *event, void *_set,
 		return FALSE;
 	}
 
+	if (set->worker_max_pipelined_requests == 0) {
+		*error_r = "auth_worker_max_pipelined_requests must not be 0";
+		return FALSE;
+	}
+
 	if (!auth_verify_verbose_password(set, error_r))
 		return FALSE;
 
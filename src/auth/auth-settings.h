@@ -71,6 +71,9 @@ struct auth_settings {
 	const char *proxy_self;
 	unsigned int failure_delay;
 	unsigned int internal_failure_delay;
+	unsigned int worker_max_pipelined_requests;
+	ARRAY_TYPE(const_string) password_verify_worker_schemes;
+	unsigned int password_verify_worker_max_pending;
 
 	const char *policy_server_url;
 	const char *policy_server_api_header;
@@ -11,6 +11,7 @@
 #include "hex-binary.h"
 #include "str.h"
 #include "strescape.h"
+#include "time-util.h"
 #include "eacces-error.h"
 #include "auth-request.h"
 #include "auth-worker-server.h"
@@ -38,15 +39,24 @@ struct auth_worker_request {
 	const char *data;
 	auth_worker_callback_t *callback;
 	void *context;
+
+	struct event *event;
+	struct timeval created_timeval;
+	/* Number of requests in the queue when this request was created */
+	unsigned int queue_depth;
 };
 
 struct auth_worker_connection {
 	struct connection conn;
 	struct timeout *to_lookup;
-	struct auth_worker_request *request;
+	/* Requests sent to the worker and waiting for replies, in the order
+	   they were sent. Only one request is sent at a time unless
+	   auth_worker_max_pipelined_requests is above 1. */
+	ARRAY(struct auth_worker_request *) requests;
 	unsigned int id_counter;
 
 	bool received_error:1;
+	bool destroyed:1;
 	bool restart:1;
 	bool shutdown:1;
 	bool timeout_pending_resume:1;
@@ -68,7 +78,7 @@ static void auth_worker_deinit(struct auth_worker_connection **worker,
 
 static void auth_worker_idle_timeout(struct auth_worker_connection *worker)
 {
-	i_assert(worker->request == NULL);
+	i_assert(array_is_empty(&worker->requests));
 
 	if (idle_count > 1)
 		auth_worker_deinit(&worker, NULL, FALSE);
@@ -78,11 +88,44 @@ static void auth_worker_idle_timeout(struct auth_worker_connection *worker)
 
 static void auth_worker_call_timeout(struct auth_worker_connection *worker)
 {
-	i_assert(worker->request != NULL);
+	i_assert(!array_is_empty(&worker->requests));
 
 	auth_worker_deinit(&worker, "Lookup timed out", TRUE);
 }
 
+static bool auth_worker_request_is_list(struct auth_worker_request *request)
+{
+	return str_begins_with(request->data, "LIST\t");
+}
+
+static void
+auth_worker_request_finished(struct auth_worker_request *request,
+			     const char *error)
+{
+	event_set_name(request->event, "auth_worker_call_finished");
+	if (error != NULL) {
+		event_add_str(request->event, "error", error);
+		e_debug(request->event, "Finished: %s", error);
+	} else {
+		e_debug(request->event, "Finished");
+	}
+	event_unref(&request->event);
+}
+
+static void
+auth_worker_request_fail(struct auth_worker_connection *worker,
+			 struct auth_worker_request *request,
+			 const char *error)
+{
+	const char *const args[] = {
+		"FAIL",
+		t_strdup_printf("%d", PASSDB_RESULT_INTERNAL_FAILURE),
+		NULL,
+	};
+	auth_worker_request_finished(request, error);
+	request->callback(worker, args, request->context);
+}
+
 static bool auth_worker_request_send(struct auth_worker_connection *worker,
 				     struct auth_worker_request *request)
 {
@@ -96,12 +139,8 @@ static bool auth_worker_request_send(struct auth_worker_connection *worker,
 			"Aborting auth request that was queued for %d secs, "
 			"%d left in queue",
 			age_secs, aqueue_count(worker_request_queue));
-		const char *const args[] = {
-			"FAIL",
-			t_strdup_printf("%d", PASSDB_RESULT_INTERNAL_FAILURE),
-			NULL,
-		};
-		request->callback(worker, args, request->context);
+		auth_worker_request_fail(worker, request,
+					 "Queued for too long");
 		return FALSE;
 	}
 	if (age_secs >= AUTH_WORKER_DELAY_WARN_SECS &&
@@ -125,15 +164,46 @@ static bool auth_worker_request_send(struct auth_worker_connection *worker,
 
 	o_stream_nsendv(worker->conn.output, iov, 3);
 
-	i_assert(worker->request == NULL);
-	worker->request = request;
+	event_add_int(request->event, "queue_depth", request->queue_depth);
+	event_add_int(request->event, "queue_usecs",
+		      timeval_diff_usecs(&ioloop_timeval,
+					 &request->created_timeval));
+	event_add_int(request->event, "pipeline_depth",
+		      array_count(&worker->requests));
+	event_add_int(request->event, "worker_request_id", request->id);
 
-	timeout_remove(&worker->to_lookup);
-	worker->to_lookup = timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
-					auth_worker_call_timeout, worker);
+	if (array_is_empty(&worker->requests)) {
+		timeout_remove(&worker->to_lookup);
+		worker->to_lookup =
+			timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
+				    auth_worker_call_timeout, worker);
+		i_assert(idle_count > 0);
+		idle_count--;
+	}
+	array_push_back(&worker->requests, &request);
+	return TRUE;
+}
+
+static bool
+auth_worker_can_pipeline(struct auth_worker_connection *worker,
+			 struct auth_worker_request *request)
+{
+	struct auth_worker_request *const *first;
 
-	i_assert(idle_count > 0);
-	idle_count--;
+	if (array_is_empty(&worker->requests))
+		return TRUE;
+	if (worker->destroyed || worker->restart || worker->shutdown ||
+	    worker->resuming)
+		return FALSE;
+	if (array_count(&worker->requests) >=
+	    global_auth_settings->worker_max_pipelined_requests)
+		return FALSE;
+	/* LIST replies are multi-line and the worker stops reading input
+	   while sending them, so don't pipeline anything with them. */
+	first = array_front(&worker->requests);
+	if (auth_worker_request_is_list(*first) ||
+	    (request != NULL && auth_worker_request_is_list(request)))
+		return FALSE;
 	return TRUE;
 }
 
@@ -147,6 +217,8 @@ static void auth_worker_request_send_next(struct auth_worker_connection *worker)
 
 		request = array_idx_elem(&worker_request_array,
 					 aqueue_idx(worker_request_queue, 0));
+		if (!auth_worker_can_pipeline(worker, request))
+			return;
 		aqueue_delete_tail(worker_request_queue);
 	} while (!auth_worker_request_send(worker, request));
 }
@@ -249,6 +321,8 @@ static struct auth_worker_connection *auth_worker_create(void)
 
 	worker->to_lookup = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
 					auth_worker_idle_timeout, worker);
+	i_array_init(&worker->requests,
+		     global_auth_settings->worker_max_pipelined_requests);
 
 	idle_count++;
 	return worker;
@@ -260,6 +334,7 @@ static void auth_worker_deinit(struct auth_worker_connection **_worker,
 	struct auth_worker_connection *worker = *_worker;
 
 	*_worker = NULL;
+	worker->destroyed = TRUE;
 
 	if (worker->received_error) {
 		i_assert(auth_workers_with_errors > 0);
@@ -267,23 +342,24 @@ static void auth_worker_deinit(struct auth_worker_connection **_worker,
 		auth_workers_with_errors--;
 	}
 
-	if (worker->request == NULL)
+	if (array_is_empty(&worker->requests))
 		idle_count--;
 	else {
-		e_error(worker->conn.event, "Aborted %s request for %s: %s",
-			t_strcut(worker->request->data, '\t'),
-			worker->request->username, reason);
-		const char *const args[] = {
-			"FAIL",
-			t_strdup_printf("%d", PASSDB_RESULT_INTERNAL_FAILURE),
-			NULL,
-		};
-		worker->request->callback(worker, args, worker->request->context);
+		struct auth_worker_request *request;
+
+		array_foreach_elem(&worker->requests, request) {
+			e_error(worker->conn.event,
+				"Aborted %s request for %s: %s",
+				t_strcut(request->data, '\t'),
+				request->username, reason);
+			auth_worker_request_fail(worker, request, reason);
+		}
 	}
 
 	timeout_remove(&worker->to_lookup);
 	connection_deinit(&worker->conn);
 
+	array_free(&worker->requests);
 	i_free(worker);
 
 	if (idle_count == 0 && restart) {
@@ -302,7 +378,7 @@ static struct auth_worker_connection *auth_worker_find_free(void)
 	while (conn != NULL) {
 		struct auth_worker_connection *worker =
 			container_of(conn, struct auth_worker_connection, conn);
-		if (worker->request == NULL)
+		if (array_is_empty(&worker->requests))
 			return worker;
 
 		conn = conn->next;
@@ -311,10 +387,33 @@ static struct auth_worker_connection *auth_worker_find_free(void)
 	i_unreached();
 }
 
+static struct auth_worker_connection *
+auth_worker_find_pipelinable(struct auth_worker_request *request)
+{
+	struct auth_worker_connection *worker, *best = NULL;
+	struct connection *conn;
+
+	if (global_auth_settings->worker_max_pipelined_requests <= 1)
+		return NULL;
+
+	/* use the worker with the least pending requests */
+	for (conn = connections->connections; conn != NULL; conn = conn->next) {
+		worker = container_of(conn, struct auth_worker_connection, conn);
+		if (!auth_worker_can_pipeline(worker, request))
+			continue;
+		if (best == NULL || array_count(&worker->requests) <
+				    array_count(&best->requests))
+			best = worker;
+	}
+	return best;
+}
+
 static int auth_worker_request_handle(struct auth_worker_connection *worker,
+				      unsigned int idx,
 				      const char *const *args)
 {
-	struct auth_worker_request *_request = worker->request;
+	struct auth_worker_request *_request =
+		array_idx_elem(&worker->requests, idx);
 
 	/* lines starting with '*' denote a multi-line request
 	   if they do, reset timeouts
@@ -330,12 +429,22 @@ static int auth_worker_request_handle(struct auth_worker_connection *worker,
 		}
 	} else {
 		worker->resuming = FALSE;
-		worker->request = NULL;
+		array_delete(&worker->requests, idx, 1);
 		worker->timeout_pending_resume = FALSE;
 		timeout_remove(&worker->to_lookup);
-		worker->to_lookup = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
-						auth_worker_idle_timeout, worker);
-		idle_count++;
+		if (array_is_empty(&worker->requests)) {
+			worker->to_lookup =
+				timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
+					    auth_worker_idle_timeout, worker);
+			idle_count++;
+		} else {
+			/* the worker is making progress with the pipelined
+			   requests - restart the lookup timeout */
+			worker->to_lookup =
+				timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
+					    auth_worker_call_timeout, worker);
+		}
+		auth_worker_request_finished(_request, NULL);
 	}
 
 	if (!_request->callback(worker, args, _request->context)) {
@@ -417,14 +526,22 @@ static int worker_input_args(struct connection *conn, const char *const *args)
 		return 1;
 	}
 
+	struct auth_worker_request *const *requests;
+	unsigned int idx, count;
 	int ret = 0;
-	if (worker->request != NULL && id == worker->request->id)
-		 ret = auth_worker_request_handle(worker, args + 1);
+
+	requests = array_get(&worker->requests, &count);
+	for (idx = 0; idx < count; idx++) {
+		if (requests[idx]->id == id)
+			break;
+	}
+	if (idx < count)
+		ret = auth_worker_request_handle(worker, idx, args + 1);
 	else {
-		if (worker->request != NULL) {
+		if (count > 0) {
 			e_error(conn->event,
 				"BUG: Worker sent reply with id %u, "
-				"expected %u", id, worker->request->id);
+				"expected %u", id, requests[0]->id);
 		} else {
 			e_error(conn->event,
 				"BUG: Worker sent reply with id %u, "
@@ -434,8 +551,10 @@ static int worker_input_args(struct connection *conn, const char *const *args)
 		return -1;
 	}
 
-	if (worker->request != NULL) {
-		/* there's still a pending request */
+	if (!array_is_empty(&worker->requests)) {
+		/* there are still pending requests */
+		if (ret > 0)
+			auth_worker_request_send_next(worker);
 	} else if (worker->restart) {
 		auth_worker_deinit(&worker, "Max requests limit", TRUE);
 		ret = 0;
@@ -487,10 +606,17 @@ void auth_worker_call(pool_t pool, const char *username, const char *data,
 
 	request = p_new(pool, struct auth_worker_request, 1);
 	request->created = ioloop_time;
+	request->created_timeval = ioloop_timeval;
 	request->username = p_strdup(pool, username);
 	request->data = p_strdup(pool, data);
 	request->callback = callback;
 	request->context = context;
+	request->queue_depth = aqueue_count(worker_request_queue);
+	request->event = event_create(auth_event);
+	event_add_str(request->event, "command", t_strcut(data, '\t'));
+	if (username != NULL)
+		event_add_str(request->event, "user", username);
+	event_set_append_log_prefix(request->event, "auth-worker: ");
 
 	if (aqueue_count(worker_request_queue) > 0) {
 		/* requests are already being queued, no chance of
@@ -502,6 +628,11 @@ void auth_worker_call(pool_t pool, const char *username, const char *data,
 			/* no free connections, create a new one */
 			worker = auth_worker_create();
 		}
+		if (worker == NULL) {
+			/* reached the process limit, pipeline the request
+			   to an existing worker */
+			worker = auth_worker_find_pipelinable(request);
+		}
 	}
 	if (worker != NULL) {
 		if (!auth_worker_request_send(worker, request))
@@ -514,7 +645,7 @@ void auth_worker_call(pool_t pool, const char *username, const char *data,
 
 void auth_worker_connection_resume_input(struct auth_worker_connection *worker)
 {
-	if (worker->request == NULL) {
+	if (array_is_empty(&worker->requests)) {
 		/* request was just finished, don't try to resume it */
 		return;
 	}
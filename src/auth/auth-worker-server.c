@@ -34,7 +34,6 @@ struct auth_worker_server {
 	struct auth *auth;
 	struct event *event;
 	struct db_oauth2 *oauth2;
-	time_t cmd_start;
 
 	bool error_sent:1;
 	bool destroyed:1;
@@ -43,6 +42,9 @@ struct auth_worker_server {
 struct auth_worker_command {
 	struct auth_worker_server *server;
 	struct event *event;
+	/* The auth process may pipeline multiple requests, so each command
+	   tracks its own start time. */
+	time_t start;
 };
 
 struct auth_worker_list_context {
@@ -175,7 +177,9 @@ static void auth_worker_send_reply(struct auth_worker_server *server,
 				   struct auth_request *request,
 				   string_t *str)
 {
-	time_t cmd_duration = time(NULL) - server->cmd_start;
+	struct auth_worker_command *cmd =
+		request == NULL ? NULL : request->context;
+	time_t cmd_duration = cmd == NULL ? 0 : time(NULL) - cmd->start;
 	const char *p;
 
 	if (worker_restart_request)
@@ -623,7 +627,7 @@ static void list_iter_deinit(struct auth_worker_list_context *ctx)
 		str_printfa(str, "%u\tFAIL\n", ctx->auth_request->id);
 	} else
 		str_printfa(str, "%u\tOK\n", ctx->auth_request->id);
-	auth_worker_send_reply(server, NULL, str);
+	auth_worker_send_reply(server, ctx->auth_request, str);
 
 	connection_input_resume(&server->conn);
 	o_stream_set_flush_callback(server->conn.output, auth_worker_output,
@@ -894,7 +898,7 @@ auth_worker_server_input_args(struct connection *conn, const char *const *args)
 	event_add_str(cmd->event, "command", args[1]);
 	event_add_int(cmd->event, "command_id", id);
 	event_set_append_log_prefix(cmd->event, t_strdup_printf("auth-worker<%u>: ", id));
-	server->cmd_start = ioloop_time;
+	cmd->start = ioloop_time;
 	server->refcount++;
 	e_debug(cmd->event, "Handling %s request", args[1]);
 
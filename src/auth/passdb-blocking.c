@@ -84,6 +84,64 @@ verify_plain_callback(struct auth_worker_connection *conn ATTR_UNUSED,
 	return TRUE;
 }
 
+struct passdb_blocking_password_verify_context {
+	struct auth_request *request;
+	verify_plain_callback_t *callback;
+};
+
+static unsigned int passdb_blocking_password_verify_pending = 0;
+
+static bool
+password_verify_callback(struct auth_worker_connection *conn ATTR_UNUSED,
+			 const char *const *args, void *context)
+{
+	struct passdb_blocking_password_verify_context *ctx = context;
+	struct auth_request *request = ctx->request;
+	enum passdb_result result;
+
+	i_assert(passdb_blocking_password_verify_pending > 0);
+	passdb_blocking_password_verify_pending--;
+
+	result = passdb_blocking_auth_worker_reply_parse(request, args);
+	ctx->callback(result, request);
+	auth_request_unref(&request);
+	return TRUE;
+}
+
+bool passdb_blocking_password_verify(struct auth_request *request,
+				     const char *password,
+				     const char *crypted_password,
+				     const char *scheme,
+				     verify_plain_callback_t *callback)
+{
+	struct passdb_blocking_password_verify_context *ctx;
+	string_t *str;
+
+	if (passdb_blocking_password_verify_pending >=
+	    request->set->password_verify_worker_max_pending)
+		return FALSE;
+
+	str = t_str_new(128);
+	str_printfa(str, "PASSW\t%u\t", request->passdb->passdb->id);
+	str_append_tabescaped(str, password);
+	str_append_c(str, '\t');
+	str_append_tabescaped(str, t_strdup_printf("{%s}%s", scheme,
+						   crypted_password));
+	str_append_c(str, '\t');
+	auth_request_export(request, str);
+
+	ctx = p_new(request->pool,
+		    struct passdb_blocking_password_verify_context, 1);
+	ctx->request = request;
+	ctx->callback = callback;
+
+	passdb_blocking_password_verify_pending++;
+	auth_request_ref(request);
+	auth_worker_call(request->pool, request->fields.user, str_c(str),
+			 password_verify_callback, ctx);
+	return TRUE;
+}
+
 void passdb_blocking_verify_plain(struct auth_request *request)
 {
 	string_t *str;
@@ -5,6 +5,14 @@ enum passdb_result
 passdb_blocking_auth_worker_reply_parse(struct auth_request *request,
 					const char *const *args);
 void passdb_blocking_verify_plain(struct auth_request *request);
+/* Verify the password against crypted_password in an auth-worker process.
+   Returns FALSE without calling the callback if there are already
+   auth_password_verify_worker_max_pending verifications waiting. */
+bool passdb_blocking_password_verify(struct auth_request *request,
+				     const char *password,
+				     const char *crypted_password,
+				     const char *scheme,
+				     verify_plain_callback_t *callback);
 void passdb_blocking_lookup_credentials(struct auth_request *request);
 void passdb_blocking_set_credentials(struct auth_request *request,
 				     const char *new_credentials);
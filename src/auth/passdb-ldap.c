@@ -101,13 +101,11 @@ ldap_lookup_finish(struct auth_request *auth_request,
 		passdb_handle_credentials(passdb_result, password, scheme,
 			ldap_request->callback.lookup_credentials,
 			auth_request);
+	} else if (password != NULL) {
+		auth_request_db_password_verify_async(auth_request,
+			auth_request->mech_password, password, scheme,
+			ldap_request->callback.verify_plain);
 	} else {
-		if (password != NULL) {
-			passdb_result = auth_request_db_password_verify(
-				auth_request, auth_request->mech_password,
-				password, scheme);
-		}
-
 		ldap_request->callback.verify_plain(passdb_result,
 						    auth_request);
 	}
@@ -97,8 +97,9 @@ passdb_lua_verify_plain(struct auth_request *request, const char *password,
 		if (result == PASSDB_RESULT_OK) {
 			if (lua_scheme == NULL)
 				lua_scheme = "PLAIN";
-			result = auth_request_db_password_verify(
-				request, password, lua_password, lua_scheme);
+			auth_request_db_password_verify_async(request,
+				password, lua_password, lua_scheme, callback);
+			return;
 		}
 	}
 	callback(result, request);
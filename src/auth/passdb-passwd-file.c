@@ -93,7 +93,6 @@ passwd_file_verify_plain(struct auth_request *request, const char *password,
 		(struct passwd_file_passdb_module *)_module;
 	struct passwd_user *pu;
 	const char *scheme, *crypted_pass;
-	enum passdb_result result;
         int ret;
 
 	ret = db_passwd_file_lookup(module->pwf, request,
@@ -109,10 +108,8 @@ passwd_file_verify_plain(struct auth_request *request, const char *password,
 		return;
 	}
 
-	result = auth_request_db_password_verify(request, password,
-						 crypted_pass, scheme);
-
-	callback(result, request);
+	auth_request_db_password_verify_async(request, password,
+					      crypted_pass, scheme, callback);
 }
 
 static void
@@ -60,9 +60,8 @@ static_verify_plain(struct auth_request *request, const char *password,
 		return;
 	}
 
-	result = auth_request_db_password_verify(
-		request, password, static_password, static_scheme);
-	callback(result, request);
+	auth_request_db_password_verify_async(request, password,
+		static_password, static_scheme, callback);
 }
 
 static void
@@ -1,11 +1,16 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
+#define AUTH_REQUEST_FIELDS_CONST
+
 #include "lib.h"
 #include "str.h"
+#include "time-util.h"
 #include "auth-request.h"
 #include "auth-cache.h"
 #include "test-common.h"
 
+#include <stdio.h>
+
 const struct var_expand_table
 auth_request_var_expand_static_tab[AUTH_REQUEST_VAR_TAB_COUNT + 1] = {
 	{ .key = "user", .value = NULL },
@@ -20,10 +25,17 @@ struct event *auth_event;
 
 struct var_expand_table *
 auth_request_get_var_expand_table_full(const struct auth_request *auth_request ATTR_UNUSED,
-				       const char *username ATTR_UNUSED,
+				       const char *username,
 				       unsigned int *count ATTR_UNUSED)
 {
-	i_unreached();
+	struct var_expand_table *table =
+		t_new(struct var_expand_table, 3);
+
+	table[0].key = "user";
+	table[0].value = username;
+	table[1].key = "id";
+	table[1].value = "1";
+	return table;
 }
 
 static int mock_get_passdb(const char *key, const char **value_r,
@@ -66,6 +78,20 @@ int auth_request_var_expand_with_table(string_t *dest, const char *str,
 	return var_expand(dest, str, &params, error_r);
 }
 
+int auth_request_var_expand_program_with_table(string_t *dest,
+	const struct var_expand_program *program,
+	const struct auth_request *auth_request,
+	const struct var_expand_table *table,
+	auth_request_escape_func_t *escape_func ATTR_UNUSED,
+	const char **error_r)
+{
+	const struct var_expand_params params = {
+		.table = table,
+		.event = auth_request->event,
+	};
+	return var_expand_program_execute(dest, program, &params, error_r);
+}
+
 static void test_auth_cache_parse_key(void)
 {
 	static const struct {
@@ -128,16 +154,179 @@ static void test_auth_cache_parse_key_errors(void)
 	test_end();
 }
 
-int main(void)
+static void test_auth_request_init(struct auth_request *request,
+				   const char *user)
+{
+	i_zero(request);
+	request->event = auth_event;
+	request->fields.user = t_strdup_noconst(user);
+	request->fields.translated_username = user;
+}
+
+static void test_auth_cache_lookup(void)
+{
+	struct auth_cache *cache;
+	struct auth_cache_node *node;
+	struct auth_request request;
+	const char *const user_masks[] = { "nobody", NULL };
+	const char *value;
+	bool expired, neg_expired;
+
+	test_begin("auth cache lookup");
+	cache = auth_cache_new(1024*1024, 3600, 3600);
+
+	test_auth_request_init(&request, "user1");
+	test_assert(auth_cache_lookup(cache, &request, "%{user}", &node,
+				      &expired, &neg_expired) == NULL);
+	auth_cache_insert(cache, &request, "%{user}", "pass1", TRUE);
+	value = auth_cache_lookup(cache, &request, "%{user}", &node,
+				  &expired, &neg_expired);
+	test_assert_strcmp(value, "pass1");
+	test_assert(node != NULL && node->last_success && node->referenced);
+	test_assert(!expired && !neg_expired);
+
+	/* negative entries */
+	test_auth_request_init(&request, "nouser");
+	auth_cache_insert(cache, &request, "%{user}", "", FALSE);
+	value = auth_cache_lookup(cache, &request, "%{user}", &node,
+				  &expired, &neg_expired);
+	test_assert_strcmp(value, "");
+	test_assert(node == NULL && !expired && !neg_expired);
+
+	/* positive entry replaces the negative one, and the other way */
+	auth_cache_insert(cache, &request, "%{user}", "pass2", TRUE);
+	value = auth_cache_lookup(cache, &request, "%{user}", &node,
+				  &expired, &neg_expired);
+	test_assert_strcmp(value, "pass2");
+	test_assert(node != NULL);
+	auth_cache_insert(cache, &request, "%{user}", "", FALSE);
+	value = auth_cache_lookup(cache, &request, "%{user}", &node,
+				  &expired, &neg_expired);
+	test_assert_strcmp(value, "");
+	test_assert(node == NULL);
+
+	/* removal */
+	auth_cache_remove(cache, &request, "%{user}");
+	test_assert(auth_cache_lookup(cache, &request, "%{user}", &node,
+				      &expired, &neg_expired) == NULL);
+	test_auth_request_init(&request, "user1");
+	auth_cache_remove(cache, &request, "%{user}");
+	test_assert(auth_cache_lookup(cache, &request, "%{user}", &node,
+				      &expired, &neg_expired) == NULL);
+
+	/* clearing users removes all the negative entries */
+	auth_cache_insert(cache, &request, "%{user}", "pass1", TRUE);
+	test_auth_request_init(&request, "nouser");
+	auth_cache_insert(cache, &request, "%{user}", "", FALSE);
+	test_assert(auth_cache_clear_users(cache, user_masks) == 1);
+	test_assert(auth_cache_lookup(cache, &request, "%{user}", &node,
+				      &expired, &neg_expired) == NULL);
+	test_assert(auth_cache_clear(cache) == 1);
+
+	auth_cache_free(&cache);
+	test_end();
+}
+
+static void test_auth_cache_eviction(void)
+{
+	struct auth_cache *cache;
+	struct auth_cache_node *node;
+	struct auth_request request;
+	const char *user;
+	unsigned int i, found = 0;
+	bool expired, neg_expired;
+
+	test_begin("auth cache eviction");
+	cache = auth_cache_new(4096, 3600, 0);
+	for (i = 0; i < 100; i++) {
+		user = t_strdup_printf("user%u", i);
+		test_auth_request_init(&request, user);
+		auth_cache_insert(cache, &request, "%{user}", "password", TRUE);
+		/* keep looking up the first user */
+		test_auth_request_init(&request, "user0");
+		if (auth_cache_lookup(cache, &request, "%{user}", &node,
+				      &expired, &neg_expired) != NULL)
+			found++;
+	}
+	test_assert(found == 100);
+
+	/* the oldest unreferenced users were evicted */
+	test_auth_request_init(&request, "user1");
+	test_assert(auth_cache_lookup(cache, &request, "%{user}", &node,
+				      &expired, &neg_expired) == NULL);
+	test_auth_request_init(&request, "user99");
+	test_assert(auth_cache_lookup(cache, &request, "%{user}", &node,
+				      &expired, &neg_expired) != NULL);
+	auth_cache_free(&cache);
+	test_end();
+}
+
+static void
+test_auth_cache_bench(unsigned int user_count, unsigned int lookup_count)
+{
+	struct auth_cache *cache;
+	struct auth_cache_node *node;
+	struct auth_request request;
+	const char *user, *value;
+	unsigned int i, hits = 0, neg_hits = 0;
+	uint64_t ts_0, ts_1;
+	bool expired, neg_expired;
+
+	/* Simulate a credential stuffing wave: 90% of the lookups are done
+	   for nonexistent users, which are cached as negative entries. */
+	cache = auth_cache_new(16*1024*1024, 3600, 3600);
+	for (i = 0; i < user_count; i++) T_BEGIN {
+		test_auth_request_init(&request, t_strdup_printf("user%u", i));
+		auth_cache_insert(cache, &request, "%{user}",
+				  "{PLAIN}password\tquota=100M", TRUE);
+	} T_END;
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < lookup_count; i++) T_BEGIN {
+		if (i % 10 == 0)
+			user = t_strdup_printf("user%u", i % user_count);
+		else
+			user = t_strdup_printf("attack%u", i % (user_count * 10));
+		test_auth_request_init(&request, user);
+		value = auth_cache_lookup(cache, &request, "%{user}", &node,
+					  &expired, &neg_expired);
+		if (value == NULL)
+			auth_cache_insert(cache, &request, "%{user}", "", FALSE);
+		else if (*value == '\0')
+			neg_hits++;
+		else
+			hits++;
+	} T_END;
+	ts_1 = i_nanoseconds();
+
+	printf("%u users, %u lookups: %u positive hits, %u negative hits\n",
+	       user_count, lookup_count, hits, neg_hits);
+	printf("\tTime: %0.03lf s (%0.0lf lookups/s)\n",
+	       (double)(ts_1 - ts_0) / 1000000000.0,
+	       (double)lookup_count * 1000000000.0 / (double)(ts_1 - ts_0));
+	auth_cache_free(&cache);
+}
+
+int main(int argc, char *argv[])
 {
 	lib_init();
 	auth_event = event_create(NULL);
 	static void (*const test_functions[])(void) = {
 		test_auth_cache_parse_key,
 		test_auth_cache_parse_key_errors,
+		test_auth_cache_lookup,
+		test_auth_cache_eviction,
 		NULL
 	};
 
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		/* run a throughput benchmark instead of the tests */
+		test_auth_cache_bench(10000, 1000000);
+		event_unref(&auth_event);
+		lib_deinit();
+		return 0;
+	}
+
 	int ret = test_run(test_functions);
 
 	event_unref(&auth_event);
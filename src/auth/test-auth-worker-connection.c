@@ -0,0 +1,351 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-auth.h"
+#include "ioloop.h"
+#include "array.h"
+#include "net.h"
+#include "istream.h"
+#include "ostream.h"
+#include "str.h"
+#include "strescape.h"
+#include "master-service.h"
+#include "auth-common.h"
+#include "auth-settings.h"
+#include "auth-request.h"
+#include "auth-worker-server.h"
+#include "auth-worker-connection.h"
+
+#include <unistd.h>
+
+#define TEST_AUTH_WORKER_SOCKET "auth-worker"
+#define TEST_TIMEOUT_MSECS (10*1000)
+
+struct test_worker {
+	int fd;
+	struct io *io;
+	struct istream *input;
+	struct ostream *output;
+
+	/* "<id> TAB <data>" lines received from the auth process */
+	ARRAY_TYPE(const_string) requests;
+};
+
+struct test_request {
+	const char *data;
+	const char *reply;
+	unsigned int multiline_count;
+};
+
+static int listen_fd;
+static struct io *io_listen;
+static struct test_worker test_worker;
+static unsigned int test_finished_count;
+static bool test_timed_out;
+static pool_t test_pool;
+
+static void test_worker_input(struct test_worker *worker)
+{
+	const char *line;
+
+	while ((line = i_stream_read_next_line(worker->input)) != NULL) {
+		/* skip the handshake */
+		if (line[0] >= '0' && line[0] <= '9') {
+			line = p_strdup(test_pool, line);
+			array_push_back(&worker->requests, &line);
+		}
+	}
+	if (worker->input->eof)
+		io_remove(&worker->io);
+}
+
+static void test_worker_accept(void *context ATTR_UNUSED)
+{
+	struct test_worker *worker = &test_worker;
+
+	i_assert(worker->fd == -1);
+	worker->fd = net_accept(listen_fd, NULL, NULL);
+	if (worker->fd < 0)
+		i_fatal("net_accept() failed: %m");
+	fd_set_nonblock(worker->fd, TRUE);
+	worker->input = i_stream_create_fd(worker->fd, SIZE_MAX);
+	worker->output = o_stream_create_fd(worker->fd, SIZE_MAX);
+	o_stream_set_no_error_handling(worker->output, TRUE);
+	worker->io = io_add(worker->fd, IO_READ, test_worker_input, worker);
+	o_stream_nsend_str(worker->output, t_strdup_printf(
+		"VERSION\t"AUTH_WORKER_NAME"\t%u\t%u\nPROCESS-LIMIT\t1\n",
+		AUTH_WORKER_PROTOCOL_MAJOR_VERSION,
+		AUTH_WORKER_PROTOCOL_MINOR_VERSION));
+}
+
+static void test_worker_deinit(struct test_worker *worker)
+{
+	io_remove(&worker->io);
+	i_stream_destroy(&worker->input);
+	o_stream_destroy(&worker->output);
+	i_close_fd(&worker->fd);
+}
+
+static bool test_worker_received(const char *data)
+{
+	const char *line;
+
+	array_foreach_elem(&test_worker.requests, line) {
+		if (strcmp(strchr(line, '\t') + 1, data) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void test_worker_reply(const char *data, const char *reply)
+{
+	const char *line, *p;
+
+	array_foreach_elem(&test_worker.requests, line) {
+		p = strchr(line, '\t');
+		if (strcmp(p + 1, data) == 0) {
+			o_stream_nsend_str(test_worker.output, t_strdup_printf(
+				"%s\t%s\n", t_strdup_until(line, p), reply));
+			return;
+		}
+	}
+	i_panic("Request %s wasn't received", data);
+}
+
+static void test_timeout(void *context ATTR_UNUSED)
+{
+	test_timed_out = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+static void test_wait(unsigned int received_count, unsigned int finished_count)
+{
+	struct timeout *to;
+
+	to = timeout_add(TEST_TIMEOUT_MSECS, test_timeout, NULL);
+	while (!test_timed_out &&
+	       (array_count(&test_worker.requests) < received_count ||
+		test_finished_count < finished_count)) {
+		io_loop_set_running(current_ioloop);
+		io_loop_handler_run(current_ioloop);
+	}
+	timeout_remove(&to);
+	test_assert(!test_timed_out);
+}
+
+static void test_flush_timeout(void *context ATTR_UNUSED)
+{
+	io_loop_stop(current_ioloop);
+}
+
+static void test_flush(void)
+{
+	struct timeout *to;
+
+	/* give the worker a chance to read anything that was sent */
+	to = timeout_add_short(10, test_flush_timeout, NULL);
+	io_loop_run(current_ioloop);
+	timeout_remove(&to);
+}
+
+static bool
+test_callback(struct auth_worker_connection *conn ATTR_UNUSED,
+	      const char *const *args, void *context)
+{
+	struct test_request *request = context;
+
+	if (args[0][0] == '*') {
+		request->multiline_count++;
+		return TRUE;
+	}
+	i_assert(request->reply == NULL);
+	request->reply = p_strdup(test_pool, t_strarray_join(args, "\t"));
+	test_finished_count++;
+	return TRUE;
+}
+
+static void test_call(struct test_request *request, const char *data)
+{
+	i_zero(request);
+	request->data = data;
+	auth_worker_call(test_pool, "testuser", data, test_callback, request);
+}
+
+static void test_auth_worker_connection_init(void)
+{
+	test_pool = pool_alloconly_create("test auth worker", 1024);
+	test_finished_count = 0;
+	test_timed_out = FALSE;
+
+	i_zero(&test_worker);
+	test_worker.fd = -1;
+	p_array_init(&test_worker.requests, test_pool, 8);
+
+	i_unlink_if_exists(TEST_AUTH_WORKER_SOCKET);
+	listen_fd = net_listen_unix(TEST_AUTH_WORKER_SOCKET, 10);
+	if (listen_fd == -1)
+		i_fatal("net_listen_unix(%s) failed: %m", TEST_AUTH_WORKER_SOCKET);
+	io_listen = io_add(listen_fd, IO_READ, test_worker_accept, NULL);
+	auth_worker_connection_init();
+}
+
+static void test_auth_worker_connection_deinit(void)
+{
+	auth_worker_connection_deinit();
+	test_worker_deinit(&test_worker);
+	io_remove(&io_listen);
+	i_close_fd(&listen_fd);
+	i_unlink_if_exists(TEST_AUTH_WORKER_SOCKET);
+	pool_unref(&test_pool);
+}
+
+static void test_auth_worker_connection_pipeline(void)
+{
+	const struct auth_settings *orig_set;
+	struct auth_settings set;
+	struct test_request first, req1, req2, req3;
+
+	test_begin("auth worker connection pipelining");
+	test_auth_worker_connection_init();
+	orig_set = global_auth_settings;
+	set = *orig_set;
+	global_auth_settings = &set;
+
+	/* the worker sends its process limit in the handshake */
+	test_call(&first, "PASSV\tfirst");
+	test_wait(1, 0);
+	test_worker_reply("PASSV\tfirst", "OK\tfirst");
+	test_wait(1, 1);
+	test_assert_strcmp(first.reply, "OK\tfirst");
+
+	/* without pipelining, requests are queued while the only allowed
+	   worker is busy */
+	test_call(&req1, "PASSV\treq1");
+	test_call(&req2, "PASSV\treq2");
+	test_wait(2, 1);
+	test_flush();
+	test_assert(test_worker_received("PASSV\treq1"));
+	test_assert(!test_worker_received("PASSV\treq2"));
+	test_worker_reply("PASSV\treq1", "OK\treq1");
+	test_wait(3, 2);
+	test_assert_strcmp(req1.reply, "OK\treq1");
+	test_assert(req2.reply == NULL);
+	test_worker_reply("PASSV\treq2", "OK\treq2");
+	test_wait(3, 3);
+	test_assert_strcmp(req2.reply, "OK\treq2");
+
+	/* with pipelining, up to the limit of requests is sent to the
+	   busy worker and the rest are queued */
+	set.worker_max_pipelined_requests = 2;
+	test_call(&req1, "PASSV\tpipe1");
+	test_call(&req2, "PASSV\tpipe2");
+	test_call(&req3, "PASSV\tpipe3");
+	test_wait(5, 3);
+	test_flush();
+	test_assert(test_worker_received("PASSV\tpipe1"));
+	test_assert(test_worker_received("PASSV\tpipe2"));
+	test_assert(!test_worker_received("PASSV\tpipe3"));
+
+	/* replies are matched by their IDs, so they can arrive out of order.
+	   Each finished request lets a queued one through. */
+	test_worker_reply("PASSV\tpipe2", "OK\tpipe2");
+	test_wait(6, 4);
+	test_assert_strcmp(req2.reply, "OK\tpipe2");
+	test_assert(req1.reply == NULL);
+	test_assert(test_worker_received("PASSV\tpipe3"));
+
+	test_worker_reply("PASSV\tpipe3", "FAIL\tpipe3");
+	test_worker_reply("PASSV\tpipe1", "OK\tpipe1");
+	test_wait(6, 6);
+	test_assert_strcmp(req1.reply, "OK\tpipe1");
+	test_assert_strcmp(req3.reply, "FAIL\tpipe3");
+
+	global_auth_settings = orig_set;
+	test_auth_worker_connection_deinit();
+	test_end();
+}
+
+static void test_auth_worker_connection_pipeline_list(void)
+{
+	const struct auth_settings *orig_set;
+	struct auth_settings set;
+	struct test_request first, list, req1, req2;
+
+	test_begin("auth worker connection pipelining with LIST");
+	test_auth_worker_connection_init();
+	orig_set = global_auth_settings;
+	set = *orig_set;
+	set.worker_max_pipelined_requests = 10;
+	global_auth_settings = &set;
+
+	test_call(&first, "PASSV\tfirst");
+	test_wait(1, 0);
+	test_worker_reply("PASSV\tfirst", "OK");
+	test_wait(1, 1);
+
+	/* nothing is pipelined after LIST */
+	test_call(&list, "LIST\t1\tservice=test");
+	test_call(&req1, "PASSV\treq1");
+	test_wait(2, 1);
+	test_flush();
+	test_assert(!test_worker_received("PASSV\treq1"));
+	test_worker_reply("LIST\t1\tservice=test", "*\tuser1");
+	test_worker_reply("LIST\t1\tservice=test", "*\tuser2");
+	test_worker_reply("LIST\t1\tservice=test", "OK");
+	test_wait(3, 2);
+	test_assert(list.multiline_count == 2);
+	test_assert_strcmp(list.reply, "OK");
+	test_assert(test_worker_received("PASSV\treq1"));
+
+	/* LIST isn't pipelined after other requests, and it blocks the
+	   requests queued after it */
+	test_call(&list, "LIST\t2\tservice=test");
+	test_call(&req2, "PASSV\treq2");
+	test_flush();
+	test_assert(!test_worker_received("LIST\t2\tservice=test"));
+	test_assert(!test_worker_received("PASSV\treq2"));
+	test_worker_reply("PASSV\treq1", "OK\treq1");
+	test_wait(4, 3);
+	test_flush();
+	test_assert_strcmp(req1.reply, "OK\treq1");
+	test_assert(test_worker_received("LIST\t2\tservice=test"));
+	test_assert(!test_worker_received("PASSV\treq2"));
+	test_worker_reply("LIST\t2\tservice=test", "OK");
+	test_wait(5, 4);
+	test_worker_reply("PASSV\treq2", "OK\treq2");
+	test_wait(5, 5);
+	test_assert_strcmp(req2.reply, "OK\treq2");
+
+	global_auth_settings = orig_set;
+	test_auth_worker_connection_deinit();
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*const test_functions[])(void) = {
+		test_auth_worker_connection_pipeline,
+		test_auth_worker_connection_pipeline_list,
+		NULL
+	};
+	const enum master_service_flags service_flags =
+		MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+		MASTER_SERVICE_FLAG_STANDALONE |
+		MASTER_SERVICE_FLAG_STD_CLIENT |
+		MASTER_SERVICE_FLAG_DONT_SEND_STATS;
+	int ret;
+
+	master_service = master_service_init("test-auth-worker-connection",
+					     service_flags, &argc, &argv, "");
+
+	master_service_init_finish(master_service);
+
+	struct ioloop *ioloop = io_loop_create();
+	io_loop_set_current(ioloop);
+	test_auth_init();
+	ret = test_run(test_functions);
+	test_auth_deinit();
+	io_loop_destroy(&ioloop);
+
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -662,7 +662,9 @@ cmd_dsync_ibc_stream_init(struct dsync_cmd_context *ctx,
 					    &ctx->input, &ctx->output);
 	}
 	return dsync_ibc_init_stream(ctx->input, ctx->output,
-				     name, temp_prefix, ctx->io_timeout_secs);
+				     name, temp_prefix, ctx->io_timeout_secs,
+				     ctx->ctx.cctx->event,
+				     doveadm_settings->dsync_compression);
 }
 
 static void dsync_errors_finish(struct dsync_cmd_context *ctx)
@@ -718,6 +720,7 @@ cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 	memcpy(set.sync_box_guid, ctx->mailbox_guid, sizeof(set.sync_box_guid));
 	set.lock_timeout_secs = ctx->lock_timeout;
 	set.import_commit_msgs_interval = ctx->import_commit_msgs_interval;
+	set.mailbox_concurrency = doveadm_settings->dsync_mailbox_concurrency;
 	set.state = ctx->state_input;
 	set.mailbox_alt_char = doveadm_settings->dsync_alt_char[0];
 	if (*doveadm_settings->dsync_hashed_headers == '\0') {
@@ -212,7 +212,9 @@ static void cmd_index_queue(struct index_cmd_context *ctx,
 	T_BEGIN {
 		string_t *str = t_str_new(256);
 
-		str_append(str, "APPEND\t0\t");
+		/* queued with a low priority, so it doesn't delay indexing
+		   that someone is waiting for */
+		str_append(str, "BULK\t0\t");
 		str_append_tabescaped(str, user->username);
 		str_append_c(str, '\t');
 		str_append_tabescaped(str, mailbox);
@@ -228,7 +230,7 @@ static void cmd_index_queue(struct index_cmd_context *ctx,
 				i_stream_get_error(ctx->queue_input));
 		}
 		if (strcmp(line, "0\tOK") != 0)
-			i_fatal("indexer: APPEND returned unexpected reply: %s", line);
+			i_fatal("indexer: BULK returned unexpected reply: %s", line);
 	} T_END;
 }
 
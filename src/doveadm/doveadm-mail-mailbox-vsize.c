@@ -0,0 +1,240 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "istream.h"
+#include "message-size.h"
+#include "mail-index.h"
+#include "mail-search-build.h"
+#include "mail-storage-private.h"
+#include "index-mailbox-size.h"
+#include "doveadm-print.h"
+#include "doveadm-mail.h"
+
+struct mailbox_vsize_cmd_context {
+	struct doveadm_mail_cmd_context ctx;
+
+	const char *const *boxes;
+	bool rebuild;
+};
+
+static bool
+cmd_mailbox_vsize_get_hdr(struct mailbox *box,
+			  struct mailbox_index_vsize *vsize_hdr_r)
+{
+	const void *data;
+	size_t size;
+
+	mail_index_get_header_ext(box->view, box->vsize_hdr_ext_id,
+				  &data, &size);
+	if (size != sizeof(*vsize_hdr_r)) {
+		i_zero(vsize_hdr_r);
+		return FALSE;
+	}
+	memcpy(vsize_hdr_r, data, sizeof(*vsize_hdr_r));
+	return vsize_hdr_r->highest_uid > 0;
+}
+
+static int
+cmd_mailbox_vsize_mail_get_body_vsize(struct mail *mail, uoff_t *vsize_r)
+{
+	struct message_size hdr_size, body_size;
+	struct istream *input;
+	bool has_nuls;
+
+	/* parse the message instead of looking up the vsize, which could be
+	   the broken value in the index */
+	if (mail_get_stream_because(mail, NULL, NULL, "vsize verify",
+				    &input) < 0)
+		return -1;
+	if (message_get_header_size(input, &hdr_size, &has_nuls) < 0 ||
+	    message_get_body_size(input, &body_size, &has_nuls) < 0) {
+		mail_set_critical(mail, "read(%s) failed: %s",
+				  i_stream_get_name(input),
+				  i_stream_get_error(input));
+		return -1;
+	}
+	*vsize_r = hdr_size.virtual_size + body_size.virtual_size;
+	return 0;
+}
+
+static int
+cmd_mailbox_vsize_count(struct mailbox *box, uint32_t highest_uid,
+			bool mark_broken, uint64_t *vsize_r, uint32_t *count_r,
+			uint32_t *broken_count_r)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_context *search_ctx;
+	struct mail_search_args *search_args;
+	struct mail *mail;
+	uint32_t seq1, seq2;
+	uoff_t index_vsize, vsize;
+	int ret = 0;
+
+	*vsize_r = 0;
+	*count_r = 0;
+	*broken_count_r = 0;
+	if (!mail_index_lookup_seq_range(box->view, 1, highest_uid,
+					 &seq1, &seq2))
+		return 0;
+
+	/* count only the mails that the header is supposed to contain */
+	search_args = mail_search_build_init();
+	mail_search_build_add_seqset(search_args, seq1, seq2);
+	trans = mailbox_transaction_begin(box, 0, "doveadm mailbox vsize");
+	search_ctx = mailbox_search_init(trans, search_args, NULL,
+					 MAIL_FETCH_VIRTUAL_SIZE |
+					 MAIL_FETCH_STREAM_HEADER |
+					 MAIL_FETCH_STREAM_BODY, NULL);
+	mail_search_args_unref(&search_args);
+	while (mailbox_search_next(search_ctx, &mail)) {
+		/* look up the mail's vsize from the index before opening the
+		   stream, since parsing the stream could replace it */
+		if (mail_get_virtual_size(mail, &index_vsize) < 0 ||
+		    cmd_mailbox_vsize_mail_get_body_vsize(mail, &vsize) < 0) {
+			if (mail->expunged)
+				continue;
+			ret = -1;
+			break;
+		}
+		if (index_vsize != vsize) {
+			(*broken_count_r)++;
+			if (mark_broken) {
+				mail_set_cache_corrupted(mail,
+					MAIL_FETCH_VIRTUAL_SIZE, t_strdup_printf(
+					"vsize %"PRIuUOFF_T" != parsed vsize "
+					"%"PRIuUOFF_T, index_vsize, vsize));
+			}
+		}
+		*vsize_r += vsize;
+		(*count_r)++;
+	}
+	if (mailbox_search_deinit(&search_ctx) < 0)
+		ret = -1;
+	if (mailbox_transaction_commit(&trans) < 0)
+		ret = -1;
+	return ret;
+}
+
+static int cmd_mailbox_vsize_rebuild(struct mailbox *box)
+{
+	/* make the reset per-mail vsizes visible before rebuilding */
+	if (mailbox_sync(box, 0) < 0)
+		return -1;
+	if (index_mailbox_vsize_rebuild(box) < 0)
+		return -1;
+	return mailbox_sync(box, 0);
+}
+
+static int
+cmd_mailbox_vsize_verify_box(struct mailbox_vsize_cmd_context *ctx,
+			     struct mailbox *box)
+{
+	struct mailbox_index_vsize vsize_hdr;
+	const char *result;
+	uint64_t vsize;
+	uint32_t count, broken_count;
+
+	if (mailbox_open(box) < 0 || mailbox_sync(box, 0) < 0)
+		return -1;
+
+	if (!cmd_mailbox_vsize_get_hdr(box, &vsize_hdr)) {
+		/* the header is built only once the vsize is looked up */
+		vsize = 0;
+		count = 0;
+		broken_count = 0;
+		result = "missing";
+	} else if (cmd_mailbox_vsize_count(box, vsize_hdr.highest_uid,
+					   ctx->rebuild, &vsize, &count,
+					   &broken_count) < 0)
+		return -1;
+	else if (vsize_hdr.vsize != vsize ||
+		 vsize_hdr.message_count != count || broken_count > 0)
+		result = "mismatch";
+	else
+		result = "ok";
+
+	if (ctx->rebuild && strcmp(result, "ok") != 0) {
+		if (cmd_mailbox_vsize_rebuild(box) < 0)
+			return -1;
+		(void)cmd_mailbox_vsize_get_hdr(box, &vsize_hdr);
+		if (cmd_mailbox_vsize_count(box, vsize_hdr.highest_uid, FALSE,
+					    &vsize, &count, &broken_count) < 0)
+			return -1;
+		result = "rebuilt";
+	}
+
+	doveadm_print(mailbox_get_vname(box));
+	doveadm_print_num(vsize_hdr.vsize);
+	doveadm_print_num(vsize_hdr.message_count);
+	doveadm_print_num(vsize_hdr.highest_uid);
+	doveadm_print_num(vsize);
+	doveadm_print_num(count);
+	doveadm_print_num(broken_count);
+	doveadm_print(result);
+	return 0;
+}
+
+static int cmd_mailbox_vsize_verify_run(struct doveadm_mail_cmd_context *_ctx,
+					struct mail_user *user)
+{
+	struct mailbox_vsize_cmd_context *ctx =
+		container_of(_ctx, struct mailbox_vsize_cmd_context, ctx);
+	const char *const *boxname;
+	int ret = 0;
+
+	for (boxname = ctx->boxes; *boxname != NULL; boxname++) {
+		struct mailbox *box = doveadm_mailbox_find(user, *boxname);
+
+		if (cmd_mailbox_vsize_verify_box(ctx, box) < 0) {
+			e_error(_ctx->cctx->event,
+				"Couldn't verify mailbox %s vsize: %s",
+				mailbox_get_vname(box),
+				mailbox_get_last_internal_error(box, NULL));
+			doveadm_mail_failed_mailbox(_ctx, box);
+			ret = -1;
+		}
+		mailbox_free(&box);
+	}
+	return ret;
+}
+
+static void cmd_mailbox_vsize_verify_init(struct doveadm_mail_cmd_context *_ctx)
+{
+	struct doveadm_cmd_context *cctx = _ctx->cctx;
+	struct mailbox_vsize_cmd_context *ctx =
+		container_of(_ctx, struct mailbox_vsize_cmd_context, ctx);
+
+	ctx->rebuild = doveadm_cmd_param_flag(cctx, "rebuild");
+	if (!doveadm_cmd_param_array(cctx, "mailbox", &ctx->boxes))
+		doveadm_mail_help_name("mailbox vsize verify");
+
+	doveadm_print_header_simple("mailbox");
+	doveadm_print_header_simple("vsize");
+	doveadm_print_header_simple("messages");
+	doveadm_print_header_simple("highest_uid");
+	doveadm_print_header_simple("actual_vsize");
+	doveadm_print_header_simple("actual_messages");
+	doveadm_print_header_simple("broken_messages");
+	doveadm_print_header_simple("result");
+}
+
+static struct doveadm_mail_cmd_context *cmd_mailbox_vsize_verify_alloc(void)
+{
+	struct mailbox_vsize_cmd_context *ctx =
+		doveadm_mail_cmd_alloc(struct mailbox_vsize_cmd_context);
+	ctx->ctx.v.init = cmd_mailbox_vsize_verify_init;
+	ctx->ctx.v.run = cmd_mailbox_vsize_verify_run;
+	doveadm_print_init(DOVEADM_PRINT_TYPE_TABLE);
+	return &ctx->ctx;
+}
+
+struct doveadm_cmd_ver2 doveadm_cmd_mailbox_vsize_verify = {
+	.name = "mailbox vsize verify",
+	.mail_cmd = cmd_mailbox_vsize_verify_alloc,
+	.usage = DOVEADM_CMD_MAIL_USAGE_PREFIX"[-r] <mailbox> [...]",
+DOVEADM_CMD_PARAMS_START
+DOVEADM_CMD_MAIL_COMMON
+DOVEADM_CMD_PARAM('r', "rebuild", CMD_PARAM_BOOL, 0)
+DOVEADM_CMD_PARAM('\0', "mailbox", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
+DOVEADM_CMD_PARAMS_END
+};
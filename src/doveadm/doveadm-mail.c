@@ -822,6 +822,7 @@ static struct doveadm_cmd_ver2 *mail_commands_ver2[] = {
 	&doveadm_cmd_mailbox_cache_decision,
 	&doveadm_cmd_mailbox_cache_remove,
 	&doveadm_cmd_mailbox_cache_purge,
+	&doveadm_cmd_mailbox_vsize_verify,
 	&doveadm_cmd_rebuild_attachments,
 	&doveadm_cmd_mail_fs_get,
 	&doveadm_cmd_mail_fs_put,
@@ -212,6 +212,7 @@ extern struct doveadm_cmd_ver2 doveadm_cmd_mailbox_path_ver2;
 extern struct doveadm_cmd_ver2 doveadm_cmd_mailbox_cache_decision;
 extern struct doveadm_cmd_ver2 doveadm_cmd_mailbox_cache_remove;
 extern struct doveadm_cmd_ver2 doveadm_cmd_mailbox_cache_purge;
+extern struct doveadm_cmd_ver2 doveadm_cmd_mailbox_vsize_verify;
 extern struct doveadm_cmd_ver2 doveadm_cmd_rebuild_attachments;
 extern struct doveadm_cmd_ver2 doveadm_cmd_mail_fs_get;
 extern struct doveadm_cmd_ver2 doveadm_cmd_mail_fs_put;
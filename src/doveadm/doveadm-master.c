@@ -227,6 +227,7 @@ static void cmd_service_status(struct doveadm_cmd_context *cctx)
 static void cmd_process_status(struct doveadm_cmd_context *cctx)
 {
 	const char *line, *const *services;
+	unsigned int fields_count;
 
 	if (!doveadm_cmd_param_array(cctx, "service", &services))
 		services = NULL;
@@ -242,6 +243,9 @@ static void cmd_process_status(struct doveadm_cmd_context *cctx)
 	doveadm_print_header_simple("idle_start");
 	doveadm_print_header_simple("last_status_update");
 	doveadm_print_header_simple("last_kill_sent");
+	doveadm_print_header_simple("listen_queue");
+	doveadm_print_header_simple("listen_overflow");
+	fields_count = doveadm_print_get_headers_count();
 
 	alarm(5);
 	while ((line = i_stream_read_next_line(input)) != NULL) {
@@ -250,8 +254,10 @@ static void cmd_process_status(struct doveadm_cmd_context *cctx)
 		T_BEGIN {
 			const char *const *args = t_strsplit_tabescaped(line);
 			if (str_array_length(args) >= 7) {
-				for (unsigned int i = 0; i < 7; i++)
+				unsigned int i;
+				for (i = 0; i < fields_count && args[i] != NULL; i++)
 					doveadm_print(args[i]);
+				doveadm_print_empty(fields_count - i);
 			}
 		} T_END;
 	}
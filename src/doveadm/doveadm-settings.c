@@ -80,6 +80,8 @@ static const struct setting_define doveadm_setting_defines[] = {
 	DEF(STR, dsync_features),
 	DEF(UINT, dsync_commit_msgs_interval),
 	DEF(STR_HIDDEN, dsync_hashed_headers),
+	DEF(STR, dsync_compression),
+	DEF(UINT, dsync_mailbox_concurrency),
 
 	{ .type = SET_FILTER_NAME, .key = DOVEADM_SERVER_FILTER },
 
@@ -109,7 +111,9 @@ const struct doveadm_settings doveadm_default_settings = {
 	.dsync_remote_cmd = "ssh -l%{login} %{host} doveadm dsync-server -u%{user}",
 	.dsync_features = "",
 	.dsync_hashed_headers = "Date Message-ID",
+	.dsync_compression = "",
 	.dsync_commit_msgs_interval = 100,
+	.dsync_mailbox_concurrency = 1,
 	.doveadm_api_key = "",
 };
 
@@ -35,7 +35,9 @@ struct doveadm_settings {
 	const char *doveadm_api_key;
 	const char *dsync_features;
 	const char *dsync_hashed_headers;
+	const char *dsync_compression;
 	unsigned int dsync_commit_msgs_interval;
+	unsigned int dsync_mailbox_concurrency;
 	enum dsync_features parsed_features;
 };
 
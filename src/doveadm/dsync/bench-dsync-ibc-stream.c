@@ -0,0 +1,269 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "ostream.h"
+#include "str.h"
+#include "strnum.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "settings.h"
+#include "compression.h"
+#include "dsync-mail.h"
+#include "dsync-ibc.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/**
+ * Sends a number of semi-compressible emails from one dsync stream IBC to
+ * another over a socketpair, once without compression and once with each
+ * compression algorithm usable for the stream. It measures the wall clock
+ * time spent and the number of bytes written to the socket.
+ */
+
+#define BENCH_TEMP_PATH_PREFIX "/tmp/bench-dsync-ibc-stream"
+#define BENCH_TIMEOUT_SECS 600
+
+struct bench_context {
+	struct event *event;
+	const char *compression;
+	const unsigned char *msg;
+	size_t msg_size;
+	unsigned long msg_count;
+
+	struct dsync_ibc *sender, *receiver;
+	bool sender_handshake, receiver_handshake;
+	unsigned long sent_count, recv_count;
+	uoff_t recv_bytes;
+	bool eol_sent;
+	bool failed;
+};
+
+/* the compressions that dsync can use for the stream */
+static const char *const compressions[] = { "zstd", "lz4", "deflate" };
+
+static const struct dsync_ibc_settings bench_ibc_set = {
+	.hostname = "bench",
+};
+
+static void bench_sender_callback(void *context)
+{
+	struct bench_context *ctx = context;
+	const struct dsync_ibc_settings *set;
+	struct dsync_mail mail;
+
+	if (dsync_ibc_has_failed(ctx->sender)) {
+		ctx->failed = TRUE;
+		io_loop_stop(current_ioloop);
+		return;
+	}
+	if (!ctx->sender_handshake) {
+		if (dsync_ibc_recv_handshake(ctx->sender, &set) !=
+		    DSYNC_IBC_RECV_RET_OK)
+			return;
+		ctx->sender_handshake = TRUE;
+	}
+
+	while (ctx->sent_count < ctx->msg_count &&
+	       !dsync_ibc_is_send_queue_full(ctx->sender)) {
+		i_zero(&mail);
+		mail.guid = "";
+		mail.uid = ++ctx->sent_count;
+		mail.input = i_stream_create_from_data(ctx->msg, ctx->msg_size);
+		dsync_ibc_send_mail(ctx->sender, &mail);
+		i_stream_unref(&mail.input);
+	}
+	if (ctx->sent_count == ctx->msg_count && !ctx->eol_sent &&
+	    !dsync_ibc_is_send_queue_full(ctx->sender)) {
+		dsync_ibc_send_end_of_list(ctx->sender, DSYNC_IBC_EOL_MAILS);
+		ctx->eol_sent = TRUE;
+	}
+}
+
+static void bench_receiver_callback(void *context)
+{
+	struct bench_context *ctx = context;
+	const struct dsync_ibc_settings *set;
+	struct dsync_mail *mail;
+	enum dsync_ibc_recv_ret ret;
+	const unsigned char *data;
+	size_t size;
+
+	if (dsync_ibc_has_failed(ctx->receiver)) {
+		ctx->failed = TRUE;
+		io_loop_stop(current_ioloop);
+		return;
+	}
+	if (!ctx->receiver_handshake) {
+		if (dsync_ibc_recv_handshake(ctx->receiver, &set) !=
+		    DSYNC_IBC_RECV_RET_OK)
+			return;
+		ctx->receiver_handshake = TRUE;
+	}
+
+	while ((ret = dsync_ibc_recv_mail(ctx->receiver, &mail)) ==
+	       DSYNC_IBC_RECV_RET_OK) {
+		/* the stream has already been fully read by the IBC */
+		while (i_stream_read_more(mail->input, &data, &size) > 0) {
+			ctx->recv_bytes += size;
+			i_stream_skip(mail->input, size);
+		}
+		if (mail->input->stream_errno != 0) {
+			i_error("read(%s) failed: %s",
+				i_stream_get_name(mail->input),
+				i_stream_get_error(mail->input));
+			ctx->failed = TRUE;
+		}
+		ctx->recv_count++;
+	}
+	if (ret == DSYNC_IBC_RECV_RET_FINISHED)
+		io_loop_stop(current_ioloop);
+}
+
+static void bench_dsync_ibc_stream(struct bench_context *ctx)
+{
+	struct ioloop *ioloop;
+	struct istream *input1, *input2;
+	struct ostream *output1, *output2;
+	uint64_t ts_0, ts_1;
+	uoff_t wire_bytes;
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		i_fatal("socketpair() failed: %m");
+	fd_set_nonblock(fds[0], TRUE);
+	fd_set_nonblock(fds[1], TRUE);
+
+	ioloop = io_loop_create();
+	input1 = i_stream_create_fd(fds[0], SIZE_MAX);
+	output1 = o_stream_create_fd(fds[0], SIZE_MAX);
+	input2 = i_stream_create_fd(fds[1], SIZE_MAX);
+	output2 = o_stream_create_fd(fds[1], SIZE_MAX);
+
+	ctx->sent_count = ctx->recv_count = 0;
+	ctx->recv_bytes = 0;
+	ctx->sender_handshake = ctx->receiver_handshake = FALSE;
+	ctx->eol_sent = ctx->failed = FALSE;
+
+	ts_0 = i_nanoseconds();
+	ctx->sender = dsync_ibc_init_stream(input1, output1, "sender",
+					    BENCH_TEMP_PATH_PREFIX,
+					    BENCH_TIMEOUT_SECS, ctx->event,
+					    ctx->compression);
+	ctx->receiver = dsync_ibc_init_stream(input2, output2, "receiver",
+					      BENCH_TEMP_PATH_PREFIX,
+					      BENCH_TIMEOUT_SECS, ctx->event,
+					      ctx->compression);
+	dsync_ibc_set_io_callback(ctx->sender, bench_sender_callback, ctx);
+	dsync_ibc_set_io_callback(ctx->receiver, bench_receiver_callback, ctx);
+	dsync_ibc_send_handshake(ctx->sender, &bench_ibc_set);
+	dsync_ibc_send_handshake(ctx->receiver, &bench_ibc_set);
+
+	io_loop_run(ioloop);
+	ts_1 = i_nanoseconds();
+	wire_bytes = output1->offset;
+
+	dsync_ibc_deinit(&ctx->sender);
+	dsync_ibc_deinit(&ctx->receiver);
+	i_stream_unref(&input1);
+	i_stream_unref(&input2);
+	o_stream_unref(&output1);
+	o_stream_unref(&output2);
+	io_loop_destroy(&ioloop);
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+
+	if (ctx->failed || ctx->recv_count != ctx->msg_count ||
+	    ctx->recv_bytes != (uoff_t)ctx->msg_size * ctx->msg_count)
+		i_fatal("%s: transfer failed", ctx->compression);
+
+	double secs = (double)(ts_1 - ts_0) / 1000000000.0;
+	double mb = (double)ctx->recv_bytes / (1024.0 * 1024.0);
+	printf("%s\n", ctx->compression[0] == '\0' ? "none" : ctx->compression);
+	printf("\tTime: %0.03lf s (%0.02lf MB/s, %0.02lf us/mail)\n",
+	       secs, mb / secs,
+	       (double)(ts_1 - ts_0) / 1000.0 / (double)ctx->msg_count);
+	printf("\tSent: %"PRIuUOFF_T" bytes (%0.02lf%% of mail data)\n\n",
+	       wire_bytes, (double)wire_bytes * 100.0 /
+	       (double)ctx->recv_bytes);
+}
+
+static void bench_generate_mail(string_t *str, size_t size)
+{
+	static const char *const words[] = {
+		"dovecot", "mailbox", "synchronization", "message", "the",
+		"of", "and", "replication", "index", "header", "a", "to",
+	};
+
+	str_append(str, "From: sender@example.com\r\n"
+		   "To: recipient@example.com\r\n"
+		   "Subject: benchmark\r\n"
+		   "Message-ID: <bench@example.com>\r\n\r\n");
+	while (str_len(str) < size) {
+		/* dots at the beginning of lines need escaping in the text
+		   based protocol */
+		if (i_rand_limit(20) == 0)
+			str_append_c(str, '.');
+		for (unsigned int i = 0; i < 10; i++) {
+			str_append(str, words[i_rand_limit(N_ELEMENTS(words))]);
+			str_append_c(str, ' ');
+		}
+		str_append(str, "\r\n");
+	}
+	str_truncate(str, size);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<mail_size> [<count>]]\n", prog);
+	fprintf(stderr, "Runs with 1000 64k mails if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct bench_context ctx;
+	struct settings_simple set;
+	unsigned long mail_size = 65536UL;
+	unsigned long mail_count = 1000UL;
+	string_t *msg;
+
+	lib_init();
+
+	if (argc >= 2 && str_to_ulong(argv[1], &mail_size) < 0)
+		print_usage(argv[0]);
+	if (argc >= 3 && str_to_ulong(argv[2], &mail_count) < 0)
+		print_usage(argv[0]);
+	if (argc > 3)
+		print_usage(argv[0]);
+
+	msg = str_new(default_pool, mail_size + 128);
+	bench_generate_mail(msg, mail_size);
+
+	settings_simple_init(&set, NULL);
+	i_zero(&ctx);
+	ctx.event = set.event;
+	ctx.msg = str_data(msg);
+	ctx.msg_size = str_len(msg);
+	ctx.msg_count = mail_count;
+	printf("Input data is %lu mails of %zu bytes\n\n",
+	       mail_count, ctx.msg_size);
+
+	ctx.compression = "";
+	bench_dsync_ibc_stream(&ctx);
+	for (unsigned int i = 0; i < N_ELEMENTS(compressions); i++) T_BEGIN {
+		const struct compression_handler *handler;
+
+		if (compression_lookup_handler(compressions[i], &handler) > 0) {
+			ctx.compression = compressions[i];
+			bench_dsync_ibc_stream(&ctx);
+		}
+	} T_END;
+
+	str_free(&msg);
+	settings_simple_deinit(&set);
+	lib_deinit();
+}
@@ -3,6 +3,8 @@
 #include "lib.h"
 #include "array.h"
 #include "hash.h"
+#include "ioloop.h"
+#include "time-util.h"
 #include "mail-cache-private.h"
 #include "mail-namespace.h"
 #include "mail-storage-private.h"
@@ -155,6 +157,12 @@ dsync_brain_sync_mailbox_init(struct dsync_brain *brain,
 				      brain->dsync_box_pool);
 	i_zero(&brain->remote_dsync_box);
 
+	brain->box_event = event_create(brain->event);
+	event_add_str(brain->box_event, "mailbox", mailbox_get_vname(box));
+	brain->box_sync_start = ioloop_timeval;
+	brain->box_mails_sent = 0;
+	brain->box_mails_received = 0;
+
 	state = dsync_mailbox_state_find(brain, local_dsync_box->mailbox_guid);
 	if (state != NULL)
 		brain->mailbox_state = *state;
@@ -369,6 +377,29 @@ int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
 	return 1;
 }
 
+static void dsync_brain_sync_mailbox_finished_event(struct dsync_brain *brain)
+{
+	struct event_passthrough *e;
+	long long usecs;
+	unsigned int mails;
+
+	if (brain->box_event == NULL)
+		return;
+
+	usecs = timeval_diff_usecs(&ioloop_timeval, &brain->box_sync_start);
+	mails = brain->box_mails_sent + brain->box_mails_received;
+
+	e = event_create_passthrough(brain->box_event)->
+		set_name("dsync_mailbox_finished")->
+		add_int("mails_sent", brain->box_mails_sent)->
+		add_int("mails_received", brain->box_mails_received);
+	e_debug(e->event(), "Mailbox synced: %u mails in %lld.%03lld secs "
+		"(%.1f mails/sec)", mails, usecs / 1000000,
+		(usecs / 1000) % 1000,
+		usecs <= 0 ? 0.0 : mails * 1000000.0 / usecs);
+	event_unref(&brain->box_event);
+}
+
 void dsync_brain_sync_mailbox_deinit(struct dsync_brain *brain)
 {
 	enum mail_error error;
@@ -409,6 +440,7 @@ void dsync_brain_sync_mailbox_deinit(struct dsync_brain *brain)
 	file_lock_free(&brain->box_lock);
 	mailbox_free(&brain->box);
 
+	dsync_brain_sync_mailbox_finished_event(brain);
 	brain->state = brain->pre_box_state;
 }
 
@@ -583,7 +615,7 @@ dsync_brain_next_mailbox(struct dsync_brain *brain, struct mailbox **box_r,
 {
 	int ret;
 
-	if (brain->no_mail_sync)
+	if (brain->no_mail_sync || brain->local_tree_iter == NULL)
 		return FALSE;
 
 	while ((ret = dsync_brain_try_next_mailbox(brain, box_r, lock_r, dsync_box_r)) == 0)
@@ -591,8 +623,47 @@ dsync_brain_next_mailbox(struct dsync_brain *brain, struct mailbox **box_r,
 	return ret > 0;
 }
 
+static void dsync_brain_master_send_pending_mailboxes(struct dsync_brain *brain)
+{
+	struct dsync_brain_pending_mailbox *pending;
+	struct dsync_mailbox dsync_box;
+	struct mailbox *box;
+	struct file_lock *lock;
+
+	/* The remote handles the mailboxes in the order they were sent, so
+	   its replies to the pending mailboxes are already waiting by the time
+	   we get to them. The current mailbox counts towards the limit. */
+	while (array_count(&brain->pending_mailboxes) + 1 <
+	       brain->mailbox_concurrency && !brain->failed) {
+		if (!dsync_brain_next_mailbox(brain, &box, &lock, &dsync_box))
+			break;
+		dsync_ibc_send_mailbox(brain->ibc, &dsync_box);
+
+		pending = array_append_space(&brain->pending_mailboxes);
+		pending->pool = pool_alloconly_create("dsync pending mailbox",
+						      512);
+		pending->box = box;
+		pending->relock = lock != NULL;
+		file_lock_free(&lock);
+		dsync_mailbox_dup(pending->pool, &dsync_box,
+				  &pending->dsync_box);
+	}
+}
+
+void dsync_brain_pending_mailboxes_free(struct dsync_brain *brain)
+{
+	struct dsync_brain_pending_mailbox *pending;
+
+	array_foreach_modifiable(&brain->pending_mailboxes, pending) {
+		mailbox_free(&pending->box);
+		pool_unref(&pending->pool);
+	}
+	array_clear(&brain->pending_mailboxes);
+}
+
 void dsync_brain_master_send_mailbox(struct dsync_brain *brain)
 {
+	struct dsync_brain_pending_mailbox pending;
 	struct dsync_mailbox dsync_box;
 	struct mailbox *box;
 	struct file_lock *lock;
@@ -600,16 +671,34 @@ void dsync_brain_master_send_mailbox(struct dsync_brain *brain)
 	i_assert(brain->master_brain);
 	i_assert(brain->box == NULL);
 
-	if (!dsync_brain_next_mailbox(brain, &box, &lock, &dsync_box)) {
+	if (array_count(&brain->pending_mailboxes) > 0) {
+		/* this mailbox was already sent to remote */
+		pending = *array_front(&brain->pending_mailboxes);
+		array_pop_front(&brain->pending_mailboxes);
+		lock = NULL;
+		if (pending.relock &&
+		    dsync_mailbox_lock(brain, pending.box, &lock) < 0) {
+			brain->failed = TRUE;
+			mailbox_free(&pending.box);
+			pool_unref(&pending.pool);
+			return;
+		}
+		dsync_brain_sync_mailbox_init(brain, pending.box, lock,
+					      &pending.dsync_box, TRUE);
+		pool_unref(&pending.pool);
+	} else if (!dsync_brain_next_mailbox(brain, &box, &lock, &dsync_box)) {
 		brain->state = DSYNC_STATE_FINISH;
 		dsync_ibc_send_end_of_list(brain->ibc, DSYNC_IBC_EOL_MAILBOX);
 		return;
+	} else {
+		/* start exporting this mailbox (wait for remote to start
+		   importing) */
+		dsync_ibc_send_mailbox(brain->ibc, &dsync_box);
+		dsync_brain_sync_mailbox_init(brain, box, lock, &dsync_box,
+					      TRUE);
 	}
-
-	/* start exporting this mailbox (wait for remote to start importing) */
-	dsync_ibc_send_mailbox(brain->ibc, &dsync_box);
-	dsync_brain_sync_mailbox_init(brain, box, lock, &dsync_box, TRUE);
 	brain->state = DSYNC_STATE_SYNC_MAILS;
+	dsync_brain_master_send_pending_mailboxes(brain);
 }
 
 bool dsync_boxes_need_sync(struct dsync_brain *brain,
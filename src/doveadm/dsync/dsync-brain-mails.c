@@ -308,6 +308,7 @@ static bool dsync_brain_recv_mail(struct dsync_brain *brain)
 			mail->uid, mail->guid);
 	if (dsync_mailbox_import_mail(brain->box_importer, mail) < 0)
 		brain->failed = TRUE;
+	brain->box_mails_received++;
 	i_stream_unref(&mail->input);
 	return TRUE;
 }
@@ -326,6 +327,7 @@ static bool dsync_brain_send_mail(struct dsync_brain *brain)
 	}
 
 	while (dsync_mailbox_export_next_mail(brain->box_exporter, &mail) > 0) {
+		brain->box_mails_sent++;
 		if (dsync_ibc_send_mail(brain->ibc, mail) == 0)
 			return TRUE;
 	}
@@ -9,6 +9,8 @@
 #define DSYNC_LOCK_FILENAME ".dovecot-sync.lock"
 #define DSYNC_MAILBOX_LOCK_FILENAME ".dovecot-box-sync.lock"
 #define DSYNC_MAILBOX_DEFAULT_LOCK_TIMEOUT_SECS 30
+/* Each mailbox sent ahead of time is kept open until it's synced */
+#define DSYNC_MAILBOX_MAX_CONCURRENCY 32
 
 struct dsync_mailbox_tree_sync_change;
 
@@ -48,6 +50,18 @@ enum dsync_box_state {
 	DSYNC_BOX_STATE_DONE
 };
 
+/* Mailbox that the master brain has already sent to the remote, but hasn't
+   yet started syncing. The mailbox lock isn't held while waiting, so other
+   dsyncs aren't blocked by the whole pipeline. */
+struct dsync_brain_pending_mailbox {
+	pool_t pool;
+	struct mailbox *box;
+	struct dsync_mailbox dsync_box;
+	/* The mailbox was locked while its state was looked up, so it needs
+	   to be locked again once syncing it starts. */
+	bool relock;
+};
+
 struct dsync_brain {
 	pool_t pool;
 	struct event *event;
@@ -92,6 +106,15 @@ struct dsync_brain {
 	unsigned int mailbox_lock_timeout_secs;
 	struct dsync_mailbox local_dsync_box, remote_dsync_box;
 	pool_t dsync_box_pool;
+	/* event for the mailbox currently being synced */
+	struct event *box_event;
+	struct timeval box_sync_start;
+	unsigned int box_mails_sent, box_mails_received;
+
+	/* max number of mailboxes in flight (the current one + pending) */
+	unsigned int mailbox_concurrency;
+	/* master: mailboxes sent ahead of time, in the order they were sent */
+	ARRAY(struct dsync_brain_pending_mailbox) pending_mailboxes;
 	/* list of mailbox states
 	   for master brain: given to brain at init and
 	   for slave brain: received from DSYNC_STATE_SLAVE_RECV_LAST_COMMON */
@@ -157,6 +180,7 @@ void dsync_brain_set_changes_during_sync(struct dsync_brain *brain,
 					 const char *reason);
 
 void dsync_brain_master_send_mailbox(struct dsync_brain *brain);
+void dsync_brain_pending_mailboxes_free(struct dsync_brain *brain);
 bool dsync_brain_slave_recv_mailbox(struct dsync_brain *brain);
 int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
 				  const struct dsync_mailbox *remote_dsync_box);
@@ -151,6 +151,8 @@ dsync_brain_common_init(struct mail_user *user, struct dsync_ibc *ibc,
 	hash_table_create(&brain->mailbox_states, pool, 0,
 			  guid_128_hash, guid_128_cmp);
 	p_array_init(&brain->remote_mailbox_states, pool, 64);
+	p_array_init(&brain->pending_mailboxes, pool, 4);
+	brain->mailbox_concurrency = 1;
 
 	brain->event = event_create(user->event);
 	event_set_append_log_prefix(brain->event, t_strdup_printf(
@@ -241,6 +243,10 @@ dsync_brain_master_init(struct mail_user *user, struct dsync_ibc *ibc,
 		brain->mailbox_lock_timeout_secs =
 			DSYNC_MAILBOX_DEFAULT_LOCK_TIMEOUT_SECS;
 	brain->import_commit_msgs_interval = set->import_commit_msgs_interval;
+	if (set->mailbox_concurrency > 1) {
+		brain->mailbox_concurrency = I_MIN(set->mailbox_concurrency,
+						   DSYNC_MAILBOX_MAX_CONCURRENCY);
+	}
 	brain->hashed_headers =
 		(const char*const*)p_strarray_dup(brain->pool, set->hashed_headers);
 	dsync_brain_set_flags(brain, flags);
@@ -279,6 +285,7 @@ dsync_brain_master_init(struct mail_user *user, struct dsync_ibc *ibc,
 	ibc_set.alt_char = brain->alt_char;
 	ibc_set.sync_type = sync_type;
 	ibc_set.hdr_hash_v2 = TRUE;
+	ibc_set.mailbox_lookahead = TRUE;
 	ibc_set.lock_timeout = set->lock_timeout_secs;
 	ibc_set.hashed_headers = set->hashed_headers;
 	/* reverse the backup direction for the slave */
@@ -324,6 +331,7 @@ dsync_brain_slave_init(struct mail_user *user, struct dsync_ibc *ibc,
 
 	i_zero(&ibc_set);
 	ibc_set.hdr_hash_v2 = TRUE;
+	ibc_set.mailbox_lookahead = TRUE;
 	ibc_set.hostname = my_hostdomain();
 	dsync_ibc_send_handshake(ibc, &ibc_set);
 
@@ -376,6 +384,7 @@ int dsync_brain_deinit(struct dsync_brain **_brain, enum mail_error *error_r)
 
 	if (brain->box != NULL)
 		dsync_brain_sync_mailbox_deinit(brain);
+	dsync_brain_pending_mailboxes_free(brain);
 	if (brain->virtual_all_box != NULL)
 		mailbox_free(&brain->virtual_all_box);
 	if (brain->local_tree_iter != NULL)
@@ -498,6 +507,10 @@ static bool dsync_brain_master_recv_handshake(struct dsync_brain *brain)
 		}
 	}
 	dsync_brain_set_hdr_hash_version(brain, ibc_set);
+	if (!ibc_set->mailbox_lookahead) {
+		/* remote doesn't support receiving mailboxes ahead of time */
+		brain->mailbox_concurrency = 1;
+	}
 
 	brain->state = brain->sync_type == DSYNC_BRAIN_SYNC_TYPE_STATE ?
 		DSYNC_STATE_MASTER_SEND_LAST_COMMON :
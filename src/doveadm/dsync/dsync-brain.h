@@ -89,6 +89,12 @@ struct dsync_brain_settings {
 	/* If non-zero, importing will attempt to commit transaction after
 	   saving this many messages. */
 	unsigned int import_commit_msgs_interval;
+	/* Maximum number of mailboxes that are in flight at the same time.
+	   The mailboxes following the one currently being synced are sent to
+	   the remote ahead of time, so their replies don't each need a
+	   separate round trip. 0 and 1 sync one mailbox at a time. The value
+	   is capped to DSYNC_MAILBOX_MAX_CONCURRENCY. */
+	unsigned int mailbox_concurrency;
 	/* Input state for DSYNC_BRAIN_SYNC_TYPE_STATE */
 	const char *state;
 };
@@ -56,6 +56,9 @@ struct dsync_ibc_pipe {
 
 	ARRAY(pool_t) pools;
 	ARRAY(struct item) item_queue;
+	/* mailboxes sent ahead of time, which were skipped over while
+	   popping other items */
+	ARRAY(struct item) mailbox_queue;
 	struct dsync_ibc_pipe *remote;
 
 	pool_t pop_pool;
@@ -104,11 +107,40 @@ dsync_ibc_pipe_push_item(struct dsync_ibc_pipe *pipe, enum item_type type)
 	return item;
 }
 
+static void dsync_ibc_pipe_queue_mailboxes(struct dsync_ibc_pipe *pipe)
+{
+	const struct item *item;
+
+	while (array_count(&pipe->item_queue) > 0) {
+		item = array_front(&pipe->item_queue);
+		if (item->type != ITEM_MAILBOX)
+			break;
+		array_push_back(&pipe->mailbox_queue, item);
+		array_pop_front(&pipe->item_queue);
+	}
+}
+
+static struct item *
+dsync_ibc_pipe_pop_queued_mailbox(struct dsync_ibc_pipe *pipe)
+{
+	if (array_count(&pipe->mailbox_queue) == 0)
+		return NULL;
+
+	pipe->pop_item = *array_front(&pipe->mailbox_queue);
+	array_pop_front(&pipe->mailbox_queue);
+
+	pool_unref(&pipe->pop_pool);
+	pipe->pop_pool = pipe->pop_item.pool;
+	return &pipe->pop_item;
+}
+
 static struct item *
 dsync_ibc_pipe_pop_item(struct dsync_ibc_pipe *pipe, enum item_type type)
 {
 	struct item *item;
 
+	if (type != ITEM_MAILBOX)
+		dsync_ibc_pipe_queue_mailboxes(pipe);
 	if (array_count(&pipe->item_queue) == 0)
 		return NULL;
 
@@ -127,6 +159,7 @@ static bool dsync_ibc_pipe_try_pop_eol(struct dsync_ibc_pipe *pipe)
 {
 	const struct item *item;
 
+	dsync_ibc_pipe_queue_mailboxes(pipe);
 	if (array_count(&pipe->item_queue) == 0)
 		return FALSE;
 
@@ -153,10 +186,14 @@ static void dsync_ibc_pipe_deinit(struct dsync_ibc *ibc)
 	array_foreach_modifiable(&pipe->item_queue, item) {
 		pool_unref(&item->pool);
 	}
+	array_foreach_modifiable(&pipe->mailbox_queue, item) {
+		pool_unref(&item->pool);
+	}
 	array_foreach_elem(&pipe->pools, pool)
 		pool_unref(&pool);
 	array_free(&pipe->pools);
 	array_free(&pipe->item_queue);
+	array_free(&pipe->mailbox_queue);
 	i_free(pipe);
 }
 
@@ -209,7 +246,8 @@ static bool dsync_ibc_pipe_has_pending_data(struct dsync_ibc *ibc)
 {
 	struct dsync_ibc_pipe *pipe = (struct dsync_ibc_pipe *)ibc;
 
-	return array_count(&pipe->item_queue) > 0;
+	return array_count(&pipe->item_queue) > 0 ||
+		array_count(&pipe->mailbox_queue) > 0;
 }
 
 static void
@@ -336,19 +374,9 @@ dsync_ibc_pipe_send_mailbox(struct dsync_ibc *ibc,
 {
 	struct dsync_ibc_pipe *pipe = (struct dsync_ibc_pipe *)ibc;
 	struct item *item;
-	const struct mailbox_cache_field *cf;
-	struct mailbox_cache_field *ncf;
 
 	item = dsync_ibc_pipe_push_item(pipe->remote, ITEM_MAILBOX);
-	item->u.dsync_box = *dsync_box;
-	p_array_init(&item->u.dsync_box.cache_fields, item->pool,
-		     array_count(&dsync_box->cache_fields));
-	array_foreach(&dsync_box->cache_fields, cf) {
-		ncf = array_append_space(&item->u.dsync_box.cache_fields);
-		ncf->name = p_strdup(item->pool, cf->name);
-		ncf->decision = cf->decision;
-		ncf->last_used = cf->last_used;
-	}
+	dsync_mailbox_dup(item->pool, dsync_box, &item->u.dsync_box);
 }
 
 static enum dsync_ibc_recv_ret
@@ -358,6 +386,14 @@ dsync_ibc_pipe_recv_mailbox(struct dsync_ibc *ibc,
 	struct dsync_ibc_pipe *pipe = (struct dsync_ibc_pipe *)ibc;
 	struct item *item;
 
+	/* mailboxes sent ahead of time come before any end-of-list */
+	dsync_ibc_pipe_queue_mailboxes(pipe);
+	item = dsync_ibc_pipe_pop_queued_mailbox(pipe);
+	if (item != NULL) {
+		*dsync_box_r = &item->u.dsync_box;
+		return DSYNC_IBC_RECV_RET_OK;
+	}
+
 	if (dsync_ibc_pipe_try_pop_eol(pipe))
 		return DSYNC_IBC_RECV_RET_FINISHED;
 
@@ -583,6 +619,7 @@ dsync_ibc_pipe_alloc(void)
 	pipe->ibc.v = dsync_ibc_pipe_vfuncs;
 	i_array_init(&pipe->pools, 4);
 	i_array_init(&pipe->item_queue, 4);
+	i_array_init(&pipe->mailbox_queue, 4);
 	return pipe;
 }
 
@@ -11,6 +11,7 @@
 #include "str.h"
 #include "strescape.h"
 #include "version.h"
+#include "compression.h"
 #include "mail-cache.h"
 #include "mail-storage-private.h"
 #include "dsync-serializer.h"
@@ -20,19 +21,35 @@
 #include "dsync-mailbox-state.h"
 #include "dsync-mailbox-tree.h"
 #include "dsync-ibc-private.h"
+#include "istream-dsync-chunked.h"
 
 
 #define DSYNC_IBC_STREAM_OUTBUF_THROTTLE_SIZE (1024*128)
 
 #define DSYNC_PROTOCOL_VERSION_MAJOR 3
-#define DSYNC_PROTOCOL_VERSION_MINOR 5
-#define DSYNC_HANDSHAKE_VERSION "VERSION\tdsync\t3\t5\n"
+#define DSYNC_PROTOCOL_VERSION_MINOR 7
+#define DSYNC_HANDSHAKE_VERSION "VERSION\tdsync\t3\t7\n"
 
 #define DSYNC_PROTOCOL_MINOR_HAVE_ATTRIBUTES 1
 #define DSYNC_PROTOCOL_MINOR_HAVE_SAVE_GUID 2
 #define DSYNC_PROTOCOL_MINOR_HAVE_FINISH 3
 #define DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V2 4
 #define DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V3 5
+#define DSYNC_PROTOCOL_MINOR_HAVE_BINARY_STREAMS 6
+#define DSYNC_PROTOCOL_MINOR_HAVE_MAILBOX_LOOKAHEAD 7
+
+/* During the handshake this line lists the compression algorithms that we
+   support. Older versions ignore it as an unknown deserializer. After the
+   handshake the line switches the rest of the stream to the given
+   compression algorithm. */
+#define COMPRESSION_LINE_CHR 'Z'
+
+/* Compression algorithms that can be used for the stream in the order of
+   preference. gz and bz2 aren't included, because they can't flush partially
+   written output. */
+static const char *const dsync_stream_compressions[] = {
+	"zstd", "lz4", "deflate", NULL
+};
 
 enum item_type {
 	ITEM_NONE,
@@ -150,8 +167,16 @@ struct dsync_ibc_stream {
 	struct ostream *output;
 	struct io *io;
 	struct timeout *to;
+	struct event *event;
 
 	unsigned int minor_version;
+	/* compression algorithm to use for output, if the remote supports it */
+	const struct compression_handler *compression;
+	/* compression algorithms supported by the remote */
+	char **remote_compressions;
+	/* mailbox lines that were sent ahead of time and received while
+	   waiting for some other item */
+	ARRAY(char *) mailbox_queue;
 	struct dsync_serializer *serializers[ITEM_END_OF_LIST];
 	struct dsync_deserializer *deserializers[ITEM_END_OF_LIST];
 
@@ -169,6 +194,12 @@ struct dsync_ibc_stream {
 
 	bool version_received:1;
 	bool handshake_received:1;
+	/* we advertised our compressions, so the remote may switch to
+	   compressed output once after the handshake */
+	bool compressions_sent:1;
+	bool input_compressed:1;
+	bool binary_streams:1;
+	bool mailbox_lookahead:1;
 	bool has_pending_data:1;
 	bool finish_received:1;
 	bool done_received:1;
@@ -231,10 +262,31 @@ static void dsync_ibc_stream_input(struct dsync_ibc_stream *ibc)
 	}
 	o_stream_cork(ibc->output);
 	ibc->ibc.io_callback(ibc->ibc.io_context);
+	/* the callback may have switched the output to a compressed stream,
+	   which is corked as well if the original was */
 	o_stream_uncork(ibc->output);
 }
 
-static int dsync_ibc_stream_send_value_stream(struct dsync_ibc_stream *ibc)
+static int dsync_ibc_stream_flush_value_output(struct dsync_ibc_stream *ibc)
+{
+	int ret;
+
+	if (o_stream_get_buffer_used_size(ibc->output) < 4096)
+		return 1;
+
+	if ((ret = o_stream_flush(ibc->output)) < 0) {
+		dsync_ibc_stream_stop(ibc);
+		return -1;
+	}
+	if (ret == 0) {
+		/* continue later */
+		o_stream_set_flush_pending(ibc->output, TRUE);
+		return 0;
+	}
+	return 1;
+}
+
+static int dsync_ibc_stream_send_value_stream_dot(struct dsync_ibc_stream *ibc)
 {
 	const unsigned char *data;
 	unsigned char add;
@@ -259,17 +311,8 @@ static int dsync_ibc_stream_send_value_stream(struct dsync_ibc_stream *ibc)
 			i_stream_skip(ibc->value_output, i);
 		}
 
-		if (o_stream_get_buffer_used_size(ibc->output) >= 4096) {
-			if ((ret = o_stream_flush(ibc->output)) < 0) {
-				dsync_ibc_stream_stop(ibc);
-				return -1;
-			}
-			if (ret == 0) {
-				/* continue later */
-				o_stream_set_flush_pending(ibc->output, TRUE);
-				return 0;
-			}
-		}
+		if ((ret = dsync_ibc_stream_flush_value_output(ibc)) <= 0)
+			return ret;
 
 		if (add != '\0') {
 			o_stream_nsend(ibc->output, &add, 1);
@@ -277,6 +320,59 @@ static int dsync_ibc_stream_send_value_stream(struct dsync_ibc_stream *ibc)
 		}
 	}
 	i_assert(ret == -1);
+	return 1;
+}
+
+static void
+dsync_ibc_stream_send_chunk(struct dsync_ibc_stream *ibc,
+			    const unsigned char *data, size_t size)
+{
+	unsigned char hdr_buf[MAX_INT_STRLEN];
+	buffer_t hdr;
+	struct const_iovec iov[2];
+
+	buffer_create_from_data(&hdr, hdr_buf, sizeof(hdr_buf));
+	dsync_chunk_header_append(&hdr, size);
+	iov[0].iov_base = hdr.data;
+	iov[0].iov_len = hdr.used;
+	iov[1].iov_base = data;
+	iov[1].iov_len = size;
+	o_stream_nsendv(ibc->output, iov, size == 0 ? 1 : 2);
+}
+
+static int
+dsync_ibc_stream_send_value_stream_chunks(struct dsync_ibc_stream *ibc)
+{
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	/* Send the stream as-is in length-prefixed chunks. This avoids
+	   scanning and escaping the data and allows the remote to copy it
+	   without parsing. */
+	while ((ret = i_stream_read_more(ibc->value_output, &data, &size)) > 0) {
+		if (size > DSYNC_CHUNK_MAX_SIZE)
+			size = DSYNC_CHUNK_MAX_SIZE;
+		dsync_ibc_stream_send_chunk(ibc, data, size);
+		i_stream_skip(ibc->value_output, size);
+
+		if ((ret = dsync_ibc_stream_flush_value_output(ibc)) <= 0)
+			return ret;
+	}
+	i_assert(ret == -1);
+	return 1;
+}
+
+static int dsync_ibc_stream_send_value_stream(struct dsync_ibc_stream *ibc)
+{
+	int ret;
+
+	if (ibc->binary_streams)
+		ret = dsync_ibc_stream_send_value_stream_chunks(ibc);
+	else
+		ret = dsync_ibc_stream_send_value_stream_dot(ibc);
+	if (ret <= 0)
+		return ret;
 
 	if (ibc->value_output->stream_errno != 0) {
 		i_error("dsync(%s): read(%s) failed: %s (%s)",
@@ -287,9 +383,15 @@ static int dsync_ibc_stream_send_value_stream(struct dsync_ibc_stream *ibc)
 		return -1;
 	}
 
-	/* finished sending the stream. use "CRLF." instead of "LF." just in
-	   case we're sending binary data that ends with CR. */
-	o_stream_nsend_str(ibc->output, "\r\n.\r\n");
+	if (ibc->binary_streams) {
+		/* finished sending the stream - send the end-of-stream
+		   chunk */
+		dsync_ibc_stream_send_chunk(ibc, NULL, 0);
+	} else {
+		/* finished sending the stream. use "CRLF." instead of "LF."
+		   just in case we're sending binary data that ends with CR. */
+		o_stream_nsend_str(ibc->output, "\r\n.\r\n");
+	}
 	i_stream_unref(&ibc->value_output);
 	return 1;
 }
@@ -307,8 +409,13 @@ static int dsync_ibc_stream_output(struct dsync_ibc_stream *ibc)
 	}
 	timeout_reset(ibc->to);
 
-	if (!dsync_ibc_is_send_queue_full(&ibc->ibc))
+	if (!dsync_ibc_is_send_queue_full(&ibc->ibc)) {
+		/* cork so that compressed output gets flushed after the
+		   callback */
+		o_stream_cork(ibc->output);
 		ibc->ibc.io_callback(ibc->ibc.io_context);
+		o_stream_uncork(ibc->output);
+	}
 	return ret;
 }
 
@@ -320,6 +427,28 @@ static void dsync_ibc_stream_timeout(struct dsync_ibc_stream *ibc)
 	dsync_ibc_stream_stop(ibc);
 }
 
+static void dsync_ibc_stream_send_compressions(struct dsync_ibc_stream *ibc)
+{
+	const struct compression_handler *handler;
+	string_t *str = t_str_new(64);
+	unsigned int i;
+
+	str_append_c(str, COMPRESSION_LINE_CHR);
+	for (i = 0; dsync_stream_compressions[i] != NULL; i++) {
+		if (compression_lookup_handler(dsync_stream_compressions[i],
+					       &handler) <= 0)
+			continue;
+		if (str_len(str) > 1)
+			str_append_c(str, '\t');
+		str_append_tabescaped(str, handler->name);
+	}
+	if (str_len(str) == 1)
+		return;
+	str_append_c(str, '\n');
+	o_stream_nsend(ibc->output, str_data(str), str_len(str));
+	ibc->compressions_sent = TRUE;
+}
+
 static void dsync_ibc_stream_init(struct dsync_ibc_stream *ibc)
 {
 	unsigned int i;
@@ -350,6 +479,9 @@ static void dsync_ibc_stream_init(struct dsync_ibc_stream *ibc)
 				dsync_serializer_encode_header_line(ibc->serializers[i]));
 		}
 	} T_END;
+	T_BEGIN {
+		dsync_ibc_stream_send_compressions(ibc);
+	} T_END;
 	o_stream_nsend_str(ibc->output, ".\n");
 	o_stream_uncork(ibc->output);
 }
@@ -358,6 +490,7 @@ static void dsync_ibc_stream_deinit(struct dsync_ibc *_ibc)
 {
 	struct dsync_ibc_stream *ibc = (struct dsync_ibc_stream *)_ibc;
 	unsigned int i;
+	char *line;
 
 	for (i = ITEM_DONE + 1; i < ITEM_END_OF_LIST; i++) {
 		if (ibc->serializers[i] != NULL)
@@ -393,6 +526,12 @@ static void dsync_ibc_stream_deinit(struct dsync_ibc *_ibc)
 	io_remove(&ibc->io);
 	i_stream_destroy(&ibc->input);
 	o_stream_destroy(&ibc->output);
+	if (ibc->remote_compressions != NULL)
+		p_strsplit_free(default_pool, ibc->remote_compressions);
+	array_foreach_elem(&ibc->mailbox_queue, line)
+		i_free(line);
+	array_free(&ibc->mailbox_queue);
+	event_unref(&ibc->event);
 	pool_unref(&ibc->ret_pool);
 	i_free(ibc->temp_path_prefix);
 	i_free(ibc->name);
@@ -497,8 +636,13 @@ dsync_ibc_stream_input_stream(struct dsync_ibc_stream *ibc)
 {
 	struct istream *inputs[2];
 
-	inputs[0] = i_stream_create_dot(ibc->input, ISTREAM_DOT_TRIM_TRAIL |
-						    ISTREAM_DOT_LOOSE_EOT);
+	if (ibc->binary_streams)
+		inputs[0] = i_stream_create_dsync_chunked(ibc->input);
+	else {
+		inputs[0] = i_stream_create_dot(ibc->input,
+						ISTREAM_DOT_TRIM_TRAIL |
+						ISTREAM_DOT_LOOSE_EOT);
+	}
 	inputs[1] = NULL;
 	ibc->value_input = i_stream_create_seekable(inputs, MAIL_READ_FULL_BLOCK_SIZE,
 						    seekable_fd_callback, ibc);
@@ -527,6 +671,52 @@ dsync_ibc_check_missing_deserializers(struct dsync_ibc_stream *ibc)
 	return ret;
 }
 
+static void
+dsync_ibc_stream_compress_output(struct dsync_ibc_stream *ibc)
+{
+	struct ostream *output;
+
+	if (ibc->compression == NULL || ibc->remote_compressions == NULL ||
+	    !str_array_find((const char *const *)ibc->remote_compressions,
+			    ibc->compression->name))
+		return;
+	if (ibc->value_output != NULL) {
+		/* can't switch in the middle of a value stream. this
+		   shouldn't happen, since the headers are sent first. */
+		return;
+	}
+
+	o_stream_nsend_str(ibc->output, t_strdup_printf("%c%s\n",
+		COMPRESSION_LINE_CHR, ibc->compression->name));
+	output = ibc->compression->create_ostream_auto(ibc->output, ibc->event);
+	if (o_stream_is_corked(ibc->output))
+		o_stream_cork(output);
+	o_stream_unref(&ibc->output);
+	ibc->output = output;
+	o_stream_set_no_error_handling(ibc->output, TRUE);
+	o_stream_set_flush_callback(ibc->output, dsync_ibc_stream_output, ibc);
+}
+
+static void
+dsync_ibc_stream_decompress_input(struct dsync_ibc_stream *ibc,
+				  const char *name)
+{
+	const struct compression_handler *handler;
+	struct istream *input;
+
+	if (compression_lookup_handler(name, &handler) <= 0) {
+		dsync_ibc_input_error(ibc, NULL,
+			"Remote switched to unsupported compression: %s", name);
+		return;
+	}
+	input = handler->create_istream(ibc->input);
+	i_stream_unref(&ibc->input);
+	ibc->input = input;
+
+	io_remove(&ibc->io);
+	ibc->io = io_add_istream(ibc->input, dsync_ibc_stream_input, ibc);
+}
+
 static bool
 dsync_ibc_stream_handshake(struct dsync_ibc_stream *ibc, const char *line)
 {
@@ -534,8 +724,18 @@ dsync_ibc_stream_handshake(struct dsync_ibc_stream *ibc, const char *line)
 	const char *const *required_keys, *error;
 	unsigned int i;
 
-	if (ibc->handshake_received)
-		return TRUE;
+	if (ibc->handshake_received) {
+		/* The remote switches to compression after it has received
+		   our handshake, so some items may have been sent before the
+		   switch. Accept it only once and only if we asked for it. */
+		if (line[0] != COMPRESSION_LINE_CHR ||
+		    !ibc->compressions_sent || ibc->input_compressed)
+			return TRUE;
+		/* the rest of the input is compressed */
+		ibc->input_compressed = TRUE;
+		dsync_ibc_stream_decompress_input(ibc, line + 1);
+		return FALSE;
+	}
 
 	if (!ibc->version_received) {
 		if (!version_string_verify_full(line, "dsync",
@@ -546,6 +746,10 @@ dsync_ibc_stream_handshake(struct dsync_ibc_stream *ibc, const char *line)
 			return DSYNC_IBC_RECV_RET_TRYAGAIN;
 		}
 		ibc->version_received = TRUE;
+		ibc->binary_streams = ibc->minor_version >=
+			DSYNC_PROTOCOL_MINOR_HAVE_BINARY_STREAMS;
+		ibc->mailbox_lookahead = ibc->minor_version >=
+			DSYNC_PROTOCOL_MINOR_HAVE_MAILBOX_LOOKAHEAD;
 		return FALSE;
 	}
 
@@ -555,6 +759,14 @@ dsync_ibc_stream_handshake(struct dsync_ibc_stream *ibc, const char *line)
 			return FALSE;
 		ibc->handshake_received = TRUE;
 		ibc->last_recv_item = ITEM_HANDSHAKE;
+		dsync_ibc_stream_compress_output(ibc);
+		return FALSE;
+	}
+	if (line[0] == COMPRESSION_LINE_CHR) {
+		if (ibc->remote_compressions != NULL)
+			p_strsplit_free(default_pool, ibc->remote_compressions);
+		ibc->remote_compressions =
+			p_strsplit_tabescaped(default_pool, line + 1);
 		return FALSE;
 	}
 
@@ -581,22 +793,53 @@ dsync_ibc_stream_handshake(struct dsync_ibc_stream *ibc, const char *line)
 	return FALSE;
 }
 
+static enum dsync_ibc_recv_ret
+dsync_ibc_stream_decode_begin(struct dsync_ibc_stream *ibc, enum item_type item,
+			      const char *line,
+			      struct dsync_deserializer_decoder **decoder_r)
+{
+	const char *error;
+
+	if (ibc->cur_decoder != NULL)
+		dsync_deserializer_decode_finish(&ibc->cur_decoder);
+	if (dsync_deserializer_decode_begin(ibc->deserializers[item],
+					    line+1, &ibc->cur_decoder,
+					    &error) < 0) {
+		dsync_ibc_input_error(ibc, NULL, "Invalid input to %s: %s",
+				      items[item].name, error);
+		return DSYNC_IBC_RECV_RET_TRYAGAIN;
+	}
+	*decoder_r = ibc->cur_decoder;
+	return DSYNC_IBC_RECV_RET_OK;
+}
+
 static enum dsync_ibc_recv_ret
 dsync_ibc_stream_input_next(struct dsync_ibc_stream *ibc, enum item_type item,
 			    struct dsync_deserializer_decoder **decoder_r)
 {
 	enum item_type line_item = ITEM_NONE;
-	const char *line, *error;
+	const char *line;
 	unsigned int i;
+	char *queued_line;
 
 	i_assert(ibc->value_input == NULL);
 
 	timeout_reset(ibc->to);
 
-	do {
-		if (dsync_ibc_stream_next_line(ibc, &line) <= 0)
-			return DSYNC_IBC_RECV_RET_TRYAGAIN;
-	} while (!dsync_ibc_stream_handshake(ibc, line));
+	for (;;) {
+		do {
+			if (dsync_ibc_stream_next_line(ibc, &line) <= 0)
+				return DSYNC_IBC_RECV_RET_TRYAGAIN;
+		} while (!dsync_ibc_stream_handshake(ibc, line));
+
+		if (item == ITEM_MAILBOX || !ibc->mailbox_lookahead ||
+		    line[0] != items[ITEM_MAILBOX].chr)
+			break;
+		/* remote sent a mailbox ahead of time. queue it until the
+		   brain asks for it. */
+		queued_line = i_strdup(line);
+		array_push_back(&ibc->mailbox_queue, &queued_line);
+	}
 
 	ibc->last_recv_item = item;
 	ibc->last_recv_item_eol = FALSE;
@@ -627,18 +870,23 @@ dsync_ibc_stream_input_next(struct dsync_ibc_stream *ibc, enum item_type item,
 			*line, items[item].chr);
 		return DSYNC_IBC_RECV_RET_TRYAGAIN;
 	}
+	return dsync_ibc_stream_decode_begin(ibc, item, line, decoder_r);
+}
 
-	if (ibc->cur_decoder != NULL)
-		dsync_deserializer_decode_finish(&ibc->cur_decoder);
-	if (dsync_deserializer_decode_begin(ibc->deserializers[item],
-					    line+1, &ibc->cur_decoder,
-					    &error) < 0) {
-		dsync_ibc_input_error(ibc, NULL, "Invalid input to %s: %s",
-				      items[item].name, error);
-		return DSYNC_IBC_RECV_RET_TRYAGAIN;
-	}
-	*decoder_r = ibc->cur_decoder;
-	return DSYNC_IBC_RECV_RET_OK;
+static enum dsync_ibc_recv_ret
+dsync_ibc_stream_input_queued_mailbox(struct dsync_ibc_stream *ibc,
+				      struct dsync_deserializer_decoder **decoder_r)
+{
+	enum dsync_ibc_recv_ret ret;
+	char *line;
+
+	line = array_idx_elem(&ibc->mailbox_queue, 0);
+	array_pop_front(&ibc->mailbox_queue);
+	ibc->last_recv_item = ITEM_MAILBOX;
+	ibc->last_recv_item_eol = FALSE;
+	ret = dsync_ibc_stream_decode_begin(ibc, ITEM_MAILBOX, line, decoder_r);
+	i_free(line);
+	return ret;
 }
 
 static struct dsync_serializer_encoder *
@@ -886,6 +1134,7 @@ dsync_ibc_stream_recv_handshake(struct dsync_ibc *_ibc,
 		set->hashed_headers = (const char*const*)p_strsplit_tabescaped(pool, value);
 	set->hdr_hash_v2 = ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V2;
 	set->hdr_hash_v3 = ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V3;
+	set->mailbox_lookahead = ibc->mailbox_lookahead;
 
 	*set_r = set;
 	return DSYNC_IBC_RECV_RET_OK;
@@ -1418,13 +1667,17 @@ dsync_ibc_stream_recv_mailbox(struct dsync_ibc *_ibc,
 	const char *value;
 	enum dsync_ibc_recv_ret ret;
 
-	p_clear(pool);
-	box = p_new(pool, struct dsync_mailbox, 1);
-
-	ret = dsync_ibc_stream_input_next(ibc, ITEM_MAILBOX, &decoder);
+	/* mailboxes sent ahead of time come before anything else */
+	if (array_count(&ibc->mailbox_queue) > 0)
+		ret = dsync_ibc_stream_input_queued_mailbox(ibc, &decoder);
+	else
+		ret = dsync_ibc_stream_input_next(ibc, ITEM_MAILBOX, &decoder);
 	if (ret != DSYNC_IBC_RECV_RET_OK)
 		return ret;
 
+	p_clear(pool);
+	box = p_new(pool, struct dsync_mailbox, 1);
+
 	value = dsync_deserializer_decode_get(decoder, "mailbox_guid");
 	if (guid_128_from_string(value, box->mailbox_guid) < 0) {
 		dsync_ibc_input_error(ibc, decoder, "Invalid mailbox_guid");
@@ -2077,7 +2330,7 @@ static bool dsync_ibc_stream_has_pending_data(struct dsync_ibc *_ibc)
 {
 	struct dsync_ibc_stream *ibc = (struct dsync_ibc_stream *)_ibc;
 
-	return ibc->has_pending_data;
+	return ibc->has_pending_data || array_count(&ibc->mailbox_queue) > 0;
 }
 
 static const struct dsync_ibc_vfuncs dsync_ibc_stream_vfuncs = {
@@ -2111,11 +2364,23 @@ static const struct dsync_ibc_vfuncs dsync_ibc_stream_vfuncs = {
 struct dsync_ibc *
 dsync_ibc_init_stream(struct istream *input, struct ostream *output,
 		      const char *name, const char *temp_path_prefix,
-		      unsigned int timeout_secs)
+		      unsigned int timeout_secs, struct event *event_parent,
+		      const char *compression)
 {
 	struct dsync_ibc_stream *ibc;
+	const struct compression_handler *handler = NULL;
+
+	if (compression != NULL && *compression != '\0' &&
+	    (!str_array_find(dsync_stream_compressions, compression) ||
+	     compression_lookup_handler(compression, &handler) <= 0)) {
+		i_error("dsync(%s): Unsupported compression: %s",
+			name, compression);
+		handler = NULL;
+	}
 
 	ibc = i_new(struct dsync_ibc_stream, 1);
+	ibc->event = event_create(event_parent);
+	ibc->compression = handler;
 	ibc->ibc.v = dsync_ibc_stream_vfuncs;
 	ibc->input = input;
 	ibc->output = output;
@@ -2125,6 +2390,7 @@ dsync_ibc_init_stream(struct istream *input, struct ostream *output,
 	ibc->temp_path_prefix = i_strdup(temp_path_prefix);
 	ibc->timeout_secs = timeout_secs;
 	ibc->ret_pool = pool_alloconly_create("ibc stream data", 2048);
+	i_array_init(&ibc->mailbox_queue, 4);
 	dsync_ibc_stream_init(ibc);
 	return &ibc->ibc;
 }
@@ -72,6 +72,9 @@ struct dsync_ibc_settings {
 	enum dsync_brain_flags brain_flags;
 	bool hdr_hash_v2;
 	bool hdr_hash_v3;
+	/* Remote can handle mailboxes being sent ahead of time while another
+	   mailbox is still being synced. */
+	bool mailbox_lookahead;
 	unsigned int lock_timeout;
 };
 
@@ -80,7 +83,8 @@ void dsync_ibc_init_pipe(struct dsync_ibc **ibc1_r,
 struct dsync_ibc *
 dsync_ibc_init_stream(struct istream *input, struct ostream *output,
 		      const char *name, const char *temp_path_prefix,
-		      unsigned int timeout_secs);
+		      unsigned int timeout_secs, struct event *event_parent,
+		      const char *compression);
 void dsync_ibc_deinit(struct dsync_ibc **ibc);
 
 /* I/O callback is called whenever new data is available. It's also called on
@@ -1,11 +1,29 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "istream.h"
 #include "mail-storage-private.h"
 #include "dsync-brain-private.h"
 #include "dsync-mailbox.h"
 
+void dsync_mailbox_dup(pool_t pool, const struct dsync_mailbox *src,
+		       struct dsync_mailbox *dest_r)
+{
+	const struct mailbox_cache_field *src_field;
+	struct mailbox_cache_field *dest_field;
+
+	*dest_r = *src;
+	p_array_init(&dest_r->cache_fields, pool,
+		     array_count(&src->cache_fields));
+	array_foreach(&src->cache_fields, src_field) {
+		dest_field = array_append_space(&dest_r->cache_fields);
+		dest_field->name = p_strdup(pool, src_field->name);
+		dest_field->decision = src_field->decision;
+		dest_field->last_used = src_field->last_used;
+	}
+}
+
 void dsync_mailbox_attribute_dup(pool_t pool,
 				 const struct dsync_mailbox_attribute *src,
 				 struct dsync_mailbox_attribute *dest_r)
@@ -34,6 +34,8 @@ struct dsync_mailbox_attribute {
 #define DSYNC_ATTR_HAS_VALUE(attr) \
 	((attr)->value != NULL || (attr)->value_stream != NULL)
 
+void dsync_mailbox_dup(pool_t pool, const struct dsync_mailbox *src,
+		       struct dsync_mailbox *dest_r);
 void dsync_mailbox_attribute_dup(pool_t pool,
 				 const struct dsync_mailbox_attribute *src,
 				 struct dsync_mailbox_attribute *dest_r);
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "hash.h"
 #include "mail-index-modseq.h"
+#include "mail-index-change-journal.h"
 #include "mail-storage-private.h"
 #include "dsync-mail.h"
 #include "dsync-mailbox.h"
@@ -345,6 +346,44 @@ log_add_attribute_update(struct dsync_transaction_log_scan *ctx,
 	}
 }
 
+static int
+dsync_log_add_change_journal(struct dsync_transaction_log_scan *ctx,
+			     struct mail_index_view *view, uint64_t modseq,
+			     uint64_t log_modseq)
+{
+	ARRAY_TYPE(mail_index_change_journal_record) records;
+	const struct mail_index_change_journal_record *rec;
+	struct dsync_mail_change *change;
+	int ret;
+
+	i_array_init(&records, 64);
+	ret = mail_index_change_journal_lookup(view->index, modseq, log_modseq,
+					       &records);
+	if (ret > 0) {
+		e_debug(ctx->event, "%s: Using change journal for modseqs "
+			"%"PRIu64"..%"PRIu64" (%u changes)",
+			view->index->filepath, modseq, log_modseq,
+			array_count(&records));
+	}
+	array_foreach(&records, rec) {
+		if ((rec->flags & MAIL_INDEX_CHANGE_JOURNAL_RECORD_FLAG_EXPUNGED) != 0) {
+			if (export_change_get(ctx, rec->uid,
+					      DSYNC_MAIL_CHANGE_TYPE_EXPUNGE,
+					      &change) &&
+			    !guid_128_is_empty(rec->guid_128)) T_BEGIN {
+				change->guid = p_strdup(ctx->pool,
+					guid_128_to_string(rec->guid_128));
+			} T_END;
+		} else if (export_change_get(ctx, rec->uid,
+				DSYNC_MAIL_CHANGE_TYPE_FLAG_CHANGE, &change)) {
+			if (change->modseq < rec->modseq)
+				change->modseq = rec->modseq;
+		}
+	}
+	array_free(&records);
+	return ret;
+}
+
 static int
 dsync_log_set(struct dsync_transaction_log_scan *ctx,
 	      struct mail_index_view *view, bool pvt_scan,
@@ -374,8 +413,6 @@ dsync_log_set(struct dsync_transaction_log_scan *ctx,
 	}
 
 	/* return everything we've got (until the end of the view) */
-	if (!pvt_scan)
-		ctx->returned_all_changes = TRUE;
 	if (mail_transaction_log_view_set_all(log_view) < 0)
 		return -1;
 
@@ -400,6 +437,15 @@ dsync_log_set(struct dsync_transaction_log_scan *ctx,
 	}
 	if (ret < 0)
 		return -1;
+	if (modseq != 0 && !pvt_scan &&
+	    dsync_log_add_change_journal(ctx, view, modseq,
+			mail_transaction_log_view_get_prev_modseq(log_view)) > 0) {
+		/* the changes missing from the transaction logs were found
+		   from the change journal */
+		return 1;
+	}
+	if (!pvt_scan)
+		ctx->returned_all_changes = TRUE;
 	if (modseq != 0) {
 		/* we didn't see all the changes that we wanted to */
 		return 0;
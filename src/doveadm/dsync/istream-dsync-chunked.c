@@ -0,0 +1,137 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "numpack.h"
+#include "istream-private.h"
+#include "istream-dsync-chunked.h"
+
+/* numpack-encoded 32bit number can't be longer than this */
+#define DSYNC_CHUNK_HEADER_MAX_SIZE 5
+
+struct dsync_chunked_istream {
+	struct istream_private istream;
+
+	size_t chunk_left;
+	bool chunk_eof:1;
+};
+
+void dsync_chunk_header_append(buffer_t *dest, size_t size)
+{
+	i_assert(size <= DSYNC_CHUNK_MAX_SIZE);
+	numpack_encode(dest, size);
+}
+
+static int
+i_stream_dsync_chunked_read_parent(struct dsync_chunked_istream *cstream)
+{
+	struct istream_private *stream = &cstream->istream;
+	ssize_t ret;
+
+	ret = i_stream_read_memarea(stream->parent);
+	if (ret > 0)
+		return 1;
+	i_assert(ret != -2);
+	if (stream->parent->stream_errno != 0) {
+		io_stream_set_error(&stream->iostream, "%s",
+				    i_stream_get_error(stream->parent));
+		stream->istream.stream_errno = stream->parent->stream_errno;
+		return -1;
+	}
+	if (ret < 0) {
+		i_assert(stream->parent->eof);
+		io_stream_set_error(&stream->iostream,
+			"dsync chunked stream ends without end-of-stream chunk");
+		stream->istream.stream_errno = EPIPE;
+		return -1;
+	}
+	return 0;
+}
+
+static int
+i_stream_dsync_chunked_read_header(struct dsync_chunked_istream *cstream)
+{
+	struct istream_private *stream = &cstream->istream;
+	const unsigned char *data, *p;
+	size_t size;
+	uint32_t chunk_size;
+	int ret;
+
+	for (;;) {
+		data = i_stream_get_data(stream->parent, &size);
+		p = data;
+		if (numpack_decode32(&p, data + size, &chunk_size) == 0)
+			break;
+		if (size >= DSYNC_CHUNK_HEADER_MAX_SIZE) {
+			io_stream_set_error(&stream->iostream,
+				"Invalid dsync chunk header");
+			stream->istream.stream_errno = EINVAL;
+			return -1;
+		}
+		if ((ret = i_stream_dsync_chunked_read_parent(cstream)) <= 0)
+			return ret;
+	}
+	if (chunk_size > DSYNC_CHUNK_MAX_SIZE) {
+		io_stream_set_error(&stream->iostream,
+			"dsync chunk too large (%u > %u)",
+			chunk_size, DSYNC_CHUNK_MAX_SIZE);
+		stream->istream.stream_errno = EINVAL;
+		return -1;
+	}
+	i_stream_skip(stream->parent, p - data);
+	if (chunk_size == 0)
+		cstream->chunk_eof = TRUE;
+	cstream->chunk_left = chunk_size;
+	return 1;
+}
+
+static ssize_t i_stream_dsync_chunked_read(struct istream_private *stream)
+{
+	struct dsync_chunked_istream *cstream =
+		container_of(stream, struct dsync_chunked_istream, istream);
+	const unsigned char *data;
+	size_t size, avail;
+	int ret;
+
+	if (cstream->chunk_left == 0 && !cstream->chunk_eof) {
+		if ((ret = i_stream_dsync_chunked_read_header(cstream)) <= 0)
+			return ret;
+	}
+	if (cstream->chunk_eof) {
+		stream->istream.eof = TRUE;
+		return -1;
+	}
+
+	if (i_stream_get_data_size(stream->parent) == 0) {
+		if ((ret = i_stream_dsync_chunked_read_parent(cstream)) <= 0)
+			return ret;
+	}
+	data = i_stream_get_data(stream->parent, &size);
+	if (size > cstream->chunk_left)
+		size = cstream->chunk_left;
+
+	if (!i_stream_try_alloc(stream, size, &avail))
+		return -2;
+	if (size > avail)
+		size = avail;
+	memcpy(stream->w_buffer + stream->pos, data, size);
+	i_stream_skip(stream->parent, size);
+	stream->pos += size;
+	cstream->chunk_left -= size;
+	return size;
+}
+
+struct istream *i_stream_create_dsync_chunked(struct istream *input)
+{
+	struct dsync_chunked_istream *cstream;
+
+	cstream = i_new(struct dsync_chunked_istream, 1);
+	cstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
+	cstream->istream.read = i_stream_dsync_chunked_read;
+
+	cstream->istream.istream.readable_fd = FALSE;
+	cstream->istream.istream.blocking = input->blocking;
+	cstream->istream.istream.seekable = FALSE;
+	return i_stream_create(&cstream->istream, input,
+			       i_stream_get_fd(input), 0);
+}
@@ -0,0 +1,17 @@
+#ifndef ISTREAM_DSYNC_CHUNKED_H
+#define ISTREAM_DSYNC_CHUNKED_H
+
+/* Maximum size of a single chunk's payload. Larger chunks are treated as
+   corrupted input. */
+#define DSYNC_CHUNK_MAX_SIZE (1024*1024)
+
+/* Append a chunk header for size bytes of payload. size=0 marks the end of
+   the stream. */
+void dsync_chunk_header_append(buffer_t *dest, size_t size);
+
+/* Create input stream for reading a binary value stream sent by the
+   dsync protocol: A sequence of numpack-encoded chunk sizes, each followed by
+   that many bytes of payload, terminated by a zero-sized chunk. */
+struct istream *i_stream_create_dsync_chunked(struct istream *input);
+
+#endif
@@ -0,0 +1,365 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "array.h"
+#include "istream.h"
+#include "ostream.h"
+#include "str.h"
+#include "settings.h"
+#include "master-service.h"
+#include "master-service-settings.h"
+#include "mail-storage-service.h"
+#include "test-common.h"
+#include "test-dir.h"
+#include "test-mail-storage-common.h"
+#include "dsync-ibc.h"
+#include "dsync-brain-private.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#define TEST_MAILBOX_COUNT 6
+#define TEST_MAILBOX_CONCURRENCY 4
+#define TEST_TIMEOUT_SECS 10
+
+static struct test_mail_storage_ctx *test_ctx;
+static struct mail_user *user1, *user2;
+static bool test_timed_out;
+
+static const char *test_mailbox_name(unsigned int idx)
+{
+	return idx == 0 ? "INBOX" : t_strdup_printf("box%u", idx);
+}
+
+static void test_mail_save(struct mailbox *box, unsigned int i)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	const char *mail_input;
+	int ret;
+
+	mail_input = t_strdup_printf("Subject: mail %u\n\nbody %u\n", i, i);
+	input = i_stream_create_from_data(mail_input, strlen(mail_input));
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	ret = mailbox_save_begin(&save_ctx, input);
+	while (ret == 0 && i_stream_read(input) > 0) {
+		if (mailbox_save_continue(save_ctx) < 0)
+			ret = -1;
+	}
+	if (ret == 0 && mailbox_save_finish(&save_ctx) < 0)
+		ret = -1;
+	if (save_ctx != NULL)
+		mailbox_save_cancel(&save_ctx);
+	if (ret == 0 && mailbox_transaction_commit(&trans) < 0)
+		ret = -1;
+	if (trans != NULL)
+		mailbox_transaction_rollback(&trans);
+	i_stream_unref(&input);
+	if (ret < 0) {
+		i_fatal("Failed to save mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+}
+
+static struct mail_user *test_user_init(const char *username)
+{
+	struct test_mail_storage_settings set = {
+		.username = username,
+		.driver = "sdbox",
+	};
+	struct mail_user *user;
+
+	test_mail_storage_init_user(test_ctx, &set);
+	user = test_ctx->user;
+	test_ctx->user = NULL;
+	user->dsyncing = TRUE;
+	return user;
+}
+
+static void test_users_init(void)
+{
+	struct mailbox *box;
+	unsigned int i, j;
+
+	user1 = test_user_init("user1");
+	user2 = test_user_init("user2");
+
+	/* mailbox i has i+1 mails */
+	for (i = 0; i < TEST_MAILBOX_COUNT; i++) {
+		box = mailbox_alloc(user1->namespaces->list,
+				    test_mailbox_name(i), 0);
+		if (i > 0 && mailbox_create(box, NULL, FALSE) < 0) {
+			i_fatal("mailbox_create(%s) failed: %s",
+				mailbox_get_vname(box),
+				mailbox_get_last_internal_error(box, NULL));
+		}
+		if (mailbox_open(box) < 0) {
+			i_fatal("mailbox_open(%s) failed: %s",
+				mailbox_get_vname(box),
+				mailbox_get_last_internal_error(box, NULL));
+		}
+		for (j = 0; j <= i; j++)
+			test_mail_save(box, j);
+		mailbox_free(&box);
+	}
+}
+
+static void test_users_deinit(void)
+{
+	mail_user_deinit(&user1);
+	mail_user_deinit(&user2);
+}
+
+static void test_users_check_synced(void)
+{
+	struct mailbox_status status;
+	struct mailbox *box;
+	unsigned int i;
+
+	for (i = 0; i < TEST_MAILBOX_COUNT; i++) {
+		box = mailbox_alloc(user2->namespaces->list,
+				    test_mailbox_name(i), 0);
+		if (mailbox_get_status(box, STATUS_MESSAGES, &status) < 0) {
+			i_error("mailbox_get_status(%s) failed: %s",
+				mailbox_get_vname(box),
+				mailbox_get_last_internal_error(box, NULL));
+			test_assert_idx(FALSE, i);
+		} else {
+			test_assert_idx(status.messages == i + 1, i);
+		}
+		mailbox_free(&box);
+	}
+}
+
+static const char *const test_hashed_headers[] = {
+	"Date", "Message-ID", NULL
+};
+
+static struct dsync_brain *
+test_brain_master_init(struct dsync_ibc *ibc, unsigned int mailbox_concurrency)
+{
+	struct dsync_brain_settings set = {
+		.hashed_headers = test_hashed_headers,
+		.mailbox_concurrency = mailbox_concurrency,
+	};
+
+	t_array_init(&set.sync_namespaces, 1);
+	return dsync_brain_master_init(user1, ibc, DSYNC_BRAIN_SYNC_TYPE_FULL,
+				       DSYNC_BRAIN_FLAG_SEND_MAIL_REQUESTS,
+				       &set);
+}
+
+static bool test_mailbox_is_locked(struct mailbox *box)
+{
+	const char *path;
+	struct stat st;
+
+	if (mailbox_get_path_to(box, MAILBOX_LIST_PATH_TYPE_INDEX,
+				&path) <= 0)
+		i_unreached();
+	path = t_strconcat(path, "/"DSYNC_MAILBOX_LOCK_FILENAME, NULL);
+	/* the lock file is unlinked when it's unlocked */
+	if (stat(path, &st) == 0)
+		return TRUE;
+	if (errno != ENOENT)
+		i_fatal("stat(%s) failed: %m", path);
+	return FALSE;
+}
+
+static void
+test_brain_check_pending(struct dsync_brain *brain,
+			 unsigned int *max_pending_count)
+{
+	const struct dsync_brain_pending_mailbox *pending;
+
+	if (brain->state != DSYNC_STATE_SYNC_MAILS || brain->box == NULL)
+		return;
+
+	/* the mailbox being synced is locked, but the ones sent ahead of
+	   time aren't */
+	test_assert(brain->box_lock != NULL);
+	test_assert(test_mailbox_is_locked(brain->box));
+	array_foreach(&brain->pending_mailboxes, pending) {
+		test_assert(pending->relock);
+		test_assert(!test_mailbox_is_locked(pending->box));
+	}
+	*max_pending_count = I_MAX(*max_pending_count,
+				   array_count(&brain->pending_mailboxes));
+}
+
+static void test_dsync_brain_concurrency_pipe(void)
+{
+	struct dsync_brain *brain1, *brain2;
+	struct dsync_ibc *ibc1, *ibc2;
+	unsigned int max_pending_count = 0;
+	bool running1, running2, changed1, changed2;
+	enum mail_error error;
+
+	test_begin("dsync brain mailbox concurrency (pipe)");
+	test_users_init();
+
+	dsync_ibc_init_pipe(&ibc1, &ibc2);
+	brain1 = test_brain_master_init(ibc1, TEST_MAILBOX_CONCURRENCY);
+	brain2 = dsync_brain_slave_init(user2, ibc2, TRUE, "", '_', 0);
+	test_assert(brain1->mailbox_concurrency == TEST_MAILBOX_CONCURRENCY);
+
+	running1 = running2 = TRUE;
+	while (running1 || running2) {
+		if (dsync_brain_has_failed(brain1) ||
+		    dsync_brain_has_failed(brain2))
+			break;
+		running1 = dsync_brain_run(brain1, &changed1);
+		test_brain_check_pending(brain1, &max_pending_count);
+		running2 = dsync_brain_run(brain2, &changed2);
+		test_brain_check_pending(brain1, &max_pending_count);
+		if (!changed1 && !changed2)
+			break;
+	}
+	test_assert(!running1 && !running2);
+	/* the mailboxes following the current one were sent ahead */
+	test_assert(max_pending_count == TEST_MAILBOX_CONCURRENCY - 1);
+
+	test_assert(dsync_brain_deinit(&brain2, &error) == 0);
+	test_assert(dsync_brain_deinit(&brain1, &error) == 0);
+	dsync_ibc_deinit(&ibc1);
+	dsync_ibc_deinit(&ibc2);
+
+	test_users_check_synced();
+	test_users_deinit();
+	test_end();
+}
+
+static void test_timeout(void *context ATTR_UNUSED)
+{
+	test_timed_out = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+static void test_dsync_brain_concurrency_stream(void)
+{
+	struct dsync_brain *brain1, *brain2;
+	struct dsync_ibc *ibc1, *ibc2;
+	struct istream *input1, *input2;
+	struct ostream *output1, *output2;
+	struct timeout *to;
+	const char *temp_prefix;
+	enum mail_error error;
+	int fds[2];
+
+	test_begin("dsync brain mailbox concurrency (stream)");
+	test_users_init();
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		i_fatal("socketpair() failed: %m");
+	fd_set_nonblock(fds[0], TRUE);
+	fd_set_nonblock(fds[1], TRUE);
+	input1 = i_stream_create_fd(fds[0], SIZE_MAX);
+	output1 = o_stream_create_fd(fds[0], SIZE_MAX);
+	input2 = i_stream_create_fd(fds[1], SIZE_MAX);
+	output2 = o_stream_create_fd(fds[1], SIZE_MAX);
+	temp_prefix = t_strdup_printf("%s/dsync-temp.", test_dir_get());
+	ibc1 = dsync_ibc_init_stream(input1, output1, "user2", temp_prefix,
+				     TEST_TIMEOUT_SECS, NULL, NULL);
+	ibc2 = dsync_ibc_init_stream(input2, output2, "user1", temp_prefix,
+				     TEST_TIMEOUT_SECS, NULL, NULL);
+
+	brain1 = test_brain_master_init(ibc1, TEST_MAILBOX_CONCURRENCY);
+	brain2 = dsync_brain_slave_init(user2, ibc2, FALSE, "", '_', 0);
+
+	/* The brains are run by their IBC callbacks, which stop the ioloop
+	   whenever either one of them finishes. */
+	test_timed_out = FALSE;
+	to = timeout_add(TEST_TIMEOUT_SECS * 1000, test_timeout, NULL);
+	while (!test_timed_out &&
+	       (brain1->state != DSYNC_STATE_DONE ||
+		brain2->state != DSYNC_STATE_DONE) &&
+	       !dsync_brain_has_failed(brain1) &&
+	       !dsync_brain_has_failed(brain2))
+		io_loop_run(current_ioloop);
+	timeout_remove(&to);
+	test_assert(!test_timed_out);
+	/* the remote supports the mailbox lookahead */
+	test_assert(brain1->mailbox_concurrency == TEST_MAILBOX_CONCURRENCY);
+
+	test_assert(dsync_brain_deinit(&brain2, &error) == 0);
+	test_assert(dsync_brain_deinit(&brain1, &error) == 0);
+	dsync_ibc_deinit(&ibc1);
+	dsync_ibc_deinit(&ibc2);
+	i_stream_unref(&input1);
+	i_stream_unref(&input2);
+	o_stream_unref(&output1);
+	o_stream_unref(&output2);
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+
+	test_users_check_synced();
+	test_users_deinit();
+	test_end();
+}
+
+static void test_dsync_brain_concurrency_max(void)
+{
+	struct dsync_brain *brain1, *brain2;
+	struct dsync_ibc *ibc1, *ibc2;
+	enum mail_error error;
+
+	test_begin("dsync brain mailbox concurrency limit");
+	test_users_init();
+	dsync_ibc_init_pipe(&ibc1, &ibc2);
+	brain1 = test_brain_master_init(ibc1,
+					DSYNC_MAILBOX_MAX_CONCURRENCY + 1);
+	brain2 = dsync_brain_slave_init(user2, ibc2, TRUE, "", '_', 0);
+	test_assert(brain1->mailbox_concurrency ==
+		    DSYNC_MAILBOX_MAX_CONCURRENCY);
+	(void)dsync_brain_deinit(&brain2, &error);
+	(void)dsync_brain_deinit(&brain1, &error);
+	dsync_ibc_deinit(&ibc1);
+	dsync_ibc_deinit(&ibc2);
+	test_users_deinit();
+	test_end();
+}
+
+static void test_setup(void)
+{
+	test_ctx = test_mail_storage_init();
+}
+
+static void test_teardown(void)
+{
+	test_mail_storage_deinit(&test_ctx);
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_setup,
+		test_dsync_brain_concurrency_pipe,
+		test_dsync_brain_concurrency_stream,
+		test_dsync_brain_concurrency_max,
+		test_teardown,
+		NULL
+	};
+	const char *error;
+	int ret;
+
+	master_service = master_service_init("test-dsync-brain",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	if (master_service_settings_read_simple(master_service, &error) < 0)
+		i_fatal("%s", error);
+	master_service_init_finish(master_service);
+	test_dir_init("test-dsync-brain");
+	ret = test_run(tests);
+
+	master_service_deinit(&master_service);
+	return ret;
+}
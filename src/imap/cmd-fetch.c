@@ -283,6 +283,13 @@ static bool cmd_fetch_continue(struct client_command_context *cmd)
 	return cmd_fetch_finish(ctx, cmd);
 }
 
+static bool cmd_fetch_prefetch(struct client_command_context *cmd)
+{
+	struct imap_fetch_context *ctx = cmd->context;
+
+	return imap_fetch_prefetch(ctx);
+}
+
 static void cmd_fetch_set_reason_codes(struct client_command_context *cmd,
 				       struct imap_fetch_context *ctx)
 {
@@ -384,6 +391,7 @@ bool cmd_fetch(struct client_command_context *cmd)
 		cmd->state = CLIENT_COMMAND_STATE_WAIT_OUTPUT;
 
 		cmd->func = cmd_fetch_continue;
+		cmd->prefetch_func = cmd_fetch_prefetch;
 		cmd->context = ctx;
 		return FALSE;
 	}
@@ -27,12 +27,38 @@ struct cmd_list_context {
 
 	struct mailbox_list_iterate_context *list_iter;
 
+	/* Mailbox looked up by cmd_list_prefetch(), but not sent yet */
+	pool_t prefetch_pool;
+	struct mailbox_info prefetch_info;
+	struct imap_status_result prefetch_status;
+	int prefetch_status_ret;
+
 	bool lsub:1;
 	bool lsub_no_unsubscribed:1;
 	bool used_listext:1;
 	bool used_status:1;
+	bool have_prefetch_info:1;
+	bool have_prefetch_status:1;
+	bool prefetch_finished:1;
 };
 
+static bool
+list_want_status(enum mailbox_info_flags mbox_flags,
+		 enum mailbox_list_iter_flags list_flags)
+{
+	if ((mbox_flags & (MAILBOX_NONEXISTENT | MAILBOX_NOSELECT)) != 0) {
+		/* doesn't exist, don't even try to get STATUS */
+		return FALSE;
+	}
+	if ((mbox_flags & MAILBOX_SUBSCRIBED) == 0 &&
+	    (list_flags & MAILBOX_LIST_ITER_SELECT_SUBSCRIBED) != 0) {
+		/* listing subscriptions, but only child is subscribed */
+		i_assert((mbox_flags & MAILBOX_CHILD_SUBSCRIBED) != 0);
+		return FALSE;
+	}
+	return TRUE;
+}
+
 static void
 mailbox_flags2str(struct cmd_list_context *ctx, string_t *str,
 		  const char *special_use, enum mailbox_info_flags flags)
@@ -217,23 +243,21 @@ static void
 list_send_status(struct cmd_list_context *ctx,
 		 const struct imap_list_return_flag_params *params)
 {
-	enum mailbox_info_flags mbox_flags = params->mbox_flags;
-	enum mailbox_list_iter_flags list_flags = params->list_flags;
 	struct imap_status_result result;
+	int ret;
 
-	if ((mbox_flags & (MAILBOX_NONEXISTENT | MAILBOX_NOSELECT)) != 0) {
-		/* doesn't exist, don't even try to get STATUS */
-		return;
-	}
-	if ((mbox_flags & MAILBOX_SUBSCRIBED) == 0 &&
-	    (list_flags & MAILBOX_LIST_ITER_SELECT_SUBSCRIBED) != 0) {
-		/* listing subscriptions, but only child is subscribed */
-		i_assert((mbox_flags & MAILBOX_CHILD_SUBSCRIBED) != 0);
+	if (ctx->have_prefetch_status) {
+		/* looked up already while waiting for the output */
+		ctx->have_prefetch_status = FALSE;
+		result = ctx->prefetch_status;
+		ret = ctx->prefetch_status_ret;
+	} else if (!list_want_status(params->mbox_flags, params->list_flags))
 		return;
+	else {
+		ret = imap_status_get(ctx->cmd, params->ns, params->name,
+				      &ctx->status_items, &result);
 	}
-
-	if (imap_status_get(ctx->cmd, params->ns, params->name,
-			    &ctx->status_items, &result) < 0) {
+	if (ret < 0) {
 		client_send_line(ctx->cmd->client,
 				 t_strconcat("* ", result.errstr, NULL));
 		return;
@@ -270,6 +294,88 @@ list_send_options(struct cmd_list_context *ctx,
 	}
 }
 
+static bool
+cmd_list_skip_info(struct cmd_list_context *ctx, enum mailbox_info_flags flags)
+{
+	/* mask doesn't end with %. we don't want to show any extra
+	   mailboxes. */
+	return (flags & MAILBOX_CHILD_SUBSCRIBED) != 0 &&
+		(flags & MAILBOX_SUBSCRIBED) == 0 &&
+		ctx->lsub_no_unsubscribed;
+}
+
+static const struct mailbox_info *
+cmd_list_iter_next(struct cmd_list_context *ctx)
+{
+	if (ctx->have_prefetch_info) {
+		ctx->have_prefetch_info = FALSE;
+		return &ctx->prefetch_info;
+	}
+	if (ctx->prefetch_finished)
+		return NULL;
+	return mailbox_list_iter_next(ctx->list_iter);
+}
+
+static int cmd_list_iter_deinit(struct cmd_list_context *ctx)
+{
+	pool_unref(&ctx->prefetch_pool);
+	return mailbox_list_iter_deinit(&ctx->list_iter);
+}
+
+static bool cmd_list_prefetch(struct client_command_context *cmd)
+{
+	struct cmd_list_context *ctx = cmd->context;
+	struct client *client = cmd->client;
+	const struct mailbox_info *info;
+	struct mail_namespace *ns;
+
+	if (cmd->cancel || ctx->list_iter == NULL ||
+	    ctx->have_prefetch_info || ctx->prefetch_finished)
+		return FALSE;
+
+	/* The next mailbox's info is kept until the reply is sent, so it
+	   can't point to the iterator's or data stack's memory. */
+	info = mailbox_list_iter_next(ctx->list_iter);
+	if (info == NULL) {
+		ctx->prefetch_finished = TRUE;
+		return FALSE;
+	}
+	if (ctx->prefetch_pool == NULL) {
+		ctx->prefetch_pool =
+			pool_alloconly_create("list prefetch", 256);
+	} else {
+		p_clear(ctx->prefetch_pool);
+	}
+	ctx->prefetch_info = *info;
+	ctx->prefetch_info.vname = p_strdup(ctx->prefetch_pool, info->vname);
+	ctx->prefetch_info.special_use =
+		p_strdup(ctx->prefetch_pool, info->special_use);
+	ctx->have_prefetch_info = TRUE;
+
+	if (!ctx->used_status || cmd_list_skip_info(ctx, info->flags) ||
+	    !list_want_status(info->flags, ctx->list_flags))
+		return TRUE;
+	ns = mail_namespace_find(ctx->user->namespaces, info->vname);
+	if (client->mailbox != NULL &&
+	    mailbox_equals(client->mailbox, ns, info->vname)) {
+		/* the selected mailbox may be in use by the command that
+		   is sending its output */
+		return TRUE;
+	}
+	/* Opening the mailbox and looking up its status is the slow part
+	   of LIST-STATUS. */
+	ctx->prefetch_status_ret =
+		imap_status_get(cmd, ns, ctx->prefetch_info.vname,
+				&ctx->status_items, &ctx->prefetch_status);
+	if (ctx->prefetch_status_ret < 0) {
+		ctx->prefetch_status.errstr =
+			p_strdup(ctx->prefetch_pool,
+				 ctx->prefetch_status.errstr);
+	}
+	ctx->have_prefetch_status = TRUE;
+	return TRUE;
+}
+
 static bool cmd_list_continue(struct client_command_context *cmd)
 {
         struct cmd_list_context *ctx = cmd->context;
@@ -282,22 +388,17 @@ static bool cmd_list_continue(struct client_command_context *cmd)
 
 	if (cmd->cancel) {
 		if (ctx->list_iter != NULL)
-			(void)mailbox_list_iter_deinit(&ctx->list_iter);
+			(void)cmd_list_iter_deinit(ctx);
 		return TRUE;
 	}
 	str = t_str_new(256);
 	mutf7_name = t_str_new(128);
-	while ((info = mailbox_list_iter_next(ctx->list_iter)) != NULL) {
+	while ((info = cmd_list_iter_next(ctx)) != NULL) {
 		name = info->vname;
 		flags = info->flags;
 
-		if ((flags & MAILBOX_CHILD_SUBSCRIBED) != 0 &&
-		    (flags & MAILBOX_SUBSCRIBED) == 0 &&
-		    ctx->lsub_no_unsubscribed) {
-			/* mask doesn't end with %. we don't want to show
-			   any extra mailboxes. */
+		if (cmd_list_skip_info(ctx, flags))
 			continue;
-		}
 
 		if (!cmd->utf8) {
 			str_truncate(mutf7_name, 0);
@@ -346,7 +447,7 @@ static bool cmd_list_continue(struct client_command_context *cmd)
 		}
 	}
 
-	if (mailbox_list_iter_deinit(&ctx->list_iter) < 0) {
+	if (cmd_list_iter_deinit(ctx) < 0) {
 		client_send_list_error(cmd, ctx->user->namespaces->list);
 		return TRUE;
 	}
@@ -577,6 +678,7 @@ bool cmd_list_full(struct client_command_context *cmd, bool lsub)
 			/* unfinished */
 			cmd->state = CLIENT_COMMAND_STATE_WAIT_OUTPUT;
 			cmd->func = cmd_list_continue;
+			cmd->prefetch_func = cmd_list_prefetch;
 			return FALSE;
 		}
 
@@ -1046,6 +1046,14 @@ void client_command_free(struct client_command_context **_cmd)
 	event_add_int(cmd->event, "lock_wait_usecs", cmd->stats.lock_wait_usecs);
 	event_add_int(cmd->event, "net_in_bytes", cmd->stats.bytes_in);
 	event_add_int(cmd->event, "net_out_bytes", cmd->stats.bytes_out);
+	if (cmd->stats.first_run_timeval.tv_sec != 0) {
+		event_add_int(cmd->event, "queue_usecs",
+			timeval_diff_usecs(&cmd->stats.first_run_timeval,
+					   &cmd->stats.start_time));
+	}
+	event_add_int(cmd->event, "output_lock_wait_usecs",
+		      cmd->stats.output_lock_wait_usecs);
+	event_add_int(cmd->event, "prefetch_usecs", cmd->stats.prefetch_usecs);
 
 	if (cmd->name != NULL) {
 		string_t *str = t_str_new(128);
@@ -1486,6 +1494,30 @@ static void client_output_cmd(struct client_command_context *cmd)
 	}
 }
 
+static void client_prefetch_commands(struct client *client)
+{
+	struct client_command_context *cmd;
+
+	/* Another command is in the middle of sending its output. Let the
+	   commands waiting behind it look up what they're going to send
+	   next, so the storage I/O overlaps with writing the output. The
+	   replies are still sent in the same order as before. */
+	for (cmd = client->command_queue; cmd != NULL; cmd = cmd->next) {
+		if (cmd == client->output_cmd_lock ||
+		    cmd->state != CLIENT_COMMAND_STATE_WAIT_OUTPUT ||
+		    cmd->cancel)
+			continue;
+
+		if (cmd->stats_start.output_lock_wait_timeval.tv_sec == 0) {
+			cmd->stats_start.output_lock_wait_timeval =
+				ioloop_timeval;
+		}
+		if (cmd->prefetch_func != NULL) T_BEGIN {
+			(void)command_prefetch(cmd);
+		} T_END;
+	}
+}
+
 static void client_output_commands(struct client *client)
 {
 	struct client_command_context *cmd;
@@ -1497,6 +1529,8 @@ static void client_output_commands(struct client *client)
 	if (client->output_cmd_lock != NULL) {
 		client->output_cmd_lock->temp_executed = TRUE;
 		client_output_cmd(client->output_cmd_lock);
+		if (client->output_cmd_lock != NULL)
+			client_prefetch_commands(client);
 	}
 	while (client->output_cmd_lock == NULL) {
 		/* go through the entire commands list every time in case
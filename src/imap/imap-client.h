@@ -73,12 +73,25 @@ struct client_command_stats {
 	uint64_t lock_wait_usecs;
 	/* how many bytes of client input/output command has used */
 	uint64_t bytes_in, bytes_out;
+	/* time when the command was executed for the first time. The time
+	   before it is spent reading the parameters and waiting for other
+	   commands to finish. */
+	struct timeval first_run_timeval;
+	/* how many usecs the command has spent waiting for another command to
+	   finish sending its output */
+	uint64_t output_lock_wait_usecs;
+	/* how many usecs the command has spent prefetching data while waiting
+	   for the output lock */
+	uint64_t prefetch_usecs;
 };
 
 struct client_command_stats_start {
 	struct timeval timeval;
 	uint64_t lock_wait_usecs;
 	uint64_t bytes_in, bytes_out;
+	/* time when the command started waiting for the output lock, or 0 if
+	   it's not waiting */
+	struct timeval output_lock_wait_timeval;
 };
 
 struct client_command_context {
@@ -106,6 +119,12 @@ struct client_command_context {
 	const char *tagline_reply;
 
 	command_func_t *func;
+	/* If non-NULL, called while the command is waiting for another
+	   command's output to finish. It may look up data that the command
+	   needs next, but it must not send anything to the client. Returns
+	   TRUE if something was prefetched. Commands aren't started while
+	   the output is locked, so e.g. STATUS can't use this. */
+	command_func_t *prefetch_func;
 	void *context;
 
 	/* Module-specific contexts. */
@@ -200,6 +200,14 @@ bool command_exec(struct client_command_context *cmd)
 
 	io_loop_time_refresh();
 	command_stats_start(cmd);
+	if (cmd->stats.first_run_timeval.tv_sec == 0)
+		cmd->stats.first_run_timeval = ioloop_timeval;
+	if (cmd->stats_start.output_lock_wait_timeval.tv_sec != 0) {
+		cmd->stats.output_lock_wait_usecs +=
+			timeval_diff_usecs(&ioloop_timeval,
+				&cmd->stats_start.output_lock_wait_timeval);
+		i_zero(&cmd->stats_start.output_lock_wait_timeval);
+	}
 
 	event_push_global(cmd->global_event);
 	cmd->executing = TRUE;
@@ -217,6 +225,29 @@ bool command_exec(struct client_command_context *cmd)
 	return finished;
 }
 
+bool command_prefetch(struct client_command_context *cmd)
+{
+	struct timeval start_timeval;
+	bool ret;
+
+	i_assert(!cmd->executing);
+	i_assert(cmd->prefetch_func != NULL);
+
+	io_loop_time_refresh();
+	start_timeval = ioloop_timeval;
+
+	event_push_global(cmd->global_event);
+	cmd->executing = TRUE;
+	ret = cmd->prefetch_func(cmd);
+	cmd->executing = FALSE;
+	event_pop_global(cmd->global_event);
+
+	io_loop_time_refresh();
+	cmd->stats.prefetch_usecs +=
+		timeval_diff_usecs(&ioloop_timeval, &start_timeval);
+	return ret;
+}
+
 static int command_cmp(const struct command *c1, const struct command *c2)
 {
 	return strcasecmp(c1->name, c2->name);
@@ -55,6 +55,8 @@ void command_hook_unregister(command_hook_callback_t *pre,
 			     command_hook_callback_t *post);
 /* Execute command and hooks */
 bool command_exec(struct client_command_context *cmd);
+/* Call the command's prefetch_func. Returns its return value. */
+bool command_prefetch(struct client_command_context *cmd);
 /* Starts counting command statistics. */
 void command_stats_start(struct client_command_context *cmd);
 /* Finish counting command statistics. This is called automatically when
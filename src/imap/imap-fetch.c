@@ -488,6 +488,27 @@ static bool imap_fetch_cur_failed(struct imap_fetch_context *ctx)
 	return TRUE;
 }
 
+static bool imap_fetch_next_mail(struct imap_fetch_context *ctx)
+{
+	struct imap_fetch_state *state = &ctx->state;
+
+	i_assert(state->cur_mail == NULL);
+
+	if (state->search_finished)
+		return FALSE;
+	if (!mailbox_search_next(state->search_ctx, &state->cur_mail)) {
+		state->search_finished = TRUE;
+		return FALSE;
+	}
+
+	str_printfa(state->cur_str, "* %u FETCH (", state->cur_mail->seq);
+	ctx->fetched_mails_count++;
+	state->cur_first = TRUE;
+	state->cur_str_prefix_size = str_len(state->cur_str);
+	i_assert(!state->line_partial);
+	return TRUE;
+}
+
 static int imap_fetch_more_int(struct imap_fetch_context *ctx, bool cancel)
 {
 	struct imap_fetch_state *state = &ctx->state;
@@ -522,6 +543,19 @@ static int imap_fetch_more_int(struct imap_fetch_context *ctx, bool cancel)
 			i_stream_unref(&state->cur_input);
 	}
 
+	if (state->cur_prefetched) {
+		state->cur_prefetched = FALSE;
+		if (cancel) {
+			/* The FETCH was cancelled before the prefetched mail's
+			   reply was started. Forget the mail, so its reply
+			   isn't sent at all. */
+			str_truncate(state->cur_str, 0);
+			ctx->fetched_mails_count--;
+			state->cur_mail = NULL;
+			return 1;
+		}
+	}
+
 	handlers = array_get(&ctx->handlers, &count);
 	for (;;) {
 		if (o_stream_get_buffer_used_size(client->output) >=
@@ -535,16 +569,8 @@ static int imap_fetch_more_int(struct imap_fetch_context *ctx, bool cancel)
 			if (cancel)
 				return 1;
 
-			if (!mailbox_search_next(state->search_ctx,
-						 &state->cur_mail))
+			if (!imap_fetch_next_mail(ctx))
 				break;
-
-			str_printfa(state->cur_str, "* %u FETCH (",
-				    state->cur_mail->seq);
-			ctx->fetched_mails_count++;
-			state->cur_first = TRUE;
-			state->cur_str_prefix_size = str_len(state->cur_str);
-			i_assert(!state->line_partial);
 		}
 
 		for (; state->cur_handler < count; state->cur_handler++) {
@@ -633,6 +659,21 @@ int imap_fetch_more(struct imap_fetch_context *ctx,
 	return ret;
 }
 
+bool imap_fetch_prefetch(struct imap_fetch_context *ctx)
+{
+	struct imap_fetch_state *state = &ctx->state;
+
+	if (!state->fetching || state->failed || state->cur_mail != NULL)
+		return FALSE;
+	/* The search looks up the mail's cached fields and starts reading
+	   the message if it's going to be needed. With mail_prefetch_count
+	   the following mails are prefetched as well. */
+	if (!imap_fetch_next_mail(ctx))
+		return FALSE;
+	state->cur_prefetched = TRUE;
+	return TRUE;
+}
+
 int imap_fetch_more_no_lock_update(struct imap_fetch_context *ctx)
 {
 	int ret;
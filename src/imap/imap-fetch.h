@@ -73,6 +73,11 @@ struct imap_fetch_state {
 	bool line_partial:1;
 	bool skipped_expunged_msgs:1;
 	bool failed:1;
+	/* mailbox_search_next() has returned FALSE */
+	bool search_finished:1;
+	/* cur_mail was looked up by imap_fetch_prefetch(), and nothing has
+	   been sent for it yet */
+	bool cur_prefetched:1;
 };
 
 struct imap_fetch_context {
@@ -145,6 +150,12 @@ int imap_fetch_send_vanished(struct client *client, struct mailbox *box,
    finished before anything else to client. */
 int imap_fetch_more(struct imap_fetch_context *ctx,
 		    struct client_command_context *cmd);
+/* Look up the next mail to be fetched and start reading it, without sending
+   anything to the client. This can be called while another command is still
+   sending its output, so the FETCH reply can be sent without delay once it's
+   allowed. Returns TRUE if a mail was prefetched, FALSE if there was nothing
+   (more) to prefetch. */
+bool imap_fetch_prefetch(struct imap_fetch_context *ctx);
 /* Like imap_fetch_more(), but don't check/update output_lock.
    The caller must handle this itself. */
 int imap_fetch_more_no_lock_update(struct imap_fetch_context *ctx);
@@ -0,0 +1,274 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "test-common.h"
+#include "test-dir.h"
+#include "istream.h"
+#include "ostream.h"
+#include "str.h"
+#include "settings-parser.h"
+#include "settings.h"
+#include "master-service.h"
+#include "smtp-submit.h"
+#include "mail-storage-service.h"
+#include "mail-search-build.h"
+#include "imap-common.h"
+#include "imap-settings.h"
+#include "imap-client.h"
+#include "imap-fetch.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define TEST_MAIL_COUNT 3
+
+imap_client_created_func_t *hook_client_created = NULL;
+bool imap_debug = FALSE;
+bool verbose_proctitle = FALSE;
+
+static struct mail_storage_service_ctx *storage_service;
+static struct client *client;
+static int client_fd;
+
+void imap_refresh_proctitle(void) { }
+void imap_refresh_proctitle_delayed(void) { }
+int client_create_from_input(const struct mail_storage_service_input *input ATTR_UNUSED,
+			     const struct imap_logout_stats *stats ATTR_UNUSED,
+			     int fd_in ATTR_UNUSED, int fd_out ATTR_UNUSED,
+			     enum client_create_flags flags ATTR_UNUSED,
+			     struct client **client_r ATTR_UNUSED,
+			     const char **error_r ATTR_UNUSED) { return -1; }
+
+static void test_mail_save(struct mailbox *box, unsigned int i)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	const char *mail_input;
+	int ret;
+
+	mail_input = t_strdup_printf("Subject: mail %u\n\nbody %u\n", i, i);
+	input = i_stream_create_from_data(mail_input, strlen(mail_input));
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	ret = mailbox_save_begin(&save_ctx, input);
+	while (ret == 0 && i_stream_read(input) > 0) {
+		if (mailbox_save_continue(save_ctx) < 0)
+			ret = -1;
+	}
+	if (ret == 0 && mailbox_save_finish(&save_ctx) < 0)
+		ret = -1;
+	if (save_ctx != NULL)
+		mailbox_save_cancel(&save_ctx);
+	if (ret == 0 && mailbox_transaction_commit(&trans) < 0)
+		ret = -1;
+	if (trans != NULL)
+		mailbox_transaction_rollback(&trans);
+	i_stream_unref(&input);
+	if (ret < 0) {
+		i_fatal("Failed to save mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+}
+
+static void test_client_init(void)
+{
+	const struct smtp_submit_settings *smtp_set;
+	const struct imap_settings *imap_set;
+	struct mail_user *mail_user;
+	const char *error;
+	int fds[2];
+
+	storage_service = mail_storage_service_init(master_service,
+		MAIL_STORAGE_SERVICE_FLAG_ALLOW_ROOT |
+		MAIL_STORAGE_SERVICE_FLAG_NO_LOG_INIT |
+		MAIL_STORAGE_SERVICE_FLAG_NO_CHDIR |
+		MAIL_STORAGE_SERVICE_FLAG_NO_RESTRICT_ACCESS);
+
+	const char *const input_userdb[] = {
+		"mailbox_list_index=no",
+		"mail_driver=sdbox",
+		t_strdup_printf("mail_path=%s/mail", test_dir_get()),
+		t_strdup_printf("base_dir=%s", test_dir_get()),
+		NULL
+	};
+	struct mail_storage_service_input input = {
+		.username = "testuser",
+		.userdb_fields = input_userdb,
+	};
+	test_assert(mail_storage_service_lookup_next(storage_service, &input,
+						     &mail_user, &error) == 1);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		i_fatal("socketpair() failed: %m");
+	fd_set_nonblock(fds[1], TRUE);
+	client_fd = fds[1];
+
+	if (settings_get(mail_user->event, &smtp_submit_setting_parser_info, 0,
+			 &smtp_set, &error) < 0 ||
+	    settings_get(mail_user->event, &imap_setting_parser_info, 0,
+			 &imap_set, &error) < 0)
+		i_fatal("%s", error);
+	struct event *event = event_create(NULL);
+	client = client_create(fds[0], fds[0], 0, event, mail_user,
+			       imap_set, smtp_set);
+	event_unref(&event);
+
+	client->mailbox = mailbox_alloc(client->user->namespaces->list,
+					"INBOX", 0);
+	test_assert(mailbox_open(client->mailbox) == 0);
+	for (unsigned int i = 1; i <= TEST_MAIL_COUNT; i++)
+		test_mail_save(client->mailbox, i);
+	test_assert(mailbox_sync(client->mailbox, 0) == 0);
+}
+
+static void test_client_deinit(void)
+{
+	client_destroy(client, NULL);
+	i_close_fd(&client_fd);
+	mail_storage_service_deinit(&storage_service);
+}
+
+static const char *test_client_read_output(void)
+{
+	string_t *str = t_str_new(128);
+	char buf[1024];
+	ssize_t ret;
+
+	test_assert(o_stream_flush(client->output) > 0);
+	while ((ret = read(client_fd, buf, sizeof(buf))) > 0)
+		str_append_data(str, buf, ret);
+	test_assert(ret < 0 && errno == EAGAIN);
+	return str_c(str);
+}
+
+static struct imap_fetch_context *test_fetch_begin(void)
+{
+	struct imap_fetch_context *ctx;
+	struct mail_search_args *search_args;
+	pool_t pool;
+
+	pool = pool_alloconly_create("test fetch", 1024);
+	ctx = imap_fetch_alloc(client, pool, "test", FALSE);
+	pool_unref(&pool);
+	imap_fetch_init_nofail_handler(ctx, imap_fetch_uid_init);
+
+	search_args = mail_search_build_init();
+	mail_search_build_add_all(search_args);
+	imap_fetch_begin(ctx, client->mailbox, search_args);
+	mail_search_args_unref(&search_args);
+	return ctx;
+}
+
+static void test_imap_fetch_prefetch_order(void)
+{
+	struct imap_fetch_context *ctx;
+	struct client_command_context *cmd;
+
+	test_begin("imap fetch prefetch order");
+	cmd = client_command_alloc(client);
+	ctx = test_fetch_begin();
+
+	/* the first mail is looked up, but nothing is sent yet */
+	test_assert(imap_fetch_prefetch(ctx));
+	test_assert(!imap_fetch_prefetch(ctx));
+	test_assert_strcmp(test_client_read_output(), "");
+
+	/* the prefetched mail is sent first, followed by the rest */
+	test_assert(imap_fetch_more(ctx, cmd) == 1);
+	test_assert_strcmp(test_client_read_output(),
+			   "* 1 FETCH (UID 1)\r\n"
+			   "* 2 FETCH (UID 2)\r\n"
+			   "* 3 FETCH (UID 3)\r\n");
+	test_assert(ctx->fetched_mails_count == TEST_MAIL_COUNT);
+
+	/* there's nothing more to prefetch */
+	test_assert(!imap_fetch_prefetch(ctx));
+	test_assert(imap_fetch_end(ctx) == 0);
+	imap_fetch_free(&ctx);
+	client_command_free(&cmd);
+	test_end();
+}
+
+static void test_imap_fetch_prefetch_cancel(void)
+{
+	struct imap_fetch_context *ctx;
+	struct client_command_context *cmd;
+
+	test_begin("imap fetch prefetch cancel");
+	cmd = client_command_alloc(client);
+	ctx = test_fetch_begin();
+
+	test_assert(imap_fetch_prefetch(ctx));
+	/* cancelling drops the prefetched mail without sending its reply */
+	cmd->cancel = TRUE;
+	test_assert(imap_fetch_more(ctx, cmd) == 1);
+	test_assert_strcmp(test_client_read_output(), "");
+	test_assert(ctx->fetched_mails_count == 0);
+	test_assert(client->output_cmd_lock == NULL);
+	test_assert(!client->disconnected);
+
+	test_assert(imap_fetch_end(ctx) == 0);
+	imap_fetch_free(&ctx);
+	client_command_free(&cmd);
+	test_end();
+}
+
+static void test_imap_fetch(void)
+{
+	test_client_init();
+	test_imap_fetch_prefetch_order();
+	test_imap_fetch_prefetch_cancel();
+	test_client_deinit();
+}
+
+struct test_service_settings {
+	pool_t pool;
+	ARRAY_TYPE(const_string) services;
+};
+
+static const struct setting_define test_service_setting_defines[] = {
+	{ .type = SET_FILTER_ARRAY, .key = "service",
+	  .offset = offsetof(struct test_service_settings, services) },
+	SETTING_DEFINE_LIST_END
+};
+
+static const struct setting_parser_info test_service_setting_parser_info = {
+	.name = "test_service",
+
+	.defines = test_service_setting_defines,
+
+	.struct_size = sizeof(struct test_service_settings),
+	.pool_offset1 = 1 + offsetof(struct test_service_settings, pool),
+};
+
+int main(int argc, char *argv[])
+{
+	const enum master_service_flags service_flags =
+		MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+		MASTER_SERVICE_FLAG_STANDALONE |
+		MASTER_SERVICE_FLAG_STD_CLIENT |
+		MASTER_SERVICE_FLAG_DONT_SEND_STATS;
+	int ret;
+
+	master_service = master_service_init("test-imap-fetch",
+					     service_flags, &argc, &argv, "D");
+
+	/* imap default settings use service/imap/imap_capability, so we need
+	   to register "service" named list filter. */
+	settings_info_register(&test_service_setting_parser_info);
+
+	master_service_init_finish(master_service);
+
+	test_dir_init("imap-fetch");
+
+	static void (*const test_functions[])(void) = {
+		test_imap_fetch,
+		NULL
+	};
+	ret = test_run(test_functions);
+
+	master_service_deinit(&master_service);
+	return ret;
+}
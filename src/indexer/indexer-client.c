@@ -35,7 +35,8 @@ static void indexer_client_ref(struct indexer_client *client);
 static void indexer_client_unref(struct indexer_client *client);
 
 static int
-indexer_client_request_queue(struct indexer_client *client, bool append,
+indexer_client_request_queue(struct indexer_client *client,
+			     enum indexer_request_priority priority,
 			     const char *const *args, const char **error_r)
 {
 	struct indexer_client_request *ctx = NULL;
@@ -67,7 +68,7 @@ indexer_client_request_queue(struct indexer_client *client, bool append,
 		indexer_client_ref(client);
 	}
 
-	indexer_queue_append(client->queue, append, args[1], args[2],
+	indexer_queue_append(client->queue, priority, args[1], args[2],
 			     session_id, max_recent_msgs, ctx);
 	o_stream_nsend_str(client->conn.output, t_strdup_printf("%u\tOK\n", tag));
 	return 0;
@@ -223,11 +224,16 @@ indexer_client_request(struct indexer_client *client,
 
 	args++;
 
-	if (strcmp(cmd, "APPEND") == 0)
-		return indexer_client_request_queue(client, TRUE, args, error_r);
-	else if (strcmp(cmd, "PREPEND") == 0)
-		return indexer_client_request_queue(client, FALSE, args, error_r);
-	else if (strcmp(cmd, "OPTIMIZE") == 0)
+	if (strcmp(cmd, "APPEND") == 0) {
+		return indexer_client_request_queue(client,
+			INDEXER_REQUEST_PRIORITY_NEW_MAIL, args, error_r);
+	} else if (strcmp(cmd, "PREPEND") == 0) {
+		return indexer_client_request_queue(client,
+			INDEXER_REQUEST_PRIORITY_INTERACTIVE, args, error_r);
+	} else if (strcmp(cmd, "BULK") == 0) {
+		return indexer_client_request_queue(client,
+			INDEXER_REQUEST_PRIORITY_BULK, args, error_r);
+	} else if (strcmp(cmd, "OPTIMIZE") == 0)
 		return indexer_client_request_optimize(client, args, error_r);
 	else if (strcmp(cmd, "REMOVE") == 0)
 		return indexer_client_request_remove(client, args, error_r);
@@ -2,25 +2,52 @@
 
 #include "lib.h"
 #include "array.h"
+#include "ioloop.h"
 #include "llist.h"
 #include "hash.h"
 #include "wildcard-match.h"
 #include "indexer-queue.h"
 
+struct indexer_queue_user {
+	char *username;
+	/* Linked list of all the user's requests */
+	struct indexer_request *requests;
+	/* Number of the user's requests being worked on. While non-zero, the
+	   user isn't in any of the round-robin lists. */
+	unsigned int working_count;
+
+	/* Queued requests for each priority */
+	struct indexer_request *queued_head[INDEXER_REQUEST_PRIORITY_COUNT];
+	struct indexer_request *queued_tail[INDEXER_REQUEST_PRIORITY_COUNT];
+	/* Round-robin list of users for each priority */
+	struct indexer_queue_user *rr_prev[INDEXER_REQUEST_PRIORITY_COUNT];
+	struct indexer_queue_user *rr_next[INDEXER_REQUEST_PRIORITY_COUNT];
+};
+
+struct indexer_queue_class {
+	/* Users that have queued requests with this priority and no requests
+	   being worked on. The next request is taken from the first user,
+	   who is then moved to the end of the list. */
+	struct indexer_queue_user *rr_head, *rr_tail;
+	/* All the queued requests with this priority, oldest first */
+	struct indexer_request *age_head, *age_tail;
+};
+
 struct indexer_queue {
 	indexer_queue_callback_t *callback;
 	void (*listen_callback)(struct indexer_queue *);
 
 	/* username+mailbox -> indexer_request */
 	HASH_TABLE(struct indexer_request *, struct indexer_request *) requests;
-	/* username -> indexer_request */
-	HASH_TABLE(char *, struct indexer_request *) users;
-	struct indexer_request *head, *tail;
+	/* username -> indexer_queue_user */
+	HASH_TABLE(char *, struct indexer_queue_user *) users;
+	struct indexer_queue_class classes[INDEXER_REQUEST_PRIORITY_COUNT];
 };
 
 struct indexer_queue_iter {
 	struct indexer_queue *queue;
 	struct hash_iterate_context *hash_iter;
+	enum indexer_request_priority priority;
 	struct indexer_request *next;
 	bool only_working;
 };
@@ -93,14 +120,95 @@ static void request_add_context(struct indexer_request *request, void *context)
 	array_push_back(&request->contexts, &context);
 }
 
+static struct indexer_queue_user *
+indexer_queue_user_get(struct indexer_queue *queue, const char *username)
+{
+	struct indexer_queue_user *user;
+
+	user = hash_table_lookup(queue->users, username);
+	if (user == NULL) {
+		user = i_new(struct indexer_queue_user, 1);
+		user->username = i_strdup(username);
+		hash_table_insert(queue->users, user->username, user);
+	}
+	return user;
+}
+
+static void
+indexer_queue_user_rr_add(struct indexer_queue *queue,
+			  struct indexer_queue_user *user,
+			  enum indexer_request_priority priority)
+{
+	struct indexer_queue_class *class = &queue->classes[priority];
+
+	DLLIST2_APPEND_FULL(&class->rr_head, &class->rr_tail, user,
+			    rr_prev[priority], rr_next[priority]);
+}
+
+static void
+indexer_queue_user_rr_remove(struct indexer_queue *queue,
+			     struct indexer_queue_user *user,
+			     enum indexer_request_priority priority)
+{
+	struct indexer_queue_class *class = &queue->classes[priority];
+
+	DLLIST2_REMOVE_FULL(&class->rr_head, &class->rr_tail, user,
+			    rr_prev[priority], rr_next[priority]);
+}
+
+static void
+indexer_queue_request_link(struct indexer_queue *queue,
+			   struct indexer_request *request,
+			   enum indexer_request_priority priority, bool head)
+{
+	struct indexer_queue_user *user = request->user;
+	struct indexer_queue_class *class = &queue->classes[priority];
+
+	if (user->queued_head[priority] == NULL && user->working_count == 0)
+		indexer_queue_user_rr_add(queue, user, priority);
+	if (head) {
+		DLLIST2_PREPEND(&user->queued_head[priority],
+				&user->queued_tail[priority], request);
+	} else {
+		DLLIST2_APPEND(&user->queued_head[priority],
+			       &user->queued_tail[priority], request);
+	}
+	request->priority = priority;
+	request->priority_time = ioloop_time;
+	DLLIST2_APPEND_FULL(&class->age_head, &class->age_tail, request,
+			    age_prev, age_next);
+}
+
+static void
+indexer_queue_request_unlink(struct indexer_queue *queue,
+			     struct indexer_request *request)
+{
+	struct indexer_queue_user *user = request->user;
+	enum indexer_request_priority priority = request->priority;
+	struct indexer_queue_class *class = &queue->classes[priority];
+
+	DLLIST2_REMOVE_FULL(&class->age_head, &class->age_tail, request,
+			    age_prev, age_next);
+	DLLIST2_REMOVE(&user->queued_head[priority],
+		       &user->queued_tail[priority], request);
+	if (user->queued_head[priority] == NULL && user->working_count == 0)
+		indexer_queue_user_rr_remove(queue, user, priority);
+}
+
 static struct indexer_request *
-indexer_queue_append_request(struct indexer_queue *queue, bool append,
+indexer_queue_append_request(struct indexer_queue *queue,
+			     enum indexer_request_priority priority,
 			     const char *username, const char *mailbox,
 			     const char *session_id,
 			     unsigned int max_recent_msgs, void *context)
 {
-	struct indexer_request *request, *first_request;
-	char *first_username;
+	struct indexer_queue_user *user;
+	struct indexer_request *request;
+	/* the latest interactive request is most likely the one someone is
+	   waiting for */
+	bool head = priority == INDEXER_REQUEST_PRIORITY_INTERACTIVE;
+
+	i_assert(priority < INDEXER_REQUEST_PRIORITY_COUNT);
 
 	request = indexer_queue_lookup(queue, username, mailbox);
 	if (request != NULL) {
@@ -109,44 +217,37 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 		request_add_context(request, context);
 		if (request->working) {
 			/* we're already indexing this mailbox. */
-			if (append)
-				request->reindex_tail = TRUE;
-			else
+			if ((!request->reindex_head && !request->reindex_tail) ||
+			    request->reindex_priority > priority)
+				request->reindex_priority = priority;
+			if (head)
 				request->reindex_head = TRUE;
+			else
+				request->reindex_tail = TRUE;
+		} else if (priority < request->priority || head) {
+			/* move the request to the higher priority, or to the
+			   beginning of the user's interactive requests */
+			indexer_queue_request_unlink(queue, request);
+			indexer_queue_request_link(queue, request,
+						   priority, head);
 		} else {
-			if (append) {
-				/* keep the request in its old position */
-			} else {
-				/* move request to beginning of the queue */
-				DLLIST2_REMOVE(&queue->head, &queue->tail, request);
-				DLLIST2_PREPEND(&queue->head, &queue->tail, request);
-			}
+			/* keep the request in its old position */
 		}
 		return request;
 	}
 
+	user = indexer_queue_user_get(queue, username);
 	request = i_new(struct indexer_request, 1);
+	request->user = user;
 	request->username = i_strdup(username);
 	request->mailbox = i_strdup(mailbox);
 	request->session_id = i_strdup(session_id);
 	request->max_recent_msgs = max_recent_msgs;
 	request_add_context(request, context);
 	hash_table_insert(queue->requests, request, request);
+	DLLIST_PREPEND_FULL(&user->requests, request, user_prev, user_next);
 
-	if (!hash_table_lookup_full(queue->users, username,
-				    &first_username, &first_request)) {
-		first_username = i_strdup(username);
-		hash_table_insert(queue->users, first_username, request);
-	} else {
-		DLLIST_PREPEND_FULL(&first_request, request,
-				    user_prev, user_next);
-		hash_table_update(queue->users, first_username, request);
-	}
-
-	if (append)
-		DLLIST2_APPEND(&queue->head, &queue->tail, request);
-	else
-		DLLIST2_PREPEND(&queue->head, &queue->tail, request);
+	indexer_queue_request_link(queue, request, priority, head);
 	return request;
 }
 
@@ -157,16 +258,17 @@ static void indexer_queue_append_finish(struct indexer_queue *queue)
 	indexer_refresh_proctitle();
 }
 
-void indexer_queue_append(struct indexer_queue *queue, bool append,
+void indexer_queue_append(struct indexer_queue *queue,
+			  enum indexer_request_priority priority,
 			  const char *username, const char *mailbox,
 			  const char *session_id, unsigned int max_recent_msgs,
 			  void *context)
 {
 	struct indexer_request *request;
 
-	request = indexer_queue_append_request(queue, append, username, mailbox,
-					       session_id, max_recent_msgs,
-					       context);
+	request = indexer_queue_append_request(queue, priority, username,
+					       mailbox, session_id,
+					       max_recent_msgs, context);
 	request->type = INDEXER_REQUEST_TYPE_INDEX;
 	indexer_queue_append_finish(queue);
 }
@@ -177,24 +279,70 @@ void indexer_queue_append_optimize(struct indexer_queue *queue,
 {
 	struct indexer_request *request;
 
-	request = indexer_queue_append_request(queue, TRUE, username, mailbox,
+	request = indexer_queue_append_request(queue,
+					       INDEXER_REQUEST_PRIORITY_BULK,
+					       username, mailbox,
 					       NULL, 0, context);
 	request->type = INDEXER_REQUEST_TYPE_OPTIMIZE;
 	indexer_queue_append_finish(queue);
 }
 
+static void indexer_queue_age(struct indexer_queue *queue)
+{
+	struct indexer_request *request;
+	unsigned int priority;
+
+	/* Requests aren't moved to the interactive priority, since that would
+	   just slow down the requests someone is actively waiting for. Handle
+	   the higher priorities first, so a request is moved only one
+	   priority higher at a time. */
+	for (priority = INDEXER_REQUEST_PRIORITY_NEW_MAIL + 1;
+	     priority < INDEXER_REQUEST_PRIORITY_COUNT; priority++) {
+		while ((request = queue->classes[priority].age_head) != NULL &&
+		       request->priority_time + INDEXER_QUEUE_AGING_SECS <=
+		       ioloop_time) {
+			indexer_queue_request_unlink(queue, request);
+			indexer_queue_request_link(queue, request,
+						   priority - 1, FALSE);
+		}
+	}
+}
+
+static struct indexer_request *indexer_queue_next(struct indexer_queue *queue)
+{
+	struct indexer_queue_user *user;
+	unsigned int priority;
+
+	for (priority = 0; priority < INDEXER_REQUEST_PRIORITY_COUNT; priority++) {
+		user = queue->classes[priority].rr_head;
+		if (user != NULL)
+			return user->queued_head[priority];
+	}
+	return NULL;
+}
+
 struct indexer_request *indexer_queue_request_peek(struct indexer_queue *queue)
 {
-	return queue->head;
+	indexer_queue_age(queue);
+	return indexer_queue_next(queue);
 }
 
 void indexer_queue_request_remove(struct indexer_queue *queue)
 {
-	struct indexer_request *request = queue->head;
+	struct indexer_request *request = indexer_queue_next(queue);
+	struct indexer_queue_user *user;
+	enum indexer_request_priority priority;
 
 	i_assert(request != NULL);
-
-	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+	user = request->user;
+	priority = request->priority;
+
+	indexer_queue_request_unlink(queue, request);
+	if (user->queued_head[priority] != NULL) {
+		/* give the other users a turn before this one */
+		indexer_queue_user_rr_remove(queue, user, priority);
+		indexer_queue_user_rr_add(queue, user, priority);
+	}
 }
 
 static void indexer_queue_request_status_int(struct indexer_queue *queue,
@@ -218,28 +366,52 @@ void indexer_queue_request_status(struct indexer_queue *queue,
 	indexer_queue_request_status_int(queue, request, status);
 }
 
-void indexer_queue_move_head_to_tail(struct indexer_queue *queue)
+void indexer_queue_request_work(struct indexer_queue *queue,
+				struct indexer_request *request)
 {
-	struct indexer_request *request = queue->head;
+	struct indexer_queue_user *user = request->user;
+	unsigned int priority;
 
-	indexer_queue_request_remove(queue);
-	DLLIST2_APPEND(&queue->head, &queue->tail, request);
-}
+	i_assert(!request->working);
 
-void indexer_queue_request_work(struct indexer_request *request)
-{
 	request->working = TRUE;
 	request->working_context_idx =
 		!array_is_created(&request->contexts) ? 0 :
 		array_count(&request->contexts);
+
+	if (user->working_count++ > 0)
+		return;
+	/* The user's other requests wait until this one is finished. */
+	for (priority = 0; priority < INDEXER_REQUEST_PRIORITY_COUNT; priority++) {
+		if (user->queued_head[priority] != NULL)
+			indexer_queue_user_rr_remove(queue, user, priority);
+	}
+}
+
+static void
+indexer_queue_request_unwork(struct indexer_queue *queue,
+			     struct indexer_request *request)
+{
+	struct indexer_queue_user *user = request->user;
+	unsigned int priority;
+
+	i_assert(user->working_count > 0);
+
+	request->working = FALSE;
+	if (--user->working_count > 0)
+		return;
+	for (priority = 0; priority < INDEXER_REQUEST_PRIORITY_COUNT; priority++) {
+		if (user->queued_head[priority] != NULL)
+			indexer_queue_user_rr_add(queue, user, priority);
+	}
 }
 
 void indexer_queue_request_finish(struct indexer_queue *queue,
 				  struct indexer_request **_request,
 				  enum indexer_state state)
 {
-	struct indexer_request *first_request, *request = *_request;
-	char *first_username;
+	struct indexer_request *request = *_request;
+	struct indexer_queue_user *user = request->user;
 
 	*_request = NULL;
 
@@ -249,29 +421,26 @@ void indexer_queue_request_finish(struct indexer_queue *queue,
 
 	if (request->reindex_head || request->reindex_tail) {
 		i_assert(request->working);
-		request->working = FALSE;
+		indexer_queue_request_unwork(queue, request);
 		if (request->working_context_idx > 0) {
 			array_delete(&request->contexts, 0,
 				     request->working_context_idx);
 		}
-		if (request->reindex_head)
-			DLLIST2_PREPEND(&queue->head, &queue->tail, request);
-		else
-			DLLIST2_APPEND(&queue->head, &queue->tail, request);
+		indexer_queue_request_link(queue, request,
+					   request->reindex_priority,
+					   request->reindex_head);
 		request->reindex_head = FALSE;
 		request->reindex_tail = FALSE;
 		return;
 	}
 
-	if (!hash_table_lookup_full(queue->users, request->username,
-				    &first_username, &first_request))
-		i_unreached();
-	DLLIST_REMOVE_FULL(&first_request, request, user_prev, user_next);
-	if (first_request != NULL)
-		hash_table_update(queue->users, first_username, first_request);
-	else {
-		hash_table_remove(queue->users, first_username);
-		i_free(first_username);
+	if (request->working)
+		indexer_queue_request_unwork(queue, request);
+	DLLIST_REMOVE_FULL(&user->requests, request, user_prev, user_next);
+	if (user->requests == NULL) {
+		hash_table_remove(queue->users, user->username);
+		i_free(user->username);
+		i_free(user);
 	}
 	hash_table_remove(queue->requests, request);
 	if (array_is_created(&request->contexts))
@@ -292,21 +461,24 @@ indexer_queue_request_cancel(struct indexer_queue *queue,
 
 	*_request = NULL;
 	request->reindex_head = request->reindex_tail = FALSE;
-	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+	indexer_queue_request_unlink(queue, request);
 	indexer_queue_request_finish(queue, &request, INDEXER_STATE_FAILED);
 }
 
 void indexer_queue_cancel(struct indexer_queue *queue, const char *username,
 			  const char *mailbox_mask)
 {
+	struct indexer_queue_user *user;
 	struct indexer_request *request, *next;
 	bool single_mailbox =
 		mailbox_mask != NULL && wildcard_is_literal(mailbox_mask);
 
 	if (single_mailbox)
 		request = indexer_queue_lookup(queue, username, mailbox_mask);
-	else
-		request = hash_table_lookup(queue->users, username);
+	else {
+		user = hash_table_lookup(queue->users, username);
+		request = user == NULL ? NULL : user->requests;
+	}
 
 	while (request != NULL) {
 		next = request->user_next;
@@ -331,6 +503,7 @@ void indexer_queue_cancel_all(struct indexer_queue *queue)
 {
 	struct indexer_request *request;
 	struct hash_iterate_context *iter;
+	unsigned int priority;
 
 	/* remove all reindex-markers so when the current requests finish
 	   (or are cancelled) we don't try to retry them (especially during
@@ -340,13 +513,21 @@ void indexer_queue_cancel_all(struct indexer_queue *queue)
 		request->reindex_head = request->reindex_tail = FALSE;
 	hash_table_iterate_deinit(&iter);
 
-	while ((request = indexer_queue_request_peek(queue)) != NULL)
-		indexer_queue_request_cancel(queue, &request);
+	for (priority = 0; priority < INDEXER_REQUEST_PRIORITY_COUNT; priority++) {
+		while ((request = queue->classes[priority].age_head) != NULL)
+			indexer_queue_request_cancel(queue, &request);
+	}
 }
 
 bool indexer_queue_is_empty(struct indexer_queue *queue)
 {
-	return queue->head == NULL;
+	unsigned int priority;
+
+	for (priority = 0; priority < INDEXER_REQUEST_PRIORITY_COUNT; priority++) {
+		if (queue->classes[priority].age_head != NULL)
+			return FALSE;
+	}
+	return TRUE;
 }
 
 unsigned int indexer_queue_count(struct indexer_queue *queue)
@@ -381,13 +562,20 @@ struct indexer_request *indexer_queue_iter_next(struct indexer_queue_iter *iter)
 				return request;
 		}
 		hash_table_iterate_deinit(&iter->hash_iter);
-		if (iter->only_working)
+		iter->priority = INDEXER_REQUEST_PRIORITY_INTERACTIVE;
+		iter->next = iter->queue->classes[iter->priority].age_head;
+	}
+	if (iter->only_working)
+		return NULL;
+
+	while (iter->next == NULL) {
+		if (iter->priority + 1 >= INDEXER_REQUEST_PRIORITY_COUNT)
 			return NULL;
-		iter->next = indexer_queue_request_peek(iter->queue);
+		iter->priority++;
+		iter->next = iter->queue->classes[iter->priority].age_head;
 	}
 	request = iter->next;
-	if (request != NULL)
-		iter->next = request->next;
+	iter->next = request->age_next;
 	return request;
 }
 
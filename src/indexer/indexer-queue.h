@@ -13,11 +13,32 @@ enum indexer_request_type {
 	INDEXER_REQUEST_TYPE_OPTIMIZE,
 };
 
+/* Requests are handled in priority order. Within the same priority the users
+   are served round-robin, so a single user with a large backlog can't keep all
+   the workers busy. Bulk requests that have been waiting for
+   INDEXER_QUEUE_AGING_SECS are moved to the new mail priority, so they
+   can't be starved. */
+enum indexer_request_priority {
+	/* Someone is waiting for the indexing to finish (e.g. SEARCH) */
+	INDEXER_REQUEST_PRIORITY_INTERACTIVE,
+	/* New mails were saved to the mailbox */
+	INDEXER_REQUEST_PRIORITY_NEW_MAIL,
+	/* Background rescans and optimizations */
+	INDEXER_REQUEST_PRIORITY_BULK,
+
+	INDEXER_REQUEST_PRIORITY_COUNT
+};
+#define INDEXER_QUEUE_AGING_SECS (30*60)
+
 struct indexer_request {
-	/* Linked list of all requests - highest priority first */
+	/* Linked list of the user's queued requests with the same priority */
 	struct indexer_request *prev, *next;
 	/* Linked list of the same username's requests */
 	struct indexer_request *user_prev, *user_next;
+	/* Linked list of the queued requests with the same priority - oldest
+	   first */
+	struct indexer_request *age_prev, *age_next;
+	struct indexer_queue_user *user;
 
 	char *username;
 	char *mailbox;
@@ -25,12 +46,18 @@ struct indexer_request {
 	unsigned int max_recent_msgs;
 
 	enum indexer_request_type type;
+	enum indexer_request_priority priority;
+	/* priority used for the reindexing */
+	enum indexer_request_priority reindex_priority;
+	/* when the request was moved to its current priority */
+	time_t priority_time;
 
 	/* currently indexing this mailbox */
 	bool working:1;
 	/* after indexing is finished, add this request back to the queue and
 	   reindex it (i.e. a new indexing request came while we were
-	   working.) */
+	   working.) reindex_head is set when it's reindexed with the
+	   interactive priority. */
 	bool reindex_head:1;
 	bool reindex_tail:1;
 
@@ -48,7 +75,8 @@ void indexer_queue_deinit(struct indexer_queue **queue);
 void indexer_queue_set_listen_callback(struct indexer_queue *queue,
 				       void (*callback)(struct indexer_queue *));
 
-void indexer_queue_append(struct indexer_queue *queue, bool append,
+void indexer_queue_append(struct indexer_queue *queue,
+			  enum indexer_request_priority priority,
 			  const char *username, const char *mailbox,
 			  const char *session_id, unsigned int max_recent_msgs,
 			  void *context);
@@ -65,7 +93,9 @@ void indexer_queue_cancel_all(struct indexer_queue *queue);
 bool indexer_queue_is_empty(struct indexer_queue *queue);
 unsigned int indexer_queue_count(struct indexer_queue *queue);
 
-/* Return the next request from the queue, without removing it. */
+/* Return the next request from the queue, without removing it. Requests of
+   users who already have a request being worked on are skipped, so this may
+   return NULL even if the queue isn't empty. */
 struct indexer_request *indexer_queue_request_peek(struct indexer_queue *queue);
 /* Remove the next request from the queue. You must call
    indexer_queue_request_finish() to free its memory. */
@@ -74,17 +104,17 @@ void indexer_queue_request_remove(struct indexer_queue *queue);
 void indexer_queue_request_status(struct indexer_queue *queue,
 				  struct indexer_request *request,
 				  const struct indexer_status *status);
-/* Move the next request to the end of the queue. */
-void indexer_queue_move_head_to_tail(struct indexer_queue *queue);
 /* Start working on a request */
-void indexer_queue_request_work(struct indexer_request *request);
+void indexer_queue_request_work(struct indexer_queue *queue,
+				struct indexer_request *request);
 /* Finish the request and free its memory. */
 void indexer_queue_request_finish(struct indexer_queue *queue,
 				  struct indexer_request **request,
 				  enum indexer_state state);
 
 /* Iterate through all requests. First it returns the requests currently being
-   worked on, followed by the queued requests in the priority order. If
+   worked on, followed by the queued requests in the priority order (and
+   oldest first within the same priority). If
    only_working=TRUE, return only the requests currently being worked on. */
 struct indexer_queue_iter *
 indexer_queue_iter_init(struct indexer_queue *queue, bool only_working);
@@ -46,31 +46,22 @@ static bool worker_send_request(struct indexer_request *request)
 					 worker_avail_callback) <= 0)
 		return FALSE;
 	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request);
+	indexer_queue_request_work(queue, request);
 	return TRUE;
 }
 
 static void queue_try_send_more(struct indexer_queue *queue)
 {
-	struct worker_connection *worker;
-	struct indexer_request *request, *first_moved_request = NULL;
+	struct indexer_request *request;
 
+	/* The queue doesn't return requests for users that already have a
+	   request being worked on. */
 	while ((request = indexer_queue_request_peek(queue)) != NULL) {
-		worker = worker_connections_find_user(request->username);
-		if (worker != NULL) {
-			/* There is already a connection handling a request
-			 * for this user. Move the request to the back of the
-			 * queue and handle requests from other users.
-			 * Terminate if we went through all requests. */
-			if (request == first_moved_request) {
-				/* all requests are waiting for existing users
-				   to finish. */
-				break;
-			}
-			if (first_moved_request == NULL)
-				first_moved_request = request;
-			indexer_queue_move_head_to_tail(queue);
-			continue;
+		if (worker_connections_find_user(request->username) != NULL) {
+			/* The user's previous request was just finished, but
+			   its worker hasn't disconnected yet. Continue when
+			   it has. */
+			break;
 		}
 
 		/* create a new connection to a worker */
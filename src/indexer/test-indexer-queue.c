@@ -1,15 +1,55 @@
 /* Copyright (c) 2022 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "ioloop.h"
 #include "test-common.h"
 #include "indexer-queue.h"
 
+#define INTERACTIVE INDEXER_REQUEST_PRIORITY_INTERACTIVE
+#define NEW_MAIL INDEXER_REQUEST_PRIORITY_NEW_MAIL
+#define BULK INDEXER_REQUEST_PRIORITY_BULK
+
 void indexer_refresh_proctitle(void) { }
 
+struct test_job {
+	enum indexer_request_priority priority;
+	time_t queued_time;
+	time_t finished_time;
+	unsigned int finish_count;
+	/* part of a single user's large backlog */
+	bool backlog;
+};
+ARRAY_DEFINE_TYPE(test_job, struct test_job *);
+
+static void
+indexer_queue_status_callback(const struct indexer_status *status,
+			      void *context)
+{
+	struct test_job *job = context;
+
+	if (job != NULL && status->state != INDEXER_STATE_PROCESSING) {
+		job->finished_time = ioloop_time;
+		job->finish_count++;
+	}
+}
+
 static void
-indexer_queue_status_callback(const struct indexer_status *status ATTR_UNUSED,
-			      void *context ATTR_UNUSED)
+test_queue_remove_expected(struct indexer_queue *queue,
+			   const char *username, const char *mailbox,
+			   unsigned int idx)
 {
+	struct indexer_request *request;
+
+	request = indexer_queue_request_peek(queue);
+	if (request == NULL) {
+		test_assert_idx(request != NULL, idx);
+		return;
+	}
+	test_assert_strcmp_idx(request->username, username, idx);
+	test_assert_strcmp_idx(request->mailbox, mailbox, idx);
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
 }
 
 static void test_indexer_queue(void)
@@ -20,25 +60,21 @@ static void test_indexer_queue(void)
 	test_begin("indexer queue");
 	queue = indexer_queue_init(indexer_queue_status_callback);
 
-	indexer_queue_append(queue, TRUE, "user2", "mailbox3", "session3", 50, NULL);
-	indexer_queue_append(queue, TRUE, "user1", "mailbox4", "session4", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user2", "mailbox2", "session2", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
-
-	request = indexer_queue_request_peek(queue);
-	test_assert_strcmp(request->username, "user1");
-	test_assert_strcmp(request->mailbox, "mailbox1");
-
-	indexer_queue_move_head_to_tail(queue);
+	indexer_queue_append(queue, NEW_MAIL, "user2", "mailbox3", "session3", 50, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user1", "mailbox4", "session4", 0, NULL);
+	indexer_queue_append(queue, INTERACTIVE, "user2", "mailbox2", "session2", 0, NULL);
+	indexer_queue_append(queue, INTERACTIVE, "user1", "mailbox1", "session1", 0, NULL);
 
+	/* interactive requests first, and the users in the order they were
+	   added to the priority */
 	struct {
 		const char *username;
 		const char *mailbox;
 	} expected[] = {
 		{ "user2", "mailbox2" },
+		{ "user1", "mailbox1" },
 		{ "user2", "mailbox3" },
 		{ "user1", "mailbox4" },
-		{ "user1", "mailbox1" },
 	};
 	for (unsigned int i = 0; i < N_ELEMENTS(expected); i++) {
 		request = indexer_queue_request_peek(queue);
@@ -62,8 +98,8 @@ static void test_indexer_queue_repeated_prepend(void)
 	test_begin("indexer queue");
 	queue = indexer_queue_init(indexer_queue_status_callback);
 
-	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, INTERACTIVE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, INTERACTIVE, "user1", "mailbox1", "session1", 0, NULL);
 
 	test_assert_cmp(indexer_queue_count(queue), ==, 1);
 
@@ -86,19 +122,19 @@ static void test_indexer_queue_reindex(void)
 	test_begin("indexer queue reindex");
 	queue = indexer_queue_init(indexer_queue_status_callback);
 
-	indexer_queue_append(queue, TRUE, "user1", "mailbox1", "session1", 0, NULL);
-	indexer_queue_append(queue, TRUE, "user1", "mailbox2", "session2", 0, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user1", "mailbox2", "session2", 0, NULL);
 
 	request = indexer_queue_request_peek(queue);
 	test_assert_strcmp(request->mailbox, "mailbox1");
 
 	/* start working on the request */
 	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request);
+	indexer_queue_request_work(queue, request);
 	test_assert(request->working);
 
 	/* prepend another request to the same mailbox */
-	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, INTERACTIVE, "user1", "mailbox1", "session1", 0, NULL);
 	test_assert(request->reindex_head);
 
 	/* finish the request, and it should now be at the head again */
@@ -109,9 +145,9 @@ static void test_indexer_queue_reindex(void)
 
 	/* start working on the request again */
 	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request);
+	indexer_queue_request_work(queue, request);
 	/* append another request to the same mailbox */
-	indexer_queue_append(queue, TRUE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user1", "mailbox1", "session1", 0, NULL);
 	test_assert(request->reindex_tail);
 
 	/* finish the request, and it should now be at the tail again */
@@ -141,10 +177,10 @@ static void test_indexer_queue_cancel(void)
 	test_begin("indexer queue cancel");
 	queue = indexer_queue_init(indexer_queue_status_callback);
 
-	indexer_queue_append(queue, TRUE, "user2", "mailbox3", "session3", 50, NULL);
-	indexer_queue_append(queue, TRUE, "user1", "mailbox4", "session4", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user2", "mailbox2", "session2", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user2", "mailbox3", "session3", 50, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user1", "mailbox4", "session4", 0, NULL);
+	indexer_queue_append(queue, INTERACTIVE, "user2", "mailbox2", "session2", 0, NULL);
+	indexer_queue_append(queue, INTERACTIVE, "user1", "mailbox1", "session1", 0, NULL);
 
 	/* try to cancel nonexistent user */
 	indexer_queue_cancel(queue, "user-none", "mailbox1");
@@ -153,30 +189,29 @@ static void test_indexer_queue_cancel(void)
 
 	test_assert(indexer_queue_count(queue) == 4);
 	request = indexer_queue_request_peek(queue);
-	test_assert_strcmp(request->mailbox, "mailbox1");
+	test_assert_strcmp(request->mailbox, "mailbox2");
 
 	/* cancel user1's all requests */
 	indexer_queue_cancel(queue, "user1", NULL);
+	test_assert(indexer_queue_count(queue) == 2);
 	request = indexer_queue_request_peek(queue);
 	test_assert_strcmp(request->mailbox, "mailbox2");
-	test_assert_strcmp(request->next->mailbox, "mailbox3");
-	test_assert(request->next->next == NULL);
 
 	/* cancel user2's requests one by one */
 	indexer_queue_cancel(queue, "user2", "mailbox2");
+	test_assert(indexer_queue_count(queue) == 1);
 	request = indexer_queue_request_peek(queue);
 	test_assert_strcmp(request->mailbox, "mailbox3");
-	test_assert(request->next == NULL);
 
 	indexer_queue_cancel(queue, "user2", "mailbox3");
 	test_assert(indexer_queue_request_peek(queue) == NULL);
 
 	/* cancelling a working request should just drop the reindex-flag */
-	indexer_queue_append(queue, TRUE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user1", "mailbox1", "session1", 0, NULL);
 	request = indexer_queue_request_peek(queue);
 	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request);
-	indexer_queue_append(queue, TRUE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_request_work(queue, request);
+	indexer_queue_append(queue, NEW_MAIL, "user1", "mailbox1", "session1", 0, NULL);
 	test_assert(request->reindex_tail);
 	indexer_queue_cancel(queue, "user1", NULL);
 	test_assert(!request->reindex_tail);
@@ -184,9 +219,9 @@ static void test_indexer_queue_cancel(void)
 	test_assert(indexer_queue_request_peek(queue) == NULL);
 
 	/* test cancelling mailbox wildcards */
-	indexer_queue_append(queue, TRUE, "user1", "testbox1", "session1", 0, NULL);
-	indexer_queue_append(queue, TRUE, "user1", "testbox2", "session1", 0, NULL);
-	indexer_queue_append(queue, TRUE, "user1", "notbox", "session1", 0, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user1", "testbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user1", "testbox2", "session1", 0, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user1", "notbox", "session1", 0, NULL);
 	indexer_queue_cancel(queue, "user1", "testbox*");
 	request = indexer_queue_request_peek(queue);
 	test_assert_strcmp(request->mailbox, "notbox");
@@ -206,23 +241,23 @@ static void test_indexer_queue_iter(void)
 	test_begin("indexer queue iter");
 	queue = indexer_queue_init(indexer_queue_status_callback);
 
-	indexer_queue_append(queue, TRUE, "user2", "mailbox3", "session3", 50, NULL);
-	indexer_queue_append(queue, TRUE, "user1", "mailbox4", "session4", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user2", "mailbox2", "session2", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user2", "mailbox3", "session3", 50, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user1", "mailbox4", "session4", 0, NULL);
+	indexer_queue_append(queue, INTERACTIVE, "user2", "mailbox2", "session2", 0, NULL);
+	indexer_queue_append(queue, INTERACTIVE, "user1", "mailbox1", "session1", 0, NULL);
 
 	/* start working on the first two requests */
 	request1 = indexer_queue_request_peek(queue);
-	test_assert_strcmp(request1->username, "user1");
-	test_assert_strcmp(request1->mailbox, "mailbox1");
+	test_assert_strcmp(request1->username, "user2");
+	test_assert_strcmp(request1->mailbox, "mailbox2");
 	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request1);
+	indexer_queue_request_work(queue, request1);
 
 	request2 = indexer_queue_request_peek(queue);
-	test_assert_strcmp(request2->username, "user2");
-	test_assert_strcmp(request2->mailbox, "mailbox2");
+	test_assert_strcmp(request2->username, "user1");
+	test_assert_strcmp(request2->mailbox, "mailbox1");
 	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request2);
+	indexer_queue_request_work(queue, request2);
 
 	/* Iteration shows the requests being worked on first. Their order
 	   depends on hash table iteration, so any order is acceptable. */
@@ -232,9 +267,12 @@ static void test_indexer_queue_iter(void)
 	test_assert((iter_request1 == request1 && iter_request2 == request2) ||
 		    (iter_request1 == request2 && iter_request2 == request1));
 
-	request = indexer_queue_request_peek(queue);
-	test_assert(indexer_queue_iter_next(iter) == request);
-	test_assert(indexer_queue_iter_next(iter) == request->next);
+	/* both users are busy, so nothing can be started */
+	test_assert(indexer_queue_request_peek(queue) == NULL);
+	request = indexer_queue_iter_next(iter);
+	test_assert_strcmp(request->mailbox, "mailbox3");
+	request = indexer_queue_iter_next(iter);
+	test_assert_strcmp(request->mailbox, "mailbox4");
 	test_assert(indexer_queue_iter_next(iter) == NULL);
 	indexer_queue_iter_deinit(&iter);
 
@@ -258,6 +296,330 @@ static void test_indexer_queue_iter(void)
 	test_end();
 }
 
+static void test_indexer_queue_priority(void)
+{
+	struct indexer_queue *queue;
+
+	test_begin("indexer queue priority");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	indexer_queue_append(queue, BULK, "user1", "bulk", NULL, 0, NULL);
+	indexer_queue_append_optimize(queue, "user2", "optimize", NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user3", "new", NULL, 0, NULL);
+	indexer_queue_append(queue, INTERACTIVE, "user4", "search", NULL, 0, NULL);
+
+	test_queue_remove_expected(queue, "user4", "search", 0);
+	test_queue_remove_expected(queue, "user3", "new", 1);
+	test_queue_remove_expected(queue, "user1", "bulk", 2);
+	test_queue_remove_expected(queue, "user2", "optimize", 3);
+	test_assert(indexer_queue_is_empty(queue));
+
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_indexer_queue_coalesce(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request;
+	struct test_job jobs[4];
+
+	test_begin("indexer queue coalesce");
+	i_zero(&jobs);
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	indexer_queue_append(queue, BULK, "user1", "box1", NULL, 0, &jobs[0]);
+	request = indexer_queue_request_peek(queue);
+	indexer_queue_append(queue, NEW_MAIL, "user2", "box2", NULL, 0, NULL);
+
+	/* a higher priority request moves the existing request */
+	indexer_queue_append(queue, NEW_MAIL, "user1", "box1", NULL, 0, &jobs[1]);
+	test_assert(indexer_queue_count(queue) == 2);
+	test_assert(request->priority == NEW_MAIL);
+	test_assert_strcmp(indexer_queue_request_peek(queue)->username, "user2");
+
+	/* a lower priority request doesn't */
+	indexer_queue_append(queue, BULK, "user1", "box1", NULL, 0, &jobs[2]);
+	test_assert(indexer_queue_count(queue) == 2);
+	test_assert(request->priority == NEW_MAIL);
+
+	/* an interactive request goes before the others */
+	indexer_queue_append(queue, INTERACTIVE, "user1", "box1", NULL, 0, &jobs[3]);
+	test_assert(indexer_queue_count(queue) == 2);
+	test_assert(request->priority == INTERACTIVE);
+	test_assert(indexer_queue_request_peek(queue) == request);
+
+	/* all the coalesced requests are finished at once */
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_work(queue, request);
+	indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+	for (unsigned int i = 0; i < N_ELEMENTS(jobs); i++)
+		test_assert_idx(jobs[i].finish_count == 1, i);
+
+	test_queue_remove_expected(queue, "user2", "box2", 0);
+	test_assert(indexer_queue_is_empty(queue));
+
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_indexer_queue_fairness(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request, *request2;
+
+	test_begin("indexer queue fairness");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	/* users are served round-robin */
+	for (unsigned int i = 1; i <= 5; i++) {
+		indexer_queue_append(queue, NEW_MAIL, "user1",
+				     t_strdup_printf("box%u", i), NULL, 0, NULL);
+	}
+	indexer_queue_append(queue, NEW_MAIL, "user2", "box1", NULL, 0, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user3", "box1", NULL, 0, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user3", "box2", NULL, 0, NULL);
+
+	struct {
+		const char *username;
+		const char *mailbox;
+	} expected[] = {
+		{ "user1", "box1" },
+		{ "user2", "box1" },
+		{ "user3", "box1" },
+		{ "user1", "box2" },
+		{ "user3", "box2" },
+		{ "user1", "box3" },
+		{ "user1", "box4" },
+		{ "user1", "box5" },
+	};
+	for (unsigned int i = 0; i < N_ELEMENTS(expected); i++) {
+		test_queue_remove_expected(queue, expected[i].username,
+					   expected[i].mailbox, i);
+	}
+	test_assert(indexer_queue_is_empty(queue));
+
+	/* users who have a request being worked on are skipped */
+	indexer_queue_append(queue, NEW_MAIL, "user1", "box1", NULL, 0, NULL);
+	indexer_queue_append(queue, NEW_MAIL, "user1", "box2", NULL, 0, NULL);
+	indexer_queue_append(queue, BULK, "user2", "box1", NULL, 0, NULL);
+
+	request = indexer_queue_request_peek(queue);
+	test_assert_strcmp(request->mailbox, "box1");
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_work(queue, request);
+
+	request2 = indexer_queue_request_peek(queue);
+	test_assert_strcmp(request2->username, "user2");
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_work(queue, request2);
+	test_assert(indexer_queue_request_peek(queue) == NULL);
+	test_assert(!indexer_queue_is_empty(queue));
+
+	indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+	test_queue_remove_expected(queue, "user1", "box2", 0);
+	indexer_queue_request_finish(queue, &request2, INDEXER_STATE_COMPLETED);
+	test_assert(indexer_queue_is_empty(queue));
+
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_indexer_queue_aging(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request;
+
+	test_begin("indexer queue aging");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+	ioloop_time = 1000;
+
+	indexer_queue_append(queue, BULK, "user1", "bulk", NULL, 0, NULL);
+	request = indexer_queue_request_peek(queue);
+	indexer_queue_append(queue, INTERACTIVE, "user2", "search", NULL, 0, NULL);
+
+	indexer_queue_append(queue, NEW_MAIL, "user3", "new", NULL, 0, NULL);
+
+	ioloop_time += INDEXER_QUEUE_AGING_SECS - 1;
+	test_assert_strcmp(indexer_queue_request_peek(queue)->mailbox, "search");
+	test_assert(request->priority == BULK);
+
+	ioloop_time += 1;
+	test_assert_strcmp(indexer_queue_request_peek(queue)->mailbox, "search");
+	test_assert(request->priority == NEW_MAIL);
+
+	/* requests aren't moved to the interactive priority */
+	ioloop_time += INDEXER_QUEUE_AGING_SECS;
+	test_assert_strcmp(indexer_queue_request_peek(queue)->mailbox, "search");
+	test_assert(request->priority == NEW_MAIL);
+
+	/* the aged request is now handled with the new mails */
+	test_queue_remove_expected(queue, "user2", "search", 0);
+	test_queue_remove_expected(queue, "user3", "new", 1);
+	test_queue_remove_expected(queue, "user1", "bulk", 2);
+	test_assert(indexer_queue_is_empty(queue));
+
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+#define TEST_SIM_WORKERS 4
+#define TEST_SIM_ARRIVAL_SECS 3600
+#define TEST_SIM_USERS 200
+#define TEST_SIM_BULK_USERS 100
+#define TEST_SIM_BULK_MAILBOXES 10
+#define TEST_SIM_BULK_USER_MAILBOXES 300
+#define TEST_SIM_BULK_SECS 5
+#define TEST_SIM_OTHER_SECS 2
+
+struct test_sim_worker {
+	struct indexer_request *request;
+	time_t end_time;
+};
+
+static unsigned int test_sim_rand_state;
+
+static unsigned int test_sim_rand(unsigned int limit)
+{
+	/* deterministic, so the results are comparable between runs */
+	test_sim_rand_state = test_sim_rand_state * 1103515245 + 12345;
+	return (test_sim_rand_state >> 16) % limit;
+}
+
+static void
+test_sim_append(struct indexer_queue *queue, ARRAY_TYPE(test_job) *jobs,
+		enum indexer_request_priority priority, bool backlog,
+		const char *username, const char *mailbox)
+{
+	struct test_job *job = i_new(struct test_job, 1);
+
+	job->priority = priority;
+	job->backlog = backlog;
+	job->queued_time = ioloop_time;
+	array_push_back(jobs, &job);
+	indexer_queue_append(queue, priority, username, mailbox,
+			     NULL, 0, job);
+}
+
+static int test_time_cmp(const time_t *t1, const time_t *t2)
+{
+	return *t1 < *t2 ? -1 : (*t1 > *t2 ? 1 : 0);
+}
+
+static void
+test_sim_report(ARRAY_TYPE(test_job) *jobs,
+		enum indexer_request_priority priority, bool backlog,
+		const char *name, time_t max_p99)
+{
+	ARRAY(time_t) latencies;
+	struct test_job *job;
+
+	t_array_init(&latencies, array_count(jobs));
+	array_foreach_elem(jobs, job) {
+		if (job->priority != priority || job->backlog != backlog)
+			continue;
+		test_assert(job->finish_count == 1);
+		time_t latency = job->finished_time - job->queued_time;
+		array_push_back(&latencies, &latency);
+	}
+	array_sort(&latencies, test_time_cmp);
+
+	unsigned int count = array_count(&latencies);
+	i_assert(count > 0);
+	time_t p50 = array_idx_elem(&latencies, count * 50 / 100);
+	time_t p95 = array_idx_elem(&latencies, count * 95 / 100);
+	time_t p99 = array_idx_elem(&latencies, count * 99 / 100);
+	time_t max = array_idx_elem(&latencies, count - 1);
+	test_out(t_strdup_printf("%s: %u requests, latency secs "
+				 "p50=%ld p95=%ld p99=%ld max=%ld",
+				 name, count, (long)p50, (long)p95,
+				 (long)p99, (long)max), p99 <= max_p99);
+}
+
+static void test_indexer_queue_mixed_workload(void)
+{
+	struct indexer_queue *queue;
+	struct test_sim_worker workers[TEST_SIM_WORKERS];
+	ARRAY_TYPE(test_job) jobs;
+	struct test_job *job;
+	unsigned int i, j;
+
+	test_begin("indexer queue mixed workload");
+	i_zero(&workers);
+	i_array_init(&jobs, 1024);
+	test_sim_rand_state = 1;
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	/* A bulk rescan of all users, and a single user with a huge backlog
+	   are queued first. New mails and searches arrive while they're
+	   being processed. */
+	ioloop_time = 0;
+	for (i = 0; i < TEST_SIM_BULK_USERS; i++) T_BEGIN {
+		for (j = 0; j < TEST_SIM_BULK_MAILBOXES; j++) {
+			test_sim_append(queue, &jobs, BULK, FALSE,
+					t_strdup_printf("user%u", i),
+					t_strdup_printf("Archive/%u", j));
+		}
+	} T_END;
+	for (j = 0; j < TEST_SIM_BULK_USER_MAILBOXES; j++) T_BEGIN {
+		test_sim_append(queue, &jobs, NEW_MAIL, TRUE, "biguser",
+				t_strdup_printf("box%u", j));
+	} T_END;
+
+	bool busy = TRUE;
+	for (; busy || ioloop_time < TEST_SIM_ARRIVAL_SECS; ioloop_time++) T_BEGIN {
+		busy = FALSE;
+		for (i = 0; i < N_ELEMENTS(workers); i++) {
+			if (workers[i].request != NULL &&
+			    workers[i].end_time <= ioloop_time) {
+				indexer_queue_request_finish(queue,
+					&workers[i].request,
+					INDEXER_STATE_COMPLETED);
+			}
+		}
+		if (ioloop_time < TEST_SIM_ARRIVAL_SECS) {
+			if (ioloop_time % 10 == 0) {
+				test_sim_append(queue, &jobs, NEW_MAIL, FALSE,
+					t_strdup_printf("user%u", test_sim_rand(TEST_SIM_USERS)),
+					t_strdup_printf("box%u", test_sim_rand(5)));
+			}
+			if (ioloop_time % 15 == 0) {
+				test_sim_append(queue, &jobs, INTERACTIVE, FALSE,
+					t_strdup_printf("user%u", test_sim_rand(TEST_SIM_USERS)),
+					"INBOX");
+			}
+		}
+		for (i = 0; i < N_ELEMENTS(workers); i++) {
+			struct indexer_request *request;
+
+			if (workers[i].request == NULL &&
+			    (request = indexer_queue_request_peek(queue)) != NULL) {
+				indexer_queue_request_remove(queue);
+				indexer_queue_request_work(queue, request);
+				workers[i].request = request;
+				workers[i].end_time = ioloop_time +
+					(str_begins_with(request->mailbox, "Archive/") ?
+					 TEST_SIM_BULK_SECS : TEST_SIM_OTHER_SECS);
+			}
+			if (workers[i].request != NULL)
+				busy = TRUE;
+		}
+	} T_END;
+	test_assert(indexer_queue_is_empty(queue));
+	test_assert(indexer_queue_count(queue) == 0);
+
+	test_sim_report(&jobs, INTERACTIVE, FALSE, "interactive", 15);
+	test_sim_report(&jobs, NEW_MAIL, FALSE, "new mail", 60);
+	test_sim_report(&jobs, NEW_MAIL, TRUE, "backlog", 2*3600);
+	test_sim_report(&jobs, BULK, FALSE, "bulk", 2*3600);
+
+	array_foreach_elem(&jobs, job)
+		i_free(job);
+	array_free(&jobs);
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -266,6 +628,11 @@ int main(void)
 		test_indexer_queue_reindex,
 		test_indexer_queue_cancel,
 		test_indexer_queue_iter,
+		test_indexer_queue_priority,
+		test_indexer_queue_coalesce,
+		test_indexer_queue_fairness,
+		test_indexer_queue_aging,
+		test_indexer_queue_mixed_workload,
 		NULL
 	};
 	return test_run(test_functions);
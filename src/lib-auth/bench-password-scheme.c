@@ -0,0 +1,96 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "password-scheme.h"
+
+#include <stdio.h>
+
+/**
+ * Measures how many password verifications (i.e. logins) per second a
+ * single process can do with each password scheme. This shows how much the
+ * expensive schemes can block an auth process, and can be used to decide
+ * which schemes should be listed in auth_password_verify_worker_schemes.
+ */
+
+#define BENCH_PASSWORD "bench-password"
+#define BENCH_MIN_MSECS 1000
+
+static const char *const default_schemes[] = {
+	"PLAIN",
+	"SSHA512",
+	"PBKDF2",
+	"SHA512-CRYPT",
+	"BLF-CRYPT",
+	"ARGON2I",
+	"ARGON2ID",
+	NULL
+};
+
+static void bench_password_scheme(const char *scheme, unsigned int rounds)
+{
+	struct password_generate_params params = {
+		.user = "benchuser",
+		.rounds = rounds,
+	};
+	const unsigned char *raw_password;
+	const char *crypted, *error;
+	size_t size;
+	unsigned int count = 0;
+	uint64_t ts_0, ts_1;
+
+	if (!password_generate_encoded(BENCH_PASSWORD, &params, scheme,
+				       &crypted)) {
+		printf("%-16s not supported\n", scheme);
+		return;
+	}
+	if (password_decode(crypted, scheme, &raw_password, &size, &error) <= 0)
+		i_fatal("password_decode(%s) failed: %s", scheme, error);
+
+	ts_0 = ts_1 = i_nanoseconds();
+	while (ts_1 - ts_0 < BENCH_MIN_MSECS * 1000000ULL) {
+		if (password_verify(BENCH_PASSWORD, &params, scheme,
+				    raw_password, size, &error) != 1)
+			i_fatal("password_verify(%s) failed", scheme);
+		count++;
+		ts_1 = i_nanoseconds();
+	}
+
+	printf("%-16s %10.1lf logins/s %10.3lf ms/login\n", scheme,
+	       (double)count * 1000000000.0 / (double)(ts_1 - ts_0),
+	       (double)(ts_1 - ts_0) / 1000000.0 / (double)count);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-r <rounds>] [<scheme> ...]\n", prog);
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	const char *const *schemes = default_schemes;
+	unsigned int rounds = 0;
+	int i = 1;
+
+	lib_init();
+	password_schemes_register_all();
+	password_schemes_allow_weak(TRUE);
+
+	if (argc >= 2 && strcmp(argv[1], "-r") == 0) {
+		if (argc < 3 || str_to_uint(argv[2], &rounds) < 0)
+			print_usage(argv[0]);
+		i = 3;
+	}
+	if (i < argc)
+		schemes = argv + i;
+
+	for (; *schemes != NULL; schemes++) T_BEGIN {
+		bench_password_scheme(*schemes, rounds);
+	} T_END;
+
+	password_schemes_deinit();
+	lib_deinit();
+	return 0;
+}
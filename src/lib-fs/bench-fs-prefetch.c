@@ -0,0 +1,158 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "istream.h"
+#include "str.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "settings.h"
+#include "fs-test.h"
+
+#include <stdio.h>
+
+/**
+ * Reads a number of files from the test fs backend configured to simulate
+ * a slow (e.g. object storage) backend, where opening each file has a fixed
+ * latency unless the file was prefetched earlier. The files are read once
+ * without prefetching and then with different sizes of prefetch windows,
+ * limited by the number of files and by the number of bytes being
+ * prefetched ahead. It measures the wall clock time spent.
+ */
+
+struct bench_window {
+	unsigned int count;
+	uoff_t max_size;
+};
+
+static const struct fs_parameters fs_params;
+static const char *const set_test[] = {
+	"fs", "test",
+	"fs/test/fs_driver", "test",
+	NULL
+};
+
+static const struct bench_window windows[] = {
+	{ 0, 0 },
+	{ 1, 0 },
+	{ 4, 0 },
+	{ 16, 0 },
+	{ 64, 0 },
+	{ 64, 1024*1024 },
+};
+
+static void
+bench_fs_prefetch(struct fs *fs, const struct bench_window *window,
+		  size_t file_size, unsigned int file_count)
+{
+	ARRAY(struct fs_file *) files;
+	struct fs_file *file;
+	struct test_fs_file *test_file;
+	struct istream *input;
+	const unsigned char *data;
+	unsigned int i, next_prefetch = 0;
+	uoff_t read_bytes = 0;
+	uint64_t ts_0, ts_1;
+	size_t size;
+
+	i_array_init(&files, file_count);
+	for (i = 0; i < file_count; i++) {
+		file = fs_file_init(fs, t_strdup_printf("mail-%u", i),
+				    FS_OPEN_MODE_READONLY);
+		test_file = test_fs_file_get(fs, fs_file_path(file));
+		buffer_append_zero(test_file->contents, file_size);
+		array_push_back(&files, &file);
+	}
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < file_count; i++) {
+		/* keep up to window->count files being prefetched ahead of
+		   the one that is being read */
+		if (next_prefetch <= i)
+			next_prefetch = i + 1;
+		while (next_prefetch < file_count &&
+		       next_prefetch <= i + window->count &&
+		       (window->max_size == 0 ||
+			(uoff_t)(next_prefetch - i - 1) * file_size <
+			window->max_size)) {
+			file = array_idx_elem(&files, next_prefetch);
+			(void)fs_prefetch(file, file_size);
+			next_prefetch++;
+		}
+
+		file = array_idx_elem(&files, i);
+		input = fs_read_stream(file, IO_BLOCK_SIZE);
+		while (i_stream_read_more(input, &data, &size) > 0) {
+			read_bytes += size;
+			i_stream_skip(input, size);
+		}
+		if (input->stream_errno != 0)
+			i_fatal("read(%s) failed: %s", i_stream_get_name(input),
+				i_stream_get_error(input));
+		i_stream_unref(&input);
+	}
+	ts_1 = i_nanoseconds();
+
+	array_foreach_elem(&files, file)
+		fs_file_deinit(&file);
+	array_free(&files);
+
+	if (read_bytes != (uoff_t)file_size * file_count)
+		i_fatal("Read only %"PRIuUOFF_T" bytes", read_bytes);
+
+	if (window->count == 0)
+		printf("No prefetching\n");
+	else if (window->max_size == 0)
+		printf("Prefetch window: %u files\n", window->count);
+	else {
+		printf("Prefetch window: %u files, %"PRIuUOFF_T" bytes\n",
+		       window->count, window->max_size);
+	}
+	printf("\tTime: %0.03lf s (%0.02lf ms/file)\n\n",
+	       (double)(ts_1 - ts_0) / 1000000000.0,
+	       (double)(ts_1 - ts_0) / 1000000.0 / (double)file_count);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<file_size> [<count> [<latency_msecs>]]]\n",
+		prog);
+	fprintf(stderr, "Runs with 200 64k files and 5ms latency "
+		"if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct settings_simple set;
+	struct fs *fs;
+	const char *error;
+	unsigned long file_size = 65536UL;
+	unsigned int file_count = 200, latency_msecs = 5;
+
+	lib_init();
+
+	if (argc >= 2 && str_to_ulong(argv[1], &file_size) < 0)
+		print_usage(argv[0]);
+	if (argc >= 3 && str_to_uint(argv[2], &file_count) < 0)
+		print_usage(argv[0]);
+	if (argc >= 4 && str_to_uint(argv[3], &latency_msecs) < 0)
+		print_usage(argv[0]);
+	if (argc > 4)
+		print_usage(argv[0]);
+
+	settings_simple_init(&set, set_test);
+	if (fs_init_auto(set.event, &fs_params, &fs, &error) <= 0)
+		i_fatal("fs_init() failed: %s", error);
+	test_fs_get(fs)->read_latency_usecs = latency_msecs * 1000;
+
+	printf("Input data is %u files of %lu bytes, %u ms latency\n\n",
+	       file_count, file_size, latency_msecs);
+	for (unsigned int i = 0; i < N_ELEMENTS(windows); i++) T_BEGIN {
+		bench_fs_prefetch(fs, &windows[i], file_size, file_count);
+	} T_END;
+
+	fs_deinit(&fs);
+	settings_simple_deinit(&set);
+	lib_deinit();
+}
@@ -3,6 +3,8 @@
 #include "lib.h"
 #include "istream.h"
 #include "ostream.h"
+#include "sleep.h"
+#include "time-util.h"
 #include "test-common.h"
 #include "fs-test.h"
 
@@ -134,13 +136,34 @@ fs_test_get_metadata(struct fs_file *_file,
 	return 0;
 }
 
-static bool fs_test_prefetch(struct fs_file *_file ATTR_UNUSED,
+static bool fs_test_prefetch(struct fs_file *_file,
 			     uoff_t length ATTR_UNUSED)
 {
+	struct test_fs *fs = test_fs_get(_file->fs);
 	struct test_fs_file *file = (struct test_fs_file *)_file;
 
-	file->prefetched = TRUE;
-	return TRUE;
+	if (!file->prefetched) {
+		file->prefetched = TRUE;
+		i_gettimeofday(&file->prefetch_timeval);
+	}
+	return fs->read_latency_usecs == 0;
+}
+
+static void fs_test_read_wait_latency(struct test_fs_file *file)
+{
+	struct test_fs *fs = test_fs_get(file->file.fs);
+	struct timeval now;
+	long long elapsed_usecs = 0;
+
+	if (fs->read_latency_usecs == 0)
+		return;
+	if (file->prefetched) {
+		i_gettimeofday(&now);
+		elapsed_usecs = timeval_diff_usecs(&now,
+						   &file->prefetch_timeval);
+	}
+	if (elapsed_usecs < fs->read_latency_usecs)
+		i_sleep_usecs(fs->read_latency_usecs - elapsed_usecs);
 }
 
 static void fs_test_stream_destroyed(struct test_fs_file *file)
@@ -161,6 +184,7 @@ fs_test_read_stream(struct fs_file *_file, size_t max_buffer_size ATTR_UNUSED)
 		return i_stream_create_error(ENOENT);
 	if (file->io_failure)
 		return i_stream_create_error(EIO);
+	fs_test_read_wait_latency(file);
 	input = test_istream_create_data(file->contents->data,
 					 file->contents->used);
 	i_stream_add_destroy_callback(input, fs_test_stream_destroyed, file);
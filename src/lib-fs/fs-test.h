@@ -7,6 +7,10 @@ struct test_fs {
 	struct fs fs;
 	enum fs_properties properties;
 	ARRAY_TYPE(const_string) iter_files;
+	/* Simulate a slow backend: opening a file for reading takes this
+	   long, unless fs_prefetch() was called for it earlier. The
+	   prefetching is assumed to be progressing in the background. */
+	unsigned int read_latency_usecs;
 };
 
 struct test_fs_file {
@@ -19,6 +23,7 @@ struct test_fs_file {
 	buffer_t *contents;
 	struct istream *input;
 	struct test_fs_file *copy_src;
+	struct timeval prefetch_timeval;
 
 	bool prefetched;
 	bool locked;
@@ -0,0 +1,273 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "lib-event-private.h"
+#include "ioloop.h"
+#include "net.h"
+#include "sleep.h"
+#include "sort.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "http-client.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+/**
+ * Simulates an fs driver or Solr/Tika caller sending bursts of small
+ * requests. test-http-server is used as the local peer. It's started from
+ * the same directory as this benchmark unless the port of an already
+ * running one is given. Each burst submits a number of GET requests at once
+ * and waits for all the responses. The bursts are further apart than
+ * http_client_max_idle_time, so connections created on demand are closed
+ * between them. This is run with connections created on demand, with a warm
+ * pool (http_client_min_idle_connections) and with a warm pool and
+ * pipelining. It measures the time each burst takes and uses the
+ * http_client_pool_finished event to count the connections created.
+ */
+
+#define BENCH_MAX_PARALLEL_CONNECTIONS 4
+#define BENCH_MAX_IDLE_TIME_MSECS 50
+#define BENCH_BURST_INTERVAL_MSECS 100
+
+struct bench_scenario {
+	const char *name;
+	unsigned int min_idle_connections;
+	unsigned int read_request_max_pipelined;
+};
+
+static const struct bench_scenario bench_scenarios[] = {
+	{ "Connections created on demand", 0, 0 },
+	{ "Warm pool (min_idle_connections=4)",
+	  BENCH_MAX_PARALLEL_CONNECTIONS, 0 },
+	{ "Warm pool, pipelining (read_request_max_pipelined=4)",
+	  BENCH_MAX_PARALLEL_CONNECTIONS, 4 },
+};
+
+struct bench_context {
+	struct ip_addr ip;
+	in_port_t port;
+	unsigned int pending;
+	uint64_t *burst_usecs;
+
+	intmax_t connections_created;
+	intmax_t requests_pipelined;
+};
+
+static struct bench_context *bench_ctx;
+
+static bool
+bench_event_callback(struct event *event, enum event_callback_type type,
+		     struct failure_context *ctx,
+		     const char *fmt ATTR_UNUSED, va_list args ATTR_UNUSED)
+{
+	const struct event_field *field;
+	const char *name;
+
+	if (type != EVENT_CALLBACK_TYPE_SEND)
+		return TRUE;
+
+	name = event->sending_name;
+	if (name != NULL && strcmp(name, "http_client_pool_finished") == 0) {
+		field = event_find_field_nonrecursive(event,
+						      "connections_created");
+		if (field != NULL)
+			bench_ctx->connections_created += field->value.intmax;
+		field = event_find_field_nonrecursive(event,
+						      "requests_pipelined");
+		if (field != NULL)
+			bench_ctx->requests_pipelined += field->value.intmax;
+	}
+	/* don't log the debug messages */
+	return ctx->type != LOG_TYPE_DEBUG;
+}
+
+static void
+bench_response(const struct http_response *resp,
+	       struct bench_context *ctx)
+{
+	if (resp->status != 200)
+		i_fatal("Request failed: %u %s", resp->status, resp->reason);
+	if (--ctx->pending == 0)
+		io_loop_stop(current_ioloop);
+}
+
+static void
+bench_burst(struct http_client *client, struct bench_context *ctx,
+	    unsigned int count)
+{
+	struct http_client_request *req;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		req = http_client_request(client, "GET", net_ip2addr(&ctx->ip),
+			t_strdup_printf("/bench-%u.txt", i),
+			bench_response, ctx);
+		http_client_request_set_port(req, ctx->port);
+		http_client_request_submit(req);
+	}
+	ctx->pending = count;
+	io_loop_run(current_ioloop);
+}
+
+static void bench_idle_timeout(void *context ATTR_UNUSED)
+{
+	io_loop_stop(current_ioloop);
+}
+
+static int bench_cmp_uint64(const uint64_t *a, const uint64_t *b)
+{
+	return *a < *b ? -1 : (*a > *b ? 1 : 0);
+}
+
+static void
+bench_http_client(const struct bench_scenario *scenario,
+		  struct bench_context *ctx, struct event *event,
+		  unsigned int bursts, unsigned int burst_size)
+{
+	struct http_client_settings set;
+	struct http_client *client;
+	struct timeout *to;
+	uint64_t ts, total = 0;
+	unsigned int i;
+
+	http_client_settings_init(null_pool, &set);
+	set.max_idle_time_msecs = BENCH_MAX_IDLE_TIME_MSECS;
+	set.max_parallel_connections = BENCH_MAX_PARALLEL_CONNECTIONS;
+	set.max_pipelined_requests = 1;
+	set.min_idle_connections = scenario->min_idle_connections;
+	set.read_request_max_pipelined = scenario->read_request_max_pipelined;
+	set.request_max_attempts = 1;
+
+	ctx->connections_created = 0;
+	ctx->requests_pipelined = 0;
+
+	/* private context, so that no connections are shared between the
+	   scenarios */
+	client = http_client_init_private(&set, event);
+	for (i = 0; i < bursts; i++) {
+		ts = i_nanoseconds();
+		bench_burst(client, ctx, burst_size);
+		ctx->burst_usecs[i] = (i_nanoseconds() - ts) / 1000;
+		total += ctx->burst_usecs[i];
+
+		to = timeout_add_short(BENCH_BURST_INTERVAL_MSECS,
+				       bench_idle_timeout, NULL);
+		io_loop_run(current_ioloop);
+		timeout_remove(&to);
+	}
+	http_client_deinit(&client);
+
+	i_qsort(ctx->burst_usecs, bursts, sizeof(ctx->burst_usecs[0]),
+		bench_cmp_uint64);
+	printf("%s\n", scenario->name);
+	printf("\tBurst time: avg %"PRIu64" us, p50 %"PRIu64" us, "
+	       "p99 %"PRIu64" us\n", total / bursts,
+	       ctx->burst_usecs[bursts / 2],
+	       ctx->burst_usecs[bursts * 99 / 100]);
+	printf("\tConnections created: %jd, requests pipelined: %jd\n\n",
+	       ctx->connections_created, ctx->requests_pipelined);
+}
+
+static pid_t bench_server_start(const char *prog, in_port_t *port_r)
+{
+	const char *server_path, *p;
+	struct ip_addr ip;
+	in_port_t port = 0;
+	pid_t pid;
+	int fd, i;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	/* find a free port */
+	if ((fd = net_listen(&ip, &port, 1)) < 0)
+		i_fatal("listen() failed: %m");
+	i_close_fd(&fd);
+
+	p = strrchr(prog, '/');
+	server_path = p == NULL ? "./test-http-server" :
+		t_strdup_printf("%s/test-http-server", t_strdup_until(prog, p));
+
+	if ((pid = fork()) < 0)
+		i_fatal("fork() failed: %m");
+	if (pid == 0) {
+		execl(server_path, server_path, dec2str(port), "127.0.0.1",
+		      NULL);
+		i_fatal("execl(%s) failed: %m", server_path);
+	}
+
+	/* wait until the server is listening */
+	for (i = 0; i < 100; i++) {
+		if ((fd = net_connect_ip_blocking(&ip, port, NULL)) >= 0) {
+			i_close_fd(&fd);
+			*port_r = port;
+			return pid;
+		}
+		i_sleep_msecs(20);
+	}
+	i_fatal("%s didn't start listening on port %u", server_path, port);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<bursts> [<requests/burst> "
+		"[<test-http-server port>]]]\n", prog);
+	fprintf(stderr, "Runs 100 bursts of 16 requests if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct bench_context ctx;
+	struct ioloop *ioloop;
+	struct event *event;
+	unsigned int i, bursts = 100, burst_size = 16;
+	pid_t server_pid = -1;
+
+	lib_init();
+
+	i_zero(&ctx);
+	if (argc >= 2 && (str_to_uint(argv[1], &bursts) < 0 || bursts == 0))
+		print_usage(argv[0]);
+	if (argc >= 3 && (str_to_uint(argv[2], &burst_size) < 0 ||
+			  burst_size == 0))
+		print_usage(argv[0]);
+	if (argc >= 4 && net_str2port(argv[3], &ctx.port) < 0)
+		print_usage(argv[0]);
+	if (argc > 4)
+		print_usage(argv[0]);
+
+	if (net_addr2ip("127.0.0.1", &ctx.ip) < 0)
+		i_unreached();
+	if (ctx.port == 0)
+		server_pid = bench_server_start(argv[0], &ctx.port);
+	ctx.burst_usecs = i_new(uint64_t, bursts);
+	bench_ctx = &ctx;
+
+	ioloop = io_loop_create();
+	event = event_create(NULL);
+	/* the pool statistics are sent as a debug event */
+	event_set_forced_debug(event, TRUE);
+	event_register_callback(bench_event_callback);
+
+	printf("%u bursts of %u requests, max %u connections, "
+	       "%u ms between bursts\n\n", bursts, burst_size,
+	       BENCH_MAX_PARALLEL_CONNECTIONS, BENCH_BURST_INTERVAL_MSECS);
+	for (i = 0; i < N_ELEMENTS(bench_scenarios); i++) T_BEGIN {
+		bench_http_client(&bench_scenarios[i], &ctx, event,
+				  bursts, burst_size);
+	} T_END;
+
+	event_unregister_callback(bench_event_callback);
+	event_unref(&event);
+	io_loop_destroy(&ioloop);
+	i_free(ctx.burst_usecs);
+
+	if (server_pid != -1) {
+		(void)kill(server_pid, SIGINT);
+		(void)waitpid(server_pid, NULL, 0);
+	}
+	lib_deinit();
+}
@@ -0,0 +1,1908 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "strnum.h"
+#include "byteorder.h"
+#include "ioloop.h"
+#include "istream-private.h"
+#include "istream-timeout.h"
+#include "ostream.h"
+#include "time-util.h"
+#include "file-lock.h"
+#include "http-date.h"
+#include "http-auth.h"
+#include "http-request.h"
+#include "http2-frame.h"
+#include "http2-hpack.h"
+
+#include "http-client-private.h"
+
+/* Receive windows advertised to the server. The stream window limits how much
+   of a response payload is buffered before the application reads it. */
+#define HTTP2_CLIENT_STREAM_WINDOW_SIZE (256*1024)
+#define HTTP2_CLIENT_CONNECTION_WINDOW_SIZE (1024*1024)
+/* Stop generating DATA frames while this much output is buffered */
+#define HTTP2_CLIENT_MAX_OUTPUT_BUFFER_SIZE (IO_BLOCK_SIZE*4)
+
+struct http2_payload_istream;
+
+struct http_client_http2_stream {
+	pool_t pool;
+	struct http_client_http2 *h2;
+	uint32_t id;
+
+	/* The request is in the connection's request_wait_list until the
+	   response is received. After that the stream keeps the connection's
+	   reference to the request while the response payload is read. */
+	struct http_client_request *req;
+
+	int64_t send_window;
+	int64_t recv_window;
+	/* Received bytes consumed by the application, which are not yet
+	   credited back to the server with WINDOW_UPDATE */
+	size_t recv_consumed;
+
+	struct http2_payload_istream *payload;
+	struct istream *payload_wrapper;
+	struct io *io_payload_input;
+
+	bool end_stream_sent:1;
+	bool end_stream_received:1;
+	bool response_received:1;
+	bool reset:1;
+	bool in_callback:1;
+};
+
+struct http_client_http2 {
+	struct http_client_connection *conn;
+
+	struct http2_hpack_encoder *encoder;
+	struct http2_hpack_decoder *decoder;
+
+	ARRAY(struct http_client_http2_stream *) streams;
+	uint32_t next_stream_id;
+
+	/* Server's settings */
+	uint32_t max_concurrent_streams;
+	uint32_t initial_window_size;
+	uint32_t max_frame_size;
+	size_t max_header_list_size;
+
+	int64_t send_window;
+	int64_t recv_window;
+	size_t recv_unacked;
+
+	/* Header block being received in HEADERS and CONTINUATION frames */
+	buffer_t *header_block;
+	uint32_t header_block_stream_id;
+	bool header_block_end_stream;
+
+	struct timeout *to_finished;
+
+	bool settings_received:1;
+	bool goaway_received:1;
+	bool streams_finished:1;
+};
+
+struct http2_payload_istream {
+	struct istream_private istream;
+	struct http_client_http2_stream *stream;
+	buffer_t *buf;
+	bool eof;
+};
+
+static void http2_send_payloads(struct http_client_http2 *h2);
+
+/*
+ * Response payload stream
+ */
+
+static void http2_stream_consumed(struct http_client_http2_stream *stream,
+				  size_t size);
+
+static void http2_payload_istream_destroy(struct iostream_private *stream)
+{
+	struct http2_payload_istream *pstream =
+		container_of(stream, struct http2_payload_istream,
+			     istream.iostream);
+
+	if (pstream->stream != NULL)
+		pstream->stream->payload = NULL;
+	buffer_free(&pstream->buf);
+}
+
+static ssize_t http2_payload_istream_read(struct istream_private *stream)
+{
+	struct http2_payload_istream *pstream =
+		container_of(stream, struct http2_payload_istream, istream);
+	size_t size;
+
+	if (stream->skip > 0) {
+		buffer_delete(pstream->buf, 0, stream->skip);
+		stream->pos -= stream->skip;
+		if (pstream->stream != NULL)
+			http2_stream_consumed(pstream->stream, stream->skip);
+		stream->skip = 0;
+	}
+	stream->buffer = pstream->buf->data;
+	if (pstream->buf->used > stream->pos) {
+		size = pstream->buf->used - stream->pos;
+		stream->pos = pstream->buf->used;
+		return size;
+	}
+	if (stream->istream.stream_errno != 0)
+		return -1;
+	if (pstream->eof) {
+		stream->istream.eof = TRUE;
+		return -1;
+	}
+	return 0;
+}
+
+static struct http2_payload_istream *
+http2_payload_istream_create(struct http_client_http2_stream *stream)
+{
+	struct http2_payload_istream *pstream;
+
+	pstream = i_new(struct http2_payload_istream, 1);
+	pstream->stream = stream;
+	pstream->buf = buffer_create_dynamic(default_pool, 1024);
+
+	pstream->istream.iostream.destroy = http2_payload_istream_destroy;
+	pstream->istream.read = http2_payload_istream_read;
+	(void)i_stream_create(&pstream->istream, NULL, -1, 0);
+	i_stream_set_name(&pstream->istream.istream,
+			  t_strdup_printf("(HTTP/2 stream %u)", stream->id));
+	return pstream;
+}
+
+static void
+http2_payload_istream_append(struct http2_payload_istream *pstream,
+			     const unsigned char *data, size_t size)
+{
+	buffer_append(pstream->buf, data, size);
+	/* The buffer may have been reallocated */
+	pstream->istream.buffer = pstream->buf->data;
+	i_stream_set_input_pending(&pstream->istream.istream, TRUE);
+}
+
+static void
+http2_payload_istream_set_eof(struct http2_payload_istream *pstream)
+{
+	pstream->eof = TRUE;
+	i_stream_set_input_pending(&pstream->istream.istream, TRUE);
+}
+
+static void
+http2_payload_istream_set_error(struct http2_payload_istream *pstream,
+				int stream_errno, const char *error)
+{
+	struct istream *input = &pstream->istream.istream;
+
+	input->stream_errno = stream_errno;
+	io_stream_set_error(&pstream->istream.iostream, "%s", error);
+	i_stream_set_input_pending(input, TRUE);
+}
+
+/*
+ * Frames
+ */
+
+static void http2_send(struct http_client_http2 *h2, const buffer_t *buf)
+{
+	o_stream_nsend(h2->conn->conn.output, buf->data, buf->used);
+}
+
+static void
+http2_send_frame(struct http_client_http2 *h2, enum http2_frame_type type,
+		 uint8_t flags, uint32_t stream_id,
+		 const void *payload, size_t size)
+{
+	buffer_t *buf = t_buffer_create(HTTP2_FRAME_HEADER_SIZE + size);
+
+	http2_frame_append(buf, type, flags, stream_id, payload, size);
+	http2_send(h2, buf);
+}
+
+static void
+http2_send_rst_stream(struct http_client_http2 *h2, uint32_t stream_id,
+		      enum http2_error_code error_code)
+{
+	buffer_t *buf = t_buffer_create(HTTP2_FRAME_HEADER_SIZE + 4);
+
+	http2_frame_append_rst_stream(buf, stream_id, error_code);
+	http2_send(h2, buf);
+}
+
+static void
+http2_send_window_update(struct http_client_http2 *h2, uint32_t stream_id,
+			 uint32_t increment)
+{
+	buffer_t *buf = t_buffer_create(HTTP2_FRAME_HEADER_SIZE + 4);
+
+	http2_frame_append_window_update(buf, stream_id, increment);
+	http2_send(h2, buf);
+}
+
+static int http2_flush(struct http_client_http2 *h2)
+{
+	struct http_client_connection *conn = h2->conn;
+
+	if (o_stream_flush(conn->conn.output) < 0) {
+		http_client_connection_handle_output_error(conn);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Streams
+ */
+
+static struct http_client_http2_stream *
+http2_stream_find(struct http_client_http2 *h2, uint32_t id)
+{
+	struct http_client_http2_stream *stream;
+
+	array_foreach_elem(&h2->streams, stream) {
+		if (stream->id == id)
+			return stream;
+	}
+	return NULL;
+}
+
+static struct http_client_http2_stream *
+http2_stream_find_request(struct http_client_http2 *h2,
+			  struct http_client_request *req)
+{
+	struct http_client_http2_stream *stream;
+
+	array_foreach_elem(&h2->streams, stream) {
+		if (stream->req == req)
+			return stream;
+	}
+	return NULL;
+}
+
+static struct http_client_http2_stream *
+http2_stream_create(struct http_client_http2 *h2,
+		    struct http_client_request *req)
+{
+	struct http_client_http2_stream *stream;
+	pool_t pool;
+
+	pool = pool_alloconly_create("http2 client stream", 1024);
+	stream = p_new(pool, struct http_client_http2_stream, 1);
+	stream->pool = pool;
+	stream->h2 = h2;
+	stream->id = h2->next_stream_id;
+	stream->req = req;
+	stream->send_window = h2->initial_window_size;
+	stream->recv_window = HTTP2_CLIENT_STREAM_WINDOW_SIZE;
+
+	h2->next_stream_id += 2;
+	array_push_back(&h2->streams, &stream);
+	return stream;
+}
+
+static void http2_stream_free(struct http_client_http2_stream **_stream)
+{
+	struct http_client_http2_stream *stream = *_stream;
+	struct http_client_http2 *h2 = stream->h2;
+	struct http_client_connection *conn = h2->conn;
+	unsigned int idx;
+
+	*_stream = NULL;
+
+	if (!stream->reset && !conn->disconnected &&
+	    (!stream->end_stream_sent || !stream->end_stream_received)) {
+		/* Cancel the rest of the request or response */
+		e_debug(conn->event, "Cancelling stream %u", stream->id);
+		http2_send_rst_stream(h2, stream->id, HTTP2_ERROR_CANCEL);
+		o_stream_set_flush_pending(conn->conn.output, TRUE);
+	}
+
+	if (!array_lsearch_ptr_idx(&h2->streams, stream, &idx))
+		i_unreached();
+	array_delete(&h2->streams, idx, 1);
+	h2->streams_finished = TRUE;
+
+	io_remove(&stream->io_payload_input);
+	if (stream->payload != NULL)
+		stream->payload->stream = NULL;
+	pool_unref(&stream->pool);
+}
+
+/* Remove the stream's request from the connection's request_wait_list and
+   drop the connection's reference to it. Returns the request, or NULL if it
+   got destroyed. */
+static struct http_client_request *
+http2_stream_detach_request(struct http_client_http2_stream *stream)
+{
+	struct http_client_connection *conn = stream->h2->conn;
+	struct http_client_request *req = stream->req, *req_ref = req;
+	unsigned int idx;
+
+	stream->req = NULL;
+	if (!array_lsearch_ptr_idx(&conn->request_wait_list, req, &idx))
+		i_unreached();
+	array_delete(&conn->request_wait_list, idx, 1);
+	if (array_count(&conn->request_wait_list) == 0)
+		http_client_connection_stop_request_timeout(conn);
+
+	if (!http_client_connection_unref_request(conn, &req_ref))
+		return NULL;
+	return req;
+}
+
+static void
+http2_stream_error(struct http_client_http2_stream *stream,
+		   enum http2_error_code error_code, const char *error)
+{
+	struct http_client_http2 *h2 = stream->h2;
+	struct http_client_request *req;
+
+	e_debug(h2->conn->event, "Stream %u error: %s (%s)", stream->id,
+		error, http2_error_code_name(error_code));
+
+	http2_send_rst_stream(h2, stream->id, error_code);
+	o_stream_set_flush_pending(h2->conn->conn.output, TRUE);
+	stream->reset = TRUE;
+
+	if (stream->payload_wrapper != NULL) {
+		/* The application is reading the response payload */
+		if (stream->payload != NULL) {
+			http2_payload_istream_set_error(stream->payload,
+							EPROTO, error);
+		}
+		return;
+	}
+
+	req = http2_stream_detach_request(stream);
+	http2_stream_free(&stream);
+	if (req != NULL) {
+		http_client_request_error(
+			&req, HTTP_CLIENT_REQUEST_ERROR_BAD_RESPONSE, error);
+	}
+}
+
+static void
+http2_stream_consumed(struct http_client_http2_stream *stream, size_t size)
+{
+	struct http_client_http2 *h2 = stream->h2;
+
+	stream->recv_consumed += size;
+	if (stream->end_stream_received || stream->reset ||
+	    stream->recv_consumed < HTTP2_CLIENT_STREAM_WINDOW_SIZE/2)
+		return;
+
+	T_BEGIN {
+		http2_send_window_update(h2, stream->id, stream->recv_consumed);
+	} T_END;
+	o_stream_set_flush_pending(h2->conn->conn.output, TRUE);
+	stream->recv_window += stream->recv_consumed;
+	stream->recv_consumed = 0;
+}
+
+/*
+ * Request payload
+ */
+
+static void http2_stream_payload_input(struct http_client_http2_stream *stream)
+{
+	struct http_client_http2 *h2 = stream->h2;
+	struct http_client_connection *conn = h2->conn;
+
+	io_remove(&stream->io_payload_input);
+
+	http_client_connection_ref(conn);
+	o_stream_cork(conn->conn.output);
+	http2_send_payloads(h2);
+	if (!conn->disconnected &&
+	    o_stream_uncork_flush(conn->conn.output) < 0)
+		http_client_connection_handle_output_error(conn);
+	http_client_connection_unref(&conn);
+}
+
+static void
+http2_stream_payload_finished(struct http_client_http2_stream *stream)
+{
+	struct http_client_http2 *h2 = stream->h2;
+	struct http_client_request *req = stream->req;
+
+	req->payload_finished = TRUE;
+	o_stream_unref(&req->payload_output);
+
+	if (!stream->end_stream_sent) {
+		http2_send_frame(h2, HTTP2_FRAME_DATA,
+				 HTTP2_FRAME_FLAG_END_STREAM, stream->id,
+				 NULL, 0);
+		req->bytes_out += HTTP2_FRAME_HEADER_SIZE;
+		stream->end_stream_sent = TRUE;
+	}
+
+	if (req->state == HTTP_REQUEST_STATE_PAYLOAD_OUT) {
+		/* We're now waiting for a response from the server */
+		req->state = HTTP_REQUEST_STATE_WAITING;
+		http_client_connection_start_request_timeout(h2->conn);
+	}
+	e_debug(req->event, "Finished sending payload");
+}
+
+static void
+http2_stream_broken_payload(struct http_client_http2_stream *stream)
+{
+	struct http_client_request *req = stream->req;
+
+	e_debug(stream->h2->conn->event,
+		"Stream %u: read(%s) failed: %s", stream->id,
+		i_stream_get_name(req->payload_input),
+		i_stream_get_error(req->payload_input));
+
+	/* Only this stream is affected; the connection stays usable */
+	req = http2_stream_detach_request(stream);
+	http2_stream_free(&stream);
+	if (req != NULL) {
+		http_client_request_error(
+			&req, HTTP_CLIENT_REQUEST_ERROR_BROKEN_PAYLOAD,
+			"Broken payload stream");
+	}
+}
+
+/* Returns 1 if the whole payload (or the current chunk of it) was sent, 0 if
+   waiting for input, output or flow control window, and -1 if the stream was
+   freed. */
+static int http2_stream_send_payload(struct http_client_http2_stream *stream)
+{
+	struct http_client_http2 *h2 = stream->h2;
+	struct http_client_connection *conn = h2->conn;
+	struct http_client_request *req = stream->req;
+	struct ostream *output = conn->conn.output;
+	const unsigned char *data;
+	size_t size;
+	buffer_t *buf;
+	int ret;
+
+	i_assert(req->payload_input != NULL);
+
+	while (o_stream_get_buffer_used_size(output) <
+	       HTTP2_CLIENT_MAX_OUTPUT_BUFFER_SIZE) {
+		if (stream->send_window <= 0 || h2->send_window <= 0) {
+			/* Wait for WINDOW_UPDATE */
+			return 0;
+		}
+
+		ret = i_stream_read_more(req->payload_input, &data, &size);
+		if (ret == 0) {
+			/* Input is blocking */
+			stream->io_payload_input = io_add_istream_to(
+				conn->conn.ioloop, req->payload_input,
+				http2_stream_payload_input, stream);
+			return 0;
+		}
+		if (ret < 0) {
+			if (req->payload_input->stream_errno != 0) {
+				http2_stream_broken_payload(stream);
+				return -1;
+			}
+			if (!req->payload_chunked &&
+			    (req->payload_input->v_offset -
+			     req->payload_offset) != req->payload_size) {
+				e_error(req->event,
+					"BUG: stream '%s' input size changed: "
+					"%"PRIuUOFF_T"-%"PRIuUOFF_T" != "
+					"%"PRIuUOFF_T,
+					i_stream_get_name(req->payload_input),
+					req->payload_input->v_offset,
+					req->payload_offset, req->payload_size);
+				http2_stream_broken_payload(stream);
+				return -1;
+			}
+			if (req->payload_wait) {
+				/* This chunk of input is finished
+				   (client needs to act) */
+				if (req->client != NULL && req->client->waiting)
+					io_loop_stop(req->client->ioloop);
+				return 1;
+			}
+			http2_stream_payload_finished(stream);
+			return 1;
+		}
+
+		size = I_MIN(size, (size_t)stream->send_window);
+		size = I_MIN(size, (size_t)h2->send_window);
+		size = I_MIN(size, h2->max_frame_size);
+
+		buf = t_buffer_create(HTTP2_FRAME_HEADER_SIZE + size);
+		http2_frame_append(buf, HTTP2_FRAME_DATA, 0, stream->id,
+				   data, size);
+		http2_send(h2, buf);
+		i_stream_skip(req->payload_input, size);
+
+		stream->send_window -= size;
+		h2->send_window -= size;
+		req->bytes_out += buf->used;
+	}
+
+	/* Output is blocking */
+	o_stream_set_flush_pending(output, TRUE);
+	return 0;
+}
+
+static void http2_send_payloads(struct http_client_http2 *h2)
+{
+	struct http_client_http2_stream *stream;
+	ARRAY(uint32_t) ids;
+	uint32_t id;
+
+	/* Sending may fail requests, whose callbacks can change the stream
+	   list, so look up the streams again by their ID. */
+	t_array_init(&ids, array_count(&h2->streams));
+	array_foreach_elem(&h2->streams, stream)
+		array_push_back(&ids, &stream->id);
+
+	array_foreach_elem(&ids, id) {
+		if (h2->conn->disconnected)
+			break;
+		if (o_stream_get_buffer_used_size(h2->conn->conn.output) >=
+		    HTTP2_CLIENT_MAX_OUTPUT_BUFFER_SIZE) {
+			o_stream_set_flush_pending(h2->conn->conn.output, TRUE);
+			break;
+		}
+
+		stream = http2_stream_find(h2, id);
+		if (stream == NULL || stream->req == NULL ||
+		    stream->end_stream_sent ||
+		    stream->io_payload_input != NULL ||
+		    stream->req->state != HTTP_REQUEST_STATE_PAYLOAD_OUT ||
+		    stream->req->payload_input == NULL)
+			continue;
+		(void)http2_stream_send_payload(stream);
+	}
+}
+
+static int http2_output(struct http_client_http2 *h2)
+{
+	struct http_client_connection *conn = h2->conn;
+	struct ostream *output = conn->conn.output;
+	int ret;
+
+	if ((ret = o_stream_flush(output)) <= 0) {
+		if (ret < 0)
+			http_client_connection_handle_output_error(conn);
+		return ret;
+	}
+
+	http_client_connection_ref(conn);
+	o_stream_cork(output);
+	http2_send_payloads(h2);
+	if (conn->disconnected)
+		ret = -1;
+	else if ((ret = o_stream_uncork_flush(output)) < 0)
+		http_client_connection_handle_output_error(conn);
+	else
+		ret = (o_stream_get_buffer_used_size(output) > 0 ? 0 : 1);
+	http_client_connection_unref(&conn);
+	return ret;
+}
+
+/*
+ * Requests
+ */
+
+static bool http2_request_header_is_allowed(const char *name)
+{
+	/* RFC 9113, Section 8.2.2: Connection-Specific Header Fields */
+	return (strcmp(name, "connection") != 0 &&
+		strcmp(name, "keep-alive") != 0 &&
+		strcmp(name, "proxy-connection") != 0 &&
+		strcmp(name, "transfer-encoding") != 0 &&
+		strcmp(name, "upgrade") != 0 &&
+		strcmp(name, "te") != 0 &&
+		strcmp(name, "host") != 0);
+}
+
+static const char *
+http2_request_get_authority(struct http_client_request *req)
+{
+	const char *line, *end, *p;
+	size_t len;
+
+	if (!req->have_hdr_host)
+		return req->authority;
+
+	/* An explicitly added Host header is sent as :authority */
+	line = str_c(req->headers);
+	while ((end = strstr(line, "\r\n")) != NULL) {
+		p = strchr(line, ':');
+		len = (p == NULL ? 0 : (size_t)(p - line));
+		if (p != NULL && p < end && len == 4 &&
+		    strncasecmp(line, "Host", 4) == 0) {
+			p++;
+			while (*p == ' ' || *p == '\t')
+				p++;
+			return t_strdup_until(p, end);
+		}
+		line = end + 2;
+	}
+	return req->authority;
+}
+
+static void
+http2_request_encode_headers(struct http_client_http2 *h2,
+			     struct http_client_request *req, buffer_t *block)
+{
+	const struct http_client_settings *set = req->client->set;
+	struct http_client_peer_shared *pshared = h2->conn->ppool->peer;
+	struct http2_hpack_encoder *enc = h2->encoder;
+	const char *line, *end, *p, *name;
+
+	http2_hpack_encode_begin(enc, block);
+	http2_hpack_encode_header(enc, block, ":method", req->method, FALSE);
+	http2_hpack_encode_header(
+		enc, block, ":scheme",
+		(http_client_peer_addr_is_https(&pshared->addr) ?
+		 "https" : "http"), FALSE);
+	http2_hpack_encode_header(enc, block, ":authority",
+				  http2_request_get_authority(req), FALSE);
+	http2_hpack_encode_header(enc, block, ":path", req->target, FALSE);
+
+	/* Create special headers implicitly if not set explicitly using
+	   http_client_request_add_header() */
+	if (!req->have_hdr_date) {
+		http2_hpack_encode_header(enc, block, "date",
+					  http_date_create(req->date), FALSE);
+	}
+	if (!req->have_hdr_authorization &&
+	    req->username != NULL && req->password != NULL) {
+		struct http_auth_credentials auth_creds;
+		string_t *value = t_str_new(64);
+
+		http_auth_basic_credentials_init(&auth_creds,
+			req->username, req->password);
+		http_auth_create_credentials(value, &auth_creds);
+		http2_hpack_encode_header(enc, block, "authorization",
+					  str_c(value), TRUE);
+	}
+	if (!req->have_hdr_user_agent && set->user_agent != NULL &&
+	    set->user_agent[0] != '\0') {
+		http2_hpack_encode_header(enc, block, "user-agent",
+					  set->user_agent, FALSE);
+	}
+	if (!req->have_hdr_body_spec &&
+	    ((req->payload_input != NULL && !req->payload_chunked) ||
+	     (req->payload_input == NULL &&
+	      (req->payload_empty ||
+	       strcasecmp(req->method, "POST") == 0 ||
+	       strcasecmp(req->method, "PUT") == 0)))) {
+		http2_hpack_encode_header(enc, block, "content-length",
+					  dec2str(req->payload_size), FALSE);
+	}
+
+	/* Explicit headers, with lowercase names and without the
+	   connection-specific ones */
+	if (req->headers == NULL)
+		return;
+	line = str_c(req->headers);
+	while ((end = strstr(line, "\r\n")) != NULL) {
+		p = strchr(line, ':');
+		if (p != NULL && p < end) {
+			name = t_str_lcase(t_strdup_until(line, p));
+			for (p++; *p == ' ' || *p == '\t'; p++) ;
+			if (http2_request_header_is_allowed(name)) {
+				http2_hpack_encode_header(
+					enc, block, name,
+					t_strdup_until(p, end),
+					strcmp(name, "authorization") == 0 ||
+					strcmp(name, "cookie") == 0);
+			}
+		}
+		line = end + 2;
+	}
+}
+
+static void
+http2_send_headers(struct http_client_http2 *h2, uint32_t stream_id,
+		   const buffer_t *block, bool end_stream)
+{
+	const unsigned char *data = block->data;
+	size_t size = block->used, chunk;
+	enum http2_frame_type type = HTTP2_FRAME_HEADERS;
+	uint8_t flags;
+	buffer_t *buf;
+
+	/* The header block is split into HEADERS and CONTINUATION frames */
+	buf = t_buffer_create(size + HTTP2_FRAME_HEADER_SIZE *
+			      (size / h2->max_frame_size + 1));
+	do {
+		chunk = I_MIN(size, h2->max_frame_size);
+		flags = 0;
+		if (type == HTTP2_FRAME_HEADERS && end_stream)
+			flags |= HTTP2_FRAME_FLAG_END_STREAM;
+		if (chunk == size)
+			flags |= HTTP2_FRAME_FLAG_END_HEADERS;
+		http2_frame_append(buf, type, flags, stream_id, data, chunk);
+		data += chunk;
+		size -= chunk;
+		type = HTTP2_FRAME_CONTINUATION;
+	} while (size > 0);
+	http2_send(h2, buf);
+}
+
+static int
+http2_send_request_real(struct http_client_http2 *h2,
+			struct http_client_request *req)
+{
+	struct http_client_connection *conn = h2->conn;
+	struct ostream *output = conn->conn.output;
+	struct http_client_http2_stream *stream;
+	buffer_t *block = t_buffer_create(256);
+	bool end_stream = (req->payload_input == NULL);
+
+	i_assert(req->payload_output == NULL);
+
+	stream = http2_stream_create(h2, req);
+	http2_request_encode_headers(h2, req, block);
+
+	req->state = HTTP_REQUEST_STATE_PAYLOAD_OUT;
+	req->payload_finished = FALSE;
+
+	req->send_attempts++;
+	if (req->first_sent_time.tv_sec == 0)
+		req->first_sent_time = ioloop_timeval;
+	req->sent_time = ioloop_timeval;
+	req->sent_lock_usecs = file_lock_wait_get_total_usecs();
+	req->sent_global_ioloop_usecs = ioloop_global_wait_usecs;
+	req->sent_http_ioloop_usecs =
+		io_wait_timer_get_usecs(conn->io_wait_timer);
+
+	o_stream_cork(output);
+	req->request_offset = output->offset;
+	http2_send_headers(h2, stream->id, block, end_stream);
+	req->bytes_out = output->offset - req->request_offset;
+
+	e_debug(req->event, "Sent header on stream %u", stream->id);
+
+	if (end_stream) {
+		stream->end_stream_sent = TRUE;
+		req->state = HTTP_REQUEST_STATE_WAITING;
+		http_client_connection_start_request_timeout(conn);
+	} else {
+		req->payload_output = output;
+		o_stream_ref(output);
+		(void)http2_stream_send_payload(stream);
+	}
+
+	if (conn->disconnected)
+		return -1;
+	if (o_stream_uncork_flush(output) < 0) {
+		http_client_connection_handle_output_error(conn);
+		return -1;
+	}
+	return 1;
+}
+
+int http_client_connection_http2_send_request(
+	struct http_client_connection *conn, struct http_client_request *req)
+{
+	int ret;
+
+	T_BEGIN {
+		ret = http2_send_request_real(conn->http2, req);
+	} T_END;
+	return ret;
+}
+
+int http_client_connection_http2_finish_payload(
+	struct http_client_connection *conn, struct http_client_request *req)
+{
+	struct http_client_http2_stream *stream;
+
+	stream = http2_stream_find_request(conn->http2, req);
+	if (stream == NULL) {
+		req->payload_finished = TRUE;
+		return 1;
+	}
+
+	T_BEGIN {
+		http2_stream_payload_finished(stream);
+	} T_END;
+	if (http2_flush(conn->http2) < 0)
+		return -1;
+	return 1;
+}
+
+void http_client_connection_http2_request_destroyed(
+	struct http_client_connection *conn, struct http_client_request *req)
+{
+	struct http_client_http2 *h2 = conn->http2;
+	struct http_client_http2_stream *stream;
+	struct istream *payload;
+
+	stream = http2_stream_find_request(h2, req);
+	if (stream == NULL)
+		return;
+
+	e_debug(conn->event, "Request on stream %u destroyed prematurely",
+		stream->id);
+
+	if (stream->payload_wrapper == NULL) {
+		/* Still waiting for the response */
+		(void)http2_stream_detach_request(stream);
+		T_BEGIN {
+			http2_stream_free(&stream);
+		} T_END;
+		return;
+	}
+
+	/* Destroy the payload, so that the timeout istream is closed. This
+	   finishes the stream. */
+	payload = stream->payload_wrapper;
+	i_stream_ref(payload);
+	i_stream_destroy(&payload);
+}
+
+unsigned int
+http_client_connection_http2_count_streams(struct http_client_connection *conn)
+{
+	return array_count(&conn->http2->streams);
+}
+
+unsigned int
+http_client_connection_http2_max_streams(struct http_client_connection *conn)
+{
+	struct http_client_http2 *h2 = conn->http2;
+	const struct http_client_settings *set = conn->set;
+
+	if (h2->next_stream_id > HTTP2_MAX_STREAM_ID) {
+		/* Stream IDs are exhausted */
+		return 0;
+	}
+	if (!h2->settings_received) {
+		/* Don't exceed the server's limit before it is known */
+		return 1;
+	}
+	return I_MIN(set->http2_max_concurrent_streams,
+		     h2->max_concurrent_streams);
+}
+
+/*
+ * Responses
+ */
+
+static void http2_payload_destroyed(struct http_client_http2_stream *stream)
+{
+	struct http_client_http2 *h2 = stream->h2;
+	struct http_client_connection *conn = h2->conn;
+	struct http_client_request *req = stream->req, *req_ref;
+
+	i_assert(stream->payload_wrapper != NULL);
+
+	e_debug(conn->event,
+		"Response payload stream %u destroyed "
+		"(%lld ms after initial response)", stream->id,
+		timeval_diff_msecs(&ioloop_timeval, &req->response_time));
+
+	stream->payload_wrapper = NULL;
+	stream->req = NULL;
+
+	/* Drop reference from connection */
+	req_ref = req;
+	if (http_client_connection_unref_request(conn, &req_ref)) {
+		/* Finish request if not already aborted */
+		http_client_request_finish(req);
+	}
+
+	T_BEGIN {
+		http2_stream_free(&stream);
+	} T_END;
+
+	/* We may get here from the API user's code, so don't close the
+	   connection or handle new requests directly. */
+	if (h2->to_finished == NULL && !conn->disconnected) {
+		h2->to_finished = timeout_add_short_to(
+			conn->conn.ioloop, 0,
+			http_client_connection_http2_input, conn);
+	}
+}
+
+static int
+http2_response_parse(struct http_client_http2_stream *stream,
+		     const ARRAY_TYPE(http2_hpack_header) *fields,
+		     struct http_response *resp, const char **error_r)
+{
+	const struct http2_hpack_header *field;
+	struct http_header *header;
+	const char *retry_after = NULL;
+	bool regular = FALSE;
+	time_t delta;
+
+	i_zero(resp);
+	resp->version_major = 2;
+	resp->reason = "";
+	resp->date = (time_t)-1;
+	resp->retry_after = (time_t)-1;
+
+	header = http_header_create(stream->pool, array_count(fields));
+	array_foreach(fields, field) {
+		if (field->name[0] == ':') {
+			/* RFC 9113, Section 8.3: Pseudo-header fields must
+			   precede the regular ones, and responses only have
+			   :status. */
+			if (regular || strcmp(field->name, ":status") != 0 ||
+			    resp->status != 0) {
+				*error_r = t_strdup_printf(
+					"Invalid pseudo-header field %s",
+					field->name);
+				return -1;
+			}
+			if (str_to_uint(field->value, &resp->status) < 0 ||
+			    resp->status < 100 || resp->status > 999) {
+				*error_r = t_strdup_printf(
+					"Invalid :status '%s'", field->value);
+				return -1;
+			}
+			continue;
+		}
+		regular = TRUE;
+		(void)http_header_field_add(
+			header, field->name,
+			(const unsigned char *)field->value,
+			strlen(field->value));
+
+		if (strcmp(field->name, "date") == 0) {
+			(void)http_date_parse(
+				(const unsigned char *)field->value,
+				strlen(field->value), &resp->date);
+		} else if (strcmp(field->name, "location") == 0) {
+			resp->location = field->value;
+		} else if (strcmp(field->name, "retry-after") == 0) {
+			retry_after = field->value;
+		}
+	}
+	if (resp->status == 0) {
+		*error_r = "Missing :status";
+		return -1;
+	}
+
+	/* Broken Retry-After header is ignored */
+	if (retry_after != NULL &&
+	    (resp->status == 503 || resp->status / 100 == 3)) {
+		if (str_to_time(retry_after, &delta) >= 0) {
+			if (resp->date != (time_t)-1)
+				resp->retry_after = resp->date + delta;
+		} else {
+			(void)http_date_parse(
+				(const unsigned char *)retry_after,
+				strlen(retry_after), &resp->retry_after);
+		}
+	}
+	resp->header = header;
+	return 0;
+}
+
+static int
+http2_return_response(struct http_client_http2_stream *stream,
+		      struct http_client_request *req,
+		      struct http_response *resp)
+{
+	struct http_client_http2 *h2 = stream->h2;
+	struct http_client_connection *conn = h2->conn;
+	struct istream *payload = NULL;
+	bool retrying;
+
+	http_client_connection_ref(conn);
+	http_client_connection_ref_request(conn, req);
+	stream->req = req;
+
+	if (resp->payload != NULL) {
+		/* Wrap the stream to capture the destroy event without
+		   destroying the actual payload stream */
+		payload = resp->payload;
+		stream->payload_wrapper = resp->payload =
+			i_stream_create_timeout(payload,
+						req->attempt_timeout_msecs);
+		i_stream_unref(&payload);
+		payload = resp->payload;
+		i_stream_add_destroy_callback(payload,
+					      http2_payload_destroyed, stream);
+	}
+
+	stream->in_callback = TRUE;
+	retrying = !http_client_request_callback(req, resp);
+	if (conn->disconnected) {
+		/* The callback managed to get this connection disconnected.
+		   The stream is already gone, but the request reference was
+		   left for us. */
+		i_stream_unref(&payload);
+		if (!retrying)
+			http_client_request_finish(req);
+		http_client_connection_unref_request(conn, &req);
+		http_client_connection_unref(&conn);
+		return -1;
+	}
+	stream->in_callback = FALSE;
+
+	if (retrying) {
+		/* Retrying, don't destroy the request */
+		if (payload != NULL) {
+			i_stream_remove_destroy_callback(
+				payload, http2_payload_destroyed);
+			stream->payload_wrapper = NULL;
+			i_stream_unref(&payload);
+		}
+		stream->req = NULL;
+		http_client_connection_unref_request(conn, &req);
+		http2_stream_free(&stream);
+	} else if (payload != NULL) {
+		req->state = HTTP_REQUEST_STATE_PAYLOAD_IN;
+		/* Request is dereferenced in payload destroy callback */
+		i_stream_unref(&payload);
+	} else {
+		stream->req = NULL;
+		http_client_request_finish(req);
+		http_client_connection_unref_request(conn, &req);
+		http2_stream_free(&stream);
+	}
+	return (http_client_connection_unref(&conn) ? 0 : -1);
+}
+
+static int
+http2_stream_response(struct http_client_http2_stream *stream,
+		      struct http_response *resp, bool end_stream)
+{
+	struct http_client_http2 *h2 = stream->h2;
+	struct http_client_connection *conn = h2->conn;
+	struct http_client_request *req = stream->req;
+	enum http_response_payload_type payload_type;
+	bool early = FALSE;
+
+	req->response_time = ioloop_timeval;
+	req->response_offset = conn->conn.input->v_offset;
+
+	if (resp->status / 100 == 1) {
+		/* RFC 9113, Section 8.1: Interim responses are ignored */
+		if (end_stream) {
+			http2_stream_error(stream, HTTP2_ERROR_PROTOCOL_ERROR,
+					   "Stream ended with 1xx response");
+			return 0;
+		}
+		e_debug(req->event, "Got unexpected %u response; ignoring",
+			resp->status);
+		return 0;
+	}
+	stream->response_received = TRUE;
+
+	if (req->state == HTTP_REQUEST_STATE_PAYLOAD_OUT) {
+		/* Early response while the payload is still being sent. With
+		   HTTP/2 only this stream is affected: the rest of the payload
+		   is not sent, and the stream is cancelled afterwards. */
+		e_debug(req->event, "Got early response from server; "
+			"request payload not completely sent");
+		io_remove(&stream->io_payload_input);
+		req->payload_finished = TRUE;
+	}
+	(void)http_client_request_check_response(req, resp, &early);
+	i_assert(!early);
+
+	payload_type = http_client_request_get_payload_type(req);
+	if (!end_stream && resp->status != 204 && resp->status != 304 &&
+	    (payload_type == HTTP_RESPONSE_PAYLOAD_TYPE_ALLOWED ||
+	     (payload_type == HTTP_RESPONSE_PAYLOAD_TYPE_ONLY_UNSUCCESSFUL &&
+	      resp->status / 100 != 2))) {
+		stream->payload = http2_payload_istream_create(stream);
+		resp->payload = &stream->payload->istream.istream;
+	}
+
+	/* Remove request from the wait list */
+	req = http2_stream_detach_request(stream);
+	if (req == NULL || req->state == HTTP_REQUEST_STATE_ABORTED) {
+		i_stream_unref(&resp->payload);
+		http2_stream_free(&stream);
+		return 0;
+	}
+
+	/* Check whether response needs to be handled internally. */
+	if (http_client_connection_handle_response(conn, req, resp)) {
+		i_stream_unref(&resp->payload);
+		http2_stream_free(&stream);
+		return 0;
+	}
+
+	/* Response handled by application */
+	return http2_return_response(stream, req, resp);
+}
+
+static void
+http2_stream_end_received(struct http_client_http2_stream *stream)
+{
+	stream->end_stream_received = TRUE;
+	if (stream->payload != NULL)
+		http2_payload_istream_set_eof(stream->payload);
+	if (stream->payload_wrapper == NULL && stream->req == NULL) {
+		/* The response was already handled */
+		http2_stream_free(&stream);
+	}
+}
+
+/*
+ * Connection errors
+ */
+
+static void
+http2_connection_error(struct http_client_http2 *h2,
+		       enum http2_error_code error_code, const char *error)
+{
+	struct http_client_connection *conn = h2->conn;
+	buffer_t *buf = t_buffer_create(64);
+
+	error = t_strdup_printf("HTTP/2 %s: %s",
+				http2_error_code_name(error_code), error);
+
+	/* We never accept streams from the server */
+	http2_frame_append_goaway(buf, 0, error_code, NULL);
+	http2_send(h2, buf);
+	(void)o_stream_flush(conn->conn.output);
+
+	conn->close_indicated = TRUE;
+	http_client_connection_abort_error(
+		&conn, HTTP_CLIENT_REQUEST_ERROR_BAD_RESPONSE, error);
+}
+
+/*
+ * Frame input
+ */
+
+static int
+http2_input_settings(struct http_client_http2 *h2,
+		     const struct http2_frame_header *hdr,
+		     const unsigned char *payload)
+{
+	struct http_client_http2_stream *stream;
+	uint32_t i, id, value;
+	int64_t delta;
+
+	if (hdr->stream_id != 0) {
+		http2_connection_error(h2, HTTP2_ERROR_PROTOCOL_ERROR,
+				       "SETTINGS frame on a stream");
+		return -1;
+	}
+	if ((hdr->flags & HTTP2_FRAME_FLAG_ACK) != 0) {
+		if (hdr->length != 0) {
+			http2_connection_error(h2,
+				HTTP2_ERROR_FRAME_SIZE_ERROR,
+				"SETTINGS ACK with payload");
+			return -1;
+		}
+		return 0;
+	}
+	if (hdr->length % HTTP2_SETTING_SIZE != 0) {
+		http2_connection_error(h2, HTTP2_ERROR_FRAME_SIZE_ERROR,
+				       "Invalid SETTINGS frame length");
+		return -1;
+	}
+
+	for (i = 0; i < hdr->length; i += HTTP2_SETTING_SIZE) {
+		id = be16_to_cpu_unaligned(payload + i);
+		value = be32_to_cpu_unaligned(payload + i + 2);
+
+		switch (id) {
+		case HTTP2_SETTING_HEADER_TABLE_SIZE:
+			http2_hpack_encoder_set_max_table_size(
+				h2->encoder,
+				I_MIN(value, HTTP2_HPACK_DEFAULT_TABLE_SIZE));
+			break;
+		case HTTP2_SETTING_ENABLE_PUSH:
+			if (value > 1) {
+				http2_connection_error(h2,
+					HTTP2_ERROR_PROTOCOL_ERROR,
+					"Invalid SETTINGS_ENABLE_PUSH");
+				return -1;
+			}
+			break;
+		case HTTP2_SETTING_MAX_CONCURRENT_STREAMS:
+			h2->max_concurrent_streams = value;
+			break;
+		case HTTP2_SETTING_INITIAL_WINDOW_SIZE:
+			if (value > HTTP2_MAX_WINDOW_SIZE) {
+				http2_connection_error(h2,
+					HTTP2_ERROR_FLOW_CONTROL_ERROR,
+					"Invalid SETTINGS_INITIAL_WINDOW_SIZE");
+				return -1;
+			}
+			/* RFC 9113, Section 6.9.2: The change applies to
+			   all the open streams */
+			delta = (int64_t)value - h2->initial_window_size;
+			h2->initial_window_size = value;
+			array_foreach_elem(&h2->streams, stream) {
+				stream->send_window += delta;
+				if (stream->send_window >
+				    HTTP2_MAX_WINDOW_SIZE) {
+					http2_connection_error(h2,
+						HTTP2_ERROR_FLOW_CONTROL_ERROR,
+						"Stream window too large");
+					return -1;
+				}
+			}
+			break;
+		case HTTP2_SETTING_MAX_FRAME_SIZE:
+			if (value < HTTP2_DEFAULT_MAX_FRAME_SIZE ||
+			    value > HTTP2_MAX_FRAME_SIZE_LIMIT) {
+				http2_connection_error(h2,
+					HTTP2_ERROR_PROTOCOL_ERROR,
+					"Invalid SETTINGS_MAX_FRAME_SIZE");
+				return -1;
+			}
+			h2->max_frame_size = value;
+			break;
+		case HTTP2_SETTING_MAX_HEADER_LIST_SIZE:
+			/* Advisory; our requests are small */
+			break;
+		default:
+			/* Unknown settings are ignored */
+			break;
+		}
+	}
+	h2->settings_received = TRUE;
+
+	http2_send_frame(h2, HTTP2_FRAME_SETTINGS, HTTP2_FRAME_FLAG_ACK, 0,
+			 NULL, 0);
+	/* Windows or stream limits may have grown */
+	h2->streams_finished = TRUE;
+	http2_send_payloads(h2);
+	return h2->conn->disconnected ? -1 : 0;
+}
+
+static int
+http2_input_ping(struct http_client_http2 *h2,
+		 const struct http2_frame_header *hdr,
+		 const unsigned char *payload)
+{
+	if (hdr->stream_id != 0) {
+		http2_connection_error(h2, HTTP2_ERROR_PROTOCOL_ERROR,
+				       "PING frame on a stream");
+		return -1;
+	}
+	if (hdr->length != 8) {
+		http2_connection_error(h2, HTTP2_ERROR_FRAME_SIZE_ERROR,
+				       "Invalid PING frame length");
+		return -1;
+	}
+	if ((hdr->flags & HTTP2_FRAME_FLAG_ACK) == 0) {
+		http2_send_frame(h2, HTTP2_FRAME_PING, HTTP2_FRAME_FLAG_ACK, 0,
+				 payload, hdr->length);
+	}
+	return 0;
+}
+
+static int
+http2_input_goaway(struct http_client_http2 *h2,
+		   const struct http2_frame_header *hdr,
+		   const unsigned char *payload)
+{
+	struct http_client_connection *conn = h2->conn;
+	struct http_client_http2_stream *stream;
+	struct http_client_request *req;
+	uint32_t last_stream_id, error_code, id;
+	ARRAY(uint32_t) ids;
+
+	if (hdr->stream_id != 0) {
+		http2_connection_error(h2, HTTP2_ERROR_PROTOCOL_ERROR,
+				       "GOAWAY frame on a stream");
+		return -1;
+	}
+	if (hdr->length < 8) {
+		http2_connection_error(h2, HTTP2_ERROR_FRAME_SIZE_ERROR,
+				       "Invalid GOAWAY frame length");
+		return -1;
+	}
+	last_stream_id = be32_to_cpu_unaligned(payload) & HTTP2_MAX_STREAM_ID;
+	error_code = be32_to_cpu_unaligned(payload + 4);
+
+	e_debug(conn->event, "Server sent GOAWAY: %s (last stream %u)",
+		http2_error_code_name(error_code), last_stream_id);
+
+	h2->goaway_received = TRUE;
+	conn->close_indicated = TRUE;
+
+	/* The streams after last_stream_id weren't processed, so they can be
+	   safely sent again on a new connection. */
+	t_array_init(&ids, array_count(&h2->streams));
+	array_foreach_elem(&h2->streams, stream) {
+		if (stream->id > last_stream_id)
+			array_push_back(&ids, &stream->id);
+	}
+	array_foreach_elem(&ids, id) {
+		stream = http2_stream_find(h2, id);
+		if (stream == NULL)
+			continue;
+		stream->reset = TRUE;
+		if (stream->payload_wrapper != NULL) {
+			/* Can't happen with a valid server */
+			if (stream->payload != NULL) {
+				http2_payload_istream_set_error(
+					stream->payload, ECONNRESET,
+					"Server refused the stream");
+			}
+			continue;
+		}
+		req = http2_stream_detach_request(stream);
+		http2_stream_free(&stream);
+		if (req != NULL && req->state < HTTP_REQUEST_STATE_FINISHED)
+			http_client_request_resubmit(req);
+		if (conn->disconnected)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+http2_input_rst_stream(struct http_client_http2 *h2,
+		       struct http_client_http2_stream *stream,
+		       const struct http2_frame_header *hdr,
+		       const unsigned char *payload)
+{
+	struct http_client_request *req;
+	uint32_t error_code;
+	const char *error;
+
+	if (hdr->length != 4) {
+		http2_connection_error(h2, HTTP2_ERROR_FRAME_SIZE_ERROR,
+				       "Invalid RST_STREAM frame length");
+		return -1;
+	}
+	if (stream == NULL)
+		return 0;
+
+	error_code = be32_to_cpu_unaligned(payload);
+	error = t_strdup_printf("Stream reset by server: %s",
+				http2_error_code_name(error_code));
+	e_debug(h2->conn->event, "Stream %u: %s", stream->id, error);
+
+	stream->reset = TRUE;
+	io_remove(&stream->io_payload_input);
+
+	if (stream->payload_wrapper != NULL) {
+		/* Reading the response payload */
+		if (stream->payload != NULL && !stream->end_stream_received) {
+			http2_payload_istream_set_error(stream->payload,
+							ECONNRESET, error);
+		}
+		return 0;
+	}
+	if (stream->req == NULL) {
+		/* The response was already handled */
+		http2_stream_free(&stream);
+		return 0;
+	}
+
+	req = http2_stream_detach_request(stream);
+	http2_stream_free(&stream);
+	if (req == NULL || req->state >= HTTP_REQUEST_STATE_FINISHED)
+		return 0;
+	if (error_code == HTTP2_ERROR_REFUSED_STREAM) {
+		/* RFC 9113, Section 8.7: The request wasn't processed, so
+		   it can be retried. */
+		http_client_request_resubmit(req);
+	} else {
+		http_client_request_retry(
+			req, HTTP_CLIENT_REQUEST_ERROR_CONNECTION_LOST, error);
+	}
+	return 0;
+}
+
+static int
+http2_input_window_update(struct http_client_http2 *h2,
+			  struct http_client_http2_stream *stream,
+			  const struct http2_frame_header *hdr,
+			  const unsigned char *payload)
+{
+	uint32_t increment;
+
+	if (hdr->length != 4) {
+		http2_connection_error(h2, HTTP2_ERROR_FRAME_SIZE_ERROR,
+				       "Invalid WINDOW_UPDATE frame length");
+		return -1;
+	}
+	increment = be32_to_cpu_unaligned(payload) & HTTP2_MAX_WINDOW_SIZE;
+
+	if (hdr->stream_id == 0) {
+		h2->send_window += increment;
+		if (increment == 0 || h2->send_window > HTTP2_MAX_WINDOW_SIZE) {
+			http2_connection_error(h2,
+				HTTP2_ERROR_FLOW_CONTROL_ERROR,
+				"Invalid connection WINDOW_UPDATE");
+			return -1;
+		}
+	} else if (stream != NULL) {
+		stream->send_window += increment;
+		if (increment == 0 ||
+		    stream->send_window > HTTP2_MAX_WINDOW_SIZE) {
+			http2_stream_error(stream,
+				HTTP2_ERROR_FLOW_CONTROL_ERROR,
+				"Invalid stream WINDOW_UPDATE");
+			return h2->conn->disconnected ? -1 : 0;
+		}
+	}
+	http2_send_payloads(h2);
+	return h2->conn->disconnected ? -1 : 0;
+}
+
+static int
+http2_input_data(struct http_client_http2 *h2,
+		 struct http_client_http2_stream *stream,
+		 const struct http2_frame_header *hdr,
+		 const unsigned char *payload)
+{
+	size_t size = hdr->length;
+
+	/* Flow control covers the whole frame payload including padding */
+	h2->recv_window -= hdr->length;
+	if (h2->recv_window < 0) {
+		http2_connection_error(h2, HTTP2_ERROR_FLOW_CONTROL_ERROR,
+				       "Connection window exceeded");
+		return -1;
+	}
+	h2->recv_unacked += hdr->length;
+	if (h2->recv_unacked >= HTTP2_CLIENT_CONNECTION_WINDOW_SIZE/2) {
+		http2_send_window_update(h2, 0, h2->recv_unacked);
+		h2->recv_window += h2->recv_unacked;
+		h2->recv_unacked = 0;
+	}
+
+	if (http2_frame_strip_padding(hdr, &payload, &size) < 0) {
+		http2_connection_error(h2, HTTP2_ERROR_PROTOCOL_ERROR,
+				       "Invalid DATA frame padding");
+		return -1;
+	}
+	if (stream == NULL) {
+		/* Stream is already closed */
+		return 0;
+	}
+	if (!stream->response_received || stream->end_stream_received) {
+		http2_stream_error(stream, HTTP2_ERROR_PROTOCOL_ERROR,
+				   "Unexpected DATA frame");
+		return h2->conn->disconnected ? -1 : 0;
+	}
+	stream->recv_window -= hdr->length;
+	if (stream->recv_window < 0) {
+		http2_stream_error(stream, HTTP2_ERROR_FLOW_CONTROL_ERROR,
+				   "Stream window exceeded");
+		return h2->conn->disconnected ? -1 : 0;
+	}
+
+	if (stream->req != NULL)
+		stream->req->bytes_in += HTTP2_FRAME_HEADER_SIZE + hdr->length;
+	if (stream->payload != NULL && stream->payload->istream.istream.stream_errno == 0)
+		http2_payload_istream_append(stream->payload, payload, size);
+	else {
+		/* Nobody reads the payload */
+		http2_stream_consumed(stream, size);
+	}
+	/* Padding is consumed immediately */
+	if (hdr->length > size)
+		http2_stream_consumed(stream, hdr->length - size);
+
+	if ((hdr->flags & HTTP2_FRAME_FLAG_END_STREAM) != 0)
+		http2_stream_end_received(stream);
+	return 0;
+}
+
+static int
+http2_input_header_block(struct http_client_http2 *h2)
+{
+	struct http_client_http2_stream *stream;
+	ARRAY_TYPE(http2_hpack_header) fields;
+	struct http_response resp;
+	uint32_t stream_id = h2->header_block_stream_id;
+	bool end_stream = h2->header_block_end_stream;
+	pool_t pool;
+	const char *error;
+	int ret;
+
+	h2->header_block_stream_id = 0;
+
+	/* The header block must be decoded even if the stream is gone to
+	   keep the decoder state in sync */
+	stream = http2_stream_find(h2, stream_id);
+	pool = (stream != NULL ? stream->pool : pool_datastack_create());
+	t_array_init(&fields, 16);
+	ret = http2_hpack_decode(h2->decoder, h2->header_block->data,
+				 h2->header_block->used,
+				 h2->max_header_list_size, pool, &fields,
+				 &error);
+	buffer_set_used_size(h2->header_block, 0);
+	if (ret < 0) {
+		http2_connection_error(h2, HTTP2_ERROR_COMPRESSION_ERROR,
+				       error);
+		return -1;
+	}
+	if (stream == NULL)
+		return 0;
+
+	if (stream->response_received) {
+		/* Trailers are ignored */
+		if (!end_stream) {
+			http2_stream_error(stream, HTTP2_ERROR_PROTOCOL_ERROR,
+					   "Trailers without END_STREAM");
+			return h2->conn->disconnected ? -1 : 0;
+		}
+		http2_stream_end_received(stream);
+		return 0;
+	}
+	if (stream->req == NULL) {
+		/* Response was already handled */
+		return 0;
+	}
+
+	if (http2_response_parse(stream, &fields, &resp, &error) < 0) {
+		http2_stream_error(stream, HTTP2_ERROR_PROTOCOL_ERROR,
+				   t_strdup_printf("Invalid response: %s",
+						   error));
+		return h2->conn->disconnected ? -1 : 0;
+	}
+	if (end_stream)
+		stream->end_stream_received = TRUE;
+	if (http2_stream_response(stream, &resp, end_stream) < 0)
+		return -1;
+	return h2->conn->disconnected ? -1 : 0;
+}
+
+static int
+http2_input_headers(struct http_client_http2 *h2,
+		    const struct http2_frame_header *hdr,
+		    const unsigned char *payload)
+{
+	size_t size = hdr->length;
+
+	if (hdr->type == HTTP2_FRAME_HEADERS) {
+		if (http2_frame_strip_padding(hdr, &payload, &size) < 0) {
+			http2_connection_error(h2, HTTP2_ERROR_PROTOCOL_ERROR,
+				"Invalid HEADERS frame padding");
+			return -1;
+		}
+		if ((hdr->flags & HTTP2_FRAME_FLAG_PRIORITY) != 0) {
+			/* Stream dependency and weight are ignored */
+			if (size < 5) {
+				http2_connection_error(h2,
+					HTTP2_ERROR_FRAME_SIZE_ERROR,
+					"Invalid HEADERS frame length");
+				return -1;
+			}
+			payload += 5;
+			size -= 5;
+		}
+		h2->header_block_stream_id = hdr->stream_id;
+		h2->header_block_end_stream =
+			(hdr->flags & HTTP2_FRAME_FLAG_END_STREAM) != 0;
+	}
+	if (h2->header_block->used + size > h2->max_header_list_size) {
+		http2_connection_error(h2, HTTP2_ERROR_ENHANCE_YOUR_CALM,
+				       "Header block too large");
+		return -1;
+	}
+	buffer_append(h2->header_block, payload, size);
+
+	if ((hdr->flags & HTTP2_FRAME_FLAG_END_HEADERS) == 0)
+		return 0;
+	return http2_input_header_block(h2);
+}
+
+static int
+http2_input_frame(struct http_client_http2 *h2,
+		  const struct http2_frame_header *hdr,
+		  const unsigned char *payload)
+{
+	struct http_client_http2_stream *stream = NULL;
+
+	e_debug(h2->conn->event, "Got %s frame (stream %u, flags 0x%02x, "
+		"length %u)", http2_frame_type_name(hdr->type),
+		hdr->stream_id, hdr->flags, hdr->length);
+
+	if (h2->header_block_stream_id != 0 &&
+	    (hdr->type != HTTP2_FRAME_CONTINUATION ||
+	     hdr->stream_id != h2->header_block_stream_id)) {
+		http2_connection_error(h2, HTTP2_ERROR_PROTOCOL_ERROR,
+				       "Expected CONTINUATION frame");
+		return -1;
+	}
+	if (!h2->settings_received && hdr->type != HTTP2_FRAME_SETTINGS) {
+		http2_connection_error(h2, HTTP2_ERROR_PROTOCOL_ERROR,
+				       "Server preface is not SETTINGS");
+		return -1;
+	}
+
+	switch (hdr->type) {
+	case HTTP2_FRAME_SETTINGS:
+		return http2_input_settings(h2, hdr, payload);
+	case HTTP2_FRAME_PING:
+		return http2_input_ping(h2, hdr, payload);
+	case HTTP2_FRAME_GOAWAY:
+		return http2_input_goaway(h2, hdr, payload);
+	case HTTP2_FRAME_WINDOW_UPDATE:
+		if (hdr->stream_id == 0)
+			return http2_input_window_update(h2, NULL, hdr, payload);
+		break;
+	case HTTP2_FRAME_PUSH_PROMISE:
+		http2_connection_error(h2, HTTP2_ERROR_PROTOCOL_ERROR,
+				       "PUSH_PROMISE while push is disabled");
+		return -1;
+	case HTTP2_FRAME_DATA:
+	case HTTP2_FRAME_HEADERS:
+	case HTTP2_FRAME_CONTINUATION:
+	case HTTP2_FRAME_RST_STREAM:
+	case HTTP2_FRAME_PRIORITY:
+		break;
+	default:
+		/* Unknown frame types are ignored */
+		return 0;
+	}
+
+	/* Stream frames */
+	if (hdr->stream_id == 0) {
+		http2_connection_error(h2, HTTP2_ERROR_PROTOCOL_ERROR,
+			t_strdup_printf("%s frame without stream",
+					http2_frame_type_name(hdr->type)));
+		return -1;
+	}
+	if ((hdr->stream_id % 2) == 0 ||
+	    hdr->stream_id >= h2->next_stream_id) {
+		/* Server can't open streams */
+		http2_connection_error(h2, HTTP2_ERROR_PROTOCOL_ERROR,
+			t_strdup_printf("%s frame on idle stream %u",
+					http2_frame_type_name(hdr->type),
+					hdr->stream_id));
+		return -1;
+	}
+	/* Frames on closed streams are mostly ignored */
+	stream = http2_stream_find(h2, hdr->stream_id);
+
+	switch (hdr->type) {
+	case HTTP2_FRAME_DATA:
+		return http2_input_data(h2, stream, hdr, payload);
+	case HTTP2_FRAME_HEADERS:
+	case HTTP2_FRAME_CONTINUATION:
+		if (hdr->type == HTTP2_FRAME_CONTINUATION &&
+		    h2->header_block_stream_id == 0) {
+			http2_connection_error(h2, HTTP2_ERROR_PROTOCOL_ERROR,
+				"Unexpected CONTINUATION frame");
+			return -1;
+		}
+		return http2_input_headers(h2, hdr, payload);
+	case HTTP2_FRAME_RST_STREAM:
+		return http2_input_rst_stream(h2, stream, hdr, payload);
+	case HTTP2_FRAME_WINDOW_UPDATE:
+		return http2_input_window_update(h2, stream, hdr, payload);
+	case HTTP2_FRAME_PRIORITY:
+		return 0;
+	default:
+		break;
+	}
+	i_unreached();
+}
+
+static void http2_input(struct http_client_http2 *h2)
+{
+	struct http_client_connection *conn = h2->conn;
+	struct istream *input = conn->conn.input;
+	struct http2_frame_header hdr;
+	const unsigned char *data;
+	size_t size;
+	ssize_t ret;
+	int stream_errno;
+
+	timeout_remove(&h2->to_finished);
+
+	/* We've seen activity from the server; reset request timeout */
+	http_client_connection_reset_request_timeout(conn);
+
+	o_stream_cork(conn->conn.output);
+	for (;;) {
+		data = i_stream_get_data(input, &size);
+		if (size >= HTTP2_FRAME_HEADER_SIZE) {
+			http2_frame_header_parse(data, &hdr);
+			if (hdr.length > HTTP2_DEFAULT_MAX_FRAME_SIZE) {
+				/* We never raise SETTINGS_MAX_FRAME_SIZE */
+				http2_connection_error(h2,
+					HTTP2_ERROR_FRAME_SIZE_ERROR,
+					"Frame too large");
+				return;
+			}
+			if (size >= HTTP2_FRAME_HEADER_SIZE + hdr.length) {
+				T_BEGIN {
+					ret = http2_input_frame(h2, &hdr,
+						data + HTTP2_FRAME_HEADER_SIZE);
+				} T_END;
+				if (ret < 0 || conn->disconnected)
+					return;
+				i_stream_skip(input, HTTP2_FRAME_HEADER_SIZE +
+					      hdr.length);
+				continue;
+			}
+		}
+
+		if ((ret = i_stream_read(input)) > 0)
+			continue;
+		if (ret == 0)
+			break;
+		i_assert(ret == -1);
+
+		stream_errno = input->stream_errno;
+		http_client_connection_lost(
+			&conn,
+			t_strdup_printf("read(%s) failed: %s",
+					i_stream_get_name(input),
+					(stream_errno != 0 ?
+					 i_stream_get_error(input) : "EOF")));
+		return;
+	}
+
+	if (o_stream_uncork_flush(conn->conn.output) < 0) {
+		http_client_connection_handle_output_error(conn);
+		return;
+	}
+
+	if (conn->close_indicated && array_count(&h2->streams) == 0) {
+		/* GOAWAY was received and all the remaining streams are
+		   finished */
+		http_client_connection_server_close(&conn);
+		return;
+	}
+
+	if (h2->streams_finished) {
+		h2->streams_finished = FALSE;
+		/* Room for new requests */
+		if (conn->peer != NULL &&
+		    http_client_connection_check_ready(conn) > 0)
+			http_client_peer_trigger_request_handler(conn->peer);
+	}
+}
+
+void http_client_connection_http2_input(struct http_client_connection *conn)
+{
+	http_client_connection_ref(conn);
+	http2_input(conn->http2);
+	http_client_connection_unref(&conn);
+}
+
+/*
+ * Connection
+ */
+
+void http_client_connection_http2_init(struct http_client_connection *conn)
+{
+	const struct http_client_settings *set = conn->set;
+	struct http_client_http2 *h2;
+	buffer_t *buf;
+
+	e_debug(conn->event, "Using HTTP/2");
+
+	h2 = i_new(struct http_client_http2, 1);
+	h2->conn = conn;
+	h2->encoder = http2_hpack_encoder_init(HTTP2_HPACK_DEFAULT_TABLE_SIZE,
+					       TRUE);
+	h2->decoder = http2_hpack_decoder_init(HTTP2_HPACK_DEFAULT_TABLE_SIZE);
+	i_array_init(&h2->streams, 16);
+	h2->next_stream_id = 1;
+	h2->header_block = buffer_create_dynamic(default_pool, 1024);
+
+	/* Defaults until the server's SETTINGS are received */
+	h2->max_concurrent_streams = UINT32_MAX;
+	h2->initial_window_size = HTTP2_DEFAULT_WINDOW_SIZE;
+	h2->max_frame_size = HTTP2_DEFAULT_MAX_FRAME_SIZE;
+	h2->send_window = HTTP2_DEFAULT_WINDOW_SIZE;
+	h2->recv_window = HTTP2_CLIENT_CONNECTION_WINDOW_SIZE;
+	h2->max_header_list_size = set->response_hdr_max_size > 0 ?
+		set->response_hdr_max_size :
+		HTTP_REQUEST_DEFAULT_MAX_HEADER_SIZE;
+
+	conn->http2 = h2;
+	conn->ppool->http2 = TRUE;
+
+	o_stream_set_no_error_handling(conn->conn.output, TRUE);
+	o_stream_set_flush_callback(conn->conn.output, http2_output, h2);
+
+	/* Connection preface */
+	buf = t_buffer_create(128);
+	buffer_append(buf, HTTP2_CONNECTION_PREFACE,
+		      HTTP2_CONNECTION_PREFACE_LEN);
+	http2_frame_header_append(buf, HTTP2_FRAME_SETTINGS, 0, 0,
+				  HTTP2_SETTING_SIZE * 3);
+	http2_frame_setting_append(buf, HTTP2_SETTING_ENABLE_PUSH, 0);
+	http2_frame_setting_append(buf, HTTP2_SETTING_MAX_CONCURRENT_STREAMS,
+				   0);
+	http2_frame_setting_append(buf, HTTP2_SETTING_INITIAL_WINDOW_SIZE,
+				   HTTP2_CLIENT_STREAM_WINDOW_SIZE);
+	http2_frame_append_window_update(
+		buf, 0, HTTP2_CLIENT_CONNECTION_WINDOW_SIZE -
+			HTTP2_DEFAULT_WINDOW_SIZE);
+	http2_send(h2, buf);
+	(void)http2_flush(h2);
+}
+
+void http_client_connection_http2_deinit(struct http_client_connection *conn)
+{
+	struct http_client_http2 *h2 = conn->http2;
+	struct http_client_http2_stream *stream;
+	struct http_client_request *req, *req_ref;
+
+	conn->http2 = NULL;
+	if (h2 == NULL)
+		return;
+
+	/* Requests still in request_wait_list are retried or aborted by the
+	   caller. Only the response payloads are handled here. */
+	while (array_count(&h2->streams) > 0) {
+		stream = array_idx_elem(&h2->streams, 0);
+		stream->reset = TRUE;
+		if (stream->in_callback) {
+			/* The response callback is still running; the request
+			   is released once it returns. */
+			if (stream->payload_wrapper != NULL) {
+				i_stream_remove_destroy_callback(
+					stream->payload_wrapper,
+					http2_payload_destroyed);
+				stream->payload_wrapper = NULL;
+			}
+			if (stream->payload != NULL &&
+			    !stream->end_stream_received) {
+				http2_payload_istream_set_error(
+					stream->payload, EPIPE,
+					"Connection lost");
+			}
+		} else if (stream->payload_wrapper != NULL) {
+			/* The stream is still accessed by lib-http caller. */
+			i_stream_remove_destroy_callback(
+				stream->payload_wrapper,
+				http2_payload_destroyed);
+			stream->payload_wrapper = NULL;
+			if (stream->payload != NULL &&
+			    !stream->end_stream_received) {
+				http2_payload_istream_set_error(
+					stream->payload, EPIPE,
+					"Connection lost");
+			}
+			req = req_ref = stream->req;
+			stream->req = NULL;
+			if (http_client_connection_unref_request(conn,
+								 &req_ref)) {
+				http_client_request_error(
+					&req, HTTP_CLIENT_REQUEST_ERROR_ABORTED,
+					"Aborting");
+			}
+		}
+		http2_stream_free(&stream);
+	}
+
+	timeout_remove(&h2->to_finished);
+	http2_hpack_encoder_deinit(&h2->encoder);
+	http2_hpack_decoder_deinit(&h2->decoder);
+	buffer_free(&h2->header_block);
+	array_free(&h2->streams);
+	i_free(h2);
+}
+
+void http_client_connection_http2_switch_ioloop(
+	struct http_client_connection *conn, struct ioloop *ioloop)
+{
+	struct http_client_http2 *h2 = conn->http2;
+	struct http_client_http2_stream *stream;
+
+	array_foreach_elem(&h2->streams, stream) {
+		if (stream->io_payload_input != NULL) {
+			stream->io_payload_input = io_loop_move_io_to(
+				ioloop, &stream->io_payload_input);
+		}
+		if (stream->payload_wrapper != NULL) {
+			i_stream_switch_ioloop_to(stream->payload_wrapper,
+						  ioloop);
+		}
+	}
+	if (h2->to_finished != NULL) {
+		h2->to_finished =
+			io_loop_move_timeout_to(ioloop, &h2->to_finished);
+	}
+}
@@ -34,26 +34,6 @@ http_client_connection_get_settings(struct http_client_connection *conn)
 	return conn->set;
 }
 
-static inline void
-http_client_connection_ref_request(struct http_client_connection *conn,
-				   struct http_client_request *req)
-{
-	i_assert(req->conn == NULL);
-	req->conn = conn;
-	http_client_request_ref(req);
-}
-
-static inline bool
-http_client_connection_unref_request(struct http_client_connection *conn,
-				     struct http_client_request **_req)
-{
-	struct http_client_request *req = *_req;
-
-	i_assert(req->conn == conn);
-	req->conn = NULL;
-	return http_client_request_unref(_req);
-}
-
 static void
 http_client_connection_unlist_pending(struct http_client_connection *conn)
 {
@@ -82,6 +62,7 @@ http_client_connection_failure(struct http_client_connection *conn,
 	struct http_client_peer *peer = conn->peer;
 
 	conn->connect_failed = TRUE;
+	conn->ppool->connections_failed++;
 	http_client_connection_unlist_pending(conn);
 	http_client_peer_connection_failure(peer, reason);
 }
@@ -89,8 +70,12 @@ http_client_connection_failure(struct http_client_connection *conn,
 unsigned int
 http_client_connection_count_pending(struct http_client_connection *conn)
 {
-	unsigned int pending_count = array_count(&conn->request_wait_list);
+	unsigned int pending_count;
 
+	if (conn->http2 != NULL)
+		return http_client_connection_http2_count_streams(conn);
+
+	pending_count = array_count(&conn->request_wait_list);
 	if (conn->in_req_callback || conn->pending_request != NULL)
 		pending_count++;
 	return pending_count;
@@ -106,6 +91,9 @@ bool http_client_connection_is_active(struct http_client_connection *conn)
 	if (!conn->connected)
 		return FALSE;
 
+	if (conn->http2 != NULL)
+		return http_client_connection_http2_count_streams(conn) > 0;
+
 	if (conn->in_req_callback || conn->pending_request != NULL)
 		return TRUE;
 
@@ -136,8 +124,7 @@ http_client_connection_retry_requests(struct http_client_connection *conn,
 	array_clear(&conn->request_wait_list);
 }
 
-static void
-http_client_connection_server_close(struct http_client_connection **_conn)
+void http_client_connection_server_close(struct http_client_connection **_conn)
 {
 	struct http_client_connection *conn = *_conn;
 	struct http_client_peer *peer = conn->peer;
@@ -166,9 +153,8 @@ http_client_connection_server_close(struct http_client_connection **_conn)
 	http_client_connection_close(_conn);
 }
 
-static void
-http_client_connection_abort_error(struct http_client_connection **_conn,
-				   unsigned int status, const char *error)
+void http_client_connection_abort_error(struct http_client_connection **_conn,
+					unsigned int status, const char *error)
 {
 	struct http_client_connection *conn = *_conn;
 	struct http_client_request *req, **req_idx;
@@ -319,11 +305,28 @@ void http_client_connection_handle_output_error(
 	}
 }
 
-int http_client_connection_check_ready(struct http_client_connection *conn)
+static unsigned int
+http_client_connection_max_pipelined(struct http_client_connection *conn)
 {
-	const struct http_client_settings *set =
-		http_client_connection_get_settings(conn);
+	struct http_client_request *req;
+	unsigned int max_pipelined = UINT_MAX;
+
+	if (conn->http2 != NULL)
+		return http_client_connection_http2_max_streams(conn);
+
+	/* Each request limits how many requests can be pipelined on the
+	   connection while it's waiting for its response. */
+	array_foreach_elem(&conn->request_wait_list, req)
+		max_pipelined = I_MIN(max_pipelined, req->max_pipelined);
+	if (conn->pending_request != NULL) {
+		max_pipelined = I_MIN(max_pipelined,
+				      conn->pending_request->max_pipelined);
+	}
+	return max_pipelined;
+}
 
+int http_client_connection_check_ready(struct http_client_connection *conn)
+{
 	if (conn->in_req_callback) {
 		/* This can happen when a nested ioloop is created inside
 		   request callback. we currently don't reuse connections that
@@ -336,7 +339,7 @@ int http_client_connection_check_ready(struct http_client_connection *conn)
 	if (!conn->connected || conn->output_locked || conn->output_broken ||
 	    conn->close_indicated || conn->tunneling ||
 	    (http_client_connection_count_pending(conn) >=
-	     set->max_pipelined_requests))
+	     http_client_connection_max_pipelined(conn)))
 		return 0;
 
 	if (conn->last_ioloop != NULL && conn->last_ioloop != current_ioloop) {
@@ -395,11 +398,22 @@ http_client_connection_detach_peer(struct http_client_connection *conn)
 static void
 http_client_connection_idle_timeout(struct http_client_connection *conn)
 {
-	e_debug(conn->event, "Idle connection timed out");
+	const struct http_client_settings *set =
+		http_client_connection_get_settings(conn);
 
 	/* Cannot get here unless connection was established at some point */
 	i_assert(conn->connect_succeeded);
 
+	if (array_count(&conn->ppool->conns) <= set->min_idle_connections) {
+		/* Other connections were closed since the timeout was set */
+		e_debug(conn->event, "Idle connection timed out; "
+			"keeping it open (http_client_min_idle_connections=%u)",
+			set->min_idle_connections);
+		timeout_remove(&conn->to_idle);
+		return;
+	}
+
+	e_debug(conn->event, "Idle connection timed out");
 	http_client_connection_close(&conn);
 }
 
@@ -418,6 +432,8 @@ http_client_connection_start_idle_timeout(struct http_client_connection *conn)
 		return UINT_MAX;
 
 	count = array_count(&ppool->conns);
+	if (count <= set->min_idle_connections)
+		return UINT_MAX;
 	idle_count = array_count(&ppool->idle_conns);
 	max = http_client_peer_shared_max_connections(pshared);
 	i_assert(count > 0);
@@ -621,12 +637,58 @@ http_client_connection_continue_timeout(struct http_client_connection *conn)
 		o_stream_set_flush_pending(conn->conn.output, TRUE);
 }
 
+static int
+http_client_connection_next_request_http2(struct http_client_connection *conn)
+{
+	struct http_client_connection *tmp_conn;
+	struct http_client_request *req;
+	bool multiplexed;
+	int ret;
+
+	/* Requests are multiplexed as independent streams, so there's no
+	   head-of-line blocking to protect urgent requests from. */
+	multiplexed = (http_client_connection_http2_count_streams(conn) > 0);
+	req = http_client_peer_claim_request(conn->peer, 0);
+	if (req == NULL)
+		return 0;
+
+	i_assert(req->state == HTTP_REQUEST_STATE_QUEUED);
+
+	http_client_connection_stop_idle(conn);
+
+	/* No Expect: 100-continue; the server can reset the stream instead
+	   of reading the payload */
+	req->payload_sync = FALSE;
+	req->payload_sync_continue = FALSE;
+
+	/* Add request to wait list and add a reference */
+	array_push_back(&conn->request_wait_list, &req);
+	http_client_connection_ref_request(conn, req);
+
+	e_debug(conn->event, "Claimed request %s",
+		http_client_request_label(req));
+
+	conn->ppool->requests_sent++;
+	if (conn->requests_sent++ > 0)
+		conn->ppool->requests_reused_connection++;
+	if (multiplexed)
+		conn->ppool->requests_pipelined++;
+
+	tmp_conn = conn;
+	http_client_connection_ref(tmp_conn);
+	ret = http_client_connection_http2_send_request(conn, req);
+	if (!http_client_connection_unref(&tmp_conn) || ret < 0)
+		return -1;
+	return 1;
+}
+
 int http_client_connection_next_request(struct http_client_connection *conn)
 {
 	struct http_client_connection *tmp_conn;
 	struct http_client_peer *peer = conn->peer;
 	struct http_client_peer_shared *pshared = conn->ppool->peer;
 	struct http_client_request *req = NULL;
+	unsigned int pending_count;
 	bool pipelined;
 	int ret;
 
@@ -636,10 +698,14 @@ int http_client_connection_next_request(struct http_client_connection *conn)
 		return ret;
 	}
 
+	if (conn->http2 != NULL)
+		return http_client_connection_next_request_http2(conn);
+
 	/* Claim request, but no urgent request can be second in line */
+	pending_count = http_client_connection_count_pending(conn);
 	pipelined = (array_count(&conn->request_wait_list) > 0 ||
 		     conn->pending_request != NULL);
-	req = http_client_peer_claim_request(peer, pipelined);
+	req = http_client_peer_claim_request(peer, pending_count);
 	if (req == NULL)
 		return 0;
 
@@ -658,6 +724,12 @@ int http_client_connection_next_request(struct http_client_connection *conn)
 	e_debug(conn->event, "Claimed request %s",
 		http_client_request_label(req));
 
+	conn->ppool->requests_sent++;
+	if (conn->requests_sent++ > 0)
+		conn->ppool->requests_reused_connection++;
+	if (pipelined)
+		conn->ppool->requests_pipelined++;
+
 	tmp_conn = conn;
 	http_client_connection_ref(tmp_conn);
 	ret = http_client_request_send(req, pipelined);
@@ -807,6 +879,10 @@ void http_client_connection_request_destroyed(
 	struct istream *payload;
 
 	i_assert(req->conn == conn);
+	if (conn->http2 != NULL) {
+		http_client_connection_http2_request_destroyed(conn, req);
+		return;
+	}
 	if (conn->pending_request != req)
 		return;
 
@@ -925,10 +1001,9 @@ http_client_connection_return_response(struct http_client_connection *conn,
 	return FALSE;
 }
 
-static bool
-http_client_connection_handle_response(struct http_client_connection *conn,
-				       struct http_client_request *req,
-				       struct http_response *resp)
+bool http_client_connection_handle_response(struct http_client_connection *conn,
+					    struct http_client_request *req,
+					    struct http_response *resp)
 {
 	struct http_client_peer_shared *pshared = conn->ppool->peer;
 
@@ -970,8 +1045,9 @@ http_client_connection_handle_response(struct http_client_connection *conn,
 		if (http_client_request_try_retry(req))
 			return TRUE;
 		/* Connection close is implicit, although server should indicate
-		   that explicitly */
-		conn->close_indicated = TRUE;
+		   that explicitly. With HTTP/2 only the stream is closed. */
+		if (conn->http2 == NULL)
+			conn->close_indicated = TRUE;
 	}
 	return FALSE;
 }
@@ -1117,6 +1193,11 @@ static void http_client_connection_input(struct connection *_conn)
 		http_client_connection_ready(conn);
 	}
 
+	if (conn->http2 != NULL) {
+		http_client_connection_http2_input(conn);
+		return;
+	}
+
 	if (conn->to_input != NULL) {
 		/* We came here from a timeout added by
 		   http_client_payload_destroyed(). The IO couldn't be added
@@ -1319,6 +1400,31 @@ void http_client_connection_start_tunnel(struct http_client_connection **_conn,
 	http_client_connection_unref(_conn);
 }
 
+static bool
+http_client_connection_use_http2(struct http_client_connection *conn)
+{
+	struct http_client_peer_shared *pshared = conn->ppool->peer;
+	const struct http_client_settings *set =
+		http_client_connection_get_settings(conn);
+	const char *proto;
+
+	if (conn->ssl_iostream != NULL) {
+		/* Negotiated with ALPN */
+		proto = ssl_iostream_get_application_protocol(
+			conn->ssl_iostream);
+		return (proto != NULL && strcmp(proto, "h2") == 0);
+	}
+
+	/* Plaintext HTTP/2 requires prior knowledge (RFC 9113, Section 3.3).
+	   It isn't used through proxies, which may not support it. */
+	if (!set->http2_prior_knowledge || set->parsed_proxy_url != NULL ||
+	    (set->proxy_socket_path != NULL &&
+	     set->proxy_socket_path[0] != '\0'))
+		return FALSE;
+	return (pshared->addr.type == HTTP_CLIENT_PEER_ADDR_HTTP ||
+		pshared->addr.type == HTTP_CLIENT_PEER_ADDR_UNIX);
+}
+
 static void http_client_connection_ready(struct http_client_connection *conn)
 {
 	struct http_client_peer *peer = conn->peer;
@@ -1351,7 +1457,7 @@ static void http_client_connection_ready(struct http_client_connection *conn)
 	if (pshared->addr.type == HTTP_CLIENT_PEER_ADDR_RAW) {
 		struct http_client_request *req;
 
-		req = http_client_peer_claim_request(conn->peer, FALSE);
+		req = http_client_peer_claim_request(conn->peer, 0);
 		if (req != NULL) {
 			struct http_response response;
 
@@ -1375,6 +1481,11 @@ static void http_client_connection_ready(struct http_client_connection *conn)
 	}
 
 	/* Start protocol I/O */
+	if (http_client_connection_use_http2(conn)) {
+		o_stream_set_finish_via_child(conn->conn.output, FALSE);
+		http_client_connection_http2_init(conn);
+		return;
+	}
 	struct http_header_limits limits = {
 		.max_size = set->response_hdr_max_size,
 		.max_field_size = set->response_hdr_max_field_size,
@@ -1696,6 +1807,10 @@ http_client_connection_create(struct http_client_peer *peer)
 	array_push_back(&peer->pending_conns, &conn);
 	array_push_back(&peer->conns, &conn);
 
+	ppool->connections_created++;
+	ppool->connections_max = I_MAX(ppool->connections_max,
+				       array_count(&ppool->conns));
+
 	http_client_peer_pool_ref(ppool);
 
 	e_debug(conn->event,
@@ -1737,6 +1852,7 @@ http_client_connection_disconnect(struct http_client_connection *conn)
 
 	if (conn->http_parser != NULL)
 		http_response_parser_deinit(&conn->http_parser);
+	http_client_connection_http2_deinit(conn);
 
 	connection_disconnect(&conn->conn);
 
@@ -1841,6 +1957,8 @@ void http_client_connection_switch_ioloop(struct http_client_connection *conn)
 	}
 	if (conn->incoming_payload != NULL)
 		i_stream_switch_ioloop_to(conn->incoming_payload, ioloop);
+	if (conn->http2 != NULL)
+		http_client_connection_http2_switch_ioloop(conn, ioloop);
 	conn->io_wait_timer =
 		io_wait_timer_move_to(&conn->io_wait_timer, ioloop);
 }
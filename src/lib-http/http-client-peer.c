@@ -173,6 +173,32 @@ void http_client_peer_pool_unref(struct http_client_peer_pool **_ppool)
 	e_debug(ppool->event, "Peer pool destroy");
 	ppool->destroyed = TRUE;
 
+	if (ppool->connections_created > 0) {
+		struct event_passthrough *e =
+			event_create_passthrough(ppool->event)->
+			set_name("http_client_pool_finished")->
+			add_int("connections_created",
+				ppool->connections_created)->
+			add_int("connections_warmed",
+				ppool->connections_warmed)->
+			add_int("connections_failed",
+				ppool->connections_failed)->
+			add_int("connections_max", ppool->connections_max)->
+			add_int("requests_sent", ppool->requests_sent)->
+			add_int("requests_reused_connection",
+				ppool->requests_reused_connection)->
+			add_int("requests_pipelined",
+				ppool->requests_pipelined);
+		e_debug(e->event(), "Peer pool finished: "
+			"%u connections created (%u warmed, %u failed, "
+			"max %u parallel), %u requests sent "
+			"(%u on reused connections, %u pipelined)",
+			ppool->connections_created, ppool->connections_warmed,
+			ppool->connections_failed, ppool->connections_max,
+			ppool->requests_sent, ppool->requests_reused_connection,
+			ppool->requests_pipelined);
+	}
+
 	i_assert(array_count(&ppool->idle_conns) == 0);
 	i_assert(array_count(&ppool->conns) == 0);
 	array_free(&ppool->idle_conns);
@@ -909,6 +935,7 @@ http_client_peer_handle_requests_real(struct http_client_peer *peer)
 	};
 	struct http_client_connection *const *conn_idx;
 	ARRAY(struct _conn_available) conns_avail;
+	ARRAY_TYPE(http_client_connection) conns_http2;
 	struct _conn_available *conn_avail_idx;
 	struct http_client_peer_shared *pshared = peer->shared;
 	unsigned int connecting, closing, idle;
@@ -955,10 +982,12 @@ http_client_peer_handle_requests_real(struct http_client_peer *peer)
 	http_client_peer_ref(peer);
 	peer->handling_requests = TRUE;
 	t_array_init(&conns_avail, array_count(&peer->conns));
+	t_array_init(&conns_http2, array_count(&peer->conns));
 	do {
 		bool conn_lost = FALSE;
 
 		array_clear(&conns_avail);
+		array_clear(&conns_http2);
 		closing = idle = 0;
 
 		/* Gather connection statistics */
@@ -970,6 +999,9 @@ http_client_peer_handle_requests_real(struct http_client_peer *peer)
 			if (ret < 0) {
 				conn_lost = TRUE;
 				break;
+			} else if (ret > 0 && conn->http2 != NULL) {
+				/* Multiplexed connections are filled first */
+				array_push_back(&conns_http2, &conn);
 			} else if (ret > 0) {
 				struct _conn_available *conn_avail;
 				unsigned int insert_idx, pending_requests;
@@ -1006,6 +1038,34 @@ http_client_peer_handle_requests_real(struct http_client_peer *peer)
 		working_conn_count = array_count(&peer->conns) - closing;
 		statistics_dirty = FALSE;
 
+		/* Send as many requests as the servers allow as concurrent
+		   streams on HTTP/2 connections */
+		array_foreach(&conns_http2, conn_idx) {
+			unsigned int handled = 0;
+			int ret = 1;
+
+			while (num_pending > 0 &&
+			       (ret = http_client_connection_next_request(
+					*conn_idx)) > 0) {
+				if (num_urgent > 0)
+					num_urgent--;
+				num_pending--;
+				handled++;
+			}
+			if (ret < 0) {
+				/* Connection error/closed */
+				statistics_dirty = TRUE;
+				break;
+			}
+			if (handled > 0) {
+				e_debug(peer->event,
+					"Multiplexed %u requests on HTTP/2 "
+					"connection", handled);
+			}
+		}
+		if (statistics_dirty)
+			continue;
+
 		/* Use idle connections right away */
 		if (idle > 0) {
 			e_debug(peer->event,
@@ -1058,7 +1118,11 @@ http_client_peer_handle_requests_real(struct http_client_peer *peer)
 	connecting = array_count(&peer->pending_conns);
 
 	/* Determine how many new connections we can set up */
-	if (pshared->last_failure.tv_sec > 0 && working_conn_count > 0 &&
+	if (peer->ppool->http2 && working_conn_count > connecting) {
+		/* A single HTTP/2 connection is used for all requests
+		   (RFC 9113, Section 9.1) */
+		new_connections = 0;
+	} else if (pshared->last_failure.tv_sec > 0 && working_conn_count > 0 &&
 	    working_conn_count == connecting) {
 		/* Don't create new connections until the existing ones have
 		   finished connecting successfully. */
@@ -1218,14 +1282,15 @@ void http_client_peer_unlink_queue(struct http_client_peer *peer,
 }
 
 struct http_client_request *
-http_client_peer_claim_request(struct http_client_peer *peer, bool no_urgent)
+http_client_peer_claim_request(struct http_client_peer *peer,
+			       unsigned int pending_count)
 {
 	struct http_client_queue *queue;
 	struct http_client_request *req;
 
 	array_foreach_elem(&peer->queues, queue) {
 		req = http_client_queue_claim_request(
-			queue, &peer->shared->addr, no_urgent);
+			queue, &peer->shared->addr, pending_count);
 		if (req != NULL) {
 			req->peer = peer;
 			return req;
@@ -1235,6 +1300,32 @@ http_client_peer_claim_request(struct http_client_peer *peer, bool no_urgent)
 	return NULL;
 }
 
+static void http_client_peer_warm_connections(struct http_client_peer *peer)
+{
+	const struct http_client_settings *set = peer->client->set;
+	struct http_client_peer_pool *ppool = peer->ppool;
+	unsigned int i, count;
+
+	if (peer->shared->addr.type == HTTP_CLIENT_PEER_ADDR_RAW ||
+	    array_count(&peer->queues) == 0)
+		return;
+
+	/* Connections that are still connecting and idle connections
+	   of other peers in the pool also count, since they can be claimed
+	   for requests just as well. */
+	count = array_count(&ppool->conns);
+	if (count >= set->min_idle_connections)
+		return;
+
+	e_debug(peer->event, "Warming connection pool: "
+		"Making %u new connections (%u connections exist)",
+		set->min_idle_connections - count, count);
+	for (i = count; i < set->min_idle_connections; i++) T_BEGIN {
+		(void)http_client_connection_create(peer);
+		ppool->connections_warmed++;
+	} T_END;
+}
+
 void http_client_peer_connection_success(struct http_client_peer *peer)
 {
 	struct http_client_peer_pool *ppool = peer->ppool;
@@ -1249,6 +1340,10 @@ void http_client_peer_connection_success(struct http_client_peer *peer)
 	array_foreach_elem(&peer->queues, queue)
 		http_client_queue_connection_success(queue, peer);
 
+	/* The peer is now known to be reachable, so the rest of the
+	   connections can be made without waiting for requests. */
+	http_client_peer_warm_connections(peer);
+
 	http_client_peer_trigger_request_handler(peer);
 }
 
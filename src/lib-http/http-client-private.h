@@ -17,6 +17,7 @@
 #define HTTP_CLIENT_DEFAULT_BACKOFF_MAX_TIME_MSECS (1000*60)
 #define HTTP_CLIENT_DEFAULT_DNS_TTL_MSECS (1000*60*30)
 #define HTTP_CLIENT_MIN_IDLE_TIMEOUT_MSECS 50
+#define HTTP_CLIENT_DEFAULT_HTTP2_MAX_CONCURRENT_STREAMS 100
 
 /*
  * Types
@@ -123,6 +124,9 @@ struct http_client_request {
 	unsigned int timeout_msecs;
 	unsigned int attempt_timeout_msecs;
 	unsigned int max_attempts;
+	/* Maximum number of requests waiting for a response on the connection
+	   this request is sent on, including this request */
+	unsigned int max_pipelined;
 
 	uoff_t response_offset, request_offset;
 	uoff_t bytes_in, bytes_out;
@@ -183,6 +187,8 @@ struct http_client_connection {
 
 	struct ssl_iostream *ssl_iostream;
 	struct http_response_parser *http_parser;
+	/* HTTP/2 state, when negotiated for this connection */
+	struct http_client_http2 *http2;
 	struct timeout *to_connect, *to_input, *to_idle, *to_response;
 	struct timeout *to_requests;
 
@@ -194,6 +200,8 @@ struct http_client_connection {
 
 	/* Requests that have been sent, waiting for response */
 	ARRAY_TYPE(http_client_request) request_wait_list;
+	/* Number of requests sent on this connection */
+	unsigned int requests_sent;
 
 	bool connected:1;           /* Connection is connected */
 	bool idle:1;		    /* Connection is idle */
@@ -260,7 +268,17 @@ struct http_client_peer_pool {
 	char *rawlog_dir;
 	struct pcap_output *pcap_output;
 
+	/* Statistics sent with the http_client_pool_finished event */
+	unsigned int connections_created;
+	unsigned int connections_warmed;
+	unsigned int connections_failed;
+	unsigned int connections_max;
+	unsigned int requests_sent;
+	unsigned int requests_reused_connection;
+	unsigned int requests_pipelined;
+
 	bool destroyed:1;         /* Peer pool is being destroyed */
+	bool http2:1;             /* Connections use HTTP/2 */
 };
 
 struct http_client_peer {
@@ -533,6 +551,9 @@ void http_client_connection_close(struct http_client_connection **_conn);
 
 void http_client_connection_lost(struct http_client_connection **_conn,
 				 const char *error) ATTR_NULL(2);
+void http_client_connection_server_close(struct http_client_connection **_conn);
+void http_client_connection_abort_error(struct http_client_connection **_conn,
+					unsigned int status, const char *error);
 
 void http_client_connection_peer_closed(struct http_client_connection **_conn);
 void http_client_connection_request_destroyed(
@@ -560,6 +581,58 @@ void http_client_connection_start_tunnel(struct http_client_connection **_conn,
 void http_client_connection_lost_peer(struct http_client_connection *conn);
 void http_client_connection_claim_idle(struct http_client_connection *conn,
 				       struct http_client_peer *peer);
+/* Returns TRUE if the response was handled internally (e.g. the request is
+   retried or redirected). */
+bool http_client_connection_handle_response(struct http_client_connection *conn,
+					    struct http_client_request *req,
+					    struct http_response *resp);
+
+static inline void
+http_client_connection_ref_request(struct http_client_connection *conn,
+				   struct http_client_request *req)
+{
+	i_assert(req->conn == NULL);
+	req->conn = conn;
+	http_client_request_ref(req);
+}
+
+static inline bool
+http_client_connection_unref_request(struct http_client_connection *conn,
+				     struct http_client_request **_req)
+{
+	struct http_client_request *req = *_req;
+
+	i_assert(req->conn == conn);
+	req->conn = NULL;
+	return http_client_request_unref(_req);
+}
+
+/* HTTP/2 */
+
+void http_client_connection_http2_init(struct http_client_connection *conn);
+/* Safe to call also when HTTP/2 isn't used. */
+void http_client_connection_http2_deinit(struct http_client_connection *conn);
+void http_client_connection_http2_input(struct http_client_connection *conn);
+void http_client_connection_http2_switch_ioloop(
+	struct http_client_connection *conn, struct ioloop *ioloop);
+
+/* Send the request on a new stream. The request must already be in
+   request_wait_list. Returns -1 if the connection was lost. */
+int http_client_connection_http2_send_request(
+	struct http_client_connection *conn, struct http_client_request *req);
+/* End the request payload sent with http_client_request_send_payload(). */
+int http_client_connection_http2_finish_payload(
+	struct http_client_connection *conn, struct http_client_request *req);
+void http_client_connection_http2_request_destroyed(
+	struct http_client_connection *conn, struct http_client_request *req);
+
+/* Returns the number of open streams */
+unsigned int
+http_client_connection_http2_count_streams(struct http_client_connection *conn);
+/* Returns the maximum number of concurrent streams allowed by both the
+   settings and the server. */
+unsigned int
+http_client_connection_http2_max_streams(struct http_client_connection *conn);
 
 /*
  * Peer
@@ -611,8 +684,11 @@ void http_client_peer_link_queue(struct http_client_peer *peer,
 				 struct http_client_queue *queue);
 void http_client_peer_unlink_queue(struct http_client_peer *peer,
 				   struct http_client_queue *queue);
+/* Claim the next request that can be sent on a connection that already has
+   pending_count requests waiting for a response. */
 struct http_client_request *
-http_client_peer_claim_request(struct http_client_peer *peer, bool no_urgent);
+http_client_peer_claim_request(struct http_client_peer *peer,
+			       unsigned int pending_count);
 void http_client_peer_trigger_request_handler(struct http_client_peer *peer);
 void http_client_peer_connection_success(struct http_client_peer *peer);
 void http_client_peer_connection_failure(struct http_client_peer *peer,
@@ -648,7 +724,7 @@ void http_client_queue_drop_request(struct http_client_queue *queue,
 struct http_client_request *
 http_client_queue_claim_request(struct http_client_queue *queue,
 				const struct http_client_peer_addr *addr,
-				bool no_urgent);
+				unsigned int pending_count);
 unsigned int
 http_client_queue_requests_pending(struct http_client_queue *queue,
 				   unsigned int *num_urgent_r) ATTR_NULL(2);
@@ -978,29 +978,46 @@ void http_client_queue_submit_request(struct http_client_queue *queue,
  * Request retrieval
  */
 
+static bool
+http_client_queue_find_request(ARRAY_TYPE(http_client_request) *requests,
+			       unsigned int pending_count, unsigned int *idx_r)
+{
+	struct http_client_request *const *reqs;
+	unsigned int i, count;
+
+	/* Skip requests that don't allow this many requests to be pending
+	   before them. They wait for a less busy connection, while the
+	   requests after them can still be pipelined. */
+	reqs = array_get(requests, &count);
+	for (i = 0; i < count; i++) {
+		if (reqs[i]->max_pipelined > pending_count) {
+			*idx_r = i;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
 struct http_client_request *
 http_client_queue_claim_request(struct http_client_queue *queue,
 				const struct http_client_peer_addr *addr,
-				bool no_urgent)
+				unsigned int pending_count)
 {
-	struct http_client_request *const *requests;
+	ARRAY_TYPE(http_client_request) *requests;
 	struct http_client_request *req;
-	unsigned int i, count;
-
-	count = 0;
-	if (!no_urgent)
-	 	requests = array_get(&queue->queued_urgent_requests, &count);
+	unsigned int idx;
 
-	if (count == 0)
-	 	requests = array_get(&queue->queued_requests, &count);
-	if (count == 0)
-		return NULL;
-	i = 0;
-	req = requests[i];
-	if (req->urgent)
-		array_delete(&queue->queued_urgent_requests, i, 1);
-	else
-		array_delete(&queue->queued_requests, i, 1);
+	/* No urgent request can be second in line */
+	requests = &queue->queued_urgent_requests;
+	if (pending_count > 0 ||
+	    !http_client_queue_find_request(requests, pending_count, &idx)) {
+		requests = &queue->queued_requests;
+		if (!http_client_queue_find_request(requests, pending_count,
+						    &idx))
+			return NULL;
+	}
+	req = array_idx_elem(requests, idx);
+	array_delete(requests, idx, 1);
 
 	e_debug(queue->event,
 		"Connection to peer %s claimed request %s %s",
@@ -125,10 +125,13 @@ http_client_request_new(struct http_client *client, const char *method,
 	/* Default to client-wide settings: */
 	req->max_attempts = client->set->request_max_attempts;
 	req->attempt_timeout_msecs = client->set->request_timeout_msecs;
+	req->max_pipelined = client->set->max_pipelined_requests;
 	if (strcasecmp(method, "GET") == 0 ||
 	    strcasecmp(method, "HEAD") == 0) {
 		if (client->set->read_request_max_attempts != 0)
 			req->max_attempts = client->set->read_request_max_attempts;
+		if (client->set->read_request_max_pipelined != 0)
+			req->max_pipelined = client->set->read_request_max_pipelined;
 		if (client->set->read_request_timeout_msecs != 0) {
 			req->attempt_timeout_msecs =
 				client->set->read_request_timeout_msecs;
@@ -137,6 +140,8 @@ http_client_request_new(struct http_client *client, const char *method,
 		   strcasecmp(method, "POST") == 0) {
 		if (client->set->write_request_max_attempts != 0)
 			req->max_attempts = client->set->write_request_max_attempts;
+		if (client->set->write_request_max_pipelined != 0)
+			req->max_pipelined = client->set->write_request_max_pipelined;
 		if (client->set->write_request_timeout_msecs != 0) {
 			req->attempt_timeout_msecs =
 				client->set->write_request_timeout_msecs;
@@ -144,6 +149,8 @@ http_client_request_new(struct http_client *client, const char *method,
 	} else if (strcasecmp(method, "DELETE") == 0) {
 		if (client->set->delete_request_max_attempts != 0)
 			req->max_attempts = client->set->delete_request_max_attempts;
+		if (client->set->delete_request_max_pipelined != 0)
+			req->max_pipelined = client->set->delete_request_max_pipelined;
 		if (client->set->delete_request_timeout_msecs != 0) {
 			req->attempt_timeout_msecs =
 				client->set->delete_request_timeout_msecs;
@@ -682,6 +689,15 @@ void http_client_request_set_max_attempts(struct http_client_request *req,
 	req->max_attempts = max_attempts;
 }
 
+void http_client_request_set_max_pipelined(struct http_client_request *req,
+					   unsigned int max_pipelined)
+{
+	i_assert(req->state == HTTP_REQUEST_STATE_NEW);
+	i_assert(max_pipelined > 0);
+
+	req->max_pipelined = max_pipelined;
+}
+
 void http_client_request_set_event_headers(struct http_client_request *req,
 					   const char *const *headers)
 {
@@ -1091,6 +1107,8 @@ http_client_request_finish_payload_out(struct http_client_request *req)
 	int ret;
 
 	i_assert(conn != NULL);
+	if (conn->http2 != NULL)
+		return http_client_connection_http2_finish_payload(conn, req);
 	req->payload_finished = TRUE;
 
 	/* Drop payload output stream */
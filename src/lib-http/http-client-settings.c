@@ -36,7 +36,15 @@ static const struct setting_define http_client_setting_defines[] = {
 
 	DEF_MSECS(TIME_MSECS, max_idle_time),
 	DEF(UINT, max_parallel_connections),
+	DEF(UINT, min_idle_connections),
 	DEF(UINT, max_pipelined_requests),
+	DEF(UINT, read_request_max_pipelined),
+	DEF(UINT, write_request_max_pipelined),
+	DEF(UINT, delete_request_max_pipelined),
+
+	DEF(BOOL, http2),
+	DEF(BOOL, http2_prior_knowledge),
+	DEF(UINT, http2_max_concurrent_streams),
 
 	DEF(BOOL_HIDDEN, auto_redirect),
 	DEF(BOOL_HIDDEN, auto_retry),
@@ -85,7 +93,16 @@ static const struct http_client_settings http_client_default_settings = {
 
 	.max_idle_time_msecs = 0,
 	.max_parallel_connections = 1,
+	.min_idle_connections = 0,
 	.max_pipelined_requests = 1,
+	.read_request_max_pipelined = 0,
+	.write_request_max_pipelined = 0,
+	.delete_request_max_pipelined = 0,
+
+	.http2 = FALSE,
+	.http2_prior_knowledge = FALSE,
+	.http2_max_concurrent_streams =
+		HTTP_CLIENT_DEFAULT_HTTP2_MAX_CONCURRENT_STREAMS,
 
 	.auto_redirect = TRUE,
 	.auto_retry = TRUE,
@@ -152,10 +169,23 @@ http_client_settings_check(void *_set, pool_t pool, const char **error_r)
 		*error_r = "http_client_max_pipelined_requests must not be 0";
 		return FALSE;
 	}
+	if (set->http2_max_concurrent_streams == 0) {
+		*error_r = "http_client_http2_max_concurrent_streams must not be 0";
+		return FALSE;
+	}
 	if (set->max_parallel_connections == 0) {
 		*error_r = "http_client_max_parallel_connections must not be 0";
 		return FALSE;
 	}
+	if (set->min_idle_connections > set->max_parallel_connections) {
+		*error_r = t_strdup_printf(
+			"http_client_min_idle_connections (%u) "
+			"must not be higher than "
+			"http_client_max_parallel_connections (%u)",
+			set->min_idle_connections,
+			set->max_parallel_connections);
+		return FALSE;
+	}
 	if (set->connect_backoff_time_msecs == 0) {
 		*error_r = "http_client_connect_backoff_time_msecs must not be 0";
 		return FALSE;
@@ -122,6 +122,8 @@ void http_client_settings_init(pool_t pool, struct http_client_settings *set_r)
 	set_r->auto_redirect = TRUE;
 	set_r->auto_retry = TRUE;
 	set_r->proxy_ssl_tunnel = TRUE;
+	set_r->http2_max_concurrent_streams =
+		HTTP_CLIENT_DEFAULT_HTTP2_MAX_CONCURRENT_STREAMS;
 }
 
 struct http_client *
@@ -351,6 +353,34 @@ unsigned int http_client_get_pending_request_count(struct http_client *client)
 	return client->requests_count;
 }
 
+static bool http_client_use_http2(struct http_client *client)
+{
+	const char *proxy_socket_path = client->set->proxy_socket_path;
+
+	return (client->set->http2 &&
+		client->set->parsed_proxy_url == NULL &&
+		(proxy_socket_path == NULL || proxy_socket_path[0] == '\0'));
+}
+
+static int
+http_client_init_ssl_ctx_http2(struct http_client *client,
+			       const struct ssl_iostream_settings *set,
+			       const char **error_r)
+{
+	struct ssl_iostream_settings h2_set = *set;
+	const char *const names[] = {
+		"h2",
+		"http/1.1",
+		NULL
+	};
+
+	/* The context cache doesn't distinguish contexts by their
+	   application protocols, so HTTP/2 clients get a private context. */
+	h2_set.application_protocols = names;
+	return ssl_iostream_context_init_client(&h2_set, &client->ssl_ctx,
+						error_r);
+}
+
 int http_client_init_ssl_ctx(struct http_client *client, const char **error_r)
 {
 	const struct ssl_settings *ssl_set;
@@ -365,6 +395,10 @@ int http_client_init_ssl_ctx(struct http_client *client, const char **error_r)
 
 	if (client->ssl_set != NULL) {
 		int ret;
+		if (http_client_use_http2(client)) {
+			return http_client_init_ssl_ctx_http2(
+				client, client->ssl_set, error_r);
+		}
 		if ((ret = ssl_iostream_client_context_cache_get(client->ssl_set,
 								 &client->ssl_ctx,
 								 error_r)) < 0)
@@ -379,11 +413,16 @@ int http_client_init_ssl_ctx(struct http_client *client, const char **error_r)
 		return -1;
 	ssl_client_settings_to_iostream_set(ssl_set, &set);
 
-	int ret = ssl_iostream_client_context_cache_get(set, &client->ssl_ctx,
-							error_r);
-	if (ret > 0) {
-		ssl_iostream_context_set_application_protocols(client->ssl_ctx,
-							       names);
+	int ret;
+	if (http_client_use_http2(client))
+		ret = http_client_init_ssl_ctx_http2(client, set, error_r);
+	else {
+		ret = ssl_iostream_client_context_cache_get(
+			set, &client->ssl_ctx, error_r);
+		if (ret > 0) {
+			ssl_iostream_context_set_application_protocols(
+				client->ssl_ctx, names);
+		}
 	}
 
 	settings_free(set);
@@ -50,8 +50,35 @@ struct http_client_settings {
 	/* Maximum number of parallel connections per peer (default = 1) */
 	unsigned int max_parallel_connections;
 
+	/* Minimum number of connections kept open per peer. Once a connection
+	   to a peer succeeds, more are created in the background until there
+	   are this many, so that bursts of requests don't wait for connection
+	   setup. Idle connections are not closed by max_idle_time while there
+	   are no more than this many. Must not be higher than
+	   max_parallel_connections. (default = 0) */
+	unsigned int min_idle_connections;
+
 	/* Maximum number of pipelined requests per connection (default = 1) */
 	unsigned int max_pipelined_requests;
+	/* If non-zero, override max_pipelined_requests for GET/HEAD
+	   requests. */
+	unsigned int read_request_max_pipelined;
+	/* If non-zero, override max_pipelined_requests for PUT/POST
+	   requests. */
+	unsigned int write_request_max_pipelined;
+	/* If non-zero, override max_pipelined_requests for DELETE requests. */
+	unsigned int delete_request_max_pipelined;
+
+	/* Offer HTTP/2 via ALPN on HTTPS connections and use it if the server
+	   selects it. Requests are then multiplexed as streams over a single
+	   connection per peer. Ignored when a proxy is used. */
+	bool http2;
+	/* Use HTTP/2 without negotiation (h2c with prior knowledge) on plain
+	   HTTP and unix socket connections. Ignored when a proxy is used. */
+	bool http2_prior_knowledge;
+	/* Maximum number of concurrent HTTP/2 streams per connection. The
+	   server's SETTINGS_MAX_CONCURRENT_STREAMS can lower this. */
+	unsigned int http2_max_concurrent_streams;
 
 	/* FALSE = Don't automatically act upon redirect responses. The
 	   redirects are returned as a regular response. TRUE = Handle
@@ -376,6 +403,12 @@ void http_client_request_set_attempt_timeout_msecs(
 /* Override http_client_settings.max_attempts */
 void http_client_request_set_max_attempts(struct http_client_request *req,
 					  unsigned int max_attempts);
+/* Override http_client_settings.max_pipelined_requests. The request is only
+   sent on a connection with fewer than max_pipelined requests waiting for a
+   response, and no more requests are pipelined behind it than that. Setting
+   this to 1 keeps slow requests from blocking others behind them. */
+void http_client_request_set_max_pipelined(struct http_client_request *req,
+					   unsigned int max_pipelined);
 
 /* Include the specified HTTP response headers in the http_request_finished
    event parameters with "http_hdr_" prefix. */
@@ -0,0 +1,137 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "byteorder.h"
+
+#include "http2-frame.h"
+
+void http2_frame_header_parse(const unsigned char *data,
+			      struct http2_frame_header *hdr_r)
+{
+	hdr_r->length = ((uint32_t)data[0] << 16) |
+		((uint32_t)data[1] << 8) | data[2];
+	hdr_r->type = data[3];
+	hdr_r->flags = data[4];
+	/* The reserved bit is ignored */
+	hdr_r->stream_id = be32_to_cpu_unaligned(data + 5) & HTTP2_MAX_STREAM_ID;
+}
+
+void http2_frame_header_append(buffer_t *dest, enum http2_frame_type type,
+			       uint8_t flags, uint32_t stream_id,
+			       size_t length)
+{
+	unsigned char hdr[HTTP2_FRAME_HEADER_SIZE];
+
+	i_assert(length <= HTTP2_MAX_FRAME_SIZE_LIMIT);
+	i_assert(stream_id <= HTTP2_MAX_STREAM_ID);
+
+	hdr[0] = (length >> 16) & 0xff;
+	hdr[1] = (length >> 8) & 0xff;
+	hdr[2] = length & 0xff;
+	hdr[3] = type;
+	hdr[4] = flags;
+	cpu32_to_be_unaligned(stream_id, hdr + 5);
+	buffer_append(dest, hdr, sizeof(hdr));
+}
+
+void http2_frame_append(buffer_t *dest, enum http2_frame_type type,
+			uint8_t flags, uint32_t stream_id,
+			const void *payload, size_t size)
+{
+	http2_frame_header_append(dest, type, flags, stream_id, size);
+	buffer_append(dest, payload, size);
+}
+
+void http2_frame_setting_append(buffer_t *dest, enum http2_setting_id id,
+				uint32_t value)
+{
+	unsigned char setting[HTTP2_SETTING_SIZE];
+
+	cpu16_to_be_unaligned(id, setting);
+	cpu32_to_be_unaligned(value, setting + 2);
+	buffer_append(dest, setting, sizeof(setting));
+}
+
+void http2_frame_append_rst_stream(buffer_t *dest, uint32_t stream_id,
+				   enum http2_error_code error_code)
+{
+	unsigned char payload[4];
+
+	cpu32_to_be_unaligned(error_code, payload);
+	http2_frame_append(dest, HTTP2_FRAME_RST_STREAM, 0, stream_id,
+			   payload, sizeof(payload));
+}
+
+void http2_frame_append_window_update(buffer_t *dest, uint32_t stream_id,
+				      uint32_t increment)
+{
+	unsigned char payload[4];
+
+	i_assert(increment > 0 && increment <= HTTP2_MAX_WINDOW_SIZE);
+
+	cpu32_to_be_unaligned(increment, payload);
+	http2_frame_append(dest, HTTP2_FRAME_WINDOW_UPDATE, 0, stream_id,
+			   payload, sizeof(payload));
+}
+
+void http2_frame_append_goaway(buffer_t *dest, uint32_t last_stream_id,
+			       enum http2_error_code error_code,
+			       const char *debug_data)
+{
+	unsigned char payload[8];
+	size_t debug_len = debug_data == NULL ? 0 : strlen(debug_data);
+
+	cpu32_to_be_unaligned(last_stream_id, payload);
+	cpu32_to_be_unaligned(error_code, payload + 4);
+	http2_frame_header_append(dest, HTTP2_FRAME_GOAWAY, 0, 0,
+				  sizeof(payload) + debug_len);
+	buffer_append(dest, payload, sizeof(payload));
+	buffer_append(dest, debug_data, debug_len);
+}
+
+int http2_frame_strip_padding(const struct http2_frame_header *hdr,
+			      const unsigned char **payload,
+			      size_t *size)
+{
+	size_t pad_len;
+
+	if ((hdr->flags & HTTP2_FRAME_FLAG_PADDED) == 0)
+		return 0;
+	if (*size < 1)
+		return -1;
+	pad_len = (*payload)[0];
+	if (pad_len >= *size)
+		return -1;
+	*payload += 1;
+	*size -= 1 + pad_len;
+	return 0;
+}
+
+const char *http2_frame_type_name(uint8_t type)
+{
+	static const char *const names[] = {
+		"DATA", "HEADERS", "PRIORITY", "RST_STREAM", "SETTINGS",
+		"PUSH_PROMISE", "PING", "GOAWAY", "WINDOW_UPDATE",
+		"CONTINUATION"
+	};
+
+	if (type < N_ELEMENTS(names))
+		return names[type];
+	return t_strdup_printf("0x%02x", type);
+}
+
+const char *http2_error_code_name(uint32_t error_code)
+{
+	static const char *const names[] = {
+		"NO_ERROR", "PROTOCOL_ERROR", "INTERNAL_ERROR",
+		"FLOW_CONTROL_ERROR", "SETTINGS_TIMEOUT", "STREAM_CLOSED",
+		"FRAME_SIZE_ERROR", "REFUSED_STREAM", "CANCEL",
+		"COMPRESSION_ERROR", "CONNECT_ERROR", "ENHANCE_YOUR_CALM",
+		"INADEQUATE_SECURITY", "HTTP_1_1_REQUIRED"
+	};
+
+	if (error_code < N_ELEMENTS(names))
+		return names[error_code];
+	return t_strdup_printf("0x%x", error_code);
+}
@@ -0,0 +1,103 @@
+#ifndef HTTP2_FRAME_H
+#define HTTP2_FRAME_H
+
+/* RFC 9113: HTTP/2 frames */
+
+#define HTTP2_CONNECTION_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_CONNECTION_PREFACE_LEN 24
+
+#define HTTP2_FRAME_HEADER_SIZE 9
+#define HTTP2_DEFAULT_MAX_FRAME_SIZE 16384
+#define HTTP2_MAX_FRAME_SIZE_LIMIT ((1U << 24) - 1)
+#define HTTP2_DEFAULT_WINDOW_SIZE 65535
+#define HTTP2_MAX_WINDOW_SIZE 0x7fffffffU
+#define HTTP2_MAX_STREAM_ID 0x7fffffffU
+#define HTTP2_SETTING_SIZE 6
+
+enum http2_frame_type {
+	HTTP2_FRAME_DATA = 0x0,
+	HTTP2_FRAME_HEADERS = 0x1,
+	HTTP2_FRAME_PRIORITY = 0x2,
+	HTTP2_FRAME_RST_STREAM = 0x3,
+	HTTP2_FRAME_SETTINGS = 0x4,
+	HTTP2_FRAME_PUSH_PROMISE = 0x5,
+	HTTP2_FRAME_PING = 0x6,
+	HTTP2_FRAME_GOAWAY = 0x7,
+	HTTP2_FRAME_WINDOW_UPDATE = 0x8,
+	HTTP2_FRAME_CONTINUATION = 0x9,
+};
+
+enum http2_frame_flags {
+	HTTP2_FRAME_FLAG_END_STREAM = 0x01,
+	HTTP2_FRAME_FLAG_ACK = 0x01,
+	HTTP2_FRAME_FLAG_END_HEADERS = 0x04,
+	HTTP2_FRAME_FLAG_PADDED = 0x08,
+	HTTP2_FRAME_FLAG_PRIORITY = 0x20,
+};
+
+enum http2_setting_id {
+	HTTP2_SETTING_HEADER_TABLE_SIZE = 0x1,
+	HTTP2_SETTING_ENABLE_PUSH = 0x2,
+	HTTP2_SETTING_MAX_CONCURRENT_STREAMS = 0x3,
+	HTTP2_SETTING_INITIAL_WINDOW_SIZE = 0x4,
+	HTTP2_SETTING_MAX_FRAME_SIZE = 0x5,
+	HTTP2_SETTING_MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+enum http2_error_code {
+	HTTP2_ERROR_NO_ERROR = 0x0,
+	HTTP2_ERROR_PROTOCOL_ERROR = 0x1,
+	HTTP2_ERROR_INTERNAL_ERROR = 0x2,
+	HTTP2_ERROR_FLOW_CONTROL_ERROR = 0x3,
+	HTTP2_ERROR_SETTINGS_TIMEOUT = 0x4,
+	HTTP2_ERROR_STREAM_CLOSED = 0x5,
+	HTTP2_ERROR_FRAME_SIZE_ERROR = 0x6,
+	HTTP2_ERROR_REFUSED_STREAM = 0x7,
+	HTTP2_ERROR_CANCEL = 0x8,
+	HTTP2_ERROR_COMPRESSION_ERROR = 0x9,
+	HTTP2_ERROR_CONNECT_ERROR = 0xa,
+	HTTP2_ERROR_ENHANCE_YOUR_CALM = 0xb,
+	HTTP2_ERROR_INADEQUATE_SECURITY = 0xc,
+	HTTP2_ERROR_HTTP_1_1_REQUIRED = 0xd,
+};
+
+struct http2_frame_header {
+	uint32_t length;
+	uint8_t type;
+	uint8_t flags;
+	uint32_t stream_id;
+};
+
+/* Parse the HTTP2_FRAME_HEADER_SIZE bytes long frame header. */
+void http2_frame_header_parse(const unsigned char *data,
+			      struct http2_frame_header *hdr_r);
+/* Append frame header for a payload of the given length. */
+void http2_frame_header_append(buffer_t *dest, enum http2_frame_type type,
+			       uint8_t flags, uint32_t stream_id,
+			       size_t length);
+
+/* Append a complete frame. */
+void http2_frame_append(buffer_t *dest, enum http2_frame_type type,
+			uint8_t flags, uint32_t stream_id,
+			const void *payload, size_t size);
+/* Append a single setting to the payload of a SETTINGS frame. */
+void http2_frame_setting_append(buffer_t *dest, enum http2_setting_id id,
+				uint32_t value);
+void http2_frame_append_rst_stream(buffer_t *dest, uint32_t stream_id,
+				   enum http2_error_code error_code);
+void http2_frame_append_window_update(buffer_t *dest, uint32_t stream_id,
+				      uint32_t increment);
+void http2_frame_append_goaway(buffer_t *dest, uint32_t last_stream_id,
+			       enum http2_error_code error_code,
+			       const char *debug_data);
+
+/* Remove padding from a PADDED frame payload. Returns -1 if the padding
+   length is invalid. */
+int http2_frame_strip_padding(const struct http2_frame_header *hdr,
+			      const unsigned char **payload,
+			      size_t *size);
+
+const char *http2_frame_type_name(uint8_t type);
+const char *http2_error_code_name(uint32_t error_code);
+
+#endif
@@ -0,0 +1,844 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+
+#include "http2-hpack.h"
+
+/* RFC 7541, Section 4.1: The size of an entry is the sum of its name's and
+   value's lengths plus 32. */
+#define HPACK_ENTRY_OVERHEAD 32
+/* Larger integers than this are never valid in a header block. */
+#define HPACK_MAX_INTEGER 0x7fffffffU
+
+#define HPACK_HUFFMAN_SYMBOLS 257
+#define HPACK_HUFFMAN_EOS 256
+#define HPACK_HUFFMAN_MAX_CODE_LEN 30
+
+struct http2_hpack_static_entry {
+	const char *name, *value;
+};
+
+struct http2_hpack_entry {
+	/* name and value are allocated together; value follows name's NUL */
+	char *name, *value;
+	size_t name_len, value_len;
+};
+
+struct http2_hpack_table {
+	/* Ring buffer of entries. Entry 0 is the newest one, which is added
+	   before the first. */
+	struct http2_hpack_entry *entries;
+	unsigned int entries_alloc, first, count;
+
+	size_t size, max_size;
+};
+
+struct http2_hpack_decoder {
+	struct http2_hpack_table table;
+	/* Our SETTINGS_HEADER_TABLE_SIZE */
+	size_t max_table_size;
+};
+
+struct http2_hpack_encoder {
+	struct http2_hpack_table table;
+	/* Our own limit for the dynamic table */
+	size_t own_max_table_size;
+	/* Smallest table size since the last header block */
+	size_t min_pending_table_size;
+
+	bool huffman:1;
+	bool table_size_update:1;
+};
+
+/* RFC 7541, Appendix A */
+static const struct http2_hpack_static_entry hpack_static_table[] = {
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+
+/* RFC 7541, Appendix B: Huffman code for each symbol */
+static const struct {
+	uint32_t code;
+	uint8_t len;
+} hpack_huffman_codes[HPACK_HUFFMAN_SYMBOLS] = {
+	{ 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 },
+	{ 0xfffffe3, 28 }, { 0xfffffe4, 28 }, { 0xfffffe5, 28 },
+	{ 0xfffffe6, 28 }, { 0xfffffe7, 28 }, { 0xfffffe8, 28 },
+	{ 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+	{ 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 },
+	{ 0xfffffec, 28 }, { 0xfffffed, 28 }, { 0xfffffee, 28 },
+	{ 0xfffffef, 28 }, { 0xffffff0, 28 }, { 0xffffff1, 28 },
+	{ 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+	{ 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 },
+	{ 0xffffff7, 28 }, { 0xffffff8, 28 }, { 0xffffff9, 28 },
+	{ 0xffffffa, 28 }, { 0xffffffb, 28 }, { 0x14, 6 },
+	{ 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+	{ 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 },
+	{ 0x7fa, 11 }, { 0x3fa, 10 }, { 0x3fb, 10 },
+	{ 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 },
+	{ 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+	{ 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 },
+	{ 0x19, 6 }, { 0x1a, 6 }, { 0x1b, 6 },
+	{ 0x1c, 6 }, { 0x1d, 6 }, { 0x1e, 6 },
+	{ 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+	{ 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 },
+	{ 0x3fc, 10 }, { 0x1ffa, 13 }, { 0x21, 6 },
+	{ 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 },
+	{ 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+	{ 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 },
+	{ 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 },
+	{ 0x69, 7 }, { 0x6a, 7 }, { 0x6b, 7 },
+	{ 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+	{ 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 },
+	{ 0x72, 7 }, { 0xfc, 8 }, { 0x73, 7 },
+	{ 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 },
+	{ 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+	{ 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 },
+	{ 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 },
+	{ 0x25, 6 }, { 0x26, 6 }, { 0x27, 6 },
+	{ 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+	{ 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 },
+	{ 0x7, 5 }, { 0x2b, 6 }, { 0x76, 7 },
+	{ 0x2c, 6 }, { 0x8, 5 }, { 0x9, 5 },
+	{ 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+	{ 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 },
+	{ 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 },
+	{ 0x1ffd, 13 }, { 0xffffffc, 28 }, { 0xfffe6, 20 },
+	{ 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+	{ 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 },
+	{ 0x7fffd9, 23 }, { 0x3fffd6, 22 }, { 0x7fffda, 23 },
+	{ 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 },
+	{ 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+	{ 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 },
+	{ 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 },
+	{ 0x7fffe2, 23 }, { 0x7fffe3, 23 }, { 0x7fffe4, 23 },
+	{ 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+	{ 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 },
+	{ 0xffffef, 24 }, { 0x3fffda, 22 }, { 0x1fffdd, 21 },
+	{ 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 },
+	{ 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+	{ 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 },
+	{ 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 },
+	{ 0x7fffeb, 23 }, { 0x7fffec, 23 }, { 0x1fffe0, 21 },
+	{ 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+	{ 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 },
+	{ 0x7fffef, 23 }, { 0xfffea, 20 }, { 0x3fffe2, 22 },
+	{ 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 },
+	{ 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+	{ 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 },
+	{ 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 },
+	{ 0x3fffe8, 22 }, { 0x1ffffec, 25 }, { 0x3ffffe2, 26 },
+	{ 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+	{ 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 },
+	{ 0x1ffffed, 25 }, { 0x7fff2, 19 }, { 0x1fffe3, 21 },
+	{ 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 },
+	{ 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+	{ 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 },
+	{ 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 },
+	{ 0x7ffffe4, 27 }, { 0x7ffffe5, 27 }, { 0xfffec, 20 },
+	{ 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+	{ 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 },
+	{ 0x7ffff3, 23 }, { 0x3fffea, 22 }, { 0x3fffeb, 22 },
+	{ 0x1ffffee, 25 }, { 0x1ffffef, 25 }, { 0xfffff4, 24 },
+	{ 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+	{ 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 },
+	{ 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 },
+	{ 0x7ffffe9, 27 }, { 0x7ffffea, 27 }, { 0x7ffffeb, 27 },
+	{ 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+	{ 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 },
+	{ 0x3ffffee, 26 }, { 0x3fffffff, 30 },
+};
+
+/* Number of codes of each length */
+static const uint8_t hpack_huffman_length_counts[HPACK_HUFFMAN_MAX_CODE_LEN + 1] = {
+	0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+	0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+/* Symbols ordered by their code, which is canonical */
+static const uint16_t hpack_huffman_symbols[HPACK_HUFFMAN_SYMBOLS] = {
+	48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+	45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+	95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+	58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+	77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+	106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+	88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+	0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+	195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+	167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+	132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+	173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+	233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+	151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+	183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+	171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+	200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+	255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+	246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+	6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+	21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+	249, 10, 13, 22, 256
+};
+
+static uint32_t hpack_huffman_first_code[HPACK_HUFFMAN_MAX_CODE_LEN + 1];
+static uint16_t hpack_huffman_offsets[HPACK_HUFFMAN_MAX_CODE_LEN + 1];
+static bool hpack_huffman_initialized = FALSE;
+
+/*
+ * Dynamic table
+ */
+
+static struct http2_hpack_entry *
+hpack_table_get(struct http2_hpack_table *table, unsigned int idx)
+{
+	i_assert(idx < table->count);
+	return &table->entries[(table->first + idx) % table->entries_alloc];
+}
+
+static void hpack_table_evict(struct http2_hpack_table *table)
+{
+	struct http2_hpack_entry *entry;
+
+	i_assert(table->count > 0);
+	entry = hpack_table_get(table, table->count - 1);
+	table->size -= entry->name_len + entry->value_len +
+		HPACK_ENTRY_OVERHEAD;
+	i_free(entry->name);
+	i_zero(entry);
+	table->count--;
+}
+
+static void
+hpack_table_set_max_size(struct http2_hpack_table *table, size_t max_size)
+{
+	table->max_size = max_size;
+	while (table->size > table->max_size)
+		hpack_table_evict(table);
+}
+
+static void hpack_table_grow(struct http2_hpack_table *table)
+{
+	struct http2_hpack_entry *entries;
+	unsigned int i, new_alloc;
+
+	new_alloc = table->entries_alloc == 0 ? 16 : table->entries_alloc * 2;
+	entries = i_new(struct http2_hpack_entry, new_alloc);
+	for (i = 0; i < table->count; i++)
+		entries[i] = *hpack_table_get(table, i);
+	i_free(table->entries);
+	table->entries = entries;
+	table->entries_alloc = new_alloc;
+	table->first = 0;
+}
+
+static void
+hpack_table_add(struct http2_hpack_table *table,
+		const char *name, size_t name_len,
+		const char *value, size_t value_len)
+{
+	struct http2_hpack_entry *entry;
+	size_t entry_size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+
+	/* RFC 7541, Section 4.4: An entry larger than the table empties the
+	   table. */
+	while (table->count > 0 && table->size + entry_size > table->max_size)
+		hpack_table_evict(table);
+	if (entry_size > table->max_size)
+		return;
+
+	if (table->count == table->entries_alloc)
+		hpack_table_grow(table);
+	table->first = (table->first + table->entries_alloc - 1) %
+		table->entries_alloc;
+	table->count++;
+
+	entry = hpack_table_get(table, 0);
+	entry->name = i_malloc(name_len + 1 + value_len + 1);
+	memcpy(entry->name, name, name_len);
+	entry->value = entry->name + name_len + 1;
+	memcpy(entry->value, value, value_len);
+	entry->name_len = name_len;
+	entry->value_len = value_len;
+	table->size += entry_size;
+}
+
+static void hpack_table_free(struct http2_hpack_table *table)
+{
+	while (table->count > 0)
+		hpack_table_evict(table);
+	i_free(table->entries);
+}
+
+/*
+ * Huffman code
+ */
+
+static void hpack_huffman_init(void)
+{
+	uint32_t code = 0;
+	unsigned int len, offset = 0;
+
+	if (hpack_huffman_initialized)
+		return;
+	/* The code is canonical: codes of the same length are consecutive and
+	   ordered by their symbol. */
+	for (len = 1; len <= HPACK_HUFFMAN_MAX_CODE_LEN; len++) {
+		hpack_huffman_first_code[len] = code;
+		hpack_huffman_offsets[len] = offset;
+		code = (code + hpack_huffman_length_counts[len]) << 1;
+		offset += hpack_huffman_length_counts[len];
+	}
+	i_assert(offset == HPACK_HUFFMAN_SYMBOLS);
+	hpack_huffman_initialized = TRUE;
+}
+
+size_t http2_hpack_huffman_encoded_size(const unsigned char *data,
+					size_t size)
+{
+	size_t i, bits = 0;
+
+	for (i = 0; i < size; i++)
+		bits += hpack_huffman_codes[data[i]].len;
+	return (bits + 7) / 8;
+}
+
+void http2_hpack_huffman_encode(buffer_t *dest, const unsigned char *data,
+				size_t size)
+{
+	uint64_t bits = 0;
+	unsigned int nbits = 0;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		bits = (bits << hpack_huffman_codes[data[i]].len) |
+			hpack_huffman_codes[data[i]].code;
+		nbits += hpack_huffman_codes[data[i]].len;
+		while (nbits >= 8) {
+			nbits -= 8;
+			buffer_append_c(dest, (bits >> nbits) & 0xff);
+		}
+	}
+	if (nbits > 0) {
+		/* pad with the most significant bits of EOS */
+		buffer_append_c(dest, ((bits << (8 - nbits)) |
+				       (0xff >> nbits)) & 0xff);
+	}
+}
+
+int http2_hpack_huffman_decode(buffer_t *dest, const unsigned char *data,
+			       size_t size)
+{
+	uint32_t code = 0, idx;
+	unsigned int len = 0;
+	size_t i;
+	int bit;
+
+	hpack_huffman_init();
+	for (i = 0; i < size; i++) {
+		for (bit = 7; bit >= 0; bit--) {
+			code = (code << 1) | ((data[i] >> bit) & 1);
+			len++;
+			idx = code - hpack_huffman_first_code[len];
+			if (code >= hpack_huffman_first_code[len] &&
+			    idx < hpack_huffman_length_counts[len]) {
+				idx = hpack_huffman_symbols[
+					hpack_huffman_offsets[len] + idx];
+				if (idx == HPACK_HUFFMAN_EOS)
+					return -1;
+				buffer_append_c(dest, idx);
+				code = 0;
+				len = 0;
+			} else if (len == HPACK_HUFFMAN_MAX_CODE_LEN) {
+				return -1;
+			}
+		}
+	}
+	/* RFC 7541, Section 5.2: Padding longer than 7 bits or not matching
+	   the most significant bits of EOS is an error. */
+	if (len > 7 || code != (1U << len) - 1)
+		return -1;
+	return 0;
+}
+
+/*
+ * Primitive types
+ */
+
+static void
+hpack_encode_int(buffer_t *dest, uint8_t first, unsigned int prefix_bits,
+		 size_t num)
+{
+	unsigned int max_prefix = (1U << prefix_bits) - 1;
+
+	if (num < max_prefix) {
+		buffer_append_c(dest, first | num);
+		return;
+	}
+	buffer_append_c(dest, first | max_prefix);
+	num -= max_prefix;
+	while (num >= 0x80) {
+		buffer_append_c(dest, (num & 0x7f) | 0x80);
+		num >>= 7;
+	}
+	buffer_append_c(dest, num);
+}
+
+static int
+hpack_decode_int(const unsigned char **data, const unsigned char *end,
+		 unsigned int prefix_bits, uint32_t *num_r)
+{
+	unsigned int max_prefix = (1U << prefix_bits) - 1;
+	unsigned int shift = 0;
+	uint64_t num;
+	unsigned char c;
+
+	i_assert(*data < end);
+	num = **data & max_prefix;
+	(*data)++;
+	if (num == max_prefix) {
+		do {
+			if (*data == end || shift > 28)
+				return -1;
+			c = **data;
+			(*data)++;
+			num += (uint64_t)(c & 0x7f) << shift;
+			shift += 7;
+		} while ((c & 0x80) != 0);
+		if (num > HPACK_MAX_INTEGER)
+			return -1;
+	}
+	*num_r = num;
+	return 0;
+}
+
+static void
+hpack_encode_string(buffer_t *dest, const char *str, size_t len,
+		    bool huffman)
+{
+	const unsigned char *data = (const unsigned char *)str;
+	size_t huffman_len;
+
+	if (huffman) {
+		huffman_len = http2_hpack_huffman_encoded_size(data, len);
+		if (huffman_len <= len) {
+			hpack_encode_int(dest, 0x80, 7, huffman_len);
+			http2_hpack_huffman_encode(dest, data, len);
+			return;
+		}
+	}
+	hpack_encode_int(dest, 0x00, 7, len);
+	buffer_append(dest, data, len);
+}
+
+static int
+hpack_decode_string(const unsigned char **data, const unsigned char *end,
+		    string_t *dest, const char **error_r)
+{
+	bool huffman;
+	uint32_t len;
+
+	if (*data == end) {
+		*error_r = "Truncated string literal";
+		return -1;
+	}
+	huffman = (**data & 0x80) != 0;
+	if (hpack_decode_int(data, end, 7, &len) < 0) {
+		*error_r = "Invalid string length";
+		return -1;
+	}
+	if (len > (size_t)(end - *data)) {
+		*error_r = "Truncated string literal";
+		return -1;
+	}
+	if (!huffman)
+		buffer_append(dest, *data, len);
+	else if (http2_hpack_huffman_decode(dest, *data, len) < 0) {
+		*error_r = "Invalid Huffman encoded string";
+		return -1;
+	}
+	*data += len;
+	/* RFC 9113, Section 8.2.1: NUL is never valid in a field */
+	if (memchr(dest->data, '\0', dest->used) != NULL) {
+		*error_r = "NUL in header field";
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Decoder
+ */
+
+struct http2_hpack_decoder *http2_hpack_decoder_init(size_t max_table_size)
+{
+	struct http2_hpack_decoder *decoder;
+
+	decoder = i_new(struct http2_hpack_decoder, 1);
+	decoder->max_table_size = max_table_size;
+	decoder->table.max_size = max_table_size;
+	return decoder;
+}
+
+void http2_hpack_decoder_deinit(struct http2_hpack_decoder **_decoder)
+{
+	struct http2_hpack_decoder *decoder = *_decoder;
+
+	*_decoder = NULL;
+	hpack_table_free(&decoder->table);
+	i_free(decoder);
+}
+
+static int
+hpack_decoder_lookup(struct http2_hpack_decoder *decoder, uint32_t idx,
+		     const char **name_r, size_t *name_len_r,
+		     const char **value_r, size_t *value_len_r)
+{
+	const struct http2_hpack_entry *entry;
+
+	if (idx == 0)
+		return -1;
+	if (idx <= N_ELEMENTS(hpack_static_table)) {
+		*name_r = hpack_static_table[idx - 1].name;
+		*value_r = hpack_static_table[idx - 1].value;
+		*name_len_r = strlen(*name_r);
+		*value_len_r = strlen(*value_r);
+		return 0;
+	}
+	idx -= N_ELEMENTS(hpack_static_table) + 1;
+	if (idx >= decoder->table.count)
+		return -1;
+	entry = hpack_table_get(&decoder->table, idx);
+	*name_r = entry->name;
+	*value_r = entry->value;
+	*name_len_r = entry->name_len;
+	*value_len_r = entry->value_len;
+	return 0;
+}
+
+static int
+hpack_decode_field(struct http2_hpack_decoder *decoder,
+		   const unsigned char **data, const unsigned char *end,
+		   string_t *name, string_t *value, bool *add_r,
+		   const char **error_r)
+{
+	const char *idx_name, *idx_value;
+	size_t idx_name_len, idx_value_len;
+	unsigned int prefix_bits;
+	uint32_t idx;
+
+	if ((**data & 0x80) != 0) {
+		/* Indexed Header Field */
+		if (hpack_decode_int(data, end, 7, &idx) < 0 ||
+		    hpack_decoder_lookup(decoder, idx,
+					 &idx_name, &idx_name_len,
+					 &idx_value, &idx_value_len) < 0) {
+			*error_r = "Invalid header field index";
+			return -1;
+		}
+		buffer_append(name, idx_name, idx_name_len);
+		buffer_append(value, idx_value, idx_value_len);
+		*add_r = FALSE;
+		return 0;
+	}
+
+	if ((**data & 0xc0) == 0x40) {
+		/* Literal Header Field with Incremental Indexing */
+		prefix_bits = 6;
+		*add_r = TRUE;
+	} else {
+		/* Literal Header Field without Indexing / Never Indexed */
+		prefix_bits = 4;
+		*add_r = FALSE;
+	}
+	if (hpack_decode_int(data, end, prefix_bits, &idx) < 0) {
+		*error_r = "Invalid header field index";
+		return -1;
+	}
+	if (idx == 0) {
+		if (hpack_decode_string(data, end, name, error_r) < 0)
+			return -1;
+	} else {
+		if (hpack_decoder_lookup(decoder, idx,
+					 &idx_name, &idx_name_len,
+					 &idx_value, &idx_value_len) < 0) {
+			*error_r = "Invalid header field name index";
+			return -1;
+		}
+		buffer_append(name, idx_name, idx_name_len);
+	}
+	return hpack_decode_string(data, end, value, error_r);
+}
+
+int http2_hpack_decode(struct http2_hpack_decoder *decoder,
+		       const unsigned char *data, size_t size,
+		       size_t max_list_size, pool_t pool,
+		       ARRAY_TYPE(http2_hpack_header) *headers,
+		       const char **error_r)
+{
+	const unsigned char *end = data + size;
+	struct http2_hpack_header *hdr;
+	string_t *name, *value;
+	size_t list_size = 0;
+	bool fields_seen = FALSE, add;
+	uint32_t table_size;
+	int ret = 0;
+
+	name = str_new(default_pool, 64);
+	value = str_new(default_pool, 256);
+	while (data < end) {
+		if ((*data & 0xe0) == 0x20) {
+			/* Dynamic Table Size Update; only allowed
+			   at the beginning of a header block */
+			if (fields_seen) {
+				*error_r = "Dynamic table size update "
+					"after header fields";
+				ret = -1;
+				break;
+			}
+			if (hpack_decode_int(&data, end, 5,
+					     &table_size) < 0 ||
+			    table_size > decoder->max_table_size) {
+				*error_r = "Invalid dynamic table size "
+					"update";
+				ret = -1;
+				break;
+			}
+			hpack_table_set_max_size(&decoder->table,
+						 table_size);
+			continue;
+		}
+		fields_seen = TRUE;
+
+		str_truncate(name, 0);
+		str_truncate(value, 0);
+		if (hpack_decode_field(decoder, &data, end,
+				       name, value, &add,
+				       error_r) < 0) {
+			ret = -1;
+			break;
+		}
+		list_size += str_len(name) + str_len(value) +
+			HPACK_ENTRY_OVERHEAD;
+		if (list_size > max_list_size) {
+			*error_r = "Header list is too large";
+			ret = -1;
+			break;
+		}
+		if (add) {
+			hpack_table_add(&decoder->table,
+					str_c(name), str_len(name),
+					str_c(value), str_len(value));
+		}
+		hdr = array_append_space(headers);
+		hdr->name = p_strndup(pool, str_data(name),
+				      str_len(name));
+		hdr->value = p_strndup(pool, str_data(value),
+				       str_len(value));
+	}
+	str_free(&name);
+	str_free(&value);
+	return ret;
+}
+
+size_t http2_hpack_decoder_get_table_size(struct http2_hpack_decoder *decoder)
+{
+	return decoder->table.size;
+}
+
+/*
+ * Encoder
+ */
+
+struct http2_hpack_encoder *
+http2_hpack_encoder_init(size_t max_table_size, bool huffman)
+{
+	struct http2_hpack_encoder *encoder;
+
+	encoder = i_new(struct http2_hpack_encoder, 1);
+	encoder->own_max_table_size = max_table_size;
+	/* The peer's initial SETTINGS_HEADER_TABLE_SIZE is the default */
+	encoder->table.max_size = I_MIN(max_table_size,
+					HTTP2_HPACK_DEFAULT_TABLE_SIZE);
+	encoder->min_pending_table_size = encoder->table.max_size;
+	encoder->huffman = huffman;
+	hpack_huffman_init();
+	return encoder;
+}
+
+void http2_hpack_encoder_deinit(struct http2_hpack_encoder **_encoder)
+{
+	struct http2_hpack_encoder *encoder = *_encoder;
+
+	*_encoder = NULL;
+	hpack_table_free(&encoder->table);
+	i_free(encoder);
+}
+
+void http2_hpack_encoder_set_max_table_size(struct http2_hpack_encoder *encoder,
+					    size_t max_table_size)
+{
+	max_table_size = I_MIN(max_table_size, encoder->own_max_table_size);
+	if (max_table_size == encoder->table.max_size)
+		return;
+
+	hpack_table_set_max_size(&encoder->table, max_table_size);
+	if (!encoder->table_size_update ||
+	    max_table_size < encoder->min_pending_table_size)
+		encoder->min_pending_table_size = max_table_size;
+	encoder->table_size_update = TRUE;
+}
+
+void http2_hpack_encode_begin(struct http2_hpack_encoder *encoder,
+			      buffer_t *dest)
+{
+	if (!encoder->table_size_update)
+		return;
+
+	/* RFC 7541, Section 4.2: If the size was reduced and increased again,
+	   the smallest size must be signaled first. */
+	if (encoder->min_pending_table_size < encoder->table.max_size) {
+		hpack_encode_int(dest, 0x20, 5,
+				 encoder->min_pending_table_size);
+	}
+	hpack_encode_int(dest, 0x20, 5, encoder->table.max_size);
+	encoder->table_size_update = FALSE;
+}
+
+static void
+hpack_encoder_find(struct http2_hpack_encoder *encoder,
+		   const char *name, size_t name_len,
+		   const char *value, size_t value_len,
+		   unsigned int *name_idx_r, unsigned int *idx_r)
+{
+	const struct http2_hpack_entry *entry;
+	unsigned int i;
+
+	*name_idx_r = 0;
+	*idx_r = 0;
+	for (i = 0; i < N_ELEMENTS(hpack_static_table); i++) {
+		if (strcmp(hpack_static_table[i].name, name) != 0)
+			continue;
+		if (*name_idx_r == 0)
+			*name_idx_r = i + 1;
+		if (strcmp(hpack_static_table[i].value, value) == 0) {
+			*idx_r = i + 1;
+			return;
+		}
+	}
+	for (i = 0; i < encoder->table.count; i++) {
+		entry = hpack_table_get(&encoder->table, i);
+		if (entry->name_len != name_len ||
+		    memcmp(entry->name, name, name_len) != 0)
+			continue;
+		if (*name_idx_r == 0)
+			*name_idx_r = N_ELEMENTS(hpack_static_table) + i + 1;
+		if (entry->value_len == value_len &&
+		    memcmp(entry->value, value, value_len) == 0) {
+			*idx_r = N_ELEMENTS(hpack_static_table) + i + 1;
+			return;
+		}
+	}
+}
+
+void http2_hpack_encode_header(struct http2_hpack_encoder *encoder,
+			       buffer_t *dest, const char *name,
+			       const char *value, bool sensitive)
+{
+	size_t name_len = strlen(name), value_len = strlen(value);
+	size_t entry_size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+	unsigned int name_idx, idx;
+
+	hpack_encoder_find(encoder, name, name_len, value, value_len,
+			   &name_idx, &idx);
+	if (idx != 0 && !sensitive) {
+		/* Indexed Header Field */
+		hpack_encode_int(dest, 0x80, 7, idx);
+		return;
+	}
+
+	if (sensitive) {
+		/* Literal Header Field Never Indexed */
+		hpack_encode_int(dest, 0x10, 4, name_idx);
+	} else if (entry_size <= encoder->table.max_size / 2 &&
+		   strcmp(name, ":path") != 0) {
+		/* Literal Header Field with Incremental Indexing. Paths are
+		   usually different for each request, and large fields would
+		   evict everything else from the table. */
+		hpack_encode_int(dest, 0x40, 6, name_idx);
+		hpack_table_add(&encoder->table, name, name_len,
+				value, value_len);
+	} else {
+		/* Literal Header Field without Indexing */
+		hpack_encode_int(dest, 0x00, 4, name_idx);
+	}
+	if (name_idx == 0)
+		hpack_encode_string(dest, name, name_len, encoder->huffman);
+	hpack_encode_string(dest, value, value_len, encoder->huffman);
+}
+
+size_t http2_hpack_encoder_get_table_size(struct http2_hpack_encoder *encoder)
+{
+	return encoder->table.size;
+}
@@ -0,0 +1,83 @@
+#ifndef HTTP2_HPACK_H
+#define HTTP2_HPACK_H
+
+/* RFC 7541: HPACK: Header Compression for HTTP/2 */
+
+#define HTTP2_HPACK_DEFAULT_TABLE_SIZE 4096
+
+struct http2_hpack_header {
+	const char *name;
+	const char *value;
+};
+ARRAY_DEFINE_TYPE(http2_hpack_header, struct http2_hpack_header);
+
+struct http2_hpack_decoder;
+struct http2_hpack_encoder;
+
+/*
+ * Decoder
+ */
+
+/* The peer's encoder may use a dynamic table up to max_table_size bytes
+   (our SETTINGS_HEADER_TABLE_SIZE). */
+struct http2_hpack_decoder *http2_hpack_decoder_init(size_t max_table_size);
+void http2_hpack_decoder_deinit(struct http2_hpack_decoder **_decoder);
+
+/* Decode a complete header block and append the fields to headers. The
+   strings are allocated from pool. Fails if the decoded header list is larger
+   than max_list_size, counted like SETTINGS_MAX_HEADER_LIST_SIZE. Returns 0 on
+   success and -1 on error. The decoder state is undefined after an error, so
+   the connection must be closed with COMPRESSION_ERROR. */
+int http2_hpack_decode(struct http2_hpack_decoder *decoder,
+		       const unsigned char *data, size_t size,
+		       size_t max_list_size, pool_t pool,
+		       ARRAY_TYPE(http2_hpack_header) *headers,
+		       const char **error_r);
+
+/* Returns the current size of the dynamic table, as defined by RFC 7541,
+   Section 4.1. */
+size_t http2_hpack_decoder_get_table_size(struct http2_hpack_decoder *decoder);
+
+/*
+ * Encoder
+ */
+
+/* Create encoder, which uses a dynamic table up to max_table_size bytes.
+   String literals are Huffman encoded unless it makes them longer, if huffman
+   is TRUE. */
+struct http2_hpack_encoder *
+http2_hpack_encoder_init(size_t max_table_size, bool huffman);
+void http2_hpack_encoder_deinit(struct http2_hpack_encoder **_encoder);
+
+/* Apply the peer's SETTINGS_HEADER_TABLE_SIZE. The dynamic table is shrunk
+   if needed. The size update is signaled at the beginning of the next header
+   block. */
+void http2_hpack_encoder_set_max_table_size(struct http2_hpack_encoder *encoder,
+					    size_t max_table_size);
+
+/* Start a new header block. */
+void http2_hpack_encode_begin(struct http2_hpack_encoder *encoder,
+			      buffer_t *dest);
+/* Encode a header field. The name must be in lowercase. Sensitive fields
+   (e.g. credentials) are never added to the dynamic table, and neither are
+   intermediaries allowed to do that. */
+void http2_hpack_encode_header(struct http2_hpack_encoder *encoder,
+			       buffer_t *dest, const char *name,
+			       const char *value, bool sensitive);
+
+size_t http2_hpack_encoder_get_table_size(struct http2_hpack_encoder *encoder);
+
+/*
+ * Huffman code
+ */
+
+/* Returns the length of data after Huffman encoding. */
+size_t http2_hpack_huffman_encoded_size(const unsigned char *data,
+					size_t size);
+void http2_hpack_huffman_encode(buffer_t *dest, const unsigned char *data,
+				size_t size);
+/* Returns -1 if data isn't a valid Huffman encoded string. */
+int http2_hpack_huffman_decode(buffer_t *dest, const unsigned char *data,
+			       size_t size);
+
+#endif
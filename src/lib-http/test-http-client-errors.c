@@ -3445,6 +3445,365 @@ static void test_idle_hosts(void)
 	test_end();
 }
 
+/*
+ * Warm connections
+ */
+
+/* server */
+
+struct _warm_connections_sctx {
+	unsigned int id;
+	bool eoh;
+};
+
+static unsigned int test_warm_connections_count = 0;
+
+static int test_warm_connections_init(struct server_connection *conn)
+{
+	struct _warm_connections_sctx *ctx;
+
+	ctx = p_new(conn->pool, struct _warm_connections_sctx, 1);
+	ctx->id = ++test_warm_connections_count;
+	conn->context = ctx;
+	return 0;
+}
+
+static void test_warm_connections_input(struct server_connection *conn)
+{
+	struct _warm_connections_sctx *ctx = conn->context;
+	const char *line;
+
+	while ((line = i_stream_read_next_line(conn->conn.input)) != NULL) {
+		if (*line == '\0') {
+			ctx->eoh = TRUE;
+			break;
+		}
+	}
+
+	if (conn->conn.input->stream_errno != 0) {
+		i_fatal("server: Stream error: %s",
+			i_stream_get_error(conn->conn.input));
+	}
+	if (line == NULL) {
+		if (conn->conn.input->eof)
+			server_connection_deinit(&conn);
+		return;
+	}
+
+	i_assert(ctx->eoh);
+	ctx->eoh = FALSE;
+
+	o_stream_nsend_str(conn->conn.output, t_strdup_printf(
+		"HTTP/1.1 200 OK\r\n"
+		"X-Connection: %u\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n", ctx->id));
+	if (o_stream_flush(conn->conn.output) < 0) {
+		i_fatal("server: Flush error: %s",
+			o_stream_get_error(conn->conn.output));
+	}
+}
+
+static void test_server_warm_connections(unsigned int index)
+{
+	test_server_init = test_warm_connections_init;
+	test_server_input = test_warm_connections_input;
+	test_server_run(index);
+}
+
+/* client */
+
+struct _warm_connections {
+	struct http_client *client;
+	unsigned int max, count;
+	struct timeout *to;
+};
+
+static void
+test_client_warm_connections_response_stage2(const struct http_response *resp,
+					     struct _warm_connections *ctx)
+{
+	const char *conn_id = http_response_header_get(resp, "X-Connection");
+	unsigned int id;
+
+	test_client_assert_response(resp, resp->status == 200);
+	/* All requests are handled by the connections created in stage 1,
+	   even though max_idle_time has passed since. */
+	test_assert(conn_id != NULL && str_to_uint(conn_id, &id) == 0 &&
+		    id <= ctx->max);
+
+	if (--ctx->count == 0) {
+		i_free(ctx);
+		io_loop_stop(ioloop);
+	}
+}
+
+static void
+test_client_warm_connections_stage2_start(struct _warm_connections *ctx)
+{
+	struct http_client_request *hreq;
+	unsigned int i;
+
+	if (debug)
+		i_debug("STAGE 2");
+
+	timeout_remove(&ctx->to);
+
+	ctx->count = ctx->max;
+	for (i = 0; i < ctx->count; i++) {
+		hreq = http_client_request(
+			ctx->client, "GET", net_ip2addr(&bind_ip),
+			t_strdup_printf("/warm-connections-stage2-%d.txt", i),
+			test_client_warm_connections_response_stage2, ctx);
+		http_client_request_set_port(hreq, bind_ports[0]);
+		http_client_request_submit(hreq);
+	}
+}
+
+static void
+test_client_warm_connections_response_stage1(const struct http_response *resp,
+					     struct _warm_connections *ctx)
+{
+	test_client_assert_response(resp, resp->status == 200);
+
+	if (debug)
+		i_debug("START STAGE 2");
+	ctx->to = timeout_add_short(
+		550, test_client_warm_connections_stage2_start, ctx);
+}
+
+static bool
+test_client_warm_connections(const struct http_client_settings *client_set)
+{
+	struct http_client_request *hreq;
+	struct _warm_connections *ctx;
+
+	if (debug)
+		i_debug("STAGE 1");
+
+	ctx = i_new(struct _warm_connections, 1);
+	ctx->max = client_set->min_idle_connections;
+
+	ctx->client = http_client = http_client_init(client_set, NULL);
+
+	/* A single request warms up the whole pool */
+	hreq = http_client_request(
+		ctx->client, "GET", net_ip2addr(&bind_ip),
+		"/warm-connections-stage1.txt",
+		test_client_warm_connections_response_stage1, ctx);
+	http_client_request_set_port(hreq, bind_ports[0]);
+	http_client_request_submit(hreq);
+	return TRUE;
+}
+
+/* test */
+
+static void test_warm_connections(void)
+{
+	struct http_client_settings http_client_set;
+
+	test_client_defaults(&http_client_set);
+	http_client_set.max_idle_time_msecs = 200;
+	http_client_set.max_parallel_connections = 4;
+
+	test_begin("warm connections (min 1)");
+	http_client_set.min_idle_connections = 1;
+	test_run_client_server(&http_client_set,
+			       test_client_warm_connections,
+			       test_server_warm_connections, 1, NULL);
+	test_end();
+
+	test_begin("warm connections (min 3)");
+	http_client_set.min_idle_connections = 3;
+	test_run_client_server(&http_client_set,
+			       test_client_warm_connections,
+			       test_server_warm_connections, 1, NULL);
+	test_end();
+}
+
+/*
+ * Pipelining policy
+ */
+
+/* server */
+
+struct _pipelining_policy_sctx {
+	ARRAY_TYPE(const_string) methods;
+	bool request_line;
+};
+
+static int test_pipelining_policy_init(struct server_connection *conn)
+{
+	struct _pipelining_policy_sctx *ctx;
+
+	ctx = p_new(conn->pool, struct _pipelining_policy_sctx, 1);
+	p_array_init(&ctx->methods, conn->pool, 8);
+	ctx->request_line = TRUE;
+	conn->context = ctx;
+	return 0;
+}
+
+static void test_pipelining_policy_input(struct server_connection *conn)
+{
+	struct _pipelining_policy_sctx *ctx = conn->context;
+	unsigned int i, count;
+	const char *line;
+
+	/* Respond to all the requests that were received together. Each
+	   response tells how many requests there were. Give the client some
+	   time to pipeline more requests first. */
+	if (array_count(&ctx->methods) == 0)
+		i_sleep_msecs(50);
+	while ((line = i_stream_read_next_line(conn->conn.input)) != NULL) {
+		if (ctx->request_line) {
+			line = p_strdup_until(conn->pool, line,
+					      strchr(line, ' '));
+			array_push_back(&ctx->methods, &line);
+			ctx->request_line = FALSE;
+		} else if (*line == '\0') {
+			ctx->request_line = TRUE;
+		}
+	}
+
+	if (conn->conn.input->stream_errno != 0) {
+		i_fatal("server: Stream error: %s",
+			i_stream_get_error(conn->conn.input));
+	}
+	if (conn->conn.input->eof) {
+		server_connection_deinit(&conn);
+		return;
+	}
+	if (!ctx->request_line) {
+		/* wait for the rest of the request */
+		return;
+	}
+
+	count = array_count(&ctx->methods);
+	array_clear(&ctx->methods);
+	for (i = 0; i < count; i++) {
+		o_stream_nsend_str(conn->conn.output, t_strdup_printf(
+			"HTTP/1.1 200 OK\r\n"
+			"X-Pipelined: %u\r\n"
+			"Content-Length: 0\r\n"
+			"\r\n", count));
+	}
+	if (o_stream_flush(conn->conn.output) < 0) {
+		i_fatal("server: Flush error: %s",
+			o_stream_get_error(conn->conn.output));
+	}
+}
+
+static void test_server_pipelining_policy(unsigned int index)
+{
+	test_server_init = test_pipelining_policy_init;
+	test_server_input = test_pipelining_policy_input;
+	test_server_run(index);
+}
+
+/* client */
+
+struct _pipelining_policy {
+	unsigned int count;
+};
+
+static void
+test_client_pipelining_policy_response(const struct http_response *resp,
+				       struct _pipelining_policy *ctx)
+{
+	test_client_assert_response(resp, resp->status == 200);
+
+	if (--ctx->count == 0) {
+		i_free(ctx);
+		io_loop_stop(ioloop);
+	}
+}
+
+static void
+test_client_pipelining_policy_response_delete(const struct http_response *resp,
+					      struct _pipelining_policy *ctx)
+{
+	const char *pipelined = http_response_header_get(resp, "X-Pipelined");
+
+	/* Nothing was pipelined with the DELETE request */
+	test_assert(null_strcmp(pipelined, "1") == 0);
+	test_client_pipelining_policy_response(resp, ctx);
+}
+
+static void
+test_client_pipelining_policy_submit(struct _pipelining_policy *ctx)
+{
+	struct http_client_request *hreq;
+	unsigned int i;
+
+	if (debug)
+		i_debug("STAGE 2");
+
+	ctx->count = 4;
+	hreq = http_client_request(
+		http_client, "DELETE", net_ip2addr(&bind_ip),
+		"/pipelining-policy-delete.txt",
+		test_client_pipelining_policy_response_delete, ctx);
+	http_client_request_set_port(hreq, bind_ports[0]);
+	http_client_request_submit(hreq);
+
+	for (i = 0; i < 3; i++) {
+		hreq = http_client_request(
+			http_client, "GET", net_ip2addr(&bind_ip),
+			t_strdup_printf("/pipelining-policy-%u.txt", i),
+			test_client_pipelining_policy_response, ctx);
+		http_client_request_set_port(hreq, bind_ports[0]);
+		http_client_request_submit(hreq);
+	}
+}
+
+static void
+test_client_pipelining_policy_response_stage1(const struct http_response *resp,
+					      struct _pipelining_policy *ctx)
+{
+	test_client_assert_response(resp, resp->status == 200);
+
+	/* The server is now known to support pipelining */
+	test_client_pipelining_policy_submit(ctx);
+}
+
+static bool
+test_client_pipelining_policy(const struct http_client_settings *client_set)
+{
+	struct http_client_request *hreq;
+	struct _pipelining_policy *ctx;
+
+	if (debug)
+		i_debug("STAGE 1");
+
+	ctx = i_new(struct _pipelining_policy, 1);
+	http_client = http_client_init(client_set, NULL);
+
+	hreq = http_client_request(
+		http_client, "GET", net_ip2addr(&bind_ip),
+		"/pipelining-policy-stage1.txt",
+		test_client_pipelining_policy_response_stage1, ctx);
+	http_client_request_set_port(hreq, bind_ports[0]);
+	http_client_request_submit(hreq);
+	return TRUE;
+}
+
+/* test */
+
+static void test_pipelining_policy(void)
+{
+	struct http_client_settings http_client_set;
+
+	test_client_defaults(&http_client_set);
+	http_client_set.max_pipelined_requests = 4;
+	http_client_set.delete_request_max_pipelined = 1;
+
+	test_begin("pipelining policy");
+	test_run_client_server(&http_client_set,
+			       test_client_pipelining_policy,
+			       test_server_pipelining_policy, 1, NULL);
+	test_end();
+}
+
 /*
  * All tests
  */
@@ -3481,6 +3840,8 @@ static void (*const test_functions[])(void) = {
 	test_multi_ip_attempts,
 	test_idle_connections,
 	test_idle_hosts,
+	test_warm_connections,
+	test_pipelining_policy,
 	NULL
 };
 
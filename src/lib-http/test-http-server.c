@@ -41,7 +41,8 @@ client_destroy(struct client **_client, const char *reason)
 	DLLIST2_REMOVE(&clients_head, &clients_tail, client);
 	i_free(client);
 
-	if (clients_head == NULL)
+	/* Keep serving new clients until SIGINT/SIGTERM */
+	if (clients_head == NULL && shut_down)
 		io_loop_stop(ioloop);
 }
 
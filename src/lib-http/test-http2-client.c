@@ -0,0 +1,1386 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "strnum.h"
+#include "hostpid.h"
+#include "byteorder.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "ostream.h"
+#include "connection.h"
+#include "test-common.h"
+#include "test-subprocess.h"
+#include "http-url.h"
+#include "http-request.h"
+#include "http-client.h"
+#include "http-client-private.h"
+#include "http2-frame.h"
+#include "http2-hpack.h"
+#include "settings.h"
+
+#include <unistd.h>
+#include <sys/signal.h>
+
+#define CLIENT_PROGRESS_TIMEOUT     30
+#define SERVER_KILL_TIMEOUT_SECS    20
+
+static struct settings_root *set_root;
+
+static void main_deinit(void);
+
+/*
+ * Types
+ */
+
+struct server_stream {
+	uint32_t id;
+	const char *method, *path;
+	buffer_t *body;
+
+	int64_t send_window;
+	/* Response payload not yet sent due to flow control */
+	buffer_t *resp_body;
+	size_t resp_offset;
+
+	bool request_finished:1;
+	bool response_sent:1;
+};
+
+struct server_connection {
+	struct connection conn;
+	void *context;
+	unsigned int index;
+
+	pool_t pool;
+	struct http2_hpack_decoder *decoder;
+	struct http2_hpack_encoder *encoder;
+	ARRAY(struct server_stream *) streams;
+
+	uint32_t initial_window_size;
+	int64_t send_window;
+
+	buffer_t *header_block;
+	uint32_t header_block_stream_id;
+	bool header_block_end_stream;
+
+	bool preface_received:1;
+};
+
+typedef void (*test_server_init_t)(unsigned int index);
+typedef bool
+(*test_client_init_t)(const struct http_client_settings *client_set);
+
+/*
+ * State
+ */
+
+/* common */
+static struct ip_addr bind_ip;
+static in_port_t *bind_ports = 0;
+static struct ioloop *ioloop;
+static bool debug = FALSE;
+
+/* server */
+static struct io *io_listen;
+static int fd_listen = -1;
+static struct connection_list *server_conn_list;
+static unsigned int server_conn_count;
+static unsigned int server_max_concurrent_streams;
+static void (*test_server_request)(struct server_connection *conn,
+				   struct server_stream *stream);
+
+/* client */
+static struct timeout *to_client_progress = NULL;
+static struct http_client *http_client = NULL;
+
+/*
+ * Forward declarations
+ */
+
+/* server */
+static void test_server_run(unsigned int index);
+
+/* client */
+static void test_client_defaults(struct http_client_settings *http_set);
+static void test_client_deinit(void);
+
+/* test*/
+static void
+test_run_client_server(const struct http_client_settings *client_set,
+		       test_client_init_t client_test,
+		       test_server_init_t server_test,
+		       unsigned int server_tests_count);
+
+/*
+ * Test server: HTTP/2 framing
+ */
+
+static void
+server_send_frame(struct server_connection *conn, enum http2_frame_type type,
+		  uint8_t flags, uint32_t stream_id,
+		  const void *payload, size_t size)
+{
+	buffer_t *buf = t_buffer_create(HTTP2_FRAME_HEADER_SIZE + size);
+
+	http2_frame_append(buf, type, flags, stream_id, payload, size);
+	o_stream_nsend(conn->conn.output, buf->data, buf->used);
+}
+
+static void
+server_send_rst_stream(struct server_connection *conn,
+		       struct server_stream *stream,
+		       enum http2_error_code error_code)
+{
+	buffer_t *buf = t_buffer_create(HTTP2_FRAME_HEADER_SIZE + 4);
+
+	http2_frame_append_rst_stream(buf, stream->id, error_code);
+	o_stream_nsend(conn->conn.output, buf->data, buf->used);
+	stream->response_sent = TRUE;
+}
+
+static void
+server_send_goaway(struct server_connection *conn, uint32_t last_stream_id)
+{
+	buffer_t *buf = t_buffer_create(HTTP2_FRAME_HEADER_SIZE + 8);
+
+	http2_frame_append_goaway(buf, last_stream_id, HTTP2_ERROR_NO_ERROR,
+				  NULL);
+	o_stream_nsend(conn->conn.output, buf->data, buf->used);
+}
+
+static void
+server_send_window_update(struct server_connection *conn, uint32_t stream_id,
+			  uint32_t increment)
+{
+	buffer_t *buf = t_buffer_create(HTTP2_FRAME_HEADER_SIZE + 4);
+
+	http2_frame_append_window_update(buf, stream_id, increment);
+	o_stream_nsend(conn->conn.output, buf->data, buf->used);
+}
+
+static void
+server_send_response_body(struct server_connection *conn,
+			  struct server_stream *stream)
+{
+	const unsigned char *data;
+	size_t size;
+
+	while (stream->resp_body != NULL) {
+		size = stream->resp_body->used - stream->resp_offset;
+		size = I_MIN(size, HTTP2_DEFAULT_MAX_FRAME_SIZE);
+		size = I_MIN(size, (size_t)I_MAX(stream->send_window, 0));
+		size = I_MIN(size, (size_t)I_MAX(conn->send_window, 0));
+		if (size == 0 &&
+		    stream->resp_offset < stream->resp_body->used) {
+			/* Wait for WINDOW_UPDATE */
+			return;
+		}
+
+		data = CONST_PTR_OFFSET(stream->resp_body->data,
+					stream->resp_offset);
+		stream->resp_offset += size;
+		stream->send_window -= size;
+		conn->send_window -= size;
+
+		if (stream->resp_offset == stream->resp_body->used) {
+			server_send_frame(conn, HTTP2_FRAME_DATA,
+					  HTTP2_FRAME_FLAG_END_STREAM,
+					  stream->id, data, size);
+			buffer_free(&stream->resp_body);
+		} else {
+			server_send_frame(conn, HTTP2_FRAME_DATA, 0,
+					  stream->id, data, size);
+		}
+	}
+}
+
+static void
+server_send_response(struct server_connection *conn,
+		     struct server_stream *stream, unsigned int status,
+		     const char *hdr_name, const char *hdr_value,
+		     const void *body, size_t body_size)
+{
+	buffer_t *block = t_buffer_create(128);
+	uint8_t flags = HTTP2_FRAME_FLAG_END_HEADERS;
+
+	http2_hpack_encode_begin(conn->encoder, block);
+	http2_hpack_encode_header(conn->encoder, block, ":status",
+				  dec2str(status), FALSE);
+	http2_hpack_encode_header(conn->encoder, block, "x-connection",
+				  dec2str(conn->index), FALSE);
+	if (hdr_name != NULL) {
+		http2_hpack_encode_header(conn->encoder, block,
+					  hdr_name, hdr_value, FALSE);
+	}
+	http2_hpack_encode_header(conn->encoder, block, "content-length",
+				  dec2str(body_size), FALSE);
+	if (body_size == 0)
+		flags |= HTTP2_FRAME_FLAG_END_STREAM;
+	server_send_frame(conn, HTTP2_FRAME_HEADERS, flags, stream->id,
+			  block->data, block->used);
+	stream->response_sent = TRUE;
+
+	if (body_size > 0) {
+		stream->resp_body = buffer_create_dynamic(default_pool,
+							  body_size);
+		buffer_append(stream->resp_body, body, body_size);
+		server_send_response_body(conn, stream);
+	}
+}
+
+static struct server_stream *
+server_stream_find(struct server_connection *conn, uint32_t id)
+{
+	struct server_stream *stream;
+
+	array_foreach_elem(&conn->streams, stream) {
+		if (stream->id == id)
+			return stream;
+	}
+	return NULL;
+}
+
+static void server_stream_request(struct server_connection *conn,
+				  struct server_stream *stream)
+{
+	if (debug) {
+		i_debug("REQUEST: %s %s (stream %u, %zu bytes)",
+			stream->method, stream->path, stream->id,
+			stream->body->used);
+	}
+	stream->request_finished = TRUE;
+	test_server_request(conn, stream);
+}
+
+static void
+server_input_headers(struct server_connection *conn)
+{
+	ARRAY_TYPE(http2_hpack_header) headers;
+	const struct http2_hpack_header *hdr;
+	struct server_stream *stream;
+	const char *error;
+
+	t_array_init(&headers, 16);
+	if (http2_hpack_decode(conn->decoder, conn->header_block->data,
+			       conn->header_block->used, SIZE_MAX,
+			       conn->pool, &headers, &error) < 0)
+		i_fatal("server: Invalid header block: %s", error);
+	buffer_set_used_size(conn->header_block, 0);
+
+	stream = p_new(conn->pool, struct server_stream, 1);
+	stream->id = conn->header_block_stream_id;
+	stream->body = buffer_create_dynamic(default_pool, 256);
+	stream->send_window = conn->initial_window_size;
+	array_foreach(&headers, hdr) {
+		if (strcmp(hdr->name, ":method") == 0)
+			stream->method = hdr->value;
+		else if (strcmp(hdr->name, ":path") == 0)
+			stream->path = hdr->value;
+		else if (strcmp(hdr->name, "connection") == 0 ||
+			 strcmp(hdr->name, "host") == 0)
+			i_fatal("server: Invalid header field %s", hdr->name);
+	}
+	if (stream->method == NULL || stream->path == NULL)
+		i_fatal("server: Missing pseudo-header fields");
+	array_push_back(&conn->streams, &stream);
+
+	if (conn->header_block_end_stream)
+		server_stream_request(conn, stream);
+	conn->header_block_stream_id = 0;
+}
+
+static void
+server_input_settings(struct server_connection *conn,
+		      const struct http2_frame_header *hdr,
+		      const unsigned char *payload)
+{
+	struct server_stream *stream;
+	uint32_t i, value;
+
+	if ((hdr->flags & HTTP2_FRAME_FLAG_ACK) != 0)
+		return;
+	for (i = 0; i + HTTP2_SETTING_SIZE <= hdr->length;
+	     i += HTTP2_SETTING_SIZE) {
+		if (be16_to_cpu_unaligned(payload + i) !=
+		    HTTP2_SETTING_INITIAL_WINDOW_SIZE)
+			continue;
+		value = be32_to_cpu_unaligned(payload + i + 2);
+		array_foreach_elem(&conn->streams, stream) {
+			stream->send_window +=
+				(int64_t)value - conn->initial_window_size;
+		}
+		conn->initial_window_size = value;
+	}
+	server_send_frame(conn, HTTP2_FRAME_SETTINGS, HTTP2_FRAME_FLAG_ACK,
+			  0, NULL, 0);
+}
+
+static void
+server_input_frame(struct server_connection *conn,
+		   const struct http2_frame_header *hdr,
+		   const unsigned char *payload)
+{
+	struct server_stream *stream;
+	const unsigned char *data = payload;
+	size_t size = hdr->length;
+	uint32_t increment;
+
+	switch (hdr->type) {
+	case HTTP2_FRAME_SETTINGS:
+		server_input_settings(conn, hdr, payload);
+		break;
+	case HTTP2_FRAME_PING:
+		if ((hdr->flags & HTTP2_FRAME_FLAG_ACK) == 0) {
+			server_send_frame(conn, HTTP2_FRAME_PING,
+					  HTTP2_FRAME_FLAG_ACK, 0,
+					  payload, hdr->length);
+		}
+		break;
+	case HTTP2_FRAME_WINDOW_UPDATE:
+		increment = be32_to_cpu_unaligned(payload);
+		if (hdr->stream_id == 0)
+			conn->send_window += increment;
+		else if ((stream = server_stream_find(
+				conn, hdr->stream_id)) != NULL)
+			stream->send_window += increment;
+		array_foreach_elem(&conn->streams, stream)
+			server_send_response_body(conn, stream);
+		break;
+	case HTTP2_FRAME_HEADERS:
+		if (http2_frame_strip_padding(hdr, &data, &size) < 0)
+			i_fatal("server: Invalid padding");
+		conn->header_block_stream_id = hdr->stream_id;
+		conn->header_block_end_stream =
+			(hdr->flags & HTTP2_FRAME_FLAG_END_STREAM) != 0;
+		/* fall through */
+	case HTTP2_FRAME_CONTINUATION:
+		if (conn->header_block_stream_id != hdr->stream_id)
+			i_fatal("server: Unexpected CONTINUATION");
+		buffer_append(conn->header_block, data, size);
+		if ((hdr->flags & HTTP2_FRAME_FLAG_END_HEADERS) != 0)
+			server_input_headers(conn);
+		break;
+	case HTTP2_FRAME_DATA:
+		stream = server_stream_find(conn, hdr->stream_id);
+		/* Give the flow control credit back right away */
+		if (hdr->length > 0) {
+			server_send_window_update(conn, 0, hdr->length);
+			if (stream != NULL && !stream->response_sent) {
+				server_send_window_update(
+					conn, hdr->stream_id, hdr->length);
+			}
+		}
+		if (stream == NULL || stream->response_sent)
+			break;
+		if (http2_frame_strip_padding(hdr, &data, &size) < 0)
+			i_fatal("server: Invalid padding");
+		buffer_append(stream->body, data, size);
+		if ((hdr->flags & HTTP2_FRAME_FLAG_END_STREAM) != 0)
+			server_stream_request(conn, stream);
+		break;
+	case HTTP2_FRAME_RST_STREAM:
+		stream = server_stream_find(conn, hdr->stream_id);
+		if (stream != NULL) {
+			if (stream->resp_body != NULL)
+				buffer_free(&stream->resp_body);
+			stream->response_sent = TRUE;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Test server: connection
+ */
+
+static void server_connection_input(struct connection *_conn)
+{
+	struct server_connection *conn = (struct server_connection *)_conn;
+	struct istream *input = conn->conn.input;
+	struct http2_frame_header hdr;
+	const unsigned char *data;
+	size_t size;
+
+	if (i_stream_read(input) == -1) {
+		if (input->stream_errno != 0) {
+			i_fatal("server: Stream error: %s",
+				i_stream_get_error(input));
+		}
+		connection_deinit(&conn->conn);
+		return;
+	}
+
+	o_stream_cork(conn->conn.output);
+	data = i_stream_get_data(input, &size);
+	if (!conn->preface_received) {
+		if (size < HTTP2_CONNECTION_PREFACE_LEN)
+			return;
+		if (memcmp(data, HTTP2_CONNECTION_PREFACE,
+			   HTTP2_CONNECTION_PREFACE_LEN) != 0)
+			i_fatal("server: Invalid connection preface");
+		i_stream_skip(input, HTTP2_CONNECTION_PREFACE_LEN);
+		conn->preface_received = TRUE;
+		data = i_stream_get_data(input, &size);
+	}
+	while (size >= HTTP2_FRAME_HEADER_SIZE) {
+		http2_frame_header_parse(data, &hdr);
+		if (size < HTTP2_FRAME_HEADER_SIZE + hdr.length)
+			break;
+		T_BEGIN {
+			server_input_frame(conn, &hdr,
+					   data + HTTP2_FRAME_HEADER_SIZE);
+		} T_END;
+		i_stream_skip(input, HTTP2_FRAME_HEADER_SIZE + hdr.length);
+		data = i_stream_get_data(input, &size);
+	}
+	if (o_stream_uncork_flush(conn->conn.output) < 0) {
+		i_fatal("server: Flush error: %s",
+			o_stream_get_error(conn->conn.output));
+	}
+}
+
+static void server_connection_init(int fd)
+{
+	struct server_connection *conn;
+	buffer_t *buf;
+	pool_t pool;
+
+	net_set_nonblock(fd, TRUE);
+
+	pool = pool_alloconly_create("server connection", 16384);
+	conn = p_new(pool, struct server_connection, 1);
+	conn->pool = pool;
+	conn->index = ++server_conn_count;
+	conn->decoder = http2_hpack_decoder_init(HTTP2_HPACK_DEFAULT_TABLE_SIZE);
+	conn->encoder = http2_hpack_encoder_init(HTTP2_HPACK_DEFAULT_TABLE_SIZE,
+						 TRUE);
+	p_array_init(&conn->streams, pool, 16);
+	conn->header_block = buffer_create_dynamic(pool, 1024);
+	conn->initial_window_size = HTTP2_DEFAULT_WINDOW_SIZE;
+	conn->send_window = HTTP2_DEFAULT_WINDOW_SIZE;
+
+	connection_init_server(server_conn_list, &conn->conn,
+			       "server connection", fd, fd);
+
+	/* Server connection preface */
+	buf = t_buffer_create(64);
+	if (server_max_concurrent_streams > 0) {
+		http2_frame_header_append(buf, HTTP2_FRAME_SETTINGS, 0, 0,
+					  HTTP2_SETTING_SIZE);
+		http2_frame_setting_append(
+			buf, HTTP2_SETTING_MAX_CONCURRENT_STREAMS,
+			server_max_concurrent_streams);
+	} else {
+		http2_frame_header_append(buf, HTTP2_FRAME_SETTINGS, 0, 0, 0);
+	}
+	o_stream_nsend(conn->conn.output, buf->data, buf->used);
+}
+
+static void server_connection_destroy(struct connection *_conn)
+{
+	struct server_connection *conn = (struct server_connection *)_conn;
+	struct server_stream *stream;
+
+	array_foreach_elem(&conn->streams, stream) {
+		buffer_free(&stream->body);
+		if (stream->resp_body != NULL)
+			buffer_free(&stream->resp_body);
+	}
+	http2_hpack_decoder_deinit(&conn->decoder);
+	http2_hpack_encoder_deinit(&conn->encoder);
+	connection_deinit(&conn->conn);
+	pool_unref(&conn->pool);
+}
+
+static void server_connection_accept(void *context ATTR_UNUSED)
+{
+	int fd;
+
+	/* accept new client */
+	fd = net_accept(fd_listen, NULL, NULL);
+	if (fd == -1) {
+		if (!NET_ACCEPT_ENOCONN(errno))
+			i_fatal("test server: accept() failed: %m");
+		return;
+	}
+
+	server_connection_init(fd);
+}
+
+/* */
+
+static struct connection_settings server_connection_set = {
+	.input_max_size = SIZE_MAX,
+	.output_max_size = SIZE_MAX,
+	.client = FALSE
+};
+
+static const struct connection_vfuncs server_connection_vfuncs = {
+	.destroy = server_connection_destroy,
+	.input = server_connection_input
+};
+
+static void test_server_run(unsigned int index ATTR_UNUSED)
+{
+	/* open server socket */
+	io_listen = io_add(fd_listen, IO_READ, server_connection_accept, NULL);
+
+	server_conn_list = connection_list_init(&server_connection_set,
+						&server_connection_vfuncs);
+
+	io_loop_run(ioloop);
+
+	/* close server socket */
+	io_remove(&io_listen);
+
+	connection_list_deinit(&server_conn_list);
+}
+
+/*
+ * Multiplexing
+ */
+
+/* server */
+
+#define MULTIPLEX_REQUEST_COUNT 5
+
+static void
+test_multiplex_request(struct server_connection *conn,
+		       struct server_stream *stream ATTR_UNUSED)
+{
+	struct server_stream *const *streams;
+	unsigned int i, count;
+
+	/* Respond only after all the requests have arrived, in reverse
+	   order */
+	streams = array_get(&conn->streams, &count);
+	if (count < MULTIPLEX_REQUEST_COUNT)
+		return;
+	for (i = count; i > 0; i--) {
+		server_send_response(conn, streams[i-1], 200, NULL, NULL,
+				     streams[i-1]->path,
+				     strlen(streams[i-1]->path));
+	}
+}
+
+static void test_server_multiplex(unsigned int index)
+{
+	test_server_request = test_multiplex_request;
+	test_server_run(index);
+}
+
+/* client */
+
+struct _multiplex {
+	unsigned int count;
+};
+
+struct _multiplex_request {
+	struct _multiplex *ctx;
+	char *path;
+	struct istream *payload;
+	struct io *io;
+	string_t *body;
+};
+
+static void
+test_client_multiplex_request_finished(struct _multiplex_request *mreq)
+{
+	struct _multiplex *ctx = mreq->ctx;
+
+	/* Responses match the requests even though they arrived in a
+	   different order */
+	test_assert_strcmp(str_c(mreq->body), mreq->path);
+
+	io_remove(&mreq->io);
+	i_stream_unref(&mreq->payload);
+	str_free(&mreq->body);
+	i_free(mreq->path);
+	i_free(mreq);
+
+	if (--ctx->count == 0) {
+		i_free(ctx);
+		io_loop_stop(ioloop);
+	}
+}
+
+static void test_client_multiplex_payload_input(struct _multiplex_request *mreq)
+{
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	while ((ret = i_stream_read_more(mreq->payload, &data, &size)) > 0) {
+		str_append_data(mreq->body, data, size);
+		i_stream_skip(mreq->payload, size);
+	}
+	if (ret == 0)
+		return;
+	test_assert(mreq->payload->stream_errno == 0);
+	test_client_multiplex_request_finished(mreq);
+}
+
+static void
+test_client_multiplex_response(const struct http_response *resp,
+			       struct _multiplex_request *mreq)
+{
+	test_assert(resp->status == 200);
+	test_assert(resp->version_major == 2);
+	/* All requests used the same connection */
+	test_assert_strcmp(http_response_header_get(resp, "x-connection"),
+			   "1");
+	test_assert(resp->payload != NULL);
+	if (resp->payload == NULL) {
+		test_client_multiplex_request_finished(mreq);
+		return;
+	}
+
+	mreq->payload = resp->payload;
+	i_stream_ref(mreq->payload);
+	mreq->io = io_add_istream(mreq->payload,
+				  test_client_multiplex_payload_input, mreq);
+	test_client_multiplex_payload_input(mreq);
+}
+
+static bool
+test_client_multiplex(const struct http_client_settings *client_set)
+{
+	struct http_client_request *hreq;
+	struct _multiplex_request *mreq;
+	struct _multiplex *ctx;
+	unsigned int i;
+
+	ctx = i_new(struct _multiplex, 1);
+	ctx->count = MULTIPLEX_REQUEST_COUNT;
+
+	http_client = http_client_init(client_set, NULL);
+
+	for (i = 0; i < MULTIPLEX_REQUEST_COUNT; i++) {
+		mreq = i_new(struct _multiplex_request, 1);
+		mreq->ctx = ctx;
+		mreq->path = i_strdup_printf("/multiplex-%u.txt", i);
+		mreq->body = str_new(default_pool, 32);
+
+		hreq = http_client_request(
+			http_client, "GET", net_ip2addr(&bind_ip),
+			mreq->path, test_client_multiplex_response, mreq);
+		http_client_request_set_port(hreq, bind_ports[0]);
+		http_client_request_submit(hreq);
+	}
+	return TRUE;
+}
+
+/* test */
+
+static void test_multiplex(void)
+{
+	struct http_client_settings http_client_set;
+
+	test_client_defaults(&http_client_set);
+
+	test_begin("http2 multiplexed requests");
+	test_run_client_server(&http_client_set,
+			       test_client_multiplex,
+			       test_server_multiplex, 1);
+	test_end();
+}
+
+/*
+ * Flow control
+ */
+
+/* server */
+
+#define FLOW_CONTROL_PAYLOAD_SIZE (1024*1024 + 17)
+
+static void
+test_flow_control_request(struct server_connection *conn,
+			  struct server_stream *stream)
+{
+	unsigned char *data;
+	size_t i;
+
+	if (strcmp(stream->method, "POST") == 0) {
+		/* Echo the size of the received payload */
+		const char *size = dec2str(stream->body->used);
+
+		server_send_response(conn, stream, 200, NULL, NULL,
+				     size, strlen(size));
+		return;
+	}
+
+	/* Larger than the client's receive windows */
+	data = i_malloc(FLOW_CONTROL_PAYLOAD_SIZE);
+	for (i = 0; i < FLOW_CONTROL_PAYLOAD_SIZE; i++)
+		data[i] = 'a' + i % 26;
+	server_send_response(conn, stream, 200, NULL, NULL,
+			     data, FLOW_CONTROL_PAYLOAD_SIZE);
+	i_free(data);
+}
+
+static void test_server_flow_control(unsigned int index)
+{
+	test_server_request = test_flow_control_request;
+	test_server_run(index);
+}
+
+/* client */
+
+struct _flow_control {
+	unsigned int count;
+	unsigned char *post_data;
+};
+
+struct _flow_control_request {
+	struct _flow_control *ctx;
+	struct istream *payload;
+	struct io *io;
+	uoff_t offset;
+	string_t *body;
+};
+
+static void
+test_client_flow_control_finished(struct _flow_control_request *freq)
+{
+	struct _flow_control *ctx = freq->ctx;
+
+	io_remove(&freq->io);
+	i_stream_unref(&freq->payload);
+	str_free(&freq->body);
+	i_free(freq);
+
+	if (--ctx->count == 0) {
+		i_free(ctx->post_data);
+		i_free(ctx);
+		io_loop_stop(ioloop);
+	}
+}
+
+static void
+test_client_flow_control_payload_input(struct _flow_control_request *freq)
+{
+	const unsigned char *data;
+	size_t i, size;
+	int ret;
+
+	while ((ret = i_stream_read_more(freq->payload, &data, &size)) > 0) {
+		if (freq->body != NULL)
+			str_append_data(freq->body, data, size);
+		else {
+			for (i = 0; i < size; i++) {
+				if (data[i] != 'a' + (freq->offset + i) % 26)
+					break;
+			}
+			test_assert(i == size);
+		}
+		freq->offset += size;
+		i_stream_skip(freq->payload, size);
+	}
+	if (ret == 0)
+		return;
+
+	test_assert(freq->payload->stream_errno == 0);
+	if (freq->body != NULL) {
+		/* The server echoes the size of the request payload */
+		test_assert_strcmp(str_c(freq->body),
+				   dec2str(FLOW_CONTROL_PAYLOAD_SIZE));
+	} else {
+		test_assert(freq->offset == FLOW_CONTROL_PAYLOAD_SIZE);
+	}
+	test_client_flow_control_finished(freq);
+}
+
+static void
+test_client_flow_control_response(const struct http_response *resp,
+				  struct _flow_control_request *freq)
+{
+	test_assert(resp->status == 200);
+	test_assert(resp->payload != NULL);
+	if (resp->payload == NULL) {
+		test_client_flow_control_finished(freq);
+		return;
+	}
+
+	freq->payload = resp->payload;
+	i_stream_ref(freq->payload);
+	freq->io = io_add_istream(freq->payload,
+				  test_client_flow_control_payload_input, freq);
+	test_client_flow_control_payload_input(freq);
+}
+
+static bool
+test_client_flow_control(const struct http_client_settings *client_set)
+{
+	struct http_client_request *hreq;
+	struct _flow_control_request *freq;
+	struct _flow_control *ctx;
+	struct istream *input;
+	size_t i;
+
+	ctx = i_new(struct _flow_control, 1);
+	ctx->count = 2;
+
+	http_client = http_client_init(client_set, NULL);
+
+	freq = i_new(struct _flow_control_request, 1);
+	freq->ctx = ctx;
+	hreq = http_client_request(
+		http_client, "GET", net_ip2addr(&bind_ip),
+		"/flow-control.txt",
+		test_client_flow_control_response, freq);
+	http_client_request_set_port(hreq, bind_ports[0]);
+	http_client_request_submit(hreq);
+
+	/* Larger than the server's initial window */
+	ctx->post_data = i_malloc(FLOW_CONTROL_PAYLOAD_SIZE);
+	for (i = 0; i < FLOW_CONTROL_PAYLOAD_SIZE; i++)
+		ctx->post_data[i] = 'A' + i % 26;
+	input = i_stream_create_from_data(ctx->post_data,
+					  FLOW_CONTROL_PAYLOAD_SIZE);
+
+	freq = i_new(struct _flow_control_request, 1);
+	freq->ctx = ctx;
+	freq->body = str_new(default_pool, 32);
+	hreq = http_client_request(
+		http_client, "POST", net_ip2addr(&bind_ip),
+		"/flow-control.txt",
+		test_client_flow_control_response, freq);
+	http_client_request_set_port(hreq, bind_ports[0]);
+	http_client_request_set_payload(hreq, input, FALSE);
+	http_client_request_submit(hreq);
+	i_stream_unref(&input);
+	return TRUE;
+}
+
+/* test */
+
+static void test_flow_control(void)
+{
+	struct http_client_settings http_client_set;
+
+	test_client_defaults(&http_client_set);
+
+	test_begin("http2 flow control");
+	test_run_client_server(&http_client_set,
+			       test_client_flow_control,
+			       test_server_flow_control, 1);
+	test_end();
+}
+
+/*
+ * Concurrent stream limit
+ */
+
+/* server */
+
+static void
+test_stream_limit_request(struct server_connection *conn,
+			  struct server_stream *stream)
+{
+	struct server_stream *other;
+	unsigned int open_streams = 0;
+
+	array_foreach_elem(&conn->streams, other) {
+		if (!other->response_sent)
+			open_streams++;
+	}
+	if (open_streams > server_max_concurrent_streams) {
+		server_send_rst_stream(conn, stream,
+				       HTTP2_ERROR_PROTOCOL_ERROR);
+		return;
+	}
+	if (open_streams < server_max_concurrent_streams)
+		return;
+
+	/* Respond once the client has used all the allowed streams */
+	array_foreach_elem(&conn->streams, other) {
+		if (!other->response_sent) {
+			server_send_response(conn, other, 200, NULL, NULL,
+					     NULL, 0);
+		}
+	}
+}
+
+static void test_server_stream_limit(unsigned int index)
+{
+	server_max_concurrent_streams = 2;
+	test_server_request = test_stream_limit_request;
+	test_server_run(index);
+}
+
+/* client */
+
+struct _stream_limit {
+	unsigned int count;
+};
+
+static void
+test_client_stream_limit_response(const struct http_response *resp,
+				  struct _stream_limit *ctx)
+{
+	test_assert(resp->status == 200);
+	test_assert_strcmp(http_response_header_get(resp, "x-connection"),
+			   "1");
+
+	if (--ctx->count == 0) {
+		i_free(ctx);
+		io_loop_stop(ioloop);
+	}
+}
+
+static bool
+test_client_stream_limit(const struct http_client_settings *client_set)
+{
+	struct http_client_request *hreq;
+	struct _stream_limit *ctx;
+	unsigned int i;
+
+	ctx = i_new(struct _stream_limit, 1);
+	ctx->count = 10;
+
+	http_client = http_client_init(client_set, NULL);
+
+	for (i = 0; i < ctx->count; i++) {
+		hreq = http_client_request(
+			http_client, "GET", net_ip2addr(&bind_ip),
+			t_strdup_printf("/stream-limit-%u.txt", i),
+			test_client_stream_limit_response, ctx);
+		http_client_request_set_port(hreq, bind_ports[0]);
+		http_client_request_submit(hreq);
+	}
+	return TRUE;
+}
+
+/* test */
+
+static void test_stream_limit(void)
+{
+	struct http_client_settings http_client_set;
+
+	test_client_defaults(&http_client_set);
+	http_client_set.max_parallel_connections = 4;
+
+	test_begin("http2 concurrent stream limit");
+	test_run_client_server(&http_client_set,
+			       test_client_stream_limit,
+			       test_server_stream_limit, 1);
+	test_end();
+}
+
+/*
+ * Refused stream
+ */
+
+/* server */
+
+static void
+test_refused_stream_request(struct server_connection *conn,
+			    struct server_stream *stream)
+{
+	/* Refuse every other stream */
+	if ((stream->id % 4) == 1) {
+		server_send_rst_stream(conn, stream,
+				       HTTP2_ERROR_REFUSED_STREAM);
+		return;
+	}
+	server_send_response(conn, stream, 200, NULL, NULL, NULL, 0);
+}
+
+static void test_server_refused_stream(unsigned int index)
+{
+	test_server_request = test_refused_stream_request;
+	test_server_run(index);
+}
+
+/* client */
+
+struct _refused_stream {
+	unsigned int count;
+};
+
+static void
+test_client_refused_stream_response(const struct http_response *resp,
+				    struct _refused_stream *ctx)
+{
+	test_assert(resp->status == 200);
+
+	if (--ctx->count == 0) {
+		i_free(ctx);
+		io_loop_stop(ioloop);
+	}
+}
+
+static bool
+test_client_refused_stream(const struct http_client_settings *client_set)
+{
+	struct http_client_request *hreq;
+	struct _refused_stream *ctx;
+	unsigned int i;
+
+	ctx = i_new(struct _refused_stream, 1);
+	ctx->count = 4;
+
+	http_client = http_client_init(client_set, NULL);
+
+	for (i = 0; i < ctx->count; i++) {
+		hreq = http_client_request(
+			http_client, "GET", net_ip2addr(&bind_ip),
+			t_strdup_printf("/refused-stream-%u.txt", i),
+			test_client_refused_stream_response, ctx);
+		http_client_request_set_port(hreq, bind_ports[0]);
+		http_client_request_submit(hreq);
+	}
+	return TRUE;
+}
+
+/* test */
+
+static void test_refused_stream(void)
+{
+	struct http_client_settings http_client_set;
+
+	test_client_defaults(&http_client_set);
+
+	test_begin("http2 refused stream");
+	test_run_client_server(&http_client_set,
+			       test_client_refused_stream,
+			       test_server_refused_stream, 1);
+	test_end();
+}
+
+/*
+ * GOAWAY
+ */
+
+/* server */
+
+#define GOAWAY_REQUEST_COUNT 3
+
+static void
+test_goaway_request(struct server_connection *conn,
+		    struct server_stream *stream ATTR_UNUSED)
+{
+	struct server_stream *const *streams;
+	unsigned int i, count;
+
+	if (conn->index > 1) {
+		server_send_response(conn, stream, 200, NULL, NULL, NULL, 0);
+		return;
+	}
+
+	/* First connection: Process only the first request */
+	streams = array_get(&conn->streams, &count);
+	if (count < GOAWAY_REQUEST_COUNT)
+		return;
+	server_send_goaway(conn, streams[0]->id);
+	server_send_response(conn, streams[0], 200, NULL, NULL, NULL, 0);
+	for (i = 1; i < count; i++)
+		streams[i]->response_sent = TRUE;
+}
+
+static void test_server_goaway(unsigned int index)
+{
+	test_server_request = test_goaway_request;
+	test_server_run(index);
+}
+
+/* client */
+
+struct _goaway {
+	unsigned int count;
+	unsigned int conn1, conn2;
+};
+
+static void
+test_client_goaway_response(const struct http_response *resp,
+			    struct _goaway *ctx)
+{
+	const char *conn_index =
+		http_response_header_get(resp, "x-connection");
+
+	test_assert(resp->status == 200);
+	if (null_strcmp(conn_index, "1") == 0)
+		ctx->conn1++;
+	else if (null_strcmp(conn_index, "2") == 0)
+		ctx->conn2++;
+	else
+		test_assert(FALSE);
+
+	if (--ctx->count == 0) {
+		/* The unprocessed requests were sent again on a new
+		   connection */
+		test_assert(ctx->conn1 == 1);
+		test_assert(ctx->conn2 == GOAWAY_REQUEST_COUNT - 1);
+		i_free(ctx);
+		io_loop_stop(ioloop);
+	}
+}
+
+static bool
+test_client_goaway(const struct http_client_settings *client_set)
+{
+	struct http_client_request *hreq;
+	struct _goaway *ctx;
+	unsigned int i;
+
+	ctx = i_new(struct _goaway, 1);
+	ctx->count = GOAWAY_REQUEST_COUNT;
+
+	http_client = http_client_init(client_set, NULL);
+
+	for (i = 0; i < ctx->count; i++) {
+		hreq = http_client_request(
+			http_client, "GET", net_ip2addr(&bind_ip),
+			t_strdup_printf("/goaway-%u.txt", i),
+			test_client_goaway_response, ctx);
+		http_client_request_set_port(hreq, bind_ports[0]);
+		http_client_request_submit(hreq);
+	}
+	return TRUE;
+}
+
+/* test */
+
+static void test_goaway(void)
+{
+	struct http_client_settings http_client_set;
+
+	test_client_defaults(&http_client_set);
+
+	test_begin("http2 goaway");
+	test_run_client_server(&http_client_set,
+			       test_client_goaway,
+			       test_server_goaway, 1);
+	test_end();
+}
+
+/*
+ * All tests
+ */
+
+static void (*const test_functions[])(void) = {
+	test_multiplex,
+	test_flow_control,
+	test_stream_limit,
+	test_refused_stream,
+	test_goaway,
+	NULL
+};
+
+/*
+ * Test client
+ */
+
+static void test_client_defaults(struct http_client_settings *http_set)
+{
+	/* client settings */
+	http_client_settings_init(null_pool, http_set);
+
+	http_set->max_idle_time_msecs = 5*1000;
+	http_set->max_parallel_connections = 1;
+	http_set->max_pipelined_requests = 1;
+	http_set->request_max_redirects = 0;
+	http_set->request_max_attempts = 1;
+	http_set->http2_prior_knowledge = TRUE;
+}
+
+static void test_client_progress_timeout(void *context ATTR_UNUSED)
+{
+	/* Terminate test due to lack of progress */
+	test_assert(FALSE);
+	timeout_remove(&to_client_progress);
+	io_loop_stop(current_ioloop);
+}
+
+static bool
+test_client_init(test_client_init_t client_test,
+		 const struct http_client_settings *client_set)
+{
+	i_assert(client_test != NULL);
+	if (!client_test(client_set))
+		return FALSE;
+
+	to_client_progress = timeout_add(CLIENT_PROGRESS_TIMEOUT*1000,
+					 test_client_progress_timeout, NULL);
+	return TRUE;
+}
+
+static void test_client_deinit(void)
+{
+	timeout_remove(&to_client_progress);
+
+	if (http_client != NULL)
+		http_client_deinit(&http_client);
+}
+
+static void
+test_client_run(test_client_init_t client_test,
+		const struct http_client_settings *client_set)
+{
+	if (test_client_init(client_test, client_set))
+		io_loop_run(ioloop);
+	test_client_deinit();
+}
+
+/*
+ * Tests
+ */
+
+struct test_server_data {
+	unsigned int index;
+	test_server_init_t server_test;
+};
+
+static int test_open_server_fd(in_port_t *bind_port)
+{
+	int fd = net_listen(&bind_ip, bind_port, 128);
+	if (debug)
+		i_debug("server listening on %u", *bind_port);
+	if (fd == -1) {
+		i_fatal("listen(%s:%u) failed: %m",
+			net_ip2addr(&bind_ip), *bind_port);
+	}
+	return fd;
+}
+
+static int test_run_server(struct test_server_data *data)
+{
+	i_set_failure_prefix("SERVER[%u]: ", data->index + 1);
+
+	if (debug)
+		i_debug("PID=%s", my_pid);
+
+	test_subprocess_notify_signal_send_parent(SIGHUP);
+	ioloop = io_loop_create();
+	data->server_test(data->index);
+	io_loop_destroy(&ioloop);
+
+	if (debug)
+		i_debug("Terminated");
+
+	i_close_fd(&fd_listen);
+	i_free(bind_ports);
+	main_deinit();
+	return 0;
+}
+
+static void
+test_run_client(const struct http_client_settings *client_set,
+		test_client_init_t client_test)
+{
+	i_set_failure_prefix("CLIENT: ");
+
+	if (debug)
+		i_debug("PID=%s", my_pid);
+
+	ioloop = io_loop_create();
+	test_client_run(client_test, client_set);
+	io_loop_destroy(&ioloop);
+
+	if (debug)
+		i_debug("Terminated");
+}
+
+static void
+test_run_client_server(const struct http_client_settings *client_set,
+		       test_client_init_t client_test,
+		       test_server_init_t server_test,
+		       unsigned int server_tests_count)
+{
+	unsigned int i;
+
+	test_server_request = NULL;
+	server_conn_count = 0;
+	server_max_concurrent_streams = 0;
+
+	if (server_tests_count > 0) {
+		int fds[server_tests_count];
+
+		bind_ports = i_new(in_port_t, server_tests_count);
+		for (i = 0; i < server_tests_count; i++)
+			fds[i] = test_open_server_fd(&bind_ports[i]);
+
+		for (i = 0; i < server_tests_count; i++) {
+			struct test_server_data data;
+
+			i_zero(&data);
+			data.index = i;
+			data.server_test = server_test;
+
+			/* Fork server */
+			fd_listen = fds[i];
+			test_subprocess_notify_signal_reset(SIGHUP);
+			test_subprocess_fork(test_run_server, &data, FALSE);
+			test_subprocess_notify_signal_wait(
+				SIGHUP, TEST_SIGNALS_DEFAULT_TIMEOUT_MS);
+			i_close_fd(&fd_listen);
+		}
+	}
+
+	/* Run client */
+	test_run_client(client_set, client_test);
+
+	i_unset_failure_prefix();
+	test_subprocess_kill_all(SERVER_KILL_TIMEOUT_SECS);
+	i_free(bind_ports);
+}
+
+/*
+ * Main
+ */
+
+static void main_init(void)
+{
+	/* nothing yet */
+}
+
+static void main_deinit(void)
+{
+	/* also called from sub-processes */
+	settings_root_deinit(&set_root);
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	int ret;
+
+	lib_init();
+	main_init();
+	struct http_client_context *cctx = http_client_get_global_context();
+	set_root = settings_root_init();
+	event_set_ptr(cctx->event, SETTINGS_EVENT_ROOT, set_root);
+
+	while ((c = getopt(argc, argv, "D")) > 0) {
+		switch (c) {
+		case 'D':
+			debug = TRUE;
+			break;
+		default:
+			i_fatal("Usage: %s [-D]", argv[0]);
+		}
+	}
+
+	test_init();
+	event_set_forced_debug(test_event, debug);
+	test_subprocesses_init();
+
+	/* listen on localhost */
+	i_zero(&bind_ip);
+	bind_ip.family = AF_INET;
+	bind_ip.u.ip4.s_addr = htonl(INADDR_LOOPBACK);
+
+	ret = test_run(test_functions);
+
+	event_set_ptr(cctx->event, SETTINGS_EVENT_ROOT, NULL);
+
+	main_deinit();
+	lib_deinit();
+
+	return ret;
+}
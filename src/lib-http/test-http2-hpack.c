@@ -0,0 +1,412 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "hex-binary.h"
+#include "http2-hpack.h"
+
+#define TEST_MAX_HEADERS 8
+
+struct hpack_test_header {
+	const char *name, *value;
+	bool sensitive;
+};
+
+struct hpack_test_block {
+	const char *hex;
+	struct hpack_test_header headers[TEST_MAX_HEADERS];
+	size_t table_size;
+};
+
+struct hpack_test {
+	const char *name;
+	size_t max_table_size;
+	bool huffman;
+	struct hpack_test_block blocks[3];
+};
+
+/* RFC 7541, Appendix C */
+static const struct hpack_test hpack_tests[] = {
+	{
+		.name = "C.2.1 literal header field with indexing",
+		.max_table_size = 4096,
+		.blocks = {
+			{ "400a637573746f6d2d6b65790d637573746f6d2d686561646572",
+			  { { "custom-key", "custom-header", FALSE } }, 55 },
+		},
+	},
+	{
+		.name = "C.2.2 literal header field without indexing",
+		.max_table_size = 4096,
+		.blocks = {
+			{ "040c2f73616d706c652f70617468",
+			  { { ":path", "/sample/path", FALSE } }, 0 },
+		},
+	},
+	{
+		.name = "C.2.3 literal header field never indexed",
+		.max_table_size = 4096,
+		.blocks = {
+			{ "100870617373776f726406736563726574",
+			  { { "password", "secret", TRUE } }, 0 },
+		},
+	},
+	{
+		.name = "C.2.4 indexed header field",
+		.max_table_size = 4096,
+		.blocks = {
+			{ "82", { { ":method", "GET", FALSE } }, 0 },
+		},
+	},
+	{
+		.name = "C.3 requests without Huffman coding",
+		.max_table_size = 4096,
+		.blocks = {
+			{ "828684410f7777772e6578616d706c652e636f6d",
+			  { { ":method", "GET", FALSE },
+			    { ":scheme", "http", FALSE },
+			    { ":path", "/", FALSE },
+			    { ":authority", "www.example.com", FALSE } }, 57 },
+			{ "828684be58086e6f2d6361636865",
+			  { { ":method", "GET", FALSE },
+			    { ":scheme", "http", FALSE },
+			    { ":path", "/", FALSE },
+			    { ":authority", "www.example.com", FALSE },
+			    { "cache-control", "no-cache", FALSE } }, 110 },
+			{ "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+			  { { ":method", "GET", FALSE },
+			    { ":scheme", "https", FALSE },
+			    { ":path", "/index.html", FALSE },
+			    { ":authority", "www.example.com", FALSE },
+			    { "custom-key", "custom-value", FALSE } }, 164 },
+		},
+	},
+	{
+		.name = "C.4 requests with Huffman coding",
+		.max_table_size = 4096,
+		.huffman = TRUE,
+		.blocks = {
+			{ "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+			  { { ":method", "GET", FALSE },
+			    { ":scheme", "http", FALSE },
+			    { ":path", "/", FALSE },
+			    { ":authority", "www.example.com", FALSE } }, 57 },
+			{ "828684be5886a8eb10649cbf",
+			  { { ":method", "GET", FALSE },
+			    { ":scheme", "http", FALSE },
+			    { ":path", "/", FALSE },
+			    { ":authority", "www.example.com", FALSE },
+			    { "cache-control", "no-cache", FALSE } }, 110 },
+			{ "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+			  { { ":method", "GET", FALSE },
+			    { ":scheme", "https", FALSE },
+			    { ":path", "/index.html", FALSE },
+			    { ":authority", "www.example.com", FALSE },
+			    { "custom-key", "custom-value", FALSE } }, 164 },
+		},
+	},
+	{
+		.name = "C.5 responses without Huffman coding",
+		.max_table_size = 256,
+		.blocks = {
+			{ "4803333032580770726976617465611d4d6f6e2c203231204f6374"
+			  "20323031332032303a31333a323120474d546e1768747470733a2f"
+			  "2f7777772e6578616d706c652e636f6d",
+			  { { ":status", "302", FALSE },
+			    { "cache-control", "private", FALSE },
+			    { "date", "Mon, 21 Oct 2013 20:13:21 GMT", FALSE },
+			    { "location", "https://www.example.com", FALSE } },
+			  222 },
+			{ "4803333037c1c0bf",
+			  { { ":status", "307", FALSE },
+			    { "cache-control", "private", FALSE },
+			    { "date", "Mon, 21 Oct 2013 20:13:21 GMT", FALSE },
+			    { "location", "https://www.example.com", FALSE } },
+			  222 },
+			{ "88c1611d4d6f6e2c203231204f637420323031332032303a31333a"
+			  "323220474d54c05a04677a69707738666f6f3d4153444a4b48514b"
+			  "425a584f5157454f50495541585157454f49553b206d61782d6167"
+			  "653d333630303b2076657273696f6e3d31",
+			  { { ":status", "200", FALSE },
+			    { "cache-control", "private", FALSE },
+			    { "date", "Mon, 21 Oct 2013 20:13:22 GMT", FALSE },
+			    { "location", "https://www.example.com", FALSE },
+			    { "content-encoding", "gzip", FALSE },
+			    { "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; "
+			      "max-age=3600; version=1", FALSE } },
+			  215 },
+		},
+	},
+	{
+		.name = "C.6 responses with Huffman coding",
+		.max_table_size = 256,
+		.huffman = TRUE,
+		.blocks = {
+			{ "488264025885aec3771a4b6196d07abe941054d444a8200595040b"
+			  "8166e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+			  { { ":status", "302", FALSE },
+			    { "cache-control", "private", FALSE },
+			    { "date", "Mon, 21 Oct 2013 20:13:21 GMT", FALSE },
+			    { "location", "https://www.example.com", FALSE } },
+			  222 },
+			{ "4883640effc1c0bf",
+			  { { ":status", "307", FALSE },
+			    { "cache-control", "private", FALSE },
+			    { "date", "Mon, 21 Oct 2013 20:13:21 GMT", FALSE },
+			    { "location", "https://www.example.com", FALSE } },
+			  222 },
+			{ "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc0"
+			  "5a839bd9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af2708"
+			  "7f3672c1ab270fb5291f9587316065c003ed4ee5b1063d5007",
+			  { { ":status", "200", FALSE },
+			    { "cache-control", "private", FALSE },
+			    { "date", "Mon, 21 Oct 2013 20:13:22 GMT", FALSE },
+			    { "location", "https://www.example.com", FALSE },
+			    { "content-encoding", "gzip", FALSE },
+			    { "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; "
+			      "max-age=3600; version=1", FALSE } },
+			  215 },
+		},
+	},
+};
+
+static buffer_t *test_hex_to_binary(const char *hex)
+{
+	buffer_t *buf = t_buffer_create(strlen(hex) / 2);
+
+	if (hex_to_binary(hex, buf) < 0)
+		i_unreached();
+	return buf;
+}
+
+static void test_http2_hpack_decode(void)
+{
+	ARRAY_TYPE(http2_hpack_header) headers;
+	struct http2_hpack_decoder *decoder;
+	const struct http2_hpack_header *hdr;
+	const struct hpack_test_block *block;
+	const char *error;
+	unsigned int i, j, k;
+	buffer_t *data;
+
+	for (i = 0; i < N_ELEMENTS(hpack_tests); i++) T_BEGIN {
+		test_begin(t_strdup_printf("http2 hpack decode [%s]",
+					   hpack_tests[i].name));
+		decoder = http2_hpack_decoder_init(
+			hpack_tests[i].max_table_size);
+		for (j = 0; j < N_ELEMENTS(hpack_tests[i].blocks); j++) {
+			block = &hpack_tests[i].blocks[j];
+			if (block->hex == NULL)
+				break;
+
+			data = test_hex_to_binary(block->hex);
+			t_array_init(&headers, TEST_MAX_HEADERS);
+			test_assert_idx(http2_hpack_decode(decoder,
+				data->data, data->used, SIZE_MAX,
+				pool_datastack_create(), &headers,
+				&error) == 0, j);
+			for (k = 0; block->headers[k].name != NULL; k++) {
+				if (k >= array_count(&headers))
+					break;
+				hdr = array_idx(&headers, k);
+				test_assert_strcmp_idx(hdr->name,
+					block->headers[k].name, k);
+				test_assert_strcmp_idx(hdr->value,
+					block->headers[k].value, k);
+			}
+			test_assert_idx(array_count(&headers) == k, j);
+			test_assert_idx(http2_hpack_decoder_get_table_size(
+				decoder) == block->table_size, j);
+		}
+		http2_hpack_decoder_deinit(&decoder);
+		test_end();
+	} T_END;
+}
+
+static void test_http2_hpack_encode(void)
+{
+	struct http2_hpack_encoder *encoder;
+	const struct hpack_test_block *block;
+	unsigned int i, j, k;
+	buffer_t *data;
+
+	for (i = 0; i < N_ELEMENTS(hpack_tests); i++) T_BEGIN {
+		test_begin(t_strdup_printf("http2 hpack encode [%s]",
+					   hpack_tests[i].name));
+		encoder = http2_hpack_encoder_init(
+			hpack_tests[i].max_table_size, hpack_tests[i].huffman);
+		for (j = 0; j < N_ELEMENTS(hpack_tests[i].blocks); j++) {
+			block = &hpack_tests[i].blocks[j];
+			if (block->hex == NULL)
+				break;
+
+			data = t_buffer_create(256);
+			http2_hpack_encode_begin(encoder, data);
+			for (k = 0; block->headers[k].name != NULL; k++) {
+				http2_hpack_encode_header(encoder, data,
+					block->headers[k].name,
+					block->headers[k].value,
+					block->headers[k].sensitive);
+			}
+			test_assert_strcmp_idx(binary_to_hex(data->data,
+							     data->used),
+					       block->hex, j);
+			test_assert_idx(http2_hpack_encoder_get_table_size(
+				encoder) == block->table_size, j);
+		}
+		http2_hpack_encoder_deinit(&encoder);
+		test_end();
+	} T_END;
+}
+
+static void test_http2_hpack_table_size_update(void)
+{
+	ARRAY_TYPE(http2_hpack_header) headers;
+	struct http2_hpack_encoder *encoder;
+	struct http2_hpack_decoder *decoder;
+	const char *error;
+	buffer_t *data;
+
+	test_begin("http2 hpack table size update");
+	encoder = http2_hpack_encoder_init(4096, TRUE);
+	decoder = http2_hpack_decoder_init(4096);
+	t_array_init(&headers, 4);
+
+	data = t_buffer_create(64);
+	http2_hpack_encode_begin(encoder, data);
+	http2_hpack_encode_header(encoder, data, "custom-key", "custom-value",
+				  FALSE);
+	test_assert(http2_hpack_decode(decoder, data->data, data->used,
+				       SIZE_MAX, pool_datastack_create(),
+				       &headers, &error) == 0);
+	test_assert(http2_hpack_decoder_get_table_size(decoder) == 54);
+
+	/* shrinking to zero and growing again signals both sizes */
+	http2_hpack_encoder_set_max_table_size(encoder, 0);
+	http2_hpack_encoder_set_max_table_size(encoder, 200);
+	test_assert(http2_hpack_encoder_get_table_size(encoder) == 0);
+	buffer_set_used_size(data, 0);
+	http2_hpack_encode_begin(encoder, data);
+	test_assert_strcmp(binary_to_hex(data->data, data->used), "203fa901");
+	http2_hpack_encode_header(encoder, data, "custom-key", "custom-value",
+				  FALSE);
+	array_clear(&headers);
+	test_assert(http2_hpack_decode(decoder, data->data, data->used,
+				       SIZE_MAX, pool_datastack_create(),
+				       &headers, &error) == 0);
+	test_assert(array_count(&headers) == 1);
+	test_assert(http2_hpack_decoder_get_table_size(decoder) == 54);
+
+	/* the update must not exceed our SETTINGS_HEADER_TABLE_SIZE */
+	data = test_hex_to_binary("3fe21f");
+	test_assert(http2_hpack_decode(decoder, data->data, data->used,
+				       SIZE_MAX, pool_datastack_create(),
+				       &headers, &error) < 0);
+
+	http2_hpack_decoder_deinit(&decoder);
+	http2_hpack_encoder_deinit(&encoder);
+	test_end();
+}
+
+static void test_http2_hpack_decode_invalid(void)
+{
+	static const struct {
+		const char *hex;
+		size_t max_list_size;
+	} tests[] = {
+		/* index 0 */
+		{ "80", SIZE_MAX },
+		/* index beyond the dynamic table */
+		{ "be", SIZE_MAX },
+		/* truncated integer */
+		{ "ff", SIZE_MAX },
+		/* integer overflow */
+		{ "ff8080808080808001", SIZE_MAX },
+		/* truncated string */
+		{ "400a637573746f6d", SIZE_MAX },
+		/* size update after a header field */
+		{ "8220", SIZE_MAX },
+		/* Huffman encoded EOS */
+		{ "40014184ffffffff", SIZE_MAX },
+		/* Huffman padding longer than 7 bits */
+		{ "40014182ffff", SIZE_MAX },
+		/* Huffman padding not all ones */
+		{ "4001418190", SIZE_MAX },
+		/* NUL in value */
+		{ "4001410100", SIZE_MAX },
+		/* header list too large */
+		{ "400a637573746f6d2d6b65790d637573746f6d2d686561646572", 54 },
+	};
+	ARRAY_TYPE(http2_hpack_header) headers;
+	struct http2_hpack_decoder *decoder;
+	const char *error;
+	unsigned int i;
+	buffer_t *data;
+
+	test_begin("http2 hpack decode invalid");
+	for (i = 0; i < N_ELEMENTS(tests); i++) T_BEGIN {
+		decoder = http2_hpack_decoder_init(4096);
+		t_array_init(&headers, 4);
+		data = test_hex_to_binary(tests[i].hex);
+		test_assert_idx(http2_hpack_decode(decoder,
+			data->data, data->used, tests[i].max_list_size,
+			pool_datastack_create(), &headers, &error) < 0, i);
+		http2_hpack_decoder_deinit(&decoder);
+	} T_END;
+	test_end();
+}
+
+static void test_http2_hpack_huffman(void)
+{
+	static const char *const tests[] = {
+		"", "a", "www.example.com", "no-cache",
+		"Mon, 21 Oct 2013 20:13:21 GMT",
+		"\x01\x7f\x80\xfe\xff",
+	};
+	buffer_t *encoded, *decoded;
+	unsigned char all[256];
+	unsigned int i;
+
+	test_begin("http2 hpack huffman");
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		encoded = t_buffer_create(64);
+		decoded = t_buffer_create(64);
+		http2_hpack_huffman_encode(encoded,
+			(const unsigned char *)tests[i], strlen(tests[i]));
+		test_assert_idx(encoded->used ==
+			http2_hpack_huffman_encoded_size(
+				(const unsigned char *)tests[i],
+				strlen(tests[i])), i);
+		test_assert_idx(http2_hpack_huffman_decode(decoded,
+			encoded->data, encoded->used) == 0, i);
+		test_assert_idx(decoded->used == strlen(tests[i]) &&
+				memcmp(decoded->data, tests[i],
+				       decoded->used) == 0, i);
+	}
+
+	for (i = 0; i < sizeof(all); i++)
+		all[i] = i;
+	encoded = t_buffer_create(1024);
+	decoded = t_buffer_create(256);
+	http2_hpack_huffman_encode(encoded, all, sizeof(all));
+	test_assert(http2_hpack_huffman_decode(decoded, encoded->data,
+					       encoded->used) == 0);
+	test_assert(decoded->used == sizeof(all) &&
+		    memcmp(decoded->data, all, sizeof(all)) == 0);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_http2_hpack_decode,
+		test_http2_hpack_encode,
+		test_http2_hpack_table_size_update,
+		test_http2_hpack_decode_invalid,
+		test_http2_hpack_huffman,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -0,0 +1,584 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "str.h"
+#include "read-full.h"
+#include "ostream.h"
+#include "file-dotlock.h"
+#include "mail-index-private.h"
+#include "mail-index-modseq.h"
+#include "mail-transaction-log-private.h"
+#include "mail-index-change-journal.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define MAIL_INDEX_CHANGE_JOURNAL_MAJOR_VERSION 1
+#define MAIL_INDEX_CHANGE_JOURNAL_MINOR_VERSION 0
+
+#define MAIL_INDEX_CHANGE_JOURNAL_LOCK_TIMEOUT_SECS 10
+#define MAIL_INDEX_CHANGE_JOURNAL_LOCK_STALE_TIMEOUT_SECS 30
+
+struct mail_index_change_journal_header {
+	uint8_t major_version;
+	uint8_t minor_version;
+	uint16_t unused_padding1;
+	/* Must match the index's indexid. Otherwise the journal is ignored. */
+	uint32_t indexid;
+
+	/* The journal contains all the changes done after first_modseq up to
+	   next_modseq. The next log file folded into the journal must begin
+	   with next_modseq. */
+	uint64_t first_modseq;
+	uint64_t next_modseq;
+	/* Highest modseq where mailbox attributes were changed. These changes
+	   aren't tracked in the journal. */
+	uint64_t attribute_modseq;
+
+	uint32_t record_count;
+	uint32_t unused_padding2;
+	/* struct mail_index_change_journal_record[record_count], sorted by
+	   UID */
+};
+
+struct mail_index_change_journal {
+	struct mail_index *index;
+	const char *path;
+	/* Locks the journal while it's being folded. The new journal is
+	   written to the lock file, which then replaces the journal. */
+	struct dotlock *dotlock;
+	int fd;
+
+	struct mail_index_change_journal_header hdr;
+	ARRAY_TYPE(mail_index_change_journal_record) records;
+	/* UID => index+1 in records array */
+	HASH_TABLE(void *, void *) uids;
+};
+
+static void
+mail_index_change_journal_init(struct mail_index_change_journal *journal,
+			       struct mail_index *index)
+{
+	i_zero(journal);
+	journal->index = index;
+	journal->path = t_strconcat(index->filepath,
+				    MAIL_INDEX_CHANGE_JOURNAL_SUFFIX, NULL);
+	journal->fd = -1;
+	i_array_init(&journal->records, 128);
+}
+
+static void
+mail_index_change_journal_deinit(struct mail_index_change_journal *journal)
+{
+	if (journal->dotlock != NULL)
+		file_dotlock_delete(&journal->dotlock);
+	if (hash_table_is_created(journal->uids))
+		hash_table_destroy(&journal->uids);
+	array_free(&journal->records);
+}
+
+static void
+mail_index_change_journal_set_corrupted(struct mail_index_change_journal *journal,
+					const char *reason)
+{
+	mail_index_set_error(journal->index,
+		"Corrupted change journal file %s: %s - deleting it",
+		journal->path, reason);
+	i_unlink_if_exists(journal->path);
+}
+
+static int
+mail_index_change_journal_read(struct mail_index_change_journal *journal)
+{
+	struct mail_index_change_journal_header hdr;
+	struct mail_index_change_journal_record *recs;
+	struct stat st;
+	size_t size;
+	int fd, ret;
+
+	fd = open(journal->path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return 0;
+		mail_index_file_set_syscall_error(journal->index,
+						  journal->path, "open()");
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		mail_index_file_set_syscall_error(journal->index,
+						  journal->path, "fstat()");
+		i_close_fd_path(&fd, journal->path);
+		return -1;
+	}
+	if ((ret = pread_full(fd, &hdr, sizeof(hdr), 0)) <= 0) {
+		if (ret < 0) {
+			mail_index_file_set_syscall_error(journal->index,
+				journal->path, "pread()");
+		} else {
+			mail_index_change_journal_set_corrupted(journal,
+				"File too small");
+		}
+		i_close_fd_path(&fd, journal->path);
+		return ret;
+	}
+	if (hdr.major_version != MAIL_INDEX_CHANGE_JOURNAL_MAJOR_VERSION ||
+	    hdr.indexid != journal->index->indexid) {
+		/* old format or the index was recreated */
+		i_close_fd_path(&fd, journal->path);
+		return 0;
+	}
+	size = (size_t)hdr.record_count *
+		sizeof(struct mail_index_change_journal_record);
+	if (hdr.record_count > MAIL_INDEX_CHANGE_JOURNAL_MAX_RECORDS ||
+	    (uoff_t)st.st_size != sizeof(hdr) + size) {
+		mail_index_change_journal_set_corrupted(journal, t_strdup_printf(
+			"Invalid record_count=%u for file size %"PRIuUOFF_T,
+			hdr.record_count, (uoff_t)st.st_size));
+		i_close_fd_path(&fd, journal->path);
+		return 0;
+	}
+
+	if (size > 0) {
+		recs = t_new(struct mail_index_change_journal_record,
+			     hdr.record_count);
+		if ((ret = pread_full(fd, recs, size, sizeof(hdr))) <= 0) {
+			/* ret=0 means the file was truncated, which
+			   shouldn't happen since it's always replaced by
+			   rename(). just ignore it then. */
+			if (ret < 0) {
+				mail_index_file_set_syscall_error(
+					journal->index, journal->path,
+					"pread()");
+			}
+			i_close_fd_path(&fd, journal->path);
+			return ret;
+		}
+		array_append(&journal->records, recs, hdr.record_count);
+	}
+	i_close_fd_path(&fd, journal->path);
+	journal->hdr = hdr;
+	return 1;
+}
+
+static int
+mail_index_change_journal_record_cmp_uid(
+	const struct mail_index_change_journal_record *r1,
+	const struct mail_index_change_journal_record *r2)
+{
+	if (r1->uid < r2->uid)
+		return -1;
+	return r1->uid > r2->uid ? 1 : 0;
+}
+
+static int
+mail_index_change_journal_record_cmp_modseq(
+	const struct mail_index_change_journal_record *r1,
+	const struct mail_index_change_journal_record *r2)
+{
+	if (r1->modseq < r2->modseq)
+		return -1;
+	if (r1->modseq > r2->modseq)
+		return 1;
+	return mail_index_change_journal_record_cmp_uid(r1, r2);
+}
+
+static void
+mail_index_change_journal_reset(struct mail_index_change_journal *journal,
+				uint64_t first_modseq)
+{
+	i_zero(&journal->hdr);
+	journal->hdr.major_version = MAIL_INDEX_CHANGE_JOURNAL_MAJOR_VERSION;
+	journal->hdr.minor_version = MAIL_INDEX_CHANGE_JOURNAL_MINOR_VERSION;
+	journal->hdr.indexid = journal->index->indexid;
+	journal->hdr.first_modseq = first_modseq;
+	journal->hdr.next_modseq = first_modseq;
+	array_clear(&journal->records);
+}
+
+static struct mail_index_change_journal_record *
+mail_index_change_journal_get(struct mail_index_change_journal *journal,
+			      uint32_t uid, uint64_t modseq)
+{
+	struct mail_index_change_journal_record *rec;
+	unsigned int idx;
+
+	/* the records array may get reallocated, so the hash table points to
+	   the array indexes */
+	idx = POINTER_CAST_TO(hash_table_lookup(journal->uids,
+						POINTER_CAST(uid)),
+			      unsigned int);
+	if (idx == 0) {
+		rec = array_append_space(&journal->records);
+		rec->uid = uid;
+		hash_table_insert(journal->uids, POINTER_CAST(uid),
+				  POINTER_CAST(array_count(&journal->records)));
+	} else {
+		rec = array_idx_modifiable(&journal->records, idx - 1);
+	}
+	if (rec->modseq < modseq)
+		rec->modseq = modseq;
+	return rec;
+}
+
+static void
+mail_index_change_journal_add_range(struct mail_index_change_journal *journal,
+				    uint32_t uid1, uint32_t uid2,
+				    uint64_t modseq)
+{
+	uint32_t uid, max_uid = journal->index->map->hdr.next_uid - 1;
+
+	/* UID ranges may be larger than what actually exists, e.g. 1..-1 */
+	if (uid2 > max_uid)
+		uid2 = max_uid;
+	for (uid = uid1; uid <= uid2 && uid != 0; uid++)
+		(void)mail_index_change_journal_get(journal, uid, modseq);
+}
+
+static void
+mail_index_change_journal_add_expunge(struct mail_index_change_journal *journal,
+				      uint32_t uid, const guid_128_t guid_128,
+				      uint64_t modseq)
+{
+	struct mail_index_change_journal_record *rec;
+
+	rec = mail_index_change_journal_get(journal, uid, modseq);
+	rec->flags |= MAIL_INDEX_CHANGE_JOURNAL_RECORD_FLAG_EXPUNGED;
+	if (guid_128 != NULL && !guid_128_is_empty(guid_128))
+		guid_128_copy(rec->guid_128, guid_128);
+}
+
+static void
+mail_index_change_journal_add(struct mail_index_change_journal *journal,
+			      const struct mail_transaction_header *hdr,
+			      const void *data, uint64_t modseq)
+{
+	bool external = (hdr->type & MAIL_TRANSACTION_EXTERNAL) != 0;
+	uint32_t uid, seq1, seq2;
+
+	if ((hdr->type & MAIL_TRANSACTION_SYNC) != 0 &&
+	    (hdr->type & MAIL_TRANSACTION_TYPE_MASK) !=
+	    MAIL_TRANSACTION_EXPUNGE_GUID) {
+		/* ignore changes done by dsync, like the transaction log
+		   scanning does */
+		return;
+	}
+
+	switch (hdr->type & MAIL_TRANSACTION_TYPE_MASK) {
+	case MAIL_TRANSACTION_EXPUNGE: {
+		const struct mail_transaction_expunge *rec, *end;
+
+		if (!external) {
+			/* this is simply a request for expunge */
+			break;
+		}
+		end = CONST_PTR_OFFSET(data, hdr->size);
+		for (rec = data; rec != end; rec++) {
+			for (uid = rec->uid1; uid <= rec->uid2 && uid != 0; uid++) {
+				mail_index_change_journal_add_expunge(journal,
+					uid, NULL, modseq);
+			}
+		}
+		break;
+	}
+	case MAIL_TRANSACTION_EXPUNGE_GUID: {
+		const struct mail_transaction_expunge_guid *rec, *end;
+
+		end = CONST_PTR_OFFSET(data, hdr->size);
+		for (rec = data; rec != end; rec++) {
+			if (!external) {
+				/* skip expunge requests that weren't done */
+				mail_index_map_lookup_seq_range(
+					journal->index->map, rec->uid, rec->uid,
+					&seq1, &seq2);
+				if (seq1 != 0)
+					continue;
+			}
+			mail_index_change_journal_add_expunge(journal,
+				rec->uid, rec->guid_128, modseq);
+		}
+		break;
+	}
+	case MAIL_TRANSACTION_FLAG_UPDATE: {
+		const struct mail_transaction_flag_update *rec, *end;
+
+		end = CONST_PTR_OFFSET(data, hdr->size);
+		for (rec = data; rec != end; rec++) {
+			mail_index_change_journal_add_range(journal,
+				rec->uid1, rec->uid2, modseq);
+		}
+		break;
+	}
+	case MAIL_TRANSACTION_KEYWORD_RESET: {
+		const struct mail_transaction_keyword_reset *rec, *end;
+
+		end = CONST_PTR_OFFSET(data, hdr->size);
+		for (rec = data; rec != end; rec++) {
+			mail_index_change_journal_add_range(journal,
+				rec->uid1, rec->uid2, modseq);
+		}
+		break;
+	}
+	case MAIL_TRANSACTION_KEYWORD_UPDATE: {
+		const struct mail_transaction_keyword_update *rec = data;
+		const uint32_t *uids, *end;
+		unsigned int uids_offset;
+
+		uids_offset = sizeof(*rec) + rec->name_size;
+		if ((uids_offset % 4) != 0)
+			uids_offset += 4 - (uids_offset % 4);
+		uids = CONST_PTR_OFFSET(rec, uids_offset);
+		end = CONST_PTR_OFFSET(rec, hdr->size);
+		for (; uids < end; uids += 2) {
+			mail_index_change_journal_add_range(journal,
+				uids[0], uids[1], modseq);
+		}
+		break;
+	}
+	case MAIL_TRANSACTION_MODSEQ_UPDATE: {
+		const struct mail_transaction_modseq_update *rec, *end;
+		uint64_t rec_modseq;
+
+		end = CONST_PTR_OFFSET(data, hdr->size);
+		for (rec = data; rec != end; rec++) {
+			if (rec->uid == 0) {
+				/* highestmodseq update */
+				continue;
+			}
+			rec_modseq = rec->modseq_low32 |
+				((uint64_t)rec->modseq_high32 << 32);
+			(void)mail_index_change_journal_get(journal, rec->uid,
+				I_MAX(rec_modseq, modseq));
+		}
+		break;
+	}
+	case MAIL_TRANSACTION_ATTRIBUTE_UPDATE:
+		if (journal->hdr.attribute_modseq < modseq)
+			journal->hdr.attribute_modseq = modseq;
+		break;
+	}
+}
+
+static void
+mail_index_change_journal_drop_oldest(struct mail_index_change_journal *journal)
+{
+	const struct mail_index_change_journal_record *rec;
+	unsigned int count = array_count(&journal->records);
+	unsigned int drop_count;
+
+	if (count <= MAIL_INDEX_CHANGE_JOURNAL_MAX_RECORDS)
+		return;
+
+	/* Drop the records with the lowest modseqs. Afterwards the journal
+	   can only be used for syncing from the highest dropped modseq. */
+	array_sort(&journal->records,
+		   mail_index_change_journal_record_cmp_modseq);
+	drop_count = count - MAIL_INDEX_CHANGE_JOURNAL_MAX_RECORDS;
+	rec = array_idx(&journal->records, drop_count - 1);
+	if (journal->hdr.first_modseq < rec->modseq)
+		journal->hdr.first_modseq = rec->modseq;
+	array_delete(&journal->records, 0, drop_count);
+}
+
+static int
+mail_index_change_journal_lock(struct mail_index_change_journal *journal)
+{
+	struct mail_index *index = journal->index;
+	struct dotlock_settings dotlock_set;
+
+	/* The journal is folded after the transaction log is unlocked, so
+	   multiple processes may be folding at the same time. The lock
+	   prevents them from overwriting each others' changes. */
+	i_zero(&dotlock_set);
+	dotlock_set.timeout = I_MIN(MAIL_INDEX_CHANGE_JOURNAL_LOCK_TIMEOUT_SECS,
+				    index->set.max_lock_timeout_secs);
+	dotlock_set.stale_timeout =
+		MAIL_INDEX_CHANGE_JOURNAL_LOCK_STALE_TIMEOUT_SECS;
+	dotlock_set.use_excl_lock =
+		(index->flags & MAIL_INDEX_OPEN_FLAG_DOTLOCK_USE_EXCL) != 0;
+	dotlock_set.nfs_flush =
+		(index->flags & MAIL_INDEX_OPEN_FLAG_NFS_FLUSH) != 0;
+
+	journal->fd = file_dotlock_open_group(&dotlock_set, journal->path, 0,
+					      index->set.mode, index->set.gid,
+					      index->set.gid_origin,
+					      &journal->dotlock);
+	if (journal->fd == -1) {
+		if (errno == EAGAIN) {
+			mail_index_set_error(index,
+				"Timeout while waiting for lock for "
+				"change journal %s", journal->path);
+		} else {
+			mail_index_file_set_syscall_error(index, journal->path,
+				"file_dotlock_open()");
+		}
+		return -1;
+	}
+	return 0;
+}
+
+static int
+mail_index_change_journal_write(struct mail_index_change_journal *journal)
+{
+	struct mail_index *index = journal->index;
+	const struct mail_index_change_journal_record *recs;
+	struct ostream *output;
+	unsigned int count;
+	int ret = 0;
+
+	mail_index_change_journal_drop_oldest(journal);
+	array_sort(&journal->records, mail_index_change_journal_record_cmp_uid);
+	journal->hdr.record_count = array_count(&journal->records);
+
+	output = o_stream_create_fd(journal->fd, 0);
+	o_stream_cork(output);
+	o_stream_nsend(output, &journal->hdr, sizeof(journal->hdr));
+	recs = array_get(&journal->records, &count);
+	o_stream_nsend(output, recs, count * sizeof(*recs));
+	if (o_stream_finish(output) < 0) {
+		mail_index_set_error(index, "write(%s) failed: %s",
+			file_dotlock_get_lock_path(journal->dotlock),
+			o_stream_get_error(output));
+		ret = -1;
+	}
+	o_stream_destroy(&output);
+	if (ret < 0)
+		return -1;
+
+	journal->fd = -1;
+	if (file_dotlock_replace(&journal->dotlock, 0) < 0) {
+		mail_index_file_set_syscall_error(index, journal->path,
+						  "file_dotlock_replace()");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+mail_index_change_journal_fold_view(struct mail_index_change_journal *journal,
+				    struct mail_transaction_log_view *log_view,
+				    bool reset)
+{
+	const struct mail_transaction_header *hdr;
+	const struct mail_index_change_journal_record *rec;
+	const void *data;
+	uint64_t modseq;
+	int ret;
+
+	modseq = mail_transaction_log_view_get_prev_modseq(log_view);
+	if ((ret = mail_index_change_journal_read(journal)) < 0)
+		return -1;
+	if (ret > 0 && !reset && journal->hdr.next_modseq > modseq) {
+		/* already folded by another process */
+		return 0;
+	}
+	if (ret == 0 || reset || journal->hdr.next_modseq < modseq) {
+		/* there's a gap between the journal and the log file.
+		   start from scratch. */
+		mail_index_change_journal_reset(journal, modseq);
+	}
+
+	hash_table_create_direct(&journal->uids, default_pool,
+				 array_count(&journal->records) + 128);
+	array_foreach(&journal->records, rec) {
+		hash_table_insert(journal->uids, POINTER_CAST(rec->uid),
+			POINTER_CAST(array_foreach_idx(&journal->records, rec) + 1));
+	}
+
+	while ((ret = mail_transaction_log_view_next(log_view, &hdr, &data)) > 0) {
+		modseq = mail_transaction_log_view_get_prev_modseq(log_view);
+		mail_index_change_journal_add(journal, hdr, data, modseq);
+	}
+	if (ret < 0)
+		return -1;
+	journal->hdr.next_modseq = modseq;
+	return mail_index_change_journal_write(journal);
+}
+
+int mail_index_change_journal_fold(struct mail_index *index,
+				   uint32_t log_file_seq)
+{
+	struct mail_index_change_journal journal;
+	struct mail_transaction_log_view *log_view;
+	const char *reason;
+	bool reset;
+	int ret;
+
+	if (MAIL_INDEX_IS_IN_MEMORY(index) || index->readonly ||
+	    log_file_seq == 0 || index->map == NULL ||
+	    !mail_index_have_modseq_tracking(index))
+		return 0;
+
+	log_view = mail_transaction_log_view_open(index->log);
+	ret = mail_transaction_log_view_set(log_view,
+					    log_file_seq, 0,
+					    log_file_seq, UOFF_T_MAX,
+					    &reset, &reason);
+	if (ret <= 0) {
+		if (ret < 0) {
+			mail_index_set_error(index,
+				"Failed to fold transaction log seq=%u "
+				"to change journal: %s", log_file_seq, reason);
+		} else {
+			e_debug(index->event, "Transaction log seq=%u "
+				"not folded to change journal: %s",
+				log_file_seq, reason);
+			ret = 0;
+		}
+		mail_transaction_log_view_close(&log_view);
+		return ret;
+	}
+
+	T_BEGIN {
+		mail_index_change_journal_init(&journal, index);
+		ret = mail_index_change_journal_lock(&journal);
+		if (ret == 0) {
+			ret = mail_index_change_journal_fold_view(&journal,
+								  log_view,
+								  reset);
+		}
+		if (ret == 0) {
+			e_debug(index->event, "Folded transaction log seq=%u "
+				"to change journal %s (%u records)",
+				log_file_seq, journal.path,
+				array_count(&journal.records));
+		}
+		mail_index_change_journal_deinit(&journal);
+	} T_END;
+	mail_transaction_log_view_close(&log_view);
+	return ret;
+}
+
+int mail_index_change_journal_lookup(struct mail_index *index,
+	uint64_t since_modseq, uint64_t log_modseq,
+	ARRAY_TYPE(mail_index_change_journal_record) *records)
+{
+	struct mail_index_change_journal journal;
+	const struct mail_index_change_journal_record *rec;
+	int ret;
+
+	if (MAIL_INDEX_IS_IN_MEMORY(index))
+		return 0;
+
+	T_BEGIN {
+		mail_index_change_journal_init(&journal, index);
+		ret = mail_index_change_journal_read(&journal);
+		if (ret > 0 &&
+		    (journal.hdr.first_modseq > since_modseq ||
+		     journal.hdr.next_modseq < log_modseq ||
+		     journal.hdr.attribute_modseq > since_modseq)) {
+			/* some of the wanted changes are missing */
+			ret = 0;
+		}
+		if (ret > 0) {
+			array_foreach(&journal.records, rec) {
+				if (rec->modseq > since_modseq)
+					array_push_back(records, rec);
+			}
+		}
+		mail_index_change_journal_deinit(&journal);
+	} T_END;
+	return ret;
+}
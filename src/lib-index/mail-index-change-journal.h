@@ -0,0 +1,54 @@
+#ifndef MAIL_INDEX_CHANGE_JOURNAL_H
+#define MAIL_INDEX_CHANGE_JOURNAL_H
+
+#include "guid.h"
+
+/* The change journal is a compacted summary of the per-message changes that
+   were in transaction log files which no longer exist. Each time the .log.2
+   is deleted its changes are folded into the journal, which keeps
+   only the latest change for each UID. This allows incremental syncing
+   (e.g. dsync) from modseqs that are older than the oldest transaction log
+   without having to scan through all the messages. */
+#define MAIL_INDEX_CHANGE_JOURNAL_SUFFIX ".changes"
+/* Never keep more than this many records in the journal. When the limit is
+   reached, the records with the lowest modseqs are dropped. */
+#define MAIL_INDEX_CHANGE_JOURNAL_MAX_RECORDS 16384
+
+struct mail_index;
+
+enum mail_index_change_journal_record_flags {
+	/* The message was expunged. Otherwise its flags, keywords or modseq
+	   were changed. */
+	MAIL_INDEX_CHANGE_JOURNAL_RECORD_FLAG_EXPUNGED	= 0x01,
+};
+
+struct mail_index_change_journal_record {
+	uint32_t uid;
+	/* enum mail_index_change_journal_record_flags */
+	uint32_t flags;
+	/* modseq of the latest change */
+	uint64_t modseq;
+	/* GUID of an expunged message, if it was known */
+	guid_128_t guid_128;
+};
+ARRAY_DEFINE_TYPE(mail_index_change_journal_record,
+		  struct mail_index_change_journal_record);
+
+/* Fold the changes in the given transaction log file into the change
+   journal. This is called after the log file was rotated away or deleted,
+   once the log is no longer locked. The file is kept open until then.
+   Nothing is done if the log file can't be found or if modseqs aren't
+   tracked.
+   Returns 0 if ok, -1 if error. */
+int mail_index_change_journal_fold(struct mail_index *index,
+				   uint32_t log_file_seq);
+
+/* Look up all the changes done after since_modseq up to log_modseq, which is
+   the modseq at the beginning of the oldest existing transaction log file.
+   Returns 1 and the records sorted by UID if the journal has all the changes,
+   0 if the journal doesn't cover the whole range, -1 if error. */
+int mail_index_change_journal_lookup(struct mail_index *index,
+	uint64_t since_modseq, uint64_t log_modseq,
+	ARRAY_TYPE(mail_index_change_journal_record) *records);
+
+#endif
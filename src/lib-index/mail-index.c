@@ -13,6 +13,7 @@
 #include "write-full.h"
 #include "mail-index-alloc-cache.h"
 #include "mail-index-private.h"
+#include "mail-index-change-journal.h"
 #include "mail-index-view-private.h"
 #include "mail-index-sync-private.h"
 #include "mail-index-modseq.h"
@@ -798,6 +799,12 @@ int mail_index_unlink(struct mail_index *index)
 	if (unlink(path) < 0 && errno != ENOENT)
 		last_errno = errno;
 
+	/* change journal */
+	path = t_strconcat(index->filepath,
+			   MAIL_INDEX_CHANGE_JOURNAL_SUFFIX, NULL);
+	if (unlink(path) < 0 && errno != ENOENT)
+		last_errno = errno;
+
 	if (last_errno == 0)
 		return 0;
 	else {
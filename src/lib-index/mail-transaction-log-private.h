@@ -133,6 +133,11 @@ struct mail_transaction_log {
 	int dotlock_refcount;
 	struct dotlock *dotlock;
 
+	/* Referenced old log file that was just rotated away or unlinked.
+	   Its changes are folded into the change journal once the log is
+	   no longer locked, so the folding doesn't delay commits. */
+	struct mail_transaction_log_file *change_journal_file;
+
 	/* This session has already checked whether an old .log.2 should be
 	   unlinked. */
 	bool log_2_unlink_checked:1;
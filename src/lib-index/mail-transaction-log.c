@@ -7,6 +7,7 @@
 #include "nfs-workarounds.h"
 #include "mmap-util.h"
 #include "mail-index-private.h"
+#include "mail-index-change-journal.h"
 #include "mail-transaction-log-private.h"
 
 #include <stdio.h>
@@ -25,6 +26,44 @@ mail_transaction_log_set_head(struct mail_transaction_log *log,
 	i_assert(log->files->next != NULL || log->files == file);
 }
 
+static void
+mail_transaction_log_change_journal_fold(struct mail_transaction_log *log)
+{
+	struct mail_transaction_log_file *file = log->change_journal_file;
+
+	if (file == NULL)
+		return;
+
+	(void)mail_index_change_journal_fold(log->index, file->hdr.file_seq);
+	log->change_journal_file = NULL;
+	if (--file->refcount == 0)
+		mail_transaction_logs_clean(log);
+}
+
+static void
+mail_transaction_log_change_journal_add(struct mail_transaction_log *log,
+					uint32_t file_seq)
+{
+	struct mail_transaction_log_file *file;
+	const char *reason;
+
+	if (file_seq == 0 || log->index->readonly)
+		return;
+	/* the previous file is normally folded already when the log was
+	   unlocked */
+	mail_transaction_log_change_journal_fold(log);
+
+	/* keep the file open, so it can still be read after it's deleted */
+	if (mail_transaction_log_find_file(log, file_seq, FALSE,
+					   &file, &reason) <= 0) {
+		e_debug(log->index->event, "Transaction log seq=%u "
+			"not folded to change journal: %s", file_seq, reason);
+		return;
+	}
+	file->refcount++;
+	log->change_journal_file = file;
+}
+
 struct mail_transaction_log *
 mail_transaction_log_alloc(struct mail_index *index)
 {
@@ -58,6 +97,11 @@ static void mail_transaction_log_2_unlink_old(struct mail_transaction_log *log)
 	if (log2_rotate_time != (uint32_t)-1 &&
 	    ioloop_time - (time_t)log2_rotate_time >= (time_t)log->index->optimization_set.log.log2_max_age_secs &&
 	    !log->index->readonly) {
+		/* preserve a summary of the changes for incremental syncs */
+		if (log->head != NULL) {
+			mail_transaction_log_change_journal_add(log,
+				log->head->hdr.prev_file_seq);
+		}
 		i_unlink_if_exists(log->filepath2);
 		log2_rotate_time = (uint32_t)-1;
 	}
@@ -140,6 +184,7 @@ void mail_transaction_log_close(struct mail_transaction_log *log)
 
 	if (log->open_file != NULL)
 		mail_transaction_log_file_free(&log->open_file);
+	mail_transaction_log_change_journal_fold(log);
 	if (log->head != NULL)
 		log->head->refcount--;
 	mail_transaction_logs_clean(log);
@@ -275,6 +320,13 @@ int mail_transaction_log_rotate(struct mail_transaction_log *log, bool reset)
 			return -1;
 		}
 
+		/* creating the new file replaces the current .log.2. fold
+		   its changes to the change journal after unlocking. */
+		if (!reset) {
+			mail_transaction_log_change_journal_add(log,
+				log->head->hdr.prev_file_seq);
+		}
+
 		file = mail_transaction_log_file_alloc(log, path);
 
 		file->st_dev = st.st_dev;
@@ -592,6 +644,7 @@ void mail_transaction_log_sync_unlock(struct mail_transaction_log *log,
 
 	log->index->log_sync_locked = FALSE;
 	mail_transaction_log_file_unlock(log->head, lock_reason);
+	mail_transaction_log_change_journal_fold(log);
 }
 
 void mail_transaction_log_get_head(struct mail_transaction_log *log,
@@ -0,0 +1,276 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "test-common.h"
+#include "test-mail-index.h"
+#include "mail-index-modseq.h"
+#include "mail-index-change-journal.h"
+#include "mail-transaction-log-private.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static void test_rotate_locked(struct mail_index *index)
+{
+	uint32_t file_seq;
+	uoff_t file_offset;
+
+	test_assert(mail_transaction_log_sync_lock(index->log, "rotating",
+						   &file_seq, &file_offset) == 0);
+	test_assert(mail_transaction_log_rotate(index->log, FALSE) == 0);
+}
+
+static void test_rotate(struct mail_index *index)
+{
+	test_rotate_locked(index);
+	mail_transaction_log_sync_unlock(index->log, "rotating");
+	test_assert(index->log->change_journal_file == NULL);
+}
+
+static uint64_t test_get_highest_modseq(struct mail_index *index)
+{
+	struct mail_index_view *view;
+	uint64_t modseq;
+
+	view = mail_index_view_open(index);
+	modseq = mail_index_modseq_get_highest(view);
+	mail_index_view_close(&view);
+	return modseq;
+}
+
+static void test_append(struct mail_index *index, uint32_t count)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t uid, seq, uid_validity = 1234;
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid <= count; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+}
+
+static void test_flag_update(struct mail_index *index, uint32_t seq1,
+			     uint32_t seq2)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_flags_range(trans, seq1, seq2, MODIFY_ADD,
+				      MAIL_SEEN);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+}
+
+static void test_expunge(struct mail_index *index, uint32_t uid,
+			 const guid_128_t guid_128)
+{
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq;
+
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &view,
+					  &trans, 0) == 1);
+	test_assert(mail_index_lookup_seq(view, uid, &seq));
+	mail_index_expunge_guid(trans, seq, guid_128);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+}
+
+static void test_mail_index_change_journal_fold(void)
+{
+	ARRAY_TYPE(mail_index_change_journal_record) records;
+	const struct mail_index_change_journal_record *rec;
+	struct mail_index *index;
+	guid_128_t guid;
+	uint64_t modseq_start, modseq_flags, modseq_expunge, modseq_end;
+
+	test_begin("mail index change journal fold");
+	index = test_mail_index_init(TRUE);
+	mail_index_modseq_enable(index);
+	t_array_init(&records, 8);
+	guid_128_generate(guid);
+
+	/* .log seq=1 */
+	test_append(index, 5);
+	test_rotate(index);
+	/* .log seq=2 - the first rotation didn't have anything to fold */
+	test_assert(mail_index_change_journal_lookup(index, 0,
+		test_get_highest_modseq(index), &records) == 0);
+
+	modseq_start = test_get_highest_modseq(index);
+	test_flag_update(index, 2, 2);
+	modseq_flags = test_get_highest_modseq(index);
+	test_expunge(index, 4, guid);
+	modseq_expunge = test_get_highest_modseq(index);
+	test_assert(modseq_start < modseq_flags &&
+		    modseq_flags < modseq_expunge);
+	test_rotate(index);
+
+	/* .log seq=3 - seq=1 was folded */
+	test_flag_update(index, 3, 3);
+	modseq_end = test_get_highest_modseq(index);
+	test_rotate_locked(index);
+	/* folding is delayed until the log is unlocked */
+	test_assert(index->log->change_journal_file != NULL);
+	test_assert(mail_index_change_journal_lookup(index, modseq_start,
+		modseq_expunge, &records) == 0);
+	mail_transaction_log_sync_unlock(index->log, "rotating");
+	test_assert(index->log->change_journal_file == NULL);
+
+	/* .log seq=4 - seq=2 was folded */
+	test_assert(mail_index_change_journal_lookup(index, modseq_start,
+		modseq_expunge, &records) == 1);
+	test_assert(array_count(&records) == 2);
+	rec = array_idx(&records, 0);
+	test_assert(rec->uid == 2 && rec->flags == 0 &&
+		    rec->modseq == modseq_flags);
+	rec = array_idx(&records, 1);
+	test_assert(rec->uid == 4 &&
+		    rec->flags == MAIL_INDEX_CHANGE_JOURNAL_RECORD_FLAG_EXPUNGED &&
+		    rec->modseq == modseq_expunge &&
+		    guid_128_equals(rec->guid_128, guid));
+
+	/* only the changes after since_modseq are returned */
+	array_clear(&records);
+	test_assert(mail_index_change_journal_lookup(index, modseq_flags,
+		modseq_expunge, &records) == 1);
+	test_assert(array_count(&records) == 1);
+	rec = array_idx(&records, 0);
+	test_assert(rec->uid == 4);
+
+	/* seq=3 isn't in the journal yet */
+	array_clear(&records);
+	test_assert(mail_index_change_journal_lookup(index, modseq_start,
+		modseq_end, &records) == 0);
+	test_assert(array_count(&records) == 0);
+	test_rotate(index);
+	test_assert(mail_index_change_journal_lookup(index, modseq_start,
+		modseq_end, &records) == 1);
+	test_assert(array_count(&records) == 3);
+	rec = array_idx(&records, 1);
+	test_assert(rec->uid == 3 && rec->modseq == modseq_end);
+
+	/* mail_index_unlink() deletes the journal also */
+	array_clear(&records);
+	test_assert(mail_index_unlink(index) == 0);
+	test_assert(mail_index_change_journal_lookup(index, modseq_start,
+		modseq_end, &records) == 0);
+
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void test_mail_index_change_journal_max_records(void)
+{
+	ARRAY_TYPE(mail_index_change_journal_record) records;
+	const struct mail_index_change_journal_record *rec;
+	struct mail_index *index;
+	uint64_t modseq_start, modseq_flags;
+	uint32_t count = MAIL_INDEX_CHANGE_JOURNAL_MAX_RECORDS + 10;
+
+	test_begin("mail index change journal max records");
+	index = test_mail_index_init(TRUE);
+	mail_index_modseq_enable(index);
+	t_array_init(&records, 8);
+
+	test_append(index, count);
+	test_rotate(index);
+	modseq_start = test_get_highest_modseq(index);
+	test_flag_update(index, 1, count - 1);
+	test_flag_update(index, count, count);
+	modseq_flags = test_get_highest_modseq(index);
+	test_rotate(index);
+	test_rotate(index);
+
+	/* the oldest changes were dropped, so the journal can't be used
+	   for syncing from before them */
+	test_assert(mail_index_change_journal_lookup(index, modseq_start,
+		modseq_flags, &records) == 0);
+	test_assert(mail_index_change_journal_lookup(index, modseq_flags - 1,
+		modseq_flags, &records) == 1);
+	test_assert(array_count(&records) == 1);
+	rec = array_idx(&records, 0);
+	test_assert(rec->uid == count);
+
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void test_mail_index_change_journal_locked(void)
+{
+	ARRAY_TYPE(mail_index_change_journal_record) records;
+	const struct mail_index_change_journal_record *rec;
+	struct mail_index *index;
+	const char *lock_path;
+	uint64_t modseq_start, modseq_flags, modseq_end;
+	int fd;
+
+	test_begin("mail index change journal locked");
+	index = test_mail_index_init(TRUE);
+	mail_index_modseq_enable(index);
+	index->set.max_lock_timeout_secs = 1;
+	t_array_init(&records, 8);
+
+	test_append(index, 5);
+	test_rotate(index);
+	modseq_start = test_get_highest_modseq(index);
+	test_flag_update(index, 2, 2);
+	modseq_flags = test_get_highest_modseq(index);
+	test_rotate(index);
+
+	/* another process is folding the journal */
+	lock_path = t_strconcat(index->filepath,
+				MAIL_INDEX_CHANGE_JOURNAL_SUFFIX".lock", NULL);
+	fd = open(lock_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", lock_path);
+	i_close_fd(&fd);
+
+	test_rotate_locked(index);
+	test_expect_error_string("Timeout while waiting for lock");
+	mail_transaction_log_sync_unlock(index->log, "rotating");
+	test_expect_no_more_errors();
+	/* the journal wasn't written behind the lock's back */
+	test_assert(mail_index_change_journal_lookup(index, modseq_start,
+		modseq_flags, &records) == 0);
+	test_assert(access(lock_path, F_OK) == 0);
+
+	/* the next folds work after the lock is released, although the
+	   changes in the skipped log are missing */
+	i_unlink(lock_path);
+	test_flag_update(index, 3, 3);
+	modseq_end = test_get_highest_modseq(index);
+	test_rotate(index);
+	test_rotate(index);
+	test_assert(mail_index_change_journal_lookup(index, modseq_start,
+		modseq_end, &records) == 0);
+	test_assert(mail_index_change_journal_lookup(index, modseq_flags,
+		modseq_end, &records) == 1);
+	test_assert(array_count(&records) == 1);
+	rec = array_idx(&records, 0);
+	test_assert(rec->uid == 3);
+
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_mail_index_change_journal_fold,
+		test_mail_index_change_journal_max_records,
+		test_mail_index_change_journal_locked,
+		NULL
+	};
+	test_dir_init("mail-index-change-journal");
+	return test_run(test_functions);
+}
@@ -0,0 +1,151 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "time-util.h"
+#include "lang-tokenizer.h"
+#include "lang-settings.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/**
+ * Feeds a multilingual corpus through the generic tokenizer with both
+ * the simple and the tr29 algorithms and reports the throughput. The corpus
+ * is built from the samples below, or read from the files given as
+ * parameters (e.g. udhr_fra.txt).
+ */
+
+#define BENCH_MIN_MSECS 1000
+#define BENCH_CHUNK_SIZE 4096
+
+static const char *const bench_samples[] = {
+	/* English */
+	"All human beings are born free and equal in dignity and rights. "
+	"They are endowed with reason and conscience and should act towards "
+	"one another in a spirit of brotherhood. It's 10:30 and we'd better "
+	"check user.name@example.com before the 3.14 release. ",
+	/* French */
+	"Tous les êtres humains naissent libres et égaux en dignité et en "
+	"droits. Ils sont doués de raison et de conscience et doivent agir "
+	"les uns envers les autres dans un esprit de fraternité. ",
+	/* German */
+	"Alle Menschen sind frei und gleich an Würde und Rechten geboren. "
+	"Sie sind mit Vernunft und Gewissen begabt und sollen einander im "
+	"Geist der Brüderlichkeit begegnen. ",
+	/* Finnish */
+	"Kaikki ihmiset syntyvät vapaina ja tasavertaisina arvoltaan ja "
+	"oikeuksiltaan. Heille on annettu järki ja omatunto, ja heidän on "
+	"toimittava toisiaan kohtaan veljeyden hengessä. ",
+	/* Russian */
+	"Все люди рождаются свободными и равными в своем достоинстве и "
+	"правах. Они наделены разумом и совестью и должны поступать в "
+	"отношении друг друга в духе братства. ",
+	/* Greek */
+	"Όλοι οι άνθρωποι γεννιούνται ελεύθεροι και ίσοι στην αξιοπρέπεια "
+	"και τα δικαιώματα. ",
+	/* Hebrew */
+	"כל בני אדם נולדו בני חורין ושווים בערכם ובזכויותיהם. ",
+	/* Arabic */
+	"يولد جميع الناس أحرارًا متساوين في الكرامة والحقوق. ",
+	/* Japanese */
+	"すべての人間は、生まれながらにして自由であり、かつ、尊厳と権利と"
+	"について平等である。カタカナのテキストも含む。",
+	/* Chinese */
+	"人人生而自由，在尊严和权利上一律平等。",
+};
+
+static void bench_corpus_add_file(string_t *corpus, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", path);
+
+	unsigned char buf[IO_BLOCK_SIZE];
+	ssize_t ret;
+	while ((ret = read(fd, buf, sizeof(buf))) > 0)
+		str_append_data(corpus, buf, ret);
+	if (ret < 0)
+		i_fatal("read(%s) failed: %m", path);
+	i_close_fd(&fd);
+}
+
+static size_t
+bench_tokenize(struct lang_tokenizer *tok, const string_t *corpus)
+{
+	const unsigned char *data = str_data(corpus);
+	size_t size = str_len(corpus), pos, chunk;
+	const char *token, *error;
+	size_t tokens = 0;
+
+	for (pos = 0; pos < size; pos += chunk) {
+		chunk = I_MIN(size - pos, BENCH_CHUNK_SIZE);
+		/* don't split UTF-8 characters between chunks */
+		while (pos + chunk < size &&
+		       (data[pos + chunk] & 0xc0) == 0x80)
+			chunk--;
+		while (lang_tokenizer_next(tok, data + pos, chunk,
+					   &token, &error) > 0)
+			tokens++;
+	}
+	while (lang_tokenizer_final(tok, &token, &error) > 0)
+		tokens++;
+	return tokens;
+}
+
+static void bench_algorithm(const char *algorithm, const string_t *corpus)
+{
+	struct lang_settings set = lang_default_settings;
+	struct lang_tokenizer *tok;
+	const char *error;
+	uint64_t ts_0, ts_1, bytes = 0;
+	size_t tokens = 0;
+
+	set.tokenizer_generic_algorithm = algorithm;
+	if (lang_tokenizer_create(lang_tokenizer_generic, NULL, &set, NULL, 0,
+				  &tok, &error) < 0)
+		i_fatal("lang_tokenizer_create(%s) failed: %s",
+			algorithm, error);
+
+	ts_0 = i_nanoseconds();
+	do {
+		tokens += bench_tokenize(tok, corpus);
+		bytes += str_len(corpus);
+		ts_1 = i_nanoseconds();
+	} while (ts_1 - ts_0 < BENCH_MIN_MSECS * 1000000ULL);
+	lang_tokenizer_unref(&tok);
+
+	printf("%-6s %8.2f MB/s %10.0f tokens/s\n", algorithm,
+	       (double)bytes * 1000.0 / (double)(ts_1 - ts_0),
+	       (double)tokens * 1000000000.0 / (double)(ts_1 - ts_0));
+}
+
+int main(int argc, char **argv)
+{
+	string_t *corpus;
+	unsigned int i;
+
+	lib_init();
+	lang_tokenizers_init();
+
+	corpus = str_new(default_pool, 1024*64);
+	if (argc > 1) {
+		for (i = 1; i < (unsigned int)argc; i++)
+			bench_corpus_add_file(corpus, argv[i]);
+	} else {
+		while (str_len(corpus) < 1024*64) {
+			for (i = 0; i < N_ELEMENTS(bench_samples); i++)
+				str_append(corpus, bench_samples[i]);
+		}
+	}
+	printf("corpus %zu bytes\n", str_len(corpus));
+
+	bench_algorithm("simple", corpus);
+	bench_algorithm("tr29", corpus);
+
+	str_free(&corpus);
+	lang_tokenizers_deinit();
+	lib_deinit();
+	return 0;
+}
@@ -30,6 +30,12 @@ static unsigned char lang_ascii_word_breaks[128] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0  /* 112-127: {|}~ */
 };
 
+static inline bool lang_ascii_is_word_char(unsigned char c)
+{
+	/* apostrophe needs special handling, see IS_APOSTROPHE() */
+	return c < 0x80 && c != '\'' && lang_ascii_word_breaks[c] == 0;
+}
+
 struct algorithm {
 	const char *name;
 	enum boundary_algorithm id;
@@ -321,6 +327,18 @@ lang_tokenizer_generic_simple_next(struct lang_tokenizer *_tok,
 
 	start = tok->token->used > 0 ? 0 : skip_base64(data, size);
 	for (i = start; i < size; i += char_size) {
+		if (tok->prev_type == LETTER_TYPE_ALETTER &&
+		    lang_ascii_is_word_char(data[i])) {
+			/* Fast path: a run of plain ASCII word characters
+			   continues the current word without changing any
+			   state, so skip over it in one go. */
+			do {
+				i++;
+			} while (i < size && lang_ascii_is_word_char(data[i]));
+			shift_prev_type(tok, LETTER_TYPE_ALETTER);
+			char_size = 0;
+			continue;
+		}
 		char_size = uni_utf8_get_char_n(data + i, size - i, &c);
 		i_assert(char_size > 0);
 
@@ -373,9 +391,29 @@ lang_tokenizer_generic_simple_next(struct lang_tokenizer *_tok,
 	return 0;
 }
 
-/* TODO: Arrange array searches roughly in order of likelihood of a match.
-   TODO: Make some array of the arrays, so this can be a foreach loop.
-   TODO: Check for Hangul.
+static const enum letter_type letter_types[] = {
+	[UNICODE_WORD_BREAK_OTHER] = LETTER_TYPE_OTHER,
+	[UNICODE_WORD_BREAK_CR] = LETTER_TYPE_CR,
+	[UNICODE_WORD_BREAK_LF] = LETTER_TYPE_LF,
+	[UNICODE_WORD_BREAK_NEWLINE] = LETTER_TYPE_NEWLINE,
+	[UNICODE_WORD_BREAK_EXTEND] = LETTER_TYPE_EXTEND,
+	/* ZWJ isn't handled separately (WB3c) */
+	[UNICODE_WORD_BREAK_ZWJ] = LETTER_TYPE_OTHER,
+	[UNICODE_WORD_BREAK_REGIONAL_INDICATOR] = LETTER_TYPE_REGIONAL_INDICATOR,
+	[UNICODE_WORD_BREAK_FORMAT] = LETTER_TYPE_FORMAT,
+	[UNICODE_WORD_BREAK_KATAKANA] = LETTER_TYPE_KATAKANA,
+	[UNICODE_WORD_BREAK_HEBREW_LETTER] = LETTER_TYPE_HEBREW_LETTER,
+	[UNICODE_WORD_BREAK_ALETTER] = LETTER_TYPE_ALETTER,
+	[UNICODE_WORD_BREAK_SINGLE_QUOTE] = LETTER_TYPE_SINGLE_QUOTE,
+	[UNICODE_WORD_BREAK_DOUBLE_QUOTE] = LETTER_TYPE_DOUBLE_QUOTE,
+	[UNICODE_WORD_BREAK_MIDNUMLET] = LETTER_TYPE_MIDNUMLET,
+	[UNICODE_WORD_BREAK_MIDLETTER] = LETTER_TYPE_MIDLETTER,
+	[UNICODE_WORD_BREAK_MIDNUM] = LETTER_TYPE_MIDNUM,
+	[UNICODE_WORD_BREAK_NUMERIC] = LETTER_TYPE_NUMERIC,
+	[UNICODE_WORD_BREAK_EXTENDNUMLET] = LETTER_TYPE_EXTENDNUMLET,
+};
+
+/* TODO: Check for Hangul.
    TODO: Add Hyphens U+002D HYPHEN-MINUS, U+2010 HYPHEN, possibly also
    U+058A ( ֊ ) ARMENIAN HYPHEN, and U+30A0 KATAKANA-HIRAGANA DOUBLE
    HYPHEN.
@@ -386,44 +424,14 @@ static enum letter_type letter_type(unichar_t c)
 	if (IS_APOSTROPHE(c))
 		return LETTER_TYPE_APOSTROPHE;
 
-	const struct unicode_code_point_data *cpd =
-		unicode_code_point_get_data(c);
+	/* The Word_Break property is looked up from a precomputed two-stage
+	   table, so this is just two array lookups per character. */
+	enum unicode_word_break wb = unicode_code_point_get_word_break(c);
+	i_assert(wb < N_ELEMENTS(letter_types));
 
-	if (cpd->pb_b_cr)
-		return LETTER_TYPE_CR;
-	if (cpd->pb_b_lf)
-		return LETTER_TYPE_LF;
-	if (cpd->pb_wb_newline)
-		return LETTER_TYPE_NEWLINE;
-	if (cpd->pb_wb_extend)
-		return LETTER_TYPE_EXTEND;
-	if (cpd->pb_b_regional_indicator)
-		return LETTER_TYPE_REGIONAL_INDICATOR;
-	if (cpd->pb_wb_format)
-		return LETTER_TYPE_FORMAT;
-	if (cpd->pb_wb_katakana)
-		return LETTER_TYPE_KATAKANA;
-	if (cpd->pb_wb_hebrew_letter)
-		return LETTER_TYPE_HEBREW_LETTER;
-	if (cpd->pb_wb_aletter)
-		return LETTER_TYPE_ALETTER;
-	if (cpd->pb_wb_single_quote)
-		return LETTER_TYPE_SINGLE_QUOTE;
-	if (cpd->pb_wb_double_quote)
-		return LETTER_TYPE_DOUBLE_QUOTE;
-	if (cpd->pb_wb_midnumlet)
-		return LETTER_TYPE_MIDNUMLET;
-	if (cpd->pb_wb_midletter)
-		return LETTER_TYPE_MIDLETTER;
-	if (cpd->pb_wb_midnum)
-		return LETTER_TYPE_MIDNUM;
-	if (cpd->pb_wb_numeric)
-		return LETTER_TYPE_NUMERIC;
-	if (cpd->pb_wb_extendnumlet)
-		return LETTER_TYPE_EXTENDNUMLET;
-	if (IS_PREFIX_SPLAT(c)) /* prioritise appropriately */
+	if (wb == UNICODE_WORD_BREAK_OTHER && IS_PREFIX_SPLAT(c))
 		return LETTER_TYPE_PREFIXSPLAT;
-	return LETTER_TYPE_OTHER;
+	return letter_types[wb];
 }
 
 static bool letter_panic(struct generic_lang_tokenizer *tok ATTR_UNUSED)
@@ -0,0 +1,245 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "net.h"
+#include "strnum.h"
+#include "write-full.h"
+#include "istream.h"
+#include "ostream.h"
+#include "time-util.h"
+#include "iostream-openssl.h"
+#include "iostream-ssl.h"
+#include "iostream-ssl-test.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <openssl/ssl.h>
+
+/**
+ * Simulates an IMAP server sending a large mail file over TLS, e.g. for
+ * FETCH BODY[]. The server sends a file with o_stream_send_istream() to a
+ * client process reading with OpenSSL. This is done with and without
+ * ssl_options = ktls. It measures the throughput and the CPU time the server
+ * process uses for each GB sent. If the kernel doesn't support kTLS, both
+ * runs are encrypted by OpenSSL.
+ */
+
+#define BENCH_BLOCK_SIZE (64*1024)
+
+struct bench_server {
+	struct ssl_iostream *ssl_iostream;
+	struct istream *input, *file_input;
+	struct ostream *output;
+	struct io *io;
+	bool finished;
+};
+
+static int bench_create_file(uoff_t size)
+{
+	static unsigned char buf[BENCH_BLOCK_SIZE];
+	char path[] = "/tmp/bench-ssl-ktls.XXXXXX";
+	size_t block;
+	int fd;
+
+	if ((fd = mkstemp(path)) < 0)
+		i_fatal("mkstemp() failed: %m");
+	i_unlink(path);
+	memset(buf, 'x', sizeof(buf));
+	while (size > 0) {
+		block = I_MIN(size, sizeof(buf));
+		if (write_full(fd, buf, block) < 0)
+			i_fatal("write() failed: %m");
+		size -= block;
+	}
+	return fd;
+}
+
+static pid_t bench_client(in_port_t port, uoff_t size)
+{
+	static unsigned char buf[BENCH_BLOCK_SIZE];
+	SSL_CTX *ssl_ctx;
+	SSL *ssl;
+	struct ip_addr ip;
+	pid_t pid;
+	int fd, ret;
+
+	if ((pid = fork()) < 0)
+		i_fatal("fork() failed: %m");
+	if (pid != 0)
+		return pid;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	if ((fd = net_connect_ip_blocking(&ip, port, NULL)) < 0)
+		i_fatal("connect(127.0.0.1:%u) failed: %m", port);
+	if ((ssl_ctx = SSL_CTX_new(TLS_client_method())) == NULL)
+		i_fatal("SSL_CTX_new() failed");
+	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
+	ssl = SSL_new(ssl_ctx);
+	if (ssl == NULL || SSL_set_fd(ssl, fd) != 1)
+		i_fatal("SSL_new() failed");
+	if (SSL_connect(ssl) != 1)
+		i_fatal("SSL_connect() failed");
+	while (size > 0) {
+		if ((ret = SSL_read(ssl, buf, sizeof(buf))) <= 0)
+			i_fatal("SSL_read() failed");
+		size -= ret;
+	}
+	_exit(0);
+}
+
+static void bench_server_input(struct bench_server *server)
+{
+	/* handshake and session tickets */
+	if (i_stream_read(server->input) < 0 && !server->finished)
+		i_fatal("read() failed: %s", i_stream_get_error(server->input));
+	i_stream_skip(server->input, i_stream_get_data_size(server->input));
+}
+
+static int bench_server_output(struct bench_server *server)
+{
+	switch (o_stream_send_istream(server->output, server->file_input)) {
+	case OSTREAM_SEND_ISTREAM_RESULT_FINISHED:
+		if (o_stream_flush(server->output) <= 0)
+			return 0;
+		server->finished = TRUE;
+		io_loop_stop(current_ioloop);
+		return 1;
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT:
+		i_unreached();
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT:
+		return 0;
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
+		i_fatal("read() failed: %s",
+			i_stream_get_error(server->file_input));
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT:
+		i_fatal("write() failed: %s",
+			o_stream_get_error(server->output));
+	}
+	i_unreached();
+}
+
+static uint64_t bench_get_cpu_usecs(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		i_fatal("getrusage() failed: %m");
+	return timeval_to_usecs(&usage.ru_utime) +
+		timeval_to_usecs(&usage.ru_stime);
+}
+
+static void
+bench_ssl_ktls(const struct ssl_iostream_settings *set, int file_fd,
+	       uoff_t size)
+{
+	struct bench_server server;
+	struct ssl_iostream_context *ctx;
+	struct ioloop *ioloop;
+	struct ip_addr ip;
+	in_port_t port = 0;
+	uint64_t ts_0, ts_1, cpu_0, cpu_1;
+	const char *error;
+	pid_t client_pid;
+	int listen_fd, fd;
+	bool ktls;
+	double gb;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	if ((listen_fd = net_listen(&ip, &port, 1)) < 0)
+		i_fatal("listen() failed: %m");
+	client_pid = bench_client(port, size);
+	if ((fd = net_accept(listen_fd, NULL, NULL)) < 0)
+		i_fatal("accept() failed: %m");
+	i_close_fd(&listen_fd);
+	fd_set_nonblock(fd, TRUE);
+
+	ioloop = io_loop_create();
+	if (ssl_iostream_context_init_server(set, &ctx, &error) < 0)
+		i_fatal("ssl_iostream_context_init_server() failed: %s", error);
+
+	i_zero(&server);
+	server.input = i_stream_create_fd(fd, IO_BLOCK_SIZE);
+	server.output = o_stream_create_fd(fd, IO_BLOCK_SIZE);
+	if (io_stream_create_ssl_server(ctx, NULL, &server.input,
+					&server.output, &server.ssl_iostream,
+					&error) < 0)
+		i_fatal("io_stream_create_ssl_server() failed: %s", error);
+	server.file_input = i_stream_create_fd(file_fd, IO_BLOCK_SIZE);
+	i_stream_seek(server.file_input, 0);
+	server.io = io_add_istream(server.input, bench_server_input, &server);
+	o_stream_set_flush_callback(server.output, bench_server_output,
+				    &server);
+	o_stream_set_flush_pending(server.output, TRUE);
+
+	ts_0 = i_nanoseconds();
+	cpu_0 = bench_get_cpu_usecs();
+	io_loop_run(ioloop);
+	ts_1 = i_nanoseconds();
+	cpu_1 = bench_get_cpu_usecs();
+	(void)waitpid(client_pid, NULL, 0);
+
+	ktls = ssl_iostream_is_ktls_enabled(server.ssl_iostream);
+	io_remove(&server.io);
+	i_stream_unref(&server.file_input);
+	ssl_iostream_destroy(&server.ssl_iostream);
+	i_stream_unref(&server.input);
+	o_stream_unref(&server.output);
+	ssl_iostream_context_unref(&ctx);
+	io_loop_destroy(&ioloop);
+	i_close_fd(&fd);
+
+	gb = (double)size / (1024.0*1024*1024);
+	if (!set->ktls)
+		printf("OpenSSL encryption\n");
+	else if (ktls)
+		printf("Kernel TLS encryption\n");
+	else
+		printf("Kernel TLS encryption (not available, used OpenSSL)\n");
+	printf("\tTime: %0.03lf s (%0.01lf MB/s), CPU: %0.01lf ms/GB\n\n",
+	       (double)(ts_1 - ts_0) / 1000000000.0,
+	       (double)size / (1024*1024) * 1000000000.0 /
+	       (double)(ts_1 - ts_0),
+	       (double)(cpu_1 - cpu_0) / 1000.0 / gb);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<MB>]\n", prog);
+	fprintf(stderr, "Sends 1024 MB if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct ssl_iostream_settings set;
+	unsigned int mb = 1024;
+	const char *error;
+	int file_fd;
+
+	lib_init();
+
+	if (argc > 2 || (argc == 2 && (str_to_uint(argv[1], &mb) < 0 ||
+				       mb == 0)))
+		print_usage(argv[0]);
+
+	ssl_iostream_openssl_init();
+	ssl_iostream_test_settings_server(&set);
+	if (io_stream_ssl_global_init(&set, &error) < 0)
+		i_fatal("%s", error);
+
+	file_fd = bench_create_file((uoff_t)mb * 1024 * 1024);
+	printf("Sending a %u MB file over TLS\n\n", mb);
+	bench_ssl_ktls(&set, file_fd, (uoff_t)mb * 1024 * 1024);
+	set.ktls = TRUE;
+	bench_ssl_ktls(&set, file_fd, (uoff_t)mb * 1024 * 1024);
+	i_close_fd(&file_fd);
+
+	ssl_iostream_openssl_deinit();
+	lib_deinit();
+}
@@ -0,0 +1,242 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "net.h"
+#include "strnum.h"
+#include "istream.h"
+#include "ostream.h"
+#include "time-util.h"
+#include "iostream-openssl.h"
+#include "iostream-ssl.h"
+#include "iostream-ssl-test.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <openssl/ssl.h>
+
+/**
+ * Simulates TLS clients connecting to a pool of login processes. A number of
+ * server processes are forked, each with its own SSL context, accepting
+ * connections from the same listener socket like login processes do. The
+ * client reconnects repeatedly and tries to resume its previous TLS session
+ * each time. This is done with and without a shared session ticket key
+ * (ssl_server_ticket_key_file). It measures the number of handshakes per
+ * second and how many of them resumed the previous session.
+ */
+
+#define BENCH_TICKET_KEY "bench-ssl-resumption-ticket-key-0123456789"
+
+struct bench_connection {
+	struct ssl_iostream *ssl_iostream;
+	struct istream *input;
+	struct ostream *output;
+	struct io *io;
+	int fd;
+	bool replied;
+};
+
+static int server_listen_fd;
+
+static void bench_connection_destroy(struct bench_connection *conn)
+{
+	io_remove(&conn->io);
+	ssl_iostream_destroy(&conn->ssl_iostream);
+	i_stream_unref(&conn->input);
+	o_stream_unref(&conn->output);
+	i_close_fd(&conn->fd);
+	i_free(conn);
+}
+
+static void bench_connection_input(struct bench_connection *conn)
+{
+	if (i_stream_read(conn->input) < 0) {
+		bench_connection_destroy(conn);
+		return;
+	}
+	if (!conn->replied && ssl_iostream_is_handshaked(conn->ssl_iostream)) {
+		/* the client waits for this reply, which also makes sure it
+		   has received the session tickets */
+		conn->replied = TRUE;
+		o_stream_nsend_str(conn->output, "+");
+		if (o_stream_flush(conn->output) < 0) {
+			bench_connection_destroy(conn);
+			return;
+		}
+	}
+	i_stream_skip(conn->input, i_stream_get_data_size(conn->input));
+}
+
+static void bench_server_accept(struct ssl_iostream_context *ctx)
+{
+	struct bench_connection *conn;
+	const char *error;
+	int fd;
+
+	/* the other server processes may have already accepted it */
+	if ((fd = net_accept(server_listen_fd, NULL, NULL)) < 0)
+		return;
+	fd_set_nonblock(fd, TRUE);
+
+	conn = i_new(struct bench_connection, 1);
+	conn->fd = fd;
+	conn->input = i_stream_create_fd(fd, 1024);
+	conn->output = o_stream_create_fd(fd, 1024);
+	if (io_stream_create_ssl_server(ctx, NULL, &conn->input, &conn->output,
+					&conn->ssl_iostream, &error) < 0)
+		i_fatal("io_stream_create_ssl_server() failed: %s", error);
+	conn->io = io_add_istream(conn->input, bench_connection_input, conn);
+	i_stream_set_input_pending(conn->input, TRUE);
+}
+
+static void ATTR_NORETURN
+bench_server(int listen_fd, const struct ssl_iostream_settings *set)
+{
+	struct ssl_iostream_context *ctx;
+	struct ioloop *ioloop;
+	struct io *io;
+	const char *error;
+
+	server_listen_fd = listen_fd;
+	ioloop = io_loop_create();
+	if (ssl_iostream_context_init_server(set, &ctx, &error) < 0)
+		i_fatal("ssl_iostream_context_init_server() failed: %s", error);
+	io = io_add(server_listen_fd, IO_READ, bench_server_accept, ctx);
+	io_loop_run(ioloop);
+	io_remove(&io);
+	io_loop_destroy(&ioloop);
+	i_unreached();
+}
+
+static bool bench_client_connect(SSL_CTX *ssl_ctx, in_port_t port,
+				 SSL_SESSION **session)
+{
+	struct ip_addr ip;
+	char reply;
+	bool reused;
+	int fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	fd = net_connect_ip_blocking(&ip, port, NULL);
+	if (fd < 0)
+		i_fatal("connect(127.0.0.1:%u) failed: %m", port);
+
+	SSL *ssl = SSL_new(ssl_ctx);
+	if (ssl == NULL || SSL_set_fd(ssl, fd) != 1)
+		i_fatal("SSL_new() failed");
+	if (*session != NULL)
+		(void)SSL_set_session(ssl, *session);
+	if (SSL_connect(ssl) != 1)
+		i_fatal("SSL_connect() failed");
+	if (SSL_read(ssl, &reply, 1) != 1)
+		i_fatal("SSL_read() failed");
+	reused = SSL_session_reused(ssl) != 0;
+
+	if (*session != NULL)
+		SSL_SESSION_free(*session);
+	*session = SSL_get1_session(ssl);
+	(void)SSL_shutdown(ssl);
+	SSL_free(ssl);
+	i_close_fd(&fd);
+	return reused;
+}
+
+static void
+bench_ssl_resumption(const struct ssl_iostream_settings *set,
+		     unsigned int process_count, unsigned int count)
+{
+	SSL_SESSION *session = NULL;
+	SSL_CTX *ssl_ctx;
+	struct ip_addr ip;
+	in_port_t port = 0;
+	unsigned int i, reused_count = 0;
+	uint64_t ts_0, ts_1;
+	pid_t pids[process_count];
+	int listen_fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	listen_fd = net_listen(&ip, &port, 128);
+	if (listen_fd < 0)
+		i_fatal("listen() failed: %m");
+	fd_set_nonblock(listen_fd, TRUE);
+
+	for (i = 0; i < process_count; i++) {
+		if ((pids[i] = fork()) < 0)
+			i_fatal("fork() failed: %m");
+		if (pids[i] == 0)
+			bench_server(listen_fd, set);
+	}
+	i_close_fd(&listen_fd);
+
+	if ((ssl_ctx = SSL_CTX_new(TLS_client_method())) == NULL)
+		i_fatal("SSL_CTX_new() failed");
+	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		if (bench_client_connect(ssl_ctx, port, &session))
+			reused_count++;
+	}
+	ts_1 = i_nanoseconds();
+
+	if (session != NULL)
+		SSL_SESSION_free(session);
+	SSL_CTX_free(ssl_ctx);
+	for (i = 0; i < process_count; i++) {
+		(void)kill(pids[i], SIGTERM);
+		(void)waitpid(pids[i], NULL, 0);
+	}
+
+	if (set->ticket_key.content == NULL)
+		printf("Separate session ticket keys\n");
+	else
+		printf("Shared session ticket key\n");
+	printf("\tTime: %0.03lf s (%0.01lf handshakes/s), "
+	       "resumed: %u/%u (%0.01lf%%)\n\n",
+	       (double)(ts_1 - ts_0) / 1000000000.0,
+	       (double)count * 1000000000.0 / (double)(ts_1 - ts_0),
+	       reused_count, count, reused_count * 100.0 / count);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<processes> [<handshakes>]]\n", prog);
+	fprintf(stderr, "Runs with 4 processes and 1000 handshakes "
+		"if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct ssl_iostream_settings set;
+	unsigned int process_count = 4, count = 1000;
+	const char *error;
+
+	lib_init();
+
+	if (argc >= 2 && (str_to_uint(argv[1], &process_count) < 0 ||
+			  process_count == 0))
+		print_usage(argv[0]);
+	if (argc >= 3 && str_to_uint(argv[2], &count) < 0)
+		print_usage(argv[0]);
+	if (argc > 3)
+		print_usage(argv[0]);
+
+	ssl_iostream_openssl_init();
+	ssl_iostream_test_settings_server(&set);
+	set.tickets = TRUE;
+	if (io_stream_ssl_global_init(&set, &error) < 0)
+		i_fatal("%s", error);
+
+	printf("%u server processes, %u handshakes\n\n", process_count, count);
+	bench_ssl_resumption(&set, process_count, count);
+	set.ticket_key.content = BENCH_TICKET_KEY;
+	bench_ssl_resumption(&set, process_count, count);
+
+	ssl_iostream_openssl_deinit();
+	lib_deinit();
+}
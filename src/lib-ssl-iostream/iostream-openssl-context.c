@@ -16,10 +16,17 @@
 #include <openssl/x509.h>
 #include <openssl/pem.h>
 #include <openssl/ssl.h>
+#include <openssl/sha.h>
 #include <openssl/err.h>
 #include <arpa/inet.h>
 
 #define ALPN_MAX_PROTOCOLS 10
+/* Minimum length of the ssl_server_ticket_key_file contents */
+#define SSL_TICKET_KEY_SECRET_MIN_LEN 32
+/* key name + HMAC secret + AES key, as expected by
+   SSL_CTX_set_tlsext_ticket_keys() */
+#define SSL_TICKET_KEY_NAME_LEN 16
+#define SSL_TICKET_KEYS_LEN (SSL_TICKET_KEY_NAME_LEN + SHA512_DIGEST_LENGTH)
 
 struct ssl_iostream_password_context {
 	const char *password;
@@ -177,6 +184,81 @@ ssl_iostream_ctx_use_dh(struct ssl_iostream_context *ctx,
 	return ret;
 }
 
+static int
+ssl_iostream_ctx_use_ticket_key(struct ssl_iostream_context *ctx,
+				const struct ssl_iostream_settings *set,
+				const char **error_r)
+{
+	unsigned char keys[SSL_TICKET_KEYS_LEN];
+	unsigned char name[SHA256_DIGEST_LENGTH];
+	size_t len = strlen(set->ticket_key.content);
+	int ret = 0;
+
+	if (len < SSL_TICKET_KEY_SECRET_MIN_LEN) {
+		*error_r = t_strdup_printf(
+			"ssl_server_ticket_key_file must contain at least "
+			"%u bytes of random data", SSL_TICKET_KEY_SECRET_MIN_LEN);
+		return -1;
+	}
+	/* The same secret gives the same keys in all processes, so a
+	   session ticket issued by one process can be decrypted by another.
+	   The key name is derived from the keys so it doesn't reveal anything
+	   about the secret. */
+	SHA512((const unsigned char *)set->ticket_key.content, len,
+	       keys + SSL_TICKET_KEY_NAME_LEN);
+	SHA256(keys + SSL_TICKET_KEY_NAME_LEN, SHA512_DIGEST_LENGTH, name);
+	memcpy(keys, name, SSL_TICKET_KEY_NAME_LEN);
+
+	if (SSL_CTX_set_tlsext_ticket_keys(ctx->ssl_ctx, keys,
+					   sizeof(keys)) != 1) {
+		*error_r = t_strdup_printf(
+			"Can't set TLS session ticket keys "
+			"(ssl_server_ticket_key_file setting): %s",
+			openssl_iostream_error());
+		ret = -1;
+	}
+	safe_memset(keys, 0, sizeof(keys));
+	return ret;
+}
+
+static void
+ssl_iostream_ctx_set_session_id_context(struct ssl_iostream_context *ctx,
+					const struct ssl_iostream_settings *set)
+{
+	unsigned char sid_ctx[SHA256_DIGEST_LENGTH];
+	string_t *str = t_str_new(256);
+
+	/* Sessions can be resumed only by contexts using the same
+	   certificate and the same client certificate verification settings.
+	   Otherwise a session established without verifying the client
+	   certificate (or trusting a different CA) could be resumed by a
+	   process that requires it. This is also required for resuming
+	   sessions when client certificates are requested. The fields are
+	   NUL-separated, so they can't be shifted into each other. */
+	str_append(str, set->cert.cert.content == NULL ? "" :
+		   set->cert.cert.content);
+	str_append_c(str, '\0');
+	str_append_c(str, set->verify_remote_cert ? '1' : '0');
+	str_append_c(str, set->skip_crl_check ? '1' : '0');
+	str_append_c(str, '\0');
+	if (set->verify_remote_cert) {
+		if (set->ca.content != NULL)
+			str_append(str, set->ca.content);
+		str_append_c(str, '\0');
+		if (set->ca_dir != NULL)
+			str_append(str, set->ca_dir);
+		str_append_c(str, '\0');
+	}
+	if (set->cert_username_field != NULL)
+		str_append(str, set->cert_username_field);
+
+	i_assert(sizeof(sid_ctx) <= SSL_MAX_SID_CTX_LENGTH);
+	SHA256(str_data(str), str_len(str), sid_ctx);
+	if (SSL_CTX_set_session_id_context(ctx->ssl_ctx, sid_ctx,
+					   sizeof(sid_ctx)) != 1)
+		i_unreached();
+}
+
 static int ssl_ctx_use_certificate_chain(SSL_CTX *ctx, const char *cert)
 {
 	/* mostly just copy&pasted from SSL_CTX_use_certificate_chain_file() */
@@ -730,6 +812,13 @@ ssl_iostream_context_set(struct ssl_iostream_context *ctx,
 		if (ssl_iostream_ctx_use_dh(ctx, set, error_r) < 0)
 			return -1;
 	}
+	if (!ctx->client_ctx) {
+		ssl_iostream_ctx_set_session_id_context(ctx, set);
+		if (set->ticket_key.content != NULL &&
+		    *set->ticket_key.content != '\0' &&
+		    ssl_iostream_ctx_use_ticket_key(ctx, set, error_r) < 0)
+			return -1;
+	}
 
 	/* set trusted CA certs */
 	if (set->verify_remote_cert) {
@@ -833,6 +922,12 @@ ssl_iostream_context_init_common(struct ssl_iostream_context *ctx,
 #ifdef SSL_OP_NO_TICKET
 	if (!set->tickets)
 		ssl_ops |= SSL_OP_NO_TICKET;
+#endif
+#ifdef HAVE_OPENSSL_KTLS
+	if (set->ktls) {
+		ssl_ops |= SSL_OP_ENABLE_KTLS;
+		ctx->ktls = TRUE;
+	}
 #endif
 	SSL_CTX_set_options(ctx->ssl_ctx, ssl_ops);
 #ifdef SSL_MODE_RELEASE_BUFFERS
@@ -0,0 +1,79 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ostream-private.h"
+#include "iostream-openssl.h"
+
+#ifdef HAVE_OPENSSL_KTLS
+
+/* OpenSSL enables kTLS by itself with SSL_OP_ENABLE_KTLS, but only when its
+   write BIO is a socket BIO. So during the handshake OpenSSL writes directly
+   to the plain_output fd instead of the BIO pair. Reading always goes
+   through the BIO pair. */
+
+void openssl_iostream_ktls_init(struct ssl_iostream *ssl_io, BIO *bio_int)
+{
+	int fd = o_stream_get_fd(ssl_io->plain_output);
+	BIO *bio;
+
+	if (fd == -1 || ssl_io->plain_output->real_stream->parent != NULL) {
+		/* not writing directly to a socket */
+		return;
+	}
+	if (o_stream_get_buffer_used_size(ssl_io->plain_output) > 0) {
+		/* OpenSSL's writes would get ahead of the buffered data */
+		return;
+	}
+	if ((bio = BIO_new_socket(fd, BIO_NOCLOSE)) == NULL)
+		return;
+
+	/* SSL_set_bio() takes over both BIOs */
+	SSL_set_bio(ssl_io->ssl, bio_int, bio);
+	ssl_io->ktls_wbio = TRUE;
+}
+
+void openssl_iostream_ktls_handshaked(struct ssl_iostream *ssl_io)
+{
+	BIO *bio_int;
+
+	if (!ssl_io->ktls_wbio)
+		return;
+	if (BIO_get_ktls_send(SSL_get_wbio(ssl_io->ssl))) {
+		e_debug(ssl_io->event, "kTLS enabled for sending");
+		ssl_io->ktls_tx = TRUE;
+		return;
+	}
+
+	/* The kernel didn't accept kTLS. Go back to writing via the BIO pair,
+	   so the output is buffered by plain_output as usual. */
+	e_debug(ssl_io->event, "kTLS not enabled for sending");
+	bio_int = SSL_get_rbio(ssl_io->ssl);
+	BIO_up_ref(bio_int);
+	SSL_set0_wbio(ssl_io->ssl, bio_int);
+	ssl_io->ktls_wbio = FALSE;
+}
+
+int openssl_iostream_ktls_flush(struct ssl_iostream *ssl_io)
+{
+	int ret;
+
+	if (!ssl_io->ktls_tx)
+		return 1;
+
+	/* plain_output may have data written to it directly by
+	   o_stream_ssl_send_istream(). It must be sent before OpenSSL writes
+	   anything more to the socket. */
+	if ((ret = o_stream_flush(ssl_io->plain_output)) < 0) {
+		i_free(ssl_io->plain_stream_errstr);
+		ssl_io->plain_stream_errstr =
+			i_strdup(o_stream_get_error(ssl_io->plain_output));
+		ssl_io->plain_stream_errno = ssl_io->plain_output->stream_errno;
+		ssl_io->closed = TRUE;
+		return -1;
+	}
+	if (ret == 0)
+		o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+	return ret;
+}
+
+#endif
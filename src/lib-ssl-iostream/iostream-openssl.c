@@ -195,6 +195,10 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 	}
 	/* bio_int will be freed by SSL_free() */
 	SSL_set_bio(ssl_io->ssl, bio_int, bio_int);
+#ifdef HAVE_OPENSSL_KTLS
+	if (ctx->ktls)
+		openssl_iostream_ktls_init(ssl_io, bio_int);
+#endif
         SSL_set_ex_data(ssl_io->ssl, dovecot_ssl_extdata_index, ssl_io);
 	SSL_set_tlsext_host_name(ssl_io->ssl, host);
 
@@ -492,6 +496,18 @@ int openssl_iostream_handle_error(struct ssl_iostream *ssl_io, int ret,
 	err = SSL_get_error(ssl_io->ssl, ret);
 	switch (err) {
 	case SSL_ERROR_WANT_WRITE:
+		if (ssl_io->ktls_wbio) {
+			/* OpenSSL is writing directly to the socket, which
+			   is full. Continue once it's writable. */
+			if (type != OPENSSL_IOSTREAM_SYNC_TYPE_NONE)
+				(void)openssl_iostream_bio_sync(ssl_io, type);
+			if (ssl_io->closed) {
+				openssl_iostream_closed(ssl_io);
+				return -1;
+			}
+			o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+			return 0;
+		}
 		if (type != OPENSSL_IOSTREAM_SYNC_TYPE_NONE &&
 		    openssl_iostream_bio_sync(ssl_io, type) == 0) {
 			if (type != OPENSSL_IOSTREAM_SYNC_TYPE_WRITE)
@@ -663,6 +679,9 @@ static int openssl_iostream_handshake(struct ssl_iostream *ssl_io)
 	i_free_and_null(ssl_io->last_error);
 	ssl_io->handshaked = TRUE;
 	ssl_io->state = SSL_IOSTREAM_STATE_OK;
+#ifdef HAVE_OPENSSL_KTLS
+	openssl_iostream_ktls_handshaked(ssl_io);
+#endif
 
 	const char *alpn_proto = ssl_iostream_get_application_protocol(ssl_io);
 	if (alpn_proto != NULL && *alpn_proto != '\0')
@@ -884,6 +903,11 @@ openssl_iostream_get_ja3(struct ssl_iostream *ssl_io)
 	return ssl_io->ja3_str;
 }
 
+static bool openssl_iostream_is_ktls_enabled(struct ssl_iostream *ssl_io)
+{
+	return ssl_io->ktls_tx;
+}
+
 static const char *
 openssl_iostream_get_application_protocol(struct ssl_iostream *ssl_io)
 {
@@ -1116,6 +1140,7 @@ static const struct iostream_ssl_vfuncs ssl_vfuncs = {
 	.get_protocol_name = openssl_iostream_get_protocol_name,
 	.get_protocol_version = openssl_iostream_get_protocol_version,
 	.get_ja3 = openssl_iostream_get_ja3,
+	.is_ktls_enabled = openssl_iostream_is_ktls_enabled,
 
 	.get_application_protocol = openssl_iostream_get_application_protocol,
 	.set_application_protocols = openssl_iostream_context_set_application_protocols,
@@ -8,6 +8,10 @@
 #ifndef HAVE_ASN1_STRING_GET0_DATA
 #  define ASN1_STRING_get0_data(str) ASN1_STRING_data(str)
 #endif
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_CTRL_GET_KTLS_SEND) && \
+    !defined(OPENSSL_NO_KTLS)
+#  define HAVE_OPENSSL_KTLS
+#endif
 enum openssl_iostream_sync_type {
 	OPENSSL_IOSTREAM_SYNC_TYPE_NONE,
 	OPENSSL_IOSTREAM_SYNC_TYPE_CONTINUE_READ,
@@ -34,6 +38,7 @@ struct ssl_iostream_context {
 	bool client_ctx:1;
 	bool verify_remote_cert:1;
 	bool allow_invalid_cert:1;
+	bool ktls:1;
 };
 
 struct ssl_iostream {
@@ -80,6 +85,11 @@ struct ssl_iostream {
 	bool ostream_flush_waiting_input:1;
 	bool closed:1;
 	bool destroyed:1;
+	/* OpenSSL writes directly to the plain_output fd, so it can enable
+	   kTLS. */
+	bool ktls_wbio:1;
+	/* The kernel encrypts everything written to the plain_output fd. */
+	bool ktls_tx:1;
 };
 
 extern int dovecot_ssl_extdata_index;
@@ -137,6 +147,18 @@ const char *
 openssl_iostream_use_certificate_error(const char *cert);
 void openssl_iostream_clear_errors(void);
 
+#ifdef HAVE_OPENSSL_KTLS
+/* Set OpenSSL to write directly to the plain_output socket, if possible.
+   bio_int is used for reading. */
+void openssl_iostream_ktls_init(struct ssl_iostream *ssl_io, BIO *bio_int);
+/* Called after the handshake. If OpenSSL didn't enable kTLS, go back to
+   writing via bio_int. */
+void openssl_iostream_ktls_handshaked(struct ssl_iostream *ssl_io);
+/* With kTLS enabled, flush plain_output before OpenSSL writes more to the
+   socket. Returns 1 if flushed, 0 if not yet, -1 if error. */
+int openssl_iostream_ktls_flush(struct ssl_iostream *ssl_io);
+#endif
+
 void ssl_iostream_openssl_init(void);
 void ssl_iostream_openssl_deinit(void);
 
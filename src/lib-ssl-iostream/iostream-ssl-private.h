@@ -54,6 +54,7 @@ struct iostream_ssl_vfuncs {
 	enum ssl_iostream_protocol_version
 	(*get_protocol_version)(struct ssl_iostream *ssl_io);
 	const char *(*get_ja3)(struct ssl_iostream *ssl_io);
+	bool (*is_ktls_enabled)(struct ssl_iostream *ssl_io);
 
 	const char *(*get_application_protocol)(struct ssl_iostream *ssl_io);
 	void (*set_application_protocols)(struct ssl_iostream_context *ctx,
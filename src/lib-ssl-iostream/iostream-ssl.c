@@ -376,6 +376,8 @@ bool ssl_iostream_settings_equals(const struct ssl_iostream_settings *set1,
 	    !quick_strcmp(set1->ciphersuites, set2->ciphersuites) ||
 	    !quick_strcmp(set1->curve_list, set2->curve_list) ||
 	    !quick_strcmp(set1->dh.content, set2->dh.content) ||
+	    !quick_strcmp(set1->ticket_key.content,
+			  set2->ticket_key.content) ||
 	    !quick_strcmp(set1->cert_username_field,
 			  set2->cert_username_field) ||
 	    !quick_strcmp(set1->crypto_device, set2->crypto_device))
@@ -386,7 +388,8 @@ bool ssl_iostream_settings_equals(const struct ssl_iostream_settings *set1,
 	    set1->allow_invalid_cert != set2->allow_invalid_cert ||
 	    set1->prefer_server_ciphers != set2->prefer_server_ciphers ||
 	    set1->compression != set2->compression ||
-	    set1->tickets != set2->tickets)
+	    set1->tickets != set2->tickets ||
+	    set1->ktls != set2->ktls)
 		return FALSE;
 	return TRUE;
 }
@@ -418,6 +421,11 @@ const char *ssl_iostream_get_ja3(struct ssl_iostream *ssl_io)
 	return ssl_vfuncs->get_ja3(ssl_io);
 }
 
+bool ssl_iostream_is_ktls_enabled(struct ssl_iostream *ssl_io)
+{
+	return ssl_vfuncs->is_ktls_enabled(ssl_io);
+}
+
 const char *ssl_iostream_get_application_protocol(struct ssl_iostream *ssl_io)
 {
 	return ssl_vfuncs->get_application_protocol(ssl_io);
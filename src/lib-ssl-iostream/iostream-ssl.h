@@ -84,6 +84,9 @@ struct ssl_iostream_settings {
 	   different key algorithm */
 	struct ssl_iostream_cert alt_cert;
 	struct settings_file dh;
+	/* server-only: Secret used to derive the TLS session ticket keys.
+	   Processes using the same secret can resume each others' sessions. */
+	struct settings_file ticket_key;
 	/* Field which contains the username returned by
 	   ssl_iostream_get_peer_username() */
 	const char *cert_username_field;
@@ -108,6 +111,8 @@ struct ssl_iostream_settings {
 	bool compression;
 	/* If FALSE, set SSL_OP_NO_TICKET. See OpenSSL documentation. */
 	bool tickets;
+	/* Use Linux kernel TLS for sending, if possible. */
+	bool ktls;
 };
 
 /* Load SSL module */
@@ -253,6 +258,8 @@ const char *ssl_iostream_get_security_string(struct ssl_iostream *ssl_io);
    if it is not available due to no handshake performed, or
    OpenSSL version is earlier than 1.1. */
 const char *ssl_iostream_get_ja3(struct ssl_iostream *ssl_io);
+/* Returns TRUE if the kernel is encrypting the sent data (kTLS). */
+bool ssl_iostream_is_ktls_enabled(struct ssl_iostream *ssl_io);
 
 /* Returns SSL context's current used cipher algorithm. Returns NULL
    if SSL handshake has not been performed.
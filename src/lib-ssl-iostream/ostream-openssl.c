@@ -87,6 +87,17 @@ static int o_stream_ssl_flush_buffer(struct ssl_ostream *sstream)
 
 	i_assert(!sstream->shutdown);
 
+#ifdef HAVE_OPENSSL_KTLS
+	if ((ret = openssl_iostream_ktls_flush(ssl_io)) <= 0) {
+		if (ret < 0) {
+			io_stream_set_error(&sstream->ostream.iostream,
+					    "%s", ssl_io->plain_stream_errstr);
+			sstream->ostream.ostream.stream_errno =
+				ssl_io->plain_stream_errno;
+		}
+		return ret;
+	}
+#endif
 	while (pos < sstream->buffer->used) {
 		/* we're writing plaintext data to OpenSSL, which it encrypts
 		   and writes to bio_int's buffer. ssl_iostream_bio_sync()
@@ -209,6 +220,33 @@ o_stream_ssl_sendv(struct ostream_private *stream,
 	return bytes_sent;
 }
 
+static enum ostream_send_istream_result
+o_stream_ssl_send_istream(struct ostream_private *outstream,
+			  struct istream *instream)
+{
+	struct ssl_ostream *sstream = (struct ssl_ostream *)outstream;
+	struct ostream *plain_output = sstream->ssl_io->plain_output;
+	enum ostream_send_istream_result res;
+	uoff_t old_offset;
+
+	if (!sstream->ssl_io->ktls_tx ||
+	    (sstream->buffer != NULL && sstream->buffer->used > 0))
+		return io_stream_copy(&outstream->ostream, instream);
+
+	/* The kernel encrypts everything written to the fd, so the data can
+	   be sent directly to plain_output. This way sendfile() can be used
+	   for files. */
+	old_offset = plain_output->offset;
+	res = o_stream_send_istream(plain_output, instream);
+	outstream->ostream.offset += plain_output->offset - old_offset;
+	if (res == OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT) {
+		io_stream_set_error(&outstream->iostream, "%s",
+				    o_stream_get_error(plain_output));
+		outstream->ostream.stream_errno = plain_output->stream_errno;
+	}
+	return res;
+}
+
 static void o_stream_ssl_switch_ioloop_to(struct ostream_private *stream,
 					  struct ioloop *ioloop)
 {
@@ -277,6 +315,7 @@ struct ostream *openssl_o_stream_create_ssl(struct ssl_iostream *ssl_io)
 	sstream->ostream.iostream.destroy = o_stream_ssl_destroy;
 	sstream->ostream.sendv = o_stream_ssl_sendv;
 	sstream->ostream.flush = o_stream_ssl_flush;
+	sstream->ostream.send_istream = o_stream_ssl_send_istream;
 	sstream->ostream.switch_ioloop_to = o_stream_ssl_switch_ioloop_to;
 
 	sstream->ostream.get_buffer_used_size =
@@ -85,6 +85,7 @@ static const struct setting_define ssl_server_setting_defines[] = {
 	DEF(FILE, ssl_server_alt_key_file),
 	DEF(STR, ssl_server_key_password),
 	DEF(FILE, ssl_server_dh_file),
+	DEF(FILE, ssl_server_ticket_key_file),
 	DEF(STR, ssl_server_cert_username_field),
 	DEF(ENUM, ssl_server_prefer_ciphers),
 
@@ -103,6 +104,7 @@ static const struct ssl_server_settings ssl_server_default_settings = {
 	.ssl_server_alt_key_file = "",
 	.ssl_server_key_password = "",
 	.ssl_server_dh_file = "",
+	.ssl_server_ticket_key_file = "",
 	.ssl_server_cert_username_field = "commonName",
 	.ssl_server_prefer_ciphers = "client:server",
 
@@ -143,6 +145,7 @@ ssl_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 	/* First set them all to defaults */
 	set->parsed_opts.compression = FALSE;
 	set->parsed_opts.tickets = TRUE;
+	set->parsed_opts.ktls = FALSE;
 
 	/* Then modify anything specified in the string */
 	const char **opts = t_strsplit_spaces(set->ssl_options, ", ");
@@ -152,6 +155,8 @@ ssl_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 			set->parsed_opts.compression = TRUE;
 		} else if (strcasecmp(opt, "no_ticket") == 0) {
 			set->parsed_opts.tickets = FALSE;
+		} else if (strcasecmp(opt, "ktls") == 0) {
+			set->parsed_opts.ktls = TRUE;
 		} else {
 			*error_r = t_strdup_printf("ssl_options: unknown flag: '%s'",
 						   opt);
@@ -255,6 +260,7 @@ ssl_common_settings_to_iostream_set(const struct ssl_settings *ssl_set)
 
 	set->compression = ssl_set->parsed_opts.compression;
 	set->tickets = ssl_set->parsed_opts.tickets;
+	set->ktls = ssl_set->parsed_opts.ktls;
 	set->curve_list = ssl_set->ssl_curve_list;
 	set->cert_hash_algo = ssl_set->ssl_peer_certificate_fingerprint_hash;
 
@@ -309,6 +315,8 @@ void ssl_server_settings_to_iostream_set(
 	}
 	settings_file_get(ssl_server_set->ssl_server_dh_file,
 			  set->pool, &set->dh);
+	settings_file_get(ssl_server_set->ssl_server_ticket_key_file,
+			  set->pool, &set->ticket_key);
 	set->cert_username_field =
 		ssl_server_set->ssl_server_cert_username_field;
 	set->prefer_server_ciphers =
@@ -26,6 +26,7 @@ struct ssl_settings {
 	struct {
 		bool compression;
 		bool tickets;
+		bool ktls;
 	} parsed_opts;
 };
 
@@ -40,6 +41,7 @@ struct ssl_server_settings {
 	const char *ssl_server_alt_key_file;
 	const char *ssl_server_key_password;
 	const char *ssl_server_dh_file;
+	const char *ssl_server_ticket_key_file;
 	const char *ssl_server_cert_username_field;
 	const char *ssl_server_prefer_ciphers;
 	const char *ssl_server_request_client_cert;
@@ -1,8 +1,10 @@
 /* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
+#include "test-subprocess.h"
 #include "buffer.h"
 #include "randgen.h"
+#include "net.h"
 #include "istream.h"
 #include "ostream.h"
 #include "iostream-openssl.h"
@@ -10,8 +12,17 @@
 #include "iostream-ssl-test.h"
 
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/ssl.h>
+
+#if defined(HAVE_OPENSSL_KTLS) && !defined(TCP_ULP)
+#  define TCP_ULP 31
+#endif
 
 #define MAX_SENT_BYTES 10000
+#define KTLS_SEND_BYTES (1024*1024)
+#define TEST_TICKET_KEY "0123456789abcdef0123456789abcdef"
 
 struct test_endpoint {
 	pool_t pool;
@@ -148,6 +159,46 @@ static void small_packets_input_callback(struct test_endpoint *ep)
 		send_output(ep);
 }
 
+static struct istream *ktls_send_input;
+static buffer_t *ktls_received;
+
+static int ktls_send_flush_callback(struct test_endpoint *ep)
+{
+	switch (o_stream_send_istream(ep->output, ktls_send_input)) {
+	case OSTREAM_SEND_ISTREAM_RESULT_FINISHED:
+		ep->finished = TRUE;
+		return o_stream_flush(ep->output);
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT:
+		i_unreached();
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT:
+		return 0;
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT:
+		break;
+	}
+	test_assert(FALSE);
+	io_loop_stop(current_ioloop);
+	return -1;
+}
+
+static void ktls_receive_input_callback(struct test_endpoint *ep)
+{
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	while ((ret = i_stream_read_more(ep->input, &data, &size)) > 0) {
+		buffer_append(ktls_received, data, size);
+		i_stream_skip(ep->input, size);
+	}
+	if (ret < 0) {
+		test_assert(ep->input->stream_errno == 0);
+		io_loop_stop(current_ioloop);
+	} else if (ktls_received->used >= KTLS_SEND_BYTES) {
+		io_loop_stop(current_ioloop);
+	}
+}
+
 static struct test_endpoint *
 create_test_endpoint(int fd, const struct ssl_iostream_settings *set)
 {
@@ -299,6 +350,25 @@ static void test_iostream_ssl_handshake(void)
 							 "failhost") == 0, idx);
 	idx++;
 
+	/* shared session ticket key */
+	ssl_iostream_test_settings_server(&server_set);
+	server_set.ticket_key.content = "0123456789abcdef0123456789abcdef";
+	ssl_iostream_test_settings_client(&client_set);
+	client_set.allow_invalid_cert = TRUE;
+	test_assert_idx(test_iostream_ssl_handshake_real(&server_set, &client_set,
+							 "localhost") == 0, idx);
+	idx++;
+
+	/* too short session ticket key */
+	ssl_iostream_test_settings_server(&server_set);
+	server_set.ticket_key.content = "0123456789abcdef";
+	ssl_iostream_test_settings_client(&client_set);
+	client_set.allow_invalid_cert = TRUE;
+	test_expect_error_string("ssl_server_ticket_key_file must contain");
+	test_assert_idx(test_iostream_ssl_handshake_real(&server_set, &client_set,
+							 "localhost") != 0, idx);
+	idx++;
+
 	/* verify remote cert */
 	ssl_iostream_test_settings_server(&server_set);
 	ssl_iostream_test_settings_client(&client_set);
@@ -384,6 +454,140 @@ static void test_iostream_ssl_handshake(void)
 	test_end();
 }
 
+struct test_resumption_server {
+	int fd;
+	const struct ssl_iostream_settings *set;
+	struct ssl_iostream *iostream;
+	struct istream *input;
+	struct ostream *output;
+	bool replied;
+};
+
+static void test_resumption_server_input(struct test_resumption_server *server)
+{
+	if (i_stream_read(server->input) < 0) {
+		io_loop_stop(current_ioloop);
+		return;
+	}
+	if (!server->replied && ssl_iostream_is_handshaked(server->iostream)) {
+		/* the client waits for this reply, which also makes sure it
+		   has received the session tickets */
+		server->replied = TRUE;
+		o_stream_nsend_str(server->output, "+");
+		if (o_stream_flush(server->output) < 0)
+			io_loop_stop(current_ioloop);
+	}
+	i_stream_skip(server->input, i_stream_get_data_size(server->input));
+}
+
+static int test_resumption_server(struct test_resumption_server *server)
+{
+	struct ssl_iostream_context *ctx;
+	struct ioloop *ioloop;
+	struct io *io;
+	const char *error;
+
+	/* Each server process has its own SSL context, like login
+	   processes do. */
+	ioloop = io_loop_create();
+	if (ssl_iostream_context_init_server(server->set, &ctx, &error) < 0)
+		i_fatal("server: %s", error);
+	server->input = i_stream_create_fd(server->fd, 1024);
+	server->output = o_stream_create_fd(server->fd, 1024);
+	if (io_stream_create_ssl_server(ctx, NULL,
+					&server->input, &server->output,
+					&server->iostream, &error) < 0)
+		i_fatal("server: %s", error);
+	io = io_add_istream(server->input, test_resumption_server_input,
+			    server);
+	i_stream_set_input_pending(server->input, TRUE);
+	io_loop_run(ioloop);
+
+	io_remove(&io);
+	ssl_iostream_destroy(&server->iostream);
+	i_stream_unref(&server->input);
+	o_stream_unref(&server->output);
+	i_close_fd(&server->fd);
+	ssl_iostream_context_unref(&ctx);
+	io_loop_destroy(&ioloop);
+	return 0;
+}
+
+static bool
+test_resumption_connect(SSL_CTX *client_ctx,
+			const struct ssl_iostream_settings *server_set,
+			SSL_SESSION **session)
+{
+	struct test_resumption_server server = {
+		.set = server_set,
+	};
+	char reply;
+	bool reused;
+	int fd[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+		i_fatal("socketpair() failed: %m");
+	server.fd = fd[0];
+	fd_set_nonblock(server.fd, TRUE);
+	test_subprocess_fork(test_resumption_server, &server, FALSE);
+	i_close_fd(&fd[0]);
+
+	SSL *ssl = SSL_new(client_ctx);
+	if (ssl == NULL || SSL_set_fd(ssl, fd[1]) != 1)
+		i_fatal("SSL_new() failed");
+	if (*session != NULL)
+		(void)SSL_set_session(ssl, *session);
+	test_assert(SSL_connect(ssl) == 1);
+	test_assert(SSL_read(ssl, &reply, 1) == 1);
+	reused = SSL_session_reused(ssl) != 0;
+
+	if (*session != NULL)
+		SSL_SESSION_free(*session);
+	*session = SSL_get1_session(ssl);
+	(void)SSL_shutdown(ssl);
+	SSL_free(ssl);
+	i_close_fd(&fd[1]);
+	test_subprocess_wait_all(10);
+	return reused;
+}
+
+static void test_iostream_ssl_session_resumption(void)
+{
+	struct ssl_iostream_settings server_set, verify_set;
+	SSL_SESSION *session = NULL;
+	SSL_CTX *client_ctx;
+
+	test_begin("ssl: session resumption");
+	if ((client_ctx = SSL_CTX_new(TLS_client_method())) == NULL)
+		i_fatal("SSL_CTX_new() failed");
+	SSL_CTX_set_verify(client_ctx, SSL_VERIFY_NONE, NULL);
+
+	ssl_iostream_test_settings_server(&server_set);
+	server_set.tickets = TRUE;
+	server_set.ticket_key.content = TEST_TICKET_KEY;
+
+	/* a session from one server process is resumed by another one using
+	   the same settings */
+	test_assert(!test_resumption_connect(client_ctx, &server_set,
+					     &session));
+	test_assert(test_resumption_connect(client_ctx, &server_set,
+					    &session));
+
+	/* a process requiring client certificates doesn't resume a session
+	   that was established without verifying them */
+	verify_set = server_set;
+	verify_set.verify_remote_cert = TRUE;
+	test_assert(!test_resumption_connect(client_ctx, &verify_set,
+					     &session));
+	/* ..or the other way around */
+	test_assert(!test_resumption_connect(client_ctx, &server_set,
+					     &session));
+
+	SSL_SESSION_free(session);
+	SSL_CTX_free(client_ctx);
+	test_end();
+}
+
 static void test_iostream_ssl_get_buffer_avail_size(void)
 {
 	struct ssl_iostream_settings set;
@@ -551,15 +755,143 @@ static void test_iostream_ssl_small_packets(void)
 	test_end();
 }
 
+static void test_tcp_socketpair(int fd[2])
+{
+	struct ip_addr ip;
+	in_port_t port = 0;
+	int listen_fd;
+
+	test_assert(net_addr2ip("127.0.0.1", &ip) == 0);
+	if ((listen_fd = net_listen(&ip, &port, 1)) < 0)
+		i_fatal("listen() failed: %m");
+	if ((fd[1] = net_connect_ip_blocking(&ip, port, NULL)) < 0)
+		i_fatal("connect() failed: %m");
+	if ((fd[0] = net_accept(listen_fd, NULL, NULL)) < 0)
+		i_fatal("accept() failed: %m");
+	i_close_fd(&listen_fd);
+}
+
+static bool test_ktls_is_available(void)
+{
+#ifdef HAVE_OPENSSL_KTLS
+	int fd[2];
+	bool ret;
+
+	/* check whether the kernel has the tls ULP */
+	test_tcp_socketpair(fd);
+	ret = setsockopt(fd[0], IPPROTO_TCP, TCP_ULP,
+			 "tls", sizeof("tls")) == 0;
+	i_close_fd(&fd[0]);
+	i_close_fd(&fd[1]);
+	return ret;
+#else
+	return FALSE;
+#endif
+}
+
+static void test_iostream_ssl_ktls_send_istream(void)
+{
+	struct ssl_iostream_settings set;
+	struct test_endpoint *server, *client;
+	struct ioloop *ioloop;
+	int fd[2];
+	const char *error;
+
+	/* Without the kernel's tls ULP this tests the fallback to
+	   OpenSSL encryption after OpenSSL has written the handshake directly
+	   to the socket. */
+	bool ktls_available = test_ktls_is_available();
+
+	test_begin("ssl: ktls send istream");
+
+	/* kTLS requires a TCP socket */
+	test_tcp_socketpair(fd);
+	fd_set_nonblock(fd[0], TRUE);
+	fd_set_nonblock(fd[1], TRUE);
+
+	ioloop = io_loop_create();
+
+	ssl_iostream_test_settings_server(&set);
+	set.ktls = TRUE;
+	server = create_test_endpoint(fd[0], &set);
+	ssl_iostream_test_settings_client(&set);
+	set.allow_invalid_cert = TRUE;
+	set.ktls = TRUE;
+	client = create_test_endpoint(fd[1], &set);
+	client->client = TRUE;
+
+	client->other = server;
+	server->other = client;
+
+	test_assert(ssl_iostream_context_init_server(server->set, &server->ctx,
+		    &error) == 0);
+	test_assert(ssl_iostream_context_init_client(client->set, &client->ctx,
+		    &error) == 0);
+
+	test_assert(io_stream_create_ssl_server(server->ctx, NULL,
+						&server->input, &server->output,
+						&server->iostream, &error) == 0);
+	test_assert(io_stream_create_ssl_client(client->ctx, "localhost", NULL, 0,
+						&client->input, &client->output,
+						&client->iostream, &error) == 0);
+
+	unsigned char *data = i_malloc(KTLS_SEND_BYTES);
+	random_fill(data, KTLS_SEND_BYTES);
+	ktls_send_input = i_stream_create_from_data(data, KTLS_SEND_BYTES);
+	ktls_received = buffer_create_dynamic(default_pool, KTLS_SEND_BYTES);
+
+	o_stream_set_flush_callback(server->output, ktls_send_flush_callback,
+				    server);
+	server->io = io_add_istream(server->input, bufsize_discard_callback,
+				    server);
+	client->io = io_add_istream(client->input, ktls_receive_input_callback,
+				    client);
+
+	test_assert(ssl_iostream_handshake(client->iostream) == 0);
+	test_assert(ssl_iostream_handshake(server->iostream) == 0);
+	o_stream_set_flush_pending(server->output, TRUE);
+
+	struct timeout *to = timeout_add(5000, io_loop_stop, ioloop);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+
+	test_assert(server->finished);
+	test_assert(ssl_iostream_is_ktls_enabled(server->iostream) ==
+		    ktls_available);
+	test_assert(server->output->offset == KTLS_SEND_BYTES);
+	test_assert(ktls_received->used == KTLS_SEND_BYTES &&
+		    memcmp(ktls_received->data, data, KTLS_SEND_BYTES) == 0);
+
+	buffer_free(&ktls_received);
+	i_stream_unref(&ktls_send_input);
+	i_free(data);
+
+	i_stream_unref(&server->input);
+	o_stream_unref(&server->output);
+	i_stream_unref(&client->input);
+	o_stream_unref(&client->output);
+
+	destroy_test_endpoint(&server);
+	destroy_test_endpoint(&client);
+
+	io_loop_destroy(&ioloop);
+	ssl_iostream_context_cache_free();
+
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_iostream_ssl_handshake,
+		test_iostream_ssl_session_resumption,
 		test_iostream_ssl_get_buffer_avail_size,
 		test_iostream_ssl_small_packets,
+		test_iostream_ssl_ktls_send_istream,
 		NULL
 	};
 	ssl_iostream_openssl_init();
+	test_subprocesses_init();
 	int ret = test_run(test_functions);
 	ssl_iostream_openssl_deinit();
 	return ret;
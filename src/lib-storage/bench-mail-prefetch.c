@@ -0,0 +1,207 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "istream.h"
+#include "str.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "master-service.h"
+#include "mail-search-build.h"
+#include "index/index-search-private.h"
+#include "test-common.h"
+#include "test-dir.h"
+#include "test-mail-storage-common.h"
+
+#include <stdio.h>
+
+/**
+ * Saves a number of mails to a maildir INBOX and reads all of them through
+ * a mailbox search with different mail_prefetch_count and
+ * mail_prefetch_max_size settings, the same way FETCH BODY[] does. Maildir
+ * has the physical sizes in the filenames, so mail_prefetch_max_size can
+ * limit the prefetch window without opening the mails. It reports the time
+ * spent per mail and the average and largest prefetch window seen after
+ * each returned mail, in mails and in bytes.
+ */
+
+#define BENCH_DEFAULT_MAIL_COUNT 2000
+#define BENCH_DEFAULT_MAIL_SIZE (64*1024)
+
+struct bench_window {
+	unsigned int count;
+	uoff_t max_size;
+};
+
+static const struct bench_window windows[] = {
+	{ 0, 0 },
+	{ 16, 0 },
+	{ 16, 256*1024 },
+	{ 256, 0 },
+	{ 256, 1024*1024 },
+	{ 1024, 0 },
+	{ 1024, 1024*1024 },
+};
+
+static unsigned int bench_mail_count = BENCH_DEFAULT_MAIL_COUNT;
+static unsigned int bench_mail_size = BENCH_DEFAULT_MAIL_SIZE;
+
+static void bench_save_mails(struct mailbox *box)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	string_t *mail;
+	unsigned int i;
+	ssize_t ret;
+
+	mail = t_str_new(bench_mail_size + 128);
+	str_append(mail, "From: user@example.com\n"
+		   "Subject: prefetch\n\n");
+	while (str_len(mail) < bench_mail_size)
+		str_append(mail, "0123456789abcdef0123456789abcdef0123456789\n");
+
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	for (i = 0; i < bench_mail_count; i++) {
+		input = i_stream_create_from_data(str_data(mail),
+						  str_len(mail));
+		save_ctx = mailbox_save_alloc(trans);
+		if (mailbox_save_begin(&save_ctx, input) < 0)
+			i_fatal("mailbox_save_begin() failed");
+		do {
+			if (mailbox_save_continue(save_ctx) < 0)
+				i_fatal("mailbox_save_continue() failed");
+		} while ((ret = i_stream_read(input)) > 0);
+		i_assert(ret == -1 && input->stream_errno == 0);
+		if (mailbox_save_finish(&save_ctx) < 0)
+			i_fatal("mailbox_save_finish() failed");
+		i_stream_unref(&input);
+	}
+	if (mailbox_transaction_commit(&trans) < 0 ||
+	    mailbox_sync(box, 0) < 0) {
+		i_fatal("Failed to save mails: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+}
+
+static void
+bench_fetch(struct mailbox *box, const struct bench_window *window)
+{
+	struct index_search_context *ictx;
+	struct mailbox_transaction_context *trans;
+	struct mail_search_context *search_ctx;
+	struct mail_search_args *search_args;
+	struct mail *mail;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	unsigned int count = 0, max_window_count = 0;
+	uoff_t window_size_sum = 0, max_window_size = 0;
+	uint64_t ts_0, ts_1;
+
+	search_args = mail_search_build_init();
+	mail_search_build_add_all(search_args);
+
+	ts_0 = i_nanoseconds();
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	search_ctx = mailbox_search_init(trans, search_args, NULL,
+					 MAIL_FETCH_STREAM_HEADER |
+					 MAIL_FETCH_STREAM_BODY, NULL);
+	ictx = container_of(search_ctx, struct index_search_context,
+			    mail_ctx);
+	while (mailbox_search_next(search_ctx, &mail)) {
+		max_window_count = I_MAX(max_window_count,
+					 search_ctx->unused_mail_idx);
+		max_window_size = I_MAX(max_window_size, ictx->prefetch_size);
+		window_size_sum += ictx->prefetch_size;
+
+		if (mail_get_stream(mail, NULL, NULL, &input) < 0)
+			i_fatal("mail_get_stream() failed");
+		while (i_stream_read_more(input, &data, &size) > 0)
+			i_stream_skip(input, size);
+		count++;
+	}
+	if (mailbox_search_deinit(&search_ctx) < 0)
+		i_fatal("mailbox_search_deinit() failed");
+	(void)mailbox_transaction_commit(&trans);
+	ts_1 = i_nanoseconds();
+	mail_search_args_unref(&search_args);
+	i_assert(count == bench_mail_count);
+
+	printf("prefetch_count=%-4u max_size=%-8"PRIuUOFF_T
+	       " %7.2f us/mail, window avg %8.0f bytes,"
+	       " max %4u mails %8"PRIuUOFF_T" bytes\n",
+	       window->count, window->max_size,
+	       (double)(ts_1 - ts_0) / 1000.0 / count,
+	       (double)window_size_sum / count,
+	       max_window_count, max_window_size);
+}
+
+static void bench_mail_prefetch(void)
+{
+	struct test_mail_storage_ctx *ctx = test_mail_storage_init();
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(windows); i++) T_BEGIN {
+		const char *const extra_input[] = {
+			t_strdup_printf("mail_prefetch_count=%u",
+					windows[i].count),
+			t_strdup_printf("mail_prefetch_max_size=%"PRIuUOFF_T,
+					windows[i].max_size),
+			NULL
+		};
+		struct test_mail_storage_settings set = {
+			.driver = "maildir",
+			.extra_input = extra_input,
+		};
+		test_mail_storage_init_user(ctx, &set);
+
+		struct mailbox *box =
+			mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+		if (mailbox_open(box) < 0)
+			i_fatal("mailbox_open() failed");
+		bench_save_mails(box);
+		bench_fetch(box, &windows[i]);
+		mailbox_free(&box);
+
+		test_mail_storage_deinit_user(ctx);
+	} T_END;
+	test_mail_storage_deinit(&ctx);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<mail count> [<mail size>]]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	void (*const benches[])(void) = {
+		bench_mail_prefetch,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("bench-mail-prefetch",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	if (argc > 3)
+		print_usage(argv[0]);
+	if (argc >= 2 && (str_to_uint(argv[1], &bench_mail_count) < 0 ||
+			  bench_mail_count == 0))
+		print_usage(argv[0]);
+	if (argc >= 3 && (str_to_uint(argv[2], &bench_mail_size) < 0 ||
+			  bench_mail_size == 0))
+		print_usage(argv[0]);
+
+	test_dir_init("bench-mail-prefetch");
+	ret = test_run(benches);
+
+	master_service_deinit(&master_service);
+	return ret;
+}
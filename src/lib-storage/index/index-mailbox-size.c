@@ -26,6 +26,15 @@
    last-indexed-uid, decrease the message count and the vsize in memory. After
    syncing is successfully committed, write the changes to header. Unlock.
 
+   With mail_vsize_incremental=yes the vsize header is kept up to date
+   without rescanning after it has been initially built: Saving new mails
+   locks vsize updates before the saves are committed (and syncing is
+   locked). The saved mails' vsizes were already calculated while saving, so
+   they're added to the header in the same index transaction that commits
+   the saved mails. Expunging mails decreases the header using the vsizes in
+   the mail records, so it doesn't depend on the quota plugin providing the
+   sizes.
+
    Note that the final expunge handling with some mailbox formats is done while
    syncing is no longer locked. Because of this we need to have the vsize
    locking. The final vsize header update requires committing a transaction,
@@ -46,10 +55,14 @@ struct mailbox_vsize_update {
 
 	struct file_lock *lock;
 	bool lock_failed;
+	bool lock_timeout;
 	bool skip_write;
 	bool rebuild;
 	bool written;
 	bool finish_in_background;
+	/* Calculate all the missing vsizes instead of finishing on
+	   background after mail_vsize_bg_after_count */
+	bool no_background;
 };
 
 static void vsize_header_refresh(struct mailbox_vsize_update *update)
@@ -141,6 +154,8 @@ static bool vsize_update_lock_full(struct mailbox_vsize_update *update,
 		   them. Especially when lock_secs is 0. */
 		if (ret < 0)
 			mailbox_set_critical(box, "%s", error);
+		else
+			update->lock_timeout = TRUE;
 		update->lock_failed = TRUE;
 		return FALSE;
 	}
@@ -240,7 +255,8 @@ void index_mailbox_vsize_update_deinit(struct mailbox_vsize_update **_update)
 	i_free(update);
 }
 
-void index_mailbox_vsize_hdr_expunge(struct mailbox_vsize_update *update,
+static void
+index_mailbox_vsize_hdr_expunge_full(struct mailbox_vsize_update *update,
 				     uint32_t uid, uoff_t vsize)
 {
 	i_assert(update->lock != NULL);
@@ -263,6 +279,93 @@ void index_mailbox_vsize_hdr_expunge(struct mailbox_vsize_update *update,
 	update->vsize_hdr.vsize -= vsize;
 }
 
+void index_mailbox_vsize_hdr_expunge(struct mailbox_vsize_update *update,
+				     uint32_t uid, uoff_t vsize)
+{
+	if (update->box->storage->set->mail_vsize_incremental) {
+		/* index_mailbox_vsize_update_expunged() already handles
+		   this expunge */
+		return;
+	}
+	index_mailbox_vsize_hdr_expunge_full(update, uid, vsize);
+}
+
+void index_mailbox_vsize_update_expunged(struct mailbox_vsize_update *update,
+					 uint32_t uid)
+{
+	const void *data;
+	uint32_t seq, vsize;
+	bool expunged;
+
+	if (uid > update->vsize_hdr.highest_uid)
+		return;
+	if (!mail_index_lookup_seq(update->view, uid, &seq)) {
+		/* already expunged before the vsize updates were locked,
+		   so the header doesn't contain it anymore */
+		return;
+	}
+	mail_index_lookup_ext(update->view, seq, update->box->mail_vsize_ext_id,
+			      &data, &expunged);
+	vsize = data == NULL ? 0 : *(const uint32_t *)data;
+	if (vsize == 0) {
+		/* the vsize isn't in the index (e.g. the mail is larger
+		   than 4 GB) - rebuild the header */
+		i_zero(&update->vsize_hdr);
+		return;
+	}
+	index_mailbox_vsize_hdr_expunge_full(update, uid, vsize - 1);
+}
+
+void index_mailbox_vsize_hdr_add_saved(struct mailbox_vsize_update *update,
+				       struct mailbox_transaction_context *t)
+{
+	struct mailbox_index_vsize vsize_hdr = update->vsize_hdr;
+	const struct seq_range *range;
+	const void *data;
+	uint32_t seq, seq1, seq2, vsize;
+	bool expunged;
+
+	i_assert(update->lock != NULL);
+
+	if (vsize_hdr.highest_uid == 0 ||
+	    array_is_empty(&t->changes->saved_uids))
+		return;
+	range = array_front(&t->changes->saved_uids);
+	if (range->seq1 != vsize_hdr.highest_uid + 1) {
+		/* some earlier mails are still missing from the header.
+		   they're added after syncing. */
+		return;
+	}
+
+	array_foreach(&t->changes->saved_uids, range) {
+		if (!mail_index_lookup_seq_range(t->view, range->seq1,
+						 range->seq2, &seq1, &seq2) ||
+		    seq2 - seq1 != range->seq2 - range->seq1)
+			return;
+		for (seq = seq1; seq <= seq2; seq++) {
+			mail_index_lookup_ext(t->view, seq,
+					      t->box->mail_vsize_ext_id,
+					      &data, &expunged);
+			vsize = data == NULL ? 0 : *(const uint32_t *)data;
+			if (vsize == 0) {
+				/* vsize wasn't calculated while saving -
+				   add the mails after syncing */
+				return;
+			}
+			vsize_hdr.vsize += vsize - 1;
+			vsize_hdr.message_count++;
+		}
+		vsize_hdr.highest_uid = range->seq2;
+	}
+
+	update->vsize_hdr = vsize_hdr;
+	mail_index_update_header_ext(t->itrans, t->box->vsize_hdr_ext_id,
+				     0, &update->vsize_hdr,
+				     sizeof(update->vsize_hdr));
+	/* the header is written by the saving transaction */
+	update->skip_write = TRUE;
+}
+
 static void
 index_mailbox_vsize_finish_bg(struct mailbox_vsize_update *update,
 			      bool require_result)
@@ -323,7 +426,8 @@ index_mailbox_vsize_hdr_add_missing(struct mailbox_vsize_update *update,
 					 MAIL_FETCH_VIRTUAL_SIZE, NULL);
 	if (!require_result)
 		mails_left = 0;
-	else if (update->box->storage->set->mail_vsize_bg_after_count == 0)
+	else if (update->no_background ||
+		 update->box->storage->set->mail_vsize_bg_after_count == 0)
 		mails_left = UINT_MAX;
 	else
 		mails_left = update->box->storage->set->mail_vsize_bg_after_count;
@@ -413,6 +517,38 @@ int index_mailbox_get_virtual_size(struct mailbox *box,
 	return ret;
 }
 
+int index_mailbox_vsize_rebuild(struct mailbox *box)
+{
+	struct mailbox_vsize_update *update;
+	int ret;
+
+	update = index_mailbox_vsize_update_init(box);
+	if (!index_mailbox_vsize_update_wait_lock(update)) {
+		if (MAIL_INDEX_IS_IN_MEMORY(box->index)) {
+			mail_storage_set_error(box->storage,
+				MAIL_ERROR_NOTPOSSIBLE,
+				"Can't lock vsize updates with in-memory index");
+		} else if (update->lock_timeout) {
+			mail_storage_set_error(box->storage, MAIL_ERROR_INUSE,
+				"Timeout while waiting for vsize lock");
+		}
+		update->skip_write = TRUE;
+		index_mailbox_vsize_update_deinit(&update);
+		return -1;
+	}
+
+	/* throw away the old header and count all the mails again */
+	i_zero(&update->vsize_hdr);
+	update->rebuild = TRUE;
+	update->no_background = TRUE;
+
+	struct event_reason *reason = event_reason_begin("mailbox:vsize");
+	ret = index_mailbox_vsize_hdr_add_missing(update, TRUE);
+	event_reason_end(&reason);
+	index_mailbox_vsize_update_deinit(&update);
+	return ret;
+}
+
 int index_mailbox_get_physical_size(struct mailbox *box,
 				    struct mailbox_metadata *metadata_r)
 {
@@ -2,6 +2,7 @@
 #define INDEX_MAILBOX_SIZE_H
 
 struct mailbox;
+struct mailbox_transaction_context;
 
 struct mailbox_vsize_update *
 index_mailbox_vsize_update_init(struct mailbox *box);
@@ -9,6 +10,15 @@ void index_mailbox_vsize_update_deinit(struct mailbox_vsize_update **update);
 
 void index_mailbox_vsize_hdr_expunge(struct mailbox_vsize_update *update,
 				     uint32_t uid, uoff_t vsize);
+/* Decrease the header by the expunged mail's vsize, which is looked up from
+   the index. Used with mail_vsize_incremental=yes. */
+void index_mailbox_vsize_update_expunged(struct mailbox_vsize_update *update,
+					 uint32_t uid);
+/* Add the mails saved by the transaction to the header. This must be called
+   after transaction_save_commit_pre() has assigned the UIDs. The header is
+   updated as part of the transaction. */
+void index_mailbox_vsize_hdr_add_saved(struct mailbox_vsize_update *update,
+				       struct mailbox_transaction_context *t);
 
 bool index_mailbox_vsize_update_try_lock(struct mailbox_vsize_update *update);
 bool index_mailbox_vsize_update_wait_lock(struct mailbox_vsize_update *update);
@@ -16,5 +26,9 @@ bool index_mailbox_vsize_update_wait_lock(struct mailbox_vsize_update *update);
 bool index_mailbox_vsize_want_updates(struct mailbox_vsize_update *update);
 
 void index_mailbox_vsize_update_appends(struct mailbox *box);
+/* Reset the vsize header and build it again by looking up all the mails'
+   vsizes, while the vsize updates are locked. Returns 0 on success, -1 on
+   error. */
+int index_mailbox_vsize_rebuild(struct mailbox *box);
 
 #endif
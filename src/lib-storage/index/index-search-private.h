@@ -24,6 +24,11 @@ struct index_search_context {
 	struct mail_thread_context *thread_ctx;
 	pool_t temp_pool;
 
+	/* Physical sizes of the mails in the prefetch window, in the same
+	   order as mail_ctx.mails. Only used with mail_prefetch_max_size. */
+	ARRAY(uoff_t) prefetch_sizes;
+	uoff_t prefetch_size;
+
 	struct timeval last_nonblock_timeval;
 	struct timeval interrupt_start_time;
 	unsigned long long cost, next_time_check_cost;
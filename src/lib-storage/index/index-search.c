@@ -1328,6 +1328,7 @@ index_storage_search_init(struct mailbox_transaction_context *t,
 	array_create(&ctx->mail_ctx.module_contexts, default_pool,
 		     sizeof(void *), 5);
 	i_array_init(&ctx->mail_ctx.mails, ctx->mail_ctx.max_mails);
+	i_array_init(&ctx->prefetch_sizes, ctx->mail_ctx.max_mails);
 
 	mail_search_args_reset(ctx->mail_ctx.args->args, TRUE);
 	if (args->have_inthreads) {
@@ -1404,6 +1405,7 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 	if (ctx->failed)
 		mail_storage_last_error_pop(ctx->box->storage);
 	array_free(&ctx->mail_ctx.mails);
+	array_free(&ctx->prefetch_sizes);
 	pool_unref(&ctx->temp_pool);
 	i_free(ctx);
 	return ret;
@@ -1681,6 +1683,48 @@ static int search_more_with_mail(struct index_search_context *ctx,
 	return ret;
 }
 
+static void
+index_search_prefetch_add(struct index_search_context *ctx, struct mail *mail)
+{
+	enum mail_lookup_abort orig_lookup_abort;
+	uoff_t size;
+
+	if (ctx->box->storage->set->mail_prefetch_max_size == 0)
+		return;
+
+	/* Don't open the mail just for this - if the size isn't known
+	   cheaply, the mail isn't counted. */
+	orig_lookup_abort = mail->lookup_abort;
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_NOT_IN_CACHE;
+	if (mail_get_physical_size(mail, &size) < 0)
+		size = 0;
+	mail->lookup_abort = orig_lookup_abort;
+
+	array_push_back(&ctx->prefetch_sizes, &size);
+	ctx->prefetch_size += size;
+}
+
+static void index_search_prefetch_remove(struct index_search_context *ctx)
+{
+	const uoff_t *sizep;
+
+	if (array_count(&ctx->prefetch_sizes) == 0)
+		return;
+
+	sizep = array_front(&ctx->prefetch_sizes);
+	i_assert(ctx->prefetch_size >= *sizep);
+	ctx->prefetch_size -= *sizep;
+	array_pop_front(&ctx->prefetch_sizes);
+}
+
+static bool index_search_prefetch_window_full(struct index_search_context *ctx)
+{
+	uoff_t max_size = ctx->box->storage->set->mail_prefetch_max_size;
+
+	return max_size != 0 && ctx->mail_ctx.unused_mail_idx > 0 &&
+		ctx->prefetch_size >= max_size;
+}
+
 struct mail *index_search_get_mail(struct index_search_context *ctx)
 {
 	struct index_mail *imail;
@@ -1689,6 +1733,8 @@ struct mail *index_search_get_mail(struct index_search_context *ctx)
 
 	if (ctx->mail_ctx.unused_mail_idx == ctx->mail_ctx.max_mails)
 		return NULL;
+	if (index_search_prefetch_window_full(ctx))
+		return NULL;
 
 	mails = array_get(&ctx->mail_ctx.mails, &count);
 	if (ctx->mail_ctx.unused_mail_idx < count)
@@ -1731,6 +1777,7 @@ static int search_more_with_prefetching(struct index_search_context *ctx,
 			*mail_r = mail;
 			return 1;
 		}
+		index_search_prefetch_add(ctx, mail);
 		ctx->mail_ctx.unused_mail_idx++;
 	}
 
@@ -1753,6 +1800,7 @@ static int search_more_with_prefetching(struct index_search_context *ctx,
 
 	mails = array_get(&ctx->mail_ctx.mails, &count);
 	*mail_r = mails[0];
+	index_search_prefetch_remove(ctx);
 	if (--ctx->mail_ctx.unused_mail_idx > 0) {
 		array_pop_front(&ctx->mail_ctx.mails);
 		array_push_back(&ctx->mail_ctx.mails, mail_r);
@@ -391,6 +391,17 @@ int index_storage_mailbox_open(struct mailbox *box, bool move_to_memory)
 	return 0;
 }
 
+static void
+index_storage_sync_notify(struct mailbox *box, uint32_t uid,
+			  enum mailbox_sync_type sync_type)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+
+	if (sync_type == MAILBOX_SYNC_TYPE_EXPUNGE &&
+	    ibox->vsize_update != NULL)
+		index_mailbox_vsize_update_expunged(ibox->vsize_update, uid);
+}
+
 void index_storage_mailbox_alloc(struct mailbox *box, const char *vname,
 				 enum mailbox_flags flags,
 				 const char *index_prefix)
@@ -423,6 +434,9 @@ void index_storage_mailbox_alloc(struct mailbox *box, const char *vname,
 		ibox->index_flags |= MAIL_INDEX_OPEN_FLAG_DEBUG;
 	ibox->next_lock_notify = time(NULL) + LOCK_NOTIFY_INTERVAL;
 	MODULE_CONTEXT_SET(box, index_storage_module, ibox);
+	if (box->storage->set->mail_vsize_incremental &&
+	    box->v.sync_notify == NULL)
+		box->v.sync_notify = index_storage_sync_notify;
 
 	box->inbox_user = strcmp(box->name, "INBOX") == 0 &&
 		(box->list->ns->flags & NAMESPACE_FLAG_INBOX_USER) != 0;
@@ -1169,7 +1183,8 @@ void index_storage_expunging_deinit(struct mailbox *box)
 {
 	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
 
-	if (ibox->vsize_update != NULL)
+	/* with saving the vsize update is finished after the commit */
+	if (ibox->vsize_update != NULL && !ibox->vsize_update_saving)
 		index_mailbox_vsize_update_deinit(&ibox->vsize_update);
 }
 
@@ -38,6 +38,9 @@ struct index_mailbox_context {
 	struct mail_cache_field *cache_fields;
 
 	struct mailbox_vsize_update *vsize_update;
+	/* vsize_update was locked for committing saves, not for syncing
+	   expunges */
+	bool vsize_update_saving;
 
 	uint32_t recent_flags_prev_first_recent_uid;
 	uint32_t recent_flags_last_check_nextuid;
@@ -4,6 +4,7 @@
 #include "array.h"
 #include "dict.h"
 #include "index-storage.h"
+#include "index-mailbox-size.h"
 #include "index-sync-private.h"
 #include "index-pop3-uidl.h"
 #include "index-mail.h"
@@ -21,6 +22,37 @@ static void index_transaction_free(struct mailbox_transaction_context *t)
 	i_free(t);
 }
 
+static struct mailbox_vsize_update *
+index_transaction_vsize_lock(struct mailbox_transaction_context *t)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(t->box);
+
+	if (!t->box->storage->set->mail_vsize_incremental ||
+	    ibox->vsize_update != NULL)
+		return NULL;
+
+	/* vsize updates must be locked before syncing is locked by
+	   transaction_save_commit_pre(). Don't wait for the lock - if it's
+	   not available, the saved mails are added to the header after
+	   syncing. */
+	ibox->vsize_update = index_mailbox_vsize_update_init(t->box);
+	if (!index_mailbox_vsize_want_updates(ibox->vsize_update) ||
+	    !index_mailbox_vsize_update_try_lock(ibox->vsize_update)) {
+		index_mailbox_vsize_update_deinit(&ibox->vsize_update);
+		return NULL;
+	}
+	ibox->vsize_update_saving = TRUE;
+	return ibox->vsize_update;
+}
+
+static void index_transaction_vsize_unlock(struct mailbox *box)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+
+	ibox->vsize_update_saving = FALSE;
+	index_mailbox_vsize_update_deinit(&ibox->vsize_update);
+}
+
 static int
 index_transaction_index_commit(struct mail_index_transaction *index_trans,
 			       struct mail_index_transaction_commit_result *result_r)
@@ -29,6 +61,7 @@ index_transaction_index_commit(struct mail_index_transaction *index_trans,
 		MAIL_STORAGE_CONTEXT_REQUIRE(index_trans);
 	struct index_mailbox_sync_pvt_context *pvt_sync_ctx = NULL;
 	const char *error;
+	struct mailbox_vsize_update *vsize_update = NULL;
 	int ret = 0;
 
 	index_pop3_uidl_update_exists_finish(t);
@@ -53,9 +86,14 @@ index_transaction_index_commit(struct mail_index_transaction *index_trans,
 		if (ret < 0) {
 			t->box->v.transaction_save_rollback(t->save_ctx);
 			t->save_ctx = NULL;
-		} else if (t->box->v.transaction_save_commit_pre(t->save_ctx) < 0) {
-			t->save_ctx = NULL;
-			ret = -1;
+		} else {
+			vsize_update = index_transaction_vsize_lock(t);
+			if (t->box->v.transaction_save_commit_pre(t->save_ctx) < 0) {
+				t->save_ctx = NULL;
+				ret = -1;
+			} else if (vsize_update != NULL) {
+				index_mailbox_vsize_hdr_add_saved(vsize_update, t);
+			}
 		}
 	}
 
@@ -83,6 +121,8 @@ index_transaction_index_commit(struct mail_index_transaction *index_trans,
 	} else {
 		t->box->v.transaction_save_rollback(t->save_ctx);
 	}
+	if (vsize_update != NULL)
+		index_transaction_vsize_unlock(t->box);
 
 	if (pvt_sync_ctx != NULL) {
 		if (index_mailbox_sync_pvt_newmails(pvt_sync_ctx, t) < 0) {
@@ -12,6 +12,13 @@ struct index_list_mailbox {
 	uint32_t pre_sync_log_file_seq;
 	uoff_t pre_sync_log_file_head_offset;
 
+	/* The list index record with this UID was verified to be up-to-date
+	   with the mailbox at this ioloop time. Used to avoid checking it
+	   again when e.g. both STATUS and SIZE are looked up for a LIST-STATUS
+	   reply. */
+	struct timeval list_index_checked_timeval;
+	uint32_t list_index_checked_uid;
+
 	bool have_backend:1;
 };
 
@@ -813,6 +813,19 @@ bool mailbox_list_index_get_index(struct mailbox_list *list,
 	return TRUE;
 }
 
+static bool
+mailbox_list_index_view_checked(struct mailbox *box, uint32_t uid)
+{
+	struct index_list_mailbox *ibox = INDEX_LIST_STORAGE_CONTEXT(box);
+
+	/* Like mailbox_list_index_refresh(), trust the earlier check until
+	   we've been back in ioloop. The mailbox may have been changed by
+	   this process after it was opened, so don't trust it then. */
+	return !box->opened && ibox->list_index_checked_uid == uid &&
+		ibox->list_index_checked_timeval.tv_usec == ioloop_timeval.tv_usec &&
+		ibox->list_index_checked_timeval.tv_sec == ioloop_timeval.tv_sec;
+}
+
 int mailbox_list_index_view_open(struct mailbox *box, bool require_refreshed,
 				 struct mail_index_view **view_r,
 				 uint32_t *seq_r)
@@ -860,11 +873,20 @@ int mailbox_list_index_view_open(struct mailbox *box, bool require_refreshed,
 	} else if (!require_refreshed) {
 		/* this operation doesn't need the index to be up-to-date */
 		ret = 0;
+	} else if (mailbox_list_index_view_checked(box, node->uid)) {
+		/* already checked since the last ioloop run */
+		ret = 0;
 	} else {
 		ret = box->v.list_index_has_changed == NULL ? 0 :
 			box->v.list_index_has_changed(box, view, seq, FALSE,
 						      &reason);
 		i_assert(ret <= 0 || reason != NULL);
+		if (ret == 0) {
+			struct index_list_mailbox *ibox =
+				INDEX_LIST_STORAGE_CONTEXT(box);
+			ibox->list_index_checked_timeval = ioloop_timeval;
+			ibox->list_index_checked_uid = node->uid;
+		}
 	}
 
 	if (ret != 0) {
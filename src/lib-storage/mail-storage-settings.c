@@ -44,6 +44,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	{ .type = SET_FILTER_NAME, .key = "mail_attribute",
 	  .required_setting = "dict", },
 	DEF(UINT, mail_prefetch_count),
+	DEF(SIZE, mail_prefetch_max_size),
 	DEF(BOOLLIST, mail_cache_fields),
 	DEF(BOOLLIST, mail_always_cache_fields),
 	DEF(BOOLLIST, mail_never_cache_fields),
@@ -70,6 +71,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(TIME, mail_max_lock_timeout),
 	DEF(TIME, mail_temp_scan_interval),
 	DEF(UINT, mail_vsize_bg_after_count),
+	DEF(BOOL, mail_vsize_incremental),
 	DEF(UINT, mail_sort_max_read_count),
 	DEF(BOOL_HIDDEN, mail_save_crlf),
 	DEF(ENUM, mail_fsync),
@@ -121,6 +123,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_ext_attachment_min_size = 1024*128,
 	.mail_attachment_detection_options = ARRAY_INIT,
 	.mail_prefetch_count = 0,
+	.mail_prefetch_max_size = 0,
 	.mail_always_cache_fields = ARRAY_INIT,
 	.mail_server_comment = "",
 	.mail_server_admin = "",
@@ -145,6 +148,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_max_lock_timeout = 0,
 	.mail_temp_scan_interval = 7*24*60*60,
 	.mail_vsize_bg_after_count = 0,
+	.mail_vsize_incremental = FALSE,
 	.mail_sort_max_read_count = 0,
 	.mail_save_crlf = FALSE,
 	.mail_fsync = "optimized:never:always",
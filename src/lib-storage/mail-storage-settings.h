@@ -33,6 +33,7 @@ struct mail_storage_settings {
 	const char *mail_ext_attachment_hash;
 	uoff_t mail_ext_attachment_min_size;
 	unsigned int mail_prefetch_count;
+	uoff_t mail_prefetch_max_size;
 	ARRAY_TYPE(const_string) mail_cache_fields;
 	ARRAY_TYPE(const_string) mail_always_cache_fields;
 	ARRAY_TYPE(const_string) mail_never_cache_fields;
@@ -61,6 +62,7 @@ struct mail_storage_settings {
 	unsigned int mail_vsize_bg_after_count;
 	unsigned int mail_sort_max_read_count;
 	bool mail_save_crlf;
+	bool mail_vsize_incremental;
 	const char *mail_fsync;
 	bool mmap_disable;
 	bool dotlock_use_excl;
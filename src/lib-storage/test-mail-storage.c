@@ -2,9 +2,13 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "str.h"
+#include "istream.h"
 #include "test-common.h"
 #include "test-dir.h"
 #include "master-service.h"
+#include "mail-storage-private.h"
+#include "index-mailbox-size.h"
 #include "test-mail-storage-common.h"
 
 static const struct test_globals {
@@ -655,6 +659,174 @@ static void test_mailbox_list_mbox(void)
 	test_end();
 }
 
+static void test_mailbox_vsize_save(struct mailbox *box, unsigned int lines)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	string_t *mail = t_str_new(1024);
+	unsigned int i;
+
+	str_append(mail, "Subject: vsize test\n\n");
+	for (i = 0; i < lines; i++)
+		str_printfa(mail, "line %u\n", i);
+	input = i_stream_create_from_data(str_data(mail), str_len(mail));
+	trans = mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_EXTERNAL,
+					  __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	test_assert(mailbox_save_begin(&save_ctx, input) == 0);
+	while (i_stream_read(input) > 0)
+		test_assert(mailbox_save_continue(save_ctx) == 0);
+	test_assert(mailbox_save_finish(&save_ctx) == 0);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	i_stream_unref(&input);
+	test_assert(mailbox_sync(box, 0) == 0);
+}
+
+static void test_mailbox_vsize_expunge(struct mailbox *box, uint32_t seq)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, seq);
+	mail_expunge(mail);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+}
+
+static void test_mailbox_vsize_check(struct mailbox *box)
+{
+	const struct mailbox_index_vsize *vsize_hdr;
+	struct mailbox_transaction_context *trans;
+	struct mailbox_status status;
+	struct mail *mail;
+	const void *data;
+	size_t size;
+	uint64_t vsize = 0;
+	uoff_t mail_vsize;
+	uint32_t seq;
+
+	mailbox_get_open_status(box, STATUS_MESSAGES | STATUS_UIDNEXT, &status);
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, MAIL_FETCH_VIRTUAL_SIZE, NULL);
+	for (seq = 1; seq <= status.messages; seq++) {
+		mail_set_seq(mail, seq);
+		test_assert(mail_get_virtual_size(mail, &mail_vsize) == 0);
+		vsize += mail_vsize;
+	}
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+
+	/* the header must be up to date without looking up the vsize */
+	mail_index_get_header_ext(box->view, box->vsize_hdr_ext_id,
+				  &data, &size);
+	test_assert(size == sizeof(*vsize_hdr));
+	if (size != sizeof(*vsize_hdr))
+		return;
+	vsize_hdr = data;
+	test_assert_cmp(vsize_hdr->highest_uid + 1, ==, status.uidnext);
+	test_assert_cmp(vsize_hdr->message_count, ==, status.messages);
+	test_assert_cmp(vsize_hdr->vsize, ==, vsize);
+}
+
+static void test_mailbox_vsize_incremental(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct mailbox_metadata metadata;
+	struct mailbox *box;
+	unsigned int i;
+
+	test_begin("mailbox vsize incremental");
+	ctx = test_mail_storage_init();
+	const char *const extra_input[] = {
+		"mail_vsize_incremental=yes",
+		NULL
+	};
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = extra_input,
+	};
+	test_mail_storage_init_user(ctx, &set);
+
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	for (i = 0; i < 3; i++)
+		test_mailbox_vsize_save(box, i);
+	/* build the header initially */
+	test_assert(mailbox_get_metadata(box, MAILBOX_METADATA_VIRTUAL_SIZE,
+					 &metadata) == 0);
+	test_mailbox_vsize_check(box);
+
+	for (i = 0; i < 10; i++) {
+		test_mailbox_vsize_save(box, i * 10);
+		test_mailbox_vsize_check(box);
+		if (i % 3 == 0) {
+			test_mailbox_vsize_expunge(box, 1 + i % 2);
+			test_mailbox_vsize_check(box);
+		}
+	}
+	mailbox_free(&box);
+
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+static void test_mailbox_vsize_rebuild(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct mail_index_transaction *itrans;
+	struct mailbox_index_vsize vsize_hdr;
+	struct mailbox_metadata metadata;
+	struct mailbox *box;
+	const void *data;
+	size_t size;
+	unsigned int i;
+
+	test_begin("mailbox vsize rebuild");
+	ctx = test_mail_storage_init();
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	test_mail_storage_init_user(ctx, &set);
+
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	for (i = 0; i < 3; i++)
+		test_mailbox_vsize_save(box, i);
+	test_assert(mailbox_get_metadata(box, MAILBOX_METADATA_VIRTUAL_SIZE,
+					 &metadata) == 0);
+
+	/* break the header */
+	mail_index_get_header_ext(box->view, box->vsize_hdr_ext_id,
+				  &data, &size);
+	test_assert(size == sizeof(vsize_hdr));
+	memcpy(&vsize_hdr, data, sizeof(vsize_hdr));
+	vsize_hdr.vsize += 100;
+	itrans = mail_index_transaction_begin(box->view,
+				MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header_ext(itrans, box->vsize_hdr_ext_id,
+				     0, &vsize_hdr, sizeof(vsize_hdr));
+	test_assert(mail_index_transaction_commit(&itrans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+	/* the header looks up to date, so it's trusted */
+	test_assert(mailbox_get_metadata(box, MAILBOX_METADATA_VIRTUAL_SIZE,
+					 &metadata) == 0);
+	test_assert(metadata.virtual_size == vsize_hdr.vsize);
+
+	test_assert(index_mailbox_vsize_rebuild(box) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+	test_mailbox_vsize_check(box);
+	mailbox_free(&box);
+
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
 static void test_mail_parse_human_timestamp(void)
 {
 	int ret;
@@ -735,6 +907,8 @@ int main(int argc, char **argv)
 		test_mailbox_verify_name,
 		test_mailbox_list_maildir,
 		test_mailbox_list_mbox,
+		test_mailbox_vsize_incremental,
+		test_mailbox_vsize_rebuild,
 		test_mail_parse_human_timestamp,
 		test_mail_parse_human_timestamp_time_interval,
 		test_mail_parse_human_timestamp_fail,
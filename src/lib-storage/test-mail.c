@@ -3,7 +3,9 @@
 #include "lib.h"
 #include "test-common.h"
 #include "test-dir.h"
+#include "ioloop.h"
 #include "istream.h"
+#include "time-util.h"
 #include "master-service.h"
 #include "message-size.h"
 #include "test-mail-storage-common.h"
@@ -725,6 +727,98 @@ static void test_mail_get_last_internal_error(void)
 	test_mail_storage_deinit(&ctx);
 }
 
+static unsigned int test_list_index_has_changed_count;
+static int (*test_list_index_has_changed_orig)(struct mailbox *box,
+					       struct mail_index_view *list_view,
+					       uint32_t seq, bool quick,
+					       const char **reason_r);
+
+static int
+test_list_index_has_changed(struct mailbox *box,
+			    struct mail_index_view *list_view,
+			    uint32_t seq, bool quick, const char **reason_r)
+{
+	test_list_index_has_changed_count++;
+	return test_list_index_has_changed_orig(box, list_view, seq, quick,
+						reason_r);
+}
+
+static void test_mailbox_list_index_status(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = (const char *const[]) {
+			"mailbox_list_index=yes",
+			NULL
+		},
+	};
+	struct mailbox_status status;
+	struct mailbox_metadata metadata;
+	struct mailbox *box;
+	uoff_t vsize;
+
+	test_begin("mailbox list index status");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	box = mailbox_alloc(ctx->user->namespaces->list, "box1", 0);
+	if (mailbox_create(box, NULL, FALSE) < 0)
+		i_fatal("Failed to create mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	for (unsigned int i = 0; i < 2; i++) {
+		test_mail_save(box,
+			       "From: <test1@example.com>\n"
+			       "Subject: test subject\n"
+			       "\n"
+			       "test body\n");
+	}
+	/* make sure the vsize header is up-to-date in the mailbox index */
+	if (mailbox_get_metadata(box, MAILBOX_METADATA_VIRTUAL_SIZE,
+				 &metadata) < 0)
+		i_fatal("Failed to get vsize: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	vsize = metadata.virtual_size;
+	if (mailbox_sync(box, 0) < 0)
+		i_fatal("Failed to sync mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	mailbox_free(&box);
+
+	/* STATUS and SIZE for LIST-STATUS are both answered from the list
+	   index without opening the mailbox. The mailbox is checked only once
+	   to see whether its list index record is up-to-date. */
+	box = mailbox_alloc(ctx->user->namespaces->list, "box1", 0);
+	test_list_index_has_changed_orig = box->v.list_index_has_changed;
+	box->v.list_index_has_changed = test_list_index_has_changed;
+	test_list_index_has_changed_count = 0;
+	test_assert(mailbox_get_status(box, STATUS_MESSAGES | STATUS_UNSEEN |
+				       STATUS_UIDNEXT | STATUS_HIGHESTMODSEQ,
+				       &status) == 0);
+	test_assert(status.messages == 2);
+	test_assert(status.unseen == 2);
+	test_assert(status.uidnext == 3);
+	test_assert(status.highest_modseq > 0);
+	i_zero(&metadata);
+	test_assert(mailbox_get_metadata(box, MAILBOX_METADATA_VIRTUAL_SIZE,
+					 &metadata) == 0);
+	test_assert(metadata.virtual_size == vsize);
+	test_assert(!box->opened);
+	test_assert(test_list_index_has_changed_count == 1);
+
+	/* the check is done again after returning to ioloop */
+	struct timeval old_ioloop_timeval = ioloop_timeval;
+	while (timeval_cmp(&ioloop_timeval, &old_ioloop_timeval) == 0)
+		io_loop_time_refresh();
+	test_assert(mailbox_get_status(box, STATUS_MESSAGES, &status) == 0);
+	test_assert(status.messages == 2);
+	test_assert(test_list_index_has_changed_count == 2);
+	mailbox_free(&box);
+
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
 int main(int argc, char **argv)
 {
 	void (*const tests[])(void) = {
@@ -735,6 +829,7 @@ int main(int argc, char **argv)
 		test_mail_set_critical,
 		test_mail_set_critical_different_mailboxes,
 		test_mail_get_last_internal_error,
+		test_mailbox_list_index_status,
 		NULL
 	};
 	int ret;
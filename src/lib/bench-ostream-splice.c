@@ -0,0 +1,166 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "net.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "write-full.h"
+#include "istream.h"
+#include "ostream.h"
+#include "iostream-pump.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/**
+ * Simulates a proxy relaying data between two TCP connections the way
+ * login-proxy does after login: a writer process sends data to the proxy,
+ * which pumps it to a reader process. This is done with and without
+ * o_stream_set_splice(). It measures the throughput and the CPU time the
+ * proxy process uses for each GB relayed.
+ */
+
+#define BENCH_BLOCK_SIZE (64*1024)
+
+static void bench_tcp_pair(int fd_r[2])
+{
+	struct ip_addr ip;
+	in_port_t port = 0;
+	int listen_fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	if ((listen_fd = net_listen(&ip, &port, 1)) < 0)
+		i_fatal("listen() failed: %m");
+	if ((fd_r[0] = net_connect_ip_blocking(&ip, port, NULL)) < 0)
+		i_fatal("connect(127.0.0.1:%u) failed: %m", port);
+	if ((fd_r[1] = net_accept(listen_fd, NULL, NULL)) < 0)
+		i_fatal("accept() failed: %m");
+	i_close_fd(&listen_fd);
+}
+
+static pid_t bench_fork(int fd, uoff_t size, bool writer)
+{
+	static unsigned char buf[BENCH_BLOCK_SIZE];
+	ssize_t ret;
+	pid_t pid;
+
+	if ((pid = fork()) < 0)
+		i_fatal("fork() failed: %m");
+	if (pid != 0)
+		return pid;
+
+	while (size > 0) {
+		if (writer) {
+			ret = I_MIN(size, sizeof(buf));
+			if (write_full(fd, buf, ret) < 0)
+				i_fatal("write() failed: %m");
+		} else {
+			if ((ret = read(fd, buf, sizeof(buf))) <= 0)
+				i_fatal("read() failed: %m");
+		}
+		size -= ret;
+	}
+	_exit(0);
+}
+
+static void bench_pump_callback(enum iostream_pump_status status,
+				struct ioloop *ioloop)
+{
+	if (status != IOSTREAM_PUMP_STATUS_INPUT_EOF)
+		i_fatal("iostream pump failed");
+	io_loop_stop(ioloop);
+}
+
+static uint64_t bench_get_cpu_usecs(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		i_fatal("getrusage() failed: %m");
+	return timeval_to_usecs(&usage.ru_utime) +
+		timeval_to_usecs(&usage.ru_stime);
+}
+
+static void bench_ostream_splice(uoff_t size, bool splice)
+{
+	struct ioloop *ioloop;
+	struct istream *input;
+	struct ostream *output;
+	struct iostream_pump *pump;
+	int in_fd[2], out_fd[2];
+	pid_t writer_pid, reader_pid;
+	uint64_t ts_0, ts_1, cpu_0, cpu_1;
+	double gb;
+
+	bench_tcp_pair(in_fd);
+	bench_tcp_pair(out_fd);
+	writer_pid = bench_fork(in_fd[1], size, TRUE);
+	reader_pid = bench_fork(out_fd[1], size, FALSE);
+	i_close_fd(&in_fd[1]);
+	i_close_fd(&out_fd[1]);
+	fd_set_nonblock(in_fd[0], TRUE);
+	fd_set_nonblock(out_fd[0], TRUE);
+
+	ioloop = io_loop_create();
+	input = i_stream_create_fd(in_fd[0], IO_BLOCK_SIZE);
+	output = o_stream_create_fd(out_fd[0], IO_BLOCK_SIZE);
+	o_stream_set_splice(output, splice);
+	pump = iostream_pump_create(input, output);
+	iostream_pump_set_completion_callback(pump, bench_pump_callback,
+					      ioloop);
+
+	ts_0 = i_nanoseconds();
+	cpu_0 = bench_get_cpu_usecs();
+	iostream_pump_start(pump);
+	io_loop_run(ioloop);
+	ts_1 = i_nanoseconds();
+	cpu_1 = bench_get_cpu_usecs();
+	if (output->offset != size)
+		i_fatal("Relayed %"PRIuUOFF_T" bytes instead of %"PRIuUOFF_T,
+			output->offset, size);
+
+	iostream_pump_destroy(&pump);
+	i_stream_destroy(&input);
+	o_stream_destroy(&output);
+	io_loop_destroy(&ioloop);
+	i_close_fd(&in_fd[0]);
+	i_close_fd(&out_fd[0]);
+	(void)waitpid(writer_pid, NULL, 0);
+	(void)waitpid(reader_pid, NULL, 0);
+
+	gb = (double)size / (1024.0*1024*1024);
+	printf("%s\n", splice ? "splice()" : "Userspace copy");
+	printf("\tTime: %0.03lf s (%0.01lf MB/s), CPU: %0.01lf ms/GB\n\n",
+	       (double)(ts_1 - ts_0) / 1000000000.0,
+	       (double)size / (1024*1024) * 1000000000.0 /
+	       (double)(ts_1 - ts_0),
+	       (double)(cpu_1 - cpu_0) / 1000.0 / gb);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<MB>]\n", prog);
+	fprintf(stderr, "Relays 1024 MB if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int mb = 1024;
+
+	lib_init();
+
+	if (argc > 2 || (argc == 2 && (str_to_uint(argv[1], &mb) < 0 ||
+				       mb == 0)))
+		print_usage(argv[0]);
+
+	printf("Relaying %u MB over TCP\n\n", mb);
+	bench_ostream_splice((uoff_t)mb * 1024 * 1024, FALSE);
+	bench_ostream_splice((uoff_t)mb * 1024 * 1024, TRUE);
+
+	lib_deinit();
+}
@@ -2,6 +2,7 @@
 
 /* @UNSAFE: whole file */
 
+#define _GNU_SOURCE /* for splice() */
 #include "lib.h"
 #include "ioloop.h"
 #include "write-full.h"
@@ -29,8 +30,20 @@
 #define MAX_SSIZE_T(size) \
 	((size) < SSIZE_T_MAX ? (size_t)(size) : SSIZE_T_MAX)
 
+/* Maximum number of bytes to move with splice() at a time. This should fit
+   into the pipe's default capacity. If the output can't take it all, the rest
+   is moved to the ostream buffer, which may then exceed max_buffer_size by
+   this much. */
+#define SPLICE_MAX_SIZE (64*1024)
+
 static void stream_send_io(struct file_ostream *fstream);
 
+#ifdef HAVE_SPLICE
+/* The pipe used for splice(). It's always empty when not inside
+   io_stream_splice(), so it can be shared by all the ostreams. */
+static int splice_pipe_fd[2] = { -1, -1 };
+#endif
+
 static void stream_closed(struct file_ostream *fstream)
 {
 	io_remove(&fstream->io);
@@ -864,6 +877,149 @@ io_stream_sendfile(struct ostream_private *outstream,
 	return TRUE;
 }
 
+#ifdef HAVE_SPLICE
+static void splice_pipe_close(void)
+{
+	i_close_fd(&splice_pipe_fd[0]);
+	i_close_fd(&splice_pipe_fd[1]);
+}
+
+static int splice_pipe_init(struct ostream_private *outstream)
+{
+	if (splice_pipe_fd[0] != -1)
+		return 0;
+	if (pipe(splice_pipe_fd) < 0) {
+		i_error("%s: pipe() failed: %m",
+			o_stream_get_name(&outstream->ostream));
+		return -1;
+	}
+	fd_set_nonblock(splice_pipe_fd[0], TRUE);
+	fd_set_nonblock(splice_pipe_fd[1], TRUE);
+	fd_close_on_exec(splice_pipe_fd[0], TRUE);
+	fd_close_on_exec(splice_pipe_fd[1], TRUE);
+	lib_atexit(splice_pipe_close);
+	return 0;
+}
+
+static int
+splice_pipe_drain(struct ostream_private *outstream, size_t size)
+{
+	unsigned char buf[IO_BLOCK_SIZE];
+	struct const_iovec iov;
+	size_t max_buffer_size = outstream->max_buffer_size;
+	ssize_t ret;
+
+	/* The output can't take any more data right now. Move what is left
+	   in the pipe to the ostream buffer, so it gets written with the
+	   rest of the buffered data and the pipe becomes empty again. */
+	outstream->max_buffer_size = I_MAX(max_buffer_size,
+		o_stream_file_get_buffer_used_size(outstream) + size);
+	while (size > 0) {
+		ret = read(splice_pipe_fd[0], buf, I_MIN(size, sizeof(buf)));
+		if (ret <= 0) {
+			if (ret == 0)
+				errno = EPIPE;
+			io_stream_set_error(&outstream->iostream,
+					    "read(splice pipe) failed: %m");
+			outstream->ostream.stream_errno = errno;
+			break;
+		}
+		iov.iov_base = buf;
+		iov.iov_len = ret;
+		if (o_stream_file_sendv(outstream, &iov, 1) < 0)
+			break;
+		size -= ret;
+	}
+	outstream->max_buffer_size = max_buffer_size;
+	if (size > 0) {
+		/* the pipe has unsent data - recreate it */
+		splice_pipe_close();
+		return -1;
+	}
+	return 0;
+}
+
+static bool
+io_stream_splice(struct ostream_private *outstream,
+		 struct istream *instream, int in_fd,
+		 enum ostream_send_istream_result *res_r)
+{
+	struct file_ostream *foutstream =
+		container_of(outstream, struct file_ostream, ostream);
+	size_t pipe_used;
+	ssize_t ret;
+	int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+	if (splice_pipe_init(outstream) < 0)
+		return FALSE;
+
+	o_stream_socket_cork(foutstream);
+
+	/* flush out any data in buffer */
+	if ((ret = buffer_flush(foutstream)) < 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+		return TRUE;
+	} else if (ret == 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+		return TRUE;
+	}
+
+	for (;;) {
+		ret = splice(in_fd, NULL, splice_pipe_fd[1], NULL,
+			     SPLICE_MAX_SIZE, flags);
+		if (ret == 0) {
+			instream->eof = TRUE;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_FINISHED;
+			return TRUE;
+		}
+		if (ret < 0) {
+			if (errno == EAGAIN) {
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT;
+				return TRUE;
+			}
+			if (errno == EINVAL || errno == ENOSYS) {
+				/* splice() not supported with this fd */
+				return FALSE;
+			}
+			io_stream_set_error(&instream->real_stream->iostream,
+					    "splice() failed: %m");
+			instream->stream_errno = errno;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT;
+			return TRUE;
+		}
+		instream->v_offset += ret;
+		instream->real_stream->last_read_timeval = ioloop_timeval;
+
+		for (pipe_used = ret; pipe_used > 0; pipe_used -= ret) {
+			ret = splice(splice_pipe_fd[0], NULL, foutstream->fd,
+				     NULL, pipe_used, flags);
+			if (ret < 0 && errno == EAGAIN) {
+				if (splice_pipe_drain(outstream, pipe_used) < 0)
+					*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+				else
+					*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+				return TRUE;
+			}
+			if (ret <= 0) {
+				if (ret == 0)
+					errno = EPIPE;
+				io_stream_set_error(&outstream->iostream,
+						    "splice() failed: %m");
+				outstream->ostream.stream_errno = errno;
+				stream_closed(foutstream);
+				/* the pipe has unsent data - recreate it */
+				splice_pipe_close();
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+				return TRUE;
+			}
+			foutstream->real_offset += ret;
+			foutstream->buffer_offset += ret;
+			outstream->ostream.offset += ret;
+		}
+	}
+}
+#endif
+
 static enum ostream_send_istream_result
 io_stream_copy_backwards(struct ostream_private *outstream,
 			 struct istream *instream, uoff_t in_size)
@@ -1005,6 +1161,18 @@ o_stream_file_send_istream(struct ostream_private *outstream,
 		   regular sending. */
 		foutstream->no_sendfile = TRUE;
 	}
+#ifdef HAVE_SPLICE
+	if (outstream->splice && !foutstream->file && in_fd != -1 &&
+	    in_fd != foutstream->fd && !instream->seekable &&
+	    !instream->blocking && !outstream->ostream.blocking &&
+	    instream->real_stream->parent == NULL &&
+	    i_stream_get_data_size(instream) == 0) {
+		if (io_stream_splice(outstream, instream, in_fd, &res))
+			return res;
+		/* splice() not supported, fallback to regular sending. */
+		outstream->splice = FALSE;
+	}
+#endif
 
 	same_stream = i_stream_get_fd(instream) == foutstream->fd &&
 		foutstream->fd != -1;
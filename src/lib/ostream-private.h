@@ -50,6 +50,7 @@ struct ostream_private {
 	bool noverflow:1;
 	bool finish_also_parent:1;
 	bool finish_via_child:1;
+	bool splice:1;
 };
 
 struct ostream *
@@ -240,6 +240,12 @@ void o_stream_abort(struct ostream *stream);
    When creating wrapper streams, they copy this behavior from the parent
    stream. */
 void o_stream_set_no_error_handling(struct ostream *stream, bool set);
+/* Allow o_stream_send_istream() to move data with splice() directly from the
+   istream's fd to this stream's fd without copying it via userspace. This is
+   done only when the ostream is a socket fd ostream and the istream is a
+   non-seekable fd istream (e.g. a socket) without any filters or buffered
+   data. Otherwise the data is copied normally. */
+void o_stream_set_splice(struct ostream *stream, bool set);
 /* Send all of the instream to outstream.
 
    On non-failure instream is skips over all data written to outstream.
@@ -1,6 +1,7 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
+#include "ioloop.h"
 #include "net.h"
 #include "str.h"
 #include "randgen.h"
@@ -9,6 +10,7 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/socket.h>
 
 #define MAX_BUFSIZE 256
 
@@ -181,6 +183,71 @@ static void test_ostream_file_send_istream_sendfile(void)
 	test_end();
 }
 
+static void test_ostream_file_send_istream_splice(void)
+{
+	struct ioloop *ioloop;
+	struct istream *input;
+	struct ostream *output;
+	enum ostream_send_istream_result res;
+	unsigned char data[50000], buf[sizeof(data)];
+	size_t write_pos = 0, read_pos = 0;
+	int in_fd[2], out_fd[2], sndbuf = 4096;
+	ssize_t ret;
+
+	test_begin("ostream file send istream splice()");
+	random_fill(data, sizeof(data));
+	ioloop = io_loop_create();
+
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, in_fd) == 0);
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, out_fd) == 0);
+	fd_set_nonblock(in_fd[0], TRUE);
+	fd_set_nonblock(in_fd[1], TRUE);
+	fd_set_nonblock(out_fd[0], TRUE);
+	fd_set_nonblock(out_fd[1], TRUE);
+	/* make sure the output gets full */
+	(void)setsockopt(out_fd[0], SOL_SOCKET, SO_SNDBUF,
+			 &sndbuf, sizeof(sndbuf));
+
+	input = i_stream_create_fd(in_fd[0], 1024);
+	output = o_stream_create_fd(out_fd[0], 1024);
+	o_stream_set_splice(output, TRUE);
+
+	do {
+		if (write_pos < sizeof(data)) {
+			ret = write(in_fd[1], data + write_pos,
+				    sizeof(data) - write_pos);
+			if (ret > 0)
+				write_pos += ret;
+			if (write_pos == sizeof(data))
+				i_close_fd(&in_fd[1]);
+		}
+		res = o_stream_send_istream(output, input);
+		test_assert(res != OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT &&
+			    res != OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT);
+		test_assert(o_stream_flush(output) >= 0);
+		ret = read(out_fd[1], buf + read_pos,
+			   I_MIN(sizeof(buf) - read_pos, 1000));
+		if (ret > 0)
+			read_pos += ret;
+	} while (!test_has_failed() &&
+		 (res != OSTREAM_SEND_ISTREAM_RESULT_FINISHED ||
+		  read_pos < sizeof(data)));
+
+	test_assert(input->eof);
+	test_assert(input->v_offset == sizeof(data));
+	test_assert(output->offset == sizeof(data));
+	test_assert(read_pos == sizeof(data) &&
+		    memcmp(buf, data, sizeof(data)) == 0);
+
+	i_stream_unref(&input);
+	o_stream_destroy(&output);
+	i_close_fd(&in_fd[0]);
+	i_close_fd(&out_fd[0]);
+	i_close_fd(&out_fd[1]);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 static void test_ostream_file_send_over_iov_max(void)
 {
 	test_begin("ostream file send over IOV_MAX");
@@ -219,6 +286,7 @@ void test_ostream_file(void)
 	test_ostream_file_random();
 	test_ostream_file_send_istream_file();
 	test_ostream_file_send_istream_sendfile();
+	test_ostream_file_send_istream_splice();
 	test_ostream_file_send_over_iov_max();
 }
 
@@ -592,6 +592,68 @@ test_word_break_property_line(const char *line, unsigned int line_num)
 	}
 }
 
+static enum unicode_word_break
+test_word_break_from_flags(const struct unicode_code_point_data *cp_data)
+{
+	if (cp_data->pb_b_cr)
+		return UNICODE_WORD_BREAK_CR;
+	if (cp_data->pb_b_lf)
+		return UNICODE_WORD_BREAK_LF;
+	if (cp_data->pb_wb_newline)
+		return UNICODE_WORD_BREAK_NEWLINE;
+	if (cp_data->pb_wb_extend)
+		return UNICODE_WORD_BREAK_EXTEND;
+	if (cp_data->pb_b_zwj)
+		return UNICODE_WORD_BREAK_ZWJ;
+	if (cp_data->pb_b_regional_indicator)
+		return UNICODE_WORD_BREAK_REGIONAL_INDICATOR;
+	if (cp_data->pb_wb_format)
+		return UNICODE_WORD_BREAK_FORMAT;
+	if (cp_data->pb_wb_katakana)
+		return UNICODE_WORD_BREAK_KATAKANA;
+	if (cp_data->pb_wb_hebrew_letter)
+		return UNICODE_WORD_BREAK_HEBREW_LETTER;
+	if (cp_data->pb_wb_aletter)
+		return UNICODE_WORD_BREAK_ALETTER;
+	if (cp_data->pb_wb_single_quote)
+		return UNICODE_WORD_BREAK_SINGLE_QUOTE;
+	if (cp_data->pb_wb_double_quote)
+		return UNICODE_WORD_BREAK_DOUBLE_QUOTE;
+	if (cp_data->pb_wb_midnumlet)
+		return UNICODE_WORD_BREAK_MIDNUMLET;
+	if (cp_data->pb_wb_midletter)
+		return UNICODE_WORD_BREAK_MIDLETTER;
+	if (cp_data->pb_wb_midnum)
+		return UNICODE_WORD_BREAK_MIDNUM;
+	if (cp_data->pb_wb_numeric)
+		return UNICODE_WORD_BREAK_NUMERIC;
+	if (cp_data->pb_wb_extendnumlet)
+		return UNICODE_WORD_BREAK_EXTENDNUMLET;
+	return UNICODE_WORD_BREAK_OTHER;
+}
+
+static void test_word_break_table(void)
+{
+	uint32_t cp;
+
+	/* The Word_Break lookup table must agree with the code point data
+	   for every code point, including the ones not listed in
+	   WordBreakProperty.txt. */
+	test_begin("unicode_data - word break table");
+	for (cp = 0; cp <= 0x10FFFF && !test_has_failed(); cp++) {
+		const struct unicode_code_point_data *cp_data =
+			unicode_code_point_get_data(cp);
+
+		test_assert_idx(unicode_code_point_get_word_break(cp) ==
+				test_word_break_from_flags(cp_data), cp);
+	}
+	test_assert(unicode_code_point_get_word_break(0x110000) ==
+		    UNICODE_WORD_BREAK_OTHER);
+	test_assert(unicode_code_point_get_word_break(0xFFFFFFFF) ==
+		    UNICODE_WORD_BREAK_OTHER);
+	test_end();
+}
+
 static void
 test_ucd_file(const char *filename,
 	      void (*test_line)(const char *line, unsigned int line_num))
@@ -651,4 +713,5 @@ void test_unicode_data(void)
 	test_ucd_file(UCD_UNICODE_DATA_TXT, test_unicode_data_line);
 	test_ucd_file(UCD_WORD_BREAK_PROPERTY_TXT,
 		      test_word_break_property_line);
+	test_word_break_table();
 }
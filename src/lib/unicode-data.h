@@ -24,6 +24,23 @@ unicode_code_point_get_data(uint32_t cp)
 	return &unicode_code_points[idxcp];
 }
 
+/* Returns the Word_Break property value of the code point. This is a
+   cheaper lookup than unicode_code_point_get_data() for callers that only
+   need the word boundary class. */
+static inline enum unicode_word_break
+unicode_code_point_get_word_break(uint32_t cp)
+{
+	if (cp > 0x10FFFF)
+		return UNICODE_WORD_BREAK_OTHER;
+
+	unsigned int blk = unicode_word_break_index[
+		cp >> UNICODE_WORD_BREAK_BLOCK_BITS];
+	unsigned int mask = (1U << UNICODE_WORD_BREAK_BLOCK_BITS) - 1;
+
+	return unicode_word_break_blocks[
+		(blk << UNICODE_WORD_BREAK_BLOCK_BITS) + (cp & mask)];
+}
+
 static inline bool
 unicode_code_point_data_is_assigned(
 	const struct unicode_code_point_data *cp_data)
@@ -45,6 +45,35 @@ ud_compositions_max_per_starter = 0
 ud_case_mappings = []
 ud_case_mapping_max_length = 0
 
+# Word_Break property values used by the tokenizers. Anything else (e.g.
+# WSegSpace) is mapped to Other.
+ud_word_break_names = [
+    "Other",
+    "CR",
+    "LF",
+    "Newline",
+    "Extend",
+    "ZWJ",
+    "Regional_Indicator",
+    "Format",
+    "Katakana",
+    "Hebrew_Letter",
+    "ALetter",
+    "Single_Quote",
+    "Double_Quote",
+    "MidNumLet",
+    "MidLetter",
+    "MidNum",
+    "Numeric",
+    "ExtendNumLet",
+]
+ud_word_break_ranges = []
+# Two-stage lookup table: index by (cp >> bits) to the block number, and the
+# block contains the Word_Break value of each code point in it.
+ud_word_break_block_bits = 7
+ud_word_break_index = []
+ud_word_break_blocks = []
+
 
 class UCDFileOpen:
     def __init__(self, filename):
@@ -732,6 +761,8 @@ def read_ucd_files():
                 continue
 
             prop = cols[1].strip()
+            if prop in ud_word_break_names:
+                ud_word_break_ranges.append((cprng[0], cprng[1], prop))
             if prop == "CR":
                 cpd = CodePointData()
                 cpd.pb_b_cr = True
@@ -1230,6 +1261,28 @@ def create_cp_index_tables():
             update_cp_index_tables(cp_first, cp_last, cpd.default_index)
 
 
+def create_word_break_tables():
+    global ud_word_break_index
+    global ud_word_break_blocks
+
+    values = bytearray(0x110000)
+    for cp_first, cp_last, prop in ud_word_break_ranges:
+        value = ud_word_break_names.index(prop)
+        for cp in range(cp_first, cp_last + 1):
+            values[cp] = value
+
+    block_size = 1 << ud_word_break_block_bits
+    blocks = {}
+    for cp in range(0, len(values), block_size):
+        block = bytes(values[cp : cp + block_size])
+        if block not in blocks:
+            blocks[block] = len(blocks)
+            ud_word_break_blocks.append(block)
+        ud_word_break_index.append(blocks[block])
+    if len(blocks) > 256:
+        die("Too many Word_Break blocks for uint8_t index")
+
+
 def get_general_category_def(gc):
     return "UNICODE_GENERAL_CATEGORY_%s" % gc.upper()
 
@@ -1316,6 +1369,12 @@ def write_tables_h():
         print("")
         print("extern const uint32_t unicode_case_mappings[];")
         print("")
+        print(
+            "#define UNICODE_WORD_BREAK_BLOCK_BITS %u" % ud_word_break_block_bits
+        )
+        print("extern const uint8_t unicode_word_break_index[];")
+        print("extern const uint8_t unicode_word_break_blocks[];")
+        print("")
         print("#endif")
 
     sys.stdout = orig_stdout
@@ -1780,6 +1839,27 @@ def write_tables_c():
         print_list(ud_case_mappings)
         print(",")
         print("};")
+        print("")
+        print("const uint8_t unicode_word_break_index[] = {")
+        for n in range(0, len(ud_word_break_index), 16):
+            print("\t// U+%06X" % (n << ud_word_break_block_bits))
+            print(
+                "\t"
+                + ", ".join(
+                    "0x%02x" % blk for blk in ud_word_break_index[n : n + 16]
+                )
+                + ","
+            )
+        print("};")
+        print("")
+        print("const uint8_t unicode_word_break_blocks[] = {")
+        for blk_id, block in enumerate(ud_word_break_blocks):
+            print("\t// Block 0x%02X" % blk_id)
+            for n in range(0, len(block), 16):
+                print(
+                    "\t" + ", ".join("%u" % value for value in block[n : n + 16]) + ","
+                )
+        print("};")
 
     sys.stdout = orig_stdout
 
@@ -1817,6 +1897,12 @@ def write_types_h():
         print("enum unicode_decomposition_type")
         print("unicode_decomposition_type_from_string(const char *str);")
         print("")
+        print("/* Word_Break */")
+        print("enum unicode_word_break {")
+        for wb in ud_word_break_names:
+            print("\tUNICODE_WORD_BREAK_%s," % wb.upper())
+        print("};")
+        print("")
         print("#endif")
 
     sys.stdout = orig_stdout
@@ -1892,6 +1978,7 @@ def main():
     derive_canonical_compositions()
 
     create_cp_index_tables()
+    create_word_break_tables()
 
     write_tables_h()
     write_tables_c()
@@ -713,6 +713,7 @@ static int proxy_start(struct client *client,
 	proxy_set.host_immediate_failure_after_secs =
 		reply->proxy_host_immediate_failure_after_secs;
 	proxy_set.rawlog_dir = client->set->login_proxy_rawlog_dir;
+	proxy_set.splice = client->set->login_proxy_splice;
 
 	client->proxy_mech = sasl_mech;
 	client->proxy_user = i_strdup(reply->proxy.username);
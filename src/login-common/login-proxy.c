@@ -103,6 +103,7 @@ struct login_proxy {
 	bool disable_reconnect:1;
 	bool anvil_connect_sent:1;
 	bool num_waiting_connections_updated:1;
+	bool splice:1;
 };
 
 static struct login_proxy_state *proxy_state;
@@ -550,6 +551,7 @@ int login_proxy_new(struct client *client, struct event *event,
 		set->host_immediate_failure_after_secs;
 	proxy->ssl_flags = set->ssl_flags;
 	proxy->rawlog_dir = i_strdup_empty(set->rawlog_dir);
+	proxy->splice = set->splice;
 	login_proxy_set_destination(proxy, set->host, &set->ip, set->port);
 
 	/* add event fields */
@@ -1195,6 +1197,14 @@ client_get_alt_usernames(struct client *client,
 
 static void login_proxy_iostream_start(struct login_proxy *proxy)
 {
+	if (proxy->splice) {
+		/* Move the data directly between the client and server fds
+		   with splice(). This is used only where neither side has
+		   any stream layers, such as TLS or rawlog. Otherwise the
+		   data is copied via userspace as usual. */
+		o_stream_set_splice(proxy->client_output, TRUE);
+		o_stream_set_splice(proxy->server_output, TRUE);
+	}
 	proxy->iostream_proxy =
 		iostream_proxy_create(proxy->client_input, proxy->client_output,
 				      proxy->server_input, proxy->server_output);
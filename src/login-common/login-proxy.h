@@ -60,6 +60,8 @@ struct login_proxy_settings {
 	unsigned int host_immediate_failure_after_secs;
 	enum auth_proxy_ssl_flags ssl_flags;
 	const char *rawlog_dir;
+	/* relay plaintext connections with splice() when possible */
+	bool splice;
 };
 
 /* Called when new input comes from proxy. */
@@ -18,6 +18,8 @@ struct login_settings {
 	const char *login_socket_path;
 	const char *ssl; /* for settings check */
 
+	bool login_proxy_splice;
+
 	bool auth_ssl_require_client_cert;
 	bool auth_ssl_username_from_cert;
 
@@ -330,6 +330,35 @@ static void login_load_modules(void)
 	module_dir_init(modules);
 }
 
+static void login_ssl_context_prewarm(const struct ssl_iostream_settings *ssl_set)
+{
+	struct ssl_iostream_context *ssl_ctx;
+	const char *error;
+	int ret;
+
+	/* Load the certificates and keys into the server context cache
+	   already now, so the first TLS handshakes don't have to wait for
+	   it. This is mainly useful together with service
+	   process_min_avail, which keeps login processes pre-forked.
+	   Skip it if the global settings have no certificate, e.g. when it's
+	   configured only inside local_name filters. */
+	if (ssl_set->cert.cert.content == NULL ||
+	    ssl_set->cert.cert.content[0] == '\0' ||
+	    ssl_set->cert.key.content == NULL ||
+	    ssl_set->cert.key.content[0] == '\0')
+		return;
+	ret = ssl_iostream_server_context_cache_get(ssl_set, &ssl_ctx, &error);
+	if (ret < 0) {
+		i_error("%s", error);
+		return;
+	}
+	if (ret > 0 && login_binary->application_protocols != NULL) {
+		ssl_iostream_context_set_application_protocols(ssl_ctx,
+			login_binary->application_protocols);
+	}
+	ssl_iostream_context_unref(&ssl_ctx);
+}
+
 static void login_ssl_init(void)
 {
 	const struct ssl_iostream_settings *ssl_set;
@@ -342,6 +371,7 @@ static void login_ssl_init(void)
 		global_ssl_server_settings, &ssl_set);
 	if (io_stream_ssl_global_init(ssl_set, &error) < 0)
 		i_fatal("Failed to initialize SSL library: %s", error);
+	login_ssl_context_prewarm(ssl_set);
 	settings_free(ssl_set);
 	login_ssl_initialized = TRUE;
 }
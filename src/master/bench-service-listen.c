@@ -0,0 +1,279 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "net.h"
+#include "sleep.h"
+#include "sort.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "write-full.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+/**
+ * Simulates login processes accepting connections from an inet_listener.
+ * A number of worker processes are forked, which accept connections the
+ * way lib-master does: one accept() for each time the listener becomes
+ * readable. First all the workers listen on the same socket, like without
+ * reuse_port. Then each worker has its own SO_REUSEPORT socket, like with
+ * reuse_port = yes. The client connects at a fixed rate and sends its
+ * connect() timestamp. The worker reads it after accepting. This measures
+ * the accept latency distribution, how evenly the connections are spread
+ * between the workers and how many wakeups didn't find a connection.
+ */
+
+#define BENCH_CLIENT_FD_RING_SIZE 1024
+
+struct bench_stats {
+	unsigned int accepted[64];
+	unsigned int wasted_wakeups[64];
+	unsigned int latency_count;
+	/* accept latencies in usecs */
+	unsigned int latencies[];
+};
+
+struct bench_worker {
+	struct bench_stats *stats;
+	unsigned int idx, max_latencies;
+	int listen_fd;
+	struct io *io;
+};
+
+static struct bench_stats *
+bench_stats_alloc(unsigned int max_latencies, size_t *size_r)
+{
+	struct bench_stats *stats;
+
+	*size_r = sizeof(*stats) + sizeof(unsigned int) * max_latencies;
+	stats = mmap(NULL, *size_r, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED)
+		i_fatal("mmap() failed: %m");
+	return stats;
+}
+
+static int bench_listen(bool reuse_port, in_port_t *port)
+{
+	enum net_listen_flags flags =
+		reuse_port ? NET_LISTEN_FLAG_REUSEPORT : 0;
+	struct ip_addr ip;
+	int fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	fd = net_listen_full(&ip, port, &flags, 1024);
+	if (fd < 0)
+		i_fatal("listen() failed: %m");
+	if (reuse_port && (flags & NET_LISTEN_FLAG_REUSEPORT) == 0)
+		i_fatal("SO_REUSEPORT not supported");
+	net_set_nonblock(fd, TRUE);
+	return fd;
+}
+
+static void bench_worker_accept(struct bench_worker *worker)
+{
+	struct bench_stats *stats = worker->stats;
+	uint64_t sent_usecs, now;
+	unsigned int idx;
+	ssize_t ret;
+	int fd;
+
+	fd = net_accept(worker->listen_fd, NULL, NULL);
+	if (fd < 0) {
+		/* another worker got it first */
+		__atomic_fetch_add(&stats->wasted_wakeups[worker->idx], 1,
+				   __ATOMIC_RELAXED);
+		return;
+	}
+	stats->accepted[worker->idx]++;
+
+	/* the timestamp is sent immediately after connect(), so it's
+	   practically always already available */
+	ret = read(fd, &sent_usecs, sizeof(sent_usecs));
+	if (ret == sizeof(sent_usecs)) {
+		now = i_nanoseconds() / 1000;
+		idx = __atomic_fetch_add(&stats->latency_count, 1,
+					 __ATOMIC_RELAXED);
+		if (idx < worker->max_latencies)
+			stats->latencies[idx] = now - sent_usecs;
+	}
+	i_close_fd(&fd);
+}
+
+static pid_t
+bench_worker_fork(struct bench_stats *stats, unsigned int idx,
+		  unsigned int max_latencies, int listen_fd)
+{
+	struct bench_worker worker;
+	struct ioloop *ioloop;
+	pid_t pid;
+
+	if ((pid = fork()) < 0)
+		i_fatal("fork() failed: %m");
+	if (pid != 0)
+		return pid;
+
+	i_zero(&worker);
+	worker.stats = stats;
+	worker.idx = idx;
+	worker.max_latencies = max_latencies;
+	worker.listen_fd = listen_fd;
+
+	ioloop = io_loop_create();
+	worker.io = io_add(listen_fd, IO_READ, bench_worker_accept, &worker);
+	io_loop_run(ioloop);
+	i_unreached();
+}
+
+static void bench_client(in_port_t port, unsigned int rate, unsigned int secs)
+{
+	static const struct linger lin = { .l_onoff = 1, .l_linger = 0 };
+	int fds[BENCH_CLIENT_FD_RING_SIZE];
+	uint64_t start, next, now, usecs;
+	unsigned int i, count = rate * secs;
+	struct ip_addr ip;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	for (i = 0; i < N_ELEMENTS(fds); i++)
+		fds[i] = -1;
+
+	start = i_nanoseconds() / 1000;
+	for (i = 0; i < count; i++) {
+		next = start + (uint64_t)i * 1000000 / rate;
+		now = i_nanoseconds() / 1000;
+		if (next > now + 100)
+			i_sleep_usecs(next - now);
+
+		int *fdp = &fds[i % N_ELEMENTS(fds)];
+		if (*fdp != -1) {
+			/* Reset instead of close to avoid running out of
+			   ports because of TIME_WAIT. */
+			(void)setsockopt(*fdp, SOL_SOCKET, SO_LINGER,
+					 &lin, sizeof(lin));
+			i_close_fd(fdp);
+		}
+		usecs = i_nanoseconds() / 1000;
+		*fdp = net_connect_ip_blocking(&ip, port, NULL);
+		if (*fdp == -1)
+			i_fatal("connect(127.0.0.1:%u) failed: %m", port);
+		if (write_full(*fdp, &usecs, sizeof(usecs)) < 0)
+			i_fatal("write() failed: %m");
+	}
+	/* give the workers time to accept the rest */
+	i_sleep_msecs(500);
+	for (i = 0; i < N_ELEMENTS(fds); i++)
+		i_close_fd(&fds[i]);
+}
+
+static int bench_cmp_uint(const unsigned int *a, const unsigned int *b)
+{
+	return *a < *b ? -1 : (*a > *b ? 1 : 0);
+}
+
+static void
+bench_print_results(struct bench_stats *stats, unsigned int workers,
+		    unsigned int max_latencies)
+{
+	static const double percentiles[] = { 50, 90, 99, 99.9 };
+	unsigned int i, count, accepted = 0, wasted = 0;
+	unsigned int min_accepted = UINT_MAX, max_accepted = 0;
+
+	for (i = 0; i < workers; i++) {
+		accepted += stats->accepted[i];
+		wasted += stats->wasted_wakeups[i];
+		min_accepted = I_MIN(min_accepted, stats->accepted[i]);
+		max_accepted = I_MAX(max_accepted, stats->accepted[i]);
+	}
+	printf("\tAccepted: %u, per worker min %u max %u, "
+	       "wasted wakeups: %u\n",
+	       accepted, min_accepted, max_accepted, wasted);
+
+	count = I_MIN(stats->latency_count, max_latencies);
+	if (count == 0)
+		return;
+	i_qsort(stats->latencies, count, sizeof(stats->latencies[0]),
+		bench_cmp_uint);
+	printf("\tAccept latency:");
+	for (i = 0; i < N_ELEMENTS(percentiles); i++) {
+		printf(" p%g %u us,", percentiles[i],
+		       stats->latencies[(unsigned int)
+					(count * percentiles[i] / 100)]);
+	}
+	printf(" max %u us\n\n", stats->latencies[count - 1]);
+}
+
+static void
+bench_service_listen(bool reuse_port, unsigned int workers,
+		     unsigned int rate, unsigned int secs)
+{
+	struct bench_stats *stats;
+	unsigned int i, max_latencies = rate * secs;
+	in_port_t port = 0;
+	pid_t pids[workers];
+	int fds[workers];
+	size_t size;
+
+	stats = bench_stats_alloc(max_latencies, &size);
+	for (i = 0; i < workers; i++) {
+		if (i == 0 || reuse_port)
+			fds[i] = bench_listen(reuse_port, &port);
+		else
+			fds[i] = fds[0];
+		pids[i] = bench_worker_fork(stats, i, max_latencies, fds[i]);
+	}
+
+	bench_client(port, rate, secs);
+
+	for (i = 0; i < workers; i++) {
+		(void)kill(pids[i], SIGTERM);
+		(void)waitpid(pids[i], NULL, 0);
+		if (i == 0 || reuse_port)
+			i_close_fd(&fds[i]);
+	}
+
+	printf("%s\n", reuse_port ? "Per-process SO_REUSEPORT sockets" :
+	       "Shared listener socket");
+	bench_print_results(stats, workers, max_latencies);
+	if (munmap(stats, size) < 0)
+		i_fatal("munmap() failed: %m");
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<workers> [<connections/sec> [<secs>]]]\n",
+		prog);
+	fprintf(stderr, "Runs 8 workers with 20000 connections/sec for "
+		"3 seconds if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int workers = 8, rate = 20000, secs = 3;
+
+	lib_init();
+
+	if (argc >= 2 && (str_to_uint(argv[1], &workers) < 0 ||
+			  workers == 0 || workers > 64))
+		print_usage(argv[0]);
+	if (argc >= 3 && (str_to_uint(argv[2], &rate) < 0 || rate == 0))
+		print_usage(argv[0]);
+	if (argc >= 4 && (str_to_uint(argv[3], &secs) < 0 || secs == 0))
+		print_usage(argv[0]);
+	if (argc > 4)
+		print_usage(argv[0]);
+
+	printf("%u workers, %u connections/sec for %u secs\n\n",
+	       workers, rate, secs);
+	bench_service_listen(FALSE, workers, rate, secs);
+	bench_service_listen(TRUE, workers, rate, secs);
+
+	lib_deinit();
+}
@@ -9,6 +9,7 @@
 #include "log-error-buffer.h"
 #include "service.h"
 #include "service-process.h"
+#include "service-listen.h"
 #include "service-monitor.h"
 #include "master-client.h"
 
@@ -54,12 +55,26 @@ static void
 master_client_process_output(string_t *str,
 			     const struct service_process *process)
 {
+	struct service_process_listener *pl;
+	unsigned int listen_queue = 0, listen_overflow = 0;
+
+	if (array_is_created(&process->listeners)) {
+		array_foreach_elem(&process->listeners, pl) {
+			if (pl->fd != -1) {
+				listen_queue +=
+					service_listener_get_queue_length(pl->fd);
+			}
+			listen_overflow += pl->overflow_count;
+		}
+	}
+
 	str_append_tabescaped(str, process->service->set->name);
-	str_printfa(str, "\t%lu\t%u\t%u\t%ld\t%ld\t%ld\n",
+	str_printfa(str, "\t%lu\t%u\t%u\t%ld\t%ld\t%ld\t%u\t%u\n",
 		    (unsigned long)process->pid, process->available_count,
 		    process->total_count, (long)process->idle_start,
 		    (long)process->last_status_update,
-		    (long)process->last_kill_sent);
+		    (long)process->last_kill_sent,
+		    listen_queue, listen_overflow);
 }
 
 static void
@@ -359,6 +359,20 @@ static void add_inet_listeners(ARRAY_TYPE(inet_listener_settings) *l,
 	}
 }
 
+static const char *
+service_get_reuse_port_listener(const struct service_settings *service)
+{
+	struct inet_listener_settings *set;
+
+	if (!array_is_created(&service->parsed_inet_listeners))
+		return NULL;
+	array_foreach_elem(&service->parsed_inet_listeners, set) {
+		if (set->reuse_port)
+			return set->name;
+	}
+	return NULL;
+}
+
 static bool master_settings_parse_type(struct service_settings *set,
 				       const char **error_r)
 {
@@ -601,9 +615,10 @@ master_settings_ext_check(struct event *event, void *_set,
 			  pool_t pool, const char **error_r)
 {
 	static bool warned_auth = FALSE, warned_anvil = FALSE;
+	static bool warned_reuse_port = FALSE;
 	struct master_settings *set = _set;
 	struct service_settings *const *services;
-	const char *const *strings, *proto;
+	const char *const *strings, *proto, *listener_name;
 	ARRAY_TYPE(const_string) all_listeners;
 	struct passwd pw;
 	unsigned int i, j, count, client_limit, process_limit;
@@ -747,6 +762,15 @@ master_settings_ext_check(struct event *event, void *_set,
 				service->name);
 			return FALSE;
 		}
+		if (service->client_limit == 1 && !warned_reuse_port &&
+		    (listener_name = service_get_reuse_port_listener(service)) != NULL) {
+			/* Each process handles only one client, so it doesn't
+			   listen for new connections itself. */
+			warned_reuse_port = TRUE;
+			i_warning("service(%s): inet_listener %s { reuse_port=yes } "
+				  "is ignored with client_limit=1",
+				  service->name, listener_name);
+		}
 		if (service->restart_request_count == 0) {
 			*error_r = t_strdup_printf("service(%s): "
 				"restart_request_count must be higher than 0 "
@@ -14,6 +14,8 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #define MIN_BACKLOG 4
 
@@ -198,7 +200,11 @@ service_inet_listener_listen(struct service_listener *l, const char **error_r)
 	if (fd == -1)
 #endif
 	{
-		if (set->reuse_port)
+		/* Per-process sockets are useless when each process handles
+		   only a single client. Connections queued to a busy process's
+		   socket would just have to wait for it to finish. The settings
+		   check warns about this. */
+		if (set->reuse_port && service->client_limit > 1)
 			flags |= NET_LISTEN_FLAG_REUSEPORT;
 		fd = net_listen_full(&l->set.inetset.ip, &port, &flags,
 				     service_get_backlog(service));
@@ -240,6 +246,41 @@ int service_listener_listen(struct service_listener *l)
 	return ret;
 }
 
+int service_listener_listen_process(struct service_listener *l)
+{
+	enum net_listen_flags flags = NET_LISTEN_FLAG_REUSEPORT;
+	in_port_t port = l->set.inetset.set->port;
+	int fd;
+
+	i_assert(l->reuse_port);
+
+	fd = net_listen_full(&l->set.inetset.ip, &port, &flags,
+			     service_get_backlog(l->service));
+	if (fd < 0) {
+		e_error(l->service->event, "listen(%s, %u) failed: %m",
+			l->inet_address, port);
+		return -1;
+	}
+	net_set_nonblock(fd, TRUE);
+	fd_close_on_exec(fd, TRUE);
+	return fd;
+}
+
+unsigned int service_listener_get_queue_length(int fd)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+
+	/* for listening sockets this is the accept queue length */
+	if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0)
+		return info.tcpi_unacked;
+#else
+	(void)fd;
+#endif
+	return 0;
+}
+
 static int service_listen(struct service *service)
 {
 	struct service_listener *l;
@@ -486,6 +527,10 @@ int services_listen_using(struct service_list *new_service_list,
 					    old_listeners[j])) {
 				new_listeners[i]->fd = old_listeners[j]->fd;
                                 old_listeners[j]->fd = -1;
+				new_listeners[i]->reuse_port =
+					old_listeners[j]->reuse_port &&
+					new_listeners[i]->set.inetset.set->reuse_port &&
+					new_listeners[i]->service->client_limit > 1;
 				break;
 			}
 		}
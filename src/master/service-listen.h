@@ -14,6 +14,12 @@ int services_listen_using(struct service_list *new_service_list,
 			  struct service_list *old_service_list);
 
 int service_listener_listen(struct service_listener *l);
+/* Create a new SO_REUSEPORT socket for a reuse_port listener. The socket is
+   used only by a single process. Returns fd or -1 on error. */
+int service_listener_listen_process(struct service_listener *l);
+/* Returns the number of connections waiting to be accepted, or 0 if it's
+   not known. */
+unsigned int service_listener_get_queue_length(int fd);
 
 int service_unix_listener_listen(struct service_listener *l, const char *path,
 				 bool verify_addrinuse, const char **error_r);
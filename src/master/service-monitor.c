@@ -34,6 +34,95 @@ static void service_monitor_start_extra_avail(struct service *service);
 static void service_status_more(struct service_process *process,
 				const struct master_status *status);
 static void service_monitor_listen_start_force(struct service *service);
+static void service_monitor_throttle(struct service *service);
+
+static bool
+service_process_listeners_need_watch(struct service_process *process)
+{
+	struct service *service = process->service;
+
+	return process->available_count == 0 &&
+		SERVICE_PROCESS_IS_INITIALIZED(process) &&
+		service->to_throttle == NULL &&
+		service->process_count < service->process_limit &&
+		service->status_fd[0] != -1 &&
+		!service->list->destroying;
+}
+
+static void service_process_listener_accept(struct service_process_listener *pl)
+{
+	struct service *service = pl->process->service;
+	int fd;
+
+	if (!service_process_listeners_need_watch(pl->process)) {
+		io_remove(&pl->io);
+		return;
+	}
+
+	/* The process isn't accepting new connections, but the kernel still
+	   queues them to its socket. Give them to a new process. */
+	fd = net_accept(pl->fd, NULL, NULL);
+	if (fd < 0) {
+		if (fd == -2 || !NET_ACCEPT_ENOCONN(errno))
+			e_error(service->event, "net_accept() failed: %m");
+		return;
+	}
+	fd_close_on_exec(fd, TRUE);
+	pl->overflow_count++;
+
+	if (service_process_create(service, fd, pl->listener) == NULL)
+		service_monitor_throttle(service);
+	net_disconnect(fd);
+	service_monitor_update_process_listeners(service);
+}
+
+static void service_process_listeners_update(struct service_process *process)
+{
+	struct service_process_listener *pl;
+	bool watch;
+
+	if (!array_is_created(&process->listeners))
+		return;
+
+	watch = service_process_listeners_need_watch(process);
+	array_foreach_elem(&process->listeners, pl) {
+		if (!watch || pl->fd == -1)
+			io_remove(&pl->io);
+		else if (pl->io == NULL) {
+			pl->io = io_add(pl->fd, IO_READ,
+					service_process_listener_accept, pl);
+		}
+	}
+}
+
+void service_monitor_update_process_listeners(struct service *service)
+{
+	struct service_process *process;
+
+	/* processes with no room for new connections are always busy */
+	for (process = service->busy_processes; process != NULL;
+	     process = process->next)
+		service_process_listeners_update(process);
+}
+
+static void service_monitor_start_orphan_listeners(struct service *service)
+{
+	struct service_listener *l;
+
+	if (service->process_count == 0 ||
+	    service->process_count >= service->process_limit)
+		return;
+
+	array_foreach_elem(&service->listeners, l) {
+		if (l->reuse_port && l->fd != -1) {
+			/* An exited process's socket still had connections
+			   waiting in it. Create a process to take it over. */
+			if (service_process_create(service, -1, NULL) == NULL)
+				service_monitor_throttle(service);
+			break;
+		}
+	}
+}
 
 static void service_process_idle_kill_timeout(struct service_process *process)
 {
@@ -237,6 +326,7 @@ service_status_input_one(struct service *service,
 		process->available_count = status->available_count;
 	}
 	service_check_idle(process);
+	service_process_listeners_update(process);
 }
 
 static void service_status_input(struct service *service)
@@ -640,11 +730,22 @@ static void service_monitor_close_dead_pipe(struct service *service)
 	}
 }
 
+static void
+service_processes_list_close_sockets(struct service_process *processes)
+{
+	for (; processes != NULL; processes = processes->next)
+		service_process_close_listeners(processes);
+}
+
 void service_monitor_stop(struct service *service)
 {
 	int i;
 
 	io_remove(&service->io_status);
+	/* the processes close their own sockets when they notice that
+	   they're no longer wanted */
+	service_processes_list_close_sockets(service->busy_processes);
+	service_processes_list_close_sockets(service->idle_processes_head);
 
 	if (service->status_fd[0] != -1 &&
 	    service->type != SERVICE_TYPE_ANVIL) {
@@ -900,6 +1001,8 @@ void services_monitor_reap_children(void)
 		service_stopped = service->status_fd[0] == -1;
 		if (!service_stopped && !service->list->destroying) {
 			service_monitor_start_extra_avail(service);
+			service_monitor_start_orphan_listeners(service);
+			service_monitor_update_process_listeners(service);
 			/* if there are no longer listening processes,
 			   start listening for more */
 			if (service->to_throttle != NULL) {
@@ -14,5 +14,8 @@ void service_monitor_stop(struct service *service);
 void service_monitor_stop_close(struct service *service);
 void service_monitor_listen_start(struct service *service);
 void service_monitor_listen_stop(struct service *service);
+/* Start or stop accepting connections from the reuse_port sockets of
+   processes that have no room for new connections. */
+void service_monitor_update_process_listeners(struct service *service);
 
 #endif
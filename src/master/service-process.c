@@ -34,21 +34,117 @@
 #include <signal.h>
 #include <sys/wait.h>
 
-static void service_reopen_inet_listeners(struct service *service)
+static void
+service_process_listeners_revert(struct service *service, int *fds)
+{
+	struct service_listener *const *listeners;
+	unsigned int i, count;
+
+	/* the process wasn't created - give back the sockets */
+	listeners = array_get(&service->listeners, &count);
+	for (i = 0; i < count; i++) {
+		if (fds[i] == -1)
+			continue;
+		if (listeners[i]->fd == -1)
+			listeners[i]->fd = fds[i];
+		else
+			i_close_fd(&fds[i]);
+	}
+}
+
+static int *service_process_listeners_create(struct service *service)
+{
+	struct service_listener *const *listeners;
+	unsigned int i, count;
+	int *fds;
+
+	listeners = array_get(&service->listeners, &count);
+	fds = t_new(int, count);
+	for (i = 0; i < count; i++) {
+		fds[i] = -1;
+		if (!listeners[i]->reuse_port) {
+			/* shared socket */
+		} else if (listeners[i]->fd != -1) {
+			/* the new process takes over the master's socket,
+			   including any connections already waiting in it */
+			io_remove(&listeners[i]->io);
+			fds[i] = listeners[i]->fd;
+			listeners[i]->fd = -1;
+		} else {
+			fds[i] = service_listener_listen_process(listeners[i]);
+			if (fds[i] == -1) {
+				service_process_listeners_revert(service, fds);
+				return NULL;
+			}
+		}
+	}
+	return fds;
+}
+
+static void
+service_process_listeners_init(struct service_process *process, int *fds)
 {
+	struct service *service = process->service;
 	struct service_listener *const *listeners;
+	struct service_process_listener *pl;
 	unsigned int i, count;
-	int old_fd;
 
 	listeners = array_get(&service->listeners, &count);
 	for (i = 0; i < count; i++) {
-		if (!listeners[i]->reuse_port || listeners[i]->fd == -1)
+		if (fds[i] == -1)
 			continue;
+		if (!array_is_created(&process->listeners))
+			i_array_init(&process->listeners, 2);
+		pl = i_new(struct service_process_listener, 1);
+		pl->process = process;
+		pl->listener = listeners[i];
+		pl->fd = fds[i];
+		array_push_back(&process->listeners, &pl);
+		listeners[i]->process_socket_count++;
+	}
+}
+
+static void service_process_listeners_deinit(struct service_process *process)
+{
+	struct service *service = process->service;
+	struct service_process_listener *pl;
+	struct service_listener *l;
 
-		old_fd = listeners[i]->fd;
-		listeners[i]->fd = -1;
-		if (service_listener_listen(listeners[i]) < 0)
-			listeners[i]->fd = old_fd;
+	if (!array_is_created(&process->listeners))
+		return;
+
+	array_foreach_elem(&process->listeners, pl) {
+		l = pl->listener;
+		io_remove(&pl->io);
+		i_assert(l->process_socket_count > 0);
+		l->process_socket_count--;
+
+		if (pl->fd == -1)
+			; /* already closed */
+		else if (l->fd == -1 && !service->list->destroying &&
+			 (l->process_socket_count == 0 ||
+			  service_listener_get_queue_length(pl->fd) > 0)) {
+			/* Keep the socket, so connections waiting in it aren't
+			   lost. This also keeps the port reserved if it was
+			   the last socket. The next process takes it over. */
+			l->fd = pl->fd;
+		} else {
+			i_close_fd(&pl->fd);
+		}
+		i_free(pl);
+	}
+	array_free(&process->listeners);
+}
+
+void service_process_close_listeners(struct service_process *process)
+{
+	struct service_process_listener *pl;
+
+	if (!array_is_created(&process->listeners))
+		return;
+	array_foreach_elem(&process->listeners, pl) {
+		io_remove(&pl->io);
+		i_close_fd(&pl->fd);
 	}
 }
 
@@ -71,6 +167,7 @@ service_unix_pid_listener_get_path(struct service_listener *l, pid_t pid,
 static void
 service_dup_fds(struct service *service, int accepted_fd,
 		const struct service_listener *accepted_listener,
+		const int *process_listener_fds,
 		int *accepted_listener_fd_r)
 {
 	struct service_listener *const *listeners;
@@ -121,7 +218,10 @@ service_dup_fds(struct service *service, int accepted_fd,
 	/* add listeners */
 	listener_settings = t_str_new(256);
 	for (i = 0; i < count; i++) {
-		if (listeners[i]->fd != -1) {
+		int listener_fd = listeners[i]->reuse_port ?
+			process_listener_fds[i] : listeners[i]->fd;
+
+		if (listener_fd != -1) {
 			str_truncate(listener_settings, 0);
 			str_append_tabescaped(listener_settings, listeners[i]->name);
 
@@ -149,7 +249,7 @@ service_dup_fds(struct service *service, int accepted_fd,
 
 			if (listeners[i] == accepted_listener)
 				*accepted_listener_fd_r = fd;
-			dup2_append(&dups, listeners[i]->fd, fd++);
+			dup2_append(&dups, listener_fd, fd++);
 
 			env_put(t_strdup_printf("SOCKET%d_SETTINGS",
 						socket_listener_count),
@@ -380,6 +480,7 @@ service_process_create(struct service *service, int accepted_fd,
 	struct service_process *process;
 	unsigned int uid = ++uid_counter;
 	const char *hostdomain;
+	int *listener_fds;
 	pid_t pid;
 	bool process_forked;
 
@@ -398,6 +499,9 @@ service_process_create(struct service *service, int accepted_fd,
 	   future lookups. */
 	hostdomain = my_hostdomain();
 
+	if ((listener_fds = service_process_listeners_create(service)) == NULL)
+		return NULL;
+
 	if (service->type == SERVICE_TYPE_ANVIL &&
 	    service_anvil_global->pid != 0) {
 		pid = service_anvil_global->pid;
@@ -421,15 +525,15 @@ service_process_create(struct service *service, int accepted_fd,
 		}
 		errno = fork_errno;
 		e_error(service->event, "fork() failed: %m%s", limit_str);
+		service_process_listeners_revert(service, listener_fds);
 		return NULL;
 	}
 	if (pid == 0) {
 		/* child */
 		int accepted_listener_fd;
 		service_process_setup_environment(service, uid, hostdomain);
-		service_reopen_inet_listeners(service);
 		service_dup_fds(service, accepted_fd, accepted_listener,
-				&accepted_listener_fd);
+				listener_fds, &accepted_listener_fd);
 		if (accepted_fd != -1) {
 			i_assert(accepted_listener_fd > 0);
 			env_put(DOVECOT_ACCEPTED_CLIENT_LISTENER_FD_ENV,
@@ -446,6 +550,7 @@ service_process_create(struct service *service, int accepted_fd,
 	process->pid = pid;
 	process->uid = uid;
 	process->create_time = ioloop_time;
+	service_process_listeners_init(process, listener_fds);
 	if (process_forked) {
 		process->to_status =
 			timeout_add(SERVICE_FIRST_STATUS_TIMEOUT_SECS * 1000,
@@ -461,16 +566,21 @@ service_process_create(struct service *service, int accepted_fd,
 
 	service->process_count_total++;
 	service->process_count++;
-	if (accepted_fd == -1) {
+	if (accepted_fd != -1 && service->client_limit == 1) {
+		/* the pre-accepted client uses up the whole process */
+		DLLIST_PREPEND(&service->busy_processes, process);
+	} else {
+		/* The new process starts idle. With client_limit > 1 a
+		   connection is pre-accepted only when it was queued to the
+		   reuse_port socket of a full process
+		   (service_process_listener_accept()). The process's first
+		   status update then accounts for that client. */
 		process->available_count = service->client_limit;
 		process->idle_start = ioloop_time;
 		service->process_avail++;
 		service->process_idling++;
 		DLLIST2_APPEND(&service->idle_processes_head,
 			       &service->idle_processes_tail, process);
-	} else {
-		i_assert(service->client_limit == 1);
-		DLLIST_PREPEND(&service->busy_processes, process);
 	}
 
 	service_list_ref(service->list);
@@ -488,6 +598,8 @@ void service_process_destroy(struct service_process *process)
 
 	i_assert(!process->destroyed);
 
+	service_process_listeners_deinit(process);
+
 	if (array_is_created(&service->unix_pid_listeners)) {
 		struct service_listener *const *listenerp;
 		string_t *path = t_str_new(128);
@@ -1,6 +1,23 @@
 #ifndef SERVICE_PROCESS_H
 #define SERVICE_PROCESS_H
 
+struct service_process_listener {
+	struct service_process *process;
+	struct service_listener *listener;
+
+	/* Master's copy of the process's own reuse_port socket, or -1 if
+	   it's already closed. The master keeps it so it can take over the
+	   connections queued to it. This costs the master one fd per process
+	   for each reuse_port listener, so with a large process_limit its fd
+	   limit (ulimit -n) must be raised accordingly. */
+	int fd;
+	/* Accepts connections from the socket while the process can't */
+	struct io *io;
+	/* Number of connections the master has accepted from the socket
+	   while the process had no room for them. */
+	unsigned int overflow_count;
+};
+
 struct service_process {
 	struct service_process *prev, *next;
 	struct service *service;
@@ -40,6 +57,9 @@ struct service_process {
 	/* kill the process if it doesn't send initial status notification */
 	struct timeout *to_status;
 
+	/* Process's own sockets for reuse_port listeners */
+	ARRAY(struct service_process_listener *) listeners;
+
 	bool destroyed:1;
 };
 
@@ -51,6 +71,9 @@ service_process_create(struct service *service, int accepted_fd,
 		       const struct service_listener *accepted_listener);
 void service_process_destroy(struct service_process *process);
 
+/* Close the master's copies of the process's own listener sockets. */
+void service_process_close_listeners(struct service_process *process);
+
 void service_process_ref(struct service_process *process);
 void service_process_unref(struct service_process *process);
 
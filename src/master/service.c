@@ -711,6 +711,7 @@ static void service_throttle_timeout(struct service *service)
 {
 	timeout_remove(&service->to_throttle);
 	service_monitor_listen_start(service);
+	service_monitor_update_process_listeners(service);
 }
 
 static void service_drop_listener_connections(struct service *service)
@@ -748,6 +749,7 @@ void service_throttle(struct service *service, unsigned int msecs)
 	service_monitor_listen_stop(service);
 	service->to_throttle = timeout_add(msecs, service_throttle_timeout,
 					   service);
+	service_monitor_update_process_listeners(service);
 }
 
 void services_throttle_time_sensitives(struct service_list *list,
@@ -40,7 +40,11 @@ struct service_listener {
 		} inetset;
 	} set;
 
+	/* Each process gets its own SO_REUSEPORT socket. Then fd is only the
+	   socket that is going to be given to the next created process. */
 	bool reuse_port;
+	/* Number of processes that currently have their own socket */
+	unsigned int process_socket_count;
 };
 
 struct service {
@@ -0,0 +1,189 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "common.h"
+#include "array.h"
+#include "net.h"
+#include "test-common.h"
+#include "service.h"
+#include "service-listen.h"
+
+#include <unistd.h>
+
+uid_t master_uid;
+gid_t master_gid;
+
+struct test_service {
+	struct service_list list;
+	struct service service;
+	struct service_listener listener;
+	struct inet_listener_settings set;
+};
+
+struct service *
+service_lookup_type(struct service_list *service_list ATTR_UNUSED,
+		    enum service_type type ATTR_UNUSED)
+{
+	return NULL;
+}
+
+static void
+test_service_init(struct test_service *ts, unsigned int client_limit,
+		  in_port_t port)
+{
+	struct service *service = &ts->service;
+	struct service_listener *l = &ts->listener;
+
+	i_zero(ts);
+	ts->list.event = event_create(NULL);
+	ts->list.master_fd = -1;
+	t_array_init(&ts->list.services, 1);
+	array_push_back(&ts->list.services, &service);
+
+	service->list = &ts->list;
+	service->event = ts->list.event;
+	service->process_limit = 10;
+	service->client_limit = client_limit;
+	t_array_init(&service->listeners, 1);
+	array_push_back(&service->listeners, &l);
+
+	ts->set.name = "test";
+	ts->set.port = port;
+	ts->set.reuse_port = TRUE;
+	l->service = service;
+	l->type = SERVICE_LISTENER_INET;
+	l->fd = -1;
+	l->name = "test";
+	l->inet_address = "127.0.0.1";
+	l->set.inetset.set = &ts->set;
+	if (net_addr2ip("127.0.0.1", &l->set.inetset.ip) < 0)
+		i_unreached();
+}
+
+static void test_service_deinit(struct test_service *ts)
+{
+	i_close_fd(&ts->listener.fd);
+	i_close_fd(&ts->list.master_fd);
+	event_unref(&ts->list.event);
+}
+
+static void test_service_listen(struct test_service *ts)
+{
+	struct ip_addr ip;
+	in_port_t port;
+
+	/* the master socket isn't needed */
+	ts->list.master_fd = dup(dev_null_fd);
+	test_assert(services_listen(&ts->list) == 1);
+	test_assert(ts->listener.fd != -1);
+
+	if (ts->set.port == 0) {
+		/* the processes' sockets need to use the same port */
+		if (net_getsockname(ts->listener.fd, &ip, &port) < 0)
+			i_fatal("net_getsockname() failed: %m");
+		ts->set.port = port;
+	}
+}
+
+static int test_connect(in_port_t port)
+{
+	struct ip_addr ip;
+	int fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	fd = net_connect_ip_blocking(&ip, port, NULL);
+	if (fd < 0)
+		i_fatal("connect(127.0.0.1:%u) failed: %m", port);
+	return fd;
+}
+
+static void test_service_listen_reuse_port(void)
+{
+	struct test_service ts;
+	int fd[2], client_fd, accepted_fd;
+	unsigned int i;
+
+	test_begin("service listen: reuse_port");
+	test_service_init(&ts, 10, 0);
+	test_service_listen(&ts);
+	test_assert(ts.listener.reuse_port);
+
+	/* each process gets its own socket for the same port */
+	fd[0] = ts.listener.fd;
+	ts.listener.fd = -1;
+	fd[1] = service_listener_listen_process(&ts.listener);
+	test_assert(fd[1] != -1);
+
+	/* the connection is queued to one of the sockets */
+	client_fd = test_connect(ts.set.port);
+#ifdef __linux__
+	test_assert(service_listener_get_queue_length(fd[0]) +
+		    service_listener_get_queue_length(fd[1]) == 1);
+#endif
+	accepted_fd = -1;
+	for (i = 0; i < N_ELEMENTS(fd) && accepted_fd < 0; i++)
+		accepted_fd = net_accept(fd[i], NULL, NULL);
+	test_assert(accepted_fd >= 0);
+	test_assert(service_listener_get_queue_length(fd[0]) == 0);
+	test_assert(service_listener_get_queue_length(fd[1]) == 0);
+
+	if (accepted_fd >= 0)
+		i_close_fd(&accepted_fd);
+	i_close_fd(&client_fd);
+	for (i = 0; i < N_ELEMENTS(fd); i++)
+		i_close_fd(&fd[i]);
+	test_service_deinit(&ts);
+	test_end();
+}
+
+static void test_service_listen_reuse_port_client_limit_1(void)
+{
+	struct test_service ts;
+
+	test_begin("service listen: reuse_port with client_limit=1");
+	test_service_init(&ts, 1, 0);
+	test_service_listen(&ts);
+	/* processes don't listen, so there are no per-process sockets */
+	test_assert(!ts.listener.reuse_port);
+	test_service_deinit(&ts);
+	test_end();
+}
+
+static void test_services_listen_using(void)
+{
+	struct test_service old_ts, new_ts;
+	int old_fd;
+
+	test_begin("service listen: reuse_port after reload");
+	test_service_init(&old_ts, 10, 0);
+	test_service_listen(&old_ts);
+	old_fd = old_ts.listener.fd;
+
+	/* the socket is kept, and so is reuse_port */
+	test_service_init(&new_ts, 10, old_ts.set.port);
+	test_assert(services_listen_using(&new_ts.list, &old_ts.list) == 1);
+	test_assert(new_ts.listener.fd == old_fd);
+	test_assert(old_ts.listener.fd == -1);
+	test_assert(new_ts.listener.reuse_port);
+	test_service_deinit(&old_ts);
+
+	/* reuse_port is dropped when client_limit is changed to 1 */
+	test_service_init(&old_ts, 1, new_ts.set.port);
+	test_assert(services_listen_using(&old_ts.list, &new_ts.list) == 1);
+	test_assert(old_ts.listener.fd == old_fd);
+	test_assert(!old_ts.listener.reuse_port);
+	test_service_deinit(&new_ts);
+	test_service_deinit(&old_ts);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_service_listen_reuse_port,
+		test_service_listen_reuse_port_client_limit_1,
+		test_services_listen_using,
+		NULL
+	};
+	return test_run(test_functions);
+}
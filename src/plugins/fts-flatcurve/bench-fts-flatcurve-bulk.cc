@@ -0,0 +1,179 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+extern "C" {
+#include "lib.h"
+#include "str.h"
+#include "strnum.h"
+#include "hostpid.h"
+#include "time-util.h"
+#include "unlink-directory.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+};
+
+#pragma GCC diagnostic push
+#  ifdef __clang__ // for building xapian's libs from gcc built debian package
+#    pragma GCC diagnostic ignored "-W#warnings"
+#    pragma GCC diagnostic ignored "-Wunused-command-line-argument"
+#  endif
+#  include <xapian.h>
+#pragma GCC diagnostic pop
+
+/**
+ * Measures the messages/sec of bulk indexing with different numbers of
+ * worker processes, the same way "doveadm fts flatcurve index -n" does it:
+ * each worker indexes a contiguous UID range into its own private shard,
+ * and afterwards the shards are compacted into a single index the same
+ * way as flatcurve's optimize does. The messages are generated from
+ * pseudo-random words, and each word is added as a term the same way as
+ * flatcurve does without substring search. The time spent indexing and
+ * merging is reported separately.
+ */
+
+#define BENCH_DEFAULT_MESSAGE_COUNT 20000
+#define BENCH_DEFAULT_WORDS_PER_MESSAGE 200
+#define BENCH_VOCABULARY_SIZE 50000
+
+static const unsigned int worker_counts[] = { 1, 2, 4, 8 };
+
+static unsigned int bench_words_per_message = BENCH_DEFAULT_WORDS_PER_MESSAGE;
+
+static void bench_fill_doc(Xapian::Document &doc, unsigned int uid)
+{
+	/* The same UID always gets the same words, regardless of which
+	   worker indexes it. */
+	uint32_t state = uid * 2654435761U + 1;
+	string_t *word = t_str_new(16);
+
+	for (unsigned int i = 0; i < bench_words_per_message; i++) {
+		state = state * 1103515245U + 12345U;
+		unsigned int n = (state >> 8) % BENCH_VOCABULARY_SIZE;
+
+		str_truncate(word, 0);
+		do {
+			str_append_c(word, 'a' + n % 26);
+			n /= 26;
+		} while (n > 0);
+		str_append(word, "x");
+		doc.add_term(str_c(word));
+	}
+}
+
+static int bench_worker(const char *path, unsigned int uid1,
+			unsigned int uid2)
+{
+	try {
+		Xapian::WritableDatabase db(path, Xapian::DB_CREATE_OR_OPEN);
+		for (unsigned int uid = uid1; uid <= uid2; uid++) T_BEGIN {
+			Xapian::Document doc;
+			bench_fill_doc(doc, uid);
+			db.replace_document(uid, doc);
+		} T_END;
+		db.commit();
+		db.close();
+	} catch (Xapian::Error &e) {
+		i_error("%s: %s", path, e.get_description().c_str());
+		return -1;
+	}
+	return 0;
+}
+
+static void
+bench_bulk_index(const char *dir, unsigned int workers, unsigned int count)
+{
+	const char **paths = t_new(const char *, workers);
+	pid_t *pids = t_new(pid_t, workers);
+	const char *error;
+	unsigned int i;
+	uint64_t ts_0, ts_1, ts_2;
+
+	if (mkdir(dir, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", dir);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < workers; i++) {
+		unsigned int first = 1 + (uint64_t)count * i / workers;
+		unsigned int last = (uint64_t)count * (i + 1) / workers;
+
+		paths[i] = t_strdup_printf("%s/bulk.%s.%u", dir, my_pid, i);
+		pids[i] = fork();
+		if (pids[i] < 0)
+			i_fatal("fork() failed: %m");
+		if (pids[i] == 0)
+			_exit(bench_worker(paths[i], first, last) < 0 ? 1 : 0);
+	}
+	for (i = 0; i < workers; i++) {
+		int status;
+
+		while (waitpid(pids[i], &status, 0) < 0) {
+			if (errno != EINTR)
+				i_fatal("waitpid() failed: %m");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			i_fatal("Worker %u failed (status=%d)", i, status);
+	}
+	ts_1 = i_nanoseconds();
+
+	const char *index_path = t_strdup_printf("%s/index", dir);
+	Xapian::doccount doccount;
+	try {
+		Xapian::Database db;
+		for (i = 0; i < workers; i++)
+			db.add_database(Xapian::Database(paths[i]));
+		db.compact(index_path, Xapian::DBCOMPACT_NO_RENUMBER |
+				       Xapian::DBCOMPACT_MULTIPASS |
+				       Xapian::Compactor::FULLER);
+		db.close();
+		doccount = Xapian::Database(index_path).get_doccount();
+	} catch (Xapian::Error &e) {
+		i_fatal("Merging shards failed: %s",
+			e.get_description().c_str());
+	}
+	ts_2 = i_nanoseconds();
+
+	if (doccount != count)
+		i_fatal("Merged index has %u messages, expected %u",
+			doccount, count);
+	if (unlink_directory(dir, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+		i_fatal("%s", error);
+
+	printf("workers=%-2u %8.0f messages/s (index %llu ms, merge %llu ms)\n",
+	       workers, (double)count * 1000000000.0 / (double)(ts_2 - ts_0),
+	       (unsigned long long)(ts_1 - ts_0) / 1000000,
+	       (unsigned long long)(ts_2 - ts_1) / 1000000);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s <dir> [<message count> "
+		"[<words per message>]]\n", prog);
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int count = BENCH_DEFAULT_MESSAGE_COUNT;
+
+	lib_init();
+
+	if (argc < 2 || argc > 4)
+		print_usage(argv[0]);
+	if (argc >= 3 && (str_to_uint(argv[2], &count) < 0 || count == 0))
+		print_usage(argv[0]);
+	if (argc >= 4 && (str_to_uint(argv[3], &bench_words_per_message) < 0 ||
+			  bench_words_per_message == 0))
+		print_usage(argv[0]);
+
+	printf("Indexing %u messages of %u words to %s\n\n",
+	       count, bench_words_per_message, argv[1]);
+	for (unsigned int i = 0; i < N_ELEMENTS(worker_counts); i++) T_BEGIN {
+		const char *dir = t_strdup_printf("%s/bench-fts-flatcurve.%s",
+						  argv[1], my_pid);
+		bench_bulk_index(dir, I_MIN(worker_counts[i], count), count);
+	} T_END;
+
+	lib_deinit();
+	return 0;
+}
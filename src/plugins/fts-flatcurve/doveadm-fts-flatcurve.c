@@ -2,20 +2,28 @@
  * See the included COPYING file */
 
 #include "lib.h"
+#include "time-util.h"
 #include "doveadm-mail.h"
 #include "doveadm-mailbox-list-iter.h"
 #include "doveadm-print.h"
 #include "doveadm-dump-flatcurve.h"
 #include "mail-search.h"
 #include "str.h"
+#include "fts-api.h"
+#include "fts-build-mail.h"
 #include "fts-backend-flatcurve.h"
 #include "fts-backend-flatcurve-xapian.h"
 
+#include <sys/wait.h>
+
 #define DOVEADM_FLATCURVE_CMD_NAME_CHECK  "fts flatcurve check"
+#define DOVEADM_FLATCURVE_CMD_NAME_INDEX  "fts flatcurve index"
 #define DOVEADM_FLATCURVE_CMD_NAME_REMOVE "fts flatcurve remove"
 #define DOVEADM_FLATCURVE_CMD_NAME_ROTATE "fts flatcurve rotate"
 #define DOVEADM_FLATCURVE_CMD_NAME_STATS  "fts flatcurve stats"
 
+#define DOVEADM_FLATCURVE_INDEX_MAX_WORKERS 256
+
 const char *doveadm_fts_flatcurve_plugin_version = DOVECOT_ABI_VERSION;
 
 void doveadm_fts_flatcurve_plugin_init(struct module *module);
@@ -23,6 +31,7 @@ void doveadm_fts_flatcurve_plugin_deinit(void);
 
 enum fts_flatcurve_cmd_type {
 	FTS_FLATCURVE_CMD_CHECK,
+	FTS_FLATCURVE_CMD_INDEX,
 	FTS_FLATCURVE_CMD_REMOVE,
 	FTS_FLATCURVE_CMD_ROTATE,
 	FTS_FLATCURVE_CMD_STATS
@@ -31,14 +40,221 @@ enum fts_flatcurve_cmd_type {
 struct fts_flatcurve_mailbox_cmd_context {
 	struct doveadm_mail_cmd_context ctx;
 	enum fts_flatcurve_cmd_type cmd_type;
+	unsigned int workers;
 };
 
+struct fts_flatcurve_index_result {
+	unsigned int workers;
+	unsigned int messages;
+	long long msecs;
+};
+
+static int
+cmd_fts_flatcurve_index_worker_box(struct flatcurve_fts_backend *backend,
+				   struct mailbox *box, const char *fname,
+				   uint32_t uid1, uint32_t uid2)
+{
+	struct fts_backend_update_context *update_ctx;
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+	const char *error;
+	uint32_t seq1, seq2;
+	int ret = 0;
+
+	if (mailbox_sync(box, 0) < 0) {
+		e_error(backend->event, "Failed to sync mailbox %s: %s",
+			mailbox_get_vname(box),
+			mailbox_get_last_internal_error(box, NULL));
+		return -1;
+	}
+	mailbox_get_seq_range(box, uid1, uid2, &seq1, &seq2);
+
+	fts_flatcurve_xapian_set_bulk_shard(backend, fname);
+	update_ctx = fts_backend_update_init(&backend->backend);
+	fts_backend_update_set_mailbox(update_ctx, box);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	for (uint32_t seq = seq1; seq <= seq2 && seq != 0 && ret == 0; seq++) {
+		mail_set_seq(mail, seq);
+		if (fts_build_mail(update_ctx, mail) < 0) {
+			e_error(backend->event, "Failed to index UID %u: %s",
+				mail->uid, mailbox_get_last_internal_error(
+					box, NULL));
+			ret = -1;
+		}
+	}
+	mail_free(&mail);
+	mailbox_transaction_rollback(&trans);
+
+	/* Commit the shard here, since closing the mailbox in
+	   fts_backend_update_deinit() doesn't return errors. */
+	if (fts_flatcurve_xapian_close(backend, &error) < 0) {
+		e_error(backend->event, "%s", error);
+		ret = -1;
+	}
+	if (fts_backend_update_deinit(&update_ctx) < 0)
+		ret = -1;
+	return ret;
+}
+
+static int
+cmd_fts_flatcurve_index_worker(struct mail_user *parent_user,
+			       const char *vname, const char *fname,
+			       uint32_t uid1, uint32_t uid2)
+{
+	struct fts_flatcurve_user *fuser;
+	struct mail_namespace *ns;
+	struct mail_user *user;
+	struct mailbox *box;
+	const char *error;
+	int ret;
+
+	/* The parent's mail user and mailbox share their open files, index
+	   mmaps and locks with the parent. Use a user and mailbox of our
+	   own instead. */
+	user = mail_user_dup(parent_user);
+	if (mail_user_init(user, &error) < 0 ||
+	    mail_namespaces_init(user, &error) < 0) {
+		e_error(user->event, "Indexing worker: %s", error);
+		mail_user_deinit(&user);
+		return -1;
+	}
+	fuser = FTS_FLATCURVE_USER_CONTEXT(user);
+	if (fuser == NULL || fuser->backend == NULL) {
+		e_error(user->event, FTS_FLATCURVE_LABEL " not enabled");
+		mail_user_deinit(&user);
+		return -1;
+	}
+
+	ns = mail_namespace_find(user->namespaces, vname);
+	box = mailbox_alloc(ns->list, vname, 0);
+	if (fts_backend_flatcurve_set_mailbox(fuser->backend, box, &error) < 0) {
+		e_error(fuser->backend->event, "%s", error);
+		ret = -1;
+	} else {
+		ret = cmd_fts_flatcurve_index_worker_box(fuser->backend, box,
+							 fname, uid1, uid2);
+		if (fts_backend_flatcurve_close_mailbox(fuser->backend,
+							&error) < 0) {
+			e_error(fuser->backend->event, "%s", error);
+			ret = -1;
+		}
+	}
+	mailbox_free(&box);
+	mail_user_deinit(&user);
+	return ret;
+}
+
+static int
+cmd_fts_flatcurve_index_box(struct flatcurve_fts_backend *backend,
+			    struct fts_flatcurve_mailbox_cmd_context *ctx,
+			    struct mailbox *box,
+			    struct fts_flatcurve_index_result *result_r,
+			    const char **error_r)
+{
+	struct timeval start, end;
+	uint32_t last_uid, seq1, seq2;
+
+	i_zero(result_r);
+	i_gettimeofday(&start);
+
+	if (mailbox_sync(box, 0) < 0) {
+		*error_r = t_strdup_printf("Failed to sync mailbox %s: %s",
+			mailbox_get_vname(box),
+			mailbox_get_last_internal_error(box, NULL));
+		return -1;
+	}
+	if (fts_flatcurve_xapian_get_last_uid(backend, &last_uid, error_r) < 0)
+		return -1;
+	mailbox_get_seq_range(box, last_uid + 1, (uint32_t)-1, &seq1, &seq2);
+	if (seq1 == 0)
+		return 0;
+
+	/* The workers must not inherit any open Xapian databases. */
+	if (fts_flatcurve_xapian_close(backend, error_r) < 0)
+		return -1;
+
+	/* Each worker indexes a contiguous range of the new messages into
+	   its own private shard, so the workers don't contend for the
+	   Xapian write lock. The shards are merged afterwards. */
+	unsigned int count = seq2 - seq1 + 1;
+	unsigned int workers = I_MIN(ctx->workers, count);
+	const char **fnames = t_new(const char *, workers + 1);
+	pid_t *pids = t_new(pid_t, workers);
+	bool failed = FALSE;
+	unsigned int i;
+
+	for (i = 0; i < workers; i++) {
+		uint32_t first = seq1 + (uint64_t)count * i / workers;
+		uint32_t last = seq1 + (uint64_t)count * (i + 1) / workers - 1;
+		ARRAY_TYPE(seq_range) seqs, uids;
+		const struct seq_range *range;
+
+		/* The worker syncs its own view of the mailbox, so give
+		   it UIDs instead of sequences. */
+		t_array_init(&seqs, 1);
+		t_array_init(&uids, 1);
+		seq_range_array_add_range(&seqs, first, last);
+		mailbox_get_uid_range(box, &seqs, &uids);
+		range = array_front(&uids);
+
+		fnames[i] = fts_flatcurve_xapian_bulk_shard_name(i);
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			e_error(backend->event, "fork() failed: %m");
+			failed = TRUE;
+			break;
+		}
+		if (pids[i] == 0) {
+			/* Skip all deinitialization of the inherited state,
+			   since the parent still owns it. */
+			_exit(cmd_fts_flatcurve_index_worker(
+				mailbox_get_namespace(box)->user,
+				mailbox_get_vname(box), fnames[i],
+				range->seq1, range->seq2) < 0 ?
+			      EX_TEMPFAIL : 0);
+		}
+	}
+	for (i = 0; i < workers && pids[i] > 0; i++) {
+		int status;
+
+		while (waitpid(pids[i], &status, 0) < 0) {
+			if (errno != EINTR)
+				i_fatal("waitpid(%s) failed: %m",
+					dec2str(pids[i]));
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			e_error(backend->event,
+				"Indexing worker %u (pid %s) failed "
+				"(status=%d)", i, dec2str(pids[i]), status);
+			failed = TRUE;
+		}
+	}
+
+	if (fts_flatcurve_xapian_bulk_merge(backend, fnames, !failed,
+					    error_r) < 0)
+		return -1;
+	if (failed) {
+		*error_r = t_strdup_printf("Indexing mailbox %s failed",
+					   mailbox_get_vname(box));
+		return -1;
+	}
+
+	i_gettimeofday(&end);
+	result_r->workers = workers;
+	result_r->messages = count;
+	result_r->msecs = timeval_diff_msecs(&end, &start);
+	return 0;
+}
+
 static int
 cmd_fts_flatcurve_mailbox_run_box(struct flatcurve_fts_backend *backend,
 				  struct fts_flatcurve_mailbox_cmd_context *ctx,
 				  struct mailbox *box, const char **error_r)
 {
 	struct fts_flatcurve_xapian_db_check check;
+	struct fts_flatcurve_index_result index;
 	struct fts_flatcurve_xapian_db_stats stats;
 	uint32_t last_uid;
 
@@ -51,6 +267,11 @@ cmd_fts_flatcurve_mailbox_run_box(struct flatcurve_fts_backend *backend,
 		result = check.shards > 0;
 		break;
 	}
+	case FTS_FLATCURVE_CMD_INDEX:
+		ret = cmd_fts_flatcurve_index_box(
+			backend, ctx, box, &index, error_r);
+		result = TRUE;
+		break;
 	case FTS_FLATCURVE_CMD_REMOVE:
 		ret = fts_backend_flatcurve_delete_dir(str_c(
 			backend->db_path), error_r);
@@ -89,6 +310,13 @@ cmd_fts_flatcurve_mailbox_run_box(struct flatcurve_fts_backend *backend,
 		doveadm_print_num(check.errors);
 		doveadm_print_num(check.shards);
 		break;
+	case FTS_FLATCURVE_CMD_INDEX:
+		doveadm_print_num(index.workers);
+		doveadm_print_num(index.messages);
+		doveadm_print_num(index.msecs);
+		doveadm_print_num(index.msecs == 0 ? index.messages :
+				  index.messages * 1000ULL / index.msecs);
+		break;
 	case FTS_FLATCURVE_CMD_STATS:
 		doveadm_print_num(last_uid);
 		doveadm_print_num(stats.messages);
@@ -177,6 +405,9 @@ cmd_fts_flatcurve_mailbox_init(struct doveadm_mail_cmd_context *_ctx)
 		case FTS_FLATCURVE_CMD_CHECK:
 			doveadm_mail_help_name(DOVEADM_FLATCURVE_CMD_NAME_CHECK);
 			break;
+		case FTS_FLATCURVE_CMD_INDEX:
+			doveadm_mail_help_name(DOVEADM_FLATCURVE_CMD_NAME_INDEX);
+			break;
 		case FTS_FLATCURVE_CMD_REMOVE:
 			doveadm_mail_help_name(DOVEADM_FLATCURVE_CMD_NAME_REMOVE);
 			break;
@@ -193,6 +424,18 @@ cmd_fts_flatcurve_mailbox_init(struct doveadm_mail_cmd_context *_ctx)
 
 	_ctx->search_args = doveadm_mail_mailbox_search_args_build(args);
 
+	if (ctx->cmd_type == FTS_FLATCURVE_CMD_INDEX) {
+		int64_t workers = 1;
+		(void)doveadm_cmd_param_int64(cctx, "workers", &workers);
+		if (workers == 0 ||
+		    workers > DOVEADM_FLATCURVE_INDEX_MAX_WORKERS) {
+			i_fatal_status(EX_USAGE,
+				       "Invalid workers count (1..%u)",
+				       DOVEADM_FLATCURVE_INDEX_MAX_WORKERS);
+		}
+		ctx->workers = workers;
+	}
+
 	doveadm_print_header("mailbox", "mailbox",
 			     DOVEADM_PRINT_HEADER_FLAG_HIDE_TITLE);
 	doveadm_print_header_simple("guid");
@@ -202,6 +445,12 @@ cmd_fts_flatcurve_mailbox_init(struct doveadm_mail_cmd_context *_ctx)
 		doveadm_print_header_simple("errors");
 		doveadm_print_header_simple("shards");
 		break;
+	case FTS_FLATCURVE_CMD_INDEX:
+		doveadm_print_header_simple("workers");
+		doveadm_print_header_simple("messages");
+		doveadm_print_header_simple("msecs");
+		doveadm_print_header_simple("messages_per_sec");
+		break;
 	case FTS_FLATCURVE_CMD_STATS:
 		doveadm_print_header_simple("last_uid");
 		doveadm_print_header_simple("messages");
@@ -241,6 +490,11 @@ static struct doveadm_mail_cmd_context *cmd_fts_flatcurve_check_alloc(void)
 	return cmd_fts_flatcurve_mailbox_alloc(FTS_FLATCURVE_CMD_CHECK);
 }
 
+static struct doveadm_mail_cmd_context *cmd_fts_flatcurve_index_alloc(void)
+{
+	return cmd_fts_flatcurve_mailbox_alloc(FTS_FLATCURVE_CMD_INDEX);
+}
+
 static struct doveadm_mail_cmd_context *cmd_fts_flatcurve_remove_alloc(void)
 {
 	return cmd_fts_flatcurve_mailbox_alloc(FTS_FLATCURVE_CMD_REMOVE);
@@ -264,6 +518,16 @@ static struct doveadm_cmd_ver2 fts_flatcurve_commands[] = {
 DOVEADM_CMD_PARAMS_START
 DOVEADM_CMD_MAIL_COMMON
 DOVEADM_CMD_PARAM('\0', "mailbox-mask", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
+DOVEADM_CMD_PARAMS_END
+	},
+	{
+		.name = DOVEADM_FLATCURVE_CMD_NAME_INDEX,
+		.usage = DOVEADM_CMD_MAIL_USAGE_PREFIX "[-n <workers>] <mailbox query>",
+		.mail_cmd = cmd_fts_flatcurve_index_alloc,
+DOVEADM_CMD_PARAMS_START
+DOVEADM_CMD_MAIL_COMMON
+DOVEADM_CMD_PARAM('n', "workers", CMD_PARAM_INT64, CMD_PARAM_FLAG_UNSIGNED)
+DOVEADM_CMD_PARAM('\0', "mailbox-mask", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
 	},
 	{
@@ -7,18 +7,23 @@ extern "C" {
 #include "file-create-locked.h"
 #include "hash.h"
 #include "hex-binary.h"
+#include "hostpid.h"
+#include "ioloop.h"
 #include "message-header-parser.h"
 #include "path-util.h"
 #include "mail-storage-private.h"
 #include "mail-search.h"
 #include "md5.h"
+#include "sha2.h"
 #include "sleep.h"
 #include "str.h"
+#include "strnum.h"
 #include "unichar.h"
 #include "time-util.h"
 #include "fts-backend-flatcurve.h"
 #include "fts-backend-flatcurve-xapian.h"
 #include <dirent.h>
+#include <signal.h>
 };
 #include <cstdio>
 
@@ -75,6 +80,10 @@ extern "C" {
 /* These are temporary data types that may appear in the fts directory. They
  * are not intended to persist between sessions. */
 #define FLATCURVE_XAPIAN_DB_OPTIMIZE "optimize"
+/* Private shards written by bulk indexing workers. They are ignored by
+ * readers and other writers until fts_flatcurve_xapian_bulk_merge() renames
+ * them to regular index shards. */
+#define FLATCURVE_XAPIAN_DB_BULK_PREFIX "bulk."
 
 /* Xapian "recommendations" are that you begin your local prefix identifier
  * with "X" for data that doesn't match with a data type listed as a Xapian
@@ -121,6 +130,7 @@ enum flatcurve_xapian_db_type {
 	FLATCURVE_XAPIAN_DB_TYPE_INDEX,
 	FLATCURVE_XAPIAN_DB_TYPE_CURRENT,
 	FLATCURVE_XAPIAN_DB_TYPE_OPTIMIZE,
+	FLATCURVE_XAPIAN_DB_TYPE_BULK,
 	FLATCURVE_XAPIAN_DB_TYPE_LOCK,
 	FLATCURVE_XAPIAN_DB_TYPE_UNKNOWN
 };
@@ -150,6 +160,11 @@ struct flatcurve_xapian {
 	 * lived data (e.g. optimize). */
 	pool_t pool;
 
+	/* Bulk indexing shard name; if set, all new documents are written
+	 * to this private shard instead of the current shard. Allocated
+	 * from the backend pool, since it outlives mailbox switches. */
+	const char *bulk_fname;
+
 	/* Current document. */
 	Xapian::Document *doc;
 	uint32_t doc_uid;
@@ -370,6 +385,8 @@ fts_flatcurve_xapian_db_iter_next(struct flatcurve_xapian_db_iter *iter)
 		iter->type = FLATCURVE_XAPIAN_DB_TYPE_CURRENT;
 	else if (strcmp(dir->d_name, FLATCURVE_XAPIAN_DB_OPTIMIZE) == 0)
 		iter->type = FLATCURVE_XAPIAN_DB_TYPE_OPTIMIZE;
+	else if (str_begins_with(dir->d_name, FLATCURVE_XAPIAN_DB_BULK_PREFIX))
+		iter->type = FLATCURVE_XAPIAN_DB_TYPE_BULK;
 
 	return TRUE;
 }
@@ -460,7 +477,8 @@ fts_flatcurve_xapian_write_db_get(struct flatcurve_fts_backend *backend,
 		backend, xdb, db_flags, error_r) < 0)
 		return -1;
 
-	if (xdb->type == FLATCURVE_XAPIAN_DB_TYPE_CURRENT &&
+	if ((xdb->type == FLATCURVE_XAPIAN_DB_TYPE_CURRENT ||
+	     xdb->type == FLATCURVE_XAPIAN_DB_TYPE_BULK) &&
 	    fts_flatcurve_xapian_check_db_version(backend, xdb, error_r) < 0)
 		return -1;
 
@@ -698,6 +716,40 @@ fts_flatcurve_xapian_create_current(struct flatcurve_fts_backend *backend,
 	return fts_flatcurve_xapian_close_db(backend, xdb, copts, error_r);
 }
 
+/* Bulk shards are named "bulk.<hostname>.<pid>.<worker>", where hostname
+ * and pid identify the process that merges them. If that process no longer
+ * exists, the shards were never merged and are deleted. Shards of other
+ * hosts are left alone, since there's no way to check their processes. */
+static void
+fts_flatcurve_xapian_bulk_delete_stale(struct flatcurve_fts_backend *backend,
+				       struct flatcurve_xapian_db_path *dbpath)
+{
+	const char *host, *p, *pidstr, *error;
+	pid_t pid;
+
+	if (!str_begins(dbpath->fname, FLATCURVE_XAPIAN_DB_BULK_PREFIX,
+			&host) ||
+	    (p = strrchr(host, '.')) == NULL)
+		return;
+	/* the hostname may contain dots, so parse from the end */
+	pidstr = t_strdup_until(host, p);
+	if ((p = strrchr(pidstr, '.')) == NULL ||
+	    str_to_pid(p + 1, &pid) < 0)
+		return;
+	host = t_strdup_until(pidstr, p);
+	if (strcmp(host, my_hostname) != 0)
+		return;
+	if (pid == getpid() || kill(pid, 0) == 0 || errno != ESRCH)
+		return;
+
+	if (fts_flatcurve_xapian_delete(backend, dbpath, &error) < 0)
+		e_error(backend->event, "%s", error);
+	else {
+		e_debug(backend->event, "Deleted stale bulk shard %s",
+			dbpath->fname);
+	}
+}
+
 /* Returns: 0 on success, -1 on error */
 static int
 fts_flatcurve_xapian_db_populate(struct flatcurve_fts_backend *backend,
@@ -746,6 +798,16 @@ fts_flatcurve_xapian_db_populate(struct flatcurve_fts_backend *backend,
 		const char *error, *last_error = NULL;
 		iter = fts_flatcurve_xapian_db_iter_init(backend, opts);
 		while (fts_flatcurve_xapian_db_iter_next(iter)) {
+			if (iter->type == FLATCURVE_XAPIAN_DB_TYPE_BULK) {
+				/* Shards left behind by a bulk indexing
+				 * process that died can be deleted only
+				 * while holding the lock. */
+				if (lock) {
+					fts_flatcurve_xapian_bulk_delete_stale(
+						backend, iter->path);
+				}
+				continue;
+			}
 			if (fts_flatcurve_xapian_db_add(
 				backend, iter->path, iter->type,
 				FALSE, NULL, &last_error) < 0)
@@ -779,6 +841,45 @@ fts_flatcurve_xapian_db_populate(struct flatcurve_fts_backend *backend,
 	return ret;
 }
 
+/* Returns: 1 on success, -1 on error */
+static int
+fts_flatcurve_xapian_write_db_bulk(struct flatcurve_fts_backend *backend,
+				   struct flatcurve_xapian_db **dbw_bulk_r,
+				   const char **error_r)
+{
+	struct flatcurve_xapian *x = backend->xapian;
+
+	if (x->dbw_current == NULL) {
+		if (mailbox_list_mkdir_root(
+				backend->backend.ns->list,
+				str_c(backend->db_path),
+				MAILBOX_LIST_PATH_TYPE_INDEX) < 0) {
+			*error_r = t_strdup_printf(
+				"Cannot create DB (RW); %s",
+				str_c(backend->db_path));
+			return -1;
+		}
+
+		/* The bulk shard is private to this process, so there is
+		 * no need to look at (or lock) any of the other shards. */
+		struct flatcurve_xapian_db *xdb =
+			p_new(x->pool, struct flatcurve_xapian_db, 1);
+		xdb->dbpath = fts_flatcurve_xapian_create_db_path(
+			backend, x->bulk_fname);
+		xdb->type = FLATCURVE_XAPIAN_DB_TYPE_BULK;
+		hash_table_insert(x->dbs, xdb->dbpath->fname, xdb);
+		x->dbw_current = xdb;
+	}
+
+	if (fts_flatcurve_xapian_write_db_get(
+		backend, x->dbw_current, FLATCURVE_XAPIAN_WDB_CREATE,
+		error_r) < 0)
+		return -1;
+
+	if (dbw_bulk_r != NULL) *dbw_bulk_r = x->dbw_current;
+	return 1;
+}
+
 /* Returns: 0 if dbw_current == NULL, 1 dbw_current != NULL, -1 on error */
 static int
 fts_flatcurve_xapian_write_db_current(struct flatcurve_fts_backend *backend,
@@ -796,6 +897,10 @@ fts_flatcurve_xapian_write_db_current(struct flatcurve_fts_backend *backend,
 		return 1;
 	}
 
+	if (x->bulk_fname != NULL)
+		return fts_flatcurve_xapian_write_db_bulk(
+			backend, dbw_current_r, error_r);
+
 	opts = (enum flatcurve_xapian_db_opts)
 		(opts | FLATCURVE_XAPIAN_DB_NOCLOSE_CURRENT);
 	/* dbw_current can be NULL if FLATCURVE_XAPIAN_DB_NOCREATE_CURRENT
@@ -1551,6 +1656,78 @@ fts_flatcurve_xapian_get_last_uid_query(struct flatcurve_fts_backend *backend AT
 		? 0 : m.begin().get_document().get_docid();
 }
 
+/* Returns: 0 if revision is unknown, 1 if it was set, -1 on error */
+int fts_flatcurve_xapian_get_revision(struct flatcurve_fts_backend *backend,
+				      uint64_t *revision_r,
+				      const char **error_r)
+{
+	DIR *dirp = opendir(str_c(backend->db_path));
+	if (dirp == NULL) {
+		if (errno == ENOENT)
+			return 0;
+		*error_r = t_strdup_printf("opendir(%s) failed: %m",
+					   str_c(backend->db_path));
+		return -1;
+	}
+
+	/* Xapian commits replace the version file of the shard, which
+	 * updates the shard directory's mtime. Shards being added, removed
+	 * or renamed change the set of names. The per-shard values are
+	 * summed, so the readdir() order doesn't matter. */
+	uint64_t revision = 0;
+	unsigned int shards = 0;
+	int ret = 1;
+	struct dirent *d;
+	errno = 0;
+	while (ret > 0 && (d = readdir(dirp)) != NULL) {
+		if (!str_begins_with(d->d_name, FLATCURVE_XAPIAN_DB_PREFIX) &&
+		    !str_begins_with(d->d_name,
+				     FLATCURVE_XAPIAN_DB_CURRENT_PREFIX))
+			continue;
+
+		struct stat st;
+		const char *path = t_strconcat(str_c(backend->db_path),
+					       d->d_name, NULL);
+		if (stat(path, &st) < 0) {
+			if (errno == ENOENT) {
+				/* Renamed or deleted just now. */
+				ret = 0;
+				break;
+			}
+			*error_r = t_strdup_printf("stat(%s) failed: %m", path);
+			ret = -1;
+			break;
+		}
+		/* A second commit within the same mtime granularity
+		 * wouldn't be noticed. */
+		if (st.st_mtime >= ioloop_time - 1) {
+			ret = 0;
+			break;
+		}
+		revision += (str_hash(d->d_name) ^
+			     ((uint64_t)st.st_ino << 32)) +
+			    (uint64_t)st.st_mtime * 1000000000ULL +
+			    ST_MTIME_NSEC(st);
+		shards++;
+		errno = 0;
+	}
+	if (ret > 0 && errno != 0) {
+		*error_r = t_strdup_printf("readdir(%s) failed: %m",
+					   str_c(backend->db_path));
+		ret = -1;
+	}
+	if (closedir(dirp) < 0 && ret >= 0) {
+		*error_r = t_strdup_printf("closedir(%s) failed: %m",
+					   str_c(backend->db_path));
+		ret = -1;
+	}
+	if (ret > 0 && shards == 0)
+		ret = 0;
+	if (ret > 0)
+		*revision_r = revision + shards;
+	return ret;
+}
+
 /* Returns: 0 on success, -1 on error */
 int fts_flatcurve_xapian_get_last_uid(struct flatcurve_fts_backend *backend,
 				      uint32_t *last_uid_r, const char **error_r)
@@ -1986,6 +2163,84 @@ int fts_flatcurve_xapian_optimize_box(struct flatcurve_fts_backend *backend,
 	return ret;
 }
 
+void fts_flatcurve_xapian_set_bulk_shard(struct flatcurve_fts_backend *backend,
+					 const char *fname)
+{
+	struct flatcurve_xapian *x = backend->xapian;
+
+	i_assert(x->dbw_current == NULL);
+	i_assert(fname == NULL ||
+		 str_begins_with(fname, FLATCURVE_XAPIAN_DB_BULK_PREFIX));
+
+	x->bulk_fname = p_strdup(backend->pool, fname);
+}
+
+const char *
+fts_flatcurve_xapian_bulk_shard_name(unsigned int worker)
+{
+	return t_strdup_printf(FLATCURVE_XAPIAN_DB_BULK_PREFIX "%s.%s.%u",
+			       my_hostname, my_pid, worker);
+}
+
+/* Returns: 0 on success, -1 on error */
+int fts_flatcurve_xapian_bulk_merge(struct flatcurve_fts_backend *backend,
+				    const char *const *fnames, bool commit,
+				    const char **error_r)
+{
+	if (fts_flatcurve_xapian_close(backend, error_r) < 0)
+		return -1;
+
+	bool locked = FALSE;
+	if (commit) {
+		if (fts_flatcurve_xapian_lock(backend, error_r) < 0)
+			return -1;
+		locked = TRUE;
+	}
+
+	const char *error;
+	int ret = 0;
+	for (; *fnames != NULL; fnames++) {
+		struct flatcurve_xapian_db_path *dbpath =
+			fts_flatcurve_xapian_create_db_path(backend, *fnames);
+
+		if (commit) {
+			struct stat st;
+			if (stat(dbpath->path, &st) < 0) {
+				/* Worker had nothing to index. */
+				if (errno == ENOENT)
+					continue;
+				error = t_strdup_printf("stat(%s) failed: %m",
+							dbpath->path);
+			} else if (fts_flatcurve_xapian_rename_db(
+					backend, dbpath, NULL, &error) == 0) {
+				continue;
+			}
+			/* The shards are given in UID order. Keep the ones
+			 * already renamed and drop the rest, so that there
+			 * are no unindexed UIDs below the last indexed UID. */
+			if (ret < 0)
+				e_error(backend->event, "%s", *error_r);
+			*error_r = error;
+			commit = FALSE;
+			ret = -1;
+		}
+		if (fts_flatcurve_xapian_delete(backend, dbpath, &error) < 0) {
+			if (ret < 0)
+				e_error(backend->event, "%s", *error_r);
+			*error_r = error;
+			ret = -1;
+		}
+	}
+	if (locked)
+		fts_flatcurve_xapian_unlock(backend);
+	if (ret < 0 || !commit)
+		return ret;
+
+	/* Merge the new shards into the existing ones with Xapian's
+	 * compact. */
+	return fts_flatcurve_xapian_optimize_box(backend, error_r);
+}
+
 static void
 fts_flatcurve_build_query_arg_term(struct flatcurve_fts_query *query,
 				   struct mail_search_arg *arg,
@@ -2327,6 +2582,52 @@ int fts_flatcurve_xapian_run_query(struct flatcurve_fts_query *query,
 	return fts_flatcurve_xapian_query_iter_deinit(&iter, error_r);
 }
 
+static void
+fts_flatcurve_xapian_query_cache_key_add(struct sha256_ctx *ctx,
+					 const Xapian::Query *query)
+{
+	std::string s = query->serialise();
+	const char *len = t_strdup_printf("%zu:", s.size());
+
+	sha256_loop(ctx, len, strlen(len));
+	sha256_loop(ctx, s.data(), s.size());
+}
+
+const char *
+fts_flatcurve_xapian_query_cache_key(struct flatcurve_fts_query *query)
+{
+	struct flatcurve_fts_query_xapian *x = query->xapian;
+	struct flatcurve_fts_query_xapian_maybe *mquery;
+	struct sha256_ctx ctx;
+	unsigned char digest[SHA256_RESULTLEN];
+	const char *flags;
+
+	if (x->query == NULL)
+		return NULL;
+
+	/* The serialised Xapian queries are the canonical form of the
+	 * parsed query. The flags decide how their matches are returned. */
+	sha256_init(&ctx);
+	flags = t_strdup_printf("%d:%d:%d:", query->flags,
+				x->and_search ? 1 : 0, x->maybe ? 1 : 0);
+	sha256_loop(&ctx, flags, strlen(flags));
+	try {
+		fts_flatcurve_xapian_query_cache_key_add(&ctx, x->query);
+		if (array_is_created(&x->maybe_queries)) {
+			array_foreach_modifiable(&x->maybe_queries, mquery)
+				fts_flatcurve_xapian_query_cache_key_add(
+					&ctx, mquery->query);
+		}
+	} catch (Xapian::Error &e) {
+		e_debug(query->backend->event,
+			"Query can't be cached: %s",
+			e.get_description().c_str());
+		return NULL;
+	}
+	sha256_result(&ctx, digest);
+	return binary_to_hex(digest, sizeof(digest));
+}
+
 void fts_flatcurve_xapian_destroy_query(struct flatcurve_fts_query *query)
 {
 	delete(query->xapian->query);
@@ -33,6 +33,13 @@ int fts_flatcurve_xapian_close(struct flatcurve_fts_backend *backend,
 			       const char **error_r);
 void fts_flatcurve_xapian_deinit(struct flatcurve_fts_backend *backend);
 
+/* Returns a value that changes whenever any shard of the mailbox is
+   committed to. Returns 0 if the index doesn't exist or if it was modified
+   so recently that further changes can't be reliably detected, 1 if
+   revision_r was set, -1 on error. */
+int fts_flatcurve_xapian_get_revision(struct flatcurve_fts_backend *backend,
+				      uint64_t *revision_r,
+				      const char **error_r);
 int fts_flatcurve_xapian_get_last_uid(struct flatcurve_fts_backend *backend,
 				      uint32_t *last_uid_r, const char **error_r);
 /* Return -1 if DB doesn't exist, 0 if UID doesn't exist, 1 if UID exists */
@@ -59,10 +66,31 @@ void fts_flatcurve_xapian_build_query(struct flatcurve_fts_query *query);
 int fts_flatcurve_xapian_run_query(struct flatcurve_fts_query *query,
 				   struct flatcurve_fts_result *r,
 				   const char **error_r);
+/* Returns a key for the query's results in the query cache, or NULL if the
+   query can't be cached. */
+const char *
+fts_flatcurve_xapian_query_cache_key(struct flatcurve_fts_query *query);
 void fts_flatcurve_xapian_destroy_query(struct flatcurve_fts_query *query);
 int fts_flatcurve_xapian_delete_index(struct flatcurve_fts_backend *backend,
 				      const char **error_r);
 
+/* Write all new documents of this process into the given private bulk
+   shard instead of the shared current shard. Must be called before anything
+   is written to the mailbox. fname must come from
+   fts_flatcurve_xapian_bulk_shard_name(). */
+void fts_flatcurve_xapian_set_bulk_shard(struct flatcurve_fts_backend *backend,
+					 const char *fname);
+/* Returns the bulk shard name for the given worker of this process. */
+const char *
+fts_flatcurve_xapian_bulk_shard_name(unsigned int worker);
+/* Make the bulk shards (given in ascending UID order) visible as regular
+   index shards and compact them together with the existing shards. If
+   commit is FALSE, the bulk shards are just deleted.
+   Returns: 0 on success, -1 on error */
+int fts_flatcurve_xapian_bulk_merge(struct flatcurve_fts_backend *backend,
+				    const char *const *fnames, bool commit,
+				    const char **error_r);
+
 struct fts_flatcurve_xapian_query_iter *
 fts_flatcurve_xapian_query_iter_init(struct flatcurve_fts_query *query);
 bool
@@ -12,6 +12,7 @@
 #include "unlink-directory.h"
 #include "fts-backend-flatcurve.h"
 #include "fts-backend-flatcurve-xapian.h"
+#include "fts-flatcurve-query-cache.h"
 
 #define FTS_FLATCURVE_MAX_TERM_SIZE_MAX 200
 
@@ -90,6 +91,88 @@ fts_backend_flatcurve_close_mailbox(struct flatcurve_fts_backend *backend,
 	return ret;
 }
 
+static void
+fts_backend_flatcurve_query_cache_event(struct flatcurve_fts_backend *backend,
+					struct mailbox *box, const char *result)
+{
+	e_debug(event_create_passthrough(backend->event)->
+		set_name("fts_flatcurve_query_cache")->
+		add_str("mailbox", box->vname)->
+		add_str("result", result)->
+		add_int("hits", backend->query_cache_hits)->
+		add_int("misses", backend->query_cache_misses)->event(),
+		"Query cache %s (hits=%u misses=%u)", result,
+		backend->query_cache_hits, backend->query_cache_misses);
+}
+
+static const char *
+fts_backend_flatcurve_query_cache_path(struct flatcurve_fts_backend *backend)
+{
+	const char *db_path = str_c(backend->db_path);
+	size_t len = str_len(backend->db_path);
+
+	/* Keep the file outside the index directory, so it doesn't get
+	   in the way of the Xapian shards there. */
+	while (len > 0 && db_path[len - 1] == '/')
+		len--;
+	return t_strconcat(t_strndup(db_path, len), "-query-cache", NULL);
+}
+
+/* Returns: 0 on success, -1 on error */
+static int
+fts_backend_flatcurve_run_query(struct flatcurve_fts_backend *backend,
+				struct flatcurve_fts_query *query,
+				struct mailbox *box,
+				struct flatcurve_fts_result *fresult,
+				const char **error_r)
+{
+	struct mailbox_metadata metadata;
+	const char *path, *key, *query_key, *error;
+	uint64_t revision;
+	int ret;
+
+	if (backend->fuser->set->query_cache_size == 0 ||
+	    str_len(query->qtext) == 0 ||
+	    (query_key = fts_flatcurve_xapian_query_cache_key(query)) == NULL)
+		return fts_flatcurve_xapian_run_query(query, fresult, error_r);
+
+	/* The index is committed by fts_backend_refresh() before each
+	   lookup, so the on-disk revision covers our own updates too. */
+	ret = fts_flatcurve_xapian_get_revision(backend, &revision, &error);
+	if (ret < 0)
+		e_error(backend->event, "%s", error);
+	if (ret <= 0)
+		return fts_flatcurve_xapian_run_query(query, fresult, error_r);
+
+	/* The GUID makes sure a result isn't used for a different mailbox
+	   that was later created with the same name. */
+	if (mailbox_get_metadata(box, MAILBOX_METADATA_GUID, &metadata) < 0)
+		return fts_flatcurve_xapian_run_query(query, fresult, error_r);
+	key = t_strconcat(guid_128_to_string(metadata.guid), ":",
+			  query_key, NULL);
+
+	path = fts_backend_flatcurve_query_cache_path(backend);
+	ret = fts_flatcurve_query_cache_lookup(path, key, revision, fresult,
+					       &error);
+	if (ret < 0)
+		e_error(backend->event, "%s", error);
+	if (ret > 0) {
+		backend->query_cache_hits++;
+		fts_backend_flatcurve_query_cache_event(backend, box, "hit");
+		return 0;
+	}
+	backend->query_cache_misses++;
+	fts_backend_flatcurve_query_cache_event(backend, box, "miss");
+
+	if (fts_flatcurve_xapian_run_query(query, fresult, error_r) < 0)
+		return -1;
+	if (fts_flatcurve_query_cache_add(path, key, revision,
+			backend->fuser->set->query_cache_size,
+			fresult, &error) < 0)
+		e_error(backend->event, "%s", error);
+	return 0;
+}
+
 static int fts_backend_flatcurve_refresh(struct fts_backend * _backend)
 {
 	const char *error;
@@ -628,7 +711,8 @@ fts_backend_flatcurve_lookup_multi(struct fts_backend *_backend,
 			break;
 		}
 
-		if (fts_flatcurve_xapian_run_query(query, fresult, &error) < 0) {
+		if (fts_backend_flatcurve_run_query(backend, query, r->box,
+						    fresult, &error) < 0) {
 			ret = -1;
 			break;
 		}
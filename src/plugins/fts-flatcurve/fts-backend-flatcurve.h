@@ -23,6 +23,9 @@ struct flatcurve_fts_backend {
 
 	enum file_lock_method parsed_lock_method;
 
+	/* Query cache lookups done by this process */
+	unsigned int query_cache_hits, query_cache_misses;
+
 	pool_t pool;
 };
 
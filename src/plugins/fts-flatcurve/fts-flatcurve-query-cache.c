@@ -0,0 +1,215 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "istream.h"
+#include "safe-mkstemp.h"
+#include "str.h"
+#include "strnum.h"
+#include "write-full.h"
+#include "imap-seqset.h"
+#include "imap-util.h"
+#include "fts-backend-flatcurve.h"
+#include "fts-flatcurve-query-cache.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/* The cache file has one result per line, most recently added first:
+   <key> TAB <revision> TAB <uids> TAB <maybe uids> TAB <scores>
+   The UIDs are IMAP sequence sets. The scores are "<uid>:<float bits>"
+   pairs separated by commas, so they're restored exactly. */
+enum query_cache_field {
+	QUERY_CACHE_FIELD_KEY,
+	QUERY_CACHE_FIELD_REVISION,
+	QUERY_CACHE_FIELD_UIDS,
+	QUERY_CACHE_FIELD_MAYBE_UIDS,
+	QUERY_CACHE_FIELD_SCORES,
+
+	QUERY_CACHE_FIELD_COUNT
+};
+
+static int
+query_cache_parse_uids(const char *str, ARRAY_TYPE(seq_range) *uids)
+{
+	if (*str == '\0')
+		return 0;
+	return imap_seq_set_nostar_parse(str, uids);
+}
+
+static int
+query_cache_parse_scores(const char *str, ARRAY_TYPE(fts_score_map) *scores)
+{
+	const char *const *pairs, *p;
+	struct fts_score_map *score;
+	uint32_t bits;
+
+	if (*str == '\0')
+		return 0;
+	for (pairs = t_strsplit(str, ","); *pairs != NULL; pairs++) {
+		score = array_append_space(scores);
+		if ((p = strchr(*pairs, ':')) == NULL ||
+		    str_to_uint32(t_strdup_until(*pairs, p), &score->uid) < 0 ||
+		    str_to_uint32_hex(p + 1, &bits) < 0)
+			return -1;
+		static_assert(sizeof(score->score) == sizeof(bits),
+			      "score must be 32 bits");
+		memcpy(&score->score, &bits, sizeof(bits));
+	}
+	return 0;
+}
+
+static void
+query_cache_append_result(string_t *str, const char *key, uint64_t revision,
+			  const struct flatcurve_fts_result *result)
+{
+	const struct fts_score_map *score;
+	uint32_t bits;
+	bool first = TRUE;
+
+	i_assert(strpbrk(key, "\t\n") == NULL);
+
+	str_printfa(str, "%s\t%"PRIu64"\t", key, revision);
+	imap_write_seq_range(str, &result->uids);
+	str_append_c(str, '\t');
+	imap_write_seq_range(str, &result->maybe_uids);
+	str_append_c(str, '\t');
+	array_foreach(&result->scores, score) {
+		memcpy(&bits, &score->score, sizeof(bits));
+		str_printfa(str, "%s%u:%x", first ? "" : ",", score->uid, bits);
+		first = FALSE;
+	}
+	str_append_c(str, '\n');
+}
+
+static int
+query_cache_read(const char *path, const char *key, uint64_t revision,
+		 struct flatcurve_fts_result *result, string_t *rest,
+		 unsigned int max_rest_lines, const char **error_r)
+{
+	struct istream *input;
+	const char *line, *const *fields;
+	uint64_t line_revision;
+	unsigned int rest_lines = 0;
+	int ret = 0;
+
+	input = i_stream_create_file(path, SIZE_MAX);
+	while (ret == 0 && (line = i_stream_read_next_line(input)) != NULL) {
+		fields = t_strsplit(line, "\t");
+		if (str_array_length(fields) != QUERY_CACHE_FIELD_COUNT ||
+		    str_to_uint64(fields[QUERY_CACHE_FIELD_REVISION],
+				  &line_revision) < 0) {
+			*error_r = t_strdup_printf(
+				"Corrupted query cache %s: Invalid line: %s",
+				path, line);
+			ret = -1;
+			break;
+		}
+		if (line_revision != revision) {
+			/* The index has changed since this result was
+			   cached. */
+			continue;
+		}
+		if (strcmp(fields[QUERY_CACHE_FIELD_KEY], key) != 0) {
+			if (rest != NULL && rest_lines < max_rest_lines) {
+				str_append(rest, line);
+				str_append_c(rest, '\n');
+				rest_lines++;
+			}
+			continue;
+		}
+		if (result == NULL)
+			continue;
+
+		if (query_cache_parse_uids(fields[QUERY_CACHE_FIELD_UIDS],
+					   &result->uids) < 0 ||
+		    query_cache_parse_uids(fields[QUERY_CACHE_FIELD_MAYBE_UIDS],
+					   &result->maybe_uids) < 0 ||
+		    query_cache_parse_scores(fields[QUERY_CACHE_FIELD_SCORES],
+					     &result->scores) < 0) {
+			*error_r = t_strdup_printf(
+				"Corrupted query cache %s: Invalid result "
+				"for key %s", path, key);
+			array_clear(&result->uids);
+			array_clear(&result->maybe_uids);
+			array_clear(&result->scores);
+			ret = -1;
+		} else {
+			ret = 1;
+		}
+	}
+	if (input->stream_errno != 0 && input->stream_errno != ENOENT) {
+		*error_r = t_strdup_printf("read(%s) failed: %s", path,
+					   i_stream_get_error(input));
+		ret = -1;
+	}
+	i_stream_destroy(&input);
+	return ret;
+}
+
+int fts_flatcurve_query_cache_lookup(const char *path, const char *key,
+				     uint64_t revision,
+				     struct flatcurve_fts_result *result,
+				     const char **error_r)
+{
+	return query_cache_read(path, key, revision, result, NULL, 0, error_r);
+}
+
+int fts_flatcurve_query_cache_add(const char *path, const char *key,
+				  uint64_t revision, unsigned int max_entries,
+				  const struct flatcurve_fts_result *result,
+				  const char **error_r)
+{
+	string_t *str, *temp_path;
+	int fd, ret = 0;
+
+	i_assert(max_entries > 0);
+
+	str = t_str_new(256);
+	query_cache_append_result(str, key, revision, result);
+	if (query_cache_read(path, key, revision, NULL, str, max_entries - 1,
+			     error_r) < 0) {
+		/* rewrite the corrupted file with only the new result */
+		str_truncate(str, 0);
+		query_cache_append_result(str, key, revision, result);
+	}
+
+	/* Another process may be replacing the file at the same time, in
+	   which case one of the new results is lost. That's fine for a
+	   cache. */
+	temp_path = t_str_new(128);
+	str_append(temp_path, path);
+	fd = safe_mkstemp_hostpid(temp_path, 0666, (uid_t)-1, (gid_t)-1);
+	if (fd == -1) {
+		*error_r = t_strdup_printf("safe_mkstemp(%s) failed: %m",
+					   str_c(temp_path));
+		return -1;
+	}
+	if (write_full(fd, str_data(str), str_len(str)) < 0) {
+		*error_r = t_strdup_printf("write(%s) failed: %m",
+					   str_c(temp_path));
+		ret = -1;
+	}
+	if (close(fd) < 0 && ret == 0) {
+		*error_r = t_strdup_printf("close(%s) failed: %m",
+					   str_c(temp_path));
+		ret = -1;
+	}
+	if (ret == 0 && rename(str_c(temp_path), path) < 0) {
+		*error_r = t_strdup_printf("rename(%s, %s) failed: %m",
+					   str_c(temp_path), path);
+		ret = -1;
+	}
+	if (ret < 0)
+		i_unlink_if_exists(str_c(temp_path));
+	return ret;
+}
+
+int fts_flatcurve_query_cache_clear(const char *path, const char **error_r)
+{
+	if (unlink(path) < 0 && errno != ENOENT) {
+		*error_r = t_strdup_printf("unlink(%s) failed: %m", path);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,29 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#ifndef FTS_FLATCURVE_QUERY_CACHE_H
+#define FTS_FLATCURVE_QUERY_CACHE_H
+
+struct flatcurve_fts_result;
+
+/* Query results are cached in a file next to the mailbox's index, so all
+   sessions share them. Each result is stored with the index revision it was
+   computed against, and it's used only as long as the revision stays the
+   same. */
+
+/* Look up the result for key. Returns 1 if it was found for the given
+   revision and added to result, 0 if not, -1 on error. */
+int fts_flatcurve_query_cache_lookup(const char *path, const char *key,
+				     uint64_t revision,
+				     struct flatcurve_fts_result *result,
+				     const char **error_r);
+/* Add the result for key. Results for other revisions are dropped, and only
+   the max_entries most recently added results are kept. Returns 0 on
+   success, -1 on error. */
+int fts_flatcurve_query_cache_add(const char *path, const char *key,
+				  uint64_t revision, unsigned int max_entries,
+				  const struct flatcurve_fts_result *result,
+				  const char **error_r);
+/* Drop all cached results. Returns 0 on success, -1 on error. */
+int fts_flatcurve_query_cache_clear(const char *path, const char **error_r);
+
+#endif
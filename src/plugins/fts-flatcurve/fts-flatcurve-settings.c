@@ -15,6 +15,7 @@ static const struct setting_define fts_flatcurve_setting_defines[] = {
 	DEF(UINT, commit_limit),
 	DEF(UINT, min_term_size),
 	DEF(UINT, optimize_limit),
+	DEF(UINT, query_cache_size),
 	DEF(UINT, rotate_count),
 	DEF(TIME_MSECS, rotate_time),
 	DEF(BOOL, substring_search),
@@ -25,6 +26,7 @@ static const struct fts_flatcurve_settings fts_flatcurve_default_settings = {
 	.commit_limit     =   500,
 	.min_term_size    =     2,
 	.optimize_limit   =    10,
+	.query_cache_size =    32,
 	.rotate_count     =  5000,
 	.rotate_time      =  5000,
 	.substring_search = FALSE,
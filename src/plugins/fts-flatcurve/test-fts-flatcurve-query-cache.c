@@ -0,0 +1,208 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "unlink-directory.h"
+#include "write-full.h"
+#include "test-common.h"
+#include "fts-backend-flatcurve.h"
+#include "fts-flatcurve-query-cache.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define TEST_DIR ".test-fts-flatcurve-query-cache"
+#define TEST_PATH TEST_DIR"/fts-flatcurve-query-cache"
+
+static void test_result_init(struct flatcurve_fts_result *result)
+{
+	t_array_init(&result->uids, 4);
+	t_array_init(&result->maybe_uids, 4);
+	t_array_init(&result->scores, 4);
+}
+
+static void
+test_result_fill(struct flatcurve_fts_result *result, uint32_t first_uid)
+{
+	struct fts_score_map *score;
+
+	test_result_init(result);
+	seq_range_array_add_range(&result->uids, first_uid, first_uid + 9);
+	seq_range_array_add(&result->uids, first_uid + 20);
+	seq_range_array_add(&result->maybe_uids, first_uid + 30);
+	score = array_append_space(&result->scores);
+	score->uid = first_uid;
+	score->score = 0.1f;
+	score = array_append_space(&result->scores);
+	score->uid = first_uid + 20;
+	score->score = 12.345678f;
+}
+
+static bool
+test_result_equals(const struct flatcurve_fts_result *r1,
+		   const struct flatcurve_fts_result *r2)
+{
+	return array_cmp(&r1->uids, &r2->uids) &&
+		array_cmp(&r1->maybe_uids, &r2->maybe_uids) &&
+		array_cmp(&r1->scores, &r2->scores);
+}
+
+static int
+test_lookup(const char *key, uint64_t revision,
+	    const struct flatcurve_fts_result *expected)
+{
+	struct flatcurve_fts_result result;
+	const char *error;
+	int ret;
+
+	test_result_init(&result);
+	ret = fts_flatcurve_query_cache_lookup(TEST_PATH, key, revision,
+					       &result, &error);
+	if (ret < 0)
+		i_error("%s", error);
+	if (ret > 0 && expected != NULL)
+		test_assert(test_result_equals(&result, expected));
+	if (ret == 0) {
+		test_assert(array_count(&result.uids) == 0 &&
+			    array_count(&result.scores) == 0);
+	}
+	return ret;
+}
+
+static void
+test_add(const char *key, uint64_t revision, unsigned int max_entries,
+	 const struct flatcurve_fts_result *result)
+{
+	const char *error;
+
+	if (fts_flatcurve_query_cache_add(TEST_PATH, key, revision,
+					  max_entries, result, &error) < 0)
+		i_error("%s", error);
+}
+
+static void test_fts_flatcurve_query_cache_hit_miss(void)
+{
+	struct flatcurve_fts_result result1, result2, empty;
+
+	test_begin("fts flatcurve query cache hit and miss");
+	test_result_fill(&result1, 1);
+	test_result_fill(&result2, 100);
+	test_result_init(&empty);
+
+	/* nothing cached yet */
+	test_assert(test_lookup("key1", 1, NULL) == 0);
+
+	test_add("key1", 1, 10, &result1);
+	test_add("key2", 1, 10, &result2);
+	test_add("empty", 1, 10, &empty);
+
+	/* The results come from the file, so they are the same for any
+	   process or session that looks them up. */
+	test_assert(test_lookup("key1", 1, &result1) == 1);
+	test_assert(test_lookup("key2", 1, &result2) == 1);
+	test_assert(test_lookup("empty", 1, &empty) == 1);
+	test_assert(test_lookup("key3", 1, NULL) == 0);
+
+	/* replacing a key keeps only the latest result */
+	test_add("key1", 1, 10, &result2);
+	test_assert(test_lookup("key1", 1, &result2) == 1);
+	test_end();
+}
+
+static void test_fts_flatcurve_query_cache_invalidation(void)
+{
+	struct flatcurve_fts_result result1, result2;
+	const char *error;
+
+	test_begin("fts flatcurve query cache invalidation");
+	test_result_fill(&result1, 1);
+	test_result_fill(&result2, 100);
+
+	test_add("key1", 1, 10, &result1);
+	test_add("key2", 1, 10, &result2);
+	test_assert(test_lookup("key1", 1, &result1) == 1);
+
+	/* the index changed */
+	test_assert(test_lookup("key1", 2, NULL) == 0);
+	test_assert(test_lookup("key2", 2, NULL) == 0);
+
+	/* adding a result for the new revision drops the old ones */
+	test_add("key1", 2, 10, &result2);
+	test_assert(test_lookup("key1", 2, &result2) == 1);
+	test_assert(test_lookup("key1", 1, NULL) == 0);
+	test_assert(test_lookup("key2", 1, NULL) == 0);
+
+	test_assert(fts_flatcurve_query_cache_clear(TEST_PATH, &error) == 0);
+	test_assert(test_lookup("key1", 2, NULL) == 0);
+	/* clearing a missing cache isn't an error */
+	test_assert(fts_flatcurve_query_cache_clear(TEST_PATH, &error) == 0);
+	test_end();
+}
+
+static void test_fts_flatcurve_query_cache_max_entries(void)
+{
+	struct flatcurve_fts_result result;
+	const char *error;
+
+	test_begin("fts flatcurve query cache max entries");
+	test_result_fill(&result, 1);
+
+	test_add("key1", 1, 2, &result);
+	test_add("key2", 1, 2, &result);
+	test_add("key3", 1, 2, &result);
+	/* the oldest result was dropped */
+	test_assert(test_lookup("key1", 1, NULL) == 0);
+	test_assert(test_lookup("key2", 1, &result) == 1);
+	test_assert(test_lookup("key3", 1, &result) == 1);
+
+	test_assert(fts_flatcurve_query_cache_clear(TEST_PATH, &error) == 0);
+	test_end();
+}
+
+static void test_fts_flatcurve_query_cache_corrupted(void)
+{
+	static const char corrupted[] = "key1\tbroken\n";
+	struct flatcurve_fts_result result;
+	int fd;
+
+	test_begin("fts flatcurve query cache corrupted");
+	test_result_fill(&result, 1);
+
+	fd = open(TEST_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", TEST_PATH);
+	if (write_full(fd, corrupted, sizeof(corrupted) - 1) < 0)
+		i_fatal("write(%s) failed: %m", TEST_PATH);
+	i_close_fd(&fd);
+
+	test_expect_error_string("Corrupted query cache");
+	test_assert(test_lookup("key1", 1, NULL) < 0);
+	test_expect_no_more_errors();
+
+	/* the corrupted file gets replaced */
+	test_add("key1", 1, 10, &result);
+	test_assert(test_lookup("key1", 1, &result) == 1);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_fts_flatcurve_query_cache_hit_miss,
+		test_fts_flatcurve_query_cache_invalidation,
+		test_fts_flatcurve_query_cache_max_entries,
+		test_fts_flatcurve_query_cache_corrupted,
+		NULL
+	};
+	const char *error;
+	int ret;
+
+	(void)unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	if (mkdir(TEST_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_DIR);
+	ret = test_run(test_functions);
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+		i_error("unlink_directory(%s) failed: %s", TEST_DIR, error);
+	return ret;
+}
@@ -97,6 +97,9 @@ struct fts_backend_update_context {
 	normalizer_func_t *normalizer;
 
 	struct mailbox *cur_box, *backend_box;
+	/* attachments of the last built mail whose text is still being
+	   extracted, see fts_build_mail_finish_pending() */
+	struct fts_build_pending *build_pending;
 
 	bool build_key_open:1;
 	bool failed:1;
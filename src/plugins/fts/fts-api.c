@@ -9,6 +9,7 @@
 #include "mailbox-list-iter.h"
 #include "mail-search.h"
 #include "fts-api-private.h"
+#include "fts-build-mail.h"
 #include "fts-storage.h"
 
 struct event_category event_category_fts = {
@@ -220,21 +221,25 @@ int fts_backend_update_deinit(struct fts_backend_update_context **_ctx)
 {
 	struct fts_backend_update_context *ctx = *_ctx;
 	struct fts_backend *backend = ctx->backend;
+	bool pending_failed;
 	int ret;
 
 	*_ctx = NULL;
 
+	pending_failed = fts_build_mail_finish_pending(ctx) < 0;
 	ctx->cur_box = NULL;
 	fts_backend_set_cur_mailbox(ctx);
 
 	ret = backend->v.update_deinit(ctx);
 	backend->updating = FALSE;
-	return ret;
+	return pending_failed ? -1 : ret;
 }
 
 void fts_backend_update_set_mailbox(struct fts_backend_update_context *ctx,
 				    struct mailbox *box)
 {
+	if (box != ctx->cur_box && fts_build_mail_finish_pending(ctx) < 0)
+		ctx->failed = TRUE;
 	if (ctx->backend_box != NULL && box != ctx->backend_box) T_BEGIN {
 		/* make sure we don't reference the backend box anymore */
 		ctx->backend->v.update_set_mailbox(ctx, NULL);
@@ -29,6 +29,8 @@ enum fts_backend_build_key_type {
 struct fts_backend_build_key {
 	uint32_t uid;
 	enum fts_backend_build_key_type type;
+	/* NULL for attachment text that is added after the mail's parsing
+	   has already finished */
 	struct message_part *part;
 
 	/* for _KEY_HDR: */
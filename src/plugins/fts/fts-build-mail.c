@@ -26,12 +26,57 @@
    wherever */
 #define MAX_WORD_SIZE 1024
 
+struct fts_pending_extraction {
+	struct fts_parser *parser;
+	/* NULL once the mail's parsing has finished */
+	struct message_part *part;
+	uint32_t uid;
+	char *content_type, *content_disposition;
+};
+
+struct fts_build_pending {
+	/* body parts whose text is still being extracted asynchronously, in
+	   the order they were parsed. The parts of the previously built mail
+	   come first. */
+	ARRAY(struct fts_pending_extraction) extractions;
+};
+
+enum fts_build_record_op_type {
+	FTS_BUILD_RECORD_OP_SET_KEY,
+	FTS_BUILD_RECORD_OP_UNSET_KEY,
+	FTS_BUILD_RECORD_OP_MORE,
+};
+
+struct fts_build_record_op {
+	enum fts_build_record_op_type type;
+	/* FTS_BUILD_RECORD_OP_SET_KEY */
+	struct fts_backend_build_key key;
+	/* FTS_BUILD_RECORD_OP_MORE: the data in fts_build_record.data */
+	size_t data_offset, data_size;
+};
+
+/* The backend calls made while building a mail, to be replayed later */
+struct fts_build_record {
+	pool_t pool;
+	ARRAY(struct fts_build_record_op) ops;
+	buffer_t *data;
+};
+
 struct fts_mail_build_context {
+	/* NULL when adding the text extracted for an already built mail */
 	struct mail *mail;
+	struct mailbox *box;
+	uint32_t uid;
 	struct fts_backend_update_context *update_ctx;
 
 	char *content_type, *content_type_params, *content_disposition;
 	struct fts_parser *body_parser;
+	struct fts_build_pending *pending;
+	unsigned int max_pending_extractions;
+	/* The previous mail's text is still being extracted. The backend
+	   calls for this mail are recorded until it's been added, so the
+	   backend gets each mail's text in one piece. */
+	struct fts_build_record *record;
 
 	buffer_t *word_buf, *pending_input;
 	struct language_user *cur_user_lang;
@@ -40,6 +85,126 @@ struct fts_mail_build_context {
 static int fts_build_data(struct fts_mail_build_context *ctx,
 			  const unsigned char *data, size_t size, bool last);
 
+static struct fts_build_record *fts_build_record_init(void)
+{
+	struct fts_build_record *record;
+	pool_t pool;
+
+	pool = pool_alloconly_create("fts build record", 1024);
+	record = p_new(pool, struct fts_build_record, 1);
+	record->pool = pool;
+	p_array_init(&record->ops, pool, 32);
+	record->data = buffer_create_dynamic(default_pool, 1024);
+	return record;
+}
+
+static void fts_build_record_free(struct fts_build_record **_record)
+{
+	struct fts_build_record *record = *_record;
+
+	if (record == NULL)
+		return;
+	*_record = NULL;
+
+	buffer_free(&record->data);
+	pool_unref(&record->pool);
+}
+
+static bool fts_build_set_key(struct fts_mail_build_context *ctx,
+			      const struct fts_backend_build_key *key)
+{
+	struct fts_build_record_op *op;
+
+	if (ctx->record == NULL)
+		return fts_backend_update_set_build_key(ctx->update_ctx, key);
+
+	/* whether the backend wants the key is known only once the calls
+	   are replayed */
+	op = array_append_space(&ctx->record->ops);
+	op->type = FTS_BUILD_RECORD_OP_SET_KEY;
+	op->key = *key;
+	op->key.hdr_name = p_strdup(ctx->record->pool, key->hdr_name);
+	op->key.body_content_type =
+		p_strdup(ctx->record->pool, key->body_content_type);
+	op->key.body_content_disposition =
+		p_strdup(ctx->record->pool, key->body_content_disposition);
+	return TRUE;
+}
+
+static void fts_build_unset_key(struct fts_mail_build_context *ctx)
+{
+	struct fts_build_record_op *op;
+
+	if (ctx->record == NULL)
+		fts_backend_update_unset_build_key(ctx->update_ctx);
+	else {
+		op = array_append_space(&ctx->record->ops);
+		op->type = FTS_BUILD_RECORD_OP_UNSET_KEY;
+	}
+}
+
+static int fts_build_more(struct fts_mail_build_context *ctx,
+			  const unsigned char *data, size_t size)
+{
+	struct fts_build_record_op *op;
+
+	if (ctx->record == NULL) {
+		if (fts_backend_update_build_more(ctx->update_ctx,
+						  data, size) < 0) {
+			mail_storage_set_internal_error(ctx->box->storage);
+			return -1;
+		}
+		return 0;
+	}
+
+	op = array_append_space(&ctx->record->ops);
+	op->type = FTS_BUILD_RECORD_OP_MORE;
+	op->data_offset = ctx->record->data->used;
+	op->data_size = size;
+	buffer_append(ctx->record->data, data, size);
+	return 0;
+}
+
+static int fts_build_record_replay(struct fts_mail_build_context *ctx)
+{
+	struct fts_build_record *record = ctx->record;
+	const struct fts_build_record_op *op;
+	bool key_set = FALSE;
+	int ret = 0;
+
+	if (record == NULL)
+		return 0;
+
+	ctx->record = NULL;
+	array_foreach(&record->ops, op) {
+		if (op->type == FTS_BUILD_RECORD_OP_SET_KEY) {
+			key_set = fts_backend_update_set_build_key(
+				ctx->update_ctx, &op->key);
+		} else if (op->type == FTS_BUILD_RECORD_OP_UNSET_KEY) {
+			fts_backend_update_unset_build_key(ctx->update_ctx);
+			key_set = FALSE;
+		} else if (key_set) {
+			if (fts_build_more(ctx, CONST_PTR_OFFSET(
+					record->data->data, op->data_offset),
+					op->data_size) < 0) {
+				ret = -1;
+				break;
+			}
+		}
+	}
+	fts_build_record_free(&record);
+	return ret;
+}
+
+static void fts_mail_build_set_critical(struct fts_mail_build_context *ctx,
+					const char *error)
+{
+	if (ctx->mail != NULL)
+		mail_set_critical(ctx->mail, "%s", error);
+	else
+		mailbox_set_critical(ctx->box, "UID %u: %s", ctx->uid, error);
+}
+
 static void fts_build_parse_content_type(struct fts_mail_build_context *ctx,
 					 const struct message_header_line *hdr)
 {
@@ -153,7 +318,7 @@ static int fts_build_mail_header(struct fts_mail_build_context *ctx,
 	/* hdr->full_value is always set because we get the block from
 	   message_decoder */
 	i_zero(&key);
-	key.uid = ctx->mail->uid;
+	key.uid = ctx->uid;
 	key.type = block->part->physical_pos == 0 ?
 		FTS_BACKEND_BUILD_KEY_HDR : FTS_BACKEND_BUILD_KEY_MIME_HDR;
 	key.part = block->part;
@@ -163,7 +328,7 @@ static int fts_build_mail_header(struct fts_mail_build_context *ctx,
 	     FTS_BACKEND_FLAG_TOKENIZED_INPUT) != 0)
 		fts_build_tokenized_hdr_update_lang(ctx, hdr);
 
-	if (!fts_backend_update_set_build_key(ctx->update_ctx, &key))
+	if (!fts_build_set_key(ctx, &key))
 		return 0;
 
 	if (!message_header_is_address(hdr->name)) {
@@ -193,7 +358,7 @@ static int fts_build_mail_header(struct fts_mail_build_context *ctx,
 		fts_mail_build_ctx_set_lang(ctx,
 			lang_user_get_data_lang(ctx->update_ctx->backend->ns->user));
 		key.hdr_name = "";
-		if (fts_backend_update_set_build_key(ctx->update_ctx, &key)) {
+		if (fts_build_set_key(ctx, &key)) {
 			if (fts_build_data(ctx, (const void *)hdr->name,
 					   strlen(hdr->name), TRUE) < 0)
 				ret = -1;
@@ -215,7 +380,7 @@ fts_build_body_begin(struct fts_mail_build_context *ctx,
 
 	*binary_body_r = FALSE;
 	i_zero(&key);
-	key.uid = ctx->mail->uid;
+	key.uid = ctx->uid;
 	key.part = part;
 
 	i_zero(&parser_context);
@@ -231,10 +396,10 @@ fts_build_body_begin(struct fts_mail_build_context *ctx,
 		/* multiparts are never indexed, only their contents */
 		return FALSE;
 	}
-	storage = mailbox_get_storage(ctx->mail->box);
+	storage = mailbox_get_storage(ctx->box);
 	parser_context.user = mail_storage_get_user(storage);
 	parser_context.content_disposition = ctx->content_disposition;
-	parser_context.event = event_create(ctx->mail->box->event);
+	parser_context.event = event_create(ctx->box->event);
 	event_add_category(parser_context.event, &event_category_fts);
 	T_BEGIN {
 		const char *prefix =
@@ -264,7 +429,7 @@ fts_build_body_begin(struct fts_mail_build_context *ctx,
 	key.body_content_type = parser_context.content_type;
 	key.body_content_disposition = ctx->content_disposition;
 	ctx->cur_user_lang = NULL;
-	if (!fts_backend_update_set_build_key(ctx->update_ctx, &key)) {
+	if (!fts_build_set_key(ctx, &key)) {
 		if (ctx->body_parser != NULL)
 			(void)fts_parser_deinit(&ctx->body_parser, NULL);
 		event_unref(&parser_context.event);
@@ -289,17 +454,14 @@ fts_build_add_tokens_with_filter(struct fts_mail_build_context *ctx,
 		if (ret2 > 0 && filter != NULL)
 			ret2 = lang_filter(filter, &token, &error);
 		if (ret2 < 0) {
-			mail_set_critical(ctx->mail,
+			fts_mail_build_set_critical(ctx, t_strdup_printf(
 				"fts: Couldn't create indexable tokens: %s",
-				error);
+				error));
 		}
 		if (ret2 > 0) {
-			if (fts_backend_update_build_more(ctx->update_ctx,
-							  (const void *)token,
-							  strlen(token)) < 0) {
-				mail_storage_set_internal_error(ctx->mail->box->storage);
+			if (fts_build_more(ctx, (const void *)token,
+					   strlen(token)) < 0)
 				ret = -1;
-			}
 		}
 	} T_END;
 	return ret;
@@ -335,9 +497,9 @@ fts_detect_language(struct fts_mail_build_context *ctx,
 	case LANGUAGE_DETECT_RESULT_ERROR:
 		/* internal language detection library failure
 		   (e.g. invalid config). don't index anything. */
-		mail_set_critical(ctx->mail,
+		fts_mail_build_set_critical(ctx, t_strdup_printf(
 			"Language detection library initialization failed: %s",
-			error);
+			error));
 		return -1;
 	default:
 		i_unreached();
@@ -403,12 +565,9 @@ fts_build_full_words(struct fts_mail_build_context *ctx,
 			return 0;
 		}
 		/* we have a full word, index it */
-		if (fts_backend_update_build_more(ctx->update_ctx,
-						  ctx->word_buf->data,
-						  ctx->word_buf->used) < 0) {
-			mail_storage_set_internal_error(ctx->mail->box->storage);
+		if (fts_build_more(ctx, ctx->word_buf->data,
+				   ctx->word_buf->used) < 0)
 			return -1;
-		}
 		buffer_set_used_size(ctx->word_buf, 0);
 	}
 
@@ -422,10 +581,8 @@ fts_build_full_words(struct fts_mail_build_context *ctx,
 		}
 	}
 
-	if (fts_backend_update_build_more(ctx->update_ctx, data, i) < 0) {
-		mail_storage_set_internal_error(ctx->mail->box->storage);
+	if (fts_build_more(ctx, data, i) < 0)
 		return -1;
-	}
 
 	if (i < size) {
 		if (ctx->word_buf == NULL) {
@@ -447,11 +604,7 @@ static int fts_build_data(struct fts_mail_build_context *ctx,
 		    FTS_BACKEND_FLAG_BUILD_FULL_WORDS) != 0) {
 		return fts_build_full_words(ctx, data, size, last);
 	} else {
-		if (fts_backend_update_build_more(ctx->update_ctx, data, size) < 0) {
-			mail_storage_set_internal_error(ctx->mail->box->storage);
-			return -1;
-		}
-		return 0;
+		return fts_build_more(ctx, data, size);
 	}
 }
 
@@ -496,12 +649,216 @@ static int fts_body_parser_finish(struct fts_mail_build_context *ctx,
 		return -1;
 	}
 	if (deinit_ret < 0) {
-		mail_storage_set_internal_error(ctx->mail->box->storage);
+		mail_storage_set_internal_error(ctx->box->storage);
 		return -1;
 	}
 	return 0;
 }
 
+static struct fts_build_pending *
+fts_build_pending_get(struct fts_backend_update_context *update_ctx)
+{
+	if (update_ctx->build_pending == NULL) {
+		update_ctx->build_pending = i_new(struct fts_build_pending, 1);
+		i_array_init(&update_ctx->build_pending->extractions, 4);
+	}
+	return update_ctx->build_pending;
+}
+
+static void
+fts_mail_build_context_init(struct fts_mail_build_context *ctx,
+			    struct fts_backend_update_context *update_ctx,
+			    struct mailbox *box, uint32_t uid)
+{
+	i_zero(ctx);
+	ctx->update_ctx = update_ctx;
+	ctx->box = box;
+	ctx->uid = uid;
+	ctx->pending = fts_build_pending_get(update_ctx);
+	ctx->max_pending_extractions =
+		fts_user_get_settings(box->storage->user)->
+		decoder_max_concurrency;
+	if ((update_ctx->backend->flags & FTS_BACKEND_FLAG_TOKENIZED_INPUT) != 0)
+		ctx->pending_input = buffer_create_dynamic(default_pool, 128);
+}
+
+static void fts_mail_build_context_deinit(struct fts_mail_build_context *ctx)
+{
+	i_assert(ctx->body_parser == NULL);
+
+	fts_build_record_free(&ctx->record);
+	i_free(ctx->content_type);
+	i_free(ctx->content_type_params);
+	i_free(ctx->content_disposition);
+	buffer_free(&ctx->word_buf);
+	buffer_free(&ctx->pending_input);
+}
+
+static int
+fts_build_pending_extraction(struct fts_mail_build_context *ctx,
+			     const char **retriable_err_msg_r,
+			     bool *may_need_retry_r)
+{
+	struct fts_pending_extraction pending =
+		*array_front(&ctx->pending->extractions);
+	struct fts_backend_build_key key;
+	int ret = 0;
+
+	i_assert(pending.uid == ctx->uid);
+
+	array_pop_front(&ctx->pending->extractions);
+	fts_build_unset_key(ctx);
+
+	i_zero(&key);
+	key.uid = pending.uid;
+	key.part = pending.part;
+	key.type = FTS_BACKEND_BUILD_KEY_BODY_PART;
+	key.body_content_type = pending.content_type;
+	key.body_content_disposition = pending.content_disposition;
+
+	i_assert(ctx->body_parser == NULL);
+	ctx->body_parser = pending.parser;
+	ctx->cur_user_lang = NULL;
+	if (!fts_build_set_key(ctx, &key))
+		(void)fts_parser_deinit(&ctx->body_parser, NULL);
+	else {
+		ret = fts_body_parser_finish(ctx, retriable_err_msg_r,
+					     may_need_retry_r);
+		fts_build_unset_key(ctx);
+	}
+	i_free(pending.content_type);
+	i_free(pending.content_disposition);
+	return ret;
+}
+
+static int
+fts_build_previous_extraction(struct fts_backend_update_context *update_ctx)
+{
+	const struct fts_pending_extraction *pending =
+		array_front(&update_ctx->build_pending->extractions);
+	struct fts_mail_build_context ctx;
+	const char *retriable_error;
+	bool may_need_retry;
+	int ret;
+
+	i_assert(update_ctx->cur_box != NULL);
+
+	fts_mail_build_context_init(&ctx, update_ctx, update_ctx->cur_box,
+				    pending->uid);
+	ret = fts_build_pending_extraction(&ctx, &retriable_error,
+					   &may_need_retry);
+	if (ret < 0 && may_need_retry) {
+		/* The mail can't be built again anymore. Handle this like
+		   fts_build_mail() does when it runs out of attempts. */
+		e_info(update_ctx->backend->event,
+		       "Mailbox %s: UID %u: %s - ignoring",
+		       mailbox_get_vname(ctx.box), ctx.uid, retriable_error);
+		ret = 0;
+	}
+	fts_mail_build_context_deinit(&ctx);
+	return ret;
+}
+
+static bool fts_build_previous_pending(struct fts_mail_build_context *ctx)
+{
+	const struct fts_pending_extraction *pending;
+
+	if (array_is_empty(&ctx->pending->extractions))
+		return FALSE;
+	pending = array_front(&ctx->pending->extractions);
+	return pending->uid != ctx->uid;
+}
+
+static int
+fts_build_pending_extractions(struct fts_mail_build_context *ctx,
+			      unsigned int max_count,
+			      const char **retriable_err_msg_r,
+			      bool *may_need_retry_r)
+{
+	while (array_count(&ctx->pending->extractions) > max_count) {
+		if (!fts_build_previous_pending(ctx)) {
+			if (fts_build_pending_extraction(ctx,
+					retriable_err_msg_r,
+					may_need_retry_r) < 0)
+				return -1;
+			continue;
+		}
+		if (fts_build_previous_extraction(ctx->update_ctx) < 0)
+			return -1;
+		if (!fts_build_previous_pending(ctx)) {
+			/* the previous mail is done - give this mail's
+			   calls so far to the backend */
+			if (fts_build_record_replay(ctx) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int fts_build_previous_extractions(struct fts_mail_build_context *ctx)
+{
+	while (fts_build_previous_pending(ctx)) {
+		if (fts_build_previous_extraction(ctx->update_ctx) < 0)
+			return -1;
+	}
+	return fts_build_record_replay(ctx);
+}
+
+/* Abort the extractions for the given mail, or all of them if uid is 0. */
+static void
+fts_abort_pending_extractions(struct fts_build_pending *pending, uint32_t uid)
+{
+	struct fts_pending_extraction *extraction;
+	unsigned int i, count;
+
+	/* the mail's extractions are the last ones */
+	count = array_count(&pending->extractions);
+	for (i = count; i > 0; i--) {
+		extraction = array_idx_modifiable(&pending->extractions, i - 1);
+		if (uid != 0 && extraction->uid != uid)
+			break;
+		(void)fts_parser_deinit(&extraction->parser, NULL);
+		i_free(extraction->content_type);
+		i_free(extraction->content_disposition);
+	}
+	array_delete(&pending->extractions, i, count - i);
+}
+
+static void fts_keep_pending_extractions(struct fts_mail_build_context *ctx)
+{
+	struct fts_pending_extraction *extraction;
+
+	/* the parts are freed with the mail */
+	array_foreach_modifiable(&ctx->pending->extractions, extraction)
+		extraction->part = NULL;
+}
+
+static int fts_body_parser_end(struct fts_mail_build_context *ctx,
+			       struct message_part *part,
+			       const char **retriable_err_msg_r,
+			       bool *may_need_retry_r)
+{
+	struct fts_pending_extraction *pending;
+
+	if (!fts_parser_start(ctx->body_parser)) {
+		return fts_body_parser_finish(ctx, retriable_err_msg_r,
+					      may_need_retry_r);
+	}
+
+	/* The text is being extracted in the background. Continue with the
+	   rest of the mail and add the text later, either to make room for
+	   more extractions or after the next mail has been parsed. */
+	pending = array_append_space(&ctx->pending->extractions);
+	pending->parser = ctx->body_parser;
+	pending->part = part;
+	pending->uid = ctx->uid;
+	pending->content_type = i_strdup(ctx->content_type != NULL ?
+					 ctx->content_type : "text/plain");
+	pending->content_disposition = i_strdup(ctx->content_disposition);
+	ctx->body_parser = NULL;
+	return 0;
+}
+
 static void
 parse_header_filter(const ARRAY_TYPE(const_string) *values, pool_t pool,
 		    ARRAY_TYPE(const_string) *list_r, bool *matches_all_r)
@@ -613,11 +970,10 @@ fts_build_mail_real(struct fts_backend_update_context *update_ctx,
 		return -1;
 	}
 
-	i_zero(&ctx);
-	ctx.update_ctx = update_ctx;
+	fts_mail_build_context_init(&ctx, update_ctx, mail->box, mail->uid);
 	ctx.mail = mail;
-	if ((update_ctx->backend->flags & FTS_BACKEND_FLAG_TOKENIZED_INPUT) != 0)
-		ctx.pending_input = buffer_create_dynamic(default_pool, 128);
+	if (fts_build_previous_pending(&ctx))
+		ctx.record = fts_build_record_init();
 
 	prev_part = NULL;
 	pool_t parts_pool = pool_alloconly_create("fts message parts", 512);
@@ -642,14 +998,22 @@ fts_build_mail_real(struct fts_backend_update_context *update_ctx,
 			/* body part changed. we're now parsing the end of
 			   boundary, possibly followed by message epilogue */
 			if (ctx.body_parser != NULL) {
-				if (fts_body_parser_finish(&ctx, retriable_err_msg_r,
-							   may_need_retry_r) < 0) {
+				if (fts_body_parser_end(&ctx, prev_part,
+							retriable_err_msg_r,
+							may_need_retry_r) < 0) {
 					ret = -1;
 					break;
 				}
 			}
 			message_decoder_set_return_binary(decoder, FALSE);
-			fts_backend_update_unset_build_key(update_ctx);
+			fts_build_unset_key(&ctx);
+			if (fts_build_pending_extractions(&ctx,
+					ctx.max_pending_extractions - 1,
+					retriable_err_msg_r,
+					may_need_retry_r) < 0) {
+				ret = -1;
+				break;
+			}
 			prev_part = raw_block.part;
 			i_free_and_null(ctx.content_type);
 			i_free_and_null(ctx.content_type_params);
@@ -719,8 +1083,9 @@ fts_build_mail_real(struct fts_backend_update_context *update_ctx,
 	}
 	if (ctx.body_parser != NULL) {
 		if (ret == 0)
-			ret = fts_body_parser_finish(&ctx, retriable_err_msg_r,
-						     may_need_retry_r);
+			ret = fts_body_parser_end(&ctx, prev_part,
+						  retriable_err_msg_r,
+						  may_need_retry_r);
 		else
 			(void)fts_parser_deinit(&ctx.body_parser, NULL);
 	}
@@ -729,14 +1094,21 @@ fts_build_mail_real(struct fts_backend_update_context *update_ctx,
 		block.data = NULL; block.size = 0;
 		ret = fts_build_body_block(&ctx, &block, TRUE);
 	}
+	if (ret == 0) {
+		/* This mail's own extractions are left running while the
+		   next mail is parsed. They're added when more room is
+		   needed, before the next mail is given to the backend, or
+		   by fts_build_mail_finish_pending(). */
+		ret = fts_build_previous_extractions(&ctx);
+	}
+	if (ret == 0)
+		fts_keep_pending_extractions(&ctx);
+	else
+		fts_abort_pending_extractions(ctx.pending, ctx.uid);
 	if (message_parser_deinit_from_parts(&parser, &parts, &error) < 0)
 		index_mail_set_message_parts_corrupted(mail, error);
 	message_decoder_deinit(&decoder);
-	i_free(ctx.content_type);
-	i_free(ctx.content_type_params);
-	i_free(ctx.content_disposition);
-	buffer_free(&ctx.word_buf);
-	buffer_free(&ctx.pending_input);
+	fts_mail_build_context_deinit(&ctx);
 	pool_unref(&parts_pool);
 	return ret < 0 ? -1 : 1;
 }
@@ -772,3 +1144,20 @@ int fts_build_mail(struct fts_backend_update_context *update_ctx,
 	} T_END;
 	return ret;
 }
+
+int fts_build_mail_finish_pending(struct fts_backend_update_context *update_ctx)
+{
+	struct fts_build_pending *pending = update_ctx->build_pending;
+	int ret = 0;
+
+	if (pending == NULL)
+		return 0;
+
+	while (ret == 0 && array_not_empty(&pending->extractions)) T_BEGIN {
+		ret = fts_build_previous_extraction(update_ctx);
+	} T_END;
+	fts_abort_pending_extractions(pending, 0);
+	array_free(&pending->extractions);
+	i_free(update_ctx->build_pending);
+	return ret;
+}
@@ -8,5 +8,9 @@
    Returns  1 on success */
 int fts_build_mail(struct fts_backend_update_context *update_ctx,
 		   struct mail *mail);
+/* Add the text still being extracted from the attachments of the mail built
+   last. This is called by fts_backend_update_deinit() and when the update's
+   mailbox changes. Returns 0 on success, -1 on error. */
+int fts_build_mail_finish_pending(struct fts_backend_update_context *update_ctx);
 
 #endif
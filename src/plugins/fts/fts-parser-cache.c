@@ -0,0 +1,261 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "istream.h"
+#include "ostream.h"
+#include "iostream-temp.h"
+#include "hex-binary.h"
+#include "sha2.h"
+#include "dict.h"
+#include "message-parser.h"
+#include "mail-user.h"
+#include "fts-parser.h"
+#include "fts-user.h"
+
+/* The same attachment (e.g. a forwarded newsletter or a commonly shared PDF)
+   is often delivered to many users, so the cache is shared by all of them. */
+#define FTS_PARSER_CACHE_DICT_PATH DICT_PATH_SHARED"fts-decoder-cache/"
+
+struct cache_fts_parser {
+	struct fts_parser parser;
+	struct fts_parser *inner;
+	struct mail_user *user;
+	struct event *event;
+	struct dict *dict;
+
+	/* The part's content is buffered until the cache has been looked up,
+	   so the decoder sees it only if the text needs to be extracted. */
+	struct ostream *input_output;
+	struct sha256_ctx hash;
+	char *key;
+	/* Extracted text. NULL if it's not going to be cached. */
+	string_t *output;
+	uoff_t output_max_size;
+
+	bool started:1;
+	bool failed:1;
+	bool cache_hit:1;
+	bool output_returned:1;
+	bool output_finished:1;
+};
+
+struct fts_parser *
+fts_parser_cache_wrap(struct fts_parser_context *parser_context,
+		      struct fts_parser *inner)
+{
+	struct mail_user *user = parser_context->user;
+	const struct fts_settings *set = fts_user_get_settings(user);
+	struct cache_fts_parser *parser;
+	struct dict *dict;
+
+	dict = fts_user_get_decoder_cache(user);
+	if (dict == NULL)
+		return inner;
+
+	parser = i_new(struct cache_fts_parser, 1);
+	parser->parser.v = fts_parser_cache;
+	parser->inner = inner;
+	parser->user = user;
+	parser->event = event_create(parser_context->event);
+	parser->dict = dict;
+	parser->output_max_size = set->decoder_cache_max_size;
+
+	/* the extracted text depends also on the decoder and the content
+	   type given to it */
+	sha256_init(&parser->hash);
+	sha256_loop(&parser->hash, set->decoder_driver,
+		    strlen(set->decoder_driver) + 1);
+	sha256_loop(&parser->hash, parser_context->content_type,
+		    strlen(parser_context->content_type) + 1);
+
+	string_t *temp_prefix = t_str_new(128);
+	mail_user_set_get_temp_prefix(temp_prefix, user->set);
+	parser->input_output =
+		iostream_temp_create_named(str_c(temp_prefix), 0,
+					   "fts_decoder_cache input");
+	return &parser->parser;
+}
+
+static void
+fts_parser_cache_lookup(struct cache_fts_parser *parser)
+{
+	const struct dict_op_settings *set =
+		mail_user_get_dict_op_settings(parser->user);
+	unsigned char digest[SHA256_RESULTLEN];
+	const char *value, *error;
+	int ret;
+
+	sha256_result(&parser->hash, digest);
+	parser->key = i_strconcat(FTS_PARSER_CACHE_DICT_PATH,
+				  binary_to_hex(digest, sizeof(digest)), NULL);
+
+	ret = dict_lookup(parser->dict, set, pool_datastack_create(),
+			  parser->key, &value, &error);
+	if (ret < 0) {
+		e_error(parser->event, "fts_decoder_cache: "
+			"dict_lookup(%s) failed: %s", parser->key, error);
+		return;
+	}
+	if (ret == 0) {
+		e_debug(parser->event, "fts_decoder_cache: %s not found",
+			parser->key);
+		parser->output = str_new(default_pool, 1024);
+		return;
+	}
+	e_debug(parser->event, "fts_decoder_cache: %s found", parser->key);
+	parser->cache_hit = TRUE;
+	parser->output = str_new(default_pool, strlen(value) + 1);
+	str_append(parser->output, value);
+}
+
+static void fts_parser_cache_input_abort(struct cache_fts_parser *parser)
+{
+	if (parser->input_output != NULL) {
+		o_stream_abort(parser->input_output);
+		o_stream_destroy(&parser->input_output);
+	}
+}
+
+static void fts_parser_cache_feed_inner(struct cache_fts_parser *parser)
+{
+	struct message_block block;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+
+	input = iostream_temp_finish(&parser->input_output, IO_BLOCK_SIZE);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		i_zero(&block);
+		block.data = data;
+		block.size = size;
+		parser->inner->v.more(parser->inner, &block);
+		i_stream_skip(input, size);
+	}
+	if (input->stream_errno != 0) {
+		e_error(parser->event, "fts_decoder_cache: read(%s) failed: %s",
+			i_stream_get_name(input), i_stream_get_error(input));
+		parser->failed = TRUE;
+	}
+	i_stream_unref(&input);
+}
+
+static bool fts_parser_cache_start(struct fts_parser *_parser)
+{
+	struct cache_fts_parser *parser = (struct cache_fts_parser *)_parser;
+
+	i_assert(!parser->started);
+	parser->started = TRUE;
+
+	T_BEGIN {
+		fts_parser_cache_lookup(parser);
+	} T_END;
+	if (parser->cache_hit) {
+		/* no need to extract the text again */
+		fts_parser_cache_input_abort(parser);
+		(void)fts_parser_deinit(&parser->inner, NULL);
+		return FALSE;
+	}
+	fts_parser_cache_feed_inner(parser);
+	if (parser->failed)
+		return FALSE;
+	return fts_parser_start(parser->inner);
+}
+
+static void fts_parser_cache_more(struct fts_parser *_parser,
+				  struct message_block *block)
+{
+	struct cache_fts_parser *parser = (struct cache_fts_parser *)_parser;
+
+	if (block->size > 0) {
+		i_assert(!parser->started);
+		sha256_loop(&parser->hash, block->data, block->size);
+		o_stream_nsend(parser->input_output, block->data, block->size);
+		block->size = 0;
+		return;
+	}
+
+	if (!parser->started)
+		(void)fts_parser_cache_start(_parser);
+	if (parser->failed)
+		return;
+	if (parser->cache_hit) {
+		if (!parser->output_returned) {
+			block->data = str_data(parser->output);
+			block->size = str_len(parser->output);
+			parser->output_returned = TRUE;
+		}
+		return;
+	}
+
+	parser->inner->v.more(parser->inner, block);
+	if (block->size == 0)
+		parser->output_finished = TRUE;
+	else if (parser->output == NULL)
+		;
+	else if (str_len(parser->output) + block->size >
+		 parser->output_max_size) {
+		/* too large to be cached */
+		str_free(&parser->output);
+	} else {
+		str_append_data(parser->output, block->data, block->size);
+	}
+}
+
+static void
+fts_parser_cache_set_callback(const struct dict_commit_result *result,
+			      struct mail_user *user)
+{
+	if (result->ret < 0) {
+		e_error(user->event, "fts_decoder_cache: "
+			"dict_transaction_commit() failed: %s", result->error);
+	}
+}
+
+static void fts_parser_cache_set(struct cache_fts_parser *parser)
+{
+	const struct dict_op_settings *set =
+		mail_user_get_dict_op_settings(parser->user);
+	struct dict_transaction_context *trans;
+
+	if (memchr(str_data(parser->output), '\0',
+		   str_len(parser->output)) != NULL) {
+		/* can't be stored as a dict value */
+		return;
+	}
+
+	trans = dict_transaction_begin(parser->dict, set);
+	dict_set(trans, parser->key, str_c(parser->output));
+	dict_transaction_commit_async(&trans, fts_parser_cache_set_callback,
+				      parser->user);
+}
+
+static int fts_parser_cache_deinit(struct fts_parser *_parser,
+				   const char **retriable_err_msg_r)
+{
+	struct cache_fts_parser *parser = (struct cache_fts_parser *)_parser;
+	int ret = 1;
+
+	fts_parser_cache_input_abort(parser);
+	if (parser->inner != NULL)
+		ret = fts_parser_deinit(&parser->inner, retriable_err_msg_r);
+	if (ret > 0 && parser->failed)
+		ret = -1;
+	if (ret > 0 && !parser->cache_hit && parser->output_finished &&
+	    parser->output != NULL)
+		fts_parser_cache_set(parser);
+
+	str_free(&parser->output);
+	event_unref(&parser->event);
+	i_free(parser->key);
+	i_free(parser);
+	return ret;
+}
+
+struct fts_parser_vfuncs fts_parser_cache = {
+	.try_init = NULL,
+	.more = fts_parser_cache_more,
+	.deinit = fts_parser_cache_deinit,
+	.unload = NULL,
+	.start = fts_parser_cache_start,
+};
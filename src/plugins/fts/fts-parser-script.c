@@ -246,6 +246,26 @@ fts_parser_script_try_init(struct fts_parser_context *parser_context)
 	return &parser->parser;
 }
 
+static void fts_parser_script_shutdown(struct script_fts_parser *parser)
+{
+	if (parser->shutdown)
+		return;
+
+	if (shutdown(parser->fd, SHUT_WR) < 0)
+		e_error(parser->event, "shutdown(%s) failed: %m", parser->path);
+	parser->shutdown = TRUE;
+}
+
+static bool fts_parser_script_start(struct fts_parser *_parser)
+{
+	struct script_fts_parser *parser = (struct script_fts_parser *)_parser;
+
+	/* The script now has all the input. It runs in its own process, so
+	   the output can be read later. */
+	fts_parser_script_shutdown(parser);
+	return TRUE;
+}
+
 static void fts_parser_script_more(struct fts_parser *_parser,
 				   struct message_block *block)
 {
@@ -261,11 +281,7 @@ static void fts_parser_script_more(struct fts_parser *_parser,
 		}
 		block->size = 0;
 	} else {
-		if (!parser->shutdown) {
-			if (shutdown(parser->fd, SHUT_WR) < 0)
-				e_error(parser->event, "shutdown(%s) failed: %m", parser->path);
-			parser->shutdown = TRUE;
-		}
+		fts_parser_script_shutdown(parser);
 		/* read the result from the script */
 		ret = read(parser->fd, parser->outbuf, sizeof(parser->outbuf));
 		if (ret < 0)
@@ -296,5 +312,5 @@ struct fts_parser_vfuncs fts_parser_script = {
 	.try_init = fts_parser_script_try_init,
 	.more = fts_parser_script_more,
 	.deinit = fts_parser_script_deinit,
-	NULL
+	.start = fts_parser_script_start,
 };
@@ -1,8 +1,11 @@
 /* Copyright (c) 2014-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "str.h"
 #include "ioloop.h"
 #include "istream.h"
+#include "ostream.h"
+#include "iostream-temp.h"
 #include "module-context.h"
 #include "iostream-ssl.h"
 #include "http-url.h"
@@ -16,6 +19,9 @@
 #define TIKA_USER_CONTEXT(obj) \
 	MODULE_CONTEXT(obj, fts_parser_tika_user_module)
 
+/* Limit for the buffered response when fts_message_max_size is unlimited */
+#define TIKA_RESULT_DEFAULT_MAX_SIZE (16*1024*1024)
+
 struct fts_parser_tika_user {
 	union mail_user_module_context module_ctx;
 	struct http_url *http_url;
@@ -26,10 +32,17 @@ struct tika_fts_parser {
 	struct mail_user *user;
 	struct http_client_request *http_req;
 
-	struct ioloop *ioloop;
+	/* request payload, sent once all of it is available */
+	struct ostream *payload_output;
+	/* response payload, read asynchronously into result */
 	struct io *io;
 	struct istream *payload;
+	buffer_t *result;
+	size_t result_pos;
+	size_t result_max_size;
 
+	bool started;
+	bool finished;
 	bool failed;
 };
 
@@ -77,7 +90,7 @@ tika_get_http_client_url(struct fts_parser_context *parser_context, struct http_
 		settings_event_add_filter_name(event_fts, FTS_FILTER);
 		struct event *event_tika = event_create(event_fts);
 		settings_event_add_filter_name(event_tika, FTS_FILTER_DECODER_TIKA);
-		int ret = http_client_init_private_auto(event, &tika_http_client, &error);
+		int ret = http_client_init_private_auto(event_tika, &tika_http_client, &error);
 		event_unref(&event_tika);
 		event_unref(&event_fts);
 		if (ret < 0) {
@@ -89,6 +102,43 @@ tika_get_http_client_url(struct fts_parser_context *parser_context, struct http_
 	return 0;
 }
 
+static void fts_tika_parser_payload_input(struct tika_fts_parser *parser)
+{
+	const unsigned char *data;
+	size_t size;
+	bool truncated = FALSE;
+	int ret;
+
+	while ((ret = i_stream_read_more(parser->payload, &data, &size)) > 0) {
+		if (size > parser->result_max_size - parser->result->used) {
+			size = parser->result_max_size - parser->result->used;
+			truncated = TRUE;
+		}
+		buffer_append(parser->result, data, size);
+		i_stream_skip(parser->payload, size);
+		if (truncated)
+			break;
+	}
+	if (ret == 0)
+		return;
+
+	if (truncated) {
+		/* Several responses may be buffered at the same time, so
+		   they can't grow without a limit. */
+		e_debug(parser->user->event, "fts_tika: Extracted text exceeds "
+			"%zu bytes, truncating", parser->result_max_size);
+	} else if (parser->payload->stream_errno != 0) {
+		e_error(parser->user->event, "read(%s) failed: %s",
+			i_stream_get_name(parser->payload),
+			i_stream_get_error(parser->payload));
+		parser->failed = TRUE;
+	}
+	/* destroying the payload finishes the request */
+	io_remove(&parser->io);
+	i_stream_unref(&parser->payload);
+	parser->finished = TRUE;
+}
+
 static void
 fts_tika_parser_response(const struct http_response *response,
 			 struct tika_fts_parser *parser)
@@ -97,15 +147,22 @@ fts_tika_parser_response(const struct http_response *response,
 	struct event *event = parser->user->event;
 	const struct fts_settings *set = fts_user_get_settings(parser->user);
 
+	parser->http_req = NULL;
 	switch (response->status) {
 	case 200:
-		/* read response */
-		if (response->payload == NULL)
-			parser->payload = i_stream_create_from_data("", 0);
-		else {
-			i_stream_ref(response->payload);
-			parser->payload = response->payload;
+		/* read response. Multiple requests may be in flight, so the
+		   payload is read as it arrives instead of leaving it waiting
+		   in the connection. */
+		if (response->payload == NULL) {
+			parser->finished = TRUE;
+			break;
 		}
+		i_stream_ref(response->payload);
+		parser->payload = response->payload;
+		parser->io = io_add_istream(parser->payload,
+					    fts_tika_parser_payload_input,
+					    parser);
+		fts_tika_parser_payload_input(parser);
 		break;
 	case 204: /* empty response */
 	case 415: /* Unsupported Media Type */
@@ -113,7 +170,7 @@ fts_tika_parser_response(const struct http_response *response,
 		e_debug(parser->user->event, "fts_tika: PUT %s failed: %s",
 			set->decoder_tika_url,
 			http_response_get_message(response));
-		parser->payload = i_stream_create_from_data("", 0);
+		parser->finished = TRUE;
 		break;
 	default:
 		if (response->status / 100 == 5) {
@@ -127,7 +184,7 @@ fts_tika_parser_response(const struct http_response *response,
 				i_strdup_printf("fts_tika: PUT %s failed: %s",
 						set->decoder_tika_url,
 						http_response_get_message(response));
-			parser->payload = i_stream_create_from_data("", 0);
+			parser->finished = TRUE;
 		} else {
 			e_error(event, "fts_tika: PUT %s failed: %s",
 				set->decoder_tika_url,
@@ -136,8 +193,6 @@ fts_tika_parser_response(const struct http_response *response,
 		}
 		break;
 	}
-	parser->http_req = NULL;
-	io_loop_stop(current_ioloop);
 }
 
 static struct fts_parser *
@@ -155,6 +210,11 @@ fts_parser_tika_try_init(struct fts_parser_context *parser_context)
 	parser = i_new(struct tika_fts_parser, 1);
 	parser->parser.v = fts_parser_tika;
 	parser->user = parser_context->user;
+	parser->result = buffer_create_dynamic(default_pool, 1024);
+	parser->result_max_size = TIKA_RESULT_DEFAULT_MAX_SIZE;
+	size_t max_size = fts_mail_user_message_max_size(parser->user);
+	if (max_size > 0 && max_size < parser->result_max_size)
+		parser->result_max_size = max_size;
 
 	http_req = http_client_request(tika_http_client, "PUT",
 			http_url->host.name,
@@ -175,76 +235,63 @@ fts_parser_tika_try_init(struct fts_parser_context *parser_context)
 					       parser_context->content_disposition);
 	http_client_request_add_header(http_req, "Accept", "text/plain");
 
+	string_t *temp_prefix = t_str_new(128);
+	mail_user_set_get_temp_prefix(temp_prefix, parser->user->set);
+	parser->payload_output =
+		iostream_temp_create_named(str_c(temp_prefix), 0,
+					   "fts_tika payload");
 	parser->http_req = http_req;
 	return &parser->parser;
 }
 
+static bool fts_parser_tika_start(struct fts_parser *_parser)
+{
+	struct tika_fts_parser *parser = (struct tika_fts_parser *)_parser;
+	struct istream *input;
+
+	i_assert(!parser->started);
+	parser->started = TRUE;
+
+	/* Send the request, but don't wait for the response. It arrives
+	   while waiting for some other request, or at the latest when the
+	   output is asked for. */
+	input = iostream_temp_finish(&parser->payload_output, IO_BLOCK_SIZE);
+	http_client_request_set_payload(parser->http_req, input, FALSE);
+	i_stream_unref(&input);
+	http_client_request_submit(parser->http_req);
+	return TRUE;
+}
+
 static void fts_parser_tika_more(struct fts_parser *_parser,
 				 struct message_block *block)
 {
 	struct tika_fts_parser *parser = (struct tika_fts_parser *)_parser;
-	struct event *event = parser->user->event;
-	struct ioloop *prev_ioloop = current_ioloop;
-	const unsigned char *data;
-	size_t size;
-	ssize_t ret;
 
 	if (block->size > 0) {
-		/* first we'll send everything to Tika */
-		if (!parser->failed &&
-		    http_client_request_send_payload(&parser->http_req,
-						     block->data,
-						     block->size) < 0)
-			parser->failed = TRUE;
+		/* first we'll buffer everything */
+		o_stream_nsend(parser->payload_output, block->data,
+			       block->size);
 		block->size = 0;
 		return;
 	}
 
-	if (parser->payload == NULL) {
-		/* read the result from Tika */
-		if (!parser->failed &&
-		    http_client_request_finish_payload(&parser->http_req) < 0)
-			parser->failed = TRUE;
-		if (!parser->failed && parser->payload == NULL)
-			http_client_wait(tika_http_client);
-		if (parser->failed)
-			return;
-		i_assert(parser->payload != NULL);
-	}
-	/* continue returning data from Tika. we'll create a new ioloop just
-	   for reading this one payload. */
-	while ((ret = i_stream_read_more(parser->payload, &data, &size)) == 0) {
-		if (parser->failed)
-			break;
-		/* wait for more input from Tika */
-		if (parser->ioloop == NULL) {
-			parser->ioloop = io_loop_create();
-			parser->io = io_add_istream(parser->payload, io_loop_stop,
-						    current_ioloop);
-		} else {
-			io_loop_set_current(parser->ioloop);
-		}
-		io_loop_run(current_ioloop);
+	if (!parser->started)
+		(void)fts_parser_tika_start(_parser);
+	if (!parser->finished && !parser->failed) {
+		/* wait for the response - this finishes also the other
+		   requests in flight */
+		http_client_wait(tika_http_client);
+		i_assert(parser->finished || parser->failed);
 	}
-	/* switch back to original ioloop. */
-	io_loop_set_current(prev_ioloop);
-
 	if (parser->failed)
-		;
-	else if (size > 0) {
-		i_assert(ret > 0);
-		block->data = data;
-		block->size = size;
-		i_stream_skip(parser->payload, size);
-	} else {
-		/* finished */
-		i_assert(ret == -1);
-		if (parser->payload->stream_errno != 0) {
-			e_error(event, "read(%s) failed: %s",
-				i_stream_get_name(parser->payload),
-				i_stream_get_error(parser->payload));
-			parser->failed = TRUE;
-		}
+		return;
+
+	/* return the extracted text */
+	if (parser->result_pos < parser->result->used) {
+		block->data = CONST_PTR_OFFSET(parser->result->data,
+					       parser->result_pos);
+		block->size = parser->result->used - parser->result_pos;
+		parser->result_pos = parser->result->used;
 	}
 }
 
@@ -260,13 +307,14 @@ static int fts_parser_tika_deinit(struct fts_parser *_parser, const char **retri
 
 	/* remove io before unrefing payload - otherwise lib-http adds another
 	   timeout to ioloop unnecessarily */
-	i_stream_unref(&parser->payload);
 	io_remove(&parser->io);
-	http_client_request_abort(&parser->http_req);
-	if (parser->ioloop != NULL) {
-		io_loop_set_current(parser->ioloop);
-		io_loop_destroy(&parser->ioloop);
+	i_stream_unref(&parser->payload);
+	if (parser->payload_output != NULL) {
+		o_stream_abort(parser->payload_output);
+		o_stream_destroy(&parser->payload_output);
 	}
+	http_client_request_abort(&parser->http_req);
+	buffer_free(&parser->result);
 	i_free(parser);
 	return ret;
 }
@@ -281,5 +329,6 @@ struct fts_parser_vfuncs fts_parser_tika = {
 	fts_parser_tika_try_init,
 	fts_parser_tika_more,
 	fts_parser_tika_deinit,
-	fts_parser_tika_unload
+	fts_parser_tika_unload,
+	fts_parser_tika_start
 };
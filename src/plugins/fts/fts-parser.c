@@ -37,8 +37,14 @@ bool fts_parser_init(struct fts_parser_context *parser_context,
 		T_BEGIN {
 			*parser_r = parsers[i]->try_init(parser_context);
 		} T_END;
-		if (*parser_r != NULL)
+		if (*parser_r != NULL) {
+			/* cache the text extracted by external decoders */
+			if (parsers[i] != &fts_parser_html) {
+				*parser_r = fts_parser_cache_wrap(parser_context,
+								  *parser_r);
+			}
 			return TRUE;
+		}
 	}
 	return FALSE;
 }
@@ -97,6 +103,13 @@ void fts_parser_more(struct fts_parser *parser, struct message_block *block)
 	}
 }
 
+bool fts_parser_start(struct fts_parser *parser)
+{
+	if (parser->v.start == NULL)
+		return FALSE;
+	return parser->v.start(parser);
+}
+
 int fts_parser_deinit(struct fts_parser **_parser, const char **retriable_err_msg_r)
 {
 	struct fts_parser *parser = *_parser;
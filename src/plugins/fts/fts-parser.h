@@ -19,6 +19,10 @@ struct fts_parser_vfuncs {
 	void (*more)(struct fts_parser *parser, struct message_block *block);
 	int (*deinit)(struct fts_parser *parser, const char **retriable_err_msg_r);
 	void (*unload)(void);
+	/* Optional: Start extracting the text after all the input has been
+	   given, without waiting for the result. Returns TRUE if the
+	   extraction is now running in the background. */
+	bool (*start)(struct fts_parser *parser);
 };
 
 struct fts_parser {
@@ -31,15 +35,29 @@ struct fts_parser {
 extern struct fts_parser_vfuncs fts_parser_html;
 extern struct fts_parser_vfuncs fts_parser_script;
 extern struct fts_parser_vfuncs fts_parser_tika;
+extern struct fts_parser_vfuncs fts_parser_cache;
 
 bool fts_parser_init(struct fts_parser_context *parser_context,
 		     struct fts_parser **parser_r);
 struct fts_parser *fts_parser_text_init(void);
+/* Wrap the parser so that the extracted text is looked up from and stored to
+   the fts_decoder_cache dict, keyed by the hash of the part's content. The
+   content is buffered and given to the parser only if the text isn't found
+   from the cache. Returns the parser itself if there's no cache configured. */
+struct fts_parser *
+fts_parser_cache_wrap(struct fts_parser_context *parser_context,
+		      struct fts_parser *parser);
 
 /* The parser is initially called with message body blocks. Once message is
    finished, it's still called with incoming size=0 while the parser increases
    it to non-zero. */
 void fts_parser_more(struct fts_parser *parser, struct message_block *block);
+/* Called after all the input has been given to fts_parser_more(). Returns TRUE
+   if the parser started extracting the text asynchronously. The caller can
+   then do other work before calling fts_parser_more() to get the output,
+   which waits for the extraction to finish if necessary. Returns FALSE if the
+   output is available only via the synchronous fts_parser_more() calls. */
+bool fts_parser_start(struct fts_parser *parser);
 /* Returns 1 if ok, 0 if the parsing should be retried, -1 if error.
    If 0 is returned, the retriable_err_msg_r is set, which should be logged
    as error if no retrying is performed. */
@@ -20,6 +20,10 @@ static const struct setting_define fts_setting_defines[] = {
 	DEF(STR,     decoder_script_socket_path),
 	{ .type = SET_FILTER_NAME, .key = FTS_FILTER_DECODER_TIKA },
 	DEF(STR,     decoder_tika_url),
+	DEF(UINT,    decoder_max_concurrency),
+	{ .type = SET_FILTER_NAME, .key = FTS_FILTER_DECODER_CACHE,
+	  .required_setting = "dict", },
+	DEF(SIZE,    decoder_cache_max_size),
 	DEF(STR,     driver),
 	DEF(BOOL,    search),
 	DEF(ENUM,    search_add_missing),
@@ -52,6 +56,8 @@ static const struct fts_settings fts_default_settings = {
 		       ":"FTS_DECODER_KEYWORD_SCRIPT,
 	.decoder_script_socket_path = "",
 	.decoder_tika_url = "",
+	.decoder_max_concurrency = 4,
+	.decoder_cache_max_size = 1024*1024,
 	.driver = "",
 	.search = TRUE,
 	.search_add_missing = FTS_SEARCH_ADD_MISSING_BODY_SEARCH_ONLY":yes",
@@ -67,7 +73,7 @@ static const struct fts_settings fts_default_settings = {
 
 static const struct setting_keyvalue fts_default_settings_keyvalue[] = {
 	{ FTS_FILTER_DECODER_TIKA"/http_client_max_idle_time", "100ms" },
-	{ FTS_FILTER_DECODER_TIKA"/http_client_max_parallel_connections", "1" },
+	{ FTS_FILTER_DECODER_TIKA"/http_client_max_parallel_connections", "4" },
 	{ FTS_FILTER_DECODER_TIKA"/http_client_max_pipelined_requests", "1" },
 	{ FTS_FILTER_DECODER_TIKA"/http_client_request_max_redirects", "1" },
 	{ FTS_FILTER_DECODER_TIKA"/http_client_request_max_attempts", "3" },
@@ -156,6 +162,10 @@ static bool fts_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 		*error_r = "fts_search_timeout must not be 0";
 		return FALSE;
 	}
+	if (set->decoder_max_concurrency == 0) {
+		*error_r = "fts_decoder_max_concurrency must not be 0";
+		return FALSE;
+	}
 	set->parsed_search_add_missing_body_only =
 		strcmp(set->search_add_missing,
 		       FTS_SEARCH_ADD_MISSING_BODY_SEARCH_ONLY) == 0;
@@ -5,6 +5,7 @@
 /* <settings checks> */
 #define FTS_FILTER		"fts"
 #define FTS_FILTER_DECODER_TIKA	"fts_decoder_tika"
+#define FTS_FILTER_DECODER_CACHE	"fts_decoder_cache"
 
 enum fts_decoder {
 	FTS_DECODER_NO,
@@ -21,6 +22,8 @@ struct fts_settings {
 	const char *decoder_driver;
 	const char *decoder_script_socket_path;
 	const char *decoder_tika_url;
+	unsigned int decoder_max_concurrency;
+	uoff_t decoder_cache_max_size;
 	const char *driver;
 	bool search;
 	const char *search_add_missing;
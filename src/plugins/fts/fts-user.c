@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "module-context.h"
 #include "str-parse.h"
+#include "dict.h"
 #include "mail-user.h"
 #include "mail-storage-private.h"
 #include "language.h"
@@ -21,6 +22,9 @@
 struct fts_user {
 	union mail_user_module_context module_ctx;
 	const struct fts_settings *set;
+
+	struct dict *decoder_cache;
+	bool decoder_cache_initialized;
 };
 
 static MODULE_CONTEXT_DEFINE_INIT(fts_user_module,
@@ -38,6 +42,28 @@ size_t fts_mail_user_message_max_size(struct mail_user *user)
 	return fuser->set->message_max_size;
 }
 
+struct dict *fts_user_get_decoder_cache(struct mail_user *user)
+{
+	struct fts_user *fuser = FTS_USER_CONTEXT_REQUIRE(user);
+	const char *error;
+
+	if (fuser->decoder_cache_initialized)
+		return fuser->decoder_cache;
+	fuser->decoder_cache_initialized = TRUE;
+
+	struct event *event_fts = event_create(user->event);
+	settings_event_add_filter_name(event_fts, FTS_FILTER);
+	struct event *event = event_create(event_fts);
+	settings_event_add_filter_name(event, FTS_FILTER_DECODER_CACHE);
+	if (dict_init_auto(event, &fuser->decoder_cache, &error) < 0) {
+		e_error(user->event, "fts_decoder_cache: dict_init_auto() failed: %s",
+			error);
+	}
+	event_unref(&event);
+	event_unref(&event_fts);
+	return fuser->decoder_cache;
+}
+
 int fts_mail_user_init(struct mail_user *user, struct event *event,
 		       bool initialize_libfts, const char **error_r)
 {
@@ -63,6 +89,10 @@ static void fts_mail_user_deinit(struct mail_user *user)
 {
 	struct fts_user *fuser = FTS_USER_CONTEXT_REQUIRE(user);
 
+	if (fuser->decoder_cache != NULL) {
+		dict_wait(fuser->decoder_cache);
+		dict_deinit(&fuser->decoder_cache);
+	}
 	settings_free(fuser->set);
 	lang_user_deinit(user);
 	fuser->module_ctx.super.deinit(user);
@@ -6,6 +6,9 @@
 const struct fts_settings *fts_user_get_settings(struct mail_user *user);
 
 size_t fts_mail_user_message_max_size(struct mail_user *user);
+/* Returns the dict used for caching text extracted by the decoders, or NULL
+   if fts_decoder_cache isn't configured. */
+struct dict *fts_user_get_decoder_cache(struct mail_user *user);
 
 int fts_mail_user_init(struct mail_user *user, struct event *event,
 		       bool initialize_libfts, const char **error_r);
@@ -0,0 +1,565 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "istream.h"
+#include "net.h"
+#include "sleep.h"
+#include "write-full.h"
+#include "module-dir.h"
+#include "settings.h"
+#include "master-service.h"
+#include "http-client.h"
+#include "lang-settings.h"
+#include "test-common.h"
+#include "test-dir.h"
+#include "test-mail-storage-common.h"
+#include "fts-api-private.h"
+#include "fts-build-mail.h"
+#include "fts-plugin.h"
+#include "fts-settings.h"
+#include "fts-user.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* The fake Tika server delays the response to content starting with this */
+#define TEST_TIKA_SLOW_PREFIX "slow"
+#define TEST_TIKA_SLOW_MSECS 200
+/* The response to content starting with "wait" is delayed until content
+   starting with "wake" has been received, or until the timeout. */
+#define TEST_TIKA_WAIT_PREFIX "wait"
+#define TEST_TIKA_WAKE_PREFIX "wake"
+#define TEST_TIKA_WAIT_TIMEOUT_MSECS 1000
+#define TEST_TIKA_WAIT_POLL_MSECS 10
+
+static const char test_mail[] =
+"From: sender@example.com\n"
+"Subject: attachments\n"
+"MIME-Version: 1.0\n"
+"Content-Type: multipart/mixed; boundary=\"b\"\n"
+"\n"
+"--b\n"
+"Content-Type: application/x-first\n"
+"\n"
+"slow first\n"
+"--b\n"
+"Content-Type: text/plain\n"
+"\n"
+"body text\n"
+"--b\n"
+"Content-Type: application/x-second\n"
+"\n"
+"second\n"
+"--b\n"
+"Content-Type: application/x-third\n"
+"\n"
+"third\n"
+"--b--\n";
+
+/* The text parts are added as soon as they're parsed. The extracted texts
+   are added in the order of the parts, even though the first one is the last
+   to be returned by the server. */
+static const char test_mail_expected_concurrent[] =
+"1 text/plain: body text\n"
+"1 application/x-first: EXTRACTED slow first\n"
+"1 application/x-second: EXTRACTED second\n"
+"1 application/x-third: EXTRACTED third\n";
+/* With fts_decoder_max_concurrency=1 each part is extracted before the next
+   one is parsed. */
+static const char test_mail_expected_serial[] =
+"1 application/x-first: EXTRACTED slow first\n"
+"1 text/plain: body text\n"
+"1 application/x-second: EXTRACTED second\n"
+"1 application/x-third: EXTRACTED third\n";
+
+/* The first mail's attachment is extracted only after the second mail's
+   attachment has been sent to the server. */
+static const char test_mail_wait[] =
+"From: sender@example.com\n"
+"Subject: wait\n"
+"MIME-Version: 1.0\n"
+"Content-Type: multipart/mixed; boundary=\"b\"\n"
+"\n"
+"--b\n"
+"Content-Type: text/plain\n"
+"\n"
+"first body\n"
+"--b\n"
+"Content-Type: application/x-wait\n"
+"\n"
+"wait\n"
+"--b--\n";
+static const char test_mail_wake[] =
+"From: sender@example.com\n"
+"Subject: wake\n"
+"MIME-Version: 1.0\n"
+"Content-Type: multipart/mixed; boundary=\"b\"\n"
+"\n"
+"--b\n"
+"Content-Type: application/x-wake\n"
+"\n"
+"wake\n"
+"--b\n"
+"Content-Type: text/plain\n"
+"\n"
+"second body\n"
+"--b--\n";
+
+/* Each mail's text is still given to the backend in one piece. */
+static const char test_mails_expected_carried[] =
+"1 text/plain: first body\n"
+"1 application/x-wait: EXTRACTED wait\n"
+"2 text/plain: second body\n"
+"2 application/x-wake: EXTRACTED wake\n";
+/* With fts_decoder_max_concurrency=1 the first mail's attachment must be
+   extracted before the second one can be sent. */
+static const char test_mails_expected_serial[] =
+"1 text/plain: first body\n"
+"1 application/x-wait: TIMED OUT wait\n"
+"2 application/x-wake: EXTRACTED wake\n"
+"2 text/plain: second body\n";
+
+struct test_fts_backend_update_context {
+	struct fts_backend_update_context ctx;
+	uint32_t uid;
+	char *content_type;
+	string_t *text;
+};
+
+static struct module test_fts_module = {
+	.path = "lib20_fts_plugin.so",
+	.name = "fts_plugin",
+};
+
+static struct test_mail_storage_ctx *test_ctx;
+static in_port_t test_tika_port;
+static pid_t test_tika_pid;
+/* created by the fake Tika server when it receives the "wake" content */
+static char *test_tika_wake_path;
+static unsigned int test_mailbox_counter;
+/* "<uid> <content type>: <text>" lines in the order they were indexed */
+static string_t *test_indexed;
+
+static bool test_tika_content_has_prefix(const char *content,
+					 size_t content_size,
+					 const char *prefix)
+{
+	return content_size >= strlen(prefix) &&
+		memcmp(content, prefix, strlen(prefix)) == 0;
+}
+
+static bool test_tika_server_wait(void)
+{
+	unsigned int msecs;
+
+	for (msecs = 0; msecs < TEST_TIKA_WAIT_TIMEOUT_MSECS;
+	     msecs += TEST_TIKA_WAIT_POLL_MSECS) {
+		if (access(test_tika_wake_path, F_OK) == 0)
+			return TRUE;
+		i_sleep_msecs(TEST_TIKA_WAIT_POLL_MSECS);
+	}
+	return FALSE;
+}
+
+static void test_tika_server_reply(int fd, const char *content,
+				   size_t content_size)
+{
+	string_t *reply = t_str_new(256);
+	const char *text_prefix = "EXTRACTED ";
+	int wake_fd;
+
+	if (test_tika_content_has_prefix(content, content_size,
+					 TEST_TIKA_SLOW_PREFIX))
+		i_sleep_msecs(TEST_TIKA_SLOW_MSECS);
+	else if (test_tika_content_has_prefix(content, content_size,
+					      TEST_TIKA_WAIT_PREFIX)) {
+		if (!test_tika_server_wait())
+			text_prefix = "TIMED OUT ";
+	} else if (test_tika_content_has_prefix(content, content_size,
+						TEST_TIKA_WAKE_PREFIX)) {
+		wake_fd = creat(test_tika_wake_path, 0600);
+		if (wake_fd == -1)
+			i_fatal("creat(%s) failed: %m", test_tika_wake_path);
+		i_close_fd(&wake_fd);
+	}
+	str_printfa(reply, "HTTP/1.1 200 OK\r\n"
+		    "Content-Type: text/plain\r\n"
+		    "Content-Length: %zu\r\n\r\n",
+		    strlen(text_prefix) + content_size);
+	str_append(reply, text_prefix);
+	str_append_data(reply, content, content_size);
+	if (write_full(fd, str_data(reply), str_len(reply)) < 0)
+		i_fatal("write() failed: %m");
+}
+
+static void test_tika_server_connection(int fd)
+{
+	struct istream *input = i_stream_create_fd(fd, SIZE_MAX);
+	const char *line, *value;
+	const unsigned char *data;
+	size_t size;
+	uoff_t content_length = 0;
+
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		if (*line != '\0' && strcmp(line, "\r") != 0) {
+			if (str_begins_icase(line, "Content-Length: ", &value) &&
+			    str_to_uoff(t_strcut(value, '\r'),
+					&content_length) < 0)
+				i_fatal("Invalid Content-Length: %s", line);
+			continue;
+		}
+		/* end of headers - read the payload */
+		while (i_stream_get_data_size(input) < content_length) {
+			if (i_stream_read(input) < 0)
+				i_fatal("Payload is truncated");
+		}
+		data = i_stream_get_data(input, &size);
+		T_BEGIN {
+			test_tika_server_reply(fd, (const char *)data,
+					       content_length);
+		} T_END;
+		i_stream_skip(input, content_length);
+		content_length = 0;
+	}
+	i_stream_destroy(&input);
+}
+
+static void test_tika_server(int listen_fd)
+{
+	int fd;
+
+	/* each connection is handled by its own process, so the slow
+	   response doesn't delay the others */
+	for (;;) {
+		fd = net_accept(listen_fd, NULL, NULL);
+		if (fd < 0)
+			i_fatal("accept() failed: %m");
+		pid_t pid = fork();
+		if (pid < 0)
+			i_fatal("fork() failed: %m");
+		if (pid == 0) {
+			i_close_fd(&listen_fd);
+			test_tika_server_connection(fd);
+			_exit(0);
+		}
+		i_close_fd(&fd);
+	}
+}
+
+static void test_tika_server_start(void)
+{
+	struct ip_addr ip;
+	int fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	test_tika_port = 0;
+	fd = net_listen(&ip, &test_tika_port, 128);
+	if (fd < 0)
+		i_fatal("listen() failed: %m");
+	net_set_nonblock(fd, FALSE);
+
+	test_tika_pid = fork();
+	if (test_tika_pid < 0)
+		i_fatal("fork() failed: %m");
+	if (test_tika_pid == 0) {
+		/* the connection processes exit when the client
+		   disconnects */
+		(void)signal(SIGCHLD, SIG_IGN);
+		test_tika_server(fd);
+	}
+	i_close_fd(&fd);
+}
+
+static void test_tika_server_stop(void)
+{
+	if (kill(test_tika_pid, SIGKILL) < 0)
+		i_error("kill() failed: %m");
+	if (waitpid(test_tika_pid, NULL, 0) < 0)
+		i_error("waitpid() failed: %m");
+}
+
+static const struct fts_backend fts_backend_test;
+
+static struct fts_backend *test_fts_backend_alloc(void)
+{
+	struct fts_backend *backend = i_new(struct fts_backend, 1);
+
+	*backend = fts_backend_test;
+	return backend;
+}
+
+static int test_fts_backend_init(struct fts_backend *backend ATTR_UNUSED,
+				 const char **error_r ATTR_UNUSED)
+{
+	return 0;
+}
+
+static void test_fts_backend_deinit(struct fts_backend *backend)
+{
+	i_free(backend);
+}
+
+static struct fts_backend_update_context *
+test_fts_backend_update_init(struct fts_backend *backend)
+{
+	struct test_fts_backend_update_context *ctx;
+
+	ctx = i_new(struct test_fts_backend_update_context, 1);
+	ctx->ctx.backend = backend;
+	ctx->text = str_new(default_pool, 128);
+	return &ctx->ctx;
+}
+
+static int
+test_fts_backend_update_deinit(struct fts_backend_update_context *_ctx)
+{
+	struct test_fts_backend_update_context *ctx =
+		(struct test_fts_backend_update_context *)_ctx;
+
+	str_free(&ctx->text);
+	i_free(ctx->content_type);
+	i_free(ctx);
+	return 0;
+}
+
+static void
+test_fts_backend_update_set_mailbox(struct fts_backend_update_context *ctx ATTR_UNUSED,
+				    struct mailbox *box ATTR_UNUSED)
+{
+}
+
+static bool
+test_fts_backend_update_set_build_key(struct fts_backend_update_context *_ctx,
+				      const struct fts_backend_build_key *key)
+{
+	struct test_fts_backend_update_context *ctx =
+		(struct test_fts_backend_update_context *)_ctx;
+
+	if (key->type != FTS_BACKEND_BUILD_KEY_BODY_PART)
+		return FALSE;
+	ctx->uid = key->uid;
+	i_free(ctx->content_type);
+	ctx->content_type = i_strdup(key->body_content_type);
+	str_truncate(ctx->text, 0);
+	return TRUE;
+}
+
+static void
+test_fts_backend_update_unset_build_key(struct fts_backend_update_context *_ctx)
+{
+	struct test_fts_backend_update_context *ctx =
+		(struct test_fts_backend_update_context *)_ctx;
+
+	/* the key is set once when the part is parsed and again when the
+	   extracted text is added */
+	if (str_len(ctx->text) > 0) {
+		str_printfa(test_indexed, "%u %s: %s\n", ctx->uid,
+			    ctx->content_type, str_c(ctx->text));
+	}
+}
+
+static int
+test_fts_backend_update_build_more(struct fts_backend_update_context *_ctx,
+				   const unsigned char *data, size_t size)
+{
+	struct test_fts_backend_update_context *ctx =
+		(struct test_fts_backend_update_context *)_ctx;
+
+	str_append_data(ctx->text, data, size);
+	return 0;
+}
+
+static const struct fts_backend fts_backend_test = {
+	.name = "test",
+	.v = {
+		.alloc = test_fts_backend_alloc,
+		.init = test_fts_backend_init,
+		.deinit = test_fts_backend_deinit,
+		.update_init = test_fts_backend_update_init,
+		.update_deinit = test_fts_backend_update_deinit,
+		.update_set_mailbox = test_fts_backend_update_set_mailbox,
+		.update_set_build_key = test_fts_backend_update_set_build_key,
+		.update_unset_build_key = test_fts_backend_update_unset_build_key,
+		.update_build_more = test_fts_backend_update_build_more,
+	},
+};
+
+static void test_user_init(unsigned int max_concurrency)
+{
+	const char *error;
+	const char *const extra_input[] = {
+		"mail_plugins=fts",
+		"language=en",
+		"language/en/language_default=yes",
+		"fts_decoder_driver=tika",
+		t_strdup_printf("fts_decoder_tika_url=http://127.0.0.1:%u/",
+				test_tika_port),
+		t_strdup_printf("fts_decoder_max_concurrency=%u",
+				max_concurrency),
+		NULL
+	};
+	struct test_mail_storage_settings storage_set = {
+		.driver = "sdbox",
+		.extra_input = extra_input,
+	};
+
+	test_mail_storage_init_user(test_ctx, &storage_set);
+	if (fts_mail_user_init(test_ctx->user, test_ctx->user->event,
+			       FALSE, &error) < 0)
+		i_fatal("fts_mail_user_init() failed: %s", error);
+}
+
+static void test_mail_save(struct mailbox *box, const char *mail_text)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	int ret;
+
+	input = i_stream_create_from_data(mail_text, strlen(mail_text));
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	if (mailbox_save_begin(&save_ctx, input) < 0)
+		i_fatal("mailbox_save_begin() failed");
+	do {
+		if (mailbox_save_continue(save_ctx) < 0)
+			i_fatal("mailbox_save_continue() failed");
+	} while ((ret = i_stream_read(input)) > 0);
+	i_assert(ret == -1 && input->stream_errno == 0);
+	if (mailbox_save_finish(&save_ctx) < 0 ||
+	    mailbox_transaction_commit(&trans) < 0 ||
+	    mailbox_sync(box, 0) < 0) {
+		i_fatal("Failed to save mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	i_stream_unref(&input);
+}
+
+static const char *
+test_build_mails(unsigned int max_concurrency, const char *const *mail_texts)
+{
+	struct fts_backend *backend;
+	struct fts_backend_update_context *update_ctx;
+	struct mailbox_transaction_context *trans;
+	struct mailbox *box;
+	struct mail *mail;
+	const char *error;
+	unsigned int i, count = str_array_length(mail_texts);
+
+	test_user_init(max_concurrency);
+	/* each call uses an empty mailbox */
+	box = mailbox_alloc(test_ctx->user->namespaces->list,
+			    t_strdup_printf("test%u", ++test_mailbox_counter),
+			    0);
+	if (mailbox_create(box, NULL, FALSE) < 0 || mailbox_open(box) < 0)
+		i_fatal("mailbox_open() failed");
+	for (i = 0; i < count; i++)
+		test_mail_save(box, mail_texts[i]);
+	i_unlink_if_exists(test_tika_wake_path);
+
+	if (fts_backend_init("test", test_ctx->user->namespaces,
+			     test_ctx->user->event, &error, &backend) < 0)
+		i_fatal("fts_backend_init() failed: %s", error);
+	update_ctx = fts_backend_update_init(backend);
+	fts_backend_update_set_mailbox(update_ctx, box);
+
+	str_truncate(test_indexed, 0);
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	for (i = 1; i <= count; i++) {
+		mail_set_seq(mail, i);
+		test_assert(fts_build_mail(update_ctx, mail) == 1);
+	}
+	mail_free(&mail);
+	(void)mailbox_transaction_commit(&trans);
+
+	test_assert(fts_backend_update_deinit(&update_ctx) == 0);
+	fts_backend_deinit(&backend);
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(test_ctx);
+	return str_c(test_indexed);
+}
+
+static const char *test_build_mail(unsigned int max_concurrency)
+{
+	const char *const mail_texts[] = { test_mail, NULL };
+
+	return test_build_mails(max_concurrency, mail_texts);
+}
+
+static void test_fts_build_mail_pending_extractions(void)
+{
+	test_begin("fts build mail pending extractions");
+	test_assert_strcmp(test_build_mail(4), test_mail_expected_concurrent);
+	test_assert_strcmp(test_build_mail(2), test_mail_expected_concurrent);
+	test_assert_strcmp(test_build_mail(1), test_mail_expected_serial);
+	test_end();
+}
+
+static void test_fts_build_mail_pending_extractions_carried(void)
+{
+	const char *const mail_texts[] = {
+		test_mail_wait, test_mail_wake, NULL
+	};
+
+	test_begin("fts build mail pending extractions carried to next mail");
+	test_assert_strcmp(test_build_mails(2, mail_texts),
+			   test_mails_expected_carried);
+	test_assert_strcmp(test_build_mails(1, mail_texts),
+			   test_mails_expected_serial);
+	test_end();
+}
+
+static void test_setup(void)
+{
+	test_ctx = test_mail_storage_init();
+	fts_plugin_init(&test_fts_module);
+	fts_backend_register(&fts_backend_test);
+	test_indexed = str_new(default_pool, 256);
+	test_tika_wake_path = i_strdup(test_dir_prepend("tika-wake"));
+	test_tika_server_start();
+}
+
+static void test_teardown(void)
+{
+	test_tika_server_stop();
+	i_free(test_tika_wake_path);
+	str_free(&test_indexed);
+	fts_backend_unregister(fts_backend_test.name);
+	fts_plugin_deinit();
+	test_mail_storage_deinit(&test_ctx);
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_setup,
+		test_fts_build_mail_pending_extractions,
+		test_fts_build_mail_pending_extractions_carried,
+		test_teardown,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-fts-build-mail",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	settings_info_register(&fts_setting_parser_info);
+	settings_info_register(&langs_setting_parser_info);
+	settings_info_register(&http_client_setting_parser_info);
+
+	test_dir_init("test-fts-build-mail");
+	ret = test_run(tests);
+
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -0,0 +1,284 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "module-dir.h"
+#include "settings.h"
+#include "master-service.h"
+#include "dict.h"
+#include "lang-settings.h"
+#include "message-parser.h"
+#include "mail-user.h"
+#include "test-common.h"
+#include "test-dir.h"
+#include "test-mail-storage-common.h"
+#include "fts-parser.h"
+#include "fts-plugin.h"
+#include "fts-settings.h"
+#include "fts-user.h"
+
+#include <ctype.h>
+
+#define TEST_CACHE_MAX_SIZE 100
+
+struct test_fts_parser {
+	struct fts_parser parser;
+	string_t *output;
+	bool input_received;
+	bool output_returned;
+};
+
+static struct module test_fts_module = {
+	.path = "lib20_fts_plugin.so",
+	.name = "fts_plugin",
+};
+
+static struct test_mail_storage_ctx *test_ctx;
+/* number of times the test parser has been given the content */
+static unsigned int test_extract_count;
+
+static void test_fts_parser_more(struct fts_parser *_parser,
+				 struct message_block *block)
+{
+	struct test_fts_parser *parser = (struct test_fts_parser *)_parser;
+
+	if (block->size > 0) {
+		if (!parser->input_received) {
+			parser->input_received = TRUE;
+			test_extract_count++;
+		}
+		/* the "extracted" text is the input in uppercase */
+		for (size_t i = 0; i < block->size; i++)
+			str_append_c(parser->output, i_toupper(block->data[i]));
+		block->size = 0;
+		return;
+	}
+	if (!parser->output_returned) {
+		block->data = str_data(parser->output);
+		block->size = str_len(parser->output);
+		parser->output_returned = TRUE;
+	}
+}
+
+static int test_fts_parser_deinit(struct fts_parser *_parser,
+				  const char **retriable_err_msg_r ATTR_UNUSED)
+{
+	struct test_fts_parser *parser = (struct test_fts_parser *)_parser;
+
+	str_free(&parser->output);
+	i_free(parser);
+	return 1;
+}
+
+static struct fts_parser_vfuncs test_fts_parser_vfuncs = {
+	.more = test_fts_parser_more,
+	.deinit = test_fts_parser_deinit,
+};
+
+static const char *
+test_extract(const char *content_type, const void *data, size_t size)
+{
+	struct fts_parser_context parser_context = {
+		.user = test_ctx->user,
+		.content_type = content_type,
+		.event = test_ctx->user->event,
+	};
+	struct test_fts_parser *test_parser;
+	struct fts_parser *parser;
+	struct message_block block;
+	string_t *text = t_str_new(128);
+
+	test_parser = i_new(struct test_fts_parser, 1);
+	test_parser->parser.v = test_fts_parser_vfuncs;
+	test_parser->output = str_new(default_pool, 128);
+	parser = fts_parser_cache_wrap(&parser_context, &test_parser->parser);
+	test_assert(parser != &test_parser->parser);
+
+	/* give the input in two blocks */
+	i_zero(&block);
+	block.data = data;
+	block.size = size / 2;
+	fts_parser_more(parser, &block);
+	test_assert(block.size == 0);
+	block.data = CONST_PTR_OFFSET(data, size / 2);
+	block.size = size - size / 2;
+	fts_parser_more(parser, &block);
+	test_assert(block.size == 0);
+	/* the test parser extracts the text synchronously */
+	test_assert(!fts_parser_start(parser));
+
+	do {
+		i_zero(&block);
+		fts_parser_more(parser, &block);
+		str_append_data(text, block.data, block.size);
+	} while (block.size > 0);
+	test_assert(fts_parser_deinit(&parser, NULL) == 1);
+
+	/* finish storing the text to the cache */
+	dict_wait(fts_user_get_decoder_cache(test_ctx->user));
+	return str_c(text);
+}
+
+static void test_fts_parser_cache_hit(void)
+{
+	static const char content[] = "attachment content";
+
+	test_begin("fts parser cache hit");
+	test_extract_count = 0;
+	test_assert_strcmp(test_extract("application/x-test", content,
+					strlen(content)),
+			   "ATTACHMENT CONTENT");
+	test_assert(test_extract_count == 1);
+
+	/* same content is looked up from the cache without giving it to
+	   the parser */
+	test_assert_strcmp(test_extract("application/x-test", content,
+					strlen(content)),
+			   "ATTACHMENT CONTENT");
+	test_assert(test_extract_count == 1);
+	test_end();
+}
+
+static void test_fts_parser_cache_miss(void)
+{
+	static const char content[] = "another attachment";
+
+	test_begin("fts parser cache miss");
+	test_extract_count = 0;
+	test_assert_strcmp(test_extract("application/x-test", content,
+					strlen(content)),
+			   "ANOTHER ATTACHMENT");
+	test_assert(test_extract_count == 1);
+	/* the content type is part of the key */
+	test_assert_strcmp(test_extract("application/x-other", content,
+					strlen(content)),
+			   "ANOTHER ATTACHMENT");
+	test_assert(test_extract_count == 2);
+	/* so is the content */
+	test_assert_strcmp(test_extract("application/x-test", content,
+					strlen(content) - 1),
+			   "ANOTHER ATTACHMEN");
+	test_assert(test_extract_count == 3);
+	test_end();
+}
+
+static void test_fts_parser_cache_too_large(void)
+{
+	string_t *content = t_str_new(TEST_CACHE_MAX_SIZE + 1);
+
+	test_begin("fts parser cache output too large");
+	test_extract_count = 0;
+	while (str_len(content) <= TEST_CACHE_MAX_SIZE)
+		str_append_c(content, 'x');
+	const char *expected = t_str_ucase(str_c(content));
+
+	/* the output is larger than fts_decoder_cache_max_size, so it's
+	   extracted every time */
+	test_assert_strcmp(test_extract("application/x-test",
+					str_data(content), str_len(content)),
+			   expected);
+	test_assert_strcmp(test_extract("application/x-test",
+					str_data(content), str_len(content)),
+			   expected);
+	test_assert(test_extract_count == 2);
+
+	/* at the limit it's still cached */
+	str_truncate(content, TEST_CACHE_MAX_SIZE);
+	expected = t_str_ucase(str_c(content));
+	test_assert_strcmp(test_extract("application/x-test",
+					str_data(content), str_len(content)),
+			   expected);
+	test_assert_strcmp(test_extract("application/x-test",
+					str_data(content), str_len(content)),
+			   expected);
+	test_assert(test_extract_count == 3);
+	test_end();
+}
+
+static void test_fts_parser_cache_nul(void)
+{
+	static const unsigned char content[] = "nul\0byte";
+
+	test_begin("fts parser cache NUL bytes");
+	test_extract_count = 0;
+	/* dict values can't contain NULs, so the output isn't cached. The
+	   NULs are replaced with spaces in the returned text. */
+	test_assert_strcmp(test_extract("application/x-test", content,
+					sizeof(content) - 1),
+			   "NUL BYTE");
+	test_assert_strcmp(test_extract("application/x-test", content,
+					sizeof(content) - 1),
+			   "NUL BYTE");
+	test_assert(test_extract_count == 2);
+	test_end();
+}
+
+static void test_setup(void)
+{
+	const char *error;
+
+	test_ctx = test_mail_storage_init();
+	fts_plugin_init(&test_fts_module);
+
+	const char *const extra_input[] = {
+		"mail_plugins=fts",
+		"language=en",
+		"language/en/language_default=yes",
+		"fts_decoder_cache/dict=file",
+		"fts_decoder_cache/dict/file/driver=file",
+		t_strdup_printf("dict_file_path=%s/fts-decoder-cache",
+				test_ctx->home_root),
+		t_strdup_printf("fts_decoder_cache_max_size=%u",
+				TEST_CACHE_MAX_SIZE),
+		NULL
+	};
+	struct test_mail_storage_settings storage_set = {
+		.driver = "sdbox",
+		.extra_input = extra_input,
+	};
+	test_mail_storage_init_user(test_ctx, &storage_set);
+	if (fts_mail_user_init(test_ctx->user, test_ctx->user->event,
+			       FALSE, &error) < 0)
+		i_fatal("fts_mail_user_init() failed: %s", error);
+	if (fts_user_get_decoder_cache(test_ctx->user) == NULL)
+		i_fatal("fts_decoder_cache isn't configured");
+}
+
+static void test_teardown(void)
+{
+	test_mail_storage_deinit_user(test_ctx);
+	fts_plugin_deinit();
+	test_mail_storage_deinit(&test_ctx);
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_setup,
+		test_fts_parser_cache_hit,
+		test_fts_parser_cache_miss,
+		test_fts_parser_cache_too_large,
+		test_fts_parser_cache_nul,
+		test_teardown,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-fts-parser-cache",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	settings_info_register(&dict_setting_parser_info);
+	settings_info_register(&dict_file_setting_parser_info);
+	settings_info_register(&fts_setting_parser_info);
+	settings_info_register(&langs_setting_parser_info);
+
+	test_dir_init("test-fts-parser-cache");
+	ret = test_run(tests);
+
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -99,19 +99,47 @@ cmd_quota_get_alloc(void)
 	return ctx;
 }
 
+struct quota_recalc_cmd_context {
+	struct doveadm_mail_cmd_context ctx;
+	bool due_ledgers;
+};
+
+static int
+cmd_quota_recalc_due_ledgers(struct doveadm_mail_cmd_context *ctx,
+			     struct mail_user *user, struct quota *quota)
+{
+	struct quota_root *const *root;
+	const char *error;
+	int ret = 0;
+
+	array_foreach(&quota->all_roots, root) {
+		if (quota_count_ledger_reconcile_if_due(*root, &error) < 0) {
+			e_error(user->event,
+				"Reconciling quota ledger failed: %s", error);
+			doveadm_mail_failed_error(ctx, MAIL_ERROR_TEMP);
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
 static int
-cmd_quota_recalc_run(struct doveadm_mail_cmd_context *ctx ATTR_UNUSED,
+cmd_quota_recalc_run(struct doveadm_mail_cmd_context *_ctx,
 		     struct mail_user *user)
 {
+	struct quota_recalc_cmd_context *ctx =
+		container_of(_ctx, struct quota_recalc_cmd_context, ctx);
 	struct quota_user *quser = QUOTA_USER_CONTEXT(user);
 	struct quota_root *const *root;
 	struct quota_transaction_context trans;
 
 	if (quser == NULL) {
 		e_error(user->event, "Quota not enabled");
-		doveadm_mail_failed_error(ctx, MAIL_ERROR_NOTFOUND);
+		doveadm_mail_failed_error(_ctx, MAIL_ERROR_NOTFOUND);
 		return -1;
 	}
+	if (ctx->due_ledgers)
+		return cmd_quota_recalc_due_ledgers(_ctx, user, quser->quota);
 
 	i_zero(&trans);
 	trans.quota = quser->quota;
@@ -128,14 +156,23 @@ cmd_quota_recalc_run(struct doveadm_mail_cmd_context *ctx ATTR_UNUSED,
 	return 0;
 }
 
+static void cmd_quota_recalc_init(struct doveadm_mail_cmd_context *_ctx)
+{
+	struct quota_recalc_cmd_context *ctx =
+		container_of(_ctx, struct quota_recalc_cmd_context, ctx);
+
+	ctx->due_ledgers = doveadm_cmd_param_flag(_ctx->cctx, "due-ledgers");
+}
+
 static struct doveadm_mail_cmd_context *
 cmd_quota_recalc_alloc(void)
 {
-	struct doveadm_mail_cmd_context *ctx;
+	struct quota_recalc_cmd_context *ctx;
 
-	ctx = doveadm_mail_cmd_alloc(struct doveadm_mail_cmd_context);
-	ctx->v.run = cmd_quota_recalc_run;
-	return ctx;
+	ctx = doveadm_mail_cmd_alloc(struct quota_recalc_cmd_context);
+	ctx->ctx.v.init = cmd_quota_recalc_init;
+	ctx->ctx.v.run = cmd_quota_recalc_run;
+	return &ctx->ctx;
 }
 
 static struct doveadm_cmd_ver2 quota_commands[] = {
@@ -149,10 +186,11 @@ DOVEADM_CMD_PARAMS_END
 	},
 	{
 		.name = "quota recalc",
-		.usage = "",
+		.usage = "[-d]",
 		.mail_cmd = cmd_quota_recalc_alloc,
 DOVEADM_CMD_PARAMS_START
 DOVEADM_CMD_MAIL_COMMON
+DOVEADM_CMD_PARAM('d', "due-ledgers", CMD_PARAM_BOOL, 0)
 DOVEADM_CMD_PARAMS_END
 	}
 };
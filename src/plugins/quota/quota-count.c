@@ -2,13 +2,33 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "strnum.h"
+#include "dict.h"
 #include "settings.h"
+#include "mail-user.h"
 #include "mailbox-list-iter.h"
 #include "quota-private.h"
 
+#define QUOTA_COUNT_LEDGER_DICT_PATH DICT_PATH_PRIVATE"quota-ledger/"
+#define QUOTA_COUNT_LEDGER_KEY_STORAGE "storage"
+#define QUOTA_COUNT_LEDGER_KEY_MESSAGES "messages"
+#define QUOTA_COUNT_LEDGER_KEY_RECONCILED "reconciled"
+
+struct quota_count_settings {
+	pool_t pool;
+
+	unsigned int quota_count_ledger_reconcile_interval;
+};
+
 struct count_quota_root {
 	struct quota_root root;
 
+	const struct quota_count_settings *set;
+	/* If set, the quota usage is kept in this dict and updated by the
+	   transaction deltas instead of counting all the mailboxes on every
+	   lookup. */
+	struct dict *ledger;
+
 	struct timeval cache_timeval;
 	uint64_t cached_bytes, cached_count;
 };
@@ -22,6 +42,30 @@ struct quota_mailbox_iter {
 	const char *error;
 };
 
+#undef DEF
+#define DEF(type, name) \
+	SETTING_DEFINE_STRUCT_##type(#name, name, struct quota_count_settings)
+static const struct setting_define quota_count_setting_defines[] = {
+	{ .type = SET_FILTER_NAME, .key = "quota_count_ledger",
+	  .required_setting = "dict", },
+	DEF(TIME, quota_count_ledger_reconcile_interval),
+
+	SETTING_DEFINE_LIST_END
+};
+
+static const struct quota_count_settings quota_count_default_settings = {
+	.quota_count_ledger_reconcile_interval = 60*60*24,
+};
+
+const struct setting_parser_info quota_count_setting_parser_info = {
+	.name = "quota_count",
+	.plugin_dependency = "lib10_quota_plugin",
+	.defines = quota_count_setting_defines,
+	.defaults = &quota_count_default_settings,
+	.struct_size = sizeof(struct quota_count_settings),
+	.pool_offset1 = 1 + offsetof(struct quota_count_settings, pool),
+};
+
 extern struct quota_backend quota_backend_count;
 
 static int
@@ -234,15 +278,41 @@ static struct quota_root *count_quota_alloc(void)
 	return &root->root;
 }
 
-static int count_quota_init(struct quota_root *root,
-			    const char **error_r ATTR_UNUSED)
+static int count_quota_init(struct quota_root *_root, const char **error_r)
 {
-	root->auto_updating = TRUE;
+	struct count_quota_root *root = (struct count_quota_root *)_root;
+	const char *error;
+	int ret;
+
+	if (settings_get(_root->backend.event, &quota_count_setting_parser_info,
+			 0, &root->set, error_r) < 0)
+		return -1;
+
+	struct event *event = event_create(_root->backend.event);
+	settings_event_add_filter_name(event, "quota_count_ledger");
+	ret = dict_init_auto(event, &root->ledger, &error);
+	event_unref(&event);
+	if (ret < 0) {
+		*error_r = t_strdup_printf(
+			"quota_count_ledger: dict_init_auto() failed: %s", error);
+		settings_free(root->set);
+		return -1;
+	}
+	/* With the ledger the usage changes need to be tracked, so they can
+	   be applied to it. */
+	_root->auto_updating = root->ledger == NULL;
 	return 0;
 }
 
 static void count_quota_deinit(struct quota_root *_root)
 {
+	struct count_quota_root *root = (struct count_quota_root *)_root;
+
+	if (root->ledger != NULL) {
+		dict_wait(root->ledger);
+		dict_deinit(&root->ledger);
+	}
+	settings_free(root->set);
 	i_free(_root);
 }
 
@@ -255,6 +325,183 @@ count_quota_root_get_resources(struct quota_root *root ATTR_UNUSED)
 	return resources;
 }
 
+static const char *
+quota_count_ledger_key(struct count_quota_root *root, const char *name)
+{
+	return t_strconcat(QUOTA_COUNT_LEDGER_DICT_PATH,
+			   root->root.set_filter_name, "/", name, NULL);
+}
+
+static int
+quota_count_ledger_lookup(struct count_quota_root *root, const char *name,
+			  int64_t *value_r, const char **error_r)
+{
+	const char *key = quota_count_ledger_key(root, name);
+	const char *value, *error;
+	int ret;
+
+	ret = dict_lookup(root->ledger,
+			  mail_user_get_dict_op_settings(root->root.quota->user),
+			  pool_datastack_create(), key, &value, &error);
+	if (ret < 0) {
+		*error_r = t_strdup_printf(
+			"quota_count_ledger: dict_lookup(%s) failed: %s",
+			key, error);
+		return -1;
+	}
+	if (ret == 0)
+		return 0;
+	if (str_to_int64(value, value_r) < 0) {
+		e_debug(root->root.backend.event, "quota_count_ledger: "
+			"Invalid %s value: %s", key, value);
+		return 0;
+	}
+	return 1;
+}
+
+static int
+quota_count_ledger_reconcile(struct count_quota_root *root,
+			     uint64_t *bytes_r, uint64_t *count_r,
+			     enum quota_get_result *error_result_r,
+			     const char **error_r)
+{
+	struct dict_transaction_context *trans;
+	int64_t old_bytes, old_count;
+	const char *error;
+	int ret;
+
+	/* Other processes may commit changes while the mailboxes are being
+	   recounted. Their increments must not be overwritten, so if the
+	   ledger already exists only the difference is applied to it. */
+	if ((ret = quota_count_ledger_lookup(root,
+			QUOTA_COUNT_LEDGER_KEY_STORAGE,
+			&old_bytes, error_r)) > 0) {
+		ret = quota_count_ledger_lookup(root,
+			QUOTA_COUNT_LEDGER_KEY_MESSAGES, &old_count, error_r);
+	}
+	if (ret < 0) {
+		*error_result_r = QUOTA_GET_RESULT_INTERNAL_ERROR;
+		return -1;
+	}
+	bool exists = ret > 0;
+
+	ret = quota_count(&root->root, bytes_r, count_r,
+			  error_result_r, error_r);
+	if (ret <= 0)
+		return ret;
+
+	e_debug(root->root.backend.event, "quota_count_ledger: "
+		"Reconciled to bytes=%"PRIu64" count=%"PRIu64,
+		*bytes_r, *count_r);
+	trans = dict_transaction_begin(root->ledger,
+		mail_user_get_dict_op_settings(root->root.quota->user));
+	if (!exists) {
+		dict_set(trans, quota_count_ledger_key(root,
+				QUOTA_COUNT_LEDGER_KEY_STORAGE),
+			 dec2str(*bytes_r));
+		dict_set(trans, quota_count_ledger_key(root,
+				QUOTA_COUNT_LEDGER_KEY_MESSAGES),
+			 dec2str(*count_r));
+	} else {
+		if ((int64_t)*bytes_r != old_bytes) {
+			dict_atomic_inc(trans, quota_count_ledger_key(root,
+					QUOTA_COUNT_LEDGER_KEY_STORAGE),
+				(int64_t)*bytes_r - old_bytes);
+		}
+		if ((int64_t)*count_r != old_count) {
+			dict_atomic_inc(trans, quota_count_ledger_key(root,
+					QUOTA_COUNT_LEDGER_KEY_MESSAGES),
+				(int64_t)*count_r - old_count);
+		}
+	}
+	dict_set(trans, quota_count_ledger_key(root,
+			QUOTA_COUNT_LEDGER_KEY_RECONCILED), dec2str(ioloop_time));
+	if (dict_transaction_commit(&trans, &error) < 0) {
+		*error_r = t_strdup_printf("quota_count_ledger: "
+			"dict_transaction_commit() failed: %s", error);
+		*error_result_r = QUOTA_GET_RESULT_INTERNAL_ERROR;
+		return -1;
+	}
+	root->cache_timeval.tv_sec = 0;
+	return 1;
+}
+
+int quota_count_ledger_reconcile_if_due(struct quota_root *_root,
+					const char **error_r)
+{
+	struct count_quota_root *root = (struct count_quota_root *)_root;
+	enum quota_get_result error_res;
+	uint64_t bytes, count;
+	int64_t reconciled;
+	int ret;
+
+	if (_root->backend.name != quota_backend_count.name ||
+	    root->ledger == NULL)
+		return 0;
+
+	ret = quota_count_ledger_lookup(root, QUOTA_COUNT_LEDGER_KEY_RECONCILED,
+					&reconciled, error_r);
+	if (ret < 0)
+		return -1;
+	if (ret > 0 && (root->set->quota_count_ledger_reconcile_interval == 0 ||
+			reconciled + root->set->quota_count_ledger_reconcile_interval >
+			ioloop_time))
+		return 0;
+	if (quota_count_ledger_reconcile(root, &bytes, &count,
+					 &error_res, error_r) < 0)
+		return -1;
+	return 1;
+}
+
+static enum quota_get_result
+quota_count_ledger_get(struct count_quota_root *root,
+		       uint64_t *bytes_r, uint64_t *count_r,
+		       const char **error_r)
+{
+	enum quota_get_result error_res;
+	int64_t reconciled, bytes, count;
+	int ret;
+
+	if (root->cache_timeval.tv_usec == ioloop_timeval.tv_usec &&
+	    root->cache_timeval.tv_sec == ioloop_timeval.tv_sec &&
+	    ioloop_timeval.tv_sec != 0) {
+		*bytes_r = root->cached_bytes;
+		*count_r = root->cached_count;
+		return QUOTA_GET_RESULT_LIMITED;
+	}
+
+	/* The periodic reconciliation is done by doveadm quota recalc -d,
+	   so the lookups never need to recount. */
+	if ((ret = quota_count_ledger_lookup(root,
+			QUOTA_COUNT_LEDGER_KEY_RECONCILED,
+			&reconciled, error_r)) > 0 &&
+	    (ret = quota_count_ledger_lookup(root,
+			QUOTA_COUNT_LEDGER_KEY_STORAGE,
+			&bytes, error_r)) > 0) {
+		ret = quota_count_ledger_lookup(root,
+			QUOTA_COUNT_LEDGER_KEY_MESSAGES, &count, error_r);
+	}
+	if (ret < 0)
+		return QUOTA_GET_RESULT_INTERNAL_ERROR;
+	if (ret == 0 || bytes < 0 || count < 0) {
+		/* The ledger hasn't been initialized yet, or a delta was
+		   applied to a missing value. */
+		ret = quota_count_ledger_reconcile(root, bytes_r, count_r,
+						   &error_res, error_r);
+		if (ret < 0)
+			return error_res;
+		if (ret == 0)
+			return QUOTA_GET_RESULT_LIMITED;
+	} else {
+		*bytes_r = bytes;
+		*count_r = count;
+	}
+	root->cache_timeval = ioloop_timeval;
+	root->cached_bytes = *bytes_r;
+	root->cached_count = *count_r;
+	return QUOTA_GET_RESULT_LIMITED;
+}
+
 static enum quota_get_result
 count_quota_get_resource(struct quota_root *_root,
 			 const char *name, uint64_t *value_r,
@@ -264,7 +511,10 @@ count_quota_get_resource(struct quota_root *_root,
 	uint64_t bytes, count;
 	enum quota_get_result ret;
 
-	ret = quota_count_cached(root, &bytes, &count, error_r);
+	if (root->ledger != NULL)
+		ret = quota_count_ledger_get(root, &bytes, &count, error_r);
+	else
+		ret = quota_count_cached(root, &bytes, &count, error_r);
 	if (ret <= QUOTA_GET_RESULT_INTERNAL_ERROR)
 		return ret;
 
@@ -362,6 +612,42 @@ static int quota_count_recalculate(struct quota_root *root,
 	return ret;
 }
 
+static int
+quota_count_ledger_update(struct count_quota_root *root,
+			  struct quota_transaction_context *ctx,
+			  const char **error_r)
+{
+	struct dict_transaction_context *trans;
+	enum quota_get_result error_res;
+	uint64_t bytes, count;
+	const char *error;
+	int ret;
+
+	if (ctx->recalculate != QUOTA_RECALCULATE_DONT) {
+		/* the deltas are incomplete */
+		ret = quota_count_ledger_reconcile(root, &bytes, &count,
+						   &error_res, error_r);
+		return ret < 0 ? -1 : 0;
+	}
+	if (ctx->bytes_used == 0 && ctx->count_used == 0)
+		return 0;
+
+	trans = dict_transaction_begin(root->ledger,
+		mail_user_get_dict_op_settings(root->root.quota->user));
+	dict_atomic_inc(trans, quota_count_ledger_key(root,
+			QUOTA_COUNT_LEDGER_KEY_STORAGE), ctx->bytes_used);
+	dict_atomic_inc(trans, quota_count_ledger_key(root,
+			QUOTA_COUNT_LEDGER_KEY_MESSAGES), ctx->count_used);
+	/* DICT_COMMIT_RET_NOTFOUND means the ledger doesn't exist yet. It's
+	   initialized by the next lookup. */
+	if (dict_transaction_commit(&trans, &error) < 0) {
+		*error_r = t_strdup_printf("quota_count_ledger: "
+			"dict_transaction_commit() failed: %s", error);
+		return -1;
+	}
+	return 0;
+}
+
 static int
 count_quota_update(struct quota_root *root,
 		   struct quota_transaction_context *ctx,
@@ -374,6 +660,8 @@ count_quota_update(struct quota_root *root,
 		if (quota_count_recalculate(root, error_r) < 0)
 			return -1;
 	}
+	if (croot->ledger != NULL)
+		return quota_count_ledger_update(croot, ctx, error_r);
 	return 0;
 }
 
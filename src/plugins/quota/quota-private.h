@@ -173,12 +173,20 @@ void quota_remove_user_namespace(struct mail_namespace *ns);
 
 struct quota *quota_get_mail_user_quota(struct mail_user *user);
 
+extern const struct setting_parser_info quota_count_setting_parser_info;
+
 bool quota_root_is_visible(struct quota_root *root, struct mailbox *box);
 
 /* Returns 1 if values were returned successfully, 0 if we're recursing into
    the same function, -1 if error. */
 int quota_count(struct quota_root *root, uint64_t *bytes_r, uint64_t *count_r,
 		enum quota_get_result *error_result_r, const char **error_r);
+/* Recount the count backend's usage ledger if
+   quota_count_ledger_reconcile_interval has passed since it was last
+   reconciled. Returns 1 if reconciled, 0 if the root has no ledger or it
+   isn't due yet, -1 if error. */
+int quota_count_ledger_reconcile_if_due(struct quota_root *root,
+					const char **error_r);
 
 bool quota_warning_match(const struct quota_root_settings *w,
 			 uint64_t bytes_before, uint64_t bytes_current,
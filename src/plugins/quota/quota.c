@@ -1103,19 +1103,32 @@ void quota_transaction_rollback(struct quota_transaction_context **_ctx)
 }
 
 static void quota_alloc_with_size(struct quota_transaction_context *ctx,
-				  uoff_t size, uoff_t expunged_size)
+				  uoff_t size, struct mailbox *expunged_box,
+				  uoff_t expunged_size)
 {
-	unsigned int i;
+	struct quota_root *const *roots;
+	unsigned int i, count;
 
 	ctx->bytes_used += size;
 	ctx->bytes_ceil = ctx->bytes_ceil2;
-	for (i = 0; i < array_count(&ctx->quota->all_roots); i++)
+	roots = array_get(&ctx->quota->all_roots, &count);
+	for (i = 0; i < count; i++)
 		ctx->roots[i].bytes_ceil = ctx->roots[i].bytes_ceil2;
 	ctx->count_used++;
 
-	quota_used_apply_expunged(&ctx->bytes_used, expunged_size);
-	quota_used_apply_expunged(&ctx->count_used,
-				  (expunged_size > 0 ? 1 : 0));
+	if (expunged_size == 0)
+		return;
+	/* The replaced or moved mail is freed by its expunge, which may be
+	   committed in another transaction. Until then it's taken into
+	   account only for the limits, so backends tracking the usage
+	   changes won't free it twice. */
+	for (i = 0; i < count; i++) {
+		if (quota_root_is_visible(roots[i], expunged_box)) {
+			quota_transaction_root_expunged(&ctx->roots[i],
+							1, expunged_size);
+		}
+	}
+	quota_transaction_update_expunged(ctx);
 }
 
 enum quota_alloc_result
@@ -1181,7 +1194,7 @@ quota_try_alloc(struct quota_transaction_context *ctx,
 	   quota_alloc() or quota_free_bytes() was already used within the same
 	   transaction, but that doesn't normally happen. */
 	ctx->auto_updating = FALSE;
-	quota_alloc_with_size(ctx, size, expunged_size);
+	quota_alloc_with_size(ctx, size, expunged_box, expunged_size);
 	return QUOTA_ALLOC_RESULT_OK;
 }
 
@@ -1314,7 +1327,7 @@ void quota_alloc(struct quota_transaction_context *ctx, struct mail *mail)
 		(void)quota_get_mail_size(ctx, mail, &size);
 	}
 
-	quota_alloc_with_size(ctx, size, 0);
+	quota_alloc_with_size(ctx, size, NULL, 0);
 }
 
 void quota_free_bytes(struct quota_transaction_context *ctx,
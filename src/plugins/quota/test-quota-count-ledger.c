@@ -0,0 +1,353 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "strnum.h"
+#include "istream.h"
+#include "module-dir.h"
+#include "settings.h"
+#include "master-service.h"
+#include "dict.h"
+#include "test-common.h"
+#include "test-dir.h"
+#include "test-mail-storage-common.h"
+#include "quota-private.h"
+#include "quota-plugin.h"
+#include "quota-settings.h"
+
+#define TEST_QUOTA_ROOT_NAME "user"
+#define TEST_MAILBOX_COUNT 3
+#define TEST_OPERATION_COUNT 200
+
+static const char *const test_mailbox_names[TEST_MAILBOX_COUNT] = {
+	"INBOX", "Archive", "Trash"
+};
+
+static struct module test_quota_module = {
+	.path = "lib10_quota_plugin.so",
+	.name = "quota_plugin",
+};
+
+static struct test_mail_storage_ctx *test_ctx;
+static struct mailbox *test_boxes[TEST_MAILBOX_COUNT];
+
+static void test_mailbox_sync(struct mailbox *box)
+{
+	if (mailbox_sync(box, 0) < 0)
+		i_fatal("Failed to sync mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+}
+
+static void test_mail_save(struct mailbox *box)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	string_t *mail;
+	unsigned int i, lines = i_rand_limit(100);
+	int ret;
+
+	mail = t_str_new(1024);
+	str_append(mail, "From: sender@example.com\n"
+		   "Subject: quota ledger test\n\n");
+	for (i = 0; i < lines; i++)
+		str_printfa(mail, "line %u of the body\n", i);
+
+	input = i_stream_create_from_data(str_data(mail), str_len(mail));
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	if (mailbox_save_begin(&save_ctx, input) < 0)
+		ret = -1;
+	else {
+		do {
+			if (mailbox_save_continue(save_ctx) < 0) {
+				mailbox_save_cancel(&save_ctx);
+				break;
+			}
+		} while (i_stream_read(input) > 0);
+		ret = save_ctx == NULL ? -1 : mailbox_save_finish(&save_ctx);
+	}
+	i_stream_unref(&input);
+	if (ret < 0)
+		mailbox_transaction_rollback(&trans);
+	else
+		ret = mailbox_transaction_commit(&trans);
+	if (ret < 0) {
+		i_fatal("Failed to save mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	test_mailbox_sync(box);
+}
+
+static void test_mail_expunge_or_move(struct mailbox *box,
+				      struct mailbox *dest_box)
+{
+	struct mailbox_transaction_context *trans, *dest_trans = NULL;
+	struct mail_save_context *save_ctx;
+	struct mail *mail;
+	struct mailbox_status status;
+
+	mailbox_get_open_status(box, STATUS_MESSAGES, &status);
+	if (status.messages == 0)
+		return;
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, i_rand_minmax(1, status.messages));
+	if (dest_box == NULL)
+		mail_expunge(mail);
+	else {
+		dest_trans = mailbox_transaction_begin(dest_box,
+				MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+		save_ctx = mailbox_save_alloc(dest_trans);
+		if (mailbox_move(&save_ctx, mail) < 0)
+			i_fatal("Failed to move mail: %s",
+				mailbox_get_last_internal_error(dest_box, NULL));
+		if (mailbox_transaction_commit(&dest_trans) < 0)
+			i_fatal("Failed to commit move: %s",
+				mailbox_get_last_internal_error(dest_box, NULL));
+	}
+	mail_free(&mail);
+	if (mailbox_transaction_commit(&trans) < 0) {
+		i_fatal("Failed to expunge mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	test_mailbox_sync(box);
+	if (dest_box != NULL)
+		test_mailbox_sync(dest_box);
+}
+
+static void test_quota_ledger_get(struct quota_root *root,
+				  uint64_t *bytes_r, uint64_t *count_r)
+{
+	uint64_t limit;
+	const char *error;
+
+	test_assert(quota_get_resource(root, test_boxes[0],
+				       QUOTA_NAME_STORAGE_BYTES, bytes_r,
+				       &limit, &error) == QUOTA_GET_RESULT_LIMITED);
+	test_assert(quota_get_resource(root, test_boxes[0],
+				       QUOTA_NAME_MESSAGES, count_r,
+				       &limit, &error) == QUOTA_GET_RESULT_LIMITED);
+}
+
+static void test_quota_ledger_check(struct quota_root *root)
+{
+	enum quota_get_result error_res;
+	uint64_t bytes, count, ledger_bytes, ledger_count;
+	const char *error;
+
+	test_quota_ledger_get(root, &ledger_bytes, &ledger_count);
+	test_assert(quota_count(root, &bytes, &count, &error_res, &error) > 0);
+	test_assert_cmp(ledger_bytes, ==, bytes);
+	test_assert_cmp(ledger_count, ==, count);
+}
+
+static void test_quota_count_ledger(void)
+{
+	struct quota_root *root;
+	unsigned int i, src, dest;
+
+	test_begin("quota count ledger");
+	root = quota_root_lookup(test_ctx->user, TEST_QUOTA_ROOT_NAME);
+	test_assert(root != NULL);
+	if (root == NULL) {
+		test_end();
+		return;
+	}
+	test_assert(!root->auto_updating);
+
+	/* the first lookup initializes the ledger */
+	test_quota_ledger_check(root);
+
+	for (i = 0; i < TEST_OPERATION_COUNT; i++) T_BEGIN {
+		src = i_rand_limit(TEST_MAILBOX_COUNT);
+		switch (i_rand_limit(4)) {
+		case 0:
+		case 1:
+			test_mail_save(test_boxes[src]);
+			break;
+		case 2:
+			test_mail_expunge_or_move(test_boxes[src], NULL);
+			break;
+		case 3:
+			dest = (src + 1 + i_rand_limit(TEST_MAILBOX_COUNT - 1)) %
+				TEST_MAILBOX_COUNT;
+			test_mail_expunge_or_move(test_boxes[src],
+						  test_boxes[dest]);
+			break;
+		}
+		/* only the deltas are applied to the ledger - it must
+		   still match the full recount */
+		test_quota_ledger_check(root);
+	} T_END;
+	test_end();
+}
+
+static void test_ledger_add(struct dict *dict, struct quota_root *root,
+			    const char *name, int64_t diff)
+{
+	struct dict_transaction_context *trans;
+	const char *error;
+
+	trans = dict_transaction_begin(dict,
+		mail_user_get_dict_op_settings(test_ctx->user));
+	dict_atomic_inc(trans, t_strdup_printf("priv/quota-ledger/%s/%s",
+					       root->set_filter_name, name),
+			diff);
+	test_assert(dict_transaction_commit(&trans, &error) > 0);
+}
+
+static void test_ledger_set(struct dict *dict, struct quota_root *root,
+			    const char *name, const char *value)
+{
+	struct dict_transaction_context *trans;
+	const char *error;
+
+	trans = dict_transaction_begin(dict,
+		mail_user_get_dict_op_settings(test_ctx->user));
+	dict_set(trans, t_strdup_printf("priv/quota-ledger/%s/%s",
+					root->set_filter_name, name), value);
+	test_assert(dict_transaction_commit(&trans, &error) > 0);
+}
+
+static uint64_t test_ledger_get(struct dict *dict, struct quota_root *root,
+				const char *name)
+{
+	const char *value, *error;
+	uint64_t num = 0;
+
+	test_assert(dict_lookup(dict,
+				mail_user_get_dict_op_settings(test_ctx->user),
+				pool_datastack_create(),
+				t_strdup_printf("priv/quota-ledger/%s/%s",
+						root->set_filter_name, name),
+				&value, &error) > 0 &&
+		    str_to_uint64(value, &num) == 0);
+	return num;
+}
+
+static void test_quota_count_ledger_reconcile(void)
+{
+	enum quota_get_result error_res;
+	struct quota_root *root;
+	struct event *event;
+	struct dict *dict;
+	uint64_t bytes, count, bytes2, count2;
+	const char *error;
+
+	test_begin("quota count ledger reconcile");
+	root = quota_root_lookup(test_ctx->user, TEST_QUOTA_ROOT_NAME);
+	event = event_create(root->backend.event);
+	settings_event_add_filter_name(event, "quota_count_ledger");
+	if (dict_init_auto(event, &dict, &error) <= 0)
+		i_fatal("dict_init_auto() failed: %s", error);
+	event_unref(&event);
+	test_assert(quota_count(root, &bytes, &count, &error_res, &error) > 0);
+
+	/* the ledger was reconciled by the first lookup, so it isn't due */
+	test_ledger_add(dict, root, "storage", 1000);
+	test_assert(quota_count_ledger_reconcile_if_due(root, &error) == 0);
+	test_assert(test_ledger_get(dict, root, "storage") == bytes + 1000);
+
+	/* when it's due, the ledger is fixed to match the recount */
+	test_ledger_set(dict, root, "reconciled", "0");
+	test_assert(quota_count_ledger_reconcile_if_due(root, &error) == 1);
+	test_assert(test_ledger_get(dict, root, "storage") == bytes);
+	test_assert(test_ledger_get(dict, root, "messages") == count);
+	test_assert(quota_count_ledger_reconcile_if_due(root, &error) == 0);
+
+	/* overdue ledgers are still used by the lookups without recounting */
+	test_ledger_set(dict, root, "reconciled", "0");
+	test_ledger_add(dict, root, "messages", 1);
+	test_quota_ledger_get(root, &bytes2, &count2);
+	test_assert(bytes2 == bytes && count2 == count + 1);
+	test_assert(test_ledger_get(dict, root, "reconciled") == 0);
+	test_assert(quota_count_ledger_reconcile_if_due(root, &error) == 1);
+	test_quota_ledger_check(root);
+
+	dict_deinit(&dict);
+	test_end();
+}
+
+static void test_setup(void)
+{
+	const char *username = "quota_test@example.com";
+	unsigned int i;
+
+	test_ctx = test_mail_storage_init();
+	quota_plugin_init(&test_quota_module);
+	const char *const extra_input[] = {
+		"mail_plugins=quota",
+		"quota="TEST_QUOTA_ROOT_NAME,
+		"quota/"TEST_QUOTA_ROOT_NAME"/quota_driver=count",
+		"quota/"TEST_QUOTA_ROOT_NAME"/quota_storage_size=1G",
+		"quota/"TEST_QUOTA_ROOT_NAME"/quota_message_count=10000",
+		"quota_count_ledger/dict=file",
+		"quota_count_ledger/dict/file/driver=file",
+		t_strdup_printf("dict_file_path=%s/%s/quota-ledger",
+				test_ctx->home_root, username),
+		NULL
+	};
+	struct test_mail_storage_settings storage_set = {
+		.username = username,
+		.driver = "sdbox",
+		.extra_input = extra_input,
+	};
+	test_mail_storage_init_user(test_ctx, &storage_set);
+
+	for (i = 0; i < TEST_MAILBOX_COUNT; i++) {
+		test_boxes[i] = mailbox_alloc(test_ctx->user->namespaces->list,
+					      test_mailbox_names[i], 0);
+		if (i > 0 && mailbox_create(test_boxes[i], NULL, FALSE) < 0)
+			i_fatal("Failed to create mailbox: %s",
+				mailbox_get_last_internal_error(test_boxes[i],
+								NULL));
+		if (mailbox_open(test_boxes[i]) < 0)
+			i_fatal("Failed to open mailbox: %s",
+				mailbox_get_last_internal_error(test_boxes[i],
+								NULL));
+	}
+}
+
+static void test_teardown(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < TEST_MAILBOX_COUNT; i++)
+		mailbox_free(&test_boxes[i]);
+	test_mail_storage_deinit_user(test_ctx);
+	quota_plugin_deinit();
+	test_mail_storage_deinit(&test_ctx);
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_setup,
+		test_quota_count_ledger,
+		test_quota_count_ledger_reconcile,
+		test_teardown,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-quota-count-ledger",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	settings_info_register(&dict_setting_parser_info);
+	settings_info_register(&dict_file_setting_parser_info);
+	settings_info_register(&quota_setting_parser_info);
+	settings_info_register(&quota_root_setting_parser_info);
+	settings_info_register(&quota_count_setting_parser_info);
+
+	test_dir_init("test-quota-count-ledger");
+	ret = test_run(tests);
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -0,0 +1,276 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "istream.h"
+#include "module-dir.h"
+#include "settings.h"
+#include "master-service.h"
+#include "test-common.h"
+#include "test-dir.h"
+#include "test-mail-storage-common.h"
+#include "mail-storage-private.h"
+#include "quota-private.h"
+#include "quota-plugin.h"
+#include "quota-settings.h"
+
+/* The maildir backend applies each transaction's usage changes to the
+   maildirsize file, so MOVE and replace must not free the same mail twice:
+   once in the saving transaction and again when it's expunged. */
+
+#define TEST_QUOTA_ROOT_NAME "user"
+
+static struct module test_quota_module = {
+	.path = "lib10_quota_plugin.so",
+	.name = "quota_plugin",
+};
+
+static struct test_mail_storage_ctx *test_ctx;
+static struct mailbox *test_inbox, *test_archive;
+static struct quota_root *test_root;
+
+static void test_mailbox_sync(struct mailbox *box)
+{
+	if (mailbox_sync(box, 0) < 0)
+		i_fatal("Failed to sync mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+}
+
+static void test_mail_save(struct mailbox *box, struct mail *replaced,
+			   unsigned int lines)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	string_t *mail;
+	unsigned int i;
+	int ret;
+
+	mail = t_str_new(1024);
+	str_append(mail, "From: sender@example.com\n"
+		   "Subject: quota maildir test\n\n");
+	for (i = 0; i < lines; i++)
+		str_printfa(mail, "line %u of the body\n", i);
+
+	input = i_stream_create_from_data(str_data(mail), str_len(mail));
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	if (replaced == NULL)
+		ret = mailbox_save_begin(&save_ctx, input);
+	else
+		ret = mailbox_save_begin_replace(&save_ctx, input, replaced);
+	if (ret == 0) {
+		do {
+			if (mailbox_save_continue(save_ctx) < 0) {
+				mailbox_save_cancel(&save_ctx);
+				break;
+			}
+		} while (i_stream_read(input) > 0);
+		ret = save_ctx == NULL ? -1 : mailbox_save_finish(&save_ctx);
+	}
+	i_stream_unref(&input);
+	if (ret < 0)
+		mailbox_transaction_rollback(&trans);
+	else
+		ret = mailbox_transaction_commit(&trans);
+	if (ret < 0) {
+		i_fatal("Failed to save mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	/* the replaced mail's transaction is still open */
+	if (replaced == NULL)
+		test_mailbox_sync(box);
+}
+
+static void test_quota_get(uint64_t *bytes_r, uint64_t *count_r)
+{
+	uint64_t limit;
+	const char *error;
+
+	test_assert(quota_get_resource(test_root, test_inbox,
+				       QUOTA_NAME_STORAGE_BYTES, bytes_r,
+				       &limit, &error) == QUOTA_GET_RESULT_LIMITED);
+	test_assert(quota_get_resource(test_root, test_inbox,
+				       QUOTA_NAME_MESSAGES, count_r,
+				       &limit, &error) == QUOTA_GET_RESULT_LIMITED);
+}
+
+static void
+test_mailbox_count(struct mailbox *box, uint64_t *bytes, uint64_t *count)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+	uint32_t seq, messages;
+	uoff_t size;
+
+	messages = mail_index_view_get_messages_count(box->view);
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	for (seq = 1; seq <= messages; seq++) {
+		mail_set_seq(mail, seq);
+		test_assert(mail_get_physical_size(mail, &size) == 0);
+		*bytes += size;
+		*count += 1;
+	}
+	mail_free(&mail);
+	(void)mailbox_transaction_commit(&trans);
+}
+
+/* Check that the maildirsize usage matches the mailboxes' contents. The
+   maildir backend counts physical sizes, unlike quota_count(). */
+static void test_quota_check(void)
+{
+	uint64_t bytes = 0, count = 0, used_bytes, used_count;
+
+	test_mailbox_count(test_inbox, &bytes, &count);
+	test_mailbox_count(test_archive, &bytes, &count);
+	test_quota_get(&used_bytes, &used_count);
+	test_assert_cmp(used_bytes, ==, bytes);
+	test_assert_cmp(used_count, ==, count);
+}
+
+static void test_quota_maildir_move(void)
+{
+	struct mailbox_transaction_context *trans, *dest_trans;
+	struct mail_save_context *save_ctx;
+	struct mail *mail;
+	uint64_t bytes, count, bytes2, count2;
+
+	test_begin("quota maildir move");
+	test_mail_save(test_inbox, NULL, 10);
+	test_mail_save(test_inbox, NULL, 20);
+	test_quota_check();
+	test_quota_get(&bytes, &count);
+	test_assert(count == 2);
+
+	trans = mailbox_transaction_begin(test_inbox, 0, __func__);
+	dest_trans = mailbox_transaction_begin(test_archive,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, 1);
+	save_ctx = mailbox_save_alloc(dest_trans);
+	if (mailbox_move(&save_ctx, mail) < 0 ||
+	    mailbox_transaction_commit(&dest_trans) < 0)
+		i_fatal("Failed to move mail: %s",
+			mailbox_get_last_internal_error(test_archive, NULL));
+	mail_free(&mail);
+	if (mailbox_transaction_commit(&trans) < 0)
+		i_fatal("Failed to expunge mail: %s",
+			mailbox_get_last_internal_error(test_inbox, NULL));
+	test_mailbox_sync(test_inbox);
+	test_mailbox_sync(test_archive);
+
+	/* moving within the same quota root doesn't change the usage */
+	test_quota_get(&bytes2, &count2);
+	test_assert_cmp(bytes2, ==, bytes);
+	test_assert_cmp(count2, ==, count);
+	test_quota_check();
+	test_end();
+}
+
+static void test_quota_maildir_replace(void)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+	uoff_t old_size, new_size;
+	uint64_t bytes, count, bytes2, count2;
+
+	test_begin("quota maildir replace");
+	test_quota_get(&bytes, &count);
+
+	trans = mailbox_transaction_begin(test_inbox, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, 1);
+	test_assert(mail_get_physical_size(mail, &old_size) == 0);
+	test_mail_save(test_inbox, mail, 50);
+	mail_free(&mail);
+	if (mailbox_transaction_commit(&trans) < 0)
+		i_fatal("Failed to expunge mail: %s",
+			mailbox_get_last_internal_error(test_inbox, NULL));
+	test_mailbox_sync(test_inbox);
+
+	/* the replacing mail is the only one left in INBOX */
+	trans = mailbox_transaction_begin(test_inbox, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, 1);
+	test_assert(mail_get_physical_size(mail, &new_size) == 0);
+	mail_free(&mail);
+	(void)mailbox_transaction_commit(&trans);
+
+	test_quota_get(&bytes2, &count2);
+	test_assert_cmp(bytes2, ==, bytes - old_size + new_size);
+	test_assert_cmp(count2, ==, count);
+	test_quota_check();
+	test_end();
+}
+
+static void test_setup(void)
+{
+	test_ctx = test_mail_storage_init();
+	quota_plugin_init(&test_quota_module);
+
+	const char *const extra_input[] = {
+		"mail_plugins=quota",
+		"quota="TEST_QUOTA_ROOT_NAME,
+		"quota/"TEST_QUOTA_ROOT_NAME"/quota_driver=maildir",
+		"quota/"TEST_QUOTA_ROOT_NAME"/quota_storage_size=1G",
+		"quota/"TEST_QUOTA_ROOT_NAME"/quota_message_count=10000",
+		NULL
+	};
+	struct test_mail_storage_settings storage_set = {
+		.driver = "maildir",
+		.extra_input = extra_input,
+	};
+	test_mail_storage_init_user(test_ctx, &storage_set);
+
+	test_root = quota_root_lookup(test_ctx->user, TEST_QUOTA_ROOT_NAME);
+	if (test_root == NULL)
+		i_fatal("Quota root "TEST_QUOTA_ROOT_NAME" not found");
+	test_inbox = mailbox_alloc(test_ctx->user->namespaces->list,
+				   "INBOX", 0);
+	test_archive = mailbox_alloc(test_ctx->user->namespaces->list,
+				     "Archive", 0);
+	if (mailbox_create(test_archive, NULL, FALSE) < 0)
+		i_fatal("Failed to create mailbox: %s",
+			mailbox_get_last_internal_error(test_archive, NULL));
+	if (mailbox_open(test_inbox) < 0 || mailbox_open(test_archive) < 0)
+		i_fatal("Failed to open mailboxes");
+}
+
+static void test_teardown(void)
+{
+	mailbox_free(&test_inbox);
+	mailbox_free(&test_archive);
+	test_mail_storage_deinit_user(test_ctx);
+	quota_plugin_deinit();
+	test_mail_storage_deinit(&test_ctx);
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_setup,
+		test_quota_maildir_move,
+		test_quota_maildir_replace,
+		test_teardown,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-quota-maildir",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	settings_info_register(&quota_setting_parser_info);
+	settings_info_register(&quota_root_setting_parser_info);
+
+	test_dir_init("test-quota-maildir");
+	ret = test_run(tests);
+
+	master_service_deinit(&master_service);
+	return ret;
+}
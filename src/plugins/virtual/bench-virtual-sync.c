@@ -0,0 +1,245 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "strnum.h"
+#include "istream.h"
+#include "time-util.h"
+#include "write-full.h"
+#include "module-dir.h"
+#include "settings.h"
+#include "master-service.h"
+#include "test-common.h"
+#include "test-dir.h"
+#include "test-mail-storage-common.h"
+#include "virtual-settings.h"
+#include "virtual-plugin.h"
+#include "virtual-storage.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/**
+ * Measures how long it takes to sync (e.g. IMAP NOOP) a virtual mailbox
+ * that consists of many backend mailboxes, both when nothing has changed
+ * and when a single backend mailbox has a new mail. Parameters are the
+ * number of backend mailboxes and the number of mails in each of them.
+ */
+
+#define BENCH_MIN_MSECS 1000
+#define BENCH_DEFAULT_BOX_COUNT 50
+#define BENCH_DEFAULT_MAIL_COUNT 200
+#define BENCH_VIRTUAL_BOX_NAME "virtual/All"
+
+static unsigned int bench_box_count = BENCH_DEFAULT_BOX_COUNT;
+static unsigned int bench_mail_count = BENCH_DEFAULT_MAIL_COUNT;
+
+static struct module bench_virtual_module = {
+	.path = "lib20_virtual_plugin.so",
+	.name = "virtual_plugin",
+};
+
+static void bench_save_mails(struct mailbox *box, unsigned int count)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	string_t *mail = t_str_new(256);
+	unsigned int i;
+	int ret;
+
+	trans = mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_EXTERNAL,
+					  __func__);
+	for (i = 0; i < count; i++) {
+		str_truncate(mail, 0);
+		str_printfa(mail, "From: sender@example.com\n"
+			    "Subject: mail %u\n\nbody of mail %u\n", i, i);
+		input = i_stream_create_from_data(str_data(mail),
+						  str_len(mail));
+		save_ctx = mailbox_save_alloc(trans);
+		ret = mailbox_save_begin(&save_ctx, input);
+		while (ret == 0 && i_stream_read(input) > 0)
+			ret = mailbox_save_continue(save_ctx);
+		if (ret == 0)
+			ret = mailbox_save_finish(&save_ctx);
+		else
+			mailbox_save_cancel(&save_ctx);
+		i_stream_unref(&input);
+		if (ret < 0) {
+			i_fatal("Failed to save mail: %s",
+				mailbox_get_last_internal_error(box, NULL));
+		}
+	}
+	if (mailbox_transaction_commit(&trans) < 0) {
+		i_fatal("Failed to commit saves: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+}
+
+static void bench_create_backend_boxes(struct mail_user *user,
+				       unsigned int box_count,
+				       unsigned int mail_count)
+{
+	struct mailbox *box;
+	unsigned int i;
+
+	for (i = 0; i < box_count; i++) T_BEGIN {
+		box = mailbox_alloc(user->namespaces->list,
+				    t_strdup_printf("box%u", i), 0);
+		if (mailbox_create(box, NULL, FALSE) < 0 ||
+		    mailbox_open(box) < 0) {
+			i_fatal("Failed to create mailbox %s: %s",
+				mailbox_get_vname(box),
+				mailbox_get_last_internal_error(box, NULL));
+		}
+		bench_save_mails(box, mail_count);
+		mailbox_free(&box);
+	} T_END;
+}
+
+static void bench_create_virtual_box(const char *virtual_root)
+{
+	const char *dir, *path;
+	const char *config = "box*\n  all\n";
+	int fd;
+
+	dir = t_strdup_printf("%s/All", virtual_root);
+	if (mkdir(virtual_root, 0700) < 0 || mkdir(dir, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", dir);
+	path = t_strdup_printf("%s/"VIRTUAL_CONFIG_FNAME, dir);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", path);
+	if (write_full(fd, config, strlen(config)) < 0)
+		i_fatal("write(%s) failed: %m", path);
+	i_close_fd(&fd);
+}
+
+static void bench_sync(struct mailbox *box)
+{
+	if (mailbox_sync(box, 0) < 0) {
+		i_fatal("Failed to sync mailbox %s: %s", mailbox_get_vname(box),
+			mailbox_get_last_internal_error(box, NULL));
+	}
+}
+
+static void
+bench_noop(const char *name, struct mailbox *vbox, struct mailbox *backend_box)
+{
+	uint64_t ts_0, ts_1, syncs = 0, sync_nsecs = 0;
+
+	ts_0 = i_nanoseconds();
+	do {
+		if (backend_box != NULL) T_BEGIN {
+			/* the new mail isn't part of the measurement */
+			bench_save_mails(backend_box, 1);
+		} T_END;
+		ts_1 = i_nanoseconds();
+		bench_sync(vbox);
+		sync_nsecs += i_nanoseconds() - ts_1;
+		syncs++;
+	} while (i_nanoseconds() - ts_0 < BENCH_MIN_MSECS * 1000000ULL);
+
+	printf("%-10s %8"PRIu64" syncs %10.1f usecs/sync\n", name, syncs,
+	       (double)sync_nsecs / 1000.0 / (double)syncs);
+}
+
+static void bench_virtual_sync(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct mailbox *vbox, *backend_box;
+	struct mailbox_status status;
+	const char *virtual_root;
+	uint64_t ts_0;
+
+	ctx = test_mail_storage_init();
+	virtual_plugin_init(&bench_virtual_module);
+	virtual_root = t_strdup_printf("%s/testuser/virtual", ctx->home_root);
+	const char *const extra_input[] = {
+		"mail_plugins=virtual",
+		"namespace+=virtual",
+		"namespace/virtual/prefix=virtual/",
+		"namespace/virtual/separator=/",
+		"namespace/virtual/mail_driver=virtual",
+		t_strdup_printf("namespace/virtual/mail_path=%s", virtual_root),
+		NULL
+	};
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.hierarchy_sep = "/",
+		.extra_input = extra_input,
+	};
+	test_mail_storage_init_user(ctx, &set);
+
+	printf("%u backend mailboxes, %u mails in each\n",
+	       bench_box_count, bench_mail_count);
+	bench_create_backend_boxes(ctx->user, bench_box_count,
+				   bench_mail_count);
+	bench_create_virtual_box(virtual_root);
+
+	vbox = mailbox_alloc(mail_namespace_find(ctx->user->namespaces,
+						 BENCH_VIRTUAL_BOX_NAME)->list,
+			     BENCH_VIRTUAL_BOX_NAME, 0);
+	ts_0 = i_nanoseconds();
+	if (mailbox_open(vbox) < 0) {
+		i_fatal("Failed to open virtual mailbox: %s",
+			mailbox_get_last_internal_error(vbox, NULL));
+	}
+	bench_sync(vbox);
+	mailbox_get_open_status(vbox, STATUS_MESSAGES, &status);
+	printf("initial    %8u mails %10.1f usecs\n", status.messages,
+	       (double)(i_nanoseconds() - ts_0) / 1000.0);
+
+	bench_noop("unchanged", vbox, NULL);
+
+	backend_box = mailbox_alloc(ctx->user->namespaces->list, "box0", 0);
+	if (mailbox_open(backend_box) < 0) {
+		i_fatal("Failed to open mailbox: %s",
+			mailbox_get_last_internal_error(backend_box, NULL));
+	}
+	bench_noop("new mail", vbox, backend_box);
+	mailbox_free(&backend_box);
+	mailbox_free(&vbox);
+
+	test_mail_storage_deinit_user(ctx);
+	virtual_plugin_deinit();
+	test_mail_storage_deinit(&ctx);
+}
+
+static void ATTR_NORETURN print_usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [<backend mailbox count> [<mails per mailbox>]]\n",
+		progname);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	void (*const benches[])(void) = {
+		bench_virtual_sync,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("bench-virtual-sync",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	if (argc >= 2 && (str_to_uint(argv[1], &bench_box_count) < 0 ||
+			  bench_box_count == 0))
+		print_usage(argv[0]);
+	if (argc >= 3 && str_to_uint(argv[2], &bench_mail_count) < 0)
+		print_usage(argv[0]);
+	if (argc > 3)
+		print_usage(argv[0]);
+
+	test_dir_init("bench-virtual-sync");
+	ret = test_run(benches);
+
+	master_service_deinit(&master_service);
+	return ret;
+}
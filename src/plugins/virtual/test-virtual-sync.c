@@ -0,0 +1,226 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "lib-event-private.h"
+#include "event-filter.h"
+#include "istream.h"
+#include "write-full.h"
+#include "module-dir.h"
+#include "master-service.h"
+#include "test-common.h"
+#include "test-dir.h"
+#include "test-mail-storage-common.h"
+#include "virtual-plugin.h"
+#include "virtual-storage.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define TEST_VIRTUAL_BOX_NAME "virtual/Match"
+#define TEST_MATCH_COUNT 3
+
+static struct module test_virtual_module = {
+	.path = "lib20_virtual_plugin.so",
+	.name = "virtual_plugin",
+};
+
+static struct test_mail_storage_ctx *test_ctx;
+static const char *virtual_root;
+static unsigned int all_mails_read_count;
+
+static bool
+test_all_mails_read_callback(struct event *event,
+			     enum event_callback_type type,
+			     struct failure_context *ctx ATTR_UNUSED,
+			     const char *fmt ATTR_UNUSED,
+			     va_list args ATTR_UNUSED)
+{
+	if (type == EVENT_CALLBACK_TYPE_SEND &&
+	    null_strcmp(event->sending_name,
+			"virtual_sync_all_mails_read") == 0)
+		all_mails_read_count++;
+	return TRUE;
+}
+
+static void test_save_mail(struct mailbox *box, const char *subject)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	const char *mail;
+	int ret;
+
+	mail = t_strdup_printf("Subject: %s\n\nbody\n", subject);
+	input = i_stream_create_from_data(mail, strlen(mail));
+	trans = mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_EXTERNAL,
+					  __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	ret = mailbox_save_begin(&save_ctx, input);
+	while (ret == 0 && i_stream_read(input) > 0)
+		ret = mailbox_save_continue(save_ctx);
+	if (ret == 0)
+		ret = mailbox_save_finish(&save_ctx);
+	else
+		mailbox_save_cancel(&save_ctx);
+	i_stream_unref(&input);
+	if (ret < 0 || mailbox_transaction_commit(&trans) < 0) {
+		i_fatal("Failed to save mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+}
+
+static void
+test_create_backend_box(const char *name, const char *subject,
+			unsigned int count)
+{
+	struct mailbox *box;
+	unsigned int i;
+
+	box = mailbox_alloc(test_ctx->user->namespaces->list, name, 0);
+	if (mailbox_create(box, NULL, FALSE) < 0 || mailbox_open(box) < 0) {
+		i_fatal("Failed to create mailbox %s: %s",
+			mailbox_get_vname(box),
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	for (i = 0; i < count; i++)
+		test_save_mail(box, subject);
+	mailbox_free(&box);
+}
+
+static void test_create_virtual_box(void)
+{
+	const char *dir, *path;
+	const char *config = "box*\n  subject match\n";
+	int fd;
+
+	dir = t_strdup_printf("%s/Match", virtual_root);
+	if (mkdir(virtual_root, 0700) < 0 || mkdir(dir, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", dir);
+	path = t_strdup_printf("%s/"VIRTUAL_CONFIG_FNAME, dir);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", path);
+	if (write_full(fd, config, strlen(config)) < 0)
+		i_fatal("write(%s) failed: %m", path);
+	i_close_fd(&fd);
+}
+
+static struct mailbox *test_virtual_box_open(void)
+{
+	struct mail_namespace *ns;
+	struct mailbox *box;
+
+	ns = mail_namespace_find(test_ctx->user->namespaces,
+				 TEST_VIRTUAL_BOX_NAME);
+	box = mailbox_alloc(ns->list, TEST_VIRTUAL_BOX_NAME, 0);
+	if (mailbox_open(box) < 0) {
+		i_fatal("Failed to open virtual mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	return box;
+}
+
+static void test_virtual_box_sync(struct mailbox *box)
+{
+	struct mailbox_status status;
+
+	test_assert(mailbox_sync(box, 0) == 0);
+	mailbox_get_open_status(box, STATUS_MESSAGES, &status);
+	test_assert(status.messages == TEST_MATCH_COUNT);
+}
+
+static void test_virtual_sync_no_matches(void)
+{
+	struct event_filter *filter;
+	struct mailbox *box;
+	const char *error;
+
+	test_begin("virtual sync with a backend mailbox matching no mails");
+	test_create_backend_box("box1", "match", TEST_MATCH_COUNT);
+	test_create_backend_box("box2", "other", 2);
+	test_create_virtual_box();
+
+	/* the initial sync searches all the backend mailboxes */
+	box = test_virtual_box_open();
+	test_virtual_box_sync(box);
+	mailbox_free(&box);
+
+	event_register_callback(test_all_mails_read_callback);
+	filter = event_filter_create();
+	test_assert(event_filter_parse("event=virtual_sync_all_mails_read",
+				       filter, &error) == 0);
+	event_set_global_debug_log_filter(filter);
+	event_filter_unref(&filter);
+	all_mails_read_count = 0;
+
+	/* After reopening, the backend mailboxes are unchanged. Their UIDs
+	   are rebuilt from the virtual index, which is read once. */
+	box = test_virtual_box_open();
+	test_virtual_box_sync(box);
+	test_assert(all_mails_read_count == 1);
+
+	/* box2 has no UIDs in the virtual mailbox, but they're already
+	   known. It's not rescanned by the following syncs. */
+	test_virtual_box_sync(box);
+	test_virtual_box_sync(box);
+	test_assert(all_mails_read_count == 1);
+	mailbox_free(&box);
+
+	event_unset_global_debug_log_filter();
+	event_unregister_callback(test_all_mails_read_callback);
+	test_end();
+}
+
+static void test_setup(void)
+{
+	test_ctx = test_mail_storage_init();
+	virtual_plugin_init(&test_virtual_module);
+	virtual_root = p_strdup_printf(test_ctx->pool, "%s/testuser/virtual",
+				       test_ctx->home_root);
+	const char *const extra_input[] = {
+		"mail_plugins=virtual",
+		"namespace+=virtual",
+		"namespace/virtual/prefix=virtual/",
+		"namespace/virtual/separator=/",
+		"namespace/virtual/mail_driver=virtual",
+		t_strdup_printf("namespace/virtual/mail_path=%s", virtual_root),
+		NULL
+	};
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.hierarchy_sep = "/",
+		.extra_input = extra_input,
+	};
+	test_mail_storage_init_user(test_ctx, &set);
+}
+
+static void test_teardown(void)
+{
+	test_mail_storage_deinit_user(test_ctx);
+	virtual_plugin_deinit();
+	test_mail_storage_deinit(&test_ctx);
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_setup,
+		test_virtual_sync_no_matches,
+		test_teardown,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-virtual-sync",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	test_dir_init("test-virtual-sync");
+	ret = test_run(tests);
+
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -140,6 +140,7 @@ struct virtual_backend_box {
 	bool deleted:1;
 	bool notify_changes_started:1; /* if the box was opened for notify_changes */
 	bool first_sync:1; /* if this is the first sync after bbox was (re-)created */
+	bool uids_initialized:1; /* if uids have been filled since the bbox was created */
 };
 ARRAY_DEFINE_TYPE(virtual_backend_box, struct virtual_backend_box *);
 
@@ -630,6 +630,7 @@ static int virtual_sync_backend_box_init(struct virtual_backend_box *bbox)
 	/* add the found UIDs to uidmap. virtual_uid gets assigned later. */
 	i_zero(&uidmap);
 	array_clear(&bbox->uids);
+	bbox->uids_initialized = TRUE;
 	while (mailbox_search_next(search_ctx, &mail)) {
 		uidmap.real_uid = mail->uid;
 		array_push_back(&bbox->uids, &uidmap);
@@ -842,7 +843,52 @@ virtual_sync_backend_add_vmsgs_results(struct virtual_sync_context *ctx,
 		seq_range_array_add(&result->removed_uids, real_uid);
 }
 
-static void
+static int virtual_sync_mail_mailbox_cmp(const struct virtual_sync_mail *m1,
+					 const struct virtual_sync_mail *m2)
+{
+	if (m1->vrec.mailbox_id < m2->vrec.mailbox_id)
+		return -1;
+	if (m1->vrec.mailbox_id > m2->vrec.mailbox_id)
+		return 1;
+	return 0;
+}
+
+static int virtual_sync_bboxes_get_mails(struct virtual_sync_context *ctx)
+{
+	uint32_t messages, vseq, vuid, prev_vuid = 0;
+	const void *mail_data;
+	const struct virtual_mail_index_record *vrec;
+	struct virtual_sync_mail *sync_mail;
+
+	messages = mail_index_view_get_messages_count(ctx->sync_view);
+	e_debug(event_create_passthrough(ctx->mbox->box.event)->
+		set_name("virtual_sync_all_mails_read")->
+		add_int("messages", messages)->event(),
+		"Reading all %u virtual messages", messages);
+	i_array_init(&ctx->all_mails, messages);
+	for (vseq = 1; vseq <= messages; vseq++) {
+		mail_index_lookup_uid(ctx->sync_view, vseq, &vuid);
+		if (vuid <= prev_vuid) {
+			mail_storage_set_critical(ctx->mbox->box.storage,
+				"Corrupted virtual index: uid=%u followed by uid=%u",
+				prev_vuid, vuid);
+			mail_index_mark_corrupted(ctx->mbox->box.index);
+			return -1;
+		}
+		prev_vuid = vuid;
+
+		mail_index_lookup_ext(ctx->sync_view, vseq,
+				      ctx->mbox->virtual_ext_id, &mail_data, NULL);
+		vrec = mail_data;
+		sync_mail = array_append_space(&ctx->all_mails);
+		sync_mail->vseq = vseq;
+		sync_mail->vrec = *vrec;
+	}
+	array_sort(&ctx->all_mails, virtual_sync_mail_mailbox_cmp);
+	return 0;
+}
+
+static int
 virtual_sync_backend_handle_old_vmsgs(struct virtual_sync_context *ctx,
 				      struct virtual_backend_box *bbox,
 				      struct mail_search_result *result)
@@ -855,6 +901,18 @@ virtual_sync_backend_handle_old_vmsgs(struct virtual_sync_context *ctx,
 	/* find the messages that currently exist in virtual index and add them
 	   to the backend mailbox's list of uids. */
 	array_clear(&bbox->uids);
+	bbox->uids_initialized = TRUE;
+
+	/* we have different optimizations depending on whether the virtual
+	   mailbox consists of multiple backend boxes or just one. the list
+	   of all messages is built only when the first backend box needs it,
+	   so syncs where all the backend boxes already have their uids don't
+	   need to go through the whole virtual index. */
+	if (array_count(&ctx->mbox->backend_boxes) > 1 &&
+	    !array_is_created(&ctx->all_mails)) {
+		if (virtual_sync_bboxes_get_mails(ctx) < 0)
+			return -1;
+	}
 
 	if (array_is_created(&ctx->all_mails)) {
 		i_assert(ctx->all_mails_prev_mailbox_id < bbox->mailbox_id);
@@ -892,6 +950,7 @@ virtual_sync_backend_handle_old_vmsgs(struct virtual_sync_context *ctx,
 		}
 	}
 	virtual_sync_bbox_uids_sort(bbox);
+	return 0;
 }
 
 static int virtual_sync_backend_box_continue(struct virtual_sync_context *ctx,
@@ -917,7 +976,10 @@ static int virtual_sync_backend_box_continue(struct virtual_sync_context *ctx,
 					     result_flags);
 	mailbox_search_result_initial_done(result);
 	i_assert(array_count(&result->removed_uids) == 0);
-	virtual_sync_backend_handle_old_vmsgs(ctx, bbox, result);
+	if (virtual_sync_backend_handle_old_vmsgs(ctx, bbox, result) < 0) {
+		mailbox_search_result_free(&result);
+		return -1;
+	}
 	if (array_count(&result->removed_uids) > 0) {
 		/* these are all expunged messages. treat them separately from
 		   "no longer matching messages" (=removed_uids) */
@@ -1416,8 +1478,8 @@ static int virtual_sync_backend_box(struct virtual_sync_context *ctx,
 
 			   we'll still need to create the bbox->uids mapping
 			   using the current index. */
-			if (array_count(&bbox->uids) == 0)
-				virtual_sync_backend_handle_old_vmsgs(ctx, bbox, NULL);
+			if (!bbox->uids_initialized)
+				return virtual_sync_backend_handle_old_vmsgs(ctx, bbox, NULL);
 			return 0;
 		}
 		e_debug(ctx->mbox->box.event, "Backend mailbox %s changed: %s",
@@ -1811,47 +1873,6 @@ static void virtual_sync_deinit(struct virtual_sync_context **_ctx)
 	i_free(ctx);
 }
 
-static int virtual_sync_mail_mailbox_cmp(const struct virtual_sync_mail *m1,
-					 const struct virtual_sync_mail *m2)
-{
-	if (m1->vrec.mailbox_id < m2->vrec.mailbox_id)
-		return -1;
-	if (m1->vrec.mailbox_id > m2->vrec.mailbox_id)
-		return 1;
-	return 0;
-}
-
-static int virtual_sync_bboxes_get_mails(struct virtual_sync_context *ctx)
-{
-	uint32_t messages, vseq, vuid, prev_vuid = 0;
-	const void *mail_data;
-	const struct virtual_mail_index_record *vrec;
-	struct virtual_sync_mail *sync_mail;
-
-	messages = mail_index_view_get_messages_count(ctx->sync_view);
-	i_array_init(&ctx->all_mails, messages);
-	for (vseq = 1; vseq <= messages; vseq++) {
-		mail_index_lookup_uid(ctx->sync_view, vseq, &vuid);
-		if (vuid <= prev_vuid) {
-			mail_storage_set_critical(ctx->mbox->box.storage,
-				"Corrupted virtual index: uid=%u followed by uid=%u",
-				prev_vuid, vuid);
-			mail_index_mark_corrupted(ctx->mbox->box.index);
-			return -1;
-		}
-		prev_vuid = vuid;
-
-		mail_index_lookup_ext(ctx->sync_view, vseq,
-				      ctx->mbox->virtual_ext_id, &mail_data, NULL);
-		vrec = mail_data;
-		sync_mail = array_append_space(&ctx->all_mails);
-		sync_mail->vseq = vseq;
-		sync_mail->vrec = *vrec;
-	}
-	array_sort(&ctx->all_mails, virtual_sync_mail_mailbox_cmp);
-	return 0;
-}
-
 static int virtual_sync_backend_boxes(struct virtual_sync_context *ctx)
 {
 	struct virtual_backend_box *const *bboxes;
@@ -1864,13 +1885,6 @@ static int virtual_sync_backend_boxes(struct virtual_sync_context *ctx)
 	i_array_init(&ctx->all_adds, 128);
 	bboxes = array_get(&ctx->mbox->backend_boxes, &count);
 
-	/* we have different optimizations depending on whether the virtual
-	   mailbox consists of multiple backend boxes or just one */
-	if (count > 1) {
-		if (virtual_sync_bboxes_get_mails(ctx) < 0)
-			return -1;
-	}
-
 	for (i = 0; i < count; i++) {
 		struct virtual_backend_box *bbox = bboxes[i];
 		if (bbox->box->mailbox_deleted)